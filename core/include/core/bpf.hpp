@@ -5,44 +5,94 @@
 #include <cstdint>
 #include <cstdio>
 #include <linux/filter.h>
+#include <optional>
 #include <span>
+#include <vector>
 
 constexpr bool logBpfOps = false;
 
+// Classic BPF socket filter (SO_ATTACH_FILTER).
+// Programs are verified and translated into a pre-decoded form once, when they
+// are attached. run() executes that form for every packet without decoding or
+// checking the instructions again.
 struct Bpf {
-	enum class Op : uint16_t {
-		ALU_ADD_X = BPF_ALU | BPF_ADD | BPF_X,
-		ALU_AND_K = BPF_ALU | BPF_AND | BPF_K,
-		ALU_MUL_K = BPF_ALU | BPF_MUL | BPF_K,
-		JMP_JEQ_K = BPF_JMP | BPF_JEQ | BPF_K,
-		JMP_JSET_K = BPF_JMP | BPF_JSET | BPF_K,
-		LDX_W_IMM = BPF_LDX | BPF_W | BPF_IMM,
-		LD_B_IND = BPF_LD | BPF_B | BPF_IND,
-		LD_H_ABS = BPF_LD | BPF_H | BPF_ABS,
-		LD_H_IND = BPF_LD | BPF_H | BPF_IND,
-		LD_W_ABS = BPF_LD | BPF_W | BPF_ABS,
-		LD_W_IND = BPF_LD | BPF_W | BPF_IND,
-		MISC_TAX = BPF_MISC | BPF_TAX,
-		RET_A = BPF_RET | BPF_A,
-		RET_K = BPF_RET | BPF_K,
-	};
+	// Returns std::nullopt if the program is rejected by the verifier, i.e., if it
+	// contains unknown instructions, jumps out of the program, divides by a zero
+	// constant, reads scratch memory before writing it or does not end in a return.
+	static std::optional<Bpf> compile(std::span<const char> fprog);
+
+	// Returns the number of bytes of the packet to accept, zero to drop it.
+	// Loads outside of the packet and divisions by zero drop the packet.
+	uint32_t run(arch::dma_buffer_view buffer) const;
 
-	Bpf(std::span<char> fprog)
-		: prog_{
-			reinterpret_cast<struct sock_filter *>(fprog.data()),
-			fprog.size() / sizeof(struct sock_filter)
-		} {
+private:
+	// Dense numbering of the cBPF instructions. run() dispatches on these
+	// through a table of labels.
+	enum class Op : uint8_t {
+		LD_W_ABS,
+		LD_H_ABS,
+		LD_B_ABS,
+		LD_W_IND,
+		LD_H_IND,
+		LD_B_IND,
+		LD_W_LEN,
+		LD_IMM,
+		LD_MEM,
+		LDX_IMM,
+		LDX_LEN,
+		LDX_MEM,
+		LDX_MSH,
+		ST,
+		STX,
+		ALU_ADD_K,
+		ALU_ADD_X,
+		ALU_SUB_K,
+		ALU_SUB_X,
+		ALU_MUL_K,
+		ALU_MUL_X,
+		ALU_DIV_K,
+		ALU_DIV_X,
+		ALU_MOD_K,
+		ALU_MOD_X,
+		ALU_AND_K,
+		ALU_AND_X,
+		ALU_OR_K,
+		ALU_OR_X,
+		ALU_XOR_K,
+		ALU_XOR_X,
+		ALU_LSH_K,
+		ALU_LSH_X,
+		ALU_RSH_K,
+		ALU_RSH_X,
+		ALU_NEG,
+		JMP_JA,
+		JMP_JEQ_K,
+		JMP_JEQ_X,
+		JMP_JGT_K,
+		JMP_JGT_X,
+		JMP_JGE_K,
+		JMP_JGE_X,
+		JMP_JSET_K,
+		JMP_JSET_X,
+		RET_K,
+		RET_A,
+		MISC_TAX,
+		MISC_TXA,
+		count
+	};
 
-	}
+	struct Insn {
+		Op op;
+		// Absolute indices of the instructions that a conditional jump continues at.
+		// Programs are at most BPF_MAXINSNS long, hence these fit into 16 bits.
+		uint16_t jt;
+		uint16_t jf;
+		uint32_t k;
+	};
 
-	bool validate();
+	static std::optional<Op> decode(uint16_t code);
 
-	uint32_t run(arch::dma_buffer_view buffer);
-private:
-	std::span<struct sock_filter> prog_;
+	Bpf() = default;
 
-	// accumulator register
-	uint32_t A = 0;
-	// index register
-	uint32_t X = 0;
+	std::vector<Insn> insns_;
 };
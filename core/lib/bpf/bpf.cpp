@@ -1,137 +1,295 @@
 #include <arch/bit.hpp>
 #include <core/bpf.hpp>
+#include <cstring>
 
-bool Bpf::validate() {
-	for(size_t pc = 0; pc < prog_.size(); pc++) {
-		auto inst = prog_[pc];
-
-		switch(Op(inst.code)) {
-			case Op::JMP_JEQ_K:
-			// case Op::JMP_JEQ_X:
-			// case Op::JMP_JGE_K:
-			// case Op::JMP_JGE_X:
-			// case Op::JMP_JGT_K:
-			// case Op::JMP_JGT_X:
-			case Op::JMP_JSET_K:
-			// case Op::JMP_JSET_X:
-				if(pc + inst.jt + 1 >= prog_.size() || pc + inst.jf + 1 >= prog_.size())
-					return false;
-				break;
-			default:
-				break;
-		}
+std::optional<Bpf::Op> Bpf::decode(uint16_t code) {
+	switch(code) {
+		case BPF_LD | BPF_W | BPF_ABS: return Op::LD_W_ABS;
+		case BPF_LD | BPF_H | BPF_ABS: return Op::LD_H_ABS;
+		case BPF_LD | BPF_B | BPF_ABS: return Op::LD_B_ABS;
+		case BPF_LD | BPF_W | BPF_IND: return Op::LD_W_IND;
+		case BPF_LD | BPF_H | BPF_IND: return Op::LD_H_IND;
+		case BPF_LD | BPF_B | BPF_IND: return Op::LD_B_IND;
+		case BPF_LD | BPF_W | BPF_LEN: return Op::LD_W_LEN;
+		case BPF_LD | BPF_IMM: return Op::LD_IMM;
+		case BPF_LD | BPF_MEM: return Op::LD_MEM;
+		case BPF_LDX | BPF_W | BPF_IMM: return Op::LDX_IMM;
+		case BPF_LDX | BPF_W | BPF_LEN: return Op::LDX_LEN;
+		case BPF_LDX | BPF_W | BPF_MEM: return Op::LDX_MEM;
+		case BPF_LDX | BPF_B | BPF_MSH: return Op::LDX_MSH;
+		case BPF_ST: return Op::ST;
+		case BPF_STX: return Op::STX;
+		case BPF_ALU | BPF_ADD | BPF_K: return Op::ALU_ADD_K;
+		case BPF_ALU | BPF_ADD | BPF_X: return Op::ALU_ADD_X;
+		case BPF_ALU | BPF_SUB | BPF_K: return Op::ALU_SUB_K;
+		case BPF_ALU | BPF_SUB | BPF_X: return Op::ALU_SUB_X;
+		case BPF_ALU | BPF_MUL | BPF_K: return Op::ALU_MUL_K;
+		case BPF_ALU | BPF_MUL | BPF_X: return Op::ALU_MUL_X;
+		case BPF_ALU | BPF_DIV | BPF_K: return Op::ALU_DIV_K;
+		case BPF_ALU | BPF_DIV | BPF_X: return Op::ALU_DIV_X;
+		case BPF_ALU | BPF_MOD | BPF_K: return Op::ALU_MOD_K;
+		case BPF_ALU | BPF_MOD | BPF_X: return Op::ALU_MOD_X;
+		case BPF_ALU | BPF_AND | BPF_K: return Op::ALU_AND_K;
+		case BPF_ALU | BPF_AND | BPF_X: return Op::ALU_AND_X;
+		case BPF_ALU | BPF_OR | BPF_K: return Op::ALU_OR_K;
+		case BPF_ALU | BPF_OR | BPF_X: return Op::ALU_OR_X;
+		case BPF_ALU | BPF_XOR | BPF_K: return Op::ALU_XOR_K;
+		case BPF_ALU | BPF_XOR | BPF_X: return Op::ALU_XOR_X;
+		case BPF_ALU | BPF_LSH | BPF_K: return Op::ALU_LSH_K;
+		case BPF_ALU | BPF_LSH | BPF_X: return Op::ALU_LSH_X;
+		case BPF_ALU | BPF_RSH | BPF_K: return Op::ALU_RSH_K;
+		case BPF_ALU | BPF_RSH | BPF_X: return Op::ALU_RSH_X;
+		case BPF_ALU | BPF_NEG: return Op::ALU_NEG;
+		case BPF_JMP | BPF_JA: return Op::JMP_JA;
+		case BPF_JMP | BPF_JEQ | BPF_K: return Op::JMP_JEQ_K;
+		case BPF_JMP | BPF_JEQ | BPF_X: return Op::JMP_JEQ_X;
+		case BPF_JMP | BPF_JGT | BPF_K: return Op::JMP_JGT_K;
+		case BPF_JMP | BPF_JGT | BPF_X: return Op::JMP_JGT_X;
+		case BPF_JMP | BPF_JGE | BPF_K: return Op::JMP_JGE_K;
+		case BPF_JMP | BPF_JGE | BPF_X: return Op::JMP_JGE_X;
+		case BPF_JMP | BPF_JSET | BPF_K: return Op::JMP_JSET_K;
+		case BPF_JMP | BPF_JSET | BPF_X: return Op::JMP_JSET_X;
+		case BPF_RET | BPF_K: return Op::RET_K;
+		case BPF_RET | BPF_A: return Op::RET_A;
+		case BPF_MISC | BPF_TAX: return Op::MISC_TAX;
+		case BPF_MISC | BPF_TXA: return Op::MISC_TXA;
+		default: return std::nullopt;
 	}
+}
 
-	Op last = Op(prog_.back().code);
-	if(last != Op::RET_K && last != Op::RET_A)
-		return false;
+std::optional<Bpf> Bpf::compile(std::span<const char> fprog) {
+	if(fprog.size() % sizeof(struct sock_filter))
+		return std::nullopt;
+	size_t n = fprog.size() / sizeof(struct sock_filter);
+	if(!n || n > BPF_MAXINSNS)
+		return std::nullopt;
 
-	return true;
-}
+	Bpf bpf;
+	bpf.insns_.resize(n);
+
+	// Scratch memory words that are written on every path to an instruction.
+	// Jumps only go forward, hence a single pass visits all predecessors of an
+	// instruction before the instruction itself. Unreachable instructions keep
+	// all bits set.
+	std::vector<uint16_t> initialized(n, 0xFFFF);
+	initialized[0] = 0;
+	static_assert(BPF_MEMWORDS <= 16);
 
-uint32_t Bpf::run(arch::dma_buffer_view buffer) {
-	size_t pc = 0;
+	for(size_t pc = 0; pc < n; pc++) {
+		struct sock_filter inst;
+		memcpy(&inst, fprog.data() + pc * sizeof(inst), sizeof(inst));
 
-	auto bpf_log_op = [&pc, this](const char *format, auto ...args) {
-		if(logBpfOps) {
-			printf("\t[%.2zu/%.2zu] ", pc, prog_.size() - 1);
-			printf(format, args...);
-			puts("");
+		auto op = decode(inst.code);
+		if(!op) {
+			if(logBpfOps)
+				printf("core/bpf: rejecting unknown instruction 0x%02x at %zu\n", inst.code, pc);
+			return std::nullopt;
 		}
-	};
 
-	for(pc = 0; pc < prog_.size(); pc++) {
-		auto inst = prog_[pc];
-
-		auto load = [&buffer]<typename T>(size_t offset) -> T {
-			if(!(offset + sizeof(T) <= buffer.size())) {
-				printf("core/bpf: read of size 0x%zx at offset 0x%zx would be out of bounds (buffer size 0x%zx)",
-					sizeof(T), offset, buffer.size());
-				assert(offset + sizeof(T) <= buffer.size());
-			}
-			return arch::convert_endian<arch::endian::big>(*reinterpret_cast<T *>(buffer.subview(offset, sizeof(T)).data()));
-		};
-
-		switch(Op(inst.code)) {
-			case Op::ALU_ADD_X: {
-				bpf_log_op("A (0x%x) += X (0x%x) = 0x%x", A, X, A * X);
-				A += X;
-				break;
-			}
-			case Op::ALU_AND_K: {
-				bpf_log_op("A (0x%x) &= k (0x%x) = 0x%x", A, inst.k, A & inst.k);
-				A &= inst.k;
-				break;
-			}
-			case Op::ALU_MUL_K: {
-				bpf_log_op("A (0x%x) *= k (0x%x) = 0x%x", A, inst.k, A * inst.k);
-				A *= inst.k;
-				break;
-			}
-			case Op::JMP_JEQ_K: {
-				bpf_log_op("PC += 0x%02x if A == K (0x%x == 0x%x) else 0x%02x (0x%02x)", inst.jt, A, inst.k, inst.jf, (A == inst.k) ? inst.jt : inst.jf);
-				pc += (A == inst.k) ? inst.jt : inst.jf;
-				break;
-			}
-			case Op::JMP_JSET_K: {
-				bpf_log_op("PC += 0x%02x if A & k (0x%x & 0x%x) else 0x%02x (0x%02x)", inst.jt, A, inst.k, inst.jf, (A & inst.k) ? inst.jt : inst.jf);
-				pc += (A & inst.k) ? inst.jt : inst.jf;
-				break;
-			}
-			case Op::LDX_W_IMM: {
-				bpf_log_op("X <- k (0x%02x)", inst.k);
-				X = inst.k;
-				break;
-			}
-			case Op::LD_B_IND: {
-				auto val = load.template operator()<uint8_t>(X + inst.k);
-				bpf_log_op("A <- P[X+k:1 (0x%02x + 0x%02x)] (0x%hx)", X, inst.k, val);
-				A = val;
-				break;
-			}
-			case Op::LD_H_ABS: {
-				auto val = load.template operator()<uint16_t>(inst.k);
-				bpf_log_op("A <- P[k:2 (0x%02x)] = 0x%hx", inst.k, val);
-				A = val;
+		auto &insn = bpf.insns_[pc];
+		insn = {*op, 0, 0, inst.k};
+		auto mem = initialized[pc];
+
+		switch(*op) {
+			case Op::LD_W_ABS:
+			case Op::LD_H_ABS:
+			case Op::LD_B_ABS:
+				// Negative offsets select ancillary data (SKF_AD_OFF etc.), which we do not have.
+				if(static_cast<int32_t>(inst.k) < 0)
+					return std::nullopt;
 				break;
-			}
-			case Op::LD_H_IND: {
-				auto val = load.template operator()<uint16_t>(X + inst.k);
-				bpf_log_op("A <- P[X+k:2 (0x%02x + 0x%02x)] (0x%hx)", X, inst.k, val);
-				A = val;
+			case Op::LD_MEM:
+			case Op::LDX_MEM:
+				if(inst.k >= BPF_MEMWORDS || !(mem & (1 << inst.k)))
+					return std::nullopt;
 				break;
-			}
-			case Op::LD_W_ABS: {
-				auto val = load.template operator()<uint32_t>(inst.k);
-				bpf_log_op("A <- P[k:4 (0x%04x)] = 0x%x", inst.k, val);
-				A = val;
+			case Op::ST:
+			case Op::STX:
+				if(inst.k >= BPF_MEMWORDS)
+					return std::nullopt;
+				mem |= 1 << inst.k;
 				break;
-			}
-			case Op::LD_W_IND: {
-				auto val = load.template operator()<uint32_t>(X + inst.k);
-				bpf_log_op("A <- P[X+k:4 (0x%02x + 0x%02x)] (0x%hx)", X, inst.k, val);
-				A = val;
+			case Op::ALU_DIV_K:
+			case Op::ALU_MOD_K:
+				if(!inst.k)
+					return std::nullopt;
 				break;
-			}
-			case Op::MISC_TAX: {
-				bpf_log_op("X <- A (0x%02x)", A);
-				X = A;
+			case Op::ALU_LSH_K:
+			case Op::ALU_RSH_K:
+				if(inst.k >= 32)
+					return std::nullopt;
 				break;
-			}
-			case Op::RET_K: {
-				bpf_log_op("RET k (0x%02x)", inst.k);
-				return inst.k;
-			}
+			case Op::JMP_JA:
+				if(inst.k >= n - pc - 1)
+					return std::nullopt;
+				insn.jt = pc + 1 + inst.k;
+				initialized[insn.jt] &= mem;
+				continue;
+			case Op::JMP_JEQ_K:
+			case Op::JMP_JEQ_X:
+			case Op::JMP_JGT_K:
+			case Op::JMP_JGT_X:
+			case Op::JMP_JGE_K:
+			case Op::JMP_JGE_X:
+			case Op::JMP_JSET_K:
+			case Op::JMP_JSET_X:
+				if(pc + inst.jt + 1 >= n || pc + inst.jf + 1 >= n)
+					return std::nullopt;
+				insn.jt = pc + 1 + inst.jt;
+				insn.jf = pc + 1 + inst.jf;
+				initialized[insn.jt] &= mem;
+				initialized[insn.jf] &= mem;
+				continue;
+			case Op::RET_K:
+			case Op::RET_A:
+				continue;
 			default:
-				// TODO: for now, an unknown BPF instruction is a hard failure as our coverage of
-				// the instruction set is quite incomplete. In the future, once that doesn't hold
-				// any more, we should do proper error handling here instead (e.g. return EINVAL).
-				printf("core: unhandled BPF instruction 0x%02x\n", inst.code);
-				bpf_log_op("{ 0x%02x, %.2u, %.2u, 0x%08x }\n", inst.code, inst.jt, inst.jf, inst.k);
-				assert(!"unhandled BPF instruction");
+				break;
 		}
 
+		// Execution falls through to the next instruction, which must exist.
+		if(pc + 1 == n)
+			return std::nullopt;
+		initialized[pc + 1] &= mem;
+	}
+
+	if(logBpfOps) {
+		for(size_t pc = 0; pc < n; pc++) {
+			auto &insn = bpf.insns_[pc];
+			printf("\t[%.2zu] op %u, jt %u, jf %u, k 0x%x\n", pc,
+				static_cast<unsigned int>(insn.op), insn.jt, insn.jf, insn.k);
+		}
 	}
 
-	assert(!"invalid BPF filter with no return!");
+	return bpf;
+}
+
+uint32_t Bpf::run(arch::dma_buffer_view buffer) const {
+	// Threaded dispatch: each instruction jumps straight to the code of its successor
+	// instead of returning to a central switch.
+	static void *const labels[] = {
+		&&LD_W_ABS, &&LD_H_ABS, &&LD_B_ABS,
+		&&LD_W_IND, &&LD_H_IND, &&LD_B_IND,
+		&&LD_W_LEN, &&LD_IMM, &&LD_MEM,
+		&&LDX_IMM, &&LDX_LEN, &&LDX_MEM, &&LDX_MSH,
+		&&ST, &&STX,
+		&&ALU_ADD_K, &&ALU_ADD_X, &&ALU_SUB_K, &&ALU_SUB_X,
+		&&ALU_MUL_K, &&ALU_MUL_X, &&ALU_DIV_K, &&ALU_DIV_X,
+		&&ALU_MOD_K, &&ALU_MOD_X, &&ALU_AND_K, &&ALU_AND_X,
+		&&ALU_OR_K, &&ALU_OR_X, &&ALU_XOR_K, &&ALU_XOR_X,
+		&&ALU_LSH_K, &&ALU_LSH_X, &&ALU_RSH_K, &&ALU_RSH_X,
+		&&ALU_NEG,
+		&&JMP_JA,
+		&&JMP_JEQ_K, &&JMP_JEQ_X, &&JMP_JGT_K, &&JMP_JGT_X,
+		&&JMP_JGE_K, &&JMP_JGE_X, &&JMP_JSET_K, &&JMP_JSET_X,
+		&&RET_K, &&RET_A,
+		&&MISC_TAX, &&MISC_TXA,
+	};
+	static_assert(sizeof(labels) / sizeof(*labels) == static_cast<size_t>(Op::count));
+
+	auto packet = static_cast<const uint8_t *>(buffer.data());
+	auto length = buffer.size();
+
+	auto load = [&]<typename T>(uint64_t offset, T &value) -> bool {
+		if(offset + sizeof(T) > length)
+			return false;
+		memcpy(&value, packet + offset, sizeof(T));
+		value = arch::convert_endian<arch::endian::big>(value);
+		return true;
+	};
+
+	// accumulator register
+	uint32_t A = 0;
+	// index register
+	uint32_t X = 0;
+	// scratch memory; the verifier ensures that words are written before they are read
+	uint32_t M[BPF_MEMWORDS] = {};
+
+	auto base = insns_.data();
+	auto insn = base;
+
+#define BPF_DISPATCH() goto *labels[static_cast<size_t>(insn->op)]
+#define BPF_NEXT() do { insn++; BPF_DISPATCH(); } while(0)
+#define BPF_LOAD(T, offset) do { \
+		T value; \
+		if(!load(offset, value)) \
+			return 0; \
+		A = value; \
+		BPF_NEXT(); \
+	} while(0)
+#define BPF_BRANCH(cond) do { \
+		insn = base + ((cond) ? insn->jt : insn->jf); \
+		BPF_DISPATCH(); \
+	} while(0)
+
+	BPF_DISPATCH();
+
+LD_W_ABS: BPF_LOAD(uint32_t, insn->k);
+LD_H_ABS: BPF_LOAD(uint16_t, insn->k);
+LD_B_ABS: BPF_LOAD(uint8_t, insn->k);
+LD_W_IND: BPF_LOAD(uint32_t, uint64_t{X} + insn->k);
+LD_H_IND: BPF_LOAD(uint16_t, uint64_t{X} + insn->k);
+LD_B_IND: BPF_LOAD(uint8_t, uint64_t{X} + insn->k);
+LD_W_LEN: A = length; BPF_NEXT();
+LD_IMM: A = insn->k; BPF_NEXT();
+LD_MEM: A = M[insn->k]; BPF_NEXT();
+LDX_IMM: X = insn->k; BPF_NEXT();
+LDX_LEN: X = length; BPF_NEXT();
+LDX_MEM: X = M[insn->k]; BPF_NEXT();
+LDX_MSH: {
+	uint8_t value;
+	if(!load(insn->k, value))
+		return 0;
+	X = (value & 0xF) << 2;
+	BPF_NEXT();
+}
+ST: M[insn->k] = A; BPF_NEXT();
+STX: M[insn->k] = X; BPF_NEXT();
+ALU_ADD_K: A += insn->k; BPF_NEXT();
+ALU_ADD_X: A += X; BPF_NEXT();
+ALU_SUB_K: A -= insn->k; BPF_NEXT();
+ALU_SUB_X: A -= X; BPF_NEXT();
+ALU_MUL_K: A *= insn->k; BPF_NEXT();
+ALU_MUL_X: A *= X; BPF_NEXT();
+ALU_DIV_K: A /= insn->k; BPF_NEXT();
+ALU_DIV_X:
+	if(!X)
+		return 0;
+	A /= X;
+	BPF_NEXT();
+ALU_MOD_K: A %= insn->k; BPF_NEXT();
+ALU_MOD_X:
+	if(!X)
+		return 0;
+	A %= X;
+	BPF_NEXT();
+ALU_AND_K: A &= insn->k; BPF_NEXT();
+ALU_AND_X: A &= X; BPF_NEXT();
+ALU_OR_K: A |= insn->k; BPF_NEXT();
+ALU_OR_X: A |= X; BPF_NEXT();
+ALU_XOR_K: A ^= insn->k; BPF_NEXT();
+ALU_XOR_X: A ^= X; BPF_NEXT();
+ALU_LSH_K: A <<= insn->k; BPF_NEXT();
+ALU_LSH_X: A = (X < 32) ? (A << X) : 0; BPF_NEXT();
+ALU_RSH_K: A >>= insn->k; BPF_NEXT();
+ALU_RSH_X: A = (X < 32) ? (A >> X) : 0; BPF_NEXT();
+ALU_NEG: A = -A; BPF_NEXT();
+JMP_JA: insn = base + insn->jt; BPF_DISPATCH();
+JMP_JEQ_K: BPF_BRANCH(A == insn->k);
+JMP_JEQ_X: BPF_BRANCH(A == X);
+JMP_JGT_K: BPF_BRANCH(A > insn->k);
+JMP_JGT_X: BPF_BRANCH(A > X);
+JMP_JGE_K: BPF_BRANCH(A >= insn->k);
+JMP_JGE_X: BPF_BRANCH(A >= X);
+JMP_JSET_K: BPF_BRANCH(A & insn->k);
+JMP_JSET_X: BPF_BRANCH(A & X);
+RET_K: return insn->k;
+RET_A: return A;
+MISC_TAX: X = A; BPF_NEXT();
+MISC_TXA: A = X; BPF_NEXT();
+
+#undef BPF_DISPATCH
+#undef BPF_NEXT
+#undef BPF_LOAD
+#undef BPF_BRANCH
 }
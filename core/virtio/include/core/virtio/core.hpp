@@ -68,10 +68,19 @@ enum {
 	DEVICE_NEEDS_RESET = 64
 };
 
+// Device-independent feature bits.
+enum {
+	VIRTIO_RING_F_INDIRECT_DESC = 28
+};
+
 enum {
 	// Bits of the spec::Descriptor::flags field.
 	VIRTQ_DESC_F_NEXT = 1, // descriptor is part of a chain
 	VIRTQ_DESC_F_WRITE = 2, // buffer is written by device
+	VIRTQ_DESC_F_INDIRECT = 4, // buffer contains a table of descriptors
+
+	// Bits of the spec::AvailableRing::flags field.
+	VIRTQ_AVAIL_F_NO_INTERRUPT = 1, // no need to interrupt the driver
 
 	// Bits of the spec::UsedRing::flags field.
 	VIRTQ_USED_F_NO_NOTIFY = 1 // no need to notify the device
@@ -153,6 +162,9 @@ struct Transport {
 
 	virtual protocols::hw::Device &hwDevice() = 0;
 
+	// Legacy devices use guest-endian structures and cannot offer feature bits >= 32.
+	virtual bool isLegacy() = 0;
+
 	virtual uint8_t loadConfig8(size_t offset) = 0;
 	virtual uint16_t loadConfig16(size_t offset) = 0;
 	virtual uint32_t loadConfig32(size_t offset) = 0;
@@ -183,7 +195,7 @@ struct DeviceSpace {
 		} else {
 			static_assert(sizeof(typename RT::rep_type) == 4,
 					"Unsupported size for DeviceSpace::load()");
-			auto v = _transport->loadConfig16(r.offset());
+			auto v = _transport->loadConfig32(r.offset());
 			return static_cast<typename RT::rep_type>(v);
 		}
 	}
@@ -216,6 +228,50 @@ struct DeviceToHostType { };
 inline constexpr HostToDeviceType hostToDevice;
 inline constexpr DeviceToHostType deviceToHost;
 
+// Physically contiguous piece of a buffer.
+struct PhysicalSegment {
+	uintptr_t physical;
+	size_t length;
+};
+
+// Splits a virtually contiguous buffer into physically contiguous segments.
+// Physically adjacent pages are merged into segments of at most max_length bytes.
+// The buffer must be mapped (and locked) in the current address space.
+std::vector<PhysicalSegment> physicalSegments(arch::dma_buffer_view view,
+		size_t max_length = size_t{1} << 31);
+
+// Table of descriptors that is referenced by a single virtq descriptor
+// (see VIRTIO_RING_F_INDIRECT_DESC). Must be kept alive until the device
+// returns the referencing descriptor.
+struct IndirectTable {
+	IndirectTable(arch::dma_pool *pool, size_t capacity);
+
+	size_t size() {
+		return _size;
+	}
+
+	size_t capacity() {
+		return _table.size();
+	}
+
+	void append(HostToDeviceType, PhysicalSegment segment);
+	void append(DeviceToHostType, PhysicalSegment segment);
+
+	// Note the remarks on Handle::setupBuffer().
+	void append(HostToDeviceType, arch::dma_buffer_view view);
+	void append(DeviceToHostType, arch::dma_buffer_view view);
+
+	arch::dma_buffer_view view() {
+		return _table.view_buffer().subview(0, _size * sizeof(spec::Descriptor));
+	}
+
+private:
+	spec::Descriptor *_append(uintptr_t physical, size_t length);
+
+	arch::dma_array<spec::Descriptor> _table;
+	size_t _size = 0;
+};
+
 // Handle to a virtq descriptor.
 struct Handle {
 	Handle()
@@ -236,8 +292,16 @@ struct Handle {
 	void setupBuffer(HostToDeviceType, arch::dma_buffer_view view);
 	void setupBuffer(DeviceToHostType, arch::dma_buffer_view view);
 
+	// Like setupBuffer() but takes a physically contiguous segment.
+	void setupSegment(HostToDeviceType, PhysicalSegment segment);
+	void setupSegment(DeviceToHostType, PhysicalSegment segment);
+
 	void setupLink(Handle other);
 
+	// Makes this descriptor refer to an indirect descriptor table.
+	// Cannot be combined with other buffers in the same chain.
+	void setupIndirect(IndirectTable &table);
+
 private:
 	Queue *_queue;
 	size_t _tableIndex;
@@ -273,6 +337,13 @@ struct Chain {
 		_back.setupBuffer(deviceToHost, view);
 	}
 
+	void setupSegment(HostToDeviceType, PhysicalSegment segment) {
+		_back.setupSegment(hostToDevice, segment);
+	}
+	void setupSegment(DeviceToHostType, PhysicalSegment segment) {
+		_back.setupSegment(deviceToHost, segment);
+	}
+
 private:
 	Handle _front;
 	Handle _back;
@@ -309,6 +380,11 @@ public:
 		return _queueSize;
 	}
 
+	// Returns the number of descriptors that can be obtained without blocking.
+	size_t numFreeDescriptors() {
+		return _descriptorStack.size();
+	}
+
 	// Allocates a single descriptor.
 	// The descriptor is automatically freed when the device returns it.
 	async::result<Handle> obtainDescriptor();
@@ -338,8 +414,13 @@ public:
 
 	// Processes interrupts for this virtq.
 	// Calls retrieveDescriptor() to complete individual requests.
+	// Can also be called without an interrupt to poll the virtq.
 	void processInterrupt();
 
+	// Asks the device to (not) interrupt us when it returns descriptors.
+	// This is only a hint; drivers that disable interrupts need to poll.
+	void setInterruptsEnabled(bool enabled);
+
 protected:
 	virtual void notifyTransport() = 0;
 
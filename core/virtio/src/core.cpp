@@ -1,5 +1,6 @@
 
 #include <assert.h>
+#include <algorithm>
 #include <iostream>
 #include <unordered_map>
 #include <optional>
@@ -87,6 +88,10 @@ struct LegacyPciTransport : Transport {
 		return _hwDevice;
 	}
 
+	bool isLegacy() override {
+		return true;
+	}
+
 	uint8_t loadConfig8(size_t offset) override;
 	uint16_t loadConfig16(size_t offset) override;
 	uint32_t loadConfig32(size_t offset) override;
@@ -284,6 +289,10 @@ struct StandardPciTransport : Transport {
 		return _hwDevice;
 	}
 
+	bool isLegacy() override {
+		return false;
+	}
+
 	uint8_t loadConfig8(size_t offset) override;
 	uint16_t loadConfig16(size_t offset) override;
 	uint32_t loadConfig32(size_t offset) override;
@@ -746,12 +755,116 @@ void Handle::setupBuffer(DeviceToHostType, arch::dma_buffer_view view) {
 	descriptor->flags.store(descriptor->flags.load() | VIRTQ_DESC_F_WRITE);
 }
 
+void Handle::setupSegment(HostToDeviceType, PhysicalSegment segment) {
+	assert(segment.length);
+
+	auto descriptor = _queue->_table + _tableIndex;
+	descriptor->address.store(segment.physical);
+	descriptor->length.store(segment.length);
+}
+
+void Handle::setupSegment(DeviceToHostType, PhysicalSegment segment) {
+	assert(segment.length);
+
+	auto descriptor = _queue->_table + _tableIndex;
+	descriptor->address.store(segment.physical);
+	descriptor->length.store(segment.length);
+	descriptor->flags.store(descriptor->flags.load() | VIRTQ_DESC_F_WRITE);
+}
+
 void Handle::setupLink(Handle other) {
 	auto descriptor = _queue->_table + _tableIndex;
 	descriptor->next.store(other._tableIndex);
 	descriptor->flags.store(descriptor->flags.load() | VIRTQ_DESC_F_NEXT);
 }
 
+void Handle::setupIndirect(IndirectTable &table) {
+	assert(table.size());
+
+	uintptr_t physical;
+	HEL_CHECK(helPointerPhysical(table.view().data(), &physical));
+
+	auto descriptor = _queue->_table + _tableIndex;
+	descriptor->address.store(physical);
+	descriptor->length.store(table.view().size());
+	descriptor->flags.store(VIRTQ_DESC_F_INDIRECT);
+}
+
+// --------------------------------------------------------
+// Scatter-gather helpers
+// --------------------------------------------------------
+
+std::vector<PhysicalSegment> physicalSegments(arch::dma_buffer_view view,
+		size_t max_length) {
+	constexpr size_t page_size = 0x1000;
+	assert(max_length >= page_size);
+
+	std::vector<PhysicalSegment> segments;
+	size_t offset = 0;
+	while(offset < view.size()) {
+		auto address = reinterpret_cast<uintptr_t>(view.data()) + offset;
+		auto chunk = std::min(view.size() - offset, page_size - (address & (page_size - 1)));
+
+		uintptr_t physical;
+		HEL_CHECK(helPointerPhysical(reinterpret_cast<void *>(address), &physical));
+
+		if(!segments.empty()
+				&& segments.back().physical + segments.back().length == physical
+				&& segments.back().length + chunk <= max_length) {
+			segments.back().length += chunk;
+		}else{
+			segments.push_back({physical, chunk});
+		}
+		offset += chunk;
+	}
+	return segments;
+}
+
+IndirectTable::IndirectTable(arch::dma_pool *pool, size_t capacity)
+: _table{pool, capacity} { }
+
+spec::Descriptor *IndirectTable::_append(uintptr_t physical, size_t length) {
+	assert(length);
+	assert(_size < _table.size());
+
+	auto descriptor = _table.data() + _size;
+	descriptor->address.store(physical);
+	descriptor->length.store(length);
+	descriptor->flags.store(0);
+	descriptor->next.store(0);
+
+	// Link the previous descriptor to the new one.
+	if(_size) {
+		auto previous = _table.data() + _size - 1;
+		previous->next.store(_size);
+		previous->flags.store(previous->flags.load() | VIRTQ_DESC_F_NEXT);
+	}
+
+	_size++;
+	return descriptor;
+}
+
+void IndirectTable::append(HostToDeviceType, PhysicalSegment segment) {
+	_append(segment.physical, segment.length);
+}
+
+void IndirectTable::append(DeviceToHostType, PhysicalSegment segment) {
+	auto descriptor = _append(segment.physical, segment.length);
+	descriptor->flags.store(VIRTQ_DESC_F_WRITE);
+}
+
+void IndirectTable::append(HostToDeviceType, arch::dma_buffer_view view) {
+	uintptr_t physical;
+	HEL_CHECK(helPointerPhysical(view.data(), &physical));
+	append(hostToDevice, PhysicalSegment{physical, view.size()});
+}
+
+void IndirectTable::append(DeviceToHostType, arch::dma_buffer_view view) {
+	uintptr_t physical;
+	HEL_CHECK(helPointerPhysical(view.data(), &physical));
+	append(deviceToHost, PhysicalSegment{physical, view.size()});
+}
+
 async::result<void> scatterGather(HostToDeviceType, Chain &chain, Queue *queue,
 		arch::dma_buffer_view view) {
 	constexpr size_t page_size = 0x1000;
@@ -854,6 +967,12 @@ void Queue::notify() {
 		notifyTransport();
 }
 
+void Queue::setInterruptsEnabled(bool enabled) {
+	_availableRing->flags.store(enabled ? 0 : VIRTQ_AVAIL_F_NO_INTERRUPT);
+	// Make sure that the device sees the flag before we poll the used ring again.
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
 void Queue::processInterrupt() {
 	while(true) {
 		auto used_head = _usedRing->headIndex.load();
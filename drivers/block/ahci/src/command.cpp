@@ -65,6 +65,13 @@ void Command::prepare(commandTable& table, commandHeader& header) {
 			table.commandFis.command = 0x35; // WRITE DMA EXT
 			header.configBytes[0] |= 1 << 6; // Indicates we are writing
 			break;
+		case CommandType::writeFua:
+			table.commandFis.command = 0x3D; // WRITE DMA FUA EXT
+			header.configBytes[0] |= 1 << 6; // Indicates we are writing
+			break;
+		case CommandType::flush:
+			table.commandFis.command = 0xEA; // FLUSH CACHE EXT
+			break;
 		case CommandType::identify:
 			table.commandFis.command = 0xEC; // IDENTIFY DEVICE
 			break;
@@ -101,6 +108,10 @@ size_t Command::writeScatterGather_(commandTable& table) {
 		};
 	};
 
+	// Non-data commands such as FLUSH CACHE EXT do not need a PRDT.
+	if (!numBytes_)
+		return 0;
+
 	uintptr_t virtStart = reinterpret_cast<uintptr_t>(buffer_);
 	uintptr_t virtEnd = virtStart + numBytes_;
 	assert(virtEnd > virtStart);
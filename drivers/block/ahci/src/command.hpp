@@ -7,6 +7,8 @@
 enum class CommandType {
 	read,
 	write,
+	writeFua,
+	flush,
 	identify
 };
 
@@ -22,6 +24,11 @@ public:
 		assert(type == CommandType::identify);
 	}
 
+	explicit Command(CommandType type)
+		: Command(0, 0, 0, nullptr, type) {
+		assert(type == CommandType::flush);
+	}
+
 	void prepare(commandTable& table, commandHeader& header);
 	void notifyCompletion(); 
 
@@ -47,6 +54,10 @@ constexpr const char *cmdTypeToString(CommandType type) {
 			return "read";
 		case CommandType::write:
 			return "write";
+		case CommandType::writeFua:
+			return "FUA write";
+		case CommandType::flush:
+			return "flush";
 		case CommandType::identify:
 			return "identify";
 		default:
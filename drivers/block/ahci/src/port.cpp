@@ -55,6 +55,8 @@ Port::Port(int64_t parentId, int portIndex, size_t numCommandSlots, bool stagger
 	numCommandSlots_{numCommandSlots}, commandsInFlight_{0}, portIndex_{portIndex}, 
 	staggeredSpinUp_{staggeredSpinUp}
 {
+	// Keep the request queue from dispatching more commands than we have slots.
+	maxQueueDepth = numCommandSlots;
 }
 
 async::result<bool> Port::init() {
@@ -194,6 +196,8 @@ async::result<bool> Port::run() {
 	auto sectorCount = identify->maxLBA48;
 	auto model = identify->getModel();
 	deviceSize_ = logicalSize * sectorCount;
+	writeCache_ = identify->hasWriteCache() && identify->supportsFlushCacheExt();
+	writeFua_ = writeCache_ && identify->supportsWriteFua();
 
 	printf("block/ahci: Started port %d, model %s, size %.1fGiB (sectors: logical %zu, physical %zu, count %" PRIu64 ")\n",
 			portIndex_, model.c_str(), static_cast<float>(deviceSize_ / (1 << 30)),
@@ -338,6 +342,31 @@ async::result<void> Port::writeSectors(uint64_t sector, const void *buffer, size
 	co_await cmd.getFuture();
 }
 
+async::result<void> Port::writeSectorsFua(uint64_t sector, const void *buffer, size_t numSectors) {
+	if (!writeFua_) {
+		co_await writeSectors(sector, buffer, numSectors);
+		(void)co_await flushCache();
+		co_return;
+	}
+
+	Command cmd{sector, numSectors, numSectors * sectorSize,
+			const_cast<void *>(buffer), CommandType::writeFua};
+	pendingCmdQueue_.put(&cmd);
+	co_await cmd.getFuture();
+}
+
+async::result<frg::expected<protocols::fs::Error>> Port::flushCache() {
+	// Without a write cache, completed writes are already on the medium.
+	if (!writeCache_)
+		co_return {};
+
+	// Failed commands are caught by checkErrors(), hence the flush succeeded once it completes.
+	Command cmd{CommandType::flush};
+	pendingCmdQueue_.put(&cmd);
+	co_await cmd.getFuture();
+	co_return {};
+}
+
 async::result<size_t> Port::getSize() {
 	assert(deviceSize_ != 0);
 	co_return deviceSize_;
@@ -28,6 +28,8 @@ public:
 
 	async::result<void> readSectors(uint64_t sector, void *buf, size_t numSectors) override;
 	async::result<void> writeSectors(uint64_t sector, const void *buf, size_t numSectors) override;
+	async::result<void> writeSectorsFua(uint64_t sector, const void *buf, size_t numSectors) override;
+	async::result<frg::expected<protocols::fs::Error>> flushCache() override;
 	async::result<size_t> getSize() override;
 
 	int getIndex() const { return portIndex_; }
@@ -68,4 +70,8 @@ private:
 	size_t commandsInFlight_;
 	int portIndex_;
 	bool staggeredSpinUp_;
+
+	// Determined from IDENTIFY DEVICE.
+	bool writeCache_ = false;
+	bool writeFua_ = false;
 };
@@ -90,9 +90,12 @@ static_assert(alignof(commandTable) >= 128);
 struct identifyDevice {
 	uint16_t _junkA[27];
 	uint16_t model[20];
-	uint16_t _junkB[36];
+	uint16_t _junkB[35];
+	uint16_t commandSets;
 	uint16_t capabilities;
-	uint16_t _junkC[16];
+	uint16_t commandSetsExt;
+	uint16_t commandSetsEnabled;
+	uint16_t _junkC[14];
 	uint64_t maxLBA48;
 	uint16_t _junkD[2];
 	uint16_t sectorSizeInfo;
@@ -143,5 +146,18 @@ struct identifyDevice {
 	bool supportsLba48() const {
 		return capabilities & (1 << 10);
 	}
+
+	// Whether the volatile write cache is enabled, i.e., writes need to be flushed.
+	bool hasWriteCache() const {
+		return (commandSets & (1 << 5)) && (commandSetsEnabled & (1 << 5));
+	}
+
+	bool supportsFlushCacheExt() const {
+		return capabilities & (1 << 13);
+	}
+
+	bool supportsWriteFua() const {
+		return commandSetsExt & (1 << 6);
+	}
 };
 static_assert(sizeof(identifyDevice) == 512);
@@ -30,9 +30,19 @@ struct Command {
 		return view_;
 	}
 
+	// Commands that ask for polling are sent to a polled I/O queue (if there is one).
+	void setPolled(bool polled) {
+		polled_ = polled;
+	}
+
+	bool isPolled() const {
+		return polled_;
+	}
+
 private:
 	spec::Command command_;
 	async::promise<Result, frg::stl_allocator> promise_;
 	std::vector<arch::dma_array<uint64_t>> prpLists;
 	arch::dma_buffer_view view_;
+	bool polled_ = false;
 };
@@ -1,5 +1,10 @@
+#include <algorithm>
 #include <arch/bit.hpp>
+#include <array>
+#include <bit>
+#include <core/cmdline.hpp>
 #include <format>
+#include <frg/cmdline.hpp>
 #include <helix/timer.hpp>
 #include <protocols/mbus/client.hpp>
 
@@ -80,7 +85,9 @@ async::detached PciExpressController::handleIrqs(helix::UniqueDescriptor irq) {
 
 		int found = 0;
 		for (auto &q : activeQueues_) {
-			found |= static_cast<PciExpressQueue *>(q.get())->handleIrq();
+			auto pq = static_cast<PciExpressQueue *>(q.get());
+			if (!pq->isPolled())
+				found |= pq->handleIrq();
 		}
 
 		regs_.store(regs::intmc, 1);
@@ -93,33 +100,29 @@ async::detached PciExpressController::handleIrqs(helix::UniqueDescriptor irq) {
 	}
 }
 
-async::detached PciExpressController::handleMsis(helix::UniqueDescriptor irq, size_t queueId, bool isMsiX) {
-	irqSequence_ = 0;
+async::detached PciExpressController::handleMsis(helix::UniqueDescriptor irq, size_t vector, bool isMsiX) {
+	uint64_t sequence = 0;
 
 	while (true) {
-		auto awaitResult = co_await helix_ng::awaitEvent(irq, irqSequence_);
-
-		auto q = std::ranges::find_if(activeQueues_, [queueId](auto &q) {
-			return q->getQueueId() == queueId;
-		});
-
-		if(q == activeQueues_.end()) {
-			std::cout << std::format("nvme: Queue ID {} not found, quitting", queueId) << std::endl;
-			break;
-		}
+		auto awaitResult = co_await helix_ng::awaitEvent(irq, sequence);
 
 		if(!isMsiX)
-			regs_.store(regs::intms, 1 << queueId);
+			regs_.store(regs::intms, 1 << vector);
 
 		HEL_CHECK(awaitResult.error());
-		irqSequence_ = awaitResult.sequence();
+		sequence = awaitResult.sequence();
 
-		static_cast<PciExpressQueue *>(q->get())->handleIrq();
+		// Multiple queues may share a vector if the device has fewer vectors than queues.
+		for (auto &q : activeQueues_) {
+			auto pq = static_cast<PciExpressQueue *>(q.get());
+			if (pq->interruptVector() == vector && !pq->isPolled())
+				pq->handleIrq();
+		}
 
 		if(!isMsiX)
-			regs_.store(regs::intmc, 1 << queueId);
+			regs_.store(regs::intmc, 1 << vector);
 
-		HEL_CHECK(helAcknowledgeIrq(irq.getHandle(), kHelAckAcknowledge, irqSequence_));
+		HEL_CHECK(helAcknowledgeIrq(irq.getHandle(), kHelAckAcknowledge, sequence));
 	}
 }
 
@@ -146,14 +149,17 @@ async::result<void> PciExpressController::disable() {
 	co_await waitStatus(false);
 }
 
-async::result<void> PciExpressController::setupIOQueueInterrupts(size_t queueId, size_t vector) {
+async::result<void> PciExpressController::setupInterruptVector(size_t vector) {
 	if(irqMode_ == InterruptMode::Msi || irqMode_ == InterruptMode::MsiX) {
 		auto irq = co_await hwDevice_.installMsi(vector);
-		handleMsis(std::move(irq), queueId, irqMode_ == InterruptMode::MsiX);
+		handleMsis(std::move(irq), vector, irqMode_ == InterruptMode::MsiX);
 	}
 }
 
 async::result<void> PciExpressController::reset() {
+	using arch::convert_endian;
+	using arch::endian;
+
 	auto cap = regs_.load(regs::cap);
 	const auto doorbellsOffset = 0x1000;
 
@@ -162,14 +168,22 @@ async::result<void> PciExpressController::reset() {
 
 	version_ = regs_.load(regs::vs);
 
+	Cmdline cmdHelper;
+	auto cmdline = co_await cmdHelper.get();
+	frg::array args = {
+		frg::option{"nvme.poll-queues", frg::as_number(numPollQueues_)},
+	};
+	frg::parse_arguments(cmdline.c_str(), args);
+
 	co_await disable();
 
 	auto info = co_await hwDevice_.getPciInfo();
 
 	if(info.numMsis) {
 		irqMode_ = info.msiX ? InterruptMode::MsiX : InterruptMode::Msi;
+		numVectors_ = info.numMsis;
 		co_await hwDevice_.enableMsi();
-		co_await setupIOQueueInterrupts(0, 0);
+		co_await setupInterruptVector(0);
 	} else {
 		irqMode_ = InterruptMode::LegacyIrq;
 		auto irq = co_await hwDevice_.accessIrq();
@@ -190,17 +204,52 @@ async::result<void> PciExpressController::reset() {
 
 	co_await enable();
 
-	requestIoQueues(1, 1);
-
-	co_await setupIOQueueInterrupts(1, 1);
-	auto ioQ = std::make_unique<PciExpressQueue>(1, queueDepth_, regs_.subspace(doorbellsOffset + 1 * 8 * dbStride_), 1);
-	co_await ioQ->init();
+	// Ask for one I/O queue per CPU that we can run on.
+	std::array<uint8_t, 64> affinity{};
+	size_t affinitySize;
+	HEL_CHECK(helGetAffinity(kHelThisThread, affinity.data(), affinity.size(), &affinitySize));
+	size_t numCpus = 0;
+	for (size_t i = 0; i < affinitySize; i++)
+		numCpus += std::popcount(affinity[i]);
+	auto wantedQueues = std::clamp(numCpus, size_t{1}, MAX_IO_QUEUES);
+
+	// The controller may grant fewer queues than we asked for.
+	size_t numIoQueues = 1;
+	auto queuesRes = co_await requestIoQueues(wantedQueues, wantedQueues);
+	if (queuesRes.first.successful()) {
+		auto granted = convert_endian<endian::little>(queuesRes.second.u32);
+		numIoQueues = std::min({wantedQueues, size_t{(granted & 0xFFFF) + 1u},
+				size_t{(granted >> 16) + 1u}});
+	}
+	numPollQueues_ = std::min(numPollQueues_, static_cast<unsigned int>(numIoQueues - 1));
+
+	for (size_t i = 1; i <= numIoQueues; i++) {
+		// Vector 0 is used by the admin queue; it is only shared if we run out of vectors.
+		bool polled = i > numIoQueues - numPollQueues_;
+		size_t vector = 0;
+		if (numVectors_ > 1)
+			vector = (i - 1) % (numVectors_ - 1) + 1;
+		if (!polled && vector == i)
+			co_await setupInterruptVector(vector);
+
+		auto ioQ = std::make_unique<PciExpressQueue>(i, queueDepth_,
+				regs_.subspace(doorbellsOffset + i * 8 * dbStride_), vector, polled);
+		co_await ioQ->init();
+
+		if (!(co_await setupIoQueue(ioQ.get())))
+			break;
 
-	if (co_await setupIoQueue(ioQ.get())) {
 		ioQ->run();
+		if (polled)
+			pollQueues_.push_back(ioQ.get());
+		else
+			irqQueues_.push_back(ioQ.get());
 		activeQueues_.push_back(std::move(ioQ));
 	}
 
+	std::cout << std::format("block/nvme: using {} I/O queues ({} polled) and {} interrupt vectors",
+			irqQueues_.size() + pollQueues_.size(), pollQueues_.size(), numVectors_) << std::endl;
+
 	assert(activeQueues_.size() >= 2 && "At least need one IO queue");
 }
 
@@ -236,7 +285,9 @@ async::result<Command::Result> PciExpressController::createCQ(PciExpressQueue *q
 	auto cmd = std::make_unique<Command>();
 	auto &cmdBuf = cmd->getCommandBuffer().createCQ;
 
-	uint16_t flags = spec::kQueuePhysContig | spec::kCQIrqEnabled;
+	uint16_t flags = spec::kQueuePhysContig;
+	if (!q->isPolled())
+		flags |= spec::kCQIrqEnabled;
 
 	cmdBuf.opcode = static_cast<uint8_t>(spec::AdminOpcode::CreateCQ);
 	cmdBuf.prp1 = convert_endian<endian::little, endian::native>((uint64_t)q->getCqPhysAddr());
@@ -345,6 +396,7 @@ async::result<void> Controller::scanNamespaces() {
 	model = std::string{idCtrl.mn, sizeof(idCtrl.mn)};
 	serial = std::string{idCtrl.sn, sizeof(idCtrl.sn)};
 	fw_rev = std::string{idCtrl.fr, sizeof(idCtrl.fr)};
+	volatileWriteCache_ = idCtrl.vwc & 1;
 
 	if (version_ >= flags::vs::version(1, 1, 0)) {
 		auto nsList = arch::dma_array<uint32_t>{nullptr, 1024};
@@ -390,6 +442,7 @@ async::result<void> Controller::createNamespace(unsigned int nsid) {
 		lbaShift = 9;
 
 	auto ns = std::make_unique<Namespace>(this, nsid, lbaShift, id.nsze);
+	ns->maxQueueDepth = maxIoQueueDepth();
 	activeNamespaces_.push_back(std::move(ns));
 }
 
@@ -399,8 +452,22 @@ async::result<Command::Result> PciExpressController::submitAdminCommand(std::uni
 	return q->submitCommand(std::move(cmd));
 }
 
+Queue *PciExpressController::pickIoQueue(bool polled) {
+	auto &queues = (polled && !pollQueues_.empty()) ? pollQueues_ : irqQueues_;
+
+	// Start the search at a rotating position such that idle queues are used in turn.
+	auto start = nextQueue_++;
+	Queue *best = nullptr;
+	for (size_t i = 0; i < queues.size(); i++) {
+		auto q = queues[(start + i) % queues.size()];
+		if (!best || q->commandsInFlight() < best->commandsInFlight())
+			best = q;
+	}
+	return best;
+}
+
 async::result<Command::Result> PciExpressController::submitIoCommand(std::unique_ptr<Command> cmd) {
-	auto &ioQ = activeQueues_.back();
+	auto ioQ = pickIoQueue(cmd->isPolled());
 
 	return ioQ->submitCommand(std::move(cmd));
 }
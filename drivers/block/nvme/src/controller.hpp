@@ -56,6 +56,19 @@ struct Controller {
 		return preferredDataTransfer_;
 	}
 
+	// Whether the controller has a volatile write cache that needs to be flushed.
+	bool hasVolatileWriteCache() const {
+		return volatileWriteCache_;
+	}
+
+	// Number of I/O commands that can be in flight at the same time.
+	size_t maxIoQueueDepth() const {
+		size_t depth = 0;
+		for (size_t i = 1; i < activeQueues_.size(); i++)
+			depth += activeQueues_[i]->getQueueDepth();
+		return std::max(depth, size_t{1});
+	}
+
 protected:
 	spec::DataTransfer preferredDataTransfer_ = spec::DataTransfer::PRP;
 
@@ -69,6 +82,8 @@ protected:
 	std::string model;
 	std::string fw_rev;
 
+	bool volatileWriteCache_ = false;
+
 	std::vector<std::unique_ptr<Queue>> activeQueues_;
 	std::vector<std::unique_ptr<Namespace>> activeNamespaces_;
 };
@@ -81,9 +96,13 @@ struct PciExpressController final : public Controller {
 	async::result<Command::Result> submitAdminCommand(std::unique_ptr<Command> cmd) override;
 	async::result<Command::Result> submitIoCommand(std::unique_ptr<Command> cmd) override;
 private:
-	async::result<void> setupIOQueueInterrupts(size_t queueId, size_t vector);
+	async::result<void> setupInterruptVector(size_t vector);
+
+	// Returns the least loaded polled or interrupt-driven I/O queue.
+	Queue *pickIoQueue(bool polled);
 
 	static constexpr int IO_QUEUE_DEPTH = 1024;
+	static constexpr size_t MAX_IO_QUEUES = 64;
 
 	protocols::hw::Device hwDevice_;
 	std::string location_;
@@ -95,6 +114,15 @@ private:
 
 	uint64_t irqSequence_;
 	InterruptMode irqMode_;
+	unsigned int numVectors_ = 1;
+
+	// Number of I/O queues that use polled completions instead of interrupts.
+	unsigned int numPollQueues_ = 0;
+
+	// Polled queues only receive commands that ask for polling.
+	std::vector<Queue *> irqQueues_;
+	std::vector<Queue *> pollQueues_;
+	size_t nextQueue_ = 0;
 
 	async::result<void> reset();
 
@@ -108,5 +136,5 @@ private:
 	async::result<Command::Result> createSQ(PciExpressQueue *q);
 
 	async::detached handleIrqs(helix::UniqueDescriptor irq);
-	async::detached handleMsis(helix::UniqueDescriptor irq, size_t queueId, bool isMsiX);
+	async::detached handleMsis(helix::UniqueDescriptor irq, size_t vector, bool isMsiX);
 };
@@ -6,6 +6,14 @@
 #include "namespace.hpp"
 #include "controller.hpp"
 
+namespace {
+
+// Reads up to this size ask for polled completion. They are usually synchronous
+// (e.g., page faults) and hence benefit most from the lower latency.
+constexpr size_t maxPolledRead = 0x1000;
+
+} // namespace
+
 Namespace::Namespace(Controller *controller, unsigned int nsid, int lbaShift, size_t lbaCount)
 	: BlockDevice{(size_t)1 << lbaShift, -1}, controller_(controller), nsid_(nsid),
 	  lbaShift_(lbaShift), lbaCount_{lbaCount} {
@@ -42,11 +50,20 @@ async::result<void> Namespace::readSectors(uint64_t sector, void *buffer, size_t
 	cmdBuf.startLba = convert_endian<endian::little, endian::native>(sector);
 	cmdBuf.length = convert_endian<endian::little, endian::native>((uint16_t)numSectors - 1);
 	cmd->setupBuffer(arch::dma_buffer_view{nullptr, buffer, numSectors << lbaShift_}, controller_->dataTransferPolicy());
+	cmd->setPolled((numSectors << lbaShift_) <= maxPolledRead);
 
 	co_await controller_->submitIoCommand(std::move(cmd));
 }
 
 async::result<void> Namespace::writeSectors(uint64_t sector, const void *buffer, size_t numSectors) {
+	co_await write_(sector, buffer, numSectors, false);
+}
+
+async::result<void> Namespace::writeSectorsFua(uint64_t sector, const void *buffer, size_t numSectors) {
+	co_await write_(sector, buffer, numSectors, controller_->hasVolatileWriteCache());
+}
+
+async::result<void> Namespace::write_(uint64_t sector, const void *buffer, size_t numSectors, bool fua) {
 	using arch::convert_endian;
 	using arch::endian;
 
@@ -57,11 +74,35 @@ async::result<void> Namespace::writeSectors(uint64_t sector, const void *buffer,
 	cmdBuf.nsid = convert_endian<endian::little, endian::native>(nsid_);
 	cmdBuf.startLba = convert_endian<endian::little, endian::native>(sector);
 	cmdBuf.length = convert_endian<endian::little, endian::native>((uint16_t)numSectors - 1);
+	if (fua)
+		cmdBuf.control = convert_endian<endian::little, endian::native>(uint16_t{spec::kReadWriteFua});
 	cmd->setupBuffer(arch::dma_buffer_view{nullptr, (char *)buffer, numSectors << lbaShift_}, controller_->dataTransferPolicy());
 
 	co_await controller_->submitIoCommand(std::move(cmd));
 }
 
+async::result<frg::expected<protocols::fs::Error>> Namespace::flushCache() {
+	using arch::convert_endian;
+	using arch::endian;
+
+	// Without a volatile write cache, completed writes are already durable.
+	if (!controller_->hasVolatileWriteCache())
+		co_return {};
+
+	auto cmd = std::make_unique<Command>();
+	auto &cmdBuf = cmd->getCommandBuffer().common;
+
+	cmdBuf.opcode = spec::kFlush;
+	cmdBuf.namespaceId = convert_endian<endian::little, endian::native>(nsid_);
+
+	auto res = co_await controller_->submitIoCommand(std::move(cmd));
+	if (!res.first.successful()) {
+		std::cout << std::format("block/nvme: flush of namespace {} failed", nsid_) << std::endl;
+		co_return protocols::fs::Error::internalError;
+	}
+	co_return {};
+}
+
 async::result<size_t> Namespace::getSize() {
 	co_return lbaCount_ << lbaShift_;
 }
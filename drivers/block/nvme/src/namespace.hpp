@@ -14,11 +14,15 @@ struct Namespace : blockfs::BlockDevice {
 
 	async::result<void> readSectors(uint64_t sector, void *buf, size_t numSectors) override;
 	async::result<void> writeSectors(uint64_t sector, const void *buf, size_t numSectors) override;
+	async::result<void> writeSectorsFua(uint64_t sector, const void *buf, size_t numSectors) override;
+	async::result<frg::expected<protocols::fs::Error>> flushCache() override;
 	async::result<size_t> getSize() override;
 
 	async::result<void> handleIoctl(managarm::fs::GenericIoctlRequest &req, helix::UniqueDescriptor conversation) override;
 
 private:
+	async::result<void> write_(uint64_t sector, const void *buf, size_t numSectors, bool fua);
+
 	Controller *controller_;
 	unsigned int nsid_;
 	int lbaShift_;
@@ -1,12 +1,15 @@
+#include <algorithm>
 #include <arch/bit.hpp>
 #include <helix/ipc.hpp>
 #include <helix/memory.hpp>
+#include <helix/timer.hpp>
 
 #include "queue.hpp"
 #include "spec.hpp"
 
-PciExpressQueue::PciExpressQueue(unsigned int qid, unsigned int depth, arch::mem_space doorbells, size_t interruptVector)
-	: Queue(qid, depth), doorbells_(doorbells), sqTail_(0), cqHead_(0), cqPhase_(1), interruptVector_{interruptVector} {
+PciExpressQueue::PciExpressQueue(unsigned int qid, unsigned int depth, arch::mem_space doorbells, size_t interruptVector, bool polled)
+	: Queue(qid, depth), doorbells_(doorbells), sqTail_(0), cqHead_(0), cqPhase_(1), interruptVector_{interruptVector},
+		polled_{polled} {
 
 }
 
@@ -40,10 +43,36 @@ async::result<void> PciExpressQueue::init() {
 
 async::detached PciExpressQueue::run() {
 	submitPendingLoop();
+	if (polled_)
+		pollLoop();
 
 	co_return;
 }
 
+async::detached PciExpressQueue::pollLoop() {
+	// Delay between polls of an empty CQ, in nanoseconds. It doubles (up to the maximum)
+	// for every empty poll such that long-running commands do not keep the CPU busy.
+	constexpr uint64_t minBackoff = 1'000;
+	constexpr uint64_t maxBackoff = 64'000;
+	uint64_t backoff = 0;
+
+	while (true) {
+		if (!commandsInFlight_) {
+			co_await pollDoorbell_.async_wait();
+			backoff = 0;
+			continue;
+		}
+
+		if (handleIrq()) {
+			backoff = 0;
+			continue;
+		}
+
+		backoff = std::clamp(backoff * 2, minBackoff, maxBackoff);
+		co_await helix::sleepFor(backoff);
+	}
+}
+
 int PciExpressQueue::handleIrq() {
 	using arch::convert_endian;
 	using arch::endian;
@@ -115,7 +144,8 @@ async::result<void> PciExpressQueue::submitCommandToDevice(std::unique_ptr<Comma
 	doorbells_.store(arch::scalar_register<uint32_t>{0}, sqTail_);
 
 	queuedCmds_[slot] = std::move(cmd);
-	commandsInFlight_++;
+	if (!commandsInFlight_++ && polled_)
+		pollDoorbell_.raise();
 }
 
 async::result<Command::Result> PciExpressQueue::submitCommand(std::unique_ptr<Command> cmd) {
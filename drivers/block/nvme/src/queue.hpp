@@ -28,6 +28,9 @@ struct Queue {
 	unsigned int getQueueDepth() const {
 		return depth_;
 	}
+	size_t commandsInFlight() const {
+		return commandsInFlight_;
+	}
 
 	async::result<size_t> findFreeSlot();
 
@@ -42,7 +45,7 @@ protected:
 };
 
 struct PciExpressQueue final : Queue {
-	PciExpressQueue(unsigned int index, unsigned int depth, arch::mem_space doorbells, size_t interruptVector = 0);
+	PciExpressQueue(unsigned int index, unsigned int depth, arch::mem_space doorbells, size_t interruptVector = 0, bool polled = false);
 
 	async::result<void> init() override;
 	async::detached run() override;
@@ -58,6 +61,11 @@ struct PciExpressQueue final : Queue {
 		return interruptVector_;
 	}
 
+	// Polled queues do not raise interrupts; their completions are reaped by pollLoop().
+	bool isPolled() const {
+		return polled_;
+	}
+
 	int handleIrq();
 
 private:
@@ -70,8 +78,11 @@ private:
 	uint16_t cqHead_;
 	uint8_t cqPhase_;
 	size_t interruptVector_;
+	bool polled_;
+	async::recurring_event pollDoorbell_;
 
 	async::detached submitPendingLoop();
+	async::detached pollLoop();
 
 	async::result<Command::Result> submitCommand(std::unique_ptr<Command> cmd) override;
 	async::result<void> submitCommandToDevice(std::unique_ptr<Command> cmd);
@@ -12,10 +12,16 @@ enum class DataTransfer {
 };
 
 enum CommandOpcode {
+	kFlush = 0x00,
 	kWrite = 0x01,
 	kRead = 0x02,
 };
 
+enum ReadWriteControl {
+	// Force Unit Access: the command completes only once the data is on non-volatile media.
+	kReadWriteFua = 1 << 14,
+};
+
 enum class AdminOpcode {
 	DeleteSQ = 0x0,
 	CreateSQ = 0x1,
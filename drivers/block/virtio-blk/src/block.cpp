@@ -1,5 +1,6 @@
 
 #include <stdlib.h>
+#include <algorithm>
 #include <iostream>
 
 #include "block.hpp"
@@ -9,151 +10,267 @@ namespace virtio {
 
 static bool logInitiateRetire = false;
 
+// Upper bound on the number of virtqs that we set up.
+constexpr size_t maxQueues = 8;
+
+// Upper bound on the number of data segments per request.
+constexpr size_t maxRequestSegments = 256;
+
+constexpr size_t pageSize = 0x1000;
+
 // --------------------------------------------------------
 // UserRequest
 // --------------------------------------------------------
 
-UserRequest::UserRequest(bool write_, uint64_t sector_, void *buffer_, size_t num_sectors_)
-: write{write_}, sector{sector_}, buffer{buffer_}, numSectors{num_sectors_} { }
+UserRequest::UserRequest(arch::dma_pool *pool, uint32_t type_, uint64_t sector_,
+		void *buffer_, size_t num_sectors_)
+: type{type_}, sector{sector_}, buffer{buffer_}, numSectors{num_sectors_},
+		header{pool}, status{pool} { }
 
 // --------------------------------------------------------
 // Device
 // --------------------------------------------------------
 
 Device::Device(std::unique_ptr<virtio_core::Transport> transport, int64_t parent_id)
-: blockfs::BlockDevice{512, parent_id}, _transport{std::move(transport)},
-		_requestQueue{nullptr}, _size{0} { }
+: blockfs::BlockDevice{512, parent_id}, _transport{std::move(transport)}, _size{0} { }
 
 void Device::runDevice() {
+	if(_transport->checkDeviceFeature(virtio_core::VIRTIO_RING_F_INDIRECT_DESC)) {
+		_transport->acknowledgeDriverFeature(virtio_core::VIRTIO_RING_F_INDIRECT_DESC);
+		_indirect = true;
+	}
+
+	if(_transport->checkDeviceFeature(VIRTIO_BLK_F_FLUSH)) {
+		_transport->acknowledgeDriverFeature(VIRTIO_BLK_F_FLUSH);
+		_flush = true;
+	}
+
+	size_t seg_max = 0;
+	if(_transport->checkDeviceFeature(VIRTIO_BLK_F_SEG_MAX)) {
+		_transport->acknowledgeDriverFeature(VIRTIO_BLK_F_SEG_MAX);
+		seg_max = _transport->space().load(spec::regs::segMax);
+	}
+
+	// We split buffers at page granularity, hence we cannot honor smaller limits.
+	_maxSegmentSize = size_t{1} << 31;
+	if(_transport->checkDeviceFeature(VIRTIO_BLK_F_SIZE_MAX)) {
+		auto size_max = _transport->space().load(spec::regs::sizeMax);
+		if(size_max >= pageSize) {
+			_transport->acknowledgeDriverFeature(VIRTIO_BLK_F_SIZE_MAX);
+			_maxSegmentSize = size_max & ~(pageSize - 1);
+		}
+	}
+
+	size_t num_queues = 1;
+	if(_transport->checkDeviceFeature(VIRTIO_BLK_F_MQ)) {
+		_transport->acknowledgeDriverFeature(VIRTIO_BLK_F_MQ);
+		num_queues = std::clamp(static_cast<size_t>(
+				_transport->space().load(spec::regs::numQueues)), size_t{1}, maxQueues);
+	}
+
 	_transport->finalizeFeatures();
-	_transport->claimQueues(1);
-	_requestQueue = _transport->setupQueue(0);
+	_transport->claimQueues(num_queues);
+	for(size_t i = 0; i < num_queues; i++) {
+		auto queue = std::make_unique<RequestQueue>();
+		queue->virtq = _transport->setupQueue(i);
+		_queues.push_back(std::move(queue));
+	}
 
 	auto size = static_cast<uint64_t>(_transport->space().load(spec::regs::capacity[0]))
 			| (static_cast<uint64_t>(_transport->space().load(spec::regs::capacity[1])) << 32);
 	std::cout << "virtio: Disk size: " << size << " sectors" << std::endl;
 	_size = size;
 
-	_transport->runDevice();
-
-	// perform device specific setup
-	virtRequestBuffer = new VirtRequest[_requestQueue->numDescriptors()];
-	statusBuffer = new uint8_t[_requestQueue->numDescriptors()];
+	// Each request needs a descriptor for its header and status byte.
+	// Without indirect descriptors, limit the chain length
+	// to ensure that a single request does not monopolize the virtq.
+	auto num_descriptors = _queues.front()->virtq->numDescriptors();
+	if(_indirect) {
+		_maxSegments = num_descriptors - 2;
+	}else{
+		_maxSegments = num_descriptors / 4 - 2;
+	}
+	_maxSegments = std::min(_maxSegments, maxRequestSegments);
+	if(seg_max)
+		_maxSegments = std::min(_maxSegments, seg_max);
+	assert(_maxSegments >= 2);
+
+	// Since the buffer is only sector aligned, it can straddle one more page
+	// than the transfer size suggests.
+	_maxSectors = (_maxSegments - 1) * (pageSize / 512);
+
+	// Allow the request queue to fill all virtqs.
+	if(_indirect) {
+		maxQueueDepth = _queues.size() * num_descriptors;
+	}else{
+		maxQueueDepth = _queues.size() * (num_descriptors / (_maxSegments + 2));
+	}
+	std::cout << "virtio: Using " << _queues.size() << " virtqs, "
+			<< (_indirect ? "indirect" : "direct") << " descriptors and up to "
+			<< _maxSegments << " segments per request"
+			<< (_flush ? " (write cache enabled)" : "") << std::endl;
 
-	// natural alignment makes sure that request headers do not cross page boundaries
-	assert((uintptr_t)virtRequestBuffer % sizeof(VirtRequest) == 0);
+	_transport->runDevice();
 
-	// setup an interrupt for the device
-	_processRequests();
+	for(auto &queue : _queues)
+		_processRequests(queue.get());
 
 	blockfs::runDevice(this);
 }
 
 async::result<void> Device::readSectors(uint64_t sector,
 		void *buffer, size_t num_sectors) {
-	// Natural alignment makes sure a sector does not cross a page boundary.
-	assert(!((uintptr_t)buffer % 512));
-//	printf("readSectors(%lu, %lu)\n", sector, num_sectors);
+	co_await _transfer(false, sector, buffer, num_sectors);
+}
 
-	// Limit to ensure that we don't monopolize the device.
-	auto max_sectors = _requestQueue->numDescriptors() / 4;
-	assert(max_sectors >= 1);
+async::result<void> Device::writeSectors(uint64_t sector,
+		const void *buffer, size_t num_sectors) {
+	co_await _transfer(true, sector, const_cast<void *>(buffer), num_sectors);
+}
 
-	for(size_t progress = 0; progress < num_sectors; progress += max_sectors) {
-		auto request = new UserRequest(false, sector + progress,
-				(char *)buffer + 512 * progress,
-				std::min(num_sectors - progress, max_sectors));
-		_pendingQueue.push(request);
-		_pendingDoorbell.raise();
-		co_await request->event.wait();
-		delete request;
+async::result<frg::expected<protocols::fs::Error>> Device::flushCache() {
+	// Without VIRTIO_BLK_F_FLUSH, the device does not cache writes.
+	if(!_flush)
+		co_return {};
+
+	UserRequest request{&_dmaPool, VIRTIO_BLK_T_FLUSH, 0, nullptr, 0};
+	_submitRequest(&request);
+	co_await request.event.wait();
+	if(*request.status.data()) {
+		std::cout << "\e[31m" "virtio: Flush failed with status "
+				<< static_cast<int>(*request.status.data()) << "\e[39m" << std::endl;
+		co_return protocols::fs::Error::internalError;
 	}
+	co_return {};
 }
 
-async::result<void> Device::writeSectors(uint64_t sector,
-		const void *buffer, size_t num_sectors) {
+async::result<size_t> Device::getSize() {
+	co_return _size * 512;
+}
+
+async::result<void> Device::_transfer(bool write, uint64_t sector,
+		void *buffer, size_t num_sectors) {
 	// Natural alignment makes sure a sector does not cross a page boundary.
 	assert(!((uintptr_t)buffer % 512));
-//	printf("writeSectors(%lu, %lu)\n", sector, num_sectors);
-
-	// Limit to ensure that we don't monopolize the device.
-	auto max_sectors = _requestQueue->numDescriptors() / 4;
-	assert(max_sectors >= 1);
 
-	for(size_t progress = 0; progress < num_sectors; progress += max_sectors) {
-		auto request = new UserRequest(true, sector + progress,
+	// Submit all chunks before waiting for any of them,
+	// such that the device can process them in parallel.
+	std::vector<std::unique_ptr<UserRequest>> requests;
+	for(size_t progress = 0; progress < num_sectors; progress += _maxSectors) {
+		auto request = std::make_unique<UserRequest>(&_dmaPool,
+				write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN, sector + progress,
 				(char *)buffer + 512 * progress,
-				std::min(num_sectors - progress, max_sectors));
-		_pendingQueue.push(request);
-		_pendingDoorbell.raise();
+				std::min(num_sectors - progress, _maxSectors));
+		_submitRequest(request.get());
+		requests.push_back(std::move(request));
+	}
+
+	for(auto &request : requests) {
 		co_await request->event.wait();
-		delete request;
+		if(*request->status.data())
+			std::cout << "\e[31m" "virtio: Request at sector " << request->sector
+					<< " failed with status " << static_cast<int>(*request->status.data())
+					<< "\e[39m" << std::endl;
 	}
 }
 
-async::result<size_t> Device::getSize() {
-	co_return _size * 512;
+void Device::_submitRequest(UserRequest *request) {
+	// Distribute requests to the virtq with the least outstanding work.
+	auto queue = std::ranges::min_element(_queues, {}, [] (auto &q) {
+		return q->numInflight + q->pendingQueue.size();
+	})->get();
+	queue->pendingQueue.push(request);
+	queue->pendingDoorbell.raise();
 }
 
-async::detached Device::_processRequests() {
+async::detached Device::_processRequests(RequestQueue *queue) {
 	while(true) {
-		if(_pendingQueue.empty()) {
-			co_await _pendingDoorbell.async_wait();
+		if(queue->pendingQueue.empty()) {
+			co_await queue->pendingDoorbell.async_wait();
 			continue;
 		}
 
-		auto request = _pendingQueue.front();
-		_pendingQueue.pop();
-		assert(request->numSectors);
-
-		// Setup the descriptor for the request header.
-		virtio_core::Chain chain;
-		chain.append(co_await _requestQueue->obtainDescriptor());
+		// Post all pending requests before notifying the device.
+		while(!queue->pendingQueue.empty()) {
+			auto request = queue->pendingQueue.front();
+			queue->pendingQueue.pop();
+			co_await _postRequest(queue, request);
+		}
+		queue->virtq->notify();
+	}
+}
 
-		VirtRequest *header = &virtRequestBuffer[chain.front().tableIndex()];
-		if(request->write) {
-			header->type = VIRTIO_BLK_T_OUT;
-		}else{
-			header->type = VIRTIO_BLK_T_IN;
+async::result<void> Device::_postRequest(RequestQueue *queue, UserRequest *request) {
+	// Only flushes do not transfer data.
+	assert(request->numSectors || request->type == VIRTIO_BLK_T_FLUSH);
+	bool write = request->type == VIRTIO_BLK_T_OUT;
+
+	auto header = request->header.data();
+	header->type = request->type;
+	header->reserved = 0;
+	header->sector = request->sector;
+	*request->status.data() = 0xFF;
+
+	std::vector<virtio_core::PhysicalSegment> segments;
+	if(request->numSectors)
+		segments = virtio_core::physicalSegments(arch::dma_buffer_view{nullptr,
+				request->buffer, request->numSectors * 512}, _maxSegmentSize);
+	assert(segments.size() <= _maxSegments);
+
+	if(logInitiateRetire)
+		std::cout << "Submitting " << request->numSectors
+				<< " sectors in " << segments.size() << " segments" << std::endl;
+
+	// Do not block on descriptors while the device has not seen previous requests.
+	size_t num_descriptors = _indirect ? 1 : segments.size() + 2;
+	if(queue->virtq->numFreeDescriptors() < num_descriptors)
+		queue->virtq->notify();
+
+	virtio_core::Chain chain;
+	if(_indirect) {
+		// The whole request only occupies a single descriptor of the virtq.
+		auto &table = request->table.emplace(&_dmaPool, segments.size() + 2);
+		table.append(virtio_core::hostToDevice, request->header.view_buffer());
+		for(auto segment : segments) {
+			if(write) {
+				table.append(virtio_core::hostToDevice, segment);
+			}else{
+				table.append(virtio_core::deviceToHost, segment);
+			}
 		}
-		header->reserved = 0;
-		header->sector = request->sector;
-
-		chain.setupBuffer(virtio_core::hostToDevice, arch::dma_buffer_view{nullptr,
-				header, sizeof(VirtRequest)});
-
-		// Setup descriptors for the transfered data.
-		for(size_t i = 0; i < request->numSectors; i++) {
-			chain.append(co_await _requestQueue->obtainDescriptor());
-			if(request->write) {
-				chain.setupBuffer(virtio_core::hostToDevice, arch::dma_buffer_view{nullptr,
-						(char *)request->buffer + 512 * i, 512});
+		table.append(virtio_core::deviceToHost, request->status.view_buffer());
+
+		chain.append(co_await queue->virtq->obtainDescriptor());
+		chain.front().setupIndirect(table);
+	}else{
+		chain.append(co_await queue->virtq->obtainDescriptor());
+		chain.setupBuffer(virtio_core::hostToDevice, request->header.view_buffer());
+
+		for(auto segment : segments) {
+			chain.append(co_await queue->virtq->obtainDescriptor());
+			if(write) {
+				chain.setupSegment(virtio_core::hostToDevice, segment);
 			}else{
-				chain.setupBuffer(virtio_core::deviceToHost, arch::dma_buffer_view{nullptr,
-						(char *)request->buffer + 512 * i, 512});
+				chain.setupSegment(virtio_core::deviceToHost, segment);
 			}
 		}
 
-		if(logInitiateRetire)
-			std::cout << "Submitting " << request->numSectors
-					<< " data descriptors" << std::endl;
-
-		// Setup a descriptor for the status byte.
-		chain.append(co_await _requestQueue->obtainDescriptor());
-		chain.setupBuffer(virtio_core::deviceToHost, arch::dma_buffer_view{nullptr,
-				&statusBuffer[chain.front().tableIndex()], 1});
-
-		// Submit the request to the device
-		_requestQueue->postDescriptor(chain.front(), request,
-				[] (virtio_core::Request *base_request) {
-			auto request = static_cast<UserRequest *>(base_request);
-			if(logInitiateRetire)
-				std::cout << "Retiring " << request->numSectors
-						<< " data descriptors" << std::endl;
-			request->event.raise();
-		});
-		_requestQueue->notify();
+		chain.append(co_await queue->virtq->obtainDescriptor());
+		chain.setupBuffer(virtio_core::deviceToHost, request->status.view_buffer());
 	}
+
+	// Submit the request to the device
+	request->queue = queue;
+	queue->numInflight++;
+	queue->virtq->postDescriptor(chain.front(), request,
+			[] (virtio_core::Request *base_request) {
+		auto request = static_cast<UserRequest *>(base_request);
+		if(logInitiateRetire)
+			std::cout << "Retiring " << request->numSectors
+					<< " sectors" << std::endl;
+		request->queue->numInflight--;
+		request->event.raise();
+	});
 }
 
 } } // namespace block::virtio
@@ -1,7 +1,10 @@
 
 #include <memory>
+#include <optional>
 #include <queue>
+#include <vector>
 
+#include <arch/dma_pool.hpp>
 #include <blockfs.hpp>
 #include <core/virtio/core.hpp>
 #include <async/oneshot-event.hpp>
@@ -22,32 +25,72 @@ static_assert(sizeof(VirtRequest) == 16, "Bad sizeof(VirtRequest)");
 
 enum {
 	VIRTIO_BLK_T_IN = 0,
-	VIRTIO_BLK_T_OUT = 1
+	VIRTIO_BLK_T_OUT = 1,
+	VIRTIO_BLK_T_FLUSH = 4
+};
+
+enum {
+	VIRTIO_BLK_F_SIZE_MAX = 1,
+	VIRTIO_BLK_F_SEG_MAX = 2,
+	VIRTIO_BLK_F_FLUSH = 9,
+	VIRTIO_BLK_F_MQ = 12
 };
 
 namespace spec::regs {
 	inline constexpr arch::scalar_register<uint32_t> capacity[] = {
 			arch::scalar_register<uint32_t>{0},
 			arch::scalar_register<uint32_t>{4}};
+	inline constexpr arch::scalar_register<uint32_t> sizeMax{8};
+	inline constexpr arch::scalar_register<uint32_t> segMax{12};
+	inline constexpr arch::scalar_register<uint16_t> numQueues{34};
 }
 
 struct Device;
+struct RequestQueue;
 
 // --------------------------------------------------------
 // UserRequest
 // --------------------------------------------------------
 
 struct UserRequest : virtio_core::Request {
-	UserRequest(bool write, uint64_t sector, void *buffer, size_t num_sectors);
+	UserRequest(arch::dma_pool *pool, uint32_t type, uint64_t sector,
+			void *buffer, size_t num_sectors);
 
-	bool write;
+	// One of the VIRTIO_BLK_T_* constants.
+	uint32_t type;
 	uint64_t sector;
 	void *buffer;
 	size_t numSectors;
 
+	// Request header and status byte that are accessed by the device.
+	arch::dma_object<VirtRequest> header;
+	arch::dma_object<uint8_t> status;
+
+	// Only used if VIRTIO_RING_F_INDIRECT_DESC is negotiated.
+	std::optional<virtio_core::IndirectTable> table;
+
+	// RequestQueue that the request was submitted to.
+	RequestQueue *queue = nullptr;
+
 	async::oneshot_event event;
 };
 
+// --------------------------------------------------------
+// RequestQueue
+// --------------------------------------------------------
+
+// Wraps one of the device's virtqs.
+struct RequestQueue {
+	virtio_core::Queue *virtq = nullptr;
+
+	// Stores UserRequest objects that have not been submitted yet.
+	std::queue<UserRequest *> pendingQueue;
+	async::recurring_event pendingDoorbell;
+
+	// Number of requests that were submitted but not completed yet.
+	size_t numInflight = 0;
+};
+
 // --------------------------------------------------------
 // Device
 // --------------------------------------------------------
@@ -63,25 +106,46 @@ struct Device : blockfs::BlockDevice {
 	async::result<void> writeSectors(uint64_t sector,
 			const void *buffer, size_t num_sectors) override;
 
+	async::result<frg::expected<protocols::fs::Error>> flushCache() override;
+
 	async::result<size_t> getSize() override;
 
 private:
-	// Submits requests from _pendingQueue to the device.
-	async::detached _processRequests();
+	// Splits a transfer into requests, submits all of them at once
+	// and waits until all of them are completed.
+	async::result<void> _transfer(bool write, uint64_t sector,
+			void *buffer, size_t num_sectors);
+
+	// Submits a request to the virtq with the least outstanding work.
+	void _submitRequest(UserRequest *request);
+
+	// Submits requests from the RequestQueue's pendingQueue to the device.
+	async::detached _processRequests(RequestQueue *queue);
+
+	// Builds the descriptor chain of a request and posts it to the virtq.
+	async::result<void> _postRequest(RequestQueue *queue, UserRequest *request);
 
 	std::unique_ptr<virtio_core::Transport> _transport;
 
-	// The single virtq of this device.
-	virtio_core::Queue *_requestQueue;
+	arch::contiguous_pool _dmaPool;
 
-	// Stores UserRequest objects that have not been submitted yet.
-	std::queue<UserRequest *> _pendingQueue;
-	async::recurring_event _pendingDoorbell;
+	// One RequestQueue per virtq (see VIRTIO_BLK_F_MQ).
+	std::vector<std::unique_ptr<RequestQueue>> _queues;
+
+	// Whether VIRTIO_RING_F_INDIRECT_DESC was negotiated.
+	bool _indirect = false;
+
+	// Whether VIRTIO_BLK_F_FLUSH was negotiated, i.e., the device has a volatile write cache.
+	bool _flush = false;
+
+	// Maximal size of a single data segment (see VIRTIO_BLK_F_SIZE_MAX).
+	size_t _maxSegmentSize = 0;
+
+	// Maximal number of data segments per request.
+	size_t _maxSegments = 0;
 
-	// these two buffer store virtio-block request header and status bytes
-	// they are indexed by the index of the request's first descriptor
-	VirtRequest *virtRequestBuffer;
-	uint8_t *statusBuffer;
+	// Maximal number of sectors per request.
+	size_t _maxSectors = 0;
 
 	// The size of the disk
 	size_t _size;
@@ -1,13 +1,17 @@
 #pragma once
 
 #include <async/result.hpp>
+#include <frg/expected.hpp>
 #include <protocols/fs/common.hpp>
 #include <protocols/mbus/client.hpp>
 #include <protocols/ostrace/ostrace.hpp>
 #include <stdint.h>
+#include <vector>
 
 namespace blockfs {
 
+struct RequestQueue;
+
 struct BlockDevice {
 	BlockDevice(size_t sector_size, int64_t parent_id);
 
@@ -20,8 +24,35 @@ struct BlockDevice {
 		throw std::runtime_error("BlockDevice does not support writeSectors()");
 	}
 
+	// Like writeSectors() but only completes once the data is on non-volatile media.
+	// Drivers of devices that support Force Unit Access should override this.
+	virtual async::result<void> writeSectorsFua(uint64_t sector, const void *buffer,
+			size_t num_sectors) {
+		co_await writeSectors(sector, buffer, num_sectors);
+		// Like writeSectors(), FUA writes do not report errors yet.
+		(void)co_await flushCache();
+	}
+
+	// Makes all writes that completed so far durable.
+	// Devices without a volatile write cache do not need to override this.
+	// Fails with Error::internalError (i.e., EIO) if the device reports an error.
+	virtual async::result<frg::expected<protocols::fs::Error>> flushCache() {
+		co_return {};
+	}
+
 	virtual async::result<size_t> getSize() = 0;
 
+	// Like readSectors(), writeSectors(), writeSectorsFua() and flushCache() but goes
+	// through the device's RequestQueue (if any). Filesystems should use these functions.
+	// Concurrent calls to flush() are batched into as few device flushes as possible.
+	async::result<void> read(uint64_t sector, void *buffer, size_t num_sectors);
+	async::result<void> write(uint64_t sector, const void *buffer, size_t num_sectors);
+	async::result<void> writeFua(uint64_t sector, const void *buffer, size_t num_sectors);
+	async::result<frg::expected<protocols::fs::Error>> flush();
+
+	// Returns the counters of /sys/block/<dev>/stat.
+	virtual std::vector<uint64_t> ioStats();
+
 	virtual async::result<void> handleIoctl(managarm::fs::GenericIoctlRequest &req, helix::UniqueDescriptor conversation) {
 		std::cout << "\e[31m" "libblockfs: Unknown ioctl() message with ID "
 				<< req.command() << "\e[39m" << std::endl;
@@ -38,6 +69,12 @@ struct BlockDevice {
 	std::string diskNamePrefix = "sd";
 	std::string diskNameSuffix = "";
 	std::string partNameSuffix = "";
+
+	// Maximal number of requests that the RequestQueue passes to the driver at a time.
+	size_t maxQueueDepth = 32;
+
+	// Set up by runDevice().
+	RequestQueue *requestQueue = nullptr;
 protected:
 };
 
@@ -52,6 +52,7 @@ struct StorageDevice : Interface, blockfs::BlockDevice {
 	StorageDevice(size_t sectorSize, int64_t parentId)
 	: blockfs::BlockDevice(sectorSize, parentId) { }
 
+	// Issues up to maxQueueDepth commands concurrently.
 	async::detached runScsi();
 
 	async::result<void> readSectors(uint64_t sector,
@@ -77,7 +78,10 @@ private:
 		frg::default_list_hook<Request> requestHook;
 	};
 
+	async::detached handleRequest_(Request *req);
+
 	async::recurring_event doorbell_;
+	size_t inFlight_ = 0;
 
 	frg::intrusive_list<
 		Request,
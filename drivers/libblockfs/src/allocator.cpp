@@ -0,0 +1,145 @@
+#include <assert.h>
+#include <algorithm>
+#include <iterator>
+
+#include "allocator.hpp"
+
+namespace blockfs {
+namespace ext2fs {
+
+namespace {
+
+// Returns the word of used bits at index i.
+uint32_t usedWord(const uint32_t *bitmap, const uint32_t *mask, uint32_t i) {
+	if(mask)
+		return bitmap[i] | mask[i];
+	return bitmap[i];
+}
+
+// Like findFreeRun() but only considers bits in [from, to) and does not wrap around.
+BitRun scanFreeRun(const uint32_t *bitmap, const uint32_t *mask,
+		uint32_t from, uint32_t to, uint32_t wanted) {
+	BitRun best{0, 0};
+
+	auto pos = from;
+	while(pos < to) {
+		// Find the first clear bit. Whole words of set bits are skipped at once.
+		auto i = pos / 32;
+		auto word = usedWord(bitmap, mask, i) | ((uint32_t{1} << (pos % 32)) - 1);
+		while(word == 0xFFFFFFFF) {
+			i++;
+			if(i * 32 >= to)
+				return best;
+			word = usedWord(bitmap, mask, i);
+		}
+		auto start = i * 32 + __builtin_ctz(~word);
+		if(start >= to)
+			return best;
+
+		// Find the end of the run. Whole words of clear bits are skipped at once.
+		auto j = start / 32;
+		word = usedWord(bitmap, mask, j) & ~((uint32_t{1} << (start % 32)) - 1);
+		while(!word) {
+			j++;
+			if(j * 32 >= to)
+				break;
+			word = usedWord(bitmap, mask, j);
+		}
+		auto end = word ? std::min(j * 32 + __builtin_ctz(word), to) : to;
+
+		auto length = end - start;
+		if(length >= wanted)
+			return {start, wanted};
+		if(length > best.length)
+			best = {start, length};
+		pos = end;
+	}
+
+	return best;
+}
+
+} // anonymous namespace
+
+BitRun findFreeRun(const uint32_t *bitmap, const uint32_t *mask,
+		uint32_t numBits, uint32_t goal, uint32_t wanted) {
+	assert(wanted);
+	if(goal >= numBits)
+		goal = 0;
+
+	auto first = scanFreeRun(bitmap, mask, goal, numBits, wanted);
+	if(first.length == wanted || !goal)
+		return first;
+	auto second = scanFreeRun(bitmap, mask, 0, goal, wanted);
+	if(second.length > first.length)
+		return second;
+	return first;
+}
+
+void setBits(uint32_t *words, uint32_t start, uint32_t length) {
+	for(auto i = start; i < start + length; i++)
+		words[i / 32] |= uint32_t{1} << (i % 32);
+}
+
+void clearBits(uint32_t *words, uint32_t start, uint32_t length) {
+	for(auto i = start; i < start + length; i++)
+		words[i / 32] &= ~(uint32_t{1} << (i % 32));
+}
+
+uint64_t BlockRangeSet::countMissing(uint64_t start, uint64_t length) const {
+	auto end = start + length;
+	uint64_t present = 0;
+
+	auto it = ranges.upper_bound(start);
+	if(it != ranges.begin())
+		it = std::prev(it);
+	for(; it != ranges.end() && it->first < end; ++it) {
+		auto lo = std::max(it->first, start);
+		auto hi = std::min(it->second, end);
+		if(lo < hi)
+			present += hi - lo;
+	}
+	return length - present;
+}
+
+void BlockRangeSet::insert(uint64_t start, uint64_t length) {
+	auto end = start + length;
+
+	// Merge with all ranges that overlap or touch the new range.
+	auto it = ranges.upper_bound(start);
+	if(it != ranges.begin() && std::prev(it)->second >= start)
+		it = std::prev(it);
+	while(it != ranges.end() && it->first <= end) {
+		start = std::min(start, it->first);
+		end = std::max(end, it->second);
+		it = ranges.erase(it);
+	}
+	ranges.emplace(start, end);
+}
+
+std::vector<BlockRange> BlockRangeSet::extract(uint64_t start, uint64_t length) {
+	auto end = start + length;
+	std::vector<BlockRange> result;
+
+	auto it = ranges.upper_bound(start);
+	if(it != ranges.begin())
+		it = std::prev(it);
+	while(it != ranges.end() && it->first < end) {
+		auto [first, last] = *it;
+		auto lo = std::max(first, start);
+		auto hi = std::min(last, end);
+		if(lo >= hi) {
+			++it;
+			continue;
+		}
+
+		result.push_back({lo, hi - lo});
+		it = ranges.erase(it);
+		if(first < lo)
+			ranges.emplace(first, lo);
+		if(hi < last)
+			it = ranges.emplace(hi, last).first;
+	}
+	return result;
+}
+
+} } // namespace blockfs::ext2fs
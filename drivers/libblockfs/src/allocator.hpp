@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <vector>
+
+namespace blockfs {
+namespace ext2fs {
+
+// --------------------------------------------------------
+// Bitmap scanning
+// --------------------------------------------------------
+
+// Run of consecutive bits in a bitmap.
+struct BitRun {
+	uint32_t start;
+	uint32_t length;
+};
+
+// Searches a bitmap of numBits bits for a run of up to wanted clear bits.
+// Bits that are set in either bitmap or mask (which may be null) are considered to be in use.
+// The search starts at goal and wraps around at the end of the bitmap.
+// Returns the first run of at least wanted bits (truncated to wanted bits) or,
+// if there is no such run, the longest run. The result is empty if all bits are in use.
+BitRun findFreeRun(const uint32_t *bitmap, const uint32_t *mask,
+		uint32_t numBits, uint32_t goal, uint32_t wanted);
+
+void setBits(uint32_t *words, uint32_t start, uint32_t length);
+void clearBits(uint32_t *words, uint32_t start, uint32_t length);
+
+// --------------------------------------------------------
+// BlockRangeSet
+// --------------------------------------------------------
+
+struct BlockRange {
+	uint64_t start;
+	uint64_t length;
+};
+
+// Set of logical blocks, stored as disjoint ranges.
+struct BlockRangeSet {
+	// Returns the number of blocks in the given range that are not in the set.
+	uint64_t countMissing(uint64_t start, uint64_t length) const;
+
+	// Adds the given range to the set.
+	void insert(uint64_t start, uint64_t length);
+
+	// Removes all blocks in the given range from the set and returns them.
+	std::vector<BlockRange> extract(uint64_t start, uint64_t length);
+
+	bool empty() const {
+		return ranges.empty();
+	}
+
+	// Maps the first block of each range to its end.
+	std::map<uint64_t, uint64_t> ranges;
+};
+
+} } // namespace blockfs::ext2fs
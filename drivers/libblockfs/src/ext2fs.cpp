@@ -5,6 +5,7 @@
 #include <string.h>
 #include <algorithm>
 #include <iostream>
+#include <limits>
 #include <sys/stat.h>
 
 #include <async/result.hpp>
@@ -12,10 +13,12 @@
 #include <core/clock.hpp>
 #include <helix/ipc.hpp>
 #include <helix/memory.hpp>
+#include <helix/timer.hpp>
 
 #include <array>
 
 #include "ext2fs.hpp"
+#include "htree.hpp"
 
 namespace blockfs {
 namespace ext2fs {
@@ -25,6 +28,63 @@ namespace {
 
 	constexpr int pageShift = 12;
 	constexpr size_t pageSize = size_t{1} << pageShift;
+
+	// Number of management requests for file data that are processed concurrently per inode.
+	constexpr int fileDataWorkers = 4;
+
+	// Size of the preallocation windows of files.
+	constexpr size_t preallocationSize = size_t{1} << 20;
+
+	// Time during which updates of the BGDT are collected before it is written back (in ns).
+	constexpr uint64_t bgdtWritebackDelay = 2'000'000;
+
+	FileType toFileType(uint8_t diskType) {
+		switch(diskType) {
+		case EXT2_FT_REG_FILE:
+			return kTypeRegular;
+		case EXT2_FT_DIR:
+			return kTypeDirectory;
+		case EXT2_FT_SYMLINK:
+			return kTypeSymlink;
+		default:
+			return kTypeNone;
+		}
+	}
+
+	// Returns the amount of space at the end of a record that can hold another entry.
+	size_t recordSlack(DiskDirEntry *entry) {
+		if(!entry->inode)
+			return entry->recordLength;
+		auto contracted = (sizeof(DiskDirEntry) + entry->nameLength + 3) & ~size_t(3);
+		assert(entry->recordLength >= contracted);
+		return entry->recordLength - contracted;
+	}
+}
+
+// --------------------------------------------------------
+// DirIndex
+// --------------------------------------------------------
+
+void DirIndex::setSlack(uint32_t offset, size_t slack) {
+	// Records that cannot hold another entry are not tracked.
+	constexpr size_t minRecordLength = (sizeof(DiskDirEntry) + 2 + 3) & ~size_t(3);
+
+	if(auto it = _slackOf.find(offset); it != _slackOf.end()) {
+		_bySlack.erase({it->second, offset});
+		_slackOf.erase(it);
+	}
+	if(slack >= minRecordLength) {
+		_bySlack.emplace(slack, offset);
+		_slackOf.emplace(offset, slack);
+	}
+}
+
+std::optional<uint32_t> DirIndex::findSlack(size_t required) {
+	// Use the record with the least sufficient slack to reduce fragmentation.
+	auto it = _bySlack.lower_bound({required, 0});
+	if(it == _bySlack.end())
+		return std::nullopt;
+	return it->second;
 }
 
 // --------------------------------------------------------
@@ -34,6 +94,11 @@ namespace {
 Inode::Inode(FileSystem &fs, uint32_t number)
 : fs(fs), number(number), isReady(false) { }
 
+Inode::~Inode() {
+	fs.discardPreallocation(this);
+	fs.dropDelayedBlocks(this, 0, std::numeric_limits<uint64_t>::max());
+}
+
 void Inode::setFileSize(size_t size) {
 	assert(!(size & ~uint64_t(0xFFFFFFFF)));
 	diskInode()->size = size;
@@ -45,17 +110,56 @@ Inode::findEntry(std::string name) {
 
 	if(fileType != kTypeDirectory)
 		co_return protocols::fs::Error::notDirectory;
+	if(corrupted)
+		co_return protocols::fs::Error::internalError;
 	assert(fileMapping.size() == fileSize());
 
-	helix::LockMemoryView lock_memory;
-	auto map_size = (fileSize() + 0xFFF) & ~size_t(0xFFF);
+	if(!dirIndex) {
+		co_await dirMutex.async_lock();
+		frg::unique_lock lock{frg::adopt_lock, dirMutex};
+
+		// Hashed directories do not need to be walked, so we do not build an index for them.
+		if(!dirIndex && fs.hasDirIndex && (diskInode()->flags & EXT2_INDEX_FL)) {
+			auto result = co_await findHashedEntry(name);
+			if(result || result.error() != protocols::fs::Error::internalError)
+				co_return result;
+			std::cout << "\e[33m" "ext2fs: Hash tree of directory inode " << number
+					<< " is corrupted, falling back to linear lookups" "\e[39m" << std::endl;
+		}
+
+		if(!dirIndex)
+			co_await buildDirIndex();
+	}
+
+	auto it = dirIndex->entries.find(name);
+	if(it == dirIndex->entries.end())
+		co_return std::nullopt;
+
+	DirEntry entry;
+	entry.inode = it->second.inode;
+	entry.fileType = toFileType(it->second.fileType);
+	co_return entry;
+}
+
+async::result<helix::UniqueDescriptor> Inode::lockRange(uintptr_t offset, size_t length) {
+	auto alignedOffset = offset & ~(pageSize - 1);
+	auto alignedLength = ((offset + length + pageSize - 1) & ~(pageSize - 1)) - alignedOffset;
+
+	helix::LockMemoryView lockMemory;
 	auto &&submit = helix::submitLockMemoryView(helix::BorrowedDescriptor(frontalMemory),
-			&lock_memory,
-			0, map_size, helix::Dispatcher::global());
+			&lockMemory,
+			alignedOffset, alignedLength, helix::Dispatcher::global());
 	co_await submit.async_wait();
-	HEL_CHECK(lock_memory.error());
+	HEL_CHECK(lockMemory.error());
+	co_return lockMemory.descriptor();
+}
 
-	// Read the directory structure.
+async::result<void> Inode::buildDirIndex() {
+	assert(!dirIndex);
+
+	auto lock = co_await lockRange(0, fileSize());
+
+	auto index = std::make_unique<DirIndex>();
 	uintptr_t offset = 0;
 	while(offset < fileSize()) {
 		assert(!(offset & 3));
@@ -64,31 +168,136 @@ Inode::findEntry(std::string name) {
 				reinterpret_cast<char *>(fileMapping.get()) + offset);
 		assert(disk_entry->recordLength);
 
-		if(disk_entry->inode
-				&& name.length() == disk_entry->nameLength
-				&& !memcmp(disk_entry->name, name.data(), name.length())) {
-			DirEntry entry;
-			entry.inode = disk_entry->inode;
-
-			switch(disk_entry->fileType) {
-			case EXT2_FT_REG_FILE:
-				entry.fileType = kTypeRegular; break;
-			case EXT2_FT_DIR:
-				entry.fileType = kTypeDirectory; break;
-			case EXT2_FT_SYMLINK:
-				entry.fileType = kTypeSymlink; break;
-			default:
-				entry.fileType = kTypeNone;
+		if(disk_entry->inode)
+			index->entries.emplace(std::string(disk_entry->name, disk_entry->nameLength),
+					DirIndex::Entry{static_cast<uint32_t>(offset),
+							disk_entry->inode, disk_entry->fileType});
+		index->setSlack(offset, recordSlack(disk_entry));
+
+		offset += disk_entry->recordLength;
+	}
+	assert(offset == fileSize());
+
+	dirIndex = std::move(index);
+}
+
+async::result<frg::expected<protocols::fs::Error, std::optional<DirEntry>>>
+Inode::findHashedEntry(const std::string &name) {
+	auto numBlocks = fileSize() >> fs.blockShift;
+	if(!numBlocks)
+		co_return protocols::fs::Error::internalError;
+
+	// Only the blocks on the path to the leaves are locked.
+	std::vector<helix::UniqueDescriptor> locks;
+	auto accessBlock = [&] (uint32_t block) -> async::result<char *> {
+		locks.push_back(co_await lockRange(uintptr_t{block} << fs.blockShift, fs.blockSize));
+		co_return reinterpret_cast<char *>(fileMapping.get()) + (uintptr_t{block} << fs.blockShift);
+	};
+
+	// The root follows the "." and ".." entries, which are 12 bytes each.
+	auto root = co_await accessBlock(0);
+	auto info = reinterpret_cast<DxRootInfo *>(root + 24);
+	int version = info->hashVersion;
+	if(version <= DX_HASH_TEA && fs.unsignedHash)
+		version += DX_HASH_LEGACY_UNSIGNED;
+	if(!isKnownHashVersion(version) || info->indirectLevels > 2
+			|| 24 + info->infoLength + sizeof(DxEntry) > fs.blockSize)
+		co_return protocols::fs::Error::internalError;
+	auto hash = dirHash(version, fs.hashSeed, name.data(), name.size());
+
+	// Remember the path from the root such that we can advance to the next leaf.
+	struct Frame {
+		DxEntry *entries;
+		unsigned int count;
+		unsigned int at;
+	};
+	std::vector<Frame> path;
+
+	auto enterNode = [&] (DxEntry *entries, bool search) -> bool {
+		auto count = reinterpret_cast<DxCountLimit *>(entries)->count;
+		auto limit = reinterpret_cast<DxCountLimit *>(entries)->limit;
+		if(!count || count > limit)
+			return false;
+		path.push_back({entries, count, search ? dxSearch(entries, count, hash) : 0});
+		return true;
+	};
+
+	if(!enterNode(reinterpret_cast<DxEntry *>(root + 24 + info->infoLength), true))
+		co_return protocols::fs::Error::internalError;
+	while(path.size() <= info->indirectLevels) {
+		auto block = dxBlock(path.back().entries[path.back().at]);
+		if(block >= numBlocks)
+			co_return protocols::fs::Error::internalError;
+		// Interior nodes start with an empty directory entry that spans the whole block.
+		auto node = co_await accessBlock(block);
+		if(!enterNode(reinterpret_cast<DxEntry *>(node + sizeof(DiskDirEntry)), true))
+			co_return protocols::fs::Error::internalError;
+	}
+
+	while(true) {
+		auto block = dxBlock(path.back().entries[path.back().at]);
+		if(block >= numBlocks)
+			co_return protocols::fs::Error::internalError;
+		auto leaf = co_await accessBlock(block);
+
+		uintptr_t offset = 0;
+		while(offset < fs.blockSize) {
+			auto disk_entry = reinterpret_cast<DiskDirEntry *>(leaf + offset);
+			if(offset + sizeof(DiskDirEntry) > fs.blockSize
+					|| disk_entry->recordLength < sizeof(DiskDirEntry)
+					|| offset + disk_entry->recordLength > fs.blockSize)
+				co_return protocols::fs::Error::internalError;
+
+			if(disk_entry->inode
+					&& name.length() == disk_entry->nameLength
+					&& !memcmp(disk_entry->name, name.data(), name.length())) {
+				DirEntry entry;
+				entry.inode = disk_entry->inode;
+				entry.fileType = toFileType(disk_entry->fileType);
+				co_return entry;
 			}
 
-			co_return entry;
+			offset += disk_entry->recordLength;
 		}
 
-		offset += disk_entry->recordLength;
+		// Names with the same hash may continue in the next leaf;
+		// this is marked by setting the lowest bit of the next hash.
+		auto level = path.size();
+		while(level && path[level - 1].at + 1 == path[level - 1].count)
+			level--;
+		if(!level)
+			co_return std::nullopt;
+		auto &frame = path[level - 1];
+		if((frame.entries[frame.at + 1].hash & ~uint32_t(1)) != hash)
+			co_return std::nullopt;
+		frame.at++;
+
+		// Descend to the leftmost leaf below the next entry.
+		path.resize(level);
+		while(path.size() <= info->indirectLevels) {
+			auto block = dxBlock(path.back().entries[path.back().at]);
+			if(block >= numBlocks)
+				co_return protocols::fs::Error::internalError;
+			auto node = co_await accessBlock(block);
+			if(!enterNode(reinterpret_cast<DxEntry *>(node + sizeof(DiskDirEntry)), false))
+				co_return protocols::fs::Error::internalError;
+		}
 	}
-	assert(offset == fileSize());
+}
 
-	co_return std::nullopt;
+async::result<void> Inode::dropHashTree() {
+	if(!(diskInode()->flags & EXT2_INDEX_FL))
+		co_return;
+
+	// We do not maintain hash trees. Since the nodes of the tree look like empty
+	// directory entries, the directory remains valid as a linear directory
+	// (this is what ext2 implementations without dir_index support do).
+	diskInode()->flags &= ~EXT2_INDEX_FL;
+
+	auto syncInode = co_await helix_ng::synchronizeSpace(
+			helix::BorrowedDescriptor{kHelNullHandle},
+			diskMapping.get(), fs.inodeSize);
+	HEL_CHECK(syncInode.error());
 }
 
 async::result<std::optional<DirEntry>>
@@ -101,7 +310,14 @@ Inode::link(std::string name, int64_t ino, blockfs::FileType type) {
 	assert(fileType == kTypeDirectory);
 	assert(fileMapping.size() == fileSize());
 
-	// Lock the mapping into memory before calling this function.
+	co_await dirMutex.async_lock();
+	frg::unique_lock lock{frg::adopt_lock, dirMutex};
+
+	co_await dropHashTree();
+	if(!dirIndex)
+		co_await buildDirIndex();
+
+	// Lock the record's block into memory before calling this function.
 	auto appendDirEntry = [&](size_t offset, size_t length)
 			-> async::result<std::optional<DirEntry>> {
 		auto diskEntry = reinterpret_cast<DiskDirEntry *>(
@@ -125,10 +341,15 @@ Inode::link(std::string name, int64_t ino, blockfs::FileType type) {
 		}
 		memcpy(diskEntry->name, name.data(), name.length() + 1);
 
-		// Flush the data to disk.
-		// TODO: It would be enough to flush only one or two pages here.
+		dirIndex->entries.emplace(name, DirIndex::Entry{static_cast<uint32_t>(offset),
+				static_cast<uint32_t>(ino), diskEntry->fileType});
+		dirIndex->setSlack(offset, recordSlack(diskEntry));
+
+		// Flush the block that contains the entry to disk.
 		auto syncDir = co_await helix_ng::synchronizeSpace(
-				helix::BorrowedDescriptor{kHelNullHandle}, fileMapping.get(), fileSize());
+				helix::BorrowedDescriptor{kHelNullHandle},
+				reinterpret_cast<char *>(fileMapping.get()) + (offset & ~size_t(fs.blockSize - 1)),
+				fs.blockSize);
 		HEL_CHECK(syncDir.error());
 
 		// Increment the target's link count.
@@ -148,14 +369,6 @@ Inode::link(std::string name, int64_t ino, blockfs::FileType type) {
 		co_return entry;
 	};
 
-	helix::LockMemoryView lock_memory;
-	auto map_size = (fileSize() + 0xFFF) & ~size_t(0xFFF);
-	auto &&submit = helix::submitLockMemoryView(helix::BorrowedDescriptor(frontalMemory),
-			&lock_memory,
-			0, map_size, helix::Dispatcher::global());
-	co_await submit.async_wait();
-	HEL_CHECK(lock_memory.error());
-
 	auto time = clk::getRealtime();
 	diskInode()->mtime = time.tv_sec;
 
@@ -168,33 +381,29 @@ Inode::link(std::string name, int64_t ino, blockfs::FileType type) {
 	// We use name.size() + 1 for the entry name length to account for the null terminator
 	auto required = (sizeof(DiskDirEntry) + name.size() + 1 + 3) & ~size_t(3);
 
-	// Walk the directory structure.
-	uintptr_t offset = 0;
-	while(offset < fileSize()) {
-		assert(!(offset & 3));
-		assert(offset + sizeof(DiskDirEntry) <= fileSize());
+	// Check whether we can reuse an existing record.
+	if(auto slot = dirIndex->findSlack(required); slot) {
+		auto offset = *slot;
+		auto blockLock = co_await lockRange(offset & ~size_t(fs.blockSize - 1), fs.blockSize);
 		auto previous_entry = reinterpret_cast<DiskDirEntry *>(
 				reinterpret_cast<char *>(fileMapping.get()) + offset);
-		assert(previous_entry->recordLength);
 
-		// Calculate available space after we contract previous_entry.
+		// Empty records can be overwritten.
+		if(!previous_entry->inode)
+			co_return co_await appendDirEntry(offset, previous_entry->recordLength);
+
+		// Otherwise, shrink previous_entry and insert a new entry after it.
 		auto contracted = (sizeof(DiskDirEntry) + previous_entry->nameLength + 3) & ~size_t(3);
-		assert(previous_entry->recordLength >= contracted);
+		assert(previous_entry->recordLength >= contracted + required);
 		auto available = previous_entry->recordLength - contracted;
+		previous_entry->recordLength = contracted;
+		dirIndex->setSlack(offset, 0);
 
-		// Check whether we can shrink previous_entry and insert a new entry after it.
-		if(available >= required) {
-			// Update the existing dentry.
-			previous_entry->recordLength = contracted;
-
-			co_return co_await appendDirEntry(offset + contracted, available);
-		}
-
-		offset += previous_entry->recordLength;
+		co_return co_await appendDirEntry(offset + contracted, available);
 	}
-	assert(offset == fileSize());
 
 	// If we made it this far, we ran out of space in the directory. Resize it.
+	auto offset = fileSize();
 	auto blockOffset = (offset & ~(fs.blockSize - 1)) >> fs.blockShift;
 	auto newSize = (offset + fs.blockSize + 0xFFF) & ~size_t(0xFFF);
 	setFileSize(newSize);
@@ -205,16 +414,8 @@ Inode::link(std::string name, int64_t ino, blockfs::FileType type) {
 			kHelMapProtRead | kHelMapProtWrite | kHelMapDontRequireBacking};
 
 	// Now append the entry that we couldn't add before.
-	{
-		helix::LockMemoryView lock_memory;
-		auto &&submit = helix::submitLockMemoryView(helix::BorrowedDescriptor(frontalMemory),
-				&lock_memory,
-				0, newSize, helix::Dispatcher::global());
-		co_await submit.async_wait();
-		HEL_CHECK(lock_memory.error());
-
-		co_return co_await appendDirEntry(offset, fileSize() - offset);
-	}
+	auto blockLock = co_await lockRange(offset, fileSize() - offset);
+	co_return co_await appendDirEntry(offset, fileSize() - offset);
 }
 
 async::result<frg::expected<protocols::fs::Error>> Inode::unlink(std::string name) {
@@ -224,105 +425,114 @@ async::result<frg::expected<protocols::fs::Error>> Inode::unlink(std::string nam
 
 	if(fileType != kTypeDirectory)
 		co_return protocols::fs::Error::notDirectory;
+	if(corrupted)
+		co_return protocols::fs::Error::internalError;
 	assert(fileMapping.size() == fileSize());
 
-	helix::LockMemoryView lock_memory;
-	auto map_size = (fileSize() + 0xFFF) & ~size_t(0xFFF);
-	auto &&submit = helix::submitLockMemoryView(helix::BorrowedDescriptor(frontalMemory),
-			&lock_memory,
-			0, map_size, helix::Dispatcher::global());
-	co_await submit.async_wait();
-	HEL_CHECK(lock_memory.error());
+	co_await dirMutex.async_lock();
+	frg::unique_lock lock{frg::adopt_lock, dirMutex};
 
-	// Read the directory structure.
-	DiskDirEntry *previous_entry = nullptr;
-	uintptr_t offset = 0;
-	while(offset < fileSize()) {
-		assert(!(offset & 3));
-		assert(offset + sizeof(DiskDirEntry) <= fileSize());
-		auto disk_entry = reinterpret_cast<DiskDirEntry *>(
-				reinterpret_cast<char *>(fileMapping.get()) + offset);
-		assert(disk_entry->recordLength);
+	if(!dirIndex)
+		co_await buildDirIndex();
 
-		if(disk_entry->inode
-				&& name.length() == disk_entry->nameLength
-				&& !memcmp(disk_entry->name, name.data(), name.length())) {
+	auto it = dirIndex->entries.find(name);
+	if(it == dirIndex->entries.end())
+		co_return protocols::fs::Error::fileNotFound;
+	auto offset = it->second.offset;
 
-			auto target = fs.accessInode(disk_entry->inode);
-			co_await target->readyJump.wait();
+	auto target = fs.accessInode(it->second.inode);
+	co_await target->readyJump.wait();
 
-			if(target->fileType == kTypeDirectory) {
-				if(target->diskInode()->linksCount > 2) {
-					co_return protocols::fs::Error::directoryNotEmpty;
-				}
+	if(target->fileType == kTypeDirectory) {
+		if(target->diskInode()->linksCount > 2) {
+			co_return protocols::fs::Error::directoryNotEmpty;
+		}
 
-				helix::LockMemoryView target_lock_memory;
-				auto target_map_size = (target->fileSize() + 0xFFF) & ~size_t(0xFFF);
-				auto &&target_submit = helix::submitLockMemoryView(helix::BorrowedDescriptor(target->frontalMemory),
-						&target_lock_memory,
-						0, target_map_size, helix::Dispatcher::global());
-				co_await target_submit.async_wait();
-				HEL_CHECK(target_lock_memory.error());
-
-				// Check the directory entries for anything other than "." and "..".
-				uintptr_t target_offset = 0;
-				while(target_offset < target->fileSize()) {
-					assert(!(target_offset & 3));
-					assert(target_offset + sizeof(DiskDirEntry) <= target->fileSize());
-					auto target_disk_entry = reinterpret_cast<DiskDirEntry *>(
-						reinterpret_cast<char*>(target->fileMapping.get()) + target_offset);
-					assert(target_disk_entry);
-					assert(target_disk_entry->recordLength);
-
-					if(target_disk_entry->inode
-						&& target_disk_entry->nameLength == 2
-						&& target_disk_entry->name[0] == '.'
-						&& target_disk_entry->name[1] == '.') {
-						// ".."
-					} else if(target_disk_entry->inode
-						&& target_disk_entry->nameLength == 1
-						&& target_disk_entry->name[0] == '.') {
-						// "."
-					} else {
-						// Directory has stuff in it, do not delete it.
-						co_return protocols::fs::Error::directoryNotEmpty;
-					}
-
-					target_offset += target_disk_entry->recordLength;
-				}
+		helix::LockMemoryView target_lock_memory;
+		auto target_map_size = (target->fileSize() + 0xFFF) & ~size_t(0xFFF);
+		auto &&target_submit = helix::submitLockMemoryView(helix::BorrowedDescriptor(target->frontalMemory),
+				&target_lock_memory,
+				0, target_map_size, helix::Dispatcher::global());
+		co_await target_submit.async_wait();
+		HEL_CHECK(target_lock_memory.error());
+
+		// Check the directory entries for anything other than "." and "..".
+		uintptr_t target_offset = 0;
+		while(target_offset < target->fileSize()) {
+			assert(!(target_offset & 3));
+			assert(target_offset + sizeof(DiskDirEntry) <= target->fileSize());
+			auto target_disk_entry = reinterpret_cast<DiskDirEntry *>(
+				reinterpret_cast<char*>(target->fileMapping.get()) + target_offset);
+			assert(target_disk_entry);
+			assert(target_disk_entry->recordLength);
+
+			if(!target_disk_entry->inode) {
+				// Unused record.
+			} else if(target_disk_entry->nameLength == 2
+				&& target_disk_entry->name[0] == '.'
+				&& target_disk_entry->name[1] == '.') {
+				// ".."
+			} else if(target_disk_entry->nameLength == 1
+				&& target_disk_entry->name[0] == '.') {
+				// "."
+			} else {
+				// Directory has stuff in it, do not delete it.
+				co_return protocols::fs::Error::directoryNotEmpty;
 			}
 
-			// The directory should start with "." and "..". As those entries are never deleted,
-			// we can assume that a previous entry exists.
-			assert(previous_entry);
-			previous_entry->recordLength += disk_entry->recordLength;
-
-			// Flush the data to disk.
-			// TODO: It would be enough to flush only one or two pages here.
-			auto syncDir = co_await helix_ng::synchronizeSpace(
-					helix::BorrowedDescriptor{kHelNullHandle}, fileMapping.get(), fileSize());
-			HEL_CHECK(syncDir.error());
-
-			// Decrement the inode's link count
-			if(--target->diskInode()->linksCount == 0) {
-				// TODO: free the data blocks and set size to 0
-				target->diskInode()->dtime = clk::getRealtime().tv_sec;
-			}
+			target_offset += target_disk_entry->recordLength;
+		}
+	}
+
+	co_await dropHashTree();
 
-			auto syncInode = co_await helix_ng::synchronizeSpace(
-					helix::BorrowedDescriptor{kHelNullHandle},
-					target->diskMapping.get(), fs.inodeSize);
-			HEL_CHECK(syncInode.error());
+	auto blockStart = offset & ~uint32_t(fs.blockSize - 1);
+	auto blockLock = co_await lockRange(blockStart, fs.blockSize);
+	auto disk_entry = reinterpret_cast<DiskDirEntry *>(
+			reinterpret_cast<char *>(fileMapping.get()) + offset);
 
-			co_return {};
+	if(offset == blockStart) {
+		// Records cannot span blocks, hence we cannot merge this record into the previous one.
+		disk_entry->inode = 0;
+		dirIndex->setSlack(offset, recordSlack(disk_entry));
+	}else{
+		// Merge the record into the previous record of the same block.
+		auto previous_offset = blockStart;
+		DiskDirEntry *previous_entry;
+		while(true) {
+			previous_entry = reinterpret_cast<DiskDirEntry *>(
+					reinterpret_cast<char *>(fileMapping.get()) + previous_offset);
+			assert(previous_entry->recordLength);
+			if(previous_offset + previous_entry->recordLength == offset)
+				break;
+			previous_offset += previous_entry->recordLength;
+			assert(previous_offset < offset);
 		}
 
-		offset += disk_entry->recordLength;
-		previous_entry = disk_entry;
+		previous_entry->recordLength += disk_entry->recordLength;
+		dirIndex->setSlack(offset, 0);
+		dirIndex->setSlack(previous_offset, recordSlack(previous_entry));
 	}
-	assert(offset == fileSize());
+	dirIndex->entries.erase(name);
 
-	co_return protocols::fs::Error::fileNotFound;
+	// Flush the block that contained the entry to disk.
+	auto syncDir = co_await helix_ng::synchronizeSpace(
+			helix::BorrowedDescriptor{kHelNullHandle},
+			reinterpret_cast<char *>(fileMapping.get()) + blockStart, fs.blockSize);
+	HEL_CHECK(syncDir.error());
+
+	// Decrement the inode's link count
+	if(--target->diskInode()->linksCount == 0) {
+		// TODO: free the data blocks and set size to 0
+		target->diskInode()->dtime = clk::getRealtime().tv_sec;
+	}
+
+	auto syncInode = co_await helix_ng::synchronizeSpace(
+			helix::BorrowedDescriptor{kHelNullHandle},
+			target->diskMapping.get(), fs.inodeSize);
+	HEL_CHECK(syncInode.error());
+
+	co_return {};
 }
 
 async::result<std::optional<DirEntry>> Inode::mkdir(std::string name) {
@@ -456,14 +666,14 @@ FileSystem::FileSystem(BlockDevice *device)
 : device(device) {
 }
 
-async::result<void> FileSystem::init() {
+async::result<frg::expected<protocols::fs::Error>> FileSystem::init() {
 	size_t deviceSuperBlockSector = superBlockOffset / device->sectorSize;
 	size_t deviceSuperBlockOffset = superBlockOffset % device->sectorSize;
 
 	size_t deviceSuperBlockSectors = (1024 + deviceSuperBlockOffset + device->sectorSize - 1) / device->sectorSize;
 
 	std::vector<uint8_t> buffer(deviceSuperBlockSectors * device->sectorSize);
-	co_await device->readSectors(deviceSuperBlockSector, buffer.data(), deviceSuperBlockSectors);
+	co_await device->read(deviceSuperBlockSector, buffer.data(), deviceSuperBlockSectors);
 
 	DiskSuperblock sb;
 	memcpy(&sb, buffer.data() + deviceSuperBlockOffset, sizeof(DiskSuperblock));
@@ -479,6 +689,10 @@ async::result<void> FileSystem::init() {
 	blocksCount = sb.blocksCount;
 	inodesCount = sb.inodesCount;
 	numBlockGroups = (sb.blocksCount + (sb.blocksPerGroup - 1)) / sb.blocksPerGroup;
+	hasDirIndex = sb.featureCompat & EXT2_FEATURE_COMPAT_DIR_INDEX;
+	hasExtents = sb.featureIncompat & EXT4_FEATURE_INCOMPAT_EXTENTS;
+	unsignedHash = sb.flags & EXT2_FLAGS_UNSIGNED_HASH;
+	memcpy(hashSeed, sb.hashSeed, sizeof(hashSeed));
 
 	if(logSuperblock) {
 		std::cout << "ext2fs: Revision is: " << sb.revLevel << std::endl;
@@ -498,15 +712,59 @@ async::result<void> FileSystem::init() {
 	assert(blockSize >= device->sectorSize);
 	assert(blockSize % device->sectorSize == 0);
 
+	// The BGDT is written back (and journaled) in units of blocks.
 	blockGroupDescriptorBuffer.resize(
-			(numBlockGroups * sizeof(DiskGroupDesc) + device->sectorSize - 1) & ~(device->sectorSize - 1));
+			(numBlockGroups * sizeof(DiskGroupDesc) + blockSize - 1) & ~size_t(blockSize - 1));
 	bgdt = (DiskGroupDesc *)blockGroupDescriptorBuffer.data();
 
 	auto bgdt_offset = (2048 + blockSize - 1) & ~size_t(blockSize - 1);
-	co_await device->readSectors((bgdt_offset >> blockShift) * sectorsPerBlock,
+	co_await device->read((bgdt_offset >> blockShift) * sectorsPerBlock,
 			blockGroupDescriptorBuffer.data(), blockGroupDescriptorBuffer.size() / device->sectorSize);
 
-	handleBgdtWriteback();
+	if((sb.featureCompat & EXT3_FEATURE_COMPAT_HAS_JOURNAL) && sb.journalInum) {
+		// Without the journal, we could neither recover the file system
+		// nor update it consistently; refuse to mount it.
+		FRG_CO_TRY(co_await loadJournal(sb.journalInum));
+
+		if(FRG_CO_TRY(co_await journal->recover())) {
+			// Replaying the journal can change all metadata, including the superblock.
+			co_await device->read(deviceSuperBlockSector, buffer.data(), deviceSuperBlockSectors);
+			memcpy(&sb, buffer.data() + deviceSuperBlockOffset, sizeof(DiskSuperblock));
+			co_await device->read((bgdt_offset >> blockShift) * sectorsPerBlock,
+					blockGroupDescriptorBuffer.data(),
+					blockGroupDescriptorBuffer.size() / device->sectorSize);
+		}
+
+		// Since we checkpoint every transaction right after it commits, the journal
+		// is empty whenever we are not committing. Nevertheless, other implementations
+		// need to look at the journal if we do not unmount cleanly.
+		sb.featureIncompat |= EXT3_FEATURE_INCOMPAT_RECOVER;
+		memcpy(buffer.data() + deviceSuperBlockOffset, &sb, sizeof(DiskSuperblock));
+		co_await device->writeFua(deviceSuperBlockSector, buffer.data(), deviceSuperBlockSectors);
+
+		journal->beforeCommit = [this] () -> async::result<void> {
+			// Updates of the BGDT become part of the transaction that is committed.
+			co_await writeBackBgdt();
+		};
+		journal->beforeCommitCredits = blockGroupDescriptorBuffer.size() >> blockShift;
+		journal->releaseBlocks = [this] (std::vector<uint32_t> blocks) -> async::result<void> {
+			// Each block can be in a different block group; the bitmap of each
+			// group is journaled as a whole page (see releaseBlocks()).
+			size_t bitmapBlocks = size_t{1} << (blockPagesShift - blockShift);
+			size_t groups = std::min(blocks.size(), size_t{numBlockGroups});
+			auto handle = co_await startHandle(true, groups * bitmapBlocks);
+			co_await releaseBlocks(blocks);
+		};
+		journal->run();
+	}
+	bgdtOnDisk = blockGroupDescriptorBuffer;
+
+	for(uint32_t bg_idx = 0; bg_idx < numBlockGroups; bg_idx++)
+		freeBlocksTotal += bgdt[bg_idx].freeBlocksCount;
+
+	// With a journal, the BGDT is written back when transactions are committed.
+	if(!journal)
+		handleBgdtWriteback();
 
 	// Create memory bundles to manage the block and inode bitmaps.
 	HelHandle block_bitmap_frontal, inode_bitmap_frontal;
@@ -531,17 +789,159 @@ async::result<void> FileSystem::init() {
 
 	manageInodeTable(helix::UniqueDescriptor{inode_table_backing});
 
-	co_return;
+	co_return {};
 }
 
 async::detached FileSystem::handleBgdtWriteback() {
 	while(true) {
 		co_await bdgtWriteback.async_wait();
 
-		auto bgdt_offset = (2048 + blockSize - 1) & ~size_t(blockSize - 1);
-		co_await device->writeSectors((bgdt_offset >> blockShift) * sectorsPerBlock,
-				blockGroupDescriptorBuffer.data(), blockGroupDescriptorBuffer.size() / device->sectorSize);
+		// Allocations tend to come in bursts; collect their updates into a single writeback.
+		co_await helix::sleepFor(bgdtWritebackDelay);
+
+		co_await writeBackBgdt();
+	}
+}
+
+async::result<void> FileSystem::writeBackBgdt() {
+	auto bgdt_block = ((2048 + blockSize - 1) & ~size_t(blockSize - 1)) >> blockShift;
+	auto numBlocks = blockGroupDescriptorBuffer.size() >> blockShift;
+
+	auto blockChanged = [&] (size_t i) {
+		return memcmp(blockGroupDescriptorBuffer.data() + (i << blockShift),
+				bgdtOnDisk.data() + (i << blockShift), blockSize);
+	};
+
+	// Only write the blocks that changed. We write from a copy such that
+	// updates during the writeback are detected (and written) in the next iteration.
+	bool changed = true;
+	while(changed) {
+		changed = false;
+		size_t i = 0;
+		while(i < numBlocks) {
+			if(!blockChanged(i)) {
+				i++;
+				continue;
+			}
+
+			size_t n = 1;
+			while(i + n < numBlocks && blockChanged(i + n))
+				n++;
+			memcpy(bgdtOnDisk.data() + (i << blockShift),
+					blockGroupDescriptorBuffer.data() + (i << blockShift), n << blockShift);
+			co_await writeMetadata(bgdt_block + i, bgdtOnDisk.data() + (i << blockShift), n);
+			i += n;
+			changed = true;
+		}
+	}
+}
+
+async::result<frg::expected<protocols::fs::Error>> FileSystem::loadJournal(uint32_t ino) {
+	// The inode is read directly from the device since the journal needs to be
+	// replayed before any metadata is cached.
+	auto bg_idx = (ino - 1) / inodesPerGroup;
+	auto offset = static_cast<size_t>((ino - 1) % inodesPerGroup) * inodeSize;
+	std::vector<std::byte> buffer(blockSize);
+	co_await device->read((bgdt[bg_idx].inodeTable + (offset >> blockShift)) * sectorsPerBlock,
+			buffer.data(), sectorsPerBlock);
+	DiskInode disk_inode;
+	memcpy(&disk_inode, buffer.data() + (offset & (blockSize - 1)), sizeof(DiskInode));
+
+	size_t num_blocks = disk_inode.size >> blockShift;
+	std::vector<uint64_t> map;
+	if(disk_inode.flags & EXT4_EXTENTS_FL) {
+		ExtentMap extents;
+		if(!(co_await readExtentTree(&disk_inode.data, extents))) {
+			std::cerr << "\e[31m" "ext2fs: Corrupted extent tree in journal inode" "\e[39m" << std::endl;
+			co_return protocols::fs::Error::internalError;
+		}
+		while(map.size() < num_blocks) {
+			auto run = extents.lookup(map.size(), num_blocks - map.size());
+			if(!run.physical || run.uninitialized) {
+				std::cerr << "\e[31m" "ext2fs: Journal inode has holes" "\e[39m" << std::endl;
+				co_return protocols::fs::Error::internalError;
+			}
+			for(size_t i = 0; i < run.length; i++)
+				map.push_back(run.physical + i);
+		}
+	}else{
+		auto &blocks = disk_inode.data.blocks;
+		for(size_t i = 0; i < 12 && map.size() < num_blocks; i++)
+			map.push_back(blocks.direct[i]);
+		co_await mapIndirectBlock(blocks.singleIndirect, 1, map, num_blocks);
+		co_await mapIndirectBlock(blocks.doubleIndirect, 2, map, num_blocks);
+		co_await mapIndirectBlock(blocks.tripleIndirect, 3, map, num_blocks);
+	}
+	assert(map.size() == num_blocks);
+
+	journal = std::make_unique<Journal>(device, blockSize, std::move(map));
+	co_return {};
+}
+
+async::result<void> FileSystem::mapIndirectBlock(uint32_t block, int depth,
+		std::vector<uint64_t> &map, size_t limit) {
+	if(map.size() >= limit)
+		co_return;
+	assert(block);
+
+	std::vector<uint32_t> entries(blockSize / 4);
+	co_await device->read(block * sectorsPerBlock, entries.data(), sectorsPerBlock);
+	for(auto entry : entries) {
+		if(map.size() >= limit)
+			break;
+		if(depth > 1) {
+			co_await mapIndirectBlock(entry, depth - 1, map, limit);
+		}else{
+			map.push_back(entry);
+		}
+	}
+}
+
+async::result<JournalHandle> FileSystem::startHandle(bool reserved, size_t credits) {
+	if(!journal)
+		co_return JournalHandle{};
+	co_return co_await journal->start(reserved, credits);
+}
+
+async::result<void> FileSystem::readMetadata(uint64_t block, void *buffer, size_t num_blocks) {
+	co_await device->read(block * sectorsPerBlock, buffer, num_blocks * sectorsPerBlock);
+	if(journal)
+		journal->overlay(block, buffer, num_blocks);
+}
+
+async::result<void> FileSystem::writeMetadata(uint64_t block, const void *buffer,
+		size_t num_blocks) {
+	if(journal) {
+		journal->writeMetadata(block, buffer, num_blocks);
+		co_return;
+	}
+	co_await device->write(block * sectorsPerBlock, buffer, num_blocks * sectorsPerBlock);
+}
+
+async::result<void> FileSystem::journalMetadata(void *pointer, size_t size) {
+	if(!journal)
+		co_return;
+	auto sync = co_await helix_ng::synchronizeSpace(
+			helix::BorrowedDescriptor{kHelNullHandle}, pointer, size);
+	HEL_CHECK(sync.error());
+}
+
+async::result<void> FileSystem::readFileBlocks(Inode *inode, uint64_t block,
+		void *buffer, size_t num_blocks) {
+	if(inode->fileType != kTypeRegular) {
+		co_await readMetadata(block, buffer, num_blocks);
+		co_return;
+	}
+	co_await device->read(block * sectorsPerBlock, buffer, num_blocks * sectorsPerBlock);
+}
+
+async::result<void> FileSystem::writeFileBlocks(Inode *inode, uint64_t block,
+		const void *buffer, size_t num_blocks) {
+	if(inode->fileType != kTypeRegular) {
+		co_await writeMetadata(block, buffer, num_blocks);
+		co_return;
 	}
+	co_await device->write(block * sectorsPerBlock, buffer, num_blocks * sectorsPerBlock);
 }
 
 async::detached FileSystem::manageBlockBitmap(helix::UniqueDescriptor memory) {
@@ -566,17 +966,14 @@ async::detached FileSystem::manageBlockBitmap(helix::UniqueDescriptor memory) {
 		if(manage.type() == kHelManageInitialize) {
 			helix::Mapping bitmap_map{memory,
 					static_cast<ptrdiff_t>(manage.offset()), manage.length()};
-			co_await device->readSectors(block * sectorsPerBlock,
-					bitmap_map.get(), sectorsPerBlock);
+			co_await readMetadata(block, bitmap_map.get(), 1);
 			HEL_CHECK(helUpdateMemory(memory.getHandle(), kHelManageInitialize,
 					manage.offset(), manage.length()));
 		}else{
 			assert(manage.type() == kHelManageWriteback);
-
 			helix::Mapping bitmap_map{memory,
 					static_cast<ptrdiff_t>(manage.offset()), manage.length()};
-			co_await device->writeSectors(block * sectorsPerBlock,
-					bitmap_map.get(), sectorsPerBlock);
+			co_await writeMetadata(block, bitmap_map.get(), 1);
 			HEL_CHECK(helUpdateMemory(memory.getHandle(), kHelManageWriteback,
 					manage.offset(), manage.length()));
 		}
@@ -610,17 +1007,14 @@ async::detached FileSystem::manageInodeBitmap(helix::UniqueDescriptor memory) {
 		if(manage.type() == kHelManageInitialize) {
 			helix::Mapping bitmap_map{memory,
 					static_cast<ptrdiff_t>(manage.offset()), manage.length()};
-			co_await device->readSectors(block * sectorsPerBlock,
-					bitmap_map.get(), sectorsPerBlock);
+			co_await readMetadata(block, bitmap_map.get(), 1);
 			HEL_CHECK(helUpdateMemory(memory.getHandle(), kHelManageInitialize,
 					manage.offset(), manage.length()));
 		}else{
 			assert(manage.type() == kHelManageWriteback);
-
 			helix::Mapping bitmap_map{memory,
 					static_cast<ptrdiff_t>(manage.offset()), manage.length()};
-			co_await device->writeSectors(block * sectorsPerBlock,
-					bitmap_map.get(), sectorsPerBlock);
+			co_await writeMetadata(block, bitmap_map.get(), 1);
 			HEL_CHECK(helUpdateMemory(memory.getHandle(), kHelManageWriteback,
 					manage.offset(), manage.length()));
 		}
@@ -651,23 +1045,22 @@ async::detached FileSystem::manageInodeTable(helix::UniqueDescriptor memory) {
 		auto block = bgdt[bg_idx].inodeTable;
 		assert(block);
 
-		assert(bg_offset % device->sectorSize == 0);
-		assert(manage.length() % device->sectorSize == 0);
+		assert(!(bg_offset & (blockSize - 1)));
+		assert(!(manage.length() & (blockSize - 1)));
 
 		if(manage.type() == kHelManageInitialize) {
 			helix::Mapping table_map{memory,
 					static_cast<ptrdiff_t>(manage.offset()), manage.length()};
-			co_await device->readSectors(block * sectorsPerBlock + bg_offset / device->sectorSize,
-					table_map.get(), manage.length() / device->sectorSize);
+			co_await readMetadata(block + (bg_offset >> blockShift),
+					table_map.get(), manage.length() >> blockShift);
 			HEL_CHECK(helUpdateMemory(memory.getHandle(), kHelManageInitialize,
 					manage.offset(), manage.length()));
 		}else{
 			assert(manage.type() == kHelManageWriteback);
-
 			helix::Mapping table_map{memory,
 					static_cast<ptrdiff_t>(manage.offset()), manage.length()};
-			co_await device->writeSectors(block * sectorsPerBlock + bg_offset / device->sectorSize,
-					table_map.get(), manage.length() / device->sectorSize);
+			co_await writeMetadata(block + (bg_offset >> blockShift),
+					table_map.get(), manage.length() >> blockShift);
 			HEL_CHECK(helUpdateMemory(memory.getHandle(), kHelManageWriteback,
 					manage.offset(), manage.length()));
 		}
@@ -721,12 +1114,19 @@ async::result<std::shared_ptr<Inode>> FileSystem::createRegular(int uid, int gid
 	memset(disk_inode, 0, inodeSize);
 	disk_inode->mode = EXT2_S_IFREG;
 	disk_inode->generation = generation + 1;
+	if(hasExtents) {
+		// Start with an empty extent tree.
+		std::vector<std::byte> nodes;
+		ExtentMap{}.buildTree(blockSize, &disk_inode->data, nodes);
+		disk_inode->flags |= EXT4_EXTENTS_FL;
+	}
 	struct timespec time = clk::getRealtime();
 	disk_inode->atime = time.tv_sec;
 	disk_inode->ctime = time.tv_sec;
 	disk_inode->mtime = time.tv_sec;
 	disk_inode->uid = uid;
 	disk_inode->gid = gid;
+	co_await journalMetadata(inode_map.get(), inodeSize);
 
 	co_return accessInode(ino);
 }
@@ -755,6 +1155,11 @@ async::result<std::shared_ptr<Inode>> FileSystem::createDirectory() {
 	memset(disk_inode, 0, inodeSize);
 	disk_inode->mode = EXT2_S_IFDIR;
 	disk_inode->generation = generation + 1;
+	if(hasExtents) {
+		std::vector<std::byte> nodes;
+		ExtentMap{}.buildTree(blockSize, &disk_inode->data, nodes);
+		disk_inode->flags |= EXT4_EXTENTS_FL;
+	}
 	struct timespec time = clk::getRealtime();
 	disk_inode->atime = time.tv_sec;
 	disk_inode->ctime = time.tv_sec;
@@ -764,6 +1169,7 @@ async::result<std::shared_ptr<Inode>> FileSystem::createDirectory() {
 	auto bg_idx = (ino - 1) / inodesPerGroup;
 	bgdt[bg_idx].usedDirsCount++;
 	bdgtWriteback.raise();
+	co_await journalMetadata(inode_map.get(), inodeSize);
 
 	co_return accessInode(ino);
 }
@@ -796,18 +1202,23 @@ async::result<std::shared_ptr<Inode>> FileSystem::createSymlink() {
 	disk_inode->atime = time.tv_sec;
 	disk_inode->ctime = time.tv_sec;
 	disk_inode->mtime = time.tv_sec;
+	co_await journalMetadata(inode_map.get(), inodeSize);
 
 	co_return accessInode(ino);
 }
 
-async::result<void> FileSystem::write(Inode *inode, uint64_t offset,
+async::result<frg::expected<protocols::fs::Error>> FileSystem::write(Inode *inode, uint64_t offset,
 		const void *buffer, size_t length) {
 	co_await inode->readyJump.wait();
+	if(inode->corrupted)
+		co_return protocols::fs::Error::internalError;
 
-	// Make sure that data blocks are allocated.
+	// Make sure that there is space for the data blocks. They are only allocated
+	// on writeback, when we know how much of the file is written in one go.
 	auto blockOffset = (offset & ~(blockSize - 1)) >> blockShift;
 	auto blockCount = ((offset & (blockSize - 1)) + length + (blockSize - 1)) >> blockShift;
-	co_await assignDataBlocks(inode, blockOffset, blockCount);
+	if(!(co_await reserveDataBlocks(inode, blockOffset, blockCount)))
+		co_return protocols::fs::Error::noSpaceLeft;
 
 	// Resize the file if necessary.
 	if(offset + length > inode->fileSize()) {
@@ -845,6 +1256,7 @@ async::result<void> FileSystem::write(Inode *inode, uint64_t offset,
 			helix::BorrowedDescriptor(inode->frontalMemory),
 			offset, length, buffer);
 	HEL_CHECK(writeMemory.error());
+	co_return {};
 }
 
 async::detached FileSystem::initiateInode(std::shared_ptr<Inode> inode) {
@@ -881,6 +1293,14 @@ async::detached FileSystem::initiateInode(std::shared_ptr<Inode> inode) {
 	inode->uid = disk_inode->uid;
 	inode->gid = disk_inode->gid;
 
+	if(disk_inode->flags & EXT4_EXTENTS_FL) {
+		if(!(co_await loadExtents(inode.get()))) {
+			// Do not fall back to indirection blocks; the page cache only sees holes.
+			inode->corrupted = true;
+			inode->extentMap = std::make_unique<ExtentMap>();
+		}
+	}
+
 	// Allocate a page cache for the file.
 	auto cache_size = (inode->fileSize() + 0xFFF) & ~size_t(0xFFF);
 	HEL_CHECK(helCreateManagedMemory(cache_size, kHelManagedReadahead,
@@ -904,7 +1324,10 @@ async::detached FileSystem::initiateInode(std::shared_ptr<Inode> inode) {
 
 	manageIndirect(inode, 1, helix::UniqueDescriptor{backingOrder1});
 	manageIndirect(inode, 2, helix::UniqueDescriptor{backingOrder2});
-	manageFileData(inode);
+	// Process multiple management requests concurrently, such that demand loads
+	// do not have to wait for readahead or writeback of other parts of the file.
+	for(int i = 0; i < fileDataWorkers; i++)
+		manageFileData(inode);
 
 	inode->isReady = true;
 	inode->readyJump.raise();
@@ -937,7 +1360,6 @@ async::detached FileSystem::manageFileData(std::shared_ptr<Inode> inode) {
 					manage.offset(), manage.length()));
 		}else{
 			assert(manage.type() == kHelManageWriteback);
-
 			helix::Mapping file_map{helix::BorrowedDescriptor{inode->backingMemory},
 					static_cast<ptrdiff_t>(manage.offset()), manage.length(), kHelMapProtRead};
 
@@ -946,8 +1368,26 @@ async::detached FileSystem::manageFileData(std::shared_ptr<Inode> inode) {
 			size_t num_blocks = (backed_size + (inode->fs.blockSize - 1)) / inode->fs.blockSize;
 
 			assert(num_blocks * inode->fs.blockSize <= manage.length());
-			co_await inode->fs.writeDataBlocks(inode, manage.offset() / inode->fs.blockSize,
+			auto block_offset = manage.offset() / inode->fs.blockSize;
+			OrderedData ordered;
+			bool delayed = inode->delayedBlocks.countMissing(block_offset, num_blocks) < num_blocks;
+			bool holes = inode->extentMap
+					&& inode->fs.countHoleBlocks(inode.get(), block_offset, num_blocks);
+			if(delayed || holes) {
+				// Allocating the delayed blocks modifies metadata. In ordered mode,
+				// that metadata is not committed before the data is written.
+				auto handle = co_await inode->fs.startHandle(true);
+				co_await inode->fs.allocateDelayedBlocks(inode.get(), block_offset, num_blocks);
+				if(holes && !(co_await inode->fs.allocateHoleBlocks(inode.get(),
+						block_offset, num_blocks)))
+					std::cerr << "\e[31m" "ext2fs: No space left to write back holes of inode "
+							<< inode->number << " that were written through mappings;"
+							" the data is lost" "\e[39m" << std::endl;
+				ordered = handle.orderData();
+			}
+			co_await inode->fs.writeDataBlocks(inode, block_offset,
 					num_blocks, file_map.get());
+			ordered = {};
 
 			HEL_CHECK(helUpdateMemory(inode->backingMemory, kHelManageWriteback,
 					manage.offset(), manage.length()));
@@ -1011,20 +1451,22 @@ async::detached FileSystem::manageIndirect(std::shared_ptr<Inode> inode,
 		if (manage.type() == kHelManageInitialize) {
 			helix::Mapping out_map{memory,
 					static_cast<ptrdiff_t>(manage.offset()), manage.length()};
-			co_await device->readSectors(block * sectorsPerBlock,
-					out_map.get(), sectorsPerBlock);
+			if(block) {
+				co_await readMetadata(block, out_map.get(), 1);
+			}else{
+				// The indirect block is not allocated (yet), e.g., because the allocation
+				// of the blocks that it maps is delayed. All of these blocks are holes.
+				memset(out_map.get(), 0, manage.length());
+			}
 			HEL_CHECK(helUpdateMemory(memory.getHandle(), kHelManageInitialize,
 					manage.offset(), manage.length()));
 		} else {
 			assert(manage.type() == kHelManageWriteback);
-
 			helix::Mapping out_map{memory,
 					static_cast<ptrdiff_t>(manage.offset()), manage.length()};
-			co_await device->writeSectors(block * sectorsPerBlock,
-					out_map.get(), sectorsPerBlock);
+			co_await writeMetadata(block, out_map.get(), 1);
 			HEL_CHECK(helUpdateMemory(memory.getHandle(), kHelManageWriteback,
 					manage.offset(), manage.length()));
-
 		}
 	}
 }
@@ -1033,57 +1475,303 @@ async::result<std::vector<uint32_t>> FileSystem::allocateBlocks(size_t num, std:
 	protocols::ostrace::Timer timer;
 	std::vector<uint32_t> result;
 
-	if (ino) {
-		uint32_t preferred_bg = (*ino - 1) / inodesPerGroup;
+	// Prefer the block group of the inode.
+	uint32_t goal = 0;
+	if(ino)
+		goal = ((*ino - 1) / inodesPerGroup) * blocksPerGroup;
+
+	bool discarded = false;
+	while(result.size() < num) {
+		auto run = co_await allocateRun(goal, num - result.size());
+		if(!run.length) {
+			// Blocks in preallocation windows are still free; take them back.
+			assert(preallocatedBlocks && !discarded && "Failed to find zero-bit");
+			discardAllPreallocations();
+			discarded = true;
+			continue;
+		}
+		for(uint32_t i = 0; i < run.length; i++)
+			result.push_back(run.start + i);
+		goal = run.start + run.length;
+	}
 
-		if(bgdt[preferred_bg].freeBlocksCount) {
-			helix::LockMemoryView lock_bitmap;
-			auto &&submit_bitmap = helix::submitLockMemoryView(blockBitmap,
+	ostContext.emit(
+		ostEvtExt2AllocateBlocks,
+		ostAttrTime(timer.elapsed())
+	);
+	co_return result;
+}
+
+async::result<std::vector<uint32_t>> FileSystem::allocateDataBlocks(Inode *inode,
+		uint64_t logical, size_t num, uint32_t goal) {
+	protocols::ostrace::Timer timer;
+	std::vector<uint32_t> result;
+
+	if(!goal)
+		goal = ((inode->number - 1) / inodesPerGroup) * blocksPerGroup;
+
+	auto &window = inode->prealloc;
+	if(window.length && window.logical != logical)
+		discardPreallocation(inode);
+
+	if(window.length) {
+		auto bg_idx = window.physical / blocksPerGroup;
+
+		helix::LockMemoryView lock_bitmap;
+		auto &&submit_bitmap = helix::submitLockMemoryView(blockBitmap,
 				&lock_bitmap,
-				preferred_bg << blockPagesShift, 1 << blockPagesShift,
+				bg_idx << blockPagesShift, 1 << blockPagesShift,
 				helix::Dispatcher::global());
+		co_await submit_bitmap.async_wait();
+		HEL_CHECK(lock_bitmap.error());
+
+		helix::Mapping bitmap_map{blockBitmap,
+				bg_idx << blockPagesShift, size_t{1} << blockPagesShift,
+				kHelMapProtRead | kHelMapProtWrite | kHelMapDontRequireBacking};
+
+		// The window can be discarded while we wait for the bitmap.
+		if(window.length) {
+			auto index = window.physical % blocksPerGroup;
+			auto n = std::min(num, static_cast<size_t>(window.length));
+			auto words = reinterpret_cast<uint32_t *>(bitmap_map.get());
+			clearBits(preallocMask(bg_idx).data(), index, n);
+			setBits(words, index, n);
+
+			bgdt[bg_idx].freeBlocksCount -= n;
+			freeBlocksTotal -= n;
+			preallocatedBlocks -= n;
+			for(size_t i = 0; i < n; i++)
+				result.push_back(window.physical + i);
+
+			window.logical += n;
+			window.physical += n;
+			window.length -= n;
+			goal = window.physical;
+			co_await journalMetadata(bitmap_map.get(), size_t{1} << blockPagesShift);
+		}
+	}
+
+	bool discarded = false;
+	while(result.size() < num) {
+		// Only open a new window for regular files and if the old one is used up.
+		bool preallocate = inode->fileType == kTypeRegular && !window.length;
+		auto run = co_await allocateRun(goal, num - result.size(),
+				preallocate ? inode : nullptr, logical + result.size());
+		if(!run.length) {
+			assert(preallocatedBlocks && !discarded && "Failed to find zero-bit");
+			discardAllPreallocations();
+			discarded = true;
+			continue;
+		}
+		for(uint32_t i = 0; i < run.length; i++)
+			result.push_back(run.start + i);
+		goal = run.start + run.length;
+	}
+
+	ostContext.emit(
+		ostEvtExt2AllocateBlocks,
+		ostAttrTime(timer.elapsed())
+	);
+	co_return result;
+}
+
+async::result<BitRun> FileSystem::allocateRun(uint32_t goal, uint32_t num,
+		Inode *inode, uint64_t logical) {
+	assert(num);
+	if(goal >= blocksCount)
+		goal = 0;
+
+	uint32_t wanted = num;
+	if(inode)
+		wanted += preallocationSize >> blockShift;
+
+	// The first pass only accepts runs that satisfy the whole request
+	// (or that continue at the goal); the second pass takes whatever is left.
+	auto goal_bg = goal / blocksPerGroup;
+	for(int pass = 0; pass < 2; pass++) {
+		for(uint32_t k = 0; k < numBlockGroups; k++) {
+			auto bg_idx = (goal_bg + k) % numBlockGroups;
+			if(!bgdt[bg_idx].freeBlocksCount)
+				continue;
+
+			helix::LockMemoryView lock_bitmap;
+			auto &&submit_bitmap = helix::submitLockMemoryView(blockBitmap,
+					&lock_bitmap,
+					bg_idx << blockPagesShift, 1 << blockPagesShift,
+					helix::Dispatcher::global());
 			co_await submit_bitmap.async_wait();
 			HEL_CHECK(lock_bitmap.error());
 
 			helix::Mapping bitmap_map{blockBitmap,
-				preferred_bg << blockPagesShift, size_t{1} << blockPagesShift,
-				kHelMapProtRead | kHelMapProtWrite | kHelMapDontRequireBacking};
+					bg_idx << blockPagesShift, size_t{1} << blockPagesShift,
+					kHelMapProtRead | kHelMapProtWrite | kHelMapDontRequireBacking};
 
 			auto words = reinterpret_cast<uint32_t *>(bitmap_map.get());
+			const uint32_t *mask = nullptr;
+			if(auto it = preallocMasks.find(bg_idx); it != preallocMasks.end())
+				mask = it->second.data();
+
+			// TODO: Make sure we never return reserved blocks.
+			auto num_bits = std::min(blocksPerGroup, blocksCount - bg_idx * blocksPerGroup);
+			auto goal_bit = (bg_idx == goal_bg) ? goal % blocksPerGroup : 0;
+			auto run = findFreeRun(words, mask, num_bits, goal_bit, wanted);
+			if(!run.length)
+				continue;
+			if(!pass && run.length < num && !(bg_idx == goal_bg && run.start == goal_bit))
+				continue;
 
-			for(unsigned int i = 0; i < (blocksPerGroup + 31) / 32; i++) {
-				if(words[i] == 0xFFFFFFFF)
-					continue;
-				for(int j = 0; j < 32; j++) {
-					if(i * 32 + j >= blocksPerGroup)
-						break;
-					if(words[i] & (static_cast<uint32_t>(1) << j))
-						continue;
-					// TODO: Make sure we never return reserved blocks.
-					// TODO: Make sure we never return blocks higher than the max. block in the SB.
-					auto block = preferred_bg * blocksPerGroup + i * 32 + j;
-					assert(block);
-					assert(block < blocksCount);
-					words[i] |= static_cast<uint32_t>(1) << j;
-
-					bgdt[preferred_bg].freeBlocksCount--;
-
-					result.push_back(block);
-					if(result.size() == num) {
-						ostContext.emit(
-							ostEvtExt2AllocateBlocks,
-							ostAttrTime(timer.elapsed())
-						);
-						co_return result;
-					}
-				}
+			auto n = std::min(run.length, num);
+			setBits(words, run.start, n);
+			bgdt[bg_idx].freeBlocksCount -= n;
+			freeBlocksTotal -= n;
+
+			if(inode && run.length > n) {
+				assert(!inode->prealloc.length);
+				setBits(preallocMask(bg_idx).data(), run.start + n, run.length - n);
+				inode->prealloc = {logical + n,
+						bg_idx * blocksPerGroup + run.start + n, run.length - n};
+				preallocatedBlocks += run.length - n;
 			}
+
+			co_await journalMetadata(bitmap_map.get(), size_t{1} << blockPagesShift);
+
+			auto block = bg_idx * blocksPerGroup + run.start;
+			assert(block);
+			co_return BitRun{block, n};
 		}
 	}
 
-	for(uint32_t bg_idx = 0; bg_idx < numBlockGroups; bg_idx++) {
-		if(!bgdt[bg_idx].freeBlocksCount)
-			continue;
+	co_return BitRun{0, 0};
+}
+
+void FileSystem::discardPreallocation(Inode *inode) {
+	auto &window = inode->prealloc;
+	if(!window.length)
+		return;
+
+	auto bg_idx = window.physical / blocksPerGroup;
+	clearBits(preallocMask(bg_idx).data(), window.physical % blocksPerGroup, window.length);
+	preallocatedBlocks -= window.length;
+	window = {};
+}
+
+void FileSystem::discardAllPreallocations() {
+	for(auto &[number, slot] : activeInodes) {
+		if(auto inode = slot.lock())
+			discardPreallocation(inode.get());
+	}
+	assert(!preallocatedBlocks);
+}
+
+std::vector<uint32_t> &FileSystem::preallocMask(uint32_t bg) {
+	auto &mask = preallocMasks[bg];
+	if(mask.empty())
+		mask.resize((blocksPerGroup + 31) / 32);
+	return mask;
+}
+
+async::result<bool> FileSystem::reserveDataBlocks(Inode *inode,
+		uint64_t block_offset, size_t num_blocks) {
+	// Finding holes in files that use indirect blocks requires walking the indirect blocks.
+	// Hence, we only delay the allocation of blocks beyond the end of such files;
+	// other blocks are assigned immediately (unless they are already delayed).
+	if(!inode->extentMap) {
+		uint64_t file_blocks = (inode->fileSize() + blockSize - 1) >> blockShift;
+		if(block_offset < file_blocks) {
+			auto n = std::min(static_cast<uint64_t>(num_blocks), file_blocks - block_offset);
+			if(inode->delayedBlocks.countMissing(block_offset, n))
+				co_await assignDataBlocks(inode, block_offset, n);
+			block_offset += n;
+			num_blocks -= n;
+		}
+	}
+
+	std::vector<BlockRange> holes;
+	uint64_t required = 0;
+	size_t prg = 0;
+	while(prg < num_blocks) {
+		BlockRun run{0, num_blocks - prg, false};
+		if(inode->extentMap)
+			run = inode->extentMap->lookup(block_offset + prg, num_blocks - prg);
+		if(!run.physical) {
+			required += inode->delayedBlocks.countMissing(block_offset + prg, run.length);
+			holes.push_back({block_offset + prg, run.length});
+		}
+		prg += run.length;
+	}
+	if(!required)
+		co_return true;
+
+	// Leave some room for indirect blocks or extent tree nodes.
+	auto metadata = required / (blockSize / 4) + 3;
+	if(reservedBlocks + required + metadata > freeBlocksTotal)
+		co_return false;
+
+	for(auto hole : holes)
+		inode->delayedBlocks.insert(hole.start, hole.length);
+	reservedBlocks += required;
+	co_return true;
+}
+
+async::result<void> FileSystem::allocateDelayedBlocks(Inode *inode,
+		uint64_t block_offset, size_t num_blocks) {
+	auto ranges = inode->delayedBlocks.extract(block_offset, num_blocks);
+	for(auto range : ranges) {
+		co_await assignDataBlocks(inode, range.start, range.length);
+		assert(reservedBlocks >= range.length);
+		reservedBlocks -= range.length;
+	}
+}
+
+uint64_t FileSystem::countHoleBlocks(Inode *inode, uint64_t block_offset, size_t num_blocks) {
+	assert(inode->extentMap);
+	uint64_t holes = 0;
+	size_t prg = 0;
+	while(prg < num_blocks) {
+		auto run = inode->extentMap->lookup(block_offset + prg, num_blocks - prg);
+		if(!run.physical)
+			holes += inode->delayedBlocks.countMissing(block_offset + prg, run.length);
+		prg += run.length;
+	}
+	return holes;
+}
+
+async::result<bool> FileSystem::allocateHoleBlocks(Inode *inode,
+		uint64_t block_offset, size_t num_blocks) {
+	auto required = countHoleBlocks(inode, block_offset, num_blocks);
+	if(!required)
+		co_return true;
+
+	// Like reserveDataBlocks(), leave room for extent tree nodes
+	// and do not steal blocks that are reserved for delayed allocation.
+	auto metadata = required / (blockSize / 4) + 3;
+	if(reservedBlocks + required + metadata > freeBlocksTotal)
+		co_return false;
+
+	co_await assignDataBlocks(inode, block_offset, num_blocks);
+	co_return true;
+}
+
+void FileSystem::dropDelayedBlocks(Inode *inode, uint64_t block_offset, size_t num_blocks) {
+	auto ranges = inode->delayedBlocks.extract(block_offset, num_blocks);
+	for(auto range : ranges) {
+		assert(reservedBlocks >= range.length);
+		reservedBlocks -= range.length;
+	}
+}
+
+async::result<void> FileSystem::freeBlocks(const std::vector<uint32_t> &blocks) {
+	if(journal) {
+		journal->deferFree(blocks);
+		co_return;
+	}
+	co_await releaseBlocks(blocks);
+}
+
+async::result<void> FileSystem::releaseBlocks(const std::vector<uint32_t> &blocks) {
+	for(auto block : blocks) {
+		auto bg_idx = block / blocksPerGroup;
+		auto index = block % blocksPerGroup;
 
 		helix::LockMemoryView lock_bitmap;
 		auto &&submit_bitmap = helix::submitLockMemoryView(blockBitmap,
@@ -1098,35 +1786,13 @@ async::result<std::vector<uint32_t>> FileSystem::allocateBlocks(size_t num, std:
 				kHelMapProtRead | kHelMapProtWrite | kHelMapDontRequireBacking};
 
 		auto words = reinterpret_cast<uint32_t *>(bitmap_map.get());
-		for(unsigned int i = 0; i < (blocksPerGroup + 31) / 32; i++) {
-			if(words[i] == 0xFFFFFFFF)
-				continue;
-			for(int j = 0; j < 32; j++) {
-				if(i * 32 + j >= blocksPerGroup)
-					break;
-				if(words[i] & (static_cast<uint32_t>(1) << j))
-					continue;
-				// TODO: Make sure we never return reserved blocks.
-				// TODO: Make sure we never return blocks higher than the max. block in the SB.
-				auto block = bg_idx * blocksPerGroup + i * 32 + j;
-				assert(block);
-				assert(block < blocksCount);
-				words[i] |= static_cast<uint32_t>(1) << j;
+		assert(words[index / 32] & (static_cast<uint32_t>(1) << (index % 32)));
+		words[index / 32] &= ~(static_cast<uint32_t>(1) << (index % 32));
 
-				bgdt[bg_idx].freeBlocksCount--;
-				result.push_back(block);
-				if(result.size() == num) {
-					ostContext.emit(
-						ostEvtExt2AllocateBlocks,
-						ostAttrTime(timer.elapsed())
-					);
-					co_return result;
-				}
-			}
-		}
+		bgdt[bg_idx].freeBlocksCount++;
+		freeBlocksTotal++;
+		co_await journalMetadata(bitmap_map.get(), size_t{1} << blockPagesShift);
 	}
-
-	assert(!"Failed to find zero-bit");
 }
 
 async::result<uint32_t> FileSystem::allocateInode(uint32_t parentIno, bool directory) {
@@ -1167,6 +1833,7 @@ async::result<uint32_t> FileSystem::allocateInode(uint32_t parentIno, bool direc
 					bgdt[bg].usedDirsCount++;
 
 				bdgtWriteback.raise();
+				co_await journalMetadata(bitmap_map.get(), size_t{1} << blockPagesShift);
 
 				ostContext.emit(
 					ostEvtExt2AllocateInode,
@@ -1225,6 +1892,29 @@ async::result<void> FileSystem::assignDataBlocks(Inode *inode,
 		uint64_t block_offset, size_t num_blocks) {
 	protocols::ostrace::Timer timer;
 
+	co_await inode->assignMutex.async_lock();
+	frg::unique_lock lock{frg::adopt_lock, inode->assignMutex};
+
+	if(inode->extentMap) {
+		co_await assignExtents(inode, block_offset, num_blocks);
+	}else{
+		co_await assignIndirectBlocks(inode, block_offset, num_blocks);
+	}
+
+	bdgtWriteback.raise();
+	auto syncInode = co_await helix_ng::synchronizeSpace(
+			helix::BorrowedDescriptor{kHelNullHandle},
+			inode->diskMapping.get(), inodeSize);
+	HEL_CHECK(syncInode.error());
+
+	ostContext.emit(
+		ostEvtExt2AssignDataBlocks,
+		ostAttrTime(timer.elapsed())
+	);
+}
+
+async::result<void> FileSystem::assignIndirectBlocks(Inode *inode,
+		uint64_t block_offset, size_t num_blocks) {
 	size_t per_indirect = blockSize / 4;
 	size_t per_single = per_indirect;
 	size_t per_double = per_indirect * per_indirect;
@@ -1259,7 +1949,10 @@ async::result<void> FileSystem::assignDataBlocks(Inode *inode,
 					continue;
 				}
 
-				auto allocated = co_await allocateBlocks(range, inode->number);
+				uint32_t goal = 0;
+				if(idx && disk_inode->data.blocks.direct[idx - 1])
+					goal = disk_inode->data.blocks.direct[idx - 1] + 1;
+				auto allocated = co_await allocateDataBlocks(inode, idx, range, goal);
 				for (auto const [blocknum, block] : std::views::enumerate(allocated))
 					disk_inode->data.blocks.direct[idx + blocknum] = block;
 
@@ -1313,13 +2006,16 @@ async::result<void> FileSystem::assignDataBlocks(Inode *inode,
 					continue;
 				}
 
-				auto allocated = co_await allocateBlocks(range, inode->number);
+				auto previous = idx ? window[idx - 1] : disk_inode->data.blocks.singleIndirect;
+				uint32_t goal = previous ? previous + 1 : 0;
+				auto allocated = co_await allocateDataBlocks(inode, block_offset + prg, range, goal);
 				for (auto const [blocknum, block] : std::views::enumerate(allocated))
 					window[idx + blocknum] = block;
 
 				disk_inode->blocks += allocated.size() * (blockSize / 512);
 				prg += allocated.size();
 			}
+			co_await journalMetadata(window, size_t{1} << blockPagesShift);
 		}else if(block_offset + prg < d_range) {
 			bool doubleNeedsReset = false;
 			if(!disk_inode->data.blocks.doubleIndirect) {
@@ -1391,28 +2087,136 @@ async::result<void> FileSystem::assignDataBlocks(Inode *inode,
 					continue;
 				}
 
-				auto allocated = co_await allocateBlocks(range, inode->number);
+				auto previous = indirect_index ? window[indirect_index - 1]
+						: double_window[indirect_frame];
+				uint32_t goal = previous ? previous + 1 : 0;
+				auto allocated = co_await allocateDataBlocks(inode, block_offset + prg, range, goal);
 				for (auto const [blocknum, block] : std::views::enumerate(allocated))
 					window[indirect_index + blocknum] = block;
 
 				disk_inode->blocks += allocated.size() * (blockSize / 512);
 				prg += allocated.size();
+				co_await journalMetadata(window, size_t{1} << blockPagesShift);
 			}
+			co_await journalMetadata(double_window, size_t{1} << blockPagesShift);
 		}else{
 			assert(!"TODO: Implement allocation in triple indirect blocks");
 		}
 	}
+}
 
-	bdgtWriteback.raise();
-	auto syncInode = co_await helix_ng::synchronizeSpace(
-			helix::BorrowedDescriptor{kHelNullHandle},
-			inode->diskMapping.get(), inodeSize);
-	HEL_CHECK(syncInode.error());
+async::result<void> FileSystem::assignExtents(Inode *inode,
+		uint64_t block_offset, size_t num_blocks) {
+	co_await inode->extentMutex.async_lock();
+	frg::unique_lock lock{frg::adopt_lock, inode->extentMutex};
 
-	ostContext.emit(
-		ostEvtExt2AssignDataBlocks,
-		ostAttrTime(timer.elapsed())
-	);
+	auto map = inode->extentMap.get();
+	auto disk_inode = inode->diskInode();
+
+	bool changed = false;
+	size_t prg = 0;
+	while(prg < num_blocks) {
+		auto run = map->lookup(block_offset + prg, num_blocks - prg);
+		if(run.physical) {
+			prg += run.length;
+			continue;
+		}
+
+		// Fill the hole, preferably right behind the preceding extent.
+		// Runs of consecutive blocks become a single extent,
+		// which is also merged with the preceding extent if possible.
+		uint32_t goal = 0;
+		if(block_offset + prg) {
+			auto previous = map->lookup(block_offset + prg - 1, 1);
+			if(previous.physical)
+				goal = previous.physical + 1;
+		}
+		auto allocated = co_await allocateDataBlocks(inode, block_offset + prg, run.length, goal);
+		assert(allocated.size() == run.length);
+		size_t i = 0;
+		while(i < allocated.size()) {
+			size_t n = 1;
+			while(i + n < allocated.size() && allocated[i + n] == allocated[i] + n)
+				n++;
+			map->insert(block_offset + prg + i, allocated[i], n);
+			i += n;
+		}
+
+		disk_inode->blocks += allocated.size() * (blockSize / 512);
+		prg += allocated.size();
+		changed = true;
+	}
+
+	if(changed)
+		co_await storeExtents(inode);
+}
+
+async::result<frg::expected<protocols::fs::Error>> FileSystem::loadExtents(Inode *inode) {
+	auto map = std::make_unique<ExtentMap>();
+
+	// The root of the tree is stored in the inode itself.
+	if(!(co_await readExtentTree(&inode->diskInode()->data, *map))) {
+		std::cerr << "\e[31m" "ext2fs: Corrupted extent tree in inode " << inode->number
+				<< "\e[39m" << std::endl;
+		co_return protocols::fs::Error::internalError;
+	}
+
+	inode->extentMap = std::move(map);
+	co_return {};
+}
+
+async::result<bool> FileSystem::readExtentTree(const void *root, ExtentMap &map) {
+	auto depth = reinterpret_cast<const ExtentHeader *>(root)->depth;
+	std::vector<uint64_t> children;
+	if(!parseExtentNode(root, sizeof(FileData), depth, map, children))
+		co_return false;
+
+	// Walk the remaining levels of the tree.
+	std::vector<std::byte> buffer(blockSize);
+	while(depth) {
+		depth--;
+		std::vector<uint64_t> next;
+		for(auto block : children) {
+			co_await readMetadata(block, buffer.data(), 1);
+			if(!parseExtentNode(buffer.data(), blockSize, depth, map, next))
+				co_return false;
+			map.treeBlocks.push_back(block);
+			map.nodes.insert(map.nodes.end(), buffer.begin(), buffer.end());
+		}
+		children = std::move(next);
+	}
+	co_return true;
+}
+
+async::result<void> FileSystem::storeExtents(Inode *inode) {
+	auto map = inode->extentMap.get();
+	auto disk_inode = inode->diskInode();
+
+	// Reuse the existing nodes of the tree; allocate or free nodes as necessary.
+	// Note that the layout of the nodes is recomputed from scratch.
+	auto required = map->countTreeBlocks(blockSize);
+	if(required > map->treeBlocks.size()) {
+		auto allocated = co_await allocateBlocks(required - map->treeBlocks.size(),
+				inode->number);
+		disk_inode->blocks += allocated.size() * (blockSize / 512);
+		map->treeBlocks.insert(map->treeBlocks.end(), allocated.begin(), allocated.end());
+	}else if(required < map->treeBlocks.size()) {
+		std::vector<uint32_t> unused(map->treeBlocks.begin() + required, map->treeBlocks.end());
+		co_await freeBlocks(unused);
+		disk_inode->blocks -= unused.size() * (blockSize / 512);
+		map->treeBlocks.resize(required);
+	}
+
+	auto oldNodes = std::move(map->nodes);
+	map->buildTree(blockSize, &disk_inode->data, map->nodes);
+
+	for(size_t i = 0; i < map->treeBlocks.size(); i++) {
+		auto node = map->nodes.data() + i * blockSize;
+		if((i + 1) * blockSize <= oldNodes.size()
+				&& !memcmp(node, oldNodes.data() + i * blockSize, blockSize))
+			continue;
+		co_await writeMetadata(map->treeBlocks[i], node, 1);
+	}
 }
 
 async::result<void> FileSystem::readDataBlocks(std::shared_ptr<Inode> inode,
@@ -1441,6 +2245,23 @@ async::result<void> FileSystem::readDataBlocks(std::shared_ptr<Inode> inode,
 	co_await inode->readyJump.wait();
 	// TODO: Assert that we do not read past the EOF.
 
+	// Extents map directly to contiguous reads, no matter how large they are.
+	if(inode->extentMap) {
+		size_t progress = 0;
+		while(progress < num_blocks) {
+			auto run = inode->extentMap->lookup(offset + progress, num_blocks - progress);
+			auto out = (uint8_t *)buffer + progress * blockSize;
+			if(run.physical && !run.uninitialized) {
+				co_await readFileBlocks(inode.get(), run.physical, out, run.length);
+			}else{
+				// Holes and uninitialized extents read as zeros.
+				memset(out, 0, run.length * blockSize);
+			}
+			progress += run.length;
+		}
+		co_return;
+	}
+
 	constexpr size_t indirectBufferSize = 8;
 
 	std::array<uint32_t, indirectBufferSize> indirectBuffer;
@@ -1524,9 +2345,8 @@ async::result<void> FileSystem::readDataBlocks(std::shared_ptr<Inode> inode,
 //				<< " blocks, starting at " << issue.first << std::endl;
 
 		if (issue.first) {
-			co_await device->readSectors(issue.first * sectorsPerBlock,
-					(uint8_t *)buffer + progress * blockSize,
-					issue.second * sectorsPerBlock);
+			co_await readFileBlocks(inode.get(), issue.first,
+					(uint8_t *)buffer + progress * blockSize, issue.second);
 		} else {
 			memset((uint8_t *)buffer + progress * blockSize, 0, issue.second * blockSize);
 		}
@@ -1562,6 +2382,41 @@ async::result<void> FileSystem::writeDataBlocks(std::shared_ptr<Inode> inode,
 	co_await inode->readyJump.wait();
 	// TODO: Assert that we do not write past the EOF.
 
+	if(inode->extentMap) {
+		bool uninitialized = false;
+		size_t progress = 0;
+		while(progress < num_blocks) {
+			auto run = inode->extentMap->lookup(offset + progress, num_blocks - progress);
+			// Holes are allocated before writeback (see allocateHoleBlocks()).
+			// They only remain if the file system ran out of space.
+			if(!run.physical) {
+				progress += run.length;
+				continue;
+			}
+			co_await writeFileBlocks(inode.get(), run.physical,
+					(const uint8_t *)buffer + progress * blockSize, run.length);
+			if(run.uninitialized)
+				uninitialized = true;
+			progress += run.length;
+		}
+
+		// Now that the data is on disk, the blocks can be read back.
+		if(uninitialized) {
+			auto handle = co_await startHandle(true);
+			co_await inode->extentMutex.async_lock();
+			frg::unique_lock lock{frg::adopt_lock, inode->extentMutex};
+			if(inode->extentMap->markInitialized(offset, num_blocks)) {
+				co_await storeExtents(inode.get());
+				bdgtWriteback.raise();
+				auto syncInode = co_await helix_ng::synchronizeSpace(
+						helix::BorrowedDescriptor{kHelNullHandle},
+						inode->diskMapping.get(), inodeSize);
+				HEL_CHECK(syncInode.error());
+			}
+		}
+		co_return;
+	}
+
 	size_t progress = 0;
 	while(progress < num_blocks) {
 		// Block number and block count of the writeSectors() command that we will issue here.
@@ -1615,10 +2470,10 @@ async::result<void> FileSystem::writeDataBlocks(std::shared_ptr<Inode> inode,
 //		std::cout << "Issuing write of " << issue.second
 //				<< " blocks, starting at " << issue.first << std::endl;
 
-		assert(issue.first);
-		co_await device->writeSectors(issue.first * sectorsPerBlock,
-				(const uint8_t *)buffer + progress * blockSize,
-				issue.second * sectorsPerBlock);
+		// Skip holes, see above.
+		if(issue.first)
+			co_await writeFileBlocks(inode.get(), issue.first,
+					(const uint8_t *)buffer + progress * blockSize, issue.second);
 		progress += issue.second;
 	}
 }
@@ -1638,6 +2493,10 @@ async::result<void> FileSystem::truncate(Inode *inode, size_t size) {
 		auto [blockOffset, alignedSize] = core::alignExtend({oldsize, diff}, blockSize);
 		size_t blockCount = alignedSize / blockSize;
 		co_await inode->fs.assignDataBlocks(inode, blockOffset, blockCount);
+	}else{
+		// Delayed blocks behind the new end of the file are never written back.
+		uint64_t fileBlocks = (size + blockSize - 1) >> blockShift;
+		dropDelayedBlocks(inode, fileBlocks, std::numeric_limits<uint64_t>::max() - fileBlocks);
 	}
 
 	auto syncInode = co_await helix_ng::synchronizeSpace(
@@ -1647,6 +2506,66 @@ async::result<void> FileSystem::truncate(Inode *inode, size_t size) {
 	co_return;
 }
 
+async::result<frg::expected<protocols::fs::Error>> FileSystem::fsync(Inode *inode) {
+	co_await inode->readyJump.wait();
+
+	auto syncInode = co_await helix_ng::synchronizeSpace(
+			helix::BorrowedDescriptor{kHelNullHandle},
+			inode->diskMapping.get(), inodeSize);
+	HEL_CHECK(syncInode.error());
+
+	co_await waitForWriteback(inode);
+	co_return co_await commitMetadata();
+}
+
+async::result<frg::expected<protocols::fs::Error>> FileSystem::sync() {
+	std::vector<std::shared_ptr<Inode>> inodes;
+	for(auto &[number, slot] : activeInodes) {
+		auto inode = slot.lock();
+		if(inode && inode->isReady)
+			inodes.push_back(std::move(inode));
+	}
+
+	for(auto &inode : inodes) {
+		auto syncInode = co_await helix_ng::synchronizeSpace(
+				helix::BorrowedDescriptor{kHelNullHandle},
+				inode->diskMapping.get(), inodeSize);
+		HEL_CHECK(syncInode.error());
+
+		co_await waitForWriteback(inode.get());
+	}
+	co_return co_await commitMetadata();
+}
+
+async::result<void> FileSystem::waitForWriteback(helix::BorrowedDescriptor memory) {
+	size_t size;
+	HEL_CHECK(helMemoryInfo(memory.getHandle(), &size));
+	auto fence = co_await helix_ng::writebackFence(memory, 0, size);
+	HEL_CHECK(fence.error());
+}
+
+async::result<void> FileSystem::waitForWriteback(Inode *inode) {
+	// Writing back data allocates delayed blocks, which dirties indirection blocks.
+	// Hence, wait for the data first.
+	co_await waitForWriteback(helix::BorrowedDescriptor{inode->frontalMemory});
+	co_await waitForWriteback(inode->indirectOrder1);
+	co_await waitForWriteback(inode->indirectOrder2);
+}
+
+async::result<frg::expected<protocols::fs::Error>> FileSystem::commitMetadata() {
+	// The writeback of data and indirection blocks can dirty the bitmaps and the inode table.
+	co_await waitForWriteback(blockBitmap);
+	co_await waitForWriteback(inodeBitmap);
+	co_await waitForWriteback(inodeTable);
+	// The BGDT is not cached in managed memory; write it back directly.
+	co_await writeBackBgdt();
+
+	// Metadata only becomes durable once its transaction is committed.
+	if(journal)
+		FRG_CO_TRY(co_await journal->commit());
+	co_return co_await device->flush();
+}
+
 // --------------------------------------------------------
 // OpenFile
 // --------------------------------------------------------
@@ -5,18 +5,25 @@
 #include <optional>
 #include <memory>
 #include <optional>
+#include <set>
+#include <string>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 #include <protocols/fs/file-locks.hpp>
 
+#include <async/mutex.hpp>
 #include <async/oneshot-event.hpp>
 #include <async/recurring-event.hpp>
 #include <hel.h>
 
 #include <blockfs.hpp>
+#include "allocator.hpp"
 #include "common.hpp"
+#include "extents.hpp"
 #include "fs.bragi.hpp"
+#include "journal.hpp"
+#include "readahead.hpp"
 
 namespace blockfs {
 namespace ext2fs {
@@ -94,10 +101,35 @@ struct DiskSuperblock {
 	//-- Other options --
 	uint32_t defaultMountOptions;
 	uint32_t firstMetaBg;
-	uint8_t unused[760];
+	uint32_t mkfsTime;
+	uint32_t jnlBlocks[17];
+	//-- 64bit Support --
+	uint32_t blocksCountHi;
+	uint32_t rBlocksCountHi;
+	uint32_t freeBlocksCountHi;
+	uint16_t minExtraIsize;
+	uint16_t wantExtraIsize;
+	uint32_t flags;
+	uint8_t unused[668];
 };
 static_assert(sizeof(DiskSuperblock) == 1024, "Bad DiskSuperblock struct size");
 
+enum {
+	EXT3_FEATURE_COMPAT_HAS_JOURNAL = 0x4,
+	EXT2_FEATURE_COMPAT_DIR_INDEX = 0x20
+};
+
+enum {
+	// The journal may contain transactions that need to be replayed.
+	EXT3_FEATURE_INCOMPAT_RECOVER = 0x4,
+	EXT4_FEATURE_INCOMPAT_EXTENTS = 0x40
+};
+
+enum {
+	// The file system was created on a platform where char is unsigned.
+	EXT2_FLAGS_UNSIGNED_HASH = 0x2
+};
+
 struct DiskGroupDesc {
 	uint32_t blockBitmap;
 	uint32_t inodeBitmap;
@@ -136,6 +168,13 @@ enum {
 	EXT2_ROOT_INO = 2
 };
 
+enum {
+	// The directory is a hash tree (see htree.hpp).
+	EXT2_INDEX_FL = 0x1000,
+	// The inode's data is mapped by an extent tree (see extents.hpp).
+	EXT4_EXTENTS_FL = 0x80000
+};
+
 enum {
 	EXT2_S_IFMT = 0xF000,
 	EXT2_S_IFLNK = 0xA000,
@@ -166,6 +205,33 @@ struct DirEntry {
 	FileType fileType;
 };
 
+// --------------------------------------------------------
+// DirIndex
+// --------------------------------------------------------
+
+// In-memory index of a directory. Maps names to the records that contain them
+// and keeps track of the unused space at the end of each record,
+// such that neither lookups nor insertions have to walk the directory.
+struct DirIndex {
+	struct Entry {
+		uint32_t offset;
+		uint32_t inode;
+		uint8_t fileType;
+	};
+
+	// Updates the amount of space that can be reused within the record at offset.
+	void setSlack(uint32_t offset, size_t slack);
+
+	// Returns the offset of a record with at least the given amount of unused space.
+	std::optional<uint32_t> findSlack(size_t required);
+
+	std::unordered_map<std::string, Entry> entries;
+
+private:
+	std::set<std::pair<size_t, uint32_t>> _bySlack;
+	std::unordered_map<uint32_t, size_t> _slackOf;
+};
+
 // --------------------------------------------------------
 // Inode
 // --------------------------------------------------------
@@ -174,6 +240,7 @@ struct FileSystem;
 
 struct Inode : std::enable_shared_from_this<Inode> {
 	Inode(FileSystem &fs, uint32_t number);
+	~Inode();
 
 	DiskInode *diskInode() {
 		return reinterpret_cast<DiskInode *>(diskMapping.get());
@@ -196,6 +263,22 @@ struct Inode : std::enable_shared_from_this<Inode> {
 	async::result<protocols::fs::Error> chmod(int mode);
 	async::result<protocols::fs::Error> utimensat(std::optional<timespec> atime, std::optional<timespec> mtime, timespec ctime);
 
+	// Locks the given byte range of the page cache and returns the lock.
+	async::result<helix::UniqueDescriptor> lockRange(uintptr_t offset, size_t length);
+
+	// The following functions must be called with dirMutex held.
+
+	// Builds dirIndex by walking the directory.
+	async::result<void> buildDirIndex();
+
+	// Looks up an entry through the on-disk hash tree of the directory.
+	// Returns Error::internalError if the hash tree is corrupted.
+	async::result<frg::expected<protocols::fs::Error, std::optional<DirEntry>>>
+	findHashedEntry(const std::string &name);
+
+	// Turns a hashed directory into a linear one before it is modified.
+	async::result<void> dropHashTree();
+
 	FileSystem &fs;
 
 	// ext2fs on-disk inode number
@@ -204,6 +287,10 @@ struct Inode : std::enable_shared_from_this<Inode> {
 	// true if this inode has already been loaded from disk
 	bool isReady;
 
+	// true if the extent tree of this inode is corrupted. Accesses to the
+	// contents of the inode fail with Error::internalError (i.e., EIO).
+	bool corrupted = false;
+
 	helix::UniqueDescriptor diskLock;
 	helix::Mapping diskMapping;
 
@@ -228,6 +315,29 @@ struct Inode : std::enable_shared_from_this<Inode> {
 	// - Indirection level 3/3 for triple indirect blocks.
 	helix::UniqueDescriptor indirectOrder3;
 
+	// Copy of the extent tree if the inode uses extents instead of indirection blocks.
+	// Loaded when the inode is initiated; modifications are serialized by extentMutex.
+	std::unique_ptr<ExtentMap> extentMap;
+	async::mutex extentMutex;
+
+	// Serializes the assignment of blocks to this inode.
+	async::mutex assignMutex;
+
+	// Logical blocks that were written but that are not allocated yet (delayed allocation).
+	// They are allocated when their pages are written back;
+	// until then, FileSystem::reservedBlocks accounts for them.
+	BlockRangeSet delayedBlocks;
+
+	// Blocks behind the last allocation that are set aside for this inode,
+	// such that files that are written concurrently do not interleave on disk.
+	// The blocks are only marked in the bitmap once they are assigned.
+	struct Preallocation {
+		// Logical block that the window continues.
+		uint64_t logical;
+		uint32_t physical;
+		uint32_t length;
+	} prealloc{};
+
 	// NOTE: The following fields are only meaningful if the isReady is true
 
 	FileType fileType;
@@ -236,6 +346,13 @@ struct Inode : std::enable_shared_from_this<Inode> {
 	FlockManager flockManager;
 
 	std::unordered_set<std::string> obstructedLinks;
+
+	// Only meaningful for directories. Built on the first lookup that does
+	// not go through the on-disk hash tree and kept up-to-date by link() and unlink().
+	std::unique_ptr<DirIndex> dirIndex;
+
+	// Serializes modifications of the directory.
+	async::mutex dirMutex;
 };
 
 // --------------------------------------------------------
@@ -245,10 +362,41 @@ struct Inode : std::enable_shared_from_this<Inode> {
 struct FileSystem {
 	FileSystem(BlockDevice *device);
 
-	async::result<void> init();
+	// Fails with Error::internalError if the file system cannot be mounted.
+	async::result<frg::expected<protocols::fs::Error>> init();
 
 	async::recurring_event bdgtWriteback;
 	async::detached handleBgdtWriteback();
+	// Writes the blocks of the BGDT that changed since they were last written.
+	async::result<void> writeBackBgdt();
+
+	// Sets up the journal that is stored in the given inode.
+	async::result<frg::expected<protocols::fs::Error>> loadJournal(uint32_t ino);
+	// Appends the blocks that an indirect block of the given depth maps to map.
+	async::result<void> mapIndirectBlock(uint32_t block, int depth,
+			std::vector<uint64_t> &map, size_t limit);
+
+	// Starts a journal handle; all metadata updates of an operation must happen while
+	// holding the handle (see JournalHandle). Returns an empty handle if there is no journal.
+	// credits bounds the number of metadata blocks that the operation updates.
+	async::result<JournalHandle> startHandle(bool reserved = false,
+			size_t credits = Journal::defaultCredits);
+
+	// Reads or writes metadata blocks. If the file system has a journal, writes
+	// go to the running transaction and reads see the contents of the journal.
+	async::result<void> readMetadata(uint64_t block, void *buffer, size_t num_blocks);
+	async::result<void> writeMetadata(uint64_t block, const void *buffer, size_t num_blocks);
+
+	// Forces the writeback of mapped metadata if the file system has a journal,
+	// such that it becomes part of the transaction of the current operation.
+	async::result<void> journalMetadata(void *pointer, size_t size);
+
+	// Like readMetadata() and writeMetadata() for blocks of files.
+	// Blocks of directories and symlinks are metadata, those of regular files are not.
+	async::result<void> readFileBlocks(Inode *inode, uint64_t block,
+			void *buffer, size_t num_blocks);
+	async::result<void> writeFileBlocks(Inode *inode, uint64_t block,
+			const void *buffer, size_t num_blocks);
 
 	async::detached manageBlockBitmap(helix::UniqueDescriptor memory);
 	async::detached manageInodeBitmap(helix::UniqueDescriptor memory);
@@ -260,7 +408,7 @@ struct FileSystem {
 	async::result<std::shared_ptr<Inode>> createDirectory();
 	async::result<std::shared_ptr<Inode>> createSymlink();
 
-	async::result<void> write(Inode *inode, uint64_t offset,
+	async::result<frg::expected<protocols::fs::Error>> write(Inode *inode, uint64_t offset,
 			const void *buffer, size_t length);
 
 	async::detached initiateInode(std::shared_ptr<Inode> inode);
@@ -271,10 +419,67 @@ struct FileSystem {
 	// Allocate up to num blocks for the given inode.
 	// This function does not write back the BGDT, this is the caller's responsibility.
 	async::result<std::vector<uint32_t>> allocateBlocks(size_t num, std::optional<uint32_t> ino = std::nullopt);
+
+	// Allocates num data blocks for the given logical block of an inode.
+	// Takes blocks from the inode's preallocation window if possible; otherwise,
+	// prefers blocks at goal (zero if there is no preference) and opens a new window.
+	// Must be called with the inode's assignMutex held.
+	async::result<std::vector<uint32_t>> allocateDataBlocks(Inode *inode,
+			uint64_t logical, size_t num, uint32_t goal);
+
+	// Allocates a run of at most num contiguous blocks, preferably starting at goal.
+	// If inode is given, the blocks that follow the run become its preallocation window,
+	// which continues at the given logical block. Returns an empty run if no block is free.
+	async::result<BitRun> allocateRun(uint32_t goal, uint32_t num,
+			Inode *inode = nullptr, uint64_t logical = 0);
+
+	// Returns the blocks of the inode's preallocation window to the free space.
+	void discardPreallocation(Inode *inode);
+	void discardAllPreallocations();
+	std::vector<uint32_t> &preallocMask(uint32_t bg);
+
+	// Accounts for blocks that are written but not yet allocated (delayed allocation).
+	// Returns false if there is not enough free space.
+	async::result<bool> reserveDataBlocks(Inode *inode,
+			uint64_t block_offset, size_t num_blocks);
+	// Allocates the delayed blocks in the given range before it is written back.
+	async::result<void> allocateDelayedBlocks(Inode *inode,
+			uint64_t block_offset, size_t num_blocks);
+	// Pages that are written through mappings are dirtied without reserveDataBlocks().
+	// Returns the number of blocks in the given range that are neither allocated nor delayed.
+	// Only supported for files that use extents.
+	uint64_t countHoleBlocks(Inode *inode, uint64_t block_offset, size_t num_blocks);
+	// Allocates the blocks of such holes before the range is written back.
+	// Returns false if there is not enough free space.
+	async::result<bool> allocateHoleBlocks(Inode *inode,
+			uint64_t block_offset, size_t num_blocks);
+	// Forgets about delayed blocks in the given range, e.g., on truncation.
+	void dropDelayedBlocks(Inode *inode, uint64_t block_offset, size_t num_blocks);
 	async::result<uint32_t> allocateInode(uint32_t parentIno = 0, bool directory = false);
 
+	// Returns blocks that were allocated by allocateBlocks().
+	// With a journal, the blocks are only released once the current transaction is
+	// checkpointed, such that they are not reused while they can still be replayed.
+	// This function does not write back the BGDT, this is the caller's responsibility.
+	async::result<void> freeBlocks(const std::vector<uint32_t> &blocks);
+	async::result<void> releaseBlocks(const std::vector<uint32_t> &blocks);
+
 	async::result<void> assignDataBlocks(Inode *inode,
 			uint64_t block_offset, size_t num_blocks);
+	async::result<void> assignIndirectBlocks(Inode *inode,
+			uint64_t block_offset, size_t num_blocks);
+	async::result<void> assignExtents(Inode *inode,
+			uint64_t block_offset, size_t num_blocks);
+
+	// Reads the extent tree of an inode into its extentMap.
+	// Fails with Error::internalError (i.e., EIO) if the tree is corrupted.
+	async::result<frg::expected<protocols::fs::Error>> loadExtents(Inode *inode);
+	// Reads the extent tree with the given root node into map.
+	// Returns false if the tree is corrupted.
+	async::result<bool> readExtentTree(const void *root, ExtentMap &map);
+	// Writes the extentMap of an inode back to disk; extentMutex must be held.
+	// Does not write back the inode itself.
+	async::result<void> storeExtents(Inode *inode);
 
 	async::result<void> readDataBlocks(std::shared_ptr<Inode> inode, uint64_t block_offset,
 			size_t num_blocks, void *buffer);
@@ -283,6 +488,21 @@ struct FileSystem {
 
 	async::result<void> truncate(Inode *inode, size_t size);
 
+	// Write back the inode (fsync) or all open inodes (sync) together with the metadata
+	// and flush the device's write cache. Pages that are dirtied through mappings
+	// outside of the file system server must be synchronized by the caller.
+	// Fail with Error::internalError (i.e., EIO) if the data cannot be made durable.
+	async::result<frg::expected<protocols::fs::Error>> fsync(Inode *inode);
+	async::result<frg::expected<protocols::fs::Error>> sync();
+
+	// Waits until no page of the memory object is dirty or under writeback.
+	async::result<void> waitForWriteback(helix::BorrowedDescriptor memory);
+	// Waits for the writeback of the page cache and the indirection blocks of an inode.
+	async::result<void> waitForWriteback(Inode *inode);
+	// Writes back the bitmaps, the inode table and the BGDT, commits the journal
+	// and flushes the device.
+	async::result<frg::expected<protocols::fs::Error>> commitMetadata();
+
 	BlockDevice *device;
 	uint16_t inodeSize;
 	uint32_t blockShift;
@@ -294,8 +514,26 @@ struct FileSystem {
 	uint32_t inodesPerGroup;
 	uint32_t blocksCount;
 	uint32_t inodesCount;
+	bool hasDirIndex;
+	bool hasExtents;
+	bool unsignedHash;
+	uint32_t hashSeed[4];
 	std::vector<std::byte> blockGroupDescriptorBuffer;
 	DiskGroupDesc *bgdt;
+	// Contents of the BGDT as it was last written to disk.
+	std::vector<std::byte> bgdtOnDisk;
+
+	// Null if the file system does not have a journal.
+	std::unique_ptr<Journal> journal;
+
+	// Sum of the free blocks of all block groups.
+	uint64_t freeBlocksTotal = 0;
+	// Free blocks that are promised to delayed allocations.
+	uint64_t reservedBlocks = 0;
+	// Free blocks that are in preallocation windows.
+	uint64_t preallocatedBlocks = 0;
+	// Per block group; marks blocks that are in preallocation windows.
+	std::unordered_map<uint32_t, std::vector<uint32_t>> preallocMasks;
 
 	helix::UniqueDescriptor blockBitmap;
 	helix::UniqueDescriptor inodeBitmap;
@@ -315,6 +553,7 @@ struct OpenFile {
 
 	std::shared_ptr<Inode> inode;
 	uint64_t offset;
+	Readahead readahead;
 	Flock flock;
 	bool append;
 };
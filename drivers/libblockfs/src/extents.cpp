@@ -0,0 +1,247 @@
+#include <assert.h>
+#include <string.h>
+#include <algorithm>
+#include <iterator>
+
+#include "extents.hpp"
+
+namespace blockfs {
+namespace ext2fs {
+
+namespace {
+
+size_t entriesPerNode(size_t blockSize) {
+	return (blockSize - sizeof(ExtentHeader)) / sizeof(DiskExtent);
+}
+
+void writeHeader(void *node, size_t entries, size_t max, uint16_t depth) {
+	auto header = reinterpret_cast<ExtentHeader *>(node);
+	header->magic = extentMagic;
+	header->entries = entries;
+	header->max = max;
+	header->depth = depth;
+	header->generation = 0;
+}
+
+} // anonymous namespace
+
+BlockRun ExtentMap::lookup(uint64_t block, size_t limit) const {
+	auto it = extents.upper_bound(block);
+	if(it != extents.begin()) {
+		auto &[first, extent] = *std::prev(it);
+		if(block < first + extent.length) {
+			auto offset = block - first;
+			return {extent.physical + offset,
+					std::min(limit, static_cast<size_t>(extent.length - offset)),
+					extent.uninitialized};
+		}
+	}
+
+	// The block is not mapped. The hole extends up to the next extent.
+	size_t length = limit;
+	if(it != extents.end())
+		length = std::min(length, static_cast<size_t>(it->first - block));
+	return {0, length, false};
+}
+
+void ExtentMap::insert(uint64_t block, uint64_t physical, uint32_t length) {
+	while(length) {
+		auto chunk = std::min(length, maxInitializedExtentLength);
+		assert(!lookup(block, chunk).physical);
+		assert(lookup(block, chunk).length == chunk);
+
+		auto it = extents.emplace(block, Extent{physical, chunk, false}).first;
+		_mergeNext(it);
+		if(it != extents.begin())
+			_mergeNext(std::prev(it));
+
+		block += chunk;
+		physical += chunk;
+		length -= chunk;
+	}
+}
+
+bool ExtentMap::markInitialized(uint64_t block, size_t count) {
+	auto end = block + count;
+
+	auto it = extents.upper_bound(block);
+	if(it != extents.begin())
+		it = std::prev(it);
+
+	bool changed = false;
+	while(it != extents.end() && it->first < end) {
+		auto start = it->first;
+		auto extent = it->second;
+		if(!extent.uninitialized || start + extent.length <= block) {
+			++it;
+			continue;
+		}
+
+		// Split the extent such that only the overlapping part becomes initialized.
+		auto from = std::max(start, block);
+		auto to = std::min(start + extent.length, end);
+		it = extents.erase(it);
+		if(from > start)
+			extents.emplace(start, Extent{extent.physical,
+					static_cast<uint32_t>(from - start), true});
+		if(to < start + extent.length)
+			extents.emplace(to, Extent{extent.physical + (to - start),
+					static_cast<uint32_t>(start + extent.length - to), true});
+		it = extents.emplace(from, Extent{extent.physical + (from - start),
+				static_cast<uint32_t>(to - from), false}).first;
+		++it;
+		changed = true;
+	}
+	if(!changed)
+		return false;
+
+	// Initialized parts may now be adjacent to other initialized extents.
+	it = extents.upper_bound(block);
+	if(it != extents.begin())
+		it = std::prev(it);
+	if(it != extents.begin())
+		it = std::prev(it);
+	while(it != extents.end() && it->first < end) {
+		_mergeNext(it);
+		++it;
+	}
+	return true;
+}
+
+size_t ExtentMap::countTreeBlocks(size_t blockSize) const {
+	if(extents.size() <= rootExtentEntries)
+		return 0;
+
+	auto perNode = entriesPerNode(blockSize);
+	size_t level = (extents.size() + perNode - 1) / perNode;
+	size_t total = level;
+	while(level > rootExtentEntries) {
+		level = (level + perNode - 1) / perNode;
+		total += level;
+	}
+	return total;
+}
+
+void ExtentMap::buildTree(size_t blockSize, void *root, std::vector<std::byte> &nodes) const {
+	assert(treeBlocks.size() == countTreeBlocks(blockSize));
+
+	auto writeExtent = [] (DiskExtent *out, uint64_t block, const Extent &extent) {
+		out->block = block;
+		out->length = extent.uninitialized
+				? extent.length + maxInitializedExtentLength : extent.length;
+		out->startHi = extent.physical >> 32;
+		out->startLo = extent.physical;
+	};
+
+	auto writeIndex = [] (ExtentIndex *out, uint64_t block, uint64_t leaf) {
+		out->block = block;
+		out->leafLo = leaf;
+		out->leafHi = leaf >> 32;
+		out->unused = 0;
+	};
+
+	auto rootEntries = reinterpret_cast<char *>(root) + sizeof(ExtentHeader);
+	memset(root, 0, sizeof(ExtentHeader) + rootExtentEntries * sizeof(DiskExtent));
+	nodes.assign(treeBlocks.size() * blockSize, std::byte{0});
+
+	if(extents.size() <= rootExtentEntries) {
+		size_t n = 0;
+		for(auto &[block, extent] : extents)
+			writeExtent(reinterpret_cast<DiskExtent *>(rootEntries) + n++, block, extent);
+		writeHeader(root, n, rootExtentEntries, 0);
+		return;
+	}
+
+	auto perNode = entriesPerNode(blockSize);
+	size_t next = 0;
+
+	// First logical block and physical block of each node of the current level.
+	std::vector<std::pair<uint64_t, uint64_t>> level;
+
+	auto it = extents.begin();
+	while(it != extents.end()) {
+		auto node = reinterpret_cast<char *>(nodes.data()) + next * blockSize;
+		level.push_back({it->first, treeBlocks[next]});
+
+		size_t n = 0;
+		for(; it != extents.end() && n < perNode; ++it, ++n)
+			writeExtent(reinterpret_cast<DiskExtent *>(node + sizeof(ExtentHeader)) + n,
+					it->first, it->second);
+		writeHeader(node, n, perNode, 0);
+		next++;
+	}
+
+	uint16_t depth = 1;
+	while(level.size() > rootExtentEntries) {
+		std::vector<std::pair<uint64_t, uint64_t>> upper;
+		for(size_t i = 0; i < level.size(); i += perNode) {
+			auto node = reinterpret_cast<char *>(nodes.data()) + next * blockSize;
+			upper.push_back({level[i].first, treeBlocks[next]});
+
+			auto n = std::min(perNode, level.size() - i);
+			for(size_t j = 0; j < n; j++)
+				writeIndex(reinterpret_cast<ExtentIndex *>(node + sizeof(ExtentHeader)) + j,
+						level[i + j].first, level[i + j].second);
+			writeHeader(node, n, perNode, depth);
+			next++;
+		}
+		level = std::move(upper);
+		depth++;
+	}
+	assert(next == treeBlocks.size());
+
+	for(size_t j = 0; j < level.size(); j++)
+		writeIndex(reinterpret_cast<ExtentIndex *>(rootEntries) + j,
+				level[j].first, level[j].second);
+	writeHeader(root, level.size(), rootExtentEntries, depth);
+}
+
+void ExtentMap::_mergeNext(std::map<uint64_t, Extent>::iterator it) {
+	auto &extent = it->second;
+	auto maxLength = extent.uninitialized
+			? maxUninitializedExtentLength : maxInitializedExtentLength;
+
+	while(true) {
+		auto next = std::next(it);
+		if(next == extents.end())
+			return;
+		if(next->first != it->first + extent.length
+				|| next->second.physical != extent.physical + extent.length
+				|| next->second.uninitialized != extent.uninitialized
+				|| extent.length + next->second.length > maxLength)
+			return;
+
+		extent.length += next->second.length;
+		extents.erase(next);
+	}
+}
+
+bool parseExtentNode(const void *node, size_t size, uint16_t depth,
+		ExtentMap &map, std::vector<uint64_t> &children) {
+	auto header = reinterpret_cast<const ExtentHeader *>(node);
+	if(header->magic != extentMagic || header->depth != depth
+			|| header->entries > header->max
+			|| sizeof(ExtentHeader) + header->entries * sizeof(DiskExtent) > size)
+		return false;
+
+	auto entries = reinterpret_cast<const char *>(node) + sizeof(ExtentHeader);
+	for(size_t i = 0; i < header->entries; i++) {
+		if(depth) {
+			auto index = reinterpret_cast<const ExtentIndex *>(entries) + i;
+			children.push_back((uint64_t{index->leafHi} << 32) | index->leafLo);
+		}else{
+			auto disk = reinterpret_cast<const DiskExtent *>(entries) + i;
+			Extent extent;
+			extent.physical = (uint64_t{disk->startHi} << 32) | disk->startLo;
+			extent.uninitialized = disk->length > maxInitializedExtentLength;
+			extent.length = extent.uninitialized
+					? disk->length - maxInitializedExtentLength : disk->length;
+			if(!extent.length)
+				continue;
+			map.extents.emplace(disk->block, extent);
+		}
+	}
+	return true;
+}
+
+} } // namespace blockfs::ext2fs
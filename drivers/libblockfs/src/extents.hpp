@@ -0,0 +1,113 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <cstddef>
+#include <map>
+#include <vector>
+
+namespace blockfs {
+namespace ext2fs {
+
+// --------------------------------------------------------
+// On-disk structures of extent-mapped (ext4) inodes
+// --------------------------------------------------------
+
+// Starts each node of the extent tree, including the root in the inode.
+struct ExtentHeader {
+	uint16_t magic;
+	uint16_t entries;
+	uint16_t max;
+	uint16_t depth;
+	uint32_t generation;
+};
+static_assert(sizeof(ExtentHeader) == 12, "Bad ExtentHeader struct size");
+
+// Entry of an interior node.
+struct ExtentIndex {
+	uint32_t block;
+	uint32_t leafLo;
+	uint16_t leafHi;
+	uint16_t unused;
+};
+static_assert(sizeof(ExtentIndex) == 12, "Bad ExtentIndex struct size");
+
+// Entry of a leaf node.
+struct DiskExtent {
+	uint32_t block;
+	uint16_t length;
+	uint16_t startHi;
+	uint32_t startLo;
+};
+static_assert(sizeof(DiskExtent) == 12, "Bad DiskExtent struct size");
+
+constexpr uint16_t extentMagic = 0xF30A;
+
+// Lengths above this value denote uninitialized extents, i.e.,
+// extents that are allocated but read as zeros.
+constexpr uint32_t maxInitializedExtentLength = 32768;
+constexpr uint32_t maxUninitializedExtentLength = 32767;
+
+// Number of entries that fit into the root node in the inode.
+constexpr size_t rootExtentEntries = 4;
+
+// --------------------------------------------------------
+// ExtentMap
+// --------------------------------------------------------
+
+struct Extent {
+	uint64_t physical;
+	uint32_t length;
+	bool uninitialized;
+};
+
+// A run of logical blocks that is either mapped contiguously or not mapped at all.
+struct BlockRun {
+	// Zero for holes.
+	uint64_t physical;
+	size_t length;
+	bool uninitialized;
+};
+
+// In-memory copy of the extent tree of an inode.
+struct ExtentMap {
+	// Returns the run of at most limit blocks that starts at the given logical block.
+	BlockRun lookup(uint64_t block, size_t limit) const;
+
+	// Maps length blocks starting at the given logical block;
+	// the range must not be mapped yet. Merges with adjacent extents where possible.
+	void insert(uint64_t block, uint64_t physical, uint32_t length);
+
+	// Turns uninitialized blocks in the given range into initialized ones.
+	// Returns true if any extent was changed.
+	bool markInitialized(uint64_t block, size_t count);
+
+	// Number of non-root nodes that are required to store the map on disk.
+	size_t countTreeBlocks(size_t blockSize) const;
+
+	// Serializes the map into the root node (which is stored in the inode) and
+	// into nodes, which receives one block of blockSize bytes per entry of treeBlocks.
+	// treeBlocks.size() must be equal to countTreeBlocks().
+	void buildTree(size_t blockSize, void *root, std::vector<std::byte> &nodes) const;
+
+	// Keyed by the first logical block of each extent.
+	std::map<uint64_t, Extent> extents;
+
+	// Physical blocks of the non-root nodes of the tree.
+	std::vector<uint64_t> treeBlocks;
+
+	// On-disk contents of treeBlocks; used to only write back nodes that changed.
+	std::vector<std::byte> nodes;
+
+private:
+	// Merges the extents that follow it into it as long as they are contiguous.
+	void _mergeNext(std::map<uint64_t, Extent>::iterator it);
+};
+
+// Parses a node of the tree at the given depth. The extents of leaves are added to map,
+// the children of interior nodes are appended to children.
+// Returns false if the node is corrupted.
+bool parseExtentNode(const void *node, size_t size, uint16_t depth,
+		ExtentMap &map, std::vector<uint64_t> &children);
+
+} } // namespace blockfs::ext2fs
@@ -28,7 +28,7 @@ async::result<std::pair<char *, DiskHeader *>> Table::probeSectorSize_(size_t se
 	size_t deviceSectors = (sectorSize + deviceGptOffset + getDevice()->sectorSize - 1) / getDevice()->sectorSize;
 
 	auto headerBuffer = new char[deviceSectors * getDevice()->sectorSize];
-	co_await getDevice()->readSectors(deviceGptSector, headerBuffer, deviceSectors);
+	co_await getDevice()->read(deviceGptSector, headerBuffer, deviceSectors);
 
 	DiskHeader *header = reinterpret_cast<DiskHeader *>(headerBuffer + deviceGptOffset);
 	if (header->signature == 0x5452415020494645)
@@ -68,7 +68,7 @@ async::result<void> Table::parse() {
 	size_t tableSectors = (tableSize + deviceTableOffset + getDevice()->sectorSize - 1) / getDevice()->sectorSize;
 
 	auto tableBuffer = new char[tableSectors * getDevice()->sectorSize];
-	co_await getDevice()->readSectors(deviceTableSector, tableBuffer, tableSectors);
+	co_await getDevice()->read(deviceTableSector, tableBuffer, tableSectors);
 
 	for (uint32_t i = 0; i < header.second->numEntries; i++) {
 		DiskEntry *entry = reinterpret_cast<DiskEntry *>(
@@ -121,19 +121,49 @@ Guid Partition::type() {
 
 async::result<void> Partition::readSectors(uint64_t sector, void *buffer, size_t count) {
 	assert(sector + count <= _numSectors);
-	return _table.getDevice()->readSectors(_startLba + sector,
+	auto start = _stats.startRequest();
+	co_await _table.getDevice()->read(_startLba + sector,
 			buffer, count);
+	_stats.endRequest(start, false, count * sectorSize / 512);
 }
 
 async::result<void> Partition::writeSectors(uint64_t sector, const void *buffer, size_t count) {
 	assert(sector + count <= _numSectors);
-	return _table.getDevice()->writeSectors(_startLba + sector,
+	auto start = _stats.startRequest();
+	co_await _table.getDevice()->write(_startLba + sector,
 			buffer, count);
+	_stats.endRequest(start, true, count * sectorSize / 512);
+}
+
+async::result<void> Partition::writeSectorsFua(uint64_t sector, const void *buffer, size_t count) {
+	assert(sector + count <= _numSectors);
+	auto start = _stats.startRequest();
+	co_await _table.getDevice()->writeFua(_startLba + sector,
+			buffer, count);
+	_stats.endRequest(start, true, count * sectorSize / 512);
+}
+
+async::result<frg::expected<protocols::fs::Error>> Partition::flushCache() {
+	uint64_t start;
+	HEL_CHECK(helGetClock(&start));
+	auto result = co_await _table.getDevice()->flush();
+	uint64_t end;
+	HEL_CHECK(helGetClock(&end));
+	_stats.flushes++;
+	_stats.flushTicks += end - start;
+	co_return result;
 }
 
 async::result<size_t> Partition::getSize() {
 	co_return _numSectors * sectorSize;
 }
 
+std::vector<uint64_t> Partition::ioStats() {
+	uint64_t now;
+	HEL_CHECK(helGetClock(&now));
+	_stats.accountTime(now);
+	return _stats.toVector();
+}
+
 } } // namespace blockfs::gpt
 
@@ -4,6 +4,7 @@
 #include <utility>
 
 #include <blockfs.hpp>
+#include "request-queue.hpp"
 
 namespace blockfs {
 namespace gpt {
@@ -108,8 +109,17 @@ struct Partition : public BlockDevice {
 	async::result<void> writeSectors(uint64_t sector, const void *buffer,
 			size_t num_sectors) override;
 
+	async::result<void> writeSectorsFua(uint64_t sector, const void *buffer,
+			size_t num_sectors) override;
+
+	async::result<frg::expected<protocols::fs::Error>> flushCache() override;
+
 	async::result<size_t> getSize() override;
 
+	// I/O to partitions is merged and queued by the request queue of the whole disk.
+	// Here, we only account the requests that are made to the partition.
+	std::vector<uint64_t> ioStats() override;
+
 	Guid id();
 
 	Guid type();
@@ -120,6 +130,7 @@ private:
 	Guid _type;
 	uint64_t _startLba;
 	uint64_t _numSectors;
+	IoStats _stats;
 };
 
 } } // namespace blockfs::gpt
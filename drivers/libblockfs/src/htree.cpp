@@ -0,0 +1,175 @@
+#include <assert.h>
+#include <string.h>
+
+#include "htree.hpp"
+
+// The hash functions follow the ext4 on-disk format,
+// see fs/ext4/hash.c in Linux or lib/ext2fs/dirhash.c in e2fsprogs.
+
+namespace blockfs {
+namespace ext2fs {
+
+namespace {
+
+uint32_t rotateLeft(uint32_t x, int s) {
+	return (x << s) | (x >> (32 - s));
+}
+
+void teaTransform(uint32_t buf[4], const uint32_t in[4]) {
+	constexpr uint32_t delta = 0x9E3779B9;
+
+	uint32_t sum = 0;
+	uint32_t b0 = buf[0], b1 = buf[1];
+	uint32_t a = in[0], b = in[1], c = in[2], d = in[3];
+	for(int n = 0; n < 16; n++) {
+		sum += delta;
+		b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+		b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+	}
+	buf[0] += b0;
+	buf[1] += b1;
+}
+
+// The reduced MD4 transform; it only processes half of an MD4 block.
+void halfMd4Transform(uint32_t buf[4], const uint32_t in[8]) {
+	constexpr uint32_t k2 = 013240474631;
+	constexpr uint32_t k3 = 015666365641;
+
+	auto f = [] (uint32_t x, uint32_t y, uint32_t z) { return z ^ (x & (y ^ z)); };
+	auto g = [] (uint32_t x, uint32_t y, uint32_t z) { return (x & y) + ((x ^ y) & z); };
+	auto h = [] (uint32_t x, uint32_t y, uint32_t z) { return x ^ y ^ z; };
+
+	uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+	auto round = [] (auto fn, uint32_t &w, uint32_t x, uint32_t y, uint32_t z,
+			uint32_t k, int s) {
+		w = rotateLeft(w + fn(x, y, z) + k, s);
+	};
+
+	round(f, a, b, c, d, in[0], 3);
+	round(f, d, a, b, c, in[1], 7);
+	round(f, c, d, a, b, in[2], 11);
+	round(f, b, c, d, a, in[3], 19);
+	round(f, a, b, c, d, in[4], 3);
+	round(f, d, a, b, c, in[5], 7);
+	round(f, c, d, a, b, in[6], 11);
+	round(f, b, c, d, a, in[7], 19);
+
+	round(g, a, b, c, d, in[1] + k2, 3);
+	round(g, d, a, b, c, in[3] + k2, 5);
+	round(g, c, d, a, b, in[5] + k2, 9);
+	round(g, b, c, d, a, in[7] + k2, 13);
+	round(g, a, b, c, d, in[0] + k2, 3);
+	round(g, d, a, b, c, in[2] + k2, 5);
+	round(g, c, d, a, b, in[4] + k2, 9);
+	round(g, b, c, d, a, in[6] + k2, 13);
+
+	round(h, a, b, c, d, in[3] + k3, 3);
+	round(h, d, a, b, c, in[7] + k3, 9);
+	round(h, c, d, a, b, in[2] + k3, 11);
+	round(h, b, c, d, a, in[6] + k3, 15);
+	round(h, a, b, c, d, in[1] + k3, 3);
+	round(h, d, a, b, c, in[5] + k3, 9);
+	round(h, c, d, a, b, in[0] + k3, 11);
+	round(h, b, c, d, a, in[4] + k3, 15);
+
+	buf[0] += a;
+	buf[1] += b;
+	buf[2] += c;
+	buf[3] += d;
+}
+
+// Older kernels hashed names using the (signed) char type of the platform;
+// the superblock records whether the file system was created with unsigned chars.
+template<typename Char>
+uint32_t legacyHash(const char *name, size_t length) {
+	uint32_t hash0 = 0x12A3FE2D, hash1 = 0x37ABE8F9;
+	for(size_t i = 0; i < length; i++) {
+		int c = static_cast<Char>(name[i]);
+		uint32_t hash = hash1 + (hash0 ^ static_cast<uint32_t>(c * 7152373));
+		if(hash & 0x80000000)
+			hash -= 0x7FFFFFFF;
+		hash1 = hash0;
+		hash0 = hash;
+	}
+	return hash0 << 1;
+}
+
+// Packs up to 4 * num bytes of name into num words, padding with the length.
+template<typename Char>
+void stringToHashBuffer(const char *name, size_t length, uint32_t *buf, int num) {
+	uint32_t pad = static_cast<uint32_t>(length) | (static_cast<uint32_t>(length) << 8);
+	pad |= pad << 16;
+
+	uint32_t val = pad;
+	if(length > size_t(num) * 4)
+		length = num * 4;
+	for(size_t i = 0; i < length; i++) {
+		int c = static_cast<Char>(name[i]);
+		val = static_cast<uint32_t>(c) + (val << 8);
+		if((i % 4) == 3) {
+			*buf++ = val;
+			val = pad;
+			num--;
+		}
+	}
+	if(--num >= 0)
+		*buf++ = val;
+	while(--num >= 0)
+		*buf++ = pad;
+}
+
+template<typename Char>
+uint32_t halfMd4Hash(uint32_t buf[4], const char *name, size_t length) {
+	uint32_t in[8];
+	for(size_t offset = 0; offset < length; offset += 32) {
+		stringToHashBuffer<Char>(name + offset, length - offset, in, 8);
+		halfMd4Transform(buf, in);
+	}
+	return buf[1];
+}
+
+template<typename Char>
+uint32_t teaHash(uint32_t buf[4], const char *name, size_t length) {
+	uint32_t in[4];
+	for(size_t offset = 0; offset < length; offset += 16) {
+		stringToHashBuffer<Char>(name + offset, length - offset, in, 4);
+		teaTransform(buf, in);
+	}
+	return buf[0];
+}
+
+} // anonymous namespace
+
+uint32_t dirHash(int version, const uint32_t seed[4], const char *name, size_t length) {
+	uint32_t buf[4] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476};
+	if(seed[0] || seed[1] || seed[2] || seed[3])
+		memcpy(buf, seed, sizeof(buf));
+
+	uint32_t hash;
+	switch(version) {
+	case DX_HASH_LEGACY:
+		hash = legacyHash<signed char>(name, length); break;
+	case DX_HASH_LEGACY_UNSIGNED:
+		hash = legacyHash<unsigned char>(name, length); break;
+	case DX_HASH_HALF_MD4:
+		hash = halfMd4Hash<signed char>(buf, name, length); break;
+	case DX_HASH_HALF_MD4_UNSIGNED:
+		hash = halfMd4Hash<unsigned char>(buf, name, length); break;
+	case DX_HASH_TEA:
+		hash = teaHash<signed char>(buf, name, length); break;
+	case DX_HASH_TEA_UNSIGNED:
+		hash = teaHash<unsigned char>(buf, name, length); break;
+	default:
+		assert(!"unexpected hash version");
+		__builtin_unreachable();
+	}
+
+	// The lowest bit is reserved to mark hash collisions that span multiple blocks.
+	// The largest hash value is reserved as an end-of-directory marker.
+	hash &= ~uint32_t(1);
+	if(hash == (uint32_t(0x7FFFFFFF) << 1))
+		hash = uint32_t(0x7FFFFFFF - 1) << 1;
+	return hash;
+}
+
+} } // namespace blockfs::ext2fs
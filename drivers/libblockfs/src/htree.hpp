@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace blockfs {
+namespace ext2fs {
+
+// --------------------------------------------------------
+// On-disk structures of hashed (dir_index) directories
+// --------------------------------------------------------
+
+// Follows the "." and ".." entries in the first block of the directory.
+struct DxRootInfo {
+	uint32_t reserved;
+	uint8_t hashVersion;
+	uint8_t infoLength;
+	uint8_t indirectLevels;
+	uint8_t unusedFlags;
+};
+static_assert(sizeof(DxRootInfo) == 8, "Bad DxRootInfo struct size");
+
+// Overlays the hash of the first DxEntry of each node.
+struct DxCountLimit {
+	uint16_t limit;
+	uint16_t count;
+};
+static_assert(sizeof(DxCountLimit) == 4, "Bad DxCountLimit struct size");
+
+struct DxEntry {
+	uint32_t hash;
+	uint32_t block;
+};
+static_assert(sizeof(DxEntry) == 8, "Bad DxEntry struct size");
+
+// Returns the block (relative to the directory) that an entry points to.
+inline uint32_t dxBlock(const DxEntry &entry) {
+	return entry.block & 0x0FFFFFFF;
+}
+
+// Returns the index of the entry whose subtree contains the given hash, i.e.,
+// the last entry whose hash is not larger than the given hash.
+// The first entry does not store a hash and covers all hashes below the second entry.
+inline unsigned int dxSearch(const DxEntry *entries, unsigned int count, uint32_t hash) {
+	unsigned int lo = 1, hi = count;
+	while(lo < hi) {
+		auto mid = lo + (hi - lo) / 2;
+		if(entries[mid].hash <= hash) {
+			lo = mid + 1;
+		}else{
+			hi = mid;
+		}
+	}
+	return lo - 1;
+}
+
+enum {
+	DX_HASH_LEGACY = 0,
+	DX_HASH_HALF_MD4 = 1,
+	DX_HASH_TEA = 2,
+	DX_HASH_LEGACY_UNSIGNED = 3,
+	DX_HASH_HALF_MD4_UNSIGNED = 4,
+	DX_HASH_TEA_UNSIGNED = 5
+};
+
+inline bool isKnownHashVersion(int version) {
+	return version >= DX_HASH_LEGACY && version <= DX_HASH_TEA_UNSIGNED;
+}
+
+// Computes the (major) hash that indexes name in a hashed directory.
+// seed is the superblock's hashSeed; the default seed is used if it is all zeros.
+// version must be a known hash version.
+uint32_t dirHash(int version, const uint32_t seed[4], const char *name, size_t length);
+
+} } // namespace blockfs::ext2fs
@@ -0,0 +1,766 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <unordered_map>
+#include <utility>
+
+#include <arch/bit.hpp>
+#include <helix/timer.hpp>
+
+#include "journal.hpp"
+
+namespace blockfs {
+namespace ext2fs {
+
+namespace {
+	constexpr bool logJournal = false;
+
+	// Interval after which the running transaction is committed (in ns).
+	constexpr uint64_t commitInterval = 5'000'000'000;
+
+	constexpr uint32_t supportedIncompatFeatures = JBD2_FEATURE_INCOMPAT_REVOKE
+			| JBD2_FEATURE_INCOMPAT_64BIT
+			| JBD2_FEATURE_INCOMPAT_CSUM_V2
+			| JBD2_FEATURE_INCOMPAT_CSUM_V3;
+
+	// Value of JournalSuperblock::checksumType for crc32c.
+	constexpr uint8_t crc32cChecksumType = 4;
+
+	constexpr size_t uuidSize = 16;
+
+	uint32_t fromBe(uint32_t x) {
+		return arch::from_endian<arch::big_endian, uint32_t>(x);
+	}
+
+	uint32_t toBe(uint32_t x) {
+		return arch::to_endian<arch::big_endian, uint32_t>(x);
+	}
+
+	uint32_t loadBe32(const std::byte *p) {
+		uint32_t x;
+		memcpy(&x, p, sizeof(uint32_t));
+		return fromBe(x);
+	}
+
+	uint16_t loadBe16(const std::byte *p) {
+		uint16_t x;
+		memcpy(&x, p, sizeof(uint16_t));
+		return arch::from_endian<arch::big_endian, uint16_t>(x);
+	}
+
+	void storeBe32(std::byte *p, uint32_t x) {
+		x = toBe(x);
+		memcpy(p, &x, sizeof(uint32_t));
+	}
+
+	void storeBe16(std::byte *p, uint16_t x) {
+		x = arch::to_endian<arch::big_endian, uint16_t>(x);
+		memcpy(p, &x, sizeof(uint16_t));
+	}
+
+	// Returns true if the sequence number a is after b.
+	bool sequenceAfter(uint32_t a, uint32_t b) {
+		return static_cast<int32_t>(a - b) > 0;
+	}
+
+	constexpr auto crc32cTable = [] {
+		std::array<uint32_t, 256> table{};
+		for(uint32_t i = 0; i < 256; i++) {
+			uint32_t crc = i;
+			for(int j = 0; j < 8; j++)
+				crc = (crc >> 1) ^ ((crc & 1) ? 0x82F63B78 : 0);
+			table[i] = crc;
+		}
+		return table;
+	}();
+}
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t size) {
+	auto p = static_cast<const uint8_t *>(data);
+	for(size_t i = 0; i < size; i++)
+		crc = crc32cTable[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+	return crc;
+}
+
+// --------------------------------------------------------
+// OrderedData and JournalHandle
+// --------------------------------------------------------
+
+OrderedData::OrderedData(Journal *journal, Transaction *transaction)
+: _journal{journal}, _transaction{transaction} {
+	_transaction->numOrderedData++;
+}
+
+OrderedData::OrderedData(OrderedData &&other)
+: _journal{std::exchange(other._journal, nullptr)},
+		_transaction{std::exchange(other._transaction, nullptr)} { }
+
+OrderedData::~OrderedData() {
+	if(!_transaction)
+		return;
+	assert(_transaction->numOrderedData > 0);
+	if(!--_transaction->numOrderedData)
+		_journal->_released.raise();
+}
+
+OrderedData &OrderedData::operator= (OrderedData other) {
+	std::swap(_journal, other._journal);
+	std::swap(_transaction, other._transaction);
+	return *this;
+}
+
+JournalHandle::JournalHandle(Journal *journal, Transaction *transaction, size_t credits)
+: _journal{journal}, _transaction{transaction}, _credits{credits} {
+	_transaction->numHandles++;
+	_transaction->credits += credits;
+}
+
+JournalHandle::JournalHandle(JournalHandle &&other)
+: _journal{std::exchange(other._journal, nullptr)},
+		_transaction{std::exchange(other._transaction, nullptr)},
+		_credits{std::exchange(other._credits, 0)} { }
+
+JournalHandle::~JournalHandle() {
+	if(!_transaction)
+		return;
+	// The blocks that the handle added are now accounted in the transaction itself.
+	assert(_transaction->credits >= _credits);
+	_transaction->credits -= _credits;
+	assert(_transaction->numHandles > 0);
+	if(!--_transaction->numHandles)
+		_journal->_released.raise();
+}
+
+JournalHandle &JournalHandle::operator= (JournalHandle other) {
+	std::swap(_journal, other._journal);
+	std::swap(_transaction, other._transaction);
+	std::swap(_credits, other._credits);
+	return *this;
+}
+
+OrderedData JournalHandle::orderData() {
+	if(!_transaction)
+		return {};
+	return OrderedData{_journal, _transaction};
+}
+
+// --------------------------------------------------------
+// Journal
+// --------------------------------------------------------
+
+Journal::Journal(BlockDevice *device, size_t blockSize, std::vector<uint64_t> map)
+: _device{device}, _blockSize{blockSize},
+		_sectorsPerBlock{blockSize / device->sectorSize}, _map{std::move(map)} {
+	assert(!(blockSize % device->sectorSize));
+}
+
+async::result<frg::expected<protocols::fs::Error, bool>> Journal::recover() {
+	auto fail = [] (const char *message) {
+		std::cerr << "\e[31m" "ext2fs: " << message << "\e[39m" << std::endl;
+		return protocols::fs::Error::internalError;
+	};
+
+	_superblockBlock.resize(_blockSize);
+	co_await _readBlock(0, _superblockBlock.data());
+	memcpy(&_superblock, _superblockBlock.data(), sizeof(JournalSuperblock));
+
+	auto &sb = _superblock;
+	if(fromBe(sb.header.magic) != journalMagic)
+		co_return fail("Journal superblock has a bad magic number");
+	auto type = fromBe(sb.header.blockType);
+	if(type == JBD2_SUPERBLOCK_V1) {
+		// V1 superblocks end before the feature fields.
+		memset(reinterpret_cast<std::byte *>(&sb) + offsetof(JournalSuperblock, featureCompat),
+				0, sizeof(JournalSuperblock) - offsetof(JournalSuperblock, featureCompat));
+	}else if(type != JBD2_SUPERBLOCK_V2) {
+		co_return fail("Journal superblock has an unknown type");
+	}
+
+	if(fromBe(sb.blockSize) != _blockSize)
+		co_return fail("Block size of the journal does not match the file system");
+	if(fromBe(sb.maxLength) > _map.size() || fromBe(sb.first) >= fromBe(sb.maxLength))
+		co_return fail("Journal is larger than its inode");
+	// We need room for at least a descriptor block, a data block and a commit block.
+	if(fromBe(sb.maxLength) - fromBe(sb.first) < 3)
+		co_return fail("Journal is too small");
+	if(fromBe(sb.featureIncompat) & ~supportedIncompatFeatures)
+		co_return fail("Journal uses unsupported features");
+	if((fromBe(sb.featureIncompat) & JBD2_FEATURE_INCOMPAT_CSUM_V2)
+			&& (fromBe(sb.featureIncompat) & JBD2_FEATURE_INCOMPAT_CSUM_V3))
+		co_return fail("Journal uses both checksum versions");
+
+	if(_hasChecksums()) {
+		if(sb.checksumType != crc32cChecksumType)
+			co_return fail("Journal uses an unsupported checksum type");
+
+		auto copy = sb;
+		copy.checksum = 0;
+		if(crc32c(~uint32_t{0}, &copy, sizeof(JournalSuperblock)) != fromBe(sb.checksum))
+			co_return fail("Journal superblock has a bad checksum");
+		_checksumSeed = crc32c(~uint32_t{0}, sb.uuid, uuidSize);
+	}
+
+	if(logJournal)
+		std::cout << "ext2fs: Journal has " << fromBe(sb.maxLength) << " blocks"
+				<< ", features: " << fromBe(sb.featureIncompat) << std::endl;
+
+	auto sequence = fromBe(sb.sequence);
+	bool replayed = false;
+	if(sb.start) {
+		sequence = co_await _replay();
+		replayed = true;
+	}
+
+	_lastCommitted = sequence - 1;
+	_running = std::make_unique<Transaction>(sequence);
+
+	// We never write the commit block checksums of COMPAT_CHECKSUM.
+	sb.featureCompat &= toBe(~uint32_t{JBD2_FEATURE_COMPAT_CHECKSUM});
+	sb.error = 0;
+	co_await _writeSuperblock(sequence, 0);
+
+	co_return replayed;
+}
+
+async::result<uint32_t> Journal::_replay() {
+	auto first = fromBe(_superblock.first);
+	auto maxLength = fromBe(_superblock.maxLength);
+	auto wrap = [&] (uint32_t pos) {
+		if(pos >= maxLength)
+			pos -= maxLength - first;
+		return pos;
+	};
+
+	auto startSequence = fromBe(_superblock.sequence);
+	auto startPos = fromBe(_superblock.start);
+	std::vector<std::byte> buffer(_blockSize);
+
+	// First pass: find the end of the log and collect the revoke records.
+	// Maps blocks to the last transaction that revoked them.
+	std::unordered_map<uint64_t, uint32_t> revoked;
+	std::vector<uint64_t> pendingRevokes;
+	auto recordSize = (fromBe(_superblock.featureIncompat) & JBD2_FEATURE_INCOMPAT_64BIT) ? 8 : 4;
+
+	auto sequence = startSequence;
+	auto pos = startPos;
+	while(true) {
+		co_await _readBlock(pos, buffer.data());
+		JournalHeader header;
+		memcpy(&header, buffer.data(), sizeof(JournalHeader));
+		if(fromBe(header.magic) != journalMagic || fromBe(header.sequence) != sequence)
+			break;
+
+		auto type = fromBe(header.blockType);
+		if(type == JBD2_DESCRIPTOR_BLOCK) {
+			if(!_verifyTail(buffer.data()))
+				break;
+			auto tags = _parseTags(buffer.data());
+			pos = wrap(pos + 1 + tags.size());
+		}else if(type == JBD2_REVOKE_BLOCK) {
+			if(!_verifyTail(buffer.data()))
+				break;
+			auto count = std::min(size_t{loadBe32(buffer.data() + offsetof(JournalRevokeHeader, count))},
+					_blockSize - (_hasChecksums() ? 4 : 0));
+			for(size_t offset = sizeof(JournalRevokeHeader); offset + recordSize <= count;
+					offset += recordSize) {
+				uint64_t block = loadBe32(buffer.data() + offset);
+				if(recordSize == 8)
+					block = (block << 32) | loadBe32(buffer.data() + offset + 4);
+				pendingRevokes.push_back(block);
+			}
+			pos = wrap(pos + 1);
+		}else if(type == JBD2_COMMIT_BLOCK) {
+			if(!_verifyCommit(buffer.data()))
+				break;
+			// Revoke records only take effect if their transaction is complete.
+			for(auto block : pendingRevokes)
+				revoked[block] = sequence;
+			pendingRevokes.clear();
+			sequence++;
+			pos = wrap(pos + 1);
+		}else{
+			break;
+		}
+	}
+	auto endSequence = sequence;
+
+	if(logJournal)
+		std::cout << "ext2fs: Replaying " << (endSequence - startSequence)
+				<< " transactions from the journal" << std::endl;
+
+	// Second pass: write the blocks of complete transactions to their home location.
+	std::vector<std::byte> data(_blockSize);
+	sequence = startSequence;
+	pos = startPos;
+	while(sequence != endSequence) {
+		co_await _readBlock(pos, buffer.data());
+		auto type = loadBe32(buffer.data() + offsetof(JournalHeader, blockType));
+		pos = wrap(pos + 1);
+		if(type == JBD2_COMMIT_BLOCK) {
+			sequence++;
+			continue;
+		}else if(type != JBD2_DESCRIPTOR_BLOCK) {
+			continue;
+		}
+
+		for(auto &tag : _parseTags(buffer.data())) {
+			co_await _readBlock(pos, data.data());
+			pos = wrap(pos + 1);
+
+			auto it = revoked.find(tag.block);
+			if(it != revoked.end() && !sequenceAfter(sequence, it->second))
+				continue;
+			if(_hasChecksums() && _tagChecksum(sequence, data.data()) != tag.checksum) {
+				std::cerr << "\e[31m" "ext2fs: Journaled copy of block " << tag.block
+						<< " has a bad checksum; skipping it" "\e[39m" << std::endl;
+				continue;
+			}
+
+			if(tag.flags & JBD2_FLAG_ESCAPE)
+				storeBe32(data.data(), journalMagic);
+			co_await _device->write(tag.block * _sectorsPerBlock, data.data(), _sectorsPerBlock);
+		}
+	}
+	if(!(co_await _device->flush()))
+		_abort("flush after replay failed");
+
+	co_return endSequence;
+}
+
+void Journal::run() {
+	assert(_running);
+	_commitLoop();
+	_commitTimer();
+}
+
+async::result<JournalHandle> Journal::start(bool reserved, size_t credits) {
+	// Limit the size of transactions such that they always fit into the journal.
+	// Regular handles only use a quarter of the capacity: the remainder is left to
+	// reserved handles, which may join while the transaction waits for regular handles.
+	auto capacity = _transactionCapacity();
+	assert(capacity > beforeCommitCredits);
+	capacity -= beforeCommitCredits;
+	auto limit = reserved ? capacity : capacity / 4;
+	credits = std::min(credits, limit);
+
+	while(true) {
+		auto state = _running->state;
+		bool joinable;
+		if(reserved) {
+			joinable = state != TransactionState::closing;
+		}else{
+			joinable = state == TransactionState::running;
+		}
+		if(joinable) {
+			if(_running->blocks.size() + _running->credits + credits <= limit)
+				break;
+			// Commit the transaction before it can outgrow the journal.
+			_requestCommit();
+		}
+		co_await _unlocked.async_wait();
+	}
+
+	co_return JournalHandle{this, _running.get(), credits};
+}
+
+void Journal::writeMetadata(uint64_t block, const void *buffer, size_t numBlocks) {
+	auto p = static_cast<const std::byte *>(buffer);
+	for(size_t i = 0; i < numBlocks; i++) {
+		auto &copy = _running->blocks[block + i];
+		copy.assign(p + i * _blockSize, p + (i + 1) * _blockSize);
+	}
+}
+
+void Journal::overlay(uint64_t block, void *buffer, size_t numBlocks) {
+	auto p = static_cast<std::byte *>(buffer);
+	for(size_t i = 0; i < numBlocks; i++) {
+		for(auto transaction : {_running.get(), _committing.get()}) {
+			if(!transaction)
+				continue;
+			auto it = transaction->blocks.find(block + i);
+			if(it == transaction->blocks.end())
+				continue;
+			memcpy(p + i * _blockSize, it->second.data(), _blockSize);
+			break;
+		}
+	}
+}
+
+void Journal::deferFree(std::vector<uint32_t> blocks) {
+	auto &frees = _running->deferredFrees;
+	frees.insert(frees.end(), blocks.begin(), blocks.end());
+}
+
+async::result<frg::expected<protocols::fs::Error>> Journal::commit() {
+	auto sequence = _running->sequence;
+	if(_running->empty() && !_running->numHandles) {
+		// There is nothing to commit; only wait for transactions that are already committing.
+		sequence--;
+	}else{
+		_requestCommit();
+	}
+
+	while(sequenceAfter(sequence, _lastCommitted))
+		co_await _committed.async_wait();
+	if(_aborted)
+		co_return protocols::fs::Error::internalError;
+	co_return {};
+}
+
+void Journal::_abort(const char *reason) {
+	if(!_aborted)
+		std::cerr << "\e[31m" "ext2fs: Aborting the journal: " << reason << "\e[39m" << std::endl;
+	_aborted = true;
+}
+
+void Journal::_requestCommit() {
+	_commitRequested = true;
+	_commitDoorbell.raise();
+}
+
+async::detached Journal::_commitTimer() {
+	while(true) {
+		co_await helix::sleepFor(commitInterval);
+		if(!_running->empty())
+			_requestCommit();
+	}
+}
+
+async::detached Journal::_commitLoop() {
+	while(true) {
+		while(!_commitRequested)
+			co_await _commitDoorbell.async_wait();
+		_commitRequested = false;
+
+		auto transaction = _running.get();
+		transaction->state = TransactionState::locked;
+		while(transaction->numHandles)
+			co_await _released.async_wait();
+		transaction->state = TransactionState::closing;
+
+		if(beforeCommit)
+			co_await beforeCommit();
+
+		// start() bounds transactions such that they fit into the journal,
+		// unless handles exceed their credits. Committing a transaction in parts would
+		// break its atomicity; hence, we stop journaling instead.
+		if(transaction->blocks.size() > _transactionCapacity())
+			_abort("transaction exceeds the capacity of the journal");
+
+		// Open the next transaction; operations can proceed while we commit.
+		assert(!_committing);
+		_committing = std::move(_running);
+		_running = std::make_unique<Transaction>(transaction->sequence + 1);
+		_unlocked.raise();
+
+		// In ordered mode, data that the metadata refers to must be written first.
+		while(transaction->numOrderedData)
+			co_await _released.async_wait();
+
+		// Once the journal is aborted, transactions are dropped. Writing them to their
+		// home location without committing them first could corrupt the file system.
+		if(!transaction->blocks.empty() && !_aborted) {
+			co_await _writeTransaction(transaction);
+			if(!_aborted)
+				co_await _checkpoint(transaction);
+		}
+
+		auto frees = std::move(transaction->deferredFrees);
+		_committing = nullptr;
+		_lastCommitted = transaction->sequence;
+		_committed.raise();
+
+		if(!frees.empty()) {
+			assert(releaseBlocks);
+			co_await releaseBlocks(std::move(frees));
+		}
+	}
+}
+
+size_t Journal::_transactionCapacity() {
+	// Each descriptor block has room for at least this many tags
+	// (only the first tag of a descriptor is followed by a UUID).
+	auto tailBytes = _hasChecksums() ? 4 : 0;
+	auto tagsPerDescriptor = (_blockSize - sizeof(JournalHeader) - tailBytes - uuidSize) / _tagBytes();
+
+	// Log blocks that are available for descriptors and data (we need one commit block).
+	// n data blocks require (n + tagsPerDescriptor - 1) / tagsPerDescriptor descriptors.
+	size_t available = fromBe(_superblock.maxLength) - fromBe(_superblock.first) - 1;
+	return available - (available + tagsPerDescriptor) / (tagsPerDescriptor + 1);
+}
+
+async::result<void> Journal::_writeTransaction(Transaction *transaction) {
+	auto sequence = transaction->sequence;
+	auto first = fromBe(_superblock.first);
+	auto maxLength = fromBe(_superblock.maxLength);
+	auto tagBytes = _tagBytes();
+	auto tailBytes = _hasChecksums() ? 4 : 0;
+
+	// Build the descriptor blocks, each followed by the blocks that it describes.
+	std::vector<std::byte> log;
+	auto it = transaction->blocks.cbegin();
+	while(it != transaction->blocks.cend()) {
+		auto descriptor = log.size();
+		log.resize(log.size() + _blockSize);
+		storeBe32(log.data() + descriptor + offsetof(JournalHeader, magic), journalMagic);
+		storeBe32(log.data() + descriptor + offsetof(JournalHeader, blockType), JBD2_DESCRIPTOR_BLOCK);
+		storeBe32(log.data() + descriptor + offsetof(JournalHeader, sequence), sequence);
+
+		size_t offset = sizeof(JournalHeader);
+		size_t lastTag = 0;
+		bool firstTag = true;
+		while(it != transaction->blocks.cend()) {
+			auto size = tagBytes + (firstTag ? uuidSize : 0);
+			if(offset + size > _blockSize - tailBytes)
+				break;
+
+			auto &[block, copy] = *it;
+			auto data = log.size();
+			log.insert(log.end(), copy.begin(), copy.end());
+
+			uint32_t flags = firstTag ? 0 : JBD2_FLAG_SAME_UUID;
+			if(loadBe32(log.data() + data) == journalMagic) {
+				storeBe32(log.data() + data, 0);
+				flags |= JBD2_FLAG_ESCAPE;
+			}
+			uint32_t checksum = 0;
+			if(_hasChecksums())
+				checksum = _tagChecksum(sequence, log.data() + data);
+
+			_storeTag(log.data() + descriptor + offset, block, flags, checksum);
+			if(firstTag)
+				memcpy(log.data() + descriptor + offset + tagBytes, _superblock.uuid, uuidSize);
+			lastTag = offset;
+			offset += size;
+			firstTag = false;
+			++it;
+		}
+		assert(!firstTag);
+
+		// Set LAST_TAG on the final tag.
+		auto tag = log.data() + descriptor + lastTag;
+		if(fromBe(_superblock.featureIncompat) & JBD2_FEATURE_INCOMPAT_CSUM_V3) {
+			storeBe32(tag + 4, loadBe32(tag + 4) | JBD2_FLAG_LAST_TAG);
+		}else{
+			storeBe16(tag + 6, loadBe16(tag + 6) | JBD2_FLAG_LAST_TAG);
+		}
+
+		if(_hasChecksums())
+			storeBe32(log.data() + descriptor + _blockSize - 4,
+					_blockChecksum(log.data() + descriptor));
+	}
+
+	// start() bounds transactions according to _transactionCapacity().
+	auto numBlocks = log.size() / _blockSize;
+	assert(first + numBlocks + 1 <= maxLength);
+
+	// Make recovery look at the log before writing it. Recovery stops at blocks
+	// that do not belong to the transaction, so partially written logs are ignored.
+	co_await _writeSuperblock(sequence, first);
+
+	co_await _writeBlocks(first, log.data(), numBlocks);
+	// The commit block must not reach the disk before the log.
+	if(!(co_await _device->flush())) {
+		_abort("flush of the log failed");
+		co_return;
+	}
+
+	// The transaction is committed once the commit block is on disk.
+	std::vector<std::byte> commitBlock(_blockSize);
+	JournalCommitBlock commit{};
+	commit.header.magic = toBe(journalMagic);
+	commit.header.blockType = toBe(JBD2_COMMIT_BLOCK);
+	commit.header.sequence = toBe(sequence);
+	timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	commit.commitSecHi = toBe(static_cast<uint64_t>(now.tv_sec) >> 32);
+	commit.commitSecLo = toBe(static_cast<uint32_t>(now.tv_sec));
+	commit.commitNsec = toBe(now.tv_nsec);
+	memcpy(commitBlock.data(), &commit, sizeof(JournalCommitBlock));
+	if(_hasChecksums())
+		storeBe32(commitBlock.data() + offsetof(JournalCommitBlock, checksum),
+				_blockChecksum(commitBlock.data()));
+
+	auto index = first + numBlocks;
+	co_await _device->writeFua(_map[index] * _sectorsPerBlock,
+			commitBlock.data(), _sectorsPerBlock);
+}
+
+async::result<void> Journal::_checkpoint(Transaction *transaction) {
+	// Write the blocks to their home location, merging consecutive blocks into single writes.
+	std::vector<std::byte> run;
+	uint64_t runStart = 0;
+	auto flushRun = [&] () -> async::result<void> {
+		co_await _device->write(runStart * _sectorsPerBlock, run.data(),
+				run.size() / _blockSize * _sectorsPerBlock);
+		run.clear();
+	};
+
+	for(auto &[block, copy] : transaction->blocks) {
+		if(!run.empty() && block != runStart + run.size() / _blockSize)
+			co_await flushRun();
+		if(run.empty())
+			runStart = block;
+		run.insert(run.end(), copy.begin(), copy.end());
+	}
+	if(!run.empty())
+		co_await flushRun();
+	// Keep the transaction in the journal such that it is replayed on the next mount.
+	if(!(co_await _device->flush())) {
+		_abort("flush of the checkpoint failed");
+		co_return;
+	}
+
+	// Mark the journal as empty.
+	co_await _writeSuperblock(transaction->sequence + 1, 0);
+}
+
+async::result<void> Journal::_readBlock(uint64_t index, void *buffer) {
+	assert(index < _map.size());
+	co_await _device->read(_map[index] * _sectorsPerBlock, buffer, _sectorsPerBlock);
+}
+
+async::result<void> Journal::_writeBlocks(uint64_t index, const void *buffer, size_t numBlocks) {
+	assert(index + numBlocks <= _map.size());
+	auto p = static_cast<const std::byte *>(buffer);
+
+	// Write physically contiguous parts of the journal at once.
+	size_t i = 0;
+	while(i < numBlocks) {
+		size_t n = 1;
+		while(i + n < numBlocks && _map[index + i + n] == _map[index + i] + n)
+			n++;
+		co_await _device->write(_map[index + i] * _sectorsPerBlock,
+				p + i * _blockSize, n * _sectorsPerBlock);
+		i += n;
+	}
+}
+
+async::result<void> Journal::_writeSuperblock(uint32_t sequence, uint32_t start) {
+	_superblock.sequence = toBe(sequence);
+	_superblock.start = toBe(start);
+	if(_hasChecksums()) {
+		_superblock.checksum = 0;
+		_superblock.checksum = toBe(crc32c(~uint32_t{0}, &_superblock, sizeof(JournalSuperblock)));
+	}
+
+	// The superblock only occupies the start of the first block of the journal.
+	memcpy(_superblockBlock.data(), &_superblock, sizeof(JournalSuperblock));
+	co_await _device->writeFua(_map[0] * _sectorsPerBlock,
+			_superblockBlock.data(), _sectorsPerBlock);
+}
+
+uint32_t Journal::_tagBytes() {
+	auto incompat = fromBe(_superblock.featureIncompat);
+	if(incompat & JBD2_FEATURE_INCOMPAT_CSUM_V3)
+		return 16;
+	uint32_t size = 12;
+	if(incompat & JBD2_FEATURE_INCOMPAT_CSUM_V2)
+		size += 2;
+	if(incompat & JBD2_FEATURE_INCOMPAT_64BIT)
+		return size;
+	return size - 4;
+}
+
+bool Journal::_hasChecksums() {
+	return fromBe(_superblock.featureIncompat)
+			& (JBD2_FEATURE_INCOMPAT_CSUM_V2 | JBD2_FEATURE_INCOMPAT_CSUM_V3);
+}
+
+// Tags of CSUM_V3 journals are laid out as { blocknr, flags, blocknr_high, checksum },
+// other tags as { blocknr, checksum (16 bits), flags (16 bits), blocknr_high (64BIT only) }.
+std::vector<Journal::Tag> Journal::_parseTags(const std::byte *descriptor) {
+	auto incompat = fromBe(_superblock.featureIncompat);
+	bool is64Bit = incompat & JBD2_FEATURE_INCOMPAT_64BIT;
+	auto tagBytes = _tagBytes();
+	auto end = _blockSize - (_hasChecksums() ? 4 : 0);
+
+	std::vector<Tag> tags;
+	size_t offset = sizeof(JournalHeader);
+	while(offset + tagBytes <= end) {
+		auto p = descriptor + offset;
+		Tag tag;
+		tag.block = loadBe32(p);
+		if(incompat & JBD2_FEATURE_INCOMPAT_CSUM_V3) {
+			tag.flags = loadBe32(p + 4);
+			if(is64Bit)
+				tag.block |= uint64_t{loadBe32(p + 8)} << 32;
+			tag.checksum = loadBe32(p + 12);
+		}else{
+			tag.checksum = loadBe16(p + 4);
+			tag.flags = loadBe16(p + 6);
+			if(is64Bit)
+				tag.block |= uint64_t{loadBe32(p + 8)} << 32;
+		}
+		tags.push_back(tag);
+
+		offset += tagBytes;
+		if(!(tag.flags & JBD2_FLAG_SAME_UUID))
+			offset += uuidSize;
+		if(tag.flags & JBD2_FLAG_LAST_TAG)
+			break;
+	}
+	return tags;
+}
+
+void Journal::_storeTag(std::byte *p, uint64_t block, uint32_t flags, uint32_t checksum) {
+	auto incompat = fromBe(_superblock.featureIncompat);
+	bool is64Bit = incompat & JBD2_FEATURE_INCOMPAT_64BIT;
+	assert(is64Bit || !(block >> 32));
+
+	storeBe32(p, block);
+	if(incompat & JBD2_FEATURE_INCOMPAT_CSUM_V3) {
+		storeBe32(p + 4, flags);
+		storeBe32(p + 8, is64Bit ? block >> 32 : 0);
+		storeBe32(p + 12, checksum);
+	}else{
+		storeBe16(p + 4, checksum);
+		storeBe16(p + 6, flags);
+		if(is64Bit)
+			storeBe32(p + 8, block >> 32);
+	}
+}
+
+// Checksum of a journaled copy of a block (as stored in the journal, i.e., escaped).
+// CSUM_V2 tags only store the lower 16 bits.
+uint32_t Journal::_tagChecksum(uint32_t sequence, const std::byte *data) {
+	auto sequenceBe = toBe(sequence);
+	auto checksum = crc32c(_checksumSeed, &sequenceBe, sizeof(uint32_t));
+	checksum = crc32c(checksum, data, _blockSize);
+	if(!(fromBe(_superblock.featureIncompat) & JBD2_FEATURE_INCOMPAT_CSUM_V3))
+		checksum &= 0xFFFF;
+	return checksum;
+}
+
+// Checksum of descriptor, revoke and commit blocks. The checksum field must be zero.
+uint32_t Journal::_blockChecksum(const std::byte *data) {
+	return crc32c(_checksumSeed, data, _blockSize);
+}
+
+bool Journal::_verifyTail(std::byte *data) {
+	if(!_hasChecksums())
+		return true;
+	auto tail = data + _blockSize - 4;
+	auto expected = loadBe32(tail);
+	storeBe32(tail, 0);
+	auto checksum = _blockChecksum(data);
+	storeBe32(tail, expected);
+	return checksum == expected;
+}
+
+bool Journal::_verifyCommit(std::byte *data) {
+	if(!_hasChecksums())
+		return true;
+	auto field = data + offsetof(JournalCommitBlock, checksum);
+	auto expected = loadBe32(field);
+	storeBe32(field, 0);
+	auto checksum = _blockChecksum(data);
+	storeBe32(field, expected);
+	return checksum == expected;
+}
+
+} } // namespace blockfs::ext2fs
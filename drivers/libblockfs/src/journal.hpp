@@ -0,0 +1,307 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <async/recurring-event.hpp>
+#include <async/result.hpp>
+#include <blockfs.hpp>
+
+namespace blockfs {
+namespace ext2fs {
+
+// --------------------------------------------------------
+// On-disk structures of the journal (JBD2)
+// --------------------------------------------------------
+
+// Note that all fields of the journal are big-endian.
+
+constexpr uint32_t journalMagic = 0xC03B3998;
+
+enum {
+	JBD2_DESCRIPTOR_BLOCK = 1,
+	JBD2_COMMIT_BLOCK = 2,
+	JBD2_SUPERBLOCK_V1 = 3,
+	JBD2_SUPERBLOCK_V2 = 4,
+	JBD2_REVOKE_BLOCK = 5
+};
+
+enum {
+	JBD2_FEATURE_COMPAT_CHECKSUM = 0x1
+};
+
+enum {
+	JBD2_FEATURE_INCOMPAT_REVOKE = 0x1,
+	JBD2_FEATURE_INCOMPAT_64BIT = 0x2,
+	JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT = 0x4,
+	JBD2_FEATURE_INCOMPAT_CSUM_V2 = 0x8,
+	JBD2_FEATURE_INCOMPAT_CSUM_V3 = 0x10,
+	JBD2_FEATURE_INCOMPAT_FAST_COMMIT = 0x20
+};
+
+// Flags of the tags in descriptor blocks.
+enum {
+	// The first four bytes of the block were zeroed since they matched journalMagic.
+	JBD2_FLAG_ESCAPE = 1,
+	// The tag is not followed by a UUID.
+	JBD2_FLAG_SAME_UUID = 2,
+	JBD2_FLAG_DELETED = 4,
+	JBD2_FLAG_LAST_TAG = 8
+};
+
+struct JournalHeader {
+	uint32_t magic;
+	uint32_t blockType;
+	uint32_t sequence;
+};
+static_assert(sizeof(JournalHeader) == 12, "Bad JournalHeader struct size");
+
+struct JournalSuperblock {
+	JournalHeader header;
+	uint32_t blockSize;
+	uint32_t maxLength;
+	uint32_t first;
+	uint32_t sequence;
+	// Zero if the journal is empty.
+	uint32_t start;
+	uint32_t error;
+	//-- JBD2_SUPERBLOCK_V2 Specific --
+	uint32_t featureCompat;
+	uint32_t featureIncompat;
+	uint32_t featureRoCompat;
+	uint8_t uuid[16];
+	uint32_t numUsers;
+	uint32_t dynSuper;
+	uint32_t maxTransaction;
+	uint32_t maxTransData;
+	uint8_t checksumType;
+	uint8_t padding2[3];
+	uint32_t numFastCommitBlocks;
+	uint32_t head;
+	uint32_t padding[40];
+	uint32_t checksum;
+	uint8_t users[16 * 48];
+};
+static_assert(sizeof(JournalSuperblock) == 1024, "Bad JournalSuperblock struct size");
+
+struct JournalCommitBlock {
+	JournalHeader header;
+	uint8_t checksumType;
+	uint8_t checksumSize;
+	uint8_t padding[2];
+	uint32_t checksum[8];
+	uint32_t commitSecHi;
+	uint32_t commitSecLo;
+	uint32_t commitNsec;
+};
+static_assert(sizeof(JournalCommitBlock) == 60, "Bad JournalCommitBlock struct size");
+
+struct JournalRevokeHeader {
+	JournalHeader header;
+	// Number of bytes of the block that are used, including this header.
+	uint32_t count;
+};
+static_assert(sizeof(JournalRevokeHeader) == 16, "Bad JournalRevokeHeader struct size");
+
+// The Castagnoli CRC that the journal uses for checksums (without pre- and post-inversion).
+uint32_t crc32c(uint32_t crc, const void *data, size_t size);
+
+// --------------------------------------------------------
+// Journal
+// --------------------------------------------------------
+
+struct Journal;
+
+enum class TransactionState {
+	// The transaction accepts new handles.
+	running,
+	// The transaction waits for its handles to finish; only reserved handles can join.
+	locked,
+	// The transaction is about to be committed.
+	closing
+};
+
+struct Transaction {
+	explicit Transaction(uint32_t sequence)
+	: sequence{sequence} { }
+
+	bool empty() {
+		return blocks.empty() && deferredFrees.empty();
+	}
+
+	uint32_t sequence;
+	TransactionState state = TransactionState::running;
+	int numHandles = 0;
+	int numOrderedData = 0;
+	// Blocks that the open handles of the transaction may still add to it.
+	size_t credits = 0;
+
+	// Copies of the metadata blocks of the transaction, keyed by block number.
+	std::map<uint64_t, std::vector<std::byte>> blocks;
+
+	// Blocks that are freed once the transaction is checkpointed.
+	std::vector<uint32_t> deferredFrees;
+};
+
+// Marks data writes that the metadata of a transaction depends on (ordered data mode).
+// The transaction does not commit before the OrderedData object is destructed.
+struct OrderedData {
+	OrderedData() = default;
+	OrderedData(Journal *journal, Transaction *transaction);
+	OrderedData(const OrderedData &) = delete;
+	OrderedData(OrderedData &&other);
+	~OrderedData();
+
+	OrderedData &operator= (OrderedData other);
+
+private:
+	Journal *_journal = nullptr;
+	Transaction *_transaction = nullptr;
+};
+
+// Keeps the transaction that it belongs to from committing.
+// All metadata updates of an operation need to be done while holding a single handle,
+// such that they are either all recovered after a crash or none of them.
+struct JournalHandle {
+	JournalHandle() = default;
+	JournalHandle(Journal *journal, Transaction *transaction, size_t credits);
+	JournalHandle(const JournalHandle &) = delete;
+	JournalHandle(JournalHandle &&other);
+	~JournalHandle();
+
+	JournalHandle &operator= (JournalHandle other);
+
+	// Makes the transaction wait for data writes that the caller is about to perform.
+	OrderedData orderData();
+
+private:
+	Journal *_journal = nullptr;
+	Transaction *_transaction = nullptr;
+	size_t _credits = 0;
+};
+
+// Metadata journal in the format of JBD2 (as used by ext3 and ext4).
+// Metadata blocks are not written to their home location directly but collected into
+// transactions. A transaction is committed to the journal once the commit interval passes
+// (or on sync()); its blocks are then written to their home location (checkpointing),
+// after which the journal is empty again.
+struct Journal {
+	// map contains the physical block of each block of the journal.
+	Journal(BlockDevice *device, size_t blockSize, std::vector<uint64_t> map);
+
+	// Reads the journal superblock and replays all transactions that were committed
+	// but not checkpointed before the file system was last used.
+	// Returns true if any transactions were replayed. Fails with Error::internalError
+	// if the journal is corrupted or uses features that we do not support.
+	async::result<frg::expected<protocols::fs::Error, bool>> recover();
+
+	// Starts to commit transactions. Must be called after recover().
+	void run();
+
+	// Number of metadata blocks that a handle may add to its transaction unless
+	// start() is told otherwise.
+	static constexpr size_t defaultCredits = 64;
+
+	// Starts an operation that updates metadata and may add up to credits blocks
+	// to the running transaction. Waits if the running transaction is committing.
+	// Reserved handles are used by writeback; they join the running transaction even
+	// if it is waiting for its handles to finish, as the handles may depend on the writeback.
+	// Like in JBD2, the credits of all handles are accounted: if the running transaction
+	// could grow beyond _transactionCapacity(), it is committed and the handle joins
+	// the next one. Regular handles leave most of the capacity to reserved handles.
+	async::result<JournalHandle> start(bool reserved = false, size_t credits = defaultCredits);
+
+	// Adds a copy of the given metadata blocks to the running transaction.
+	void writeMetadata(uint64_t block, const void *buffer, size_t numBlocks);
+
+	// Replaces blocks that were read from their home location by the versions in the journal.
+	void overlay(uint64_t block, void *buffer, size_t numBlocks);
+
+	// Defers freeing blocks until the running transaction is checkpointed,
+	// such that blocks are not reused while an older version may still be replayed.
+	void deferFree(std::vector<uint32_t> blocks);
+
+	// Commits the running transaction and waits until it is checkpointed.
+	// Fails with Error::internalError if the journal was aborted due to an I/O error.
+	async::result<frg::expected<protocols::fs::Error>> commit();
+
+	// Called before a transaction is closed, e.g., to add pending metadata to it.
+	std::function<async::result<void>()> beforeCommit;
+	// Maximal number of blocks that beforeCommit adds to a transaction.
+	size_t beforeCommitCredits = 0;
+
+	// Called with the blocks that were passed to deferFree() after their transaction is done.
+	std::function<async::result<void>(std::vector<uint32_t>)> releaseBlocks;
+
+private:
+	friend struct JournalHandle;
+	friend struct OrderedData;
+
+	struct Tag {
+		uint64_t block;
+		uint32_t flags;
+		uint32_t checksum;
+	};
+
+	uint32_t _tagBytes();
+	bool _hasChecksums();
+	void _requestCommit();
+	// Stops writing transactions after an I/O error; see _aborted.
+	void _abort(const char *reason);
+
+	std::vector<Tag> _parseTags(const std::byte *descriptor);
+	void _storeTag(std::byte *p, uint64_t block, uint32_t flags, uint32_t checksum);
+	uint32_t _tagChecksum(uint32_t sequence, const std::byte *data);
+	uint32_t _blockChecksum(const std::byte *data);
+	bool _verifyTail(std::byte *data);
+	bool _verifyCommit(std::byte *data);
+
+	async::result<void> _readBlock(uint64_t index, void *buffer);
+	async::result<void> _writeBlocks(uint64_t index, const void *buffer, size_t numBlocks);
+	async::result<void> _writeSuperblock(uint32_t sequence, uint32_t start);
+
+	// Replays the log. Returns the sequence number that follows the last complete transaction.
+	async::result<uint32_t> _replay();
+
+	// Maximal number of blocks of a transaction that fit into the journal.
+	size_t _transactionCapacity();
+
+	async::result<void> _writeTransaction(Transaction *transaction);
+	async::result<void> _checkpoint(Transaction *transaction);
+
+	async::detached _commitLoop();
+	async::detached _commitTimer();
+
+	BlockDevice *_device;
+	size_t _blockSize;
+	size_t _sectorsPerBlock;
+	std::vector<uint64_t> _map;
+
+	JournalSuperblock _superblock;
+	// First block of the journal, which contains the superblock.
+	std::vector<std::byte> _superblockBlock;
+	uint32_t _checksumSeed = 0;
+
+	std::unique_ptr<Transaction> _running;
+	std::unique_ptr<Transaction> _committing;
+	uint32_t _lastCommitted;
+	// Set after a device flush failed. Transactions are no longer written to disk;
+	// committing fails with an I/O error.
+	bool _aborted = false;
+
+	bool _commitRequested = false;
+	async::recurring_event _commitDoorbell;
+	// Raised when the running transaction changes or is unlocked.
+	async::recurring_event _unlocked;
+	// Raised when a transaction has no more handles or ordered data.
+	async::recurring_event _released;
+	// Raised when a transaction is checkpointed.
+	async::recurring_event _committed;
+};
+
+} } // namespace blockfs::ext2fs
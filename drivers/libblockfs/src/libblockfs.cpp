@@ -19,6 +19,7 @@
 #include "gpt.hpp"
 #include "ext2fs.hpp"
 #include "raw.hpp"
+#include "request-queue.hpp"
 #include "fs.bragi.hpp"
 #include <bragi/helpers-std.hpp>
 
@@ -108,6 +109,8 @@ async::result<protocols::fs::ReadResult> read(void *object, helix_ng::Credential
 	}
 
 	co_await self->inode->readyJump.wait();
+	if(self->inode->corrupted)
+		co_return std::unexpected{protocols::fs::Error::internalError};
 
 	if(self->offset >= self->inode->fileSize())
 		co_return size_t{0};
@@ -120,6 +123,13 @@ async::result<protocols::fs::ReadResult> read(void *object, helix_ng::Credential
 	auto chunk_offset = self->offset;
 	self->offset += chunkSize;
 
+	// Start loading the pages before we wait for them. For sequential reads, this
+	// also loads parts of the file that will be read later.
+	// This is only a hint; if it fails, the pages are loaded on access.
+	auto ahead = self->readahead.access(chunk_offset, chunkSize, self->inode->fileSize());
+	if(ahead.length)
+		helLoadahead(self->inode->frontalMemory, ahead.offset, ahead.length);
+
 	// TODO: If we *know* that the pages are already available,
 	//       we can also fall back to the following "old" mapping code.
 /*
@@ -163,6 +173,8 @@ async::result<protocols::fs::ReadResult> pread(void *object, int64_t offset, hel
 	auto self = static_cast<ext2fs::OpenFile *>(object);
 	// TODO(geert): pass cancellation token
 	co_await self->inode->readyJump.wait();
+	if(self->inode->corrupted)
+		co_return std::unexpected{protocols::fs::Error::internalError};
 
 	if(self->offset >= self->inode->fileSize())
 		co_return size_t{0};
@@ -173,6 +185,11 @@ async::result<protocols::fs::ReadResult> pread(void *object, int64_t offset, hel
 		co_return std::unexpected{protocols::fs::Error::endOfFile};
 
 	auto chunk_offset = offset;
+
+	auto ahead = self->readahead.access(chunk_offset, chunk_size, self->inode->fileSize());
+	if(ahead.length)
+		helLoadahead(self->inode->frontalMemory, ahead.offset, ahead.length);
+
 	auto map_offset = chunk_offset & ~size_t(0xFFF);
 	auto map_size = (((chunk_offset & size_t(0xFFF)) + chunk_size + 0xFFF) & ~size_t(0xFFF));
 
@@ -207,10 +224,11 @@ async::result<frg::expected<protocols::fs::Error, size_t>> write(void *object, h
 	protocols::ostrace::Timer timer;
 
 	auto self = static_cast<ext2fs::OpenFile *>(object);
+	auto handle = co_await self->inode->fs.startHandle();
 	if(self->append) {
 		self->offset = self->inode->fileSize();
 	}
-	co_await self->inode->fs.write(self->inode.get(), self->offset, buffer, length);
+	FRG_CO_TRY(co_await self->inode->fs.write(self->inode.get(), self->offset, buffer, length));
 	self->offset += length;
 
 	ostContext.emit(
@@ -231,10 +249,63 @@ async::result<frg::expected<protocols::fs::Error, size_t>> pwrite(void *object,
 	}
 
 	auto self = static_cast<ext2fs::OpenFile *>(object);
-	co_await self->inode->fs.write(self->inode.get(), offset, buffer, length);
+	auto handle = co_await self->inode->fs.startHandle();
+	FRG_CO_TRY(co_await self->inode->fs.write(self->inode.get(), offset, buffer, length));
 	co_return length;
 }
 
+// Copies from another page cache (usually another file's frontalMemory) into the file.
+// The data is written directly from the locked source pages; it never passes through posix.
+async::result<frg::expected<protocols::fs::Error, size_t>>
+copyFromMemory(void *object, helix::BorrowedDescriptor memory,
+		uint64_t inOffset, int64_t outOffset, size_t length) {
+	// Bounds the amount of memory that is locked (and the size of each transaction).
+	constexpr size_t windowSize = 0x100000;
+
+	auto self = static_cast<ext2fs::OpenFile *>(object);
+	co_await self->inode->readyJump.wait();
+
+	size_t progress = 0;
+	while(progress < length) {
+		auto chunkOffset = inOffset + progress;
+		auto chunkSize = std::min(length - progress, windowSize - (chunkOffset & (windowSize - 1)));
+
+		auto mapOffset = chunkOffset & ~size_t(0xFFF);
+		auto mapSize = (((chunkOffset & size_t(0xFFF)) + chunkSize + 0xFFF) & ~size_t(0xFFF));
+
+		helix::LockMemoryView lockMemory;
+		auto &&submit = helix::submitLockMemoryView(memory,
+				&lockMemory, mapOffset, mapSize, helix::Dispatcher::global());
+		co_await submit.async_wait();
+		if(lockMemory.error()) {
+			// The source is shorter than requested; report the partial copy.
+			if(progress)
+				break;
+			co_return protocols::fs::Error::illegalArguments;
+		}
+
+		helix::Mapping sourceMap{memory,
+				static_cast<ptrdiff_t>(mapOffset), mapSize,
+				kHelMapProtRead | kHelMapDontRequireBacking};
+		auto source = reinterpret_cast<char *>(sourceMap.get()) + (chunkOffset - mapOffset);
+
+		auto handle = co_await self->inode->fs.startHandle();
+		if(outOffset < 0) {
+			if(self->append)
+				self->offset = self->inode->fileSize();
+			FRG_CO_TRY(co_await self->inode->fs.write(self->inode.get(), self->offset,
+					source, chunkSize));
+			self->offset += chunkSize;
+		}else{
+			FRG_CO_TRY(co_await self->inode->fs.write(self->inode.get(), outOffset + progress,
+					source, chunkSize));
+		}
+		progress += chunkSize;
+	}
+
+	co_return progress;
+}
+
 async::result<helix::BorrowedDescriptor>
 accessMemory(void *object) {
 	auto self = static_cast<ext2fs::OpenFile *>(object);
@@ -256,10 +327,20 @@ readEntries(void *object) {
 async::result<frg::expected<protocols::fs::Error>>
 truncate(void *object, size_t size) {
 	auto self = static_cast<ext2fs::OpenFile *>(object);
+	co_await self->inode->readyJump.wait();
+	if(self->inode->corrupted)
+		co_return protocols::fs::Error::internalError;
+	auto handle = co_await self->inode->fs.startHandle();
 	co_await self->inode->fs.truncate(self->inode.get(), size);
 	co_return {};
 }
 
+async::result<frg::expected<protocols::fs::Error>>
+fsync(void *object) {
+	auto self = static_cast<ext2fs::OpenFile *>(object);
+	co_return co_await self->inode->fs.fsync(self->inode.get());
+}
+
 async::result<int> getFileFlags(void *) {
 	std::cout << "libblockfs: getFileFlags is stubbed" << std::endl;
     co_return 0;
@@ -281,7 +362,9 @@ constexpr protocols::fs::FileOperations fileOperations {
 	.readEntries  = &readEntries,
 	.accessMemory = &accessMemory,
 	.truncate     = &truncate,
+	.fsync        = &fsync,
 	.flock        = &flock,
+	.copyFromMemory = &copyFromMemory,
 	.getFileFlags = &getFileFlags,
 	.setFileFlags = &setFileFlags,
 };
@@ -328,6 +411,7 @@ getLink(std::shared_ptr<void> object,
 async::result<protocols::fs::GetLinkResult> link(std::shared_ptr<void> object,
 		std::string name, int64_t ino) {
 	auto self = std::static_pointer_cast<ext2fs::Inode>(object);
+	auto handle = co_await self->fs.startHandle();
 	auto entry = co_await self->link(std::move(name), ino, kTypeRegular);
 	if(!entry)
 		co_return protocols::fs::GetLinkResult{nullptr, -1,
@@ -354,6 +438,7 @@ async::result<protocols::fs::GetLinkResult> link(std::shared_ptr<void> object,
 
 async::result<frg::expected<protocols::fs::Error>> unlink(std::shared_ptr<void> object, std::string name) {
 	auto self = std::static_pointer_cast<ext2fs::Inode>(object);
+	auto handle = co_await self->fs.startHandle();
 	auto result = co_await self->unlink(std::move(name));
 	if(!result) {
 		assert(result.error() == protocols::fs::Error::fileNotFound
@@ -406,6 +491,7 @@ open(std::shared_ptr<void> object, bool append) {
 	helix::UniqueLane local_pt, remote_pt;
 	std::tie(local_ctrl, remote_ctrl) = helix::createStream();
 	std::tie(local_pt, remote_pt) = helix::createStream();
+	auto handle = co_await self->fs.startHandle();
 	struct timespec time = clk::getRealtime();
 	self->diskInode()->atime = time.tv_sec;
 
@@ -439,6 +525,7 @@ async::result<std::string> readSymlink(std::shared_ptr<void> object) {
 async::result<protocols::fs::MkdirResult>
 mkdir(std::shared_ptr<void> object, std::string name) {
 	auto self = std::static_pointer_cast<ext2fs::Inode>(object);
+	auto handle = co_await self->fs.startHandle();
 	auto entry = co_await self->mkdir(std::move(name));
 
 	if(!entry)
@@ -451,6 +538,7 @@ mkdir(std::shared_ptr<void> object, std::string name) {
 async::result<protocols::fs::SymlinkResult>
 symlink(std::shared_ptr<void> object, std::string name, std::string target) {
 	auto self = std::static_pointer_cast<ext2fs::Inode>(object);
+	auto handle = co_await self->fs.startHandle();
 	auto entry = co_await self->symlink(std::move(name), std::move(target));
 
 	if(!entry)
@@ -462,6 +550,7 @@ symlink(std::shared_ptr<void> object, std::string name, std::string target) {
 
 async::result<protocols::fs::Error> chmod(std::shared_ptr<void> object, int mode) {
 	auto self = std::static_pointer_cast<ext2fs::Inode>(object);
+	auto handle = co_await self->fs.startHandle();
 	auto result = co_await self->chmod(mode);
 
 	co_return result;
@@ -470,6 +559,7 @@ async::result<protocols::fs::Error> chmod(std::shared_ptr<void> object, int mode
 async::result<protocols::fs::Error> utimensat(std::shared_ptr<void> object,
 		std::optional<timespec> atime, std::optional<timespec> mtime, timespec ctime) {
 	auto self = std::static_pointer_cast<ext2fs::Inode>(object);
+	auto handle = co_await self->fs.startHandle();
 	auto result = co_await self->utimensat(atime, mtime, ctime);
 
 	co_return result;
@@ -607,6 +697,8 @@ getLinkOrCreate(std::shared_ptr<void> object, std::string name, mode_t mode, boo
 		co_return protocols::fs::GetLinkResult{self->fs.accessInode(e.inode), e.inode, type};
 	}
 
+	// Creating, initializing and linking the inode is a single transaction.
+	auto handle = co_await self->fs.startHandle();
 	auto inode = co_await self->fs.createRegular(uid, gid, self->number);
 	auto chmodResult = co_await inode->chmod(mode);
 	if (chmodResult != protocols::fs::Error::none)
@@ -641,6 +733,13 @@ async::result<protocols::fs::ReadResult> rawRead(void *object, helix_ng::Credent
 	auto chunk_offset = self->offset;
 	self->offset += chunkSize;
 
+	// Start loading the pages before we wait for them. For sequential reads, this
+	// also loads parts of the file that will be read later.
+	// This is only a hint; if it fails, the pages are loaded on access.
+	auto ahead = self->readahead.access(chunk_offset, chunkSize, file_size);
+	if(ahead.length)
+		helLoadahead(self->rawFs->frontalMemory, ahead.offset, ahead.length);
+
 	// TODO(geert): use cancellation token here
 	auto readMemory = co_await helix_ng::readMemory(
 			helix::BorrowedDescriptor(self->rawFs->frontalMemory),
@@ -765,7 +864,22 @@ async::detached servePartition(helix::UniqueLane lane, gpt::Partition *partition
 		if(req.req_type() == managarm::fs::CntReqType::DEV_MOUNT) {
 			// Mount the actual file system
 			fs = std::make_unique<ext2fs::FileSystem>(partition);
-			co_await fs->init();
+			auto initResult = co_await fs->init();
+			if(!initResult) {
+				std::cout << "\e[31m" "libblockfs: Failed to mount ext2fs" "\e[39m" << std::endl;
+				fs = nullptr;
+
+				managarm::fs::SvrResponse resp;
+				resp.set_error(initResult.error() | protocols::fs::toFsError);
+
+				auto ser = resp.SerializeAsString();
+				auto [send_resp] = co_await helix_ng::exchangeMsgs(
+					conversation,
+					helix_ng::sendBuffer(ser.data(), ser.size())
+				);
+				HEL_CHECK(send_resp.error());
+				continue;
+			}
 			printf("ext2fs is ready!\n");
 
 			helix::UniqueLane local_lane, remote_lane;
@@ -785,7 +899,9 @@ async::detached servePartition(helix::UniqueLane lane, gpt::Partition *partition
 			HEL_CHECK(send_resp.error());
 			HEL_CHECK(push_node.error());
 		}else if(req.req_type() == managarm::fs::CntReqType::SB_CREATE_REGULAR) {
+			auto handle = co_await fs->startHandle();
 			auto inode = co_await fs->createRegular(req.uid(), req.gid(), 0);
+			handle = {};
 
 			helix::UniqueLane local_lane, remote_lane;
 			std::tie(local_lane, remote_lane) = helix::createStream();
@@ -805,6 +921,22 @@ async::detached servePartition(helix::UniqueLane lane, gpt::Partition *partition
 			);
 			HEL_CHECK(send_resp.error());
 			HEL_CHECK(push_node.error());
+		}else if(req.req_type() == managarm::fs::CntReqType::SB_SYNC) {
+			auto result = co_await fs->sync();
+
+			managarm::fs::SvrResponse resp;
+			if(result) {
+				resp.set_error(managarm::fs::Errors::SUCCESS);
+			}else{
+				resp.set_error(result.error() | protocols::fs::toFsError);
+			}
+
+			auto ser = resp.SerializeAsString();
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBuffer(ser.data(), ser.size())
+			);
+			HEL_CHECK(send_resp.error());
 		}else if(preamble.id() == managarm::fs::RenameRequest::message_id) {
 			std::vector<std::byte> tail(preamble.tail_size());
 			auto [recv_tail] = co_await helix_ng::exchangeMsgs(
@@ -820,6 +952,8 @@ async::detached servePartition(helix::UniqueLane lane, gpt::Partition *partition
 				break;
 			}
 
+			// The unlinks and the link are a single transaction.
+			auto handle = co_await fs->startHandle();
 			auto oldInode = fs->accessInode(req->inode_source());
 			auto newInode = fs->accessInode(req->inode_target());
 
@@ -1037,6 +1171,20 @@ async::detached serveDevice(helix::UniqueLane lane, std::unique_ptr<raw::RawFs>
 						helix_ng::sendBuffer(ser.data(), ser.size())
 				);
 				HEL_CHECK(send_resp.error());
+			} else if(req->command() == protocols::fs::ioctlBlockStats) {
+				auto stats = rawFs->device->ioStats();
+
+				managarm::fs::GenericIoctlReply rsp;
+				rsp.set_error(managarm::fs::Errors::SUCCESS);
+
+				auto ser = rsp.SerializeAsString();
+				auto [send_resp, send_stats] = co_await helix_ng::exchangeMsgs(
+						conversation,
+						helix_ng::sendBuffer(ser.data(), ser.size()),
+						helix_ng::sendBuffer(stats.data(), stats.size() * sizeof(uint64_t))
+				);
+				HEL_CHECK(send_resp.error());
+				HEL_CHECK(send_stats.error());
 			} else {
 				std::cout << "\e[31m" "libblockfs: Unknown ioctl() message with ID "
 						<< req->command() << "\e[39m" << std::endl;
@@ -1063,6 +1211,10 @@ async::detached runDevice(BlockDevice *device) {
 	if(!clkInitialized)
 		co_await clk::enumerateTracker();
 
+	// Route filesystem I/O through a request queue. Like the table below,
+	// it is leaked since the device is never deleted.
+	device->requestQueue = new RequestQueue{device};
+
 	// TODO(qookie): Don't leak the table.
 	// Currently it should be fine to leak it since neither it nor
 	// the device gets deleted anyway.
@@ -37,7 +37,7 @@ async::detached RawFs::manageMapping() {
 			size_t num_blocks = (backed_size + device->sectorSize - 1) / device->sectorSize;
 
 			assert(num_blocks * device->sectorSize <= manage.length());
-			co_await device->readSectors(manage.offset() / device->sectorSize, file_map.get(),
+			co_await device->read(manage.offset() / device->sectorSize, file_map.get(),
 					num_blocks);
 
 			HEL_CHECK(helUpdateMemory(backingMemory, kHelManageInitialize,
@@ -54,7 +54,7 @@ async::detached RawFs::manageMapping() {
 			size_t num_blocks = (backed_size + device->sectorSize - 1) / device->sectorSize;
 
 			assert(num_blocks * device->sectorSize <= manage.length());
-			co_await device->writeSectors(manage.offset() / device->sectorSize, file_map.get(),
+			co_await device->write(manage.offset() / device->sectorSize, file_map.get(),
 					num_blocks);
 
 			HEL_CHECK(helUpdateMemory(backingMemory, kHelManageWriteback,
@@ -4,6 +4,7 @@
 #include <helix/memory.hpp>
 #include <protocols/fs/file-locks.hpp>
 #include <blockfs.hpp>
+#include "readahead.hpp"
 
 namespace blockfs {
 namespace raw {
@@ -30,6 +31,7 @@ struct OpenFile {
 
 	RawFs *rawFs;
 	uint64_t offset;
+	Readahead readahead;
 	Flock flock;
 };
 
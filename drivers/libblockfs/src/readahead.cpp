@@ -0,0 +1,37 @@
+#include <algorithm>
+
+#include "readahead.hpp"
+
+namespace blockfs {
+
+Readahead::Range Readahead::access(uint64_t offset, size_t length, uint64_t fileSize) {
+	auto end = offset + length;
+	auto limit = (fileSize + 0xFFF) & ~uint64_t(0xFFF);
+	bool sequential = offset == nextOffset;
+	nextOffset = end;
+
+	if(!sequential) {
+		// Random access. Only load the range that is read, but do so in one request.
+		window = 0;
+		aheadEnd = 0;
+		auto start = offset & ~uint64_t(0xFFF);
+		return {start, static_cast<size_t>(std::min((end + 0xFFF) & ~uint64_t(0xFFF), limit) - start)};
+	}
+
+	if(!window) {
+		window = minWindow;
+	}else if(end + window / 2 <= aheadEnd) {
+		// Enough data is already on its way.
+		return {0, 0};
+	}else{
+		window = std::min(window * 2, maxWindow);
+	}
+
+	auto start = std::max(aheadEnd, offset & ~uint64_t(0xFFF));
+	aheadEnd = std::min(((end + 0xFFF) & ~uint64_t(0xFFF)) + window, limit);
+	if(start >= aheadEnd)
+		return {0, 0};
+	return {start, static_cast<size_t>(aheadEnd - start)};
+}
+
+} // namespace blockfs
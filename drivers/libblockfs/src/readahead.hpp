@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace blockfs {
+
+// Detects sequential reads through an open file and decides which parts
+// of the file should be loaded into the page cache ahead of time.
+struct Readahead {
+	static constexpr size_t minWindow = 128 * 1024;
+	static constexpr size_t maxWindow = 2 * 1024 * 1024;
+
+	struct Range {
+		uint64_t offset;
+		size_t length;
+	};
+
+	// Records a read of length bytes at offset and returns the page-aligned range
+	// that should be loaded (length is zero if nothing needs to be loaded).
+	// For sequential reads, the range extends beyond the read by the current window;
+	// it is requested before the reader reaches the end of the previous range,
+	// such that loading overlaps with the reader consuming the data.
+	Range access(uint64_t offset, size_t length, uint64_t fileSize);
+
+	// Offset at which the next read is expected if the file is read sequentially.
+	uint64_t nextOffset = 0;
+	// End of the range that was already requested.
+	uint64_t aheadEnd = 0;
+	// Zero until a sequential read is detected; doubles until it reaches maxWindow.
+	size_t window = 0;
+};
+
+} // namespace blockfs
@@ -0,0 +1,346 @@
+#include <assert.h>
+#include <algorithm>
+
+#include <helix/timer.hpp>
+
+#include "request-queue.hpp"
+
+namespace blockfs {
+
+namespace {
+
+// Requests expire after this many nanoseconds (indexed by direction).
+constexpr std::array<uint64_t, 2> expireTime{500'000'000, 5'000'000'000};
+
+// Maximal number of requests that are served in sector order
+// before checking for expired requests again.
+constexpr unsigned int fifoBatch = 16;
+
+// Maximal number of read batches that may be served while writes are pending.
+constexpr unsigned int writesStarved = 2;
+
+// Requests are not merged beyond this size.
+constexpr size_t maxMergeBytes = 512 * 1024;
+
+// While the device is busy, new requests are held back for at most this many
+// nanoseconds such that adjacent requests can be merged.
+constexpr uint64_t maxPlugTime = 100'000;
+
+// Plugged queues are unplugged early once they hold this many requests.
+constexpr size_t maxPluggedRequests = 16;
+
+uint64_t now() {
+	uint64_t nanos;
+	HEL_CHECK(helGetClock(&nanos));
+	return nanos;
+}
+
+} // anonymous namespace
+
+// --------------------------------------------------------
+// BlockDevice
+// --------------------------------------------------------
+
+async::result<void> BlockDevice::read(uint64_t sector, void *buffer, size_t num_sectors) {
+	if(!requestQueue)
+		return readSectors(sector, buffer, num_sectors);
+	return requestQueue->submit(false, sector, buffer, num_sectors);
+}
+
+async::result<void> BlockDevice::write(uint64_t sector, const void *buffer, size_t num_sectors) {
+	if(!requestQueue)
+		return writeSectors(sector, buffer, num_sectors);
+	return requestQueue->submit(true, sector, const_cast<void *>(buffer), num_sectors);
+}
+
+async::result<void> BlockDevice::writeFua(uint64_t sector, const void *buffer, size_t num_sectors) {
+	if(!requestQueue)
+		return writeSectorsFua(sector, buffer, num_sectors);
+	return requestQueue->submit(true, sector, const_cast<void *>(buffer), num_sectors, true);
+}
+
+async::result<frg::expected<protocols::fs::Error>> BlockDevice::flush() {
+	if(!requestQueue)
+		return flushCache();
+	return requestQueue->flush();
+}
+
+std::vector<uint64_t> BlockDevice::ioStats() {
+	if(!requestQueue)
+		return IoStats{}.toVector();
+	return requestQueue->stats().toVector();
+}
+
+// --------------------------------------------------------
+// IoStats
+// --------------------------------------------------------
+
+uint64_t IoStats::startRequest() {
+	auto start = now();
+	accountTime(start);
+	inFlight++;
+	return start;
+}
+
+void IoStats::endRequest(uint64_t start, bool write, uint64_t numSectors) {
+	auto end = now();
+	accountTime(end);
+	inFlight--;
+	ios[write]++;
+	sectors[write] += numSectors;
+	ticks[write] += end - start;
+}
+
+void IoStats::accountTime(uint64_t time) {
+	if(inFlight) {
+		ioTicks += time - _lastAccountTime;
+		timeInQueue += (time - _lastAccountTime) * inFlight;
+	}
+	_lastAccountTime = time;
+}
+
+std::vector<uint64_t> IoStats::toVector() const {
+	// Times are reported in milliseconds.
+	return {
+		ios[0], merges[0], sectors[0], ticks[0] / 1'000'000,
+		ios[1], merges[1], sectors[1], ticks[1] / 1'000'000,
+		inFlight, ioTicks / 1'000'000, timeInQueue / 1'000'000,
+		// We do not support discards.
+		0, 0, 0, 0,
+		flushes, flushTicks / 1'000'000
+	};
+}
+
+// --------------------------------------------------------
+// RequestQueue
+// --------------------------------------------------------
+
+RequestQueue::RequestQueue(BlockDevice *device)
+: _device{device} {
+	_dispatchRequests();
+}
+
+async::result<void> RequestQueue::submit(bool write, uint64_t sector,
+		void *buffer, size_t num_sectors, bool fua) {
+	assert(num_sectors);
+	assert(write || !fua);
+
+	Bio bio{sector, num_sectors, buffer, {}};
+	if(!_tryMerge(&bio, write, fua)) {
+		auto request = new Request{write, fua, sector, num_sectors, {&bio},
+				now() + expireTime[write], {}};
+		_insert(request);
+	}
+
+	// Requests to an idle device are dispatched right away. Otherwise, give other
+	// submitters a chance to merge with us before the device becomes free.
+	if(_plugged) {
+		if(_numQueued >= maxPluggedRequests)
+			_unplug();
+	}else if(_inFlight) {
+		_plugged = true;
+		_plugTimer(++_plugGeneration);
+	}
+
+	co_await bio.done.wait();
+}
+
+async::result<frg::expected<protocols::fs::Error>> RequestQueue::flush() {
+	PendingFlush flush;
+	_pendingFlushes.push_back(&flush);
+	while(!flush.done) {
+		if(_flushInFlight) {
+			co_await _flushDoorbell.async_wait();
+			continue;
+		}
+
+		// flush() calls that arrive while this flush is in flight are batched
+		// into the next one.
+		_flushInFlight = true;
+
+		// Only requests that were made before the device starts flushing are covered.
+		auto covered = std::move(_pendingFlushes);
+		_pendingFlushes.clear();
+		auto start = now();
+		auto result = co_await _device->flushCache();
+		_stats.flushes++;
+		_stats.flushTicks += now() - start;
+
+		// All covered callers see the error of the flush.
+		for(auto pending : covered) {
+			pending->result = result;
+			pending->done = true;
+		}
+		_flushInFlight = false;
+		_flushDoorbell.raise();
+	}
+	co_return flush.result;
+}
+
+IoStats RequestQueue::stats() {
+	_stats.accountTime(now());
+	return _stats;
+}
+
+bool RequestQueue::_tryMerge(Bio *bio, bool write, bool fua) {
+	auto &sorted = _sorted[write];
+	auto maxSectors = std::max(maxMergeBytes / _device->sectorSize, size_t{1});
+
+	auto it = sorted.lower_bound(bio->sector);
+
+	// Requests are passed to the driver as a single buffer. Hence, we only merge
+	// bios that are also adjacent in memory; this avoids bounce buffers.
+	auto bufferEnd = [&] (Bio *b) {
+		return static_cast<char *>(b->buffer) + b->numSectors * _device->sectorSize;
+	};
+
+	// Back merge: a queued request ends where the bio starts.
+	if(it != sorted.begin()) {
+		auto request = std::prev(it)->second;
+		if(request->fua == fua && request->sector + request->numSectors == bio->sector
+				&& bufferEnd(request->bios.back()) == bio->buffer
+				&& request->numSectors + bio->numSectors <= maxSectors) {
+			request->numSectors += bio->numSectors;
+			request->bios.push_back(bio);
+			_stats.merges[write]++;
+			return true;
+		}
+	}
+
+	// Front merge: a queued request starts where the bio ends.
+	if(it != sorted.end()) {
+		auto request = it->second;
+		if(request->fua == fua && request->sector == bio->sector + bio->numSectors
+				&& bufferEnd(bio) == request->bios.front()->buffer
+				&& request->numSectors + bio->numSectors <= maxSectors) {
+			sorted.erase(it);
+			request->sector = bio->sector;
+			request->numSectors += bio->numSectors;
+			request->bios.push_front(bio);
+			sorted.emplace(request->sector, request);
+			_stats.merges[write]++;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void RequestQueue::_insert(Request *request) {
+	_sorted[request->write].emplace(request->sector, request);
+	_fifo[request->write].push_back(request);
+	request->fifoIt = std::prev(_fifo[request->write].end());
+	_numQueued++;
+	_doorbell.raise();
+}
+
+void RequestQueue::_remove(Request *request) {
+	auto &sorted = _sorted[request->write];
+	auto [begin, end] = sorted.equal_range(request->sector);
+	auto it = std::find_if(begin, end, [&] (auto &entry) {
+		return entry.second == request;
+	});
+	assert(it != end);
+	sorted.erase(it);
+	_fifo[request->write].erase(request->fifoIt);
+	_numQueued--;
+}
+
+RequestQueue::Request *RequestQueue::_pickRequest() {
+	assert(_numQueued);
+
+	// Continue the current batch in ascending sector order.
+	if(_batched < fifoBatch) {
+		auto &sorted = _sorted[_direction];
+		auto it = sorted.lower_bound(_nextSector);
+		if(it != sorted.end()) {
+			_batched++;
+			return it->second;
+		}
+	}
+
+	// Start a new batch. Prefer reads unless that would starve writes.
+	int direction;
+	if(!_fifo[0].empty() && (_fifo[1].empty() || _readBatchesSinceWrite < writesStarved)) {
+		direction = 0;
+		if(!_fifo[1].empty())
+			_readBatchesSinceWrite++;
+	}else{
+		direction = 1;
+		_readBatchesSinceWrite = 0;
+	}
+
+	// Serve the oldest request if it expired; otherwise, continue the sweep.
+	Request *request = _fifo[direction].front();
+	if(request->deadline > now()) {
+		auto &sorted = _sorted[direction];
+		auto it = sorted.lower_bound(direction == _direction ? _nextSector : 0);
+		if(it == sorted.end())
+			it = sorted.begin();
+		request = it->second;
+	}
+
+	_direction = direction;
+	_batched = 1;
+	return request;
+}
+
+void RequestQueue::_unplug() {
+	_plugged = false;
+	_doorbell.raise();
+}
+
+async::detached RequestQueue::_plugTimer(uint64_t generation) {
+	co_await helix::sleepFor(maxPlugTime);
+	if(_plugged && _plugGeneration == generation)
+		_unplug();
+}
+
+async::detached RequestQueue::_dispatchRequests() {
+	while(true) {
+		if(_plugged || !_numQueued || _inFlight >= _device->maxQueueDepth) {
+			co_await _doorbell.async_wait();
+			continue;
+		}
+
+		auto request = _pickRequest();
+		_remove(request);
+		_nextSector = request->sector + request->numSectors;
+		_issue(request);
+	}
+}
+
+async::detached RequestQueue::_issue(Request *request) {
+	auto start = _stats.startRequest();
+	_inFlight++;
+
+	// Merged bios are adjacent in memory, see _tryMerge().
+	void *buffer = request->bios.front()->buffer;
+	if(request->write) {
+		if(request->fua) {
+			co_await _device->writeSectorsFua(request->sector, buffer, request->numSectors);
+		}else{
+			co_await _device->writeSectors(request->sector, buffer, request->numSectors);
+		}
+	}else{
+		co_await _device->readSectors(request->sector, buffer, request->numSectors);
+	}
+
+	_inFlight--;
+	_stats.endRequest(start, request->write,
+			request->numSectors * _device->sectorSize / 512);
+
+	// Do not keep requests plugged while the device is idle.
+	if(_plugged && !_inFlight)
+		_unplug();
+
+	// Raising the events resumes the submitters, which destroys the bios.
+	auto bios = std::move(request->bios);
+	delete request;
+	for(auto bio : bios)
+		bio->done.raise();
+
+	_doorbell.raise();
+}
+
+} // namespace blockfs
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <array>
+#include <list>
+#include <map>
+#include <vector>
+
+#include <async/oneshot-event.hpp>
+#include <async/recurring-event.hpp>
+#include <async/result.hpp>
+#include <blockfs.hpp>
+
+namespace blockfs {
+
+// Counters in the format of Linux' /sys/block/<dev>/stat.
+struct IoStats {
+	// Indexed by 0 for reads and 1 for writes.
+	std::array<uint64_t, 2> ios{};
+	std::array<uint64_t, 2> merges{};
+	std::array<uint64_t, 2> sectors{};
+	std::array<uint64_t, 2> ticks{};
+	uint64_t inFlight = 0;
+	uint64_t ioTicks = 0;
+	uint64_t timeInQueue = 0;
+	uint64_t flushes = 0;
+	uint64_t flushTicks = 0;
+
+	// Account a request that is passed to the device. startRequest() returns
+	// the start time that has to be passed to endRequest().
+	uint64_t startRequest();
+	void endRequest(uint64_t start, bool write, uint64_t numSectors);
+
+	// Updates ioTicks and timeInQueue up to the given time.
+	void accountTime(uint64_t time);
+
+	// Returns the counters in the order of /sys/block/<dev>/stat.
+	std::vector<uint64_t> toVector() const;
+
+private:
+	uint64_t _lastAccountTime = 0;
+};
+
+// Sits between filesystems and the driver of a BlockDevice.
+// Requests are merged with queued requests that are adjacent both on disk and
+// in memory. While the device is busy, new requests are plugged for a short
+// time (such that concurrent submitters can be merged) and then dispatched by
+// a deadline scheduler that serves requests in sector order while bounding
+// their latency.
+// At most BlockDevice::maxQueueDepth requests are passed to the driver at a time.
+// Cache flushes are batched: all flush() calls that arrive before a flush
+// is issued to the driver are completed by that flush (group commit).
+struct RequestQueue {
+	RequestQueue(BlockDevice *device);
+
+	RequestQueue(const RequestQueue &) = delete;
+
+	RequestQueue &operator= (const RequestQueue &) = delete;
+
+	async::result<void> submit(bool write, uint64_t sector, void *buffer, size_t num_sectors,
+			bool fua = false);
+
+	async::result<frg::expected<protocols::fs::Error>> flush();
+
+	IoStats stats();
+
+private:
+	// A single submission by a caller of submit().
+	struct Bio {
+		uint64_t sector;
+		size_t numSectors;
+		void *buffer;
+		async::oneshot_event done;
+	};
+
+	// A (possibly merged) request that is dispatched to the driver as a whole.
+	struct Request {
+		bool write;
+		// FUA requests are only merged with other FUA requests.
+		bool fua;
+		uint64_t sector;
+		size_t numSectors;
+		std::list<Bio *> bios;
+		uint64_t deadline;
+		std::list<Request *>::iterator fifoIt;
+	};
+
+	using SortedMap = std::multimap<uint64_t, Request *>;
+
+	bool _tryMerge(Bio *bio, bool write, bool fua);
+	void _insert(Request *request);
+	void _remove(Request *request);
+
+	// Implements the deadline policy.
+	Request *_pickRequest();
+
+	void _unplug();
+	async::detached _plugTimer(uint64_t generation);
+	async::detached _dispatchRequests();
+	async::detached _issue(Request *request);
+
+	BlockDevice *_device;
+
+	// Queued requests; indexed by direction (0 = read, 1 = write).
+	std::array<SortedMap, 2> _sorted;
+	std::array<std::list<Request *>, 2> _fifo;
+	size_t _numQueued = 0;
+
+	bool _plugged = false;
+	// Incremented on each plug such that stale timers do not unplug.
+	uint64_t _plugGeneration = 0;
+	async::recurring_event _doorbell;
+	size_t _inFlight = 0;
+
+	// Scheduler state.
+	int _direction = 0;
+	uint64_t _nextSector = 0;
+	unsigned int _batched = 0;
+	unsigned int _readBatchesSinceWrite = 0;
+
+	// A caller of flush() that waits for its flush to complete.
+	struct PendingFlush {
+		bool done = false;
+		frg::expected<protocols::fs::Error> result;
+	};
+
+	// flush() calls that are not covered by a flush that is in flight.
+	std::vector<PendingFlush *> _pendingFlushes;
+	bool _flushInFlight = false;
+	async::recurring_event _flushDoorbell;
+
+	IoStats _stats;
+};
+
+} // namespace blockfs
@@ -1,22 +1,58 @@
 #include <nic/virtio/virtio.hpp>
 
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <deque>
 #include <arch/dma_pool.hpp>
+#include <async/recurring-event.hpp>
 #include <core/virtio/core.hpp>
 
 namespace {
 	constexpr bool logFrames = false;
+
+	// Upper bound on the number of RX/TX virtq pairs that we set up.
+	constexpr size_t maxQueuePairs = 8;
+
+	// Upper bound on the number of buffers that we keep posted to each RX virtq.
+	constexpr size_t maxRxBuffers = 256;
+
+	// Size of RX buffers if VIRTIO_NET_F_MRG_RXBUF is negotiated.
+	// Larger frames are spread over multiple buffers.
+	constexpr size_t mergeableBufferSize = 2048;
+
+	constexpr size_t maxFrameSize = 1514;
+	// Frames that are subject to segmentation offloads carry a full IP packet.
+	constexpr size_t maxTsoFrameSize = 14 + 0xFFFF;
 }
 
 namespace {
 // Device feature bits.
 constexpr size_t legacyHeaderSize = 10;
 enum {
-	VIRTIO_NET_F_MAC = 5
+	VIRTIO_NET_F_CSUM = 0,
+	VIRTIO_NET_F_GUEST_CSUM = 1,
+	VIRTIO_NET_F_MAC = 5,
+	VIRTIO_NET_F_GUEST_TSO4 = 7,
+	VIRTIO_NET_F_HOST_TSO4 = 11,
+	VIRTIO_NET_F_MRG_RXBUF = 15,
+	VIRTIO_NET_F_CTRL_VQ = 17,
+	VIRTIO_NET_F_MQ = 22,
+	VIRTIO_NET_F_RSS = 60
+};
+
+// Offsets into the device configuration space.
+enum {
+	configMaxQueuePairs = 8,
+	configRssMaxKeySize = 17,
+	configRssMaxIndirectionTableLength = 18,
+	configSupportedHashTypes = 20
 };
 
 // Bits for VirtHeader::flags.
 enum {
-	VIRTIO_NET_HDR_F_NEEDS_CSUM = 1
+	VIRTIO_NET_HDR_F_NEEDS_CSUM = 1,
+	VIRTIO_NET_HDR_F_DATA_VALID = 2
 };
 
 // Values for VirtHeader::gsoType.
@@ -28,6 +64,31 @@ enum {
 	VIRTIO_NET_HDR_GSO_ECN = 0x80
 };
 
+// Commands of the control virtq.
+enum {
+	VIRTIO_NET_CTRL_MQ = 4,
+	VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET = 0,
+	VIRTIO_NET_CTRL_MQ_RSS_CONFIG = 1,
+
+	VIRTIO_NET_OK = 0
+};
+
+// Hash types for VIRTIO_NET_CTRL_MQ_RSS_CONFIG.
+enum {
+	VIRTIO_NET_RSS_HASH_TYPE_IPv4 = 1 << 0,
+	VIRTIO_NET_RSS_HASH_TYPE_TCPv4 = 1 << 1,
+	VIRTIO_NET_RSS_HASH_TYPE_UDPv4 = 1 << 2
+};
+
+// The Toeplitz key from Microsoft's RSS specification.
+constexpr uint8_t defaultRssKey[40] = {
+	0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+	0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+	0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+	0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+	0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa
+};
+
 struct VirtHeader {
 	uint8_t flags;
 	uint8_t gsoType;
@@ -38,20 +99,74 @@ struct VirtHeader {
 	uint16_t numBuffers;
 };
 
+struct ControlHeader {
+	uint8_t cls;
+	uint8_t command;
+};
+
 struct VirtioNic : nic::Link {
 	VirtioNic(mbus_ng::EntityId entity, std::unique_ptr<virtio_core::Transport> transport);
 	async::result<void> initialize();
 
 	async::result<size_t> receive(arch::dma_buffer_view) override;
 	async::result<void> send(const arch::dma_buffer_view) override;
+	async::result<nic::RxInfo> receiveWithInfo(arch::dma_buffer_view frame) override;
+	async::result<void> sendWithOffload(const arch::dma_buffer_view frame, nic::TxOffload offload) override;
+	async::result<void> receiveBatch(std::vector<nic::RxFrame> &frames, size_t maxFrames) override;
 
 	~VirtioNic() override = default;
 private:
+	struct RxQueue;
+
+	// Buffer that is kept posted to an RX virtq.
+	struct RxBuffer : virtio_core::Request {
+		RxBuffer(RxQueue *queue, arch::dma_buffer buffer)
+		: queue{queue}, buffer{std::move(buffer)} { }
+
+		RxQueue *queue;
+		arch::dma_buffer buffer;
+	};
+
+	struct RxQueue {
+		VirtioNic *nic;
+		virtio_core::Queue *virtq;
+		std::vector<std::unique_ptr<RxBuffer>> buffers;
+		// Buffers that the device filled, in the order of the used ring.
+		std::deque<RxBuffer *> filled;
+		// Number of buffers that the device can currently fill.
+		size_t numPosted = 0;
+		// Buffers were posted since the device was last notified.
+		bool needsNotify = false;
+	};
+
+	async::result<void> postRxBuffer_(RxBuffer *buffer);
+	async::detached repostRxBuffer_(RxBuffer *buffer);
+	void notifyRx_();
+	bool popRxFrame_(RxQueue *queue, std::vector<nic::RxFrame> &frames);
+	async::result<void> transmit_(const arch::dma_buffer_view frame, VirtHeader header);
+	virtio_core::Queue *selectTxQueue_(arch::dma_buffer_view frame);
+	async::result<bool> sendControl_(uint8_t cls, uint8_t command, arch::dma_buffer_view data);
+	async::result<bool> configureRss_();
+
 	mbus_ng::EntityId entity_;
 	std::unique_ptr<virtio_core::Transport> transport_;
 	arch::contiguous_pool dmaPool_;
-	virtio_core::Queue *receiveVq_;
-	virtio_core::Queue *transmitVq_;
+	// Modern devices and VIRTIO_NET_F_MRG_RXBUF use the full VirtHeader.
+	size_t headerSize_ = legacyHeaderSize;
+	bool mergeable_ = false;
+	bool rss_ = false;
+	size_t rssKeySize_ = 0;
+	size_t rssTableLength_ = 0;
+	uint32_t rssHashTypes_ = 0;
+	std::vector<std::unique_ptr<RxQueue>> rxQueues_;
+	std::vector<virtio_core::Queue *> txQueues_;
+	virtio_core::Queue *controlVq_ = nullptr;
+	// Raised when the device fills RX buffers while interrupts are enabled.
+	async::recurring_event rxDoorbell_;
+	// receiveBatch() is blocked until the device fills RX buffers.
+	bool waitingForRx_ = false;
+	// RX virtq that receiveBatch() looks at first, for fairness.
+	size_t nextRxQueue_ = 0;
 };
 
 VirtioNic::VirtioNic(mbus_ng::EntityId entity, std::unique_ptr<virtio_core::Transport> transport)
@@ -70,10 +185,70 @@ VirtioNic::VirtioNic(mbus_ng::EntityId entity, std::unique_ptr<virtio_core::Tran
 		transport_->acknowledgeDriverFeature(VIRTIO_NET_F_MAC);
 	}
 
+	auto negotiate = [&] (unsigned int feature) {
+		if(!transport_->checkDeviceFeature(feature))
+			return false;
+		transport_->acknowledgeDriverFeature(feature);
+		return true;
+	};
+
+	if(!transport_->isLegacy())
+		headerSize_ = sizeof(VirtHeader);
+
+	if(negotiate(VIRTIO_NET_F_MRG_RXBUF)) {
+		mergeable_ = true;
+		headerSize_ = sizeof(VirtHeader);
+	}
+
+	if(negotiate(VIRTIO_NET_F_CSUM)) {
+		offloads_.txChecksum = true;
+		if(negotiate(VIRTIO_NET_F_HOST_TSO4))
+			offloads_.maxTsoSize = 0xFFFF;
+	}
+
+	// Without mergeable RX buffers, GUEST_TSO4 would require us to post 64 KiB buffers.
+	if(negotiate(VIRTIO_NET_F_GUEST_CSUM)) {
+		offloads_.rxChecksum = true;
+		if(mergeable_ && negotiate(VIRTIO_NET_F_GUEST_TSO4))
+			offloads_.maxReceiveSize = maxTsoFrameSize;
+	}
+
+	// Multiple queue pairs are configured through the control virtq,
+	// which comes after the last queue pair.
+	size_t numPairs = 1;
+	size_t controlIndex = 0;
+	bool mq = transport_->checkDeviceFeature(VIRTIO_NET_F_MQ);
+	bool rss = !transport_->isLegacy() && transport_->checkDeviceFeature(VIRTIO_NET_F_RSS);
+	if((mq || rss) && negotiate(VIRTIO_NET_F_CTRL_VQ)) {
+		if(mq)
+			transport_->acknowledgeDriverFeature(VIRTIO_NET_F_MQ);
+		if(rss) {
+			transport_->acknowledgeDriverFeature(VIRTIO_NET_F_RSS);
+			rss_ = true;
+			rssKeySize_ = std::min(size_t{transport_->loadConfig8(configRssMaxKeySize)},
+					sizeof(defaultRssKey));
+			rssTableLength_ = transport_->loadConfig16(configRssMaxIndirectionTableLength);
+			rssHashTypes_ = transport_->loadConfig32(configSupportedHashTypes)
+					& (VIRTIO_NET_RSS_HASH_TYPE_IPv4 | VIRTIO_NET_RSS_HASH_TYPE_TCPv4
+						| VIRTIO_NET_RSS_HASH_TYPE_UDPv4);
+		}
+
+		size_t devicePairs = std::max(size_t{transport_->loadConfig16(configMaxQueuePairs)}, size_t{1});
+		numPairs = std::min(devicePairs, maxQueuePairs);
+		controlIndex = 2 * devicePairs;
+	}
+
 	transport_->finalizeFeatures();
-	transport_->claimQueues(2);
-	receiveVq_ = transport_->setupQueue(0);
-	transmitVq_ = transport_->setupQueue(1);
+	transport_->claimQueues(controlIndex ? controlIndex + 1 : 2);
+	for(size_t i = 0; i < numPairs; i++) {
+		auto queue = std::make_unique<RxQueue>();
+		queue->nic = this;
+		queue->virtq = transport_->setupQueue(2 * i);
+		rxQueues_.push_back(std::move(queue));
+		txQueues_.push_back(transport_->setupQueue(2 * i + 1));
+	}
+	if(controlIndex)
+		controlVq_ = transport_->setupQueue(controlIndex);
 
 	promiscuous_ = true;
 	all_multicast_ = true;
@@ -85,6 +260,45 @@ VirtioNic::VirtioNic(mbus_ng::EntityId entity, std::unique_ptr<virtio_core::Tran
 }
 
 async::result<void> VirtioNic::initialize() {
+	// Devices start out with a single queue pair.
+	if(rxQueues_.size() > 1) {
+		bool success = false;
+		if(rss_)
+			success = co_await configureRss_();
+		if(!success) {
+			arch::dma_object<uint16_t> pairs{&dmaPool_};
+			*pairs.data() = rxQueues_.size();
+			success = co_await sendControl_(VIRTIO_NET_CTRL_MQ, VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET,
+					pairs.view_buffer());
+		}
+		if(!success) {
+			std::cout << "virtio-driver: Failed to enable multiple queue pairs" << std::endl;
+			rxQueues_.resize(1);
+			txQueues_.resize(1);
+		}
+	}
+
+	// Without mergeable buffers, the header is in a separate descriptor.
+	auto numDescriptors = rxQueues_.front()->virtq->numDescriptors();
+	size_t numBuffers = std::min(mergeable_ ? numDescriptors : numDescriptors / 2, maxRxBuffers);
+	size_t bufferSize = mergeable_ ? mergeableBufferSize : headerSize_ + maxFrameSize;
+	for(auto &queue : rxQueues_) {
+		for(size_t i = 0; i < numBuffers; i++)
+			queue->buffers.push_back(std::make_unique<RxBuffer>(queue.get(),
+					arch::dma_buffer{&dmaPool_, bufferSize}));
+		for(auto &buffer : queue->buffers)
+			co_await postRxBuffer_(buffer.get());
+	}
+	notifyRx_();
+
+	std::cout << "virtio-driver: Using " << rxQueues_.size() << " queue pairs"
+			<< (rss_ ? " with RSS" : "")
+			<< (mergeable_ ? ", mergeable RX buffers" : "")
+			<< (offloads_.txChecksum ? ", TX checksums" : "")
+			<< (offloads_.rxChecksum ? ", RX checksums" : "")
+			<< (offloads_.maxTsoSize ? ", TSO" : "")
+			<< (offloads_.maxReceiveSize ? ", LRO" : "") << std::endl;
+
 	mbus_ng::Properties netProperties{
 		{"drvcore.mbus-parent", mbus_ng::StringItem{std::to_string(entity_)}},
 		{"unix.subsystem", mbus_ng::StringItem{"net"}},
@@ -104,42 +318,315 @@ async::result<void> VirtioNic::initialize() {
 	}(std::move(netClassEntity));
 }
 
-async::result<size_t> VirtioNic::receive(arch::dma_buffer_view frame) {
-	arch::dma_object<VirtHeader> header { &dmaPool_ };
+async::result<void> VirtioNic::postRxBuffer_(RxBuffer *buffer) {
+	auto queue = buffer->queue;
+	auto virtq = queue->virtq;
 
 	virtio_core::Chain chain;
-	chain.append(co_await receiveVq_->obtainDescriptor());
-	chain.setupBuffer(virtio_core::deviceToHost,
-			header.view_buffer().subview(0, legacyHeaderSize));
-	chain.append(co_await receiveVq_->obtainDescriptor());
-	chain.setupBuffer(virtio_core::deviceToHost, frame);
+	if(mergeable_) {
+		chain.append(co_await virtq->obtainDescriptor());
+		chain.setupBuffer(virtio_core::deviceToHost, buffer->buffer);
+	}else{
+		chain.append(co_await virtq->obtainDescriptor());
+		chain.setupBuffer(virtio_core::deviceToHost, buffer->buffer.subview(0, headerSize_));
+		chain.append(co_await virtq->obtainDescriptor());
+		chain.setupBuffer(virtio_core::deviceToHost, buffer->buffer.subview(headerSize_));
+	}
+
+	virtq->postDescriptor(chain.front(), buffer, [] (virtio_core::Request *base) {
+		auto buffer = static_cast<RxBuffer *>(base);
+		auto queue = buffer->queue;
+		queue->numPosted--;
+		queue->filled.push_back(buffer);
+		queue->nic->rxDoorbell_.raise();
+	});
+	queue->numPosted++;
+	queue->needsNotify = true;
+}
 
-	co_return (co_await receiveVq_->submitDescriptor(chain.front()) - legacyHeaderSize);
+// Posts a buffer again once the stack is done with it. Since each virtq has enough
+// descriptors for all of its buffers, this never blocks.
+async::detached VirtioNic::repostRxBuffer_(RxBuffer *buffer) {
+	co_await postRxBuffer_(buffer);
+	// Otherwise, receiveBatch() notifies the device before it polls.
+	if(waitingForRx_)
+		notifyRx_();
+}
+
+void VirtioNic::notifyRx_() {
+	for(auto &queue : rxQueues_) {
+		if(!queue->needsNotify)
+			continue;
+		queue->virtq->notify();
+		queue->needsNotify = false;
+	}
+}
+
+// Turns the buffers of the next frame into an RxFrame. Returns false if there is none.
+// Since the header and data are adjacent in each buffer, the same code
+// handles mergeable and non-mergeable buffers.
+bool VirtioNic::popRxFrame_(RxQueue *queue, std::vector<nic::RxFrame> &frames) {
+	while(!queue->filled.empty()) {
+		auto first = queue->filled.front();
+		VirtHeader header{};
+		memcpy(&header, first->buffer.data(), std::min(headerSize_, first->len));
+		size_t numBuffers = mergeable_ ? std::max(header.numBuffers, uint16_t{1}) : 1;
+		// The device returns all buffers of a frame at once, but do not rely on that.
+		if(queue->filled.size() < numBuffers)
+			return false;
+
+		// Only the first buffer contains the header.
+		auto payloadSize = [&] (size_t i) -> size_t {
+			size_t skip = i ? 0 : headerSize_;
+			auto len = queue->filled[i]->len;
+			return len > skip ? len - skip : 0;
+		};
+		size_t length = 0;
+		for(size_t i = 0; i < numBuffers; i++)
+			length += payloadSize(i);
+
+		// Partially checksummed frames come from the same host and do not need to be verified.
+		nic::RxFrame frame{
+			.owner = {},
+			.data = {},
+			.info = {
+				.length = length,
+				.checksumValid = (header.flags & (VIRTIO_NET_HDR_F_NEEDS_CSUM
+						| VIRTIO_NET_HDR_F_DATA_VALID)) != 0
+			}
+		};
+
+		if(numBuffers == 1 && length && queue->numPosted >= queue->buffers.size() / 4) {
+			// Lend the buffer to the stack. It is posted again once the frame is dropped.
+			queue->filled.pop_front();
+			frame.owner = nic::FrameOwner{first, [this] (RxBuffer *buffer) {
+				repostRxBuffer_(buffer);
+			}};
+			frame.data = first->buffer.subview(headerSize_, length);
+		}else{
+			// Copy frames that span multiple buffers, and copy if the stack holds on to
+			// so many buffers that the device might run out of them.
+			std::shared_ptr<arch::dma_buffer> copy;
+			if(length)
+				copy = std::make_shared<arch::dma_buffer>(&dmaPool_, length);
+
+			size_t offset = 0;
+			for(size_t i = 0; i < numBuffers; i++) {
+				auto buffer = queue->filled[i];
+				size_t size = payloadSize(i);
+				if(size)
+					memcpy(static_cast<char *>(copy->data()) + offset,
+							static_cast<char *>(buffer->buffer.data()) + (i ? 0 : headerSize_),
+							size);
+				offset += size;
+			}
+			for(size_t i = 0; i < numBuffers; i++) {
+				auto buffer = queue->filled.front();
+				queue->filled.pop_front();
+				repostRxBuffer_(buffer);
+			}
+
+			if(!length)
+				continue;
+			frame.data = *copy;
+			frame.owner = std::move(copy);
+		}
+
+		if(logFrames)
+			std::cout << "virtio-driver: received frame of " << length
+					<< " bytes from virtq " << queue->virtq->queueIndex() << std::endl;
+		frames.push_back(std::move(frame));
+		return true;
+	}
+	return false;
+}
+
+// Polls the RX virtqs while frames keep arriving and only waits for interrupts
+// once they are all empty, similar to Linux' NAPI.
+async::result<void> VirtioNic::receiveBatch(std::vector<nic::RxFrame> &frames, size_t maxFrames) {
+	while(true) {
+		// Return buffers that the stack dropped since the last batch to the device.
+		notifyRx_();
+
+		for(size_t k = 0; k < rxQueues_.size(); k++) {
+			auto queue = rxQueues_[(nextRxQueue_ + k) % rxQueues_.size()].get();
+			queue->virtq->processInterrupt();
+			while(frames.size() < maxFrames && popRxFrame_(queue, frames))
+				;
+		}
+		nextRxQueue_ = (nextRxQueue_ + 1) % rxQueues_.size();
+
+		if(!frames.empty()) {
+			notifyRx_();
+			co_return;
+		}
+
+		// Poll once more after enabling interrupts, since the device
+		// might have filled buffers before it saw the change.
+		bool pending = false;
+		for(auto &queue : rxQueues_) {
+			queue->virtq->setInterruptsEnabled(true);
+			queue->virtq->processInterrupt();
+			if(!queue->filled.empty())
+				pending = true;
+		}
+
+		if(!pending) {
+			waitingForRx_ = true;
+			co_await rxDoorbell_.async_wait();
+			waitingForRx_ = false;
+		}
+
+		for(auto &queue : rxQueues_)
+			queue->virtq->setInterruptsEnabled(false);
+	}
+}
+
+async::result<nic::RxInfo> VirtioNic::receiveWithInfo(arch::dma_buffer_view frame) {
+	std::vector<nic::RxFrame> frames;
+	while(true) {
+		frames.clear();
+		co_await receiveBatch(frames, 1);
+
+		auto &rx = frames.front();
+		if(rx.data.size() > frame.size()) {
+			std::cout << "virtio-driver: Dropping frame of " << rx.data.size()
+					<< " bytes" << std::endl;
+			continue;
+		}
+
+		memcpy(frame.data(), rx.data.data(), rx.data.size());
+		co_return rx.info;
+	}
+}
+
+async::result<size_t> VirtioNic::receive(arch::dma_buffer_view frame) {
+	auto info = co_await receiveWithInfo(frame);
+	co_return info.length;
 }
 
 async::result<void> VirtioNic::send(const arch::dma_buffer_view payload) {
-	if (payload.size() > 1514) {
+	if (payload.size() > maxFrameSize) {
+		throw std::runtime_error("data exceeds mtu");
+	}
+
+	co_await transmit_(payload, VirtHeader{});
+}
+
+async::result<void> VirtioNic::sendWithOffload(const arch::dma_buffer_view payload,
+		nic::TxOffload offload) {
+	if (payload.size() > (offload.segmentSize ? maxTsoFrameSize : maxFrameSize)) {
 		throw std::runtime_error("data exceeds mtu");
 	}
 
-	arch::dma_object<VirtHeader> header { &dmaPool_ };
-	memset(header.data(), 0, sizeof(VirtHeader));
+	VirtHeader header{};
+	if(offload.needsChecksum) {
+		assert(offloads_.txChecksum);
+		header.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+		header.csumStart = offload.checksumStart;
+		header.csumOffset = offload.checksumOffset;
+	}
+	if(offload.segmentSize) {
+		assert(offloads_.maxTsoSize);
+		header.gsoType = VIRTIO_NET_HDR_GSO_TCPV4;
+		header.gsoSize = offload.segmentSize;
+		header.hdrLen = offload.headerSize;
+	}
+
+	co_await transmit_(payload, header);
+}
+
+async::result<void> VirtioNic::transmit_(const arch::dma_buffer_view payload, VirtHeader header) {
+	arch::dma_object<VirtHeader> dmaHeader { &dmaPool_ };
+	memcpy(dmaHeader.data(), &header, sizeof(VirtHeader));
+
+	auto virtq = selectTxQueue_(payload);
 
 	virtio_core::Chain chain;
-	chain.append(co_await transmitVq_->obtainDescriptor());
+	chain.append(co_await virtq->obtainDescriptor());
 	chain.setupBuffer(virtio_core::hostToDevice,
-			header.view_buffer().subview(0, legacyHeaderSize));
-	chain.append(co_await transmitVq_->obtainDescriptor());
-	chain.setupBuffer(virtio_core::hostToDevice, payload);
+			dmaHeader.view_buffer().subview(0, headerSize_));
+	co_await virtio_core::scatterGather(virtio_core::hostToDevice, chain, virtq, payload);
 
 	if(logFrames) {
 		std::cout << "virtio-driver: sending frame" << std::endl;
 	}
-	co_await transmitVq_->submitDescriptor(chain.front());
+	co_await virtq->submitDescriptor(chain.front());
 	if(logFrames) {
 		std::cout << "virtio-driver: sent frame" << std::endl;
 	}
 }
+
+// Keeps all frames of a flow on the same virtq, such that they are not reordered.
+virtio_core::Queue *VirtioNic::selectTxQueue_(arch::dma_buffer_view frame) {
+	if(txQueues_.size() == 1)
+		return txQueues_.front();
+
+	auto p = static_cast<const uint8_t *>(frame.data());
+	uint32_t hash = 0;
+	auto mix = [&] (size_t offset, size_t length) {
+		for(size_t i = offset; i < offset + length; i++)
+			hash = (hash ^ p[i]) * 16777619;
+	};
+
+	// Hash the IPv4 addresses and the TCP/UDP ports (if any).
+	if(frame.size() >= 34 && p[12] == 0x08 && p[13] == 0x00) {
+		mix(26, 8);
+		size_t ihl = (p[14] & 0xF) * 4;
+		if((p[23] == 6 || p[23] == 17) && frame.size() >= 14 + ihl + 4)
+			mix(14 + ihl, 4);
+	}
+	return txQueues_[hash % txQueues_.size()];
+}
+
+async::result<bool> VirtioNic::sendControl_(uint8_t cls, uint8_t command,
+		arch::dma_buffer_view data) {
+	arch::dma_object<ControlHeader> header{&dmaPool_};
+	header.data()->cls = cls;
+	header.data()->command = command;
+	arch::dma_object<uint8_t> ack{&dmaPool_};
+	*ack.data() = 0xFF;
+
+	virtio_core::Chain chain;
+	chain.append(co_await controlVq_->obtainDescriptor());
+	chain.setupBuffer(virtio_core::hostToDevice, header.view_buffer());
+	co_await virtio_core::scatterGather(virtio_core::hostToDevice, chain, controlVq_, data);
+	chain.append(co_await controlVq_->obtainDescriptor());
+	chain.setupBuffer(virtio_core::deviceToHost, ack.view_buffer());
+
+	co_await controlVq_->submitDescriptor(chain.front());
+	co_return *ack.data() == VIRTIO_NET_OK;
+}
+
+// Spreads flows over all RX virtqs. The device also uses the hash to pick
+// the TX virtq for its replies, which does not matter to us.
+async::result<bool> VirtioNic::configureRss_() {
+	if(!rssTableLength_ || !rssKeySize_ || !rssHashTypes_)
+		co_return false;
+	size_t tableLength = std::bit_floor(std::min(rssTableLength_, size_t{128}));
+
+	// struct virtio_net_rss_config, which has variable-size fields.
+	size_t size = 8 + 2 * tableLength + 3 + rssKeySize_;
+	arch::dma_buffer config{&dmaPool_, size};
+	auto p = static_cast<uint8_t *>(config.data());
+	auto store16 = [&] (uint16_t value) {
+		memcpy(p, &value, sizeof(uint16_t));
+		p += sizeof(uint16_t);
+	};
+
+	memcpy(p, &rssHashTypes_, sizeof(uint32_t));
+	p += sizeof(uint32_t);
+	store16(tableLength - 1);
+	store16(0); // Unclassified packets go to the first RX virtq.
+	for(size_t i = 0; i < tableLength; i++)
+		store16(i % rxQueues_.size());
+	store16(txQueues_.size());
+	*p++ = rssKeySize_;
+	memcpy(p, defaultRssKey, rssKeySize_);
+
+	co_return co_await sendControl_(VIRTIO_NET_CTRL_MQ, VIRTIO_NET_CTRL_MQ_RSS_CONFIG, config);
+}
+
 } // namespace
 
 namespace nic::virtio {
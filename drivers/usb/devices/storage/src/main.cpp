@@ -22,16 +22,18 @@ namespace {
 
 namespace proto = protocols::usb;
 
-async::detached StorageDevice::run(int config_num, int intf_num) {
+async::result<void> StorageDevice::setup(proto::Configuration config,
+		const std::string &descriptor, int intf_num, int alternative) {
 	// I own a USB key that does not support the READ6 command. ~AvdG
 	enableRead6 = false;
 
-	auto descriptor = (co_await usbDevice_.configurationDescriptor(0)).unwrap();
-
 	std::optional<int> in_endp_number;
 	std::optional<int> out_endp_number;
 
 	proto::walkConfiguration(descriptor, [&] (int type, size_t, void *, const auto &info) {
+		if(info.interfaceNumber != intf_num || info.interfaceAlternative != alternative)
+			return;
+
 		if(type == proto::descriptor_type::endpoint) {
 			if(info.endpointIn.value()) {
 				in_endp_number = info.endpointNumber.value();
@@ -47,17 +49,14 @@ async::detached StorageDevice::run(int config_num, int intf_num) {
 	});
 
 	if(logSteps)
-		std::cout << "block-usb: Setting up configuration" << std::endl;
+		std::cout << "block-usb: Setting up interface" << std::endl;
 
-	auto config = (co_await usbDevice_.useConfiguration(0, config_num)).unwrap();
-	auto intf = (co_await config.useInterface(intf_num, 0)).unwrap();
+	auto intf = (co_await config.useInterface(intf_num, alternative)).unwrap();
 	endp_in_ = (co_await intf.getEndpoint(proto::PipeType::in, in_endp_number.value())).unwrap();
 	endp_out_ = (co_await intf.getEndpoint(proto::PipeType::out, out_endp_number.value())).unwrap();
 
 	if(logSteps)
 		std::cout << "block-usb: Device is ready" << std::endl;
-
-	runScsi();
 }
 
 async::result<frg::expected<scsi::Error, size_t>> StorageDevice::sendScsiCommand(const scsi::CommandInfo &info) {
@@ -122,9 +121,9 @@ async::detached bindDevice(mbus_ng::Entity entity) {
 
 	std::optional<int> config_number;
 	std::optional<int> intf_number;
-	std::optional<int> intf_class;
-	std::optional<int> intf_subclass;
-	std::optional<int> intf_protocol;
+	// Alternate settings of the interface that implement BOT and UAS.
+	std::optional<int> bot_alternative;
+	std::optional<int> uas_alternative;
 
 	if(logEnumeration)
 		std::cout << "block-usb: Getting configuration descriptor" << std::endl;
@@ -134,47 +133,74 @@ async::detached bindDevice(mbus_ng::Entity entity) {
 		std::cout << "usb-hid: Failed to get device descriptor" << std::endl;
 		co_return;
 	}
+	auto descriptor = descriptorOrError.value();
 
-	proto::walkConfiguration(descriptorOrError.value(), [&] (int type, size_t, void *p, const auto &info) {
+	proto::walkConfiguration(descriptor, [&] (int type, size_t, void *p, const auto &info) {
 		if(type == proto::descriptor_type::configuration) {
 			assert(!config_number);
 			config_number = info.configNumber.value();
 		}else if(type == proto::descriptor_type::interface) {
-			if(intf_number) {
+			if(intf_number && intf_number != info.interfaceNumber) {
 				std::cout << "block-usb: Ignoring interface "
 						<< info.interfaceNumber.value() << std::endl;
 				return;
 			}
+			auto desc = (proto::InterfaceDescriptor *)p;
 			if(logEnumeration)
 				std::cout << "block-usb: Found interface: " << info.interfaceNumber.value()
-						<< ", alternative: " << info.interfaceAlternative.value() << std::endl;
+						<< ", alternative: " << info.interfaceAlternative.value()
+						<< ", class: 0x" << std::hex << (int)desc->interfaceClass
+						<< ", subclass: 0x" << (int)desc->interfaceSubClass
+						<< ", protocol: 0x" << (int)desc->interfaceProtocol
+						<< std::dec << std::endl;
 			intf_number = info.interfaceNumber.value();
 
-			assert(!intf_class);
-			assert(!intf_subclass);
-			assert(!intf_protocol);
-			auto desc = (proto::InterfaceDescriptor *)p;
-			intf_class = desc->interfaceClass;
-			intf_subclass = desc->interfaceSubClass;
-			intf_protocol = desc->interfaceProtocol;
+			if(desc->interfaceClass != protocols::usb::usb_class::mass_storage
+					|| desc->interfaceSubClass != 0x06)
+				return;
+			if(desc->interfaceProtocol == 0x50 && !bot_alternative)
+				bot_alternative = info.interfaceAlternative.value();
+			if(desc->interfaceProtocol == 0x62 && !uas_alternative)
+				uas_alternative = info.interfaceAlternative.value();
 		}
 	});
 
-	if(logEnumeration)
-		std::cout << "block-usb: Device class: 0x" << std::hex << intf_class.value()
-				<< ", subclass: 0x" << intf_subclass.value()
-				<< ", protocol: 0x" << intf_protocol.value()
-				<< std::dec << std::endl;
-	if(intf_class.value() != protocols::usb::usb_class::mass_storage
-			|| intf_subclass.value() != 0x06
-			|| intf_protocol.value() != 0x50)
+	if(!bot_alternative && !uas_alternative)
 		co_return;
 
 	if(logEnumeration)
 		std::cout << "block-usb: Detected USB device" << std::endl;
 
-	auto storage_device = new StorageDevice(device, entity.id());
-	storage_device->run(config_number.value(), intf_number.value());
+	auto config = (co_await device.useConfiguration(0, config_number.value())).unwrap();
+
+	scsi::StorageDevice *storage_device = nullptr;
+	if(uas_alternative) {
+		auto uas_device = new UasDevice(entity.id());
+		auto outcome = co_await uas_device->setup(config, descriptor,
+				intf_number.value(), uas_alternative.value());
+		if(outcome) {
+			storage_device = uas_device;
+		}else{
+			std::cout << "block-usb: Failed to set up UAS, error " << (int)outcome.error()
+					<< (bot_alternative ? ", falling back to BOT" : "") << std::endl;
+			delete uas_device;
+		}
+	}
+
+	if(!storage_device && bot_alternative) {
+		auto bot_device = new StorageDevice(device, entity.id());
+		// Bulk-only transport handles one command at a time; keep the rest queued
+		// in the request queue where it can be merged.
+		bot_device->maxQueueDepth = 1;
+		co_await bot_device->setup(config, descriptor,
+				intf_number.value(), bot_alternative.value());
+		storage_device = bot_device;
+	}
+
+	if(!storage_device)
+		co_return;
+
+	storage_device->runScsi();
 	blockfs::runDevice(storage_device);
 }
 
@@ -1,9 +1,14 @@
+#include <string>
+#include <vector>
+
+#include <arch/bit.hpp>
 #include <async/recurring-event.hpp>
 #include <async/oneshot-event.hpp>
 #include <async/result.hpp>
 #include <blockfs.hpp>
 #include <scsi.hpp>
 
+#include <protocols/usb/api.hpp>
 #include <protocols/usb/server.hpp>
 
 enum Signatures {
@@ -30,12 +35,14 @@ struct [[ gnu::packed ]] CommandStatusWrapper {
 };
 static_assert(sizeof(CommandStatusWrapper) == 13);
 
+// Bulk-only transport (BOT) device.
 struct StorageDevice : scsi::StorageDevice {
 	StorageDevice(protocols::usb::Device usb_device, int64_t parent_id)
 	: scsi::StorageDevice(512, parent_id), usbDevice_(std::move(usb_device)),
 		endp_in_{nullptr}, endp_out_{nullptr} { }
 
-	async::detached run(int config_num, int intf_num);
+	async::result<void> setup(protocols::usb::Configuration config,
+			const std::string &descriptor, int intf_num, int alternative);
 
 	async::result<frg::expected<scsi::Error, size_t>> sendScsiCommand(const scsi::CommandInfo &info) override;
 
@@ -45,3 +52,106 @@ private:
 	protocols::usb::Endpoint endp_out_;
 };
 
+// --------------------------------------------------------
+// USB Attached SCSI (UAS).
+// --------------------------------------------------------
+
+namespace uas {
+
+enum PipeId : uint8_t {
+	kPipeCommand = 1,
+	kPipeStatus = 2,
+	kPipeDataIn = 3,
+	kPipeDataOut = 4
+};
+
+enum IuId : uint8_t {
+	kIuCommand = 0x01,
+	kIuSense = 0x03,
+	kIuResponse = 0x04,
+	kIuTaskManagement = 0x05,
+	kIuReadReady = 0x06,
+	kIuWriteReady = 0x07
+};
+
+// Class-specific descriptor that follows each endpoint of an UAS interface.
+struct [[ gnu::packed ]] PipeUsageDescriptor : protocols::usb::DescriptorBase {
+	uint8_t pipeId;
+	uint8_t reserved;
+};
+static_assert(sizeof(PipeUsageDescriptor) == 4);
+
+constexpr uint8_t pipeUsageDescriptorType = 0x24;
+
+// All multi-byte fields of IUs are big endian.
+struct [[ gnu::packed ]] CommandIu {
+	uint8_t iuId;
+	uint8_t reserved0;
+	uint16_t tag;
+	uint8_t priorityAttribute;
+	uint8_t reserved1;
+	uint8_t additionalCdbLength;
+	uint8_t reserved2;
+	uint8_t lun[8];
+	uint8_t cdb[16];
+};
+static_assert(sizeof(CommandIu) == 32);
+
+struct [[ gnu::packed ]] SenseIu {
+	uint8_t iuId;
+	uint8_t reserved0;
+	uint16_t tag;
+	uint16_t statusQualifier;
+	uint8_t status;
+	uint8_t reserved1[7];
+	uint16_t length;
+	uint8_t senseData[96];
+};
+static_assert(sizeof(SenseIu) == 112);
+
+struct [[ gnu::packed ]] ResponseIu {
+	uint8_t iuId;
+	uint8_t reserved;
+	uint16_t tag;
+	uint8_t additionalInfo[3];
+	uint8_t responseCode;
+};
+static_assert(sizeof(ResponseIu) == 8);
+
+// Common header of all IUs received on the status pipe.
+struct [[ gnu::packed ]] IuHeader {
+	uint8_t iuId;
+	uint8_t reserved;
+	uint16_t tag;
+};
+static_assert(sizeof(IuHeader) == 4);
+
+} // namespace uas
+
+struct UasDevice : scsi::StorageDevice {
+	UasDevice(int64_t parent_id)
+	: scsi::StorageDevice(512, parent_id), command_{nullptr}, status_{nullptr},
+		dataIn_{nullptr}, dataOut_{nullptr} { }
+
+	// Fails if the interface does not describe all four UAS pipes.
+	async::result<frg::expected<protocols::usb::UsbError>> setup(protocols::usb::Configuration config,
+			const std::string &descriptor, int intf_num, int alternative);
+
+	async::result<frg::expected<scsi::Error, size_t>> sendScsiCommand(const scsi::CommandInfo &info) override;
+
+private:
+	async::result<frg::expected<scsi::Error, size_t>> sendWithStreams_(const scsi::CommandInfo &info,
+			uint16_t tag);
+	async::result<frg::expected<scsi::Error, size_t>> sendWithoutStreams_(const scsi::CommandInfo &info,
+			uint16_t tag);
+
+	protocols::usb::Endpoint command_;
+	protocols::usb::Endpoint status_;
+	protocols::usb::Endpoint dataIn_;
+	protocols::usb::Endpoint dataOut_;
+
+	// Without streams, the device can only process one command at a time.
+	bool useStreams_ = false;
+	// With streams, each tag equals the stream ID used on the status and data pipes.
+	std::vector<uint16_t> freeTags_;
+};
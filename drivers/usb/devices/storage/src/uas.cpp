@@ -0,0 +1,255 @@
+#include <algorithm>
+#include <iostream>
+#include <optional>
+
+#include <assert.h>
+#include <string.h>
+
+#include <async/algorithm.hpp>
+#include <async/result.hpp>
+#include <protocols/usb/usb.hpp>
+#include <protocols/usb/api.hpp>
+
+#include "storage.hpp"
+
+namespace {
+	constexpr bool logSteps = false;
+
+	// Number of streams (and thus tags) that we try to allocate.
+	constexpr size_t maxStreams = 32;
+}
+
+namespace proto = protocols::usb;
+
+async::result<frg::expected<proto::UsbError>> UasDevice::setup(proto::Configuration config,
+		const std::string &descriptor, int intf_num, int alternative) {
+	std::optional<int> pipes[5];
+
+	proto::walkConfiguration(descriptor, [&] (int type, size_t length, void *p, const auto &info) {
+		if(info.interfaceNumber != intf_num || info.interfaceAlternative != alternative)
+			return;
+		if(type != uas::pipeUsageDescriptorType || !info.endpointNumber)
+			return;
+		if(length < sizeof(uas::PipeUsageDescriptor))
+			return;
+
+		auto desc = (uas::PipeUsageDescriptor *)p;
+		if(desc->pipeId < uas::kPipeCommand || desc->pipeId > uas::kPipeDataOut)
+			return;
+		pipes[desc->pipeId] = info.endpointNumber.value();
+	});
+
+	for(int i = uas::kPipeCommand; i <= uas::kPipeDataOut; i++) {
+		if(!pipes[i]) {
+			std::cout << "block-usb: UAS interface lacks pipe " << i << std::endl;
+			co_return proto::UsbError::unsupported;
+		}
+	}
+
+	if(logSteps)
+		std::cout << "block-usb: Setting up UAS interface" << std::endl;
+
+	auto intf = FRG_CO_TRY(co_await config.useInterface(intf_num, alternative));
+	command_ = FRG_CO_TRY(co_await intf.getEndpoint(proto::PipeType::out, *pipes[uas::kPipeCommand]));
+	status_ = FRG_CO_TRY(co_await intf.getEndpoint(proto::PipeType::in, *pipes[uas::kPipeStatus]));
+	dataIn_ = FRG_CO_TRY(co_await intf.getEndpoint(proto::PipeType::in, *pipes[uas::kPipeDataIn]));
+	dataOut_ = FRG_CO_TRY(co_await intf.getEndpoint(proto::PipeType::out, *pipes[uas::kPipeDataOut]));
+
+	// Streams are only available on SuperSpeed devices behind controllers that
+	// support them. Otherwise, UAS degrades to one command at a time.
+	size_t numStreams = maxStreams;
+	for(auto ep : {&status_, &dataIn_, &dataOut_}) {
+		auto streams = co_await ep->allocateStreams(numStreams);
+		if(!streams) {
+			if(streams.error() != proto::UsbError::unsupported)
+				co_return streams.error();
+			numStreams = 0;
+			break;
+		}
+		numStreams = std::min(numStreams, streams.value());
+	}
+
+	useStreams_ = numStreams > 0;
+	if(!useStreams_)
+		numStreams = 1;
+	for(size_t i = numStreams; i > 0; i--)
+		freeTags_.push_back(i);
+	maxQueueDepth = numStreams;
+
+	std::cout << "block-usb: UAS device is ready, " << (useStreams_ ? "using" : "without")
+			<< " streams, queue depth " << maxQueueDepth << std::endl;
+	co_return frg::success;
+}
+
+async::result<frg::expected<scsi::Error, size_t>> UasDevice::sendScsiCommand(const scsi::CommandInfo &info) {
+	// runScsi() never issues more than maxQueueDepth commands at a time.
+	assert(!freeTags_.empty());
+	auto tag = freeTags_.back();
+	freeTags_.pop_back();
+
+	frg::expected<scsi::Error, size_t> result{size_t{0}};
+	if(useStreams_)
+		result = co_await sendWithStreams_(info, tag);
+	else
+		result = co_await sendWithoutStreams_(info, tag);
+
+	freeTags_.push_back(tag);
+	co_return result;
+}
+
+namespace {
+
+uas::CommandIu makeCommandIu(const scsi::CommandInfo &info, uint16_t tag) {
+	assert(info.command.size() <= 16);
+
+	uas::CommandIu iu{};
+	iu.iuId = uas::kIuCommand;
+	iu.tag = arch::to_endian<arch::big_endian, uint16_t>(tag);
+	memcpy(iu.cdb, info.command.data(), info.command.size());
+	return iu;
+}
+
+// Interprets the final IU of a command, which is either a SENSE IU or a RESPONSE IU.
+frg::expected<scsi::Error> checkStatus(const uas::SenseIu &sense, uint16_t tag) {
+	if(arch::from_endian<arch::big_endian, uint16_t>(sense.tag) != tag) {
+		std::cout << "block-usb: UAS status IU has unexpected tag" << std::endl;
+		return scsi::Error{.type = scsi::ErrorType::deviceSpecific, .code = 0};
+	}
+
+	if(sense.iuId == uas::kIuSense) {
+		if(sense.status)
+			return scsi::statusToError(sense.status);
+		return frg::success;
+	}else if(sense.iuId == uas::kIuResponse) {
+		uas::ResponseIu response;
+		memcpy(&response, &sense, sizeof(uas::ResponseIu));
+		std::cout << "block-usb: UAS command failed with response code "
+				<< (int)response.responseCode << std::endl;
+		return scsi::Error{.type = scsi::ErrorType::deviceSpecific, .code = response.responseCode};
+	}
+
+	std::cout << "block-usb: Unexpected UAS IU " << (int)sense.iuId << std::endl;
+	return scsi::Error{.type = scsi::ErrorType::deviceSpecific, .code = sense.iuId};
+}
+
+} // anonymous namespace
+
+// With streams, the status and data transfers are posted before the command
+// so that the device can complete them in any order.
+async::result<frg::expected<scsi::Error, size_t>>
+UasDevice::sendWithStreams_(const scsi::CommandInfo &info, uint16_t tag) {
+	auto commandIu = makeCommandIu(info, tag);
+	uas::SenseIu sense{};
+
+	proto::BulkTransfer status{proto::XferFlags::kXferToHost,
+			arch::dma_buffer_view{nullptr, &sense, sizeof(uas::SenseIu)}};
+	status.allowShortPackets = true;
+	status.streamId = tag;
+
+	proto::BulkTransfer data{info.isWrite ? proto::XferFlags::kXferToDevice : proto::XferFlags::kXferToHost,
+			info.data};
+	data.allowShortPackets = true;
+	data.streamId = tag;
+
+	frg::expected<proto::UsbError, size_t> statusResult{proto::UsbError::other};
+	frg::expected<proto::UsbError, size_t> dataResult{size_t{0}};
+	frg::expected<proto::UsbError, size_t> commandResult{proto::UsbError::other};
+
+	bool dataDone = false;
+
+	auto doData = [&] () -> async::result<void> {
+		if(!info.data.size())
+			co_return;
+		auto &ep = info.isWrite ? dataOut_ : dataIn_;
+		dataResult = co_await ep.transfer(data);
+		dataDone = true;
+	};
+
+	auto doStatus = [&] () -> async::result<void> {
+		statusResult = co_await status_.transfer(status);
+
+		// The device may end the command early (e.g. with a CHECK CONDITION) without
+		// transferring any data. Like Linux' uas driver (which unlinks its data URBs),
+		// cancel the data transfer so that it does not stay pending forever.
+		if(info.data.size() && !dataDone) {
+			auto &ep = info.isWrite ? dataOut_ : dataIn_;
+			auto outcome = co_await ep.cancelStream(tag);
+			if(!outcome)
+				std::cout << "block-usb: Failed to cancel UAS data transfer" << std::endl;
+		}
+	};
+
+	if(logSteps)
+		std::cout << "block-usb: Sending UAS command with tag " << tag << std::endl;
+	co_await async::when_all(
+		doStatus(),
+		doData(),
+		async::transform(command_.transfer(proto::BulkTransfer{proto::XferFlags::kXferToDevice,
+				arch::dma_buffer_view{nullptr, &commandIu, sizeof(uas::CommandIu)}}), [&] (auto result) {
+			commandResult = std::move(result);
+		})
+	);
+
+	// A cancelled data transfer did not move any data; the status IU decides the outcome.
+	if(!dataResult && dataResult.error() == proto::UsbError::cancelled)
+		dataResult = size_t{0};
+
+	if(!commandResult || !statusResult || !dataResult) {
+		std::cout << "block-usb: UAS transfer failed" << std::endl;
+		co_return scsi::Error{.type = scsi::ErrorType::deviceSpecific, .code = 0};
+	}
+
+	auto outcome = checkStatus(sense, tag);
+	if(!outcome)
+		co_return outcome.error();
+	co_return dataResult.value();
+}
+
+// Without streams, the device announces the data phase with READ READY or
+// WRITE READY IUs on the status pipe.
+async::result<frg::expected<scsi::Error, size_t>>
+UasDevice::sendWithoutStreams_(const scsi::CommandInfo &info, uint16_t tag) {
+	auto commandIu = makeCommandIu(info, tag);
+	uas::SenseIu sense{};
+
+	auto receiveStatus = [&] () -> async::result<frg::expected<proto::UsbError, size_t>> {
+		proto::BulkTransfer status{proto::XferFlags::kXferToHost,
+				arch::dma_buffer_view{nullptr, &sense, sizeof(uas::SenseIu)}};
+		status.allowShortPackets = true;
+		co_return co_await status_.transfer(status);
+	};
+
+	if(logSteps)
+		std::cout << "block-usb: Sending UAS command with tag " << tag << std::endl;
+	auto commandResult = co_await command_.transfer(proto::BulkTransfer{proto::XferFlags::kXferToDevice,
+			arch::dma_buffer_view{nullptr, &commandIu, sizeof(uas::CommandIu)}});
+	if(!commandResult || !(co_await receiveStatus())) {
+		std::cout << "block-usb: UAS transfer failed" << std::endl;
+		co_return scsi::Error{.type = scsi::ErrorType::deviceSpecific, .code = 0};
+	}
+
+	size_t length = 0;
+	if(sense.iuId == uas::kIuReadReady || sense.iuId == uas::kIuWriteReady) {
+		if((sense.iuId == uas::kIuWriteReady) != info.isWrite) {
+			std::cout << "block-usb: UAS device requested the wrong data direction" << std::endl;
+			co_return scsi::Error{.type = scsi::ErrorType::deviceSpecific, .code = sense.iuId};
+		}
+
+		if(logSteps)
+			std::cout << "block-usb: Transferring UAS data" << std::endl;
+		proto::BulkTransfer data{info.isWrite ? proto::XferFlags::kXferToDevice : proto::XferFlags::kXferToHost,
+				info.data};
+		data.allowShortPackets = true;
+		auto dataResult = co_await (info.isWrite ? dataOut_ : dataIn_).transfer(data);
+		if(!dataResult || !(co_await receiveStatus())) {
+			std::cout << "block-usb: UAS transfer failed" << std::endl;
+			co_return scsi::Error{.type = scsi::ErrorType::deviceSpecific, .code = 0};
+		}
+		length = dataResult.value();
+	}
+
+	auto outcome = checkStatus(sense, tag);
+	if(!outcome)
+		co_return outcome.error();
+	co_return length;
+}
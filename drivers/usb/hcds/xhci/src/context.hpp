@@ -157,6 +157,18 @@ namespace SlotFields {
 } // namespace SlotFields
 
 namespace EpFields {
+	constexpr ContextField epState(uint8_t v) {
+		return {0, uint32_t{v & 0b111u}};
+	}
+
+	constexpr ContextField maxPStreams(uint8_t v) {
+		return {0, uint32_t{v & 0x1Fu} << 10};
+	}
+
+	constexpr ContextField linearStreamArray(bool v) {
+		return {0, uint32_t{v} << 15};
+	}
+
 	constexpr ContextField interval(uint8_t v) {
 		return {0, uint32_t{v} << 16};
 	}
@@ -173,6 +185,10 @@ namespace EpFields {
 		return {1, uint32_t{v & 0b111u} << 3};
 	}
 
+	constexpr ContextField maxBurstSize(uint8_t v) {
+		return {1, uint32_t{v} << 8};
+	}
+
 	constexpr ContextField maxPacketSize(uint16_t v) {
 		return {1, uint32_t{v} << 16};
 	}
@@ -199,3 +215,24 @@ namespace EpFields {
 		return {4, uint32_t{v & 0xFFFF} << 16};
 	}
 } // namespace EpFields
+
+// Entry of a (linear) stream context array.
+struct alignas(16) StreamContext {
+	uint32_t val[4];
+};
+static_assert(sizeof(StreamContext) == 16, "invalid StreamContext size");
+
+namespace StreamFields {
+	// Stream context type: primary transfer ring.
+	inline constexpr uint32_t sctPrimaryRing = 1;
+
+	constexpr StreamContext transferRing(uintptr_t ring, bool dequeueCycle) {
+		assert(!(ring & 0xF));
+		return StreamContext{{
+			static_cast<uint32_t>(ring & 0xFFFFFFF0u)
+				| (sctPrimaryRing << 1) | uint32_t{dequeueCycle},
+			static_cast<uint32_t>(ring >> 32),
+			0, 0
+		}};
+	}
+} // namespace StreamFields
@@ -1,7 +1,9 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
+#include <algorithm>
 #include <optional>
 #include <functional>
 #include <memory>
@@ -41,7 +43,7 @@ Controller::Controller(protocols::hw::Device hw_device, mbus_ng::Entity entity,
 		_space{_mapping.get()}, _name{name}, _memoryPool{},
 		_dcbaa{&_memoryPool, 256}, _cmdRing{this},
 		_eventRing{this},
-		_enumerator{this}, _largeCtx{false},
+		_enumerator{this}, _largeCtx{false}, _maxPsaSize{0},
 		_entity{std::move(entity)} {
 	auto doorbell_offset = _space.load(cap_regs::dboff);
 	_doorbells = _space.subspace(doorbell_offset);
@@ -126,6 +128,7 @@ async::detached Controller::initialize() {
 	std::cout << this << "Controller reset done" << std::endl;
 
 	_largeCtx = _space.load(cap_regs::hccparams1) & hccparams1::contextSize;
+	_maxPsaSize = _space.load(cap_regs::hccparams1) & hccparams1::maxPsaSize;
 
 	_maxDeviceSlots = _space.load(cap_regs::hcsparams1) & hcsparams1::maxDevSlots;
 	operational.store(op_regs::config, config::enabledDeviceSlots(_maxDeviceSlots));
@@ -339,7 +342,7 @@ void Controller::processEvent(Event ev) {
 
 		case transferEvent:
 			if (auto ep = _devices[ev.slotId]->endpoint(ev.endpointId))
-				ep->transferRing().processEvent(ev);
+				ep->processEvent(ev);
 			else
 				std::cout << this << "Event for missing endpoint ID " << ev.endpointId
 					<< " on slot " << ev.slotId << std::endl;
@@ -614,6 +617,8 @@ Device::useConfiguration(uint8_t index, uint8_t value) {
 		proto::PipeType dir;
 		int packetSize;
 		proto::EndpointType type;
+		uint8_t maxBurst = 0;
+		uint8_t maxStreams = 0;
 	};
 
 	std::vector<EndpointInfo> _eps = {};
@@ -628,6 +633,14 @@ Device::useConfiguration(uint8_t index, uint8_t value) {
 			valueByIndex = desc->configValue;
 		}
 
+		// The companion descriptor belongs to the preceding endpoint.
+		if(type == proto::descriptor_type::ssEndpointCompanion && !_eps.empty()) {
+			auto desc = (proto::SsEndpointCompanionDescriptor *)p;
+			_eps.back().maxBurst = desc->maxBurst;
+			if(_eps.back().type == proto::EndpointType::bulk)
+				_eps.back().maxStreams = desc->attributes & 0x1F;
+		}
+
 		if(type != proto::descriptor_type::endpoint)
 			return;
 		auto desc = (proto::EndpointDescriptor *)p;
@@ -656,7 +669,8 @@ Device::useConfiguration(uint8_t index, uint8_t value) {
 		std::cout << _controller << "Setting up " << (ep.dir == proto::PipeType::in ? "in" : "out")
 			<< " endpoint " << ep.pipe << " (max packet size: " << ep.packetSize << ")" << std::endl;
 
-		FRG_CO_TRY(co_await setupEndpoint(ep.pipe, ep.dir, ep.packetSize, ep.type));
+		FRG_CO_TRY(co_await setupEndpoint(ep.pipe, ep.dir, ep.packetSize, ep.type,
+				ep.maxBurst, ep.maxStreams));
 	}
 
 	arch::dma_object<proto::SetupPacket> setConfig{setupPool()};
@@ -678,9 +692,9 @@ Device::transfer(proto::ControlTransfer info) {
 	co_return co_await _endpoints[0]->transfer(info);
 }
 
-void Device::submit(int endpoint) {
+void Device::submit(int endpoint, uint16_t streamId) {
 	assert(_slotId != -1);
-	_controller->ringDoorbell(_slotId, endpoint);
+	_controller->ringDoorbell(_slotId, endpoint, streamId);
 }
 
 static inline uint8_t getHcdSpeedId(proto::DeviceSpeed speed) {
@@ -813,7 +827,8 @@ static inline uint32_t getDefaultAverageTrbLen(proto::EndpointType type) {
 
 
 async::result<frg::expected<proto::UsbError>>
-Device::setupEndpoint(int endpoint, proto::PipeType dir, size_t maxPacketSize, proto::EndpointType type) {
+Device::setupEndpoint(int endpoint, proto::PipeType dir, size_t maxPacketSize, proto::EndpointType type,
+		uint8_t maxBurst, uint8_t maxStreams) {
 	InputContext inputCtx{_controller->largeCtx(), _controller->memoryPool()};
 
 	inputCtx.get(inputCtxCtrl) |= InputControlFields::add(0); // Slot Context
@@ -822,7 +837,7 @@ Device::setupEndpoint(int endpoint, proto::PipeType dir, size_t maxPacketSize, p
 	inputCtx.get(inputCtxSlot) = _devCtx.get(deviceCtxSlot);
 	inputCtx.get(inputCtxSlot) |= SlotFields::ctxEntries(31);
 
-	_initEpCtx(inputCtx, endpoint, dir, maxPacketSize, type);
+	_initEpCtx(inputCtx, endpoint, dir, maxPacketSize, type, maxBurst, maxStreams);
 
 	_controller->barrier.writeback(inputCtx.rawData(), inputCtx.rawSize());
 	auto event = co_await _controller->submitCommand(
@@ -840,6 +855,45 @@ Device::setupEndpoint(int endpoint, proto::PipeType dir, size_t maxPacketSize, p
 	co_return frg::success;
 }
 
+async::result<frg::expected<proto::UsbError>>
+Device::configureStreams(int endpointId, uintptr_t streamContexts, uint8_t maxPStreams) {
+	InputContext inputCtx{_controller->largeCtx(), _controller->memoryPool()};
+
+	// Dropping and adding the endpoint in the same command reconfigures it.
+	inputCtx.get(inputCtxCtrl) |= InputControlFields::add(0); // Slot Context
+	inputCtx.get(inputCtxCtrl) |= InputControlFields::drop(endpointId);
+	inputCtx.get(inputCtxCtrl) |= InputControlFields::add(endpointId);
+
+	_controller->barrier.invalidate(_devCtx.rawData(), _devCtx.rawSize());
+	inputCtx.get(inputCtxSlot) = _devCtx.get(deviceCtxSlot);
+
+	auto &epCtx = inputCtx.get(inputCtxEp0 + endpointId - 1);
+	epCtx = _devCtx.get(deviceCtxEp0 + endpointId - 1);
+	epCtx &= ~EpFields::epState(0b111);
+	epCtx |= EpFields::maxPStreams(maxPStreams);
+	epCtx |= EpFields::linearStreamArray(true);
+
+	// The TR dequeue pointer now points to the stream context array.
+	// The dequeue cycle state is part of the stream contexts instead.
+	epCtx.val[2] = 0;
+	epCtx.val[3] = 0;
+	epCtx |= EpFields::trPointerLo(streamContexts);
+	epCtx |= EpFields::trPointerHi(streamContexts);
+
+	_controller->barrier.writeback(inputCtx.rawData(), inputCtx.rawSize());
+	auto event = co_await _controller->submitCommand(
+			Command::configureEndpoint(_slotId,
+				helix::ptrToPhysical(inputCtx.rawData())));
+
+	if (event.completionCode != 1)
+		std::cout << _controller << "Failed to configure streams for endpoint " << endpointId
+			<< ", completion code: " << completionCodeNames[event.completionCode] << std::endl;
+
+	FRG_CO_TRY(completionToError(event));
+
+	co_return frg::success;
+}
+
 async::result<frg::expected<proto::UsbError>>
 Device::configureHub(std::shared_ptr<proto::Hub> hub, proto::DeviceSpeed speed) {
 	InputContext inputCtx{_controller->largeCtx(), _controller->memoryPool()};
@@ -872,12 +926,13 @@ Device::configureHub(std::shared_ptr<proto::Hub> hub, proto::DeviceSpeed speed)
 	co_return frg::success;
 }
 
-void Device::_initEpCtx(InputContext &ctx, int endpoint, proto::PipeType dir, size_t maxPacketSize, proto::EndpointType type) {
+void Device::_initEpCtx(InputContext &ctx, int endpoint, proto::PipeType dir, size_t maxPacketSize, proto::EndpointType type,
+		uint8_t maxBurst, uint8_t maxStreams) {
 	int endpointId = getEndpointIndex(endpoint, dir);
 
 	ctx.get(inputCtxCtrl) |= InputControlFields::add(endpointId); // EP Context
 
-	auto ep = std::make_shared<EndpointState>(this, endpointId, type, maxPacketSize);
+	auto ep = std::make_shared<EndpointState>(this, endpointId, type, maxPacketSize, maxStreams);
 	_endpoints[endpointId - 1] = ep;
 
 	auto trPtr = ep->transferRing().getPtr();
@@ -890,6 +945,7 @@ void Device::_initEpCtx(InputContext &ctx, int endpoint, proto::PipeType dir, si
 	epCtx |= EpFields::interval(6);
 	epCtx |= EpFields::epType(getHcdEndpointType(dir, type));
 	epCtx |= EpFields::maxPacketSize(maxPacketSize);
+	epCtx |= EpFields::maxBurstSize(maxBurst);
 	// TODO(qookie): This is fine for USB 2 (unless max burst > 0),
 	// but for USB 3 this should use wBytesPerInterval from the SS
 	// endpoint companion descriptor.
@@ -996,7 +1052,7 @@ EndpointState::transfer(proto::ControlTransfer info) {
 		_device->controller()->barrier.invalidate(info.buffer);
 
 	if (!maybeResidue && maybeResidue.error() == proto::UsbError::stall) {
-		auto res = co_await _resetAfterError(nextDequeue, nextCycle);
+		auto res = co_await _resetAfterError(_transferRing, 0, nextDequeue, nextCycle);
 		if (!res) {
 			std::cout << _device->controller() << "Failed to reset EP " << _endpointId
 				<< " after stall: " << (int)res.error() << std::endl;
@@ -1007,22 +1063,27 @@ EndpointState::transfer(proto::ControlTransfer info) {
 }
 
 async::result<frg::expected<proto::UsbError, size_t>>
-EndpointState::_bulkOrInterruptXfer(arch::dma_buffer_view buffer, bool toHost) {
+EndpointState::_bulkOrInterruptXfer(arch::dma_buffer_view buffer, bool toHost, uint16_t streamId) {
+	// Once streams are allocated, every transfer needs to target a stream.
+	if (_streamRings.empty() ? streamId : (!streamId || streamId > _streamRings.size()))
+		co_return proto::UsbError::unsupported;
+	auto &ring = streamId ? *_streamRings[streamId - 1] : _transferRing;
+
 	ProducerRing::Transaction tx;
 
 	Transfer::buildNormalChain([&] (RawTrb trb) {
-		_transferRing.pushRawTrb(trb, &tx);
+		ring.pushRawTrb(trb, &tx);
 	}, buffer, _maxPacketSize);
 
-	size_t nextDequeue = _transferRing.enqueuePtr();
-	bool nextCycle = _transferRing.producerCycle();
+	size_t nextDequeue = ring.enqueuePtr();
+	bool nextCycle = ring.producerCycle();
 
 	if (toHost)
 		_device->controller()->barrier.clean_or_invalidate(buffer);
 	else
 		_device->controller()->barrier.writeback(buffer);
 
-	_device->submit(_endpointId);
+	_device->submit(_endpointId, streamId);
 
 	auto maybeResidue = co_await tx.normal();
 
@@ -1030,7 +1091,7 @@ EndpointState::_bulkOrInterruptXfer(arch::dma_buffer_view buffer, bool toHost) {
 		_device->controller()->barrier.invalidate(buffer);
 
 	if (!maybeResidue && maybeResidue.error() == proto::UsbError::stall) {
-		auto res = co_await _resetAfterError(nextDequeue, nextCycle);
+		auto res = co_await _resetAfterError(ring, streamId, nextDequeue, nextCycle);
 		if (!res) {
 			std::cout << _device->controller() << "Failed to reset EP " << _endpointId
 				<< " after stall: " << (int)res.error() << std::endl;
@@ -1047,11 +1108,111 @@ EndpointState::transfer(proto::InterruptTransfer info) {
 
 async::result<frg::expected<proto::UsbError, size_t>>
 EndpointState::transfer(proto::BulkTransfer info) {
-	co_return co_await _bulkOrInterruptXfer(info.buffer, info.flags == proto::kXferToHost);
+	co_return co_await _bulkOrInterruptXfer(info.buffer, info.flags == proto::kXferToHost,
+			info.streamId);
+}
+
+async::result<frg::expected<proto::UsbError, size_t>>
+EndpointState::allocateStreams(size_t numStreams) {
+	auto controller = _device->controller();
+	auto maxPrimaryStreams = controller->maxPrimaryStreams();
+	if (_type != proto::EndpointType::bulk || !_maxStreams || !maxPrimaryStreams || !numStreams)
+		co_return proto::UsbError::unsupported;
+	if (!_streamRings.empty())
+		co_return _streamRings.size();
+
+	// Stream ID 0 is reserved, hence the array needs one more entry than there are streams.
+	// The smallest array that the controller accepts has 4 entries.
+	numStreams = std::min({numStreams, size_t{1} << _maxStreams, maxPrimaryStreams - 1});
+	auto arraySize = std::max(std::bit_ceil(numStreams + 1), size_t{4});
+	assert(arraySize <= maxPrimaryStreams);
+
+	_streamContexts = arch::dma_array<StreamContext>{controller->memoryPool(), arraySize};
+	memset(_streamContexts.data(), 0, arraySize * sizeof(StreamContext));
+	for (size_t i = 0; i < numStreams; i++) {
+		auto ring = std::make_unique<ProducerRing>(controller);
+		_streamContexts[i + 1] = StreamFields::transferRing(ring->getPtr(), ring->producerCycle());
+		_streamRings.push_back(std::move(ring));
+	}
+	controller->barrier.writeback(_streamContexts.view_buffer());
+
+	auto maxPStreams = std::countr_zero(arraySize) - 1;
+	auto res = co_await _device->configureStreams(_endpointId,
+			helix::ptrToPhysical(_streamContexts.data()), maxPStreams);
+	if (!res) {
+		_streamRings.clear();
+		co_return res.error();
+	}
+
+	std::cout << controller << "Allocated " << numStreams << " streams for EP "
+		<< _endpointId << std::endl;
+	co_return numStreams;
+}
+
+async::result<frg::expected<proto::UsbError>>
+EndpointState::cancelStream(uint32_t streamId) {
+	if (!streamId || streamId > _streamRings.size())
+		co_return proto::UsbError::unsupported;
+	auto &ring = *_streamRings[streamId - 1];
+	if (!ring.hasPending())
+		co_return frg::success;
+
+	// Stopping the endpoint stops all of its streams. The TDs of other streams
+	// are resumed once we ring their doorbells again.
+	auto event = co_await _device->controller()->submitCommand(
+		Command::stopEndpoint(_device->slot(), _endpointId));
+
+	// A context state error means that the endpoint is already stopped or halted.
+	if (event.completionCode != 1 && event.completionCode != 19) {
+		std::cout << _device->controller() << "Failed to stop EP " << _endpointId
+			<< ", completion code: " << completionCodeNames[event.completionCode] << std::endl;
+		FRG_CO_TRY(completionToError(event));
+	}
+
+	ring.cancelPending();
+
+	// Issue the Set TR Dequeue Pointer command to skip the cancelled TDs.
+	auto dequeue = ring.getPtr() + ring.enqueuePtr() * sizeof(RawTrb);
+	dequeue |= StreamFields::sctPrimaryRing << 1;
+	event = co_await _device->controller()->submitCommand(
+		Command::setTransferRingDequeue(_device->slot(), _endpointId,
+				dequeue | ring.producerCycle(), streamId));
+
+	if (event.completionCode != 1) {
+		std::cout << _device->controller() << "Failed to set TR dequeue pointer"
+			<< ", completion code: " << completionCodeNames[event.completionCode] << std::endl;
+		FRG_CO_TRY(completionToError(event));
+	}
+
+	// Restart the endpoint for the streams that still have pending TDs.
+	for (size_t i = 0; i < _streamRings.size(); i++) {
+		if (_streamRings[i]->hasPending())
+			_device->submit(_endpointId, i + 1);
+	}
+
+	co_return frg::success;
+}
+
+void EndpointState::processEvent(Event ev) {
+	if (_streamRings.empty()) {
+		_transferRing.processEvent(ev);
+		return;
+	}
+
+	for (auto &ring : _streamRings) {
+		if (ring->contains(ev.trbPointer)) {
+			ring->processEvent(ev);
+			return;
+		}
+	}
+
+	std::cout << _device->controller() << "Event for unknown TRB on EP " << _endpointId
+		<< " of slot " << ev.slotId << std::endl;
+	ev.printInfo();
 }
 
 async::result<frg::expected<proto::UsbError>>
-EndpointState::_resetAfterError(size_t nextDequeue, bool cycle) {
+EndpointState::_resetAfterError(ProducerRing &ring, uint16_t streamId, size_t nextDequeue, bool cycle) {
 	// Issue the Reset Endpoint command to reset the xHC state
 	auto event = co_await _device->controller()->submitCommand(
 		Command::resetEndpoint(_device->slot(), _endpointId));
@@ -1083,10 +1244,12 @@ EndpointState::_resetAfterError(size_t nextDequeue, bool cycle) {
 
 	// Issue the Set TR Dequeue Pointer command to skip the failed
 	// transfer
-	auto dequeue = _transferRing.getPtr() + nextDequeue * sizeof(RawTrb);
+	auto dequeue = ring.getPtr() + nextDequeue * sizeof(RawTrb);
+	if (streamId)
+		dequeue |= StreamFields::sctPrimaryRing << 1;
 	event = co_await _device->controller()->submitCommand(
 		Command::setTransferRingDequeue(_device->slot(), _endpointId,
-				dequeue | cycle));
+				dequeue | cycle, streamId));
 
 	if (event.completionCode != 1)
 		std::cout << _device->controller() << "Failed to set TR dequeue pointer"
@@ -1095,7 +1258,7 @@ EndpointState::_resetAfterError(size_t nextDequeue, bool cycle) {
 	FRG_CO_TRY(completionToError(event));
 
 	// Ring the doorbell to restart the pipe
-	_device->submit(_endpointId);
+	_device->submit(_endpointId, streamId);
 
 	co_return frg::success;
 }
@@ -210,6 +210,10 @@ uintptr_t ProducerRing::getPtr() {
 	return helix::ptrToPhysical(_ring.data());
 }
 
+bool ProducerRing::contains(uintptr_t ptr) {
+	return ptr >= getPtr() && ptr < getPtr() + ringSize * sizeof(RawTrb);
+}
+
 void ProducerRing::pushRawTrb(RawTrb cmd, Transaction *tx) {
 	_ring->ent[_enqueuePtr] = cmd;
 	_transactions[_enqueuePtr] = tx;
@@ -238,6 +242,13 @@ void ProducerRing::processEvent(Event ev) {
 	size_t idx = (ev.trbPointer - getPtr()) / sizeof(RawTrb);
 	assert(idx < ringSize);
 
+	// Stopping an endpoint (see EndpointState::cancelStream()) reports the TD that the xHC
+	// was working on as stopped. That TD is resumed once the endpoint is restarted,
+	// unless it is cancelled through cancelPending().
+	if (ev.type == TrbType::transferEvent
+			&& ev.completionCode >= 26 && ev.completionCode <= 28)
+		return;
+
 	auto tx = std::exchange(_transactions[idx], nullptr);
 
 	if (tx) {
@@ -245,6 +256,35 @@ void ProducerRing::processEvent(Event ev) {
 	}
 }
 
+bool ProducerRing::hasPending() const {
+	for (auto tx : _transactions) {
+		if (tx)
+			return true;
+	}
+	return false;
+}
+
+void ProducerRing::cancelPending() {
+	Event ev{};
+	ev.type = TrbType::transferEvent;
+	ev.completionCode = 26;
+
+	for (size_t i = 0; i < ringSize; i++) {
+		auto tx = std::exchange(_transactions[i], nullptr);
+		if (!tx)
+			continue;
+
+		// TDs that consist of multiple TRBs occupy multiple entries;
+		// only complete each transaction once.
+		for (size_t j = i + 1; j < ringSize; j++) {
+			if (_transactions[j] == tx)
+				_transactions[j] = nullptr;
+		}
+
+		tx->onEvent(_controller, ev, _ring->ent[i]);
+	}
+}
+
 void ProducerRing::updateLink() {
 	_ring->ent[ringSize - 1] = {{
 		static_cast<uint32_t>(getPtr() & 0xFFFFFFFF),
@@ -319,8 +359,9 @@ void ProducerRing::Transaction::onEvent(Controller *controller, Event event, Raw
 	if (event.completionCode != 1) {
 		auto associatedTrbType = static_cast<TrbType>((associatedTrb.val[3] >> 10) & 63);
 
-		// Ignore short packet completions for transfers
-		if (event.type == TrbType::transferEvent && event.completionCode != 13) {
+		// Ignore short packet completions and cancelled (i.e., stopped) TDs for transfers
+		if (event.type == TrbType::transferEvent
+				&& event.completionCode != 13 && event.completionCode != 26) {
 			std::cout << controller << "Transfer TRB '" << trbTypeNames[static_cast<int>(associatedTrbType)] << "'"
 				<< " completed with '" << completionCodeNames[event.completionCode] << "'"
 				<< " (Slot " << event.slotId << ", EP " << event.endpointId << ")" << std::endl;
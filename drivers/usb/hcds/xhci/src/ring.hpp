@@ -54,6 +54,8 @@ inline frg::expected<protocols::usb::UsbError> completionToError(Event ev) {
 		case 3: return UsbError::babble;
 		case 6: return UsbError::stall;
 		case 22: return UsbError::unsupported;
+		// Stopped; reported for TDs that are cancelled (see ProducerRing::cancelPending()).
+		case 26: return UsbError::cancelled;
 		default: return UsbError::other;
 	}
 }
@@ -126,6 +128,7 @@ struct ProducerRing {
 
 	ProducerRing(Controller *controller);
 	uintptr_t getPtr();
+	bool contains(uintptr_t ptr);
 	size_t enqueuePtr() const { return _enqueuePtr; }
 	bool producerCycle() const { return _pcs; }
 
@@ -133,6 +136,13 @@ struct ProducerRing {
 
 	void processEvent(Event ev);
 
+	// Returns true if some TD on the ring did not complete yet.
+	bool hasPending() const;
+
+	// Completes all pending TDs as cancelled. The endpoint must be stopped and
+	// the caller must move the dequeue pointer of the xHC past the TDs.
+	void cancelPending();
+
 private:
 	std::array<Transaction *, ringSize> _transactions;
 	arch::dma_object<RingEntries> _ring;
@@ -101,6 +101,14 @@ namespace Command {
 		};
 	}
 
+	constexpr RawTrb stopEndpoint(uint8_t slotId, uint8_t endpointId) {
+		return RawTrb{
+			0, 0, 0,
+			(uint32_t{slotId} << 24) | (uint32_t{endpointId} << 16)
+			| (static_cast<uint32_t>(TrbType::stopEndpointCommand) << 10)
+		};
+	}
+
 	constexpr RawTrb resetEndpoint(uint8_t slotId, uint8_t endpointId) {
 		return RawTrb{
 			0, 0, 0,
@@ -109,10 +117,13 @@ namespace Command {
 		};
 	}
 
-	constexpr RawTrb setTransferRingDequeue(uint8_t slotId, uint8_t endpointId, uintptr_t dequeue) {
+	// For endpoints with streams, dequeue also contains the stream context type.
+	constexpr RawTrb setTransferRingDequeue(uint8_t slotId, uint8_t endpointId, uintptr_t dequeue,
+			uint16_t streamId = 0) {
 		return RawTrb{
 			static_cast<uint32_t>(dequeue & 0xFFFFFFFF),
-			static_cast<uint32_t>(dequeue >> 32), 0,
+			static_cast<uint32_t>(dequeue >> 32),
+			uint32_t{streamId} << 16,
 			(uint32_t{slotId} << 24) | (uint32_t{endpointId} << 16)
 			| (static_cast<uint32_t>(TrbType::setTrDequeuePtrCommand) << 10)
 		};
@@ -122,7 +122,7 @@ struct Device final : proto::DeviceData, std::enable_shared_from_this<Device> {
 	transfer(proto::ControlTransfer info) override;
 
 
-	void submit(int endpoint);
+	void submit(int endpoint, uint16_t streamId = 0);
 
 	async::result<frg::expected<proto::UsbError>>
 	enumerate(size_t rootPort, size_t port, uint32_t route, std::shared_ptr<proto::Hub> hub, proto::DeviceSpeed speed, int slotType);
@@ -131,7 +131,12 @@ struct Device final : proto::DeviceData, std::enable_shared_from_this<Device> {
 	readDescriptor(arch::dma_buffer_view dest, uint16_t desc);
 
 	async::result<frg::expected<proto::UsbError>>
-	setupEndpoint(int endpoint, proto::PipeType dir, size_t maxPacketSize, proto::EndpointType type);
+	setupEndpoint(int endpoint, proto::PipeType dir, size_t maxPacketSize, proto::EndpointType type,
+			uint8_t maxBurst = 0, uint8_t maxStreams = 0);
+
+	// Reconfigures the endpoint to use the given stream context array.
+	async::result<frg::expected<proto::UsbError>>
+	configureStreams(int endpointId, uintptr_t streamContexts, uint8_t maxPStreams);
 
 	async::result<frg::expected<proto::UsbError>>
 	configureHub(std::shared_ptr<proto::Hub> hub, proto::DeviceSpeed speed);
@@ -159,7 +164,8 @@ private:
 
 	DeviceContext _devCtx;
 
-	void _initEpCtx(InputContext &ctx, int endpoint, proto::PipeType dir, size_t maxPacketSize, proto::EndpointType type);
+	void _initEpCtx(InputContext &ctx, int endpoint, proto::PipeType dir, size_t maxPacketSize, proto::EndpointType type,
+			uint8_t maxBurst = 0, uint8_t maxStreams = 0);
 
 	std::array<std::shared_ptr<EndpointState>, 31> _endpoints;
 };
@@ -168,9 +174,10 @@ private:
 struct EndpointState final : proto::EndpointData {
 	friend struct Device;
 
-	explicit EndpointState(Device *device, int endpointId, proto::EndpointType type, size_t maxPacketSize)
+	explicit EndpointState(Device *device, int endpointId, proto::EndpointType type, size_t maxPacketSize,
+			uint8_t maxStreams = 0)
 	: _device{device}, _endpointId{endpointId}, _type{type},
-		_maxPacketSize{maxPacketSize}, _transferRing{device->controller()} { }
+		_maxPacketSize{maxPacketSize}, _maxStreams{maxStreams}, _transferRing{device->controller()} { }
 
 	async::result<frg::expected<proto::UsbError, size_t>>
 	transfer(proto::ControlTransfer info) override;
@@ -181,23 +188,39 @@ struct EndpointState final : proto::EndpointData {
 	async::result<frg::expected<proto::UsbError, size_t>>
 	transfer(proto::BulkTransfer info) override;
 
+	async::result<frg::expected<proto::UsbError, size_t>>
+	allocateStreams(size_t numStreams) override;
+
+	async::result<frg::expected<proto::UsbError>>
+	cancelStream(uint32_t streamId) override;
+
 	ProducerRing &transferRing() {
 		return _transferRing;
 	}
 
+	// Dispatches a transfer event to the ring that contains its TRB.
+	void processEvent(Event ev);
+
 private:
 	Device *_device;
 	int _endpointId;
 	proto::EndpointType _type;
 
 	size_t _maxPacketSize;
+	// log2 of the number of streams that the device supports (zero if it does not support streams).
+	uint8_t _maxStreams;
 	ProducerRing _transferRing;
 
+	// If streams are allocated, each stream has its own ring and _transferRing is unused.
+	// The ring of stream ID n is at index n - 1.
+	arch::dma_array<StreamContext> _streamContexts;
+	std::vector<std::unique_ptr<ProducerRing>> _streamRings;
+
 	async::result<frg::expected<proto::UsbError, size_t>>
-	_bulkOrInterruptXfer(arch::dma_buffer_view buffer, bool toHost);
+	_bulkOrInterruptXfer(arch::dma_buffer_view buffer, bool toHost, uint16_t streamId = 0);
 
 	async::result<frg::expected<proto::UsbError>>
-	_resetAfterError(size_t nextDequeue, bool nextCycle);
+	_resetAfterError(ProducerRing &ring, uint16_t streamId, size_t nextDequeue, bool nextCycle);
 };
 
 
@@ -266,6 +289,11 @@ struct Controller final : proto::BaseController {
 		return _largeCtx;
 	}
 
+	// Maximum size of a primary stream context array (zero if streams are not supported).
+	size_t maxPrimaryStreams() const {
+		return _maxPsaSize ? size_t{1} << (_maxPsaSize + 1) : 0;
+	}
+
 	void setDeviceContext(size_t slot, DeviceContext &ctx) {
 		_dcbaa[slot] = helix::ptrToPhysical(ctx.rawData());
 		barrier.writeback(_dcbaa.view_buffer());
@@ -407,6 +435,7 @@ private:
 	proto::Enumerator _enumerator;
 
 	bool _largeCtx;
+	uint8_t _maxPsaSize;
 
 	mbus_ng::Entity _entity;
 };
@@ -271,6 +271,12 @@ extern inline __attribute__ (( always_inline )) HelError helLoadahead(HelHandle
 	return helSyscall3(kHelCallLoadahead, (HelWord)handle, (HelWord)offset, (HelWord)length);
 };
 
+extern inline __attribute__ (( always_inline )) HelError helSubmitWritebackFence(HelHandle handle,
+		uintptr_t offset, size_t length, HelHandle queue, uintptr_t context) {
+	return helSyscall5(kHelCallSubmitWritebackFence, (HelWord)handle, (HelWord)offset,
+			(HelWord)length, (HelWord)queue, (HelWord)context);
+};
+
 extern inline __attribute__ (( always_inline )) HelError helCreateThread(HelHandle universe,
 		HelHandle address_space, HelAbi abi, void *ip, void *sp, uint32_t flags,
 		HelHandle *handle) {
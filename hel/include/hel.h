@@ -18,7 +18,7 @@
 
 enum {
 	// largest system call number plus 1
-	kHelNumCalls = 105,
+	kHelNumCalls = 106,
 
 	kHelCallLog = 1,
 	kHelCallPanic = 10,
@@ -57,6 +57,7 @@ enum {
 	kHelCallUpdateMemory = 47,
 	kHelCallSubmitLockMemoryView = 48,
 	kHelCallLoadahead = 49,
+	kHelCallSubmitWritebackFence = 105,
 	kHelCallCreateVirtualizedSpace = 50,
 
 	kHelCallCreateThread = 67,
@@ -827,7 +828,9 @@ HEL_C_LINKAGE HelError helSubmitProtectMemory(HelHandle spaceHandle,
 //!
 //! This system call returns after the kernel has scanned all specified pages
 //! and determined whether they are dirty
-//! or not. It does *not* wait until the pages are clean again.
+//! or not. It does *not* wait until the pages are clean again
+//! (see ::helSubmitWritebackFence).
+//! Completes with ::kHelErrFault if part of the range is not mapped.
 //!
 //! This is an asynchronous operation.
 //! @param[in] spaceHandle
@@ -909,6 +912,23 @@ HEL_C_LINKAGE HelError helSubmitLockMemoryView(HelHandle handle, uintptr_t offse
 //!     Length of the memory range that is preloaded.
 HEL_C_LINKAGE HelError helLoadahead(HelHandle handle, uintptr_t offset, size_t length);
 
+//! Waits until a range of memory is clean.
+//!
+//! Completes once no page in the range is dirty or under writeback anymore.
+//! Together with ::helSubmitSynchronizeSpace, this can be used to implement fsync().
+//!
+//! This is an asynchronous operation.
+//! @param[in] handle
+//!     Handle to the memory object.
+//! @param[in] offset
+//!     Offset in bytes, relative to @p handle.
+//!    	Must be aligned to the system's page size.
+//! @param[in] length
+//!     Length of the memory range.
+//!    	Must be aligned to the system's page size.
+HEL_C_LINKAGE HelError helSubmitWritebackFence(HelHandle handle, uintptr_t offset, size_t length,
+		HelHandle queue, uintptr_t context);
+
 HEL_C_LINKAGE HelError helCreateVirtualizedSpace(HelHandle *handle);
 
 //! @}
@@ -873,6 +873,67 @@ inline auto writeMemory(BorrowedDescriptor descriptor,
 	return WriteMemorySender{descriptor, address, length, buffer};
 }
 
+// --------------------------------------------------------------------
+// WritebackFence
+// --------------------------------------------------------------------
+
+template <typename Receiver>
+struct WritebackFenceOperation : private Context {
+	WritebackFenceOperation(BorrowedDescriptor memory,
+			uintptr_t offset, size_t length, Receiver r)
+	: memory_{std::move(memory)}, offset_{offset}, length_{length}, r_{std::move(r)} { }
+
+	void start() {
+		auto context = static_cast<Context *>(this);
+		HEL_CHECK(helSubmitWritebackFence(memory_.getHandle(),
+				offset_, length_,
+				Dispatcher::global().acquire(),
+				reinterpret_cast<uintptr_t>(context)));
+	}
+
+	WritebackFenceOperation(const WritebackFenceOperation &) = delete;
+	WritebackFenceOperation &operator= (const WritebackFenceOperation &) = delete;
+
+private:
+	void complete(ElementHandle element) override {
+		SynchronizeSpaceResult result;
+		void *ptr = element.data();
+		result.parse(ptr, element);
+		async::execution::set_value_noinline(r_, std::move(result));
+	}
+
+	BorrowedDescriptor memory_;
+	uintptr_t offset_;
+	size_t length_;
+	Receiver r_;
+};
+
+struct [[nodiscard]] WritebackFenceSender {
+	using value_type = SynchronizeSpaceResult;
+
+	WritebackFenceSender(BorrowedDescriptor memory, uintptr_t offset, size_t length)
+	: memory_{std::move(memory)}, offset_{offset}, length_{length} { }
+
+	template<typename Receiver>
+	WritebackFenceOperation<Receiver> connect(Receiver receiver) {
+		return {std::move(memory_), offset_, length_, std::move(receiver)};
+	}
+
+private:
+	BorrowedDescriptor memory_;
+	uintptr_t offset_;
+	size_t length_;
+};
+
+inline async::sender_awaiter<WritebackFenceSender, SynchronizeSpaceResult>
+operator co_await (WritebackFenceSender sender) {
+	return {std::move(sender)};
+}
+
+inline auto writebackFence(BorrowedDescriptor memory, uintptr_t offset, size_t length) {
+	return WritebackFenceSender{std::move(memory), offset, length};
+}
+
 // --------------------------------------------------------------------
 // AwaitEvent
 // --------------------------------------------------------------------
@@ -602,6 +602,7 @@ VirtualSpace::synchronize(VirtualAddr address, size_t size) {
 	auto alignedSize = (size + misalign + kPageSize - 1) & ~(kPageSize - 1);
 
 	size_t overallProgress = 0;
+	bool unmapped = false;
 	while(overallProgress < alignedSize) {
 		smarter::shared_ptr<Mapping> mapping;
 		{
@@ -610,7 +611,12 @@ VirtualSpace::synchronize(VirtualAddr address, size_t size) {
 
 			mapping = _findMapping(alignedAddress + overallProgress);
 		}
-		assert(mapping);
+		// The range may have been unmapped concurrently. We still need to shoot down
+		// the pages that were already cleaned.
+		if(!mapping) {
+			unmapped = true;
+			break;
+		}
 
 		auto mappingOffset = alignedAddress + overallProgress - mapping->address;
 		auto mappingChunk = frg::min(alignedSize - overallProgress,
@@ -626,6 +632,8 @@ VirtualSpace::synchronize(VirtualAddr address, size_t size) {
 	}
 	co_await _ops->shootdown(alignedAddress, alignedSize);
 
+	if(unmapped)
+		co_return Error::fault;
 	co_return {};
 }
 
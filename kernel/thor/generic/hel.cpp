@@ -1096,10 +1096,9 @@ HelError helSubmitSynchronizeSpace(HelHandle spaceHandle, void *pointer, size_t
 			smarter::shared_ptr<IpcQueue> queue, uintptr_t context,
 			enable_detached_coroutine = {}) -> void {
 		auto outcome = co_await space->synchronize((VirtualAddr)pointer, length);
-		// TODO: handle errors after propagating them through VirtualSpace::synchronize.
-		assert(outcome);
 
-		HelSimpleResult helResult{.error = kHelErrNone, .reserved = {}};
+		HelSimpleResult helResult{.error = translateError(outcome ? Error::success : outcome.error()),
+				.reserved = {}};
 		QueueSource ipcSource{&helResult, sizeof(HelSimpleResult), nullptr};
 		co_await queue->submit(&ipcSource, context);
 	}(std::move(space), pointer, length, std::move(queue), context);
@@ -1596,7 +1595,8 @@ HelError helSubmitLockMemoryView(HelHandle handle, uintptr_t offset, size_t size
 }
 
 HelError helLoadahead(HelHandle handle, uintptr_t offset, size_t length) {
-	assert(offset % kPageSize == 0 && length % kPageSize == 0);
+	if(offset % kPageSize || length % kPageSize)
+		return kHelErrIllegalArgs;
 
 	auto this_thread = getCurrentThread();
 	auto this_universe = this_thread->getUniverse();
@@ -1614,12 +1614,53 @@ HelError helLoadahead(HelHandle handle, uintptr_t offset, size_t length) {
 		memory = memory_wrapper->get<MemoryViewDescriptor>().memory;
 	}
 
-/*	auto handle_load = smarter::allocate_shared<AsyncInitiateLoad>(*kernelAlloc,
-			NullCompleter(), offset, length);
+	auto error = memory->loadahead(offset, length);
+	assert(error == Error::success);
+	return kHelErrNone;
+}
+
+HelError helSubmitWritebackFence(HelHandle handle, uintptr_t offset, size_t length,
+		HelHandle queueHandle, uintptr_t context) {
+	if(offset % kPageSize || length % kPageSize)
+		return kHelErrIllegalArgs;
+
+	auto thisThread = getCurrentThread();
+	auto thisUniverse = thisThread->getUniverse();
+
+	smarter::shared_ptr<MemoryView> memory;
+	smarter::shared_ptr<IpcQueue> queue;
 	{
-		// TODO: protect memory object with a guard
-		memory->submitInitiateLoad(std::move(handle_load));
-	}*/
+		auto irqLock = frg::guard(&irqMutex());
+		Universe::Guard universeGuard(thisUniverse->lock);
+
+		auto memoryWrapper = thisUniverse->getDescriptor(universeGuard, handle);
+		if(!memoryWrapper)
+			return kHelErrNoDescriptor;
+		if(!memoryWrapper->is<MemoryViewDescriptor>())
+			return kHelErrBadDescriptor;
+		memory = memoryWrapper->get<MemoryViewDescriptor>().memory;
+
+		auto queueWrapper = thisUniverse->getDescriptor(universeGuard, queueHandle);
+		if(!queueWrapper)
+			return kHelErrNoDescriptor;
+		if(!queueWrapper->is<QueueDescriptor>())
+			return kHelErrBadDescriptor;
+		queue = queueWrapper->get<QueueDescriptor>().queue;
+	}
+
+	if(!queue->validSize(ipcSourceSize(sizeof(HelSimpleResult))))
+		return kHelErrQueueTooSmall;
+
+	[] (smarter::shared_ptr<MemoryView> memory, uintptr_t offset, size_t length,
+			smarter::shared_ptr<IpcQueue> queue, uintptr_t context,
+			enable_detached_coroutine = {}) -> void {
+		auto outcome = co_await memory->waitForWriteback(offset, length);
+
+		HelSimpleResult helResult{.error = translateError(outcome ? Error::success : outcome.error()),
+				.reserved = {}};
+		QueueSource ipcSource{&helResult, sizeof(HelSimpleResult), nullptr};
+		co_await queue->submit(&ipcSource, context);
+	}(std::move(memory), offset, length, std::move(queue), context);
 
 	return kHelErrNone;
 }
@@ -721,6 +721,10 @@ void handleSyscall(SyscallImageAccessor image) {
 	case kHelCallLoadahead: {
 		*image.error() = helLoadahead((HelHandle)arg0, (uintptr_t)arg1, (size_t)arg2);
 	} break;
+	case kHelCallSubmitWritebackFence: {
+		*image.error() = helSubmitWritebackFence((HelHandle)arg0, (uintptr_t)arg1, (size_t)arg2,
+				(HelHandle)arg3, (uintptr_t)arg4);
+	} break;
 	case kHelCallCreateVirtualizedSpace: {
 		HelHandle handle;
 		*image.error() = helCreateVirtualizedSpace(&handle);
@@ -342,6 +342,16 @@ MemoryView::touchRange(uintptr_t offset, size_t size,
 	co_return {};
 }
 
+Error MemoryView::loadahead(uintptr_t, size_t) {
+	// Loadahead is only a hint; views that cannot benefit from it ignore it.
+	return Error::success;
+}
+
+coroutine<frg::expected<Error>> MemoryView::waitForWriteback(uintptr_t, size_t) {
+	// Views that are not backed by user space never need writeback.
+	co_return {};
+}
+
 Error MemoryView::updateRange(ManageRequest, size_t, size_t) {
 	return Error::illegalObject;
 }
@@ -947,11 +957,31 @@ void ManagedSpace::_progressMonitors(MonitorList &pending) {
 		return true;
 	};
 
+	auto progressWriteback = [&] (MonitorNode *node) -> bool {
+		while(node->progress < node->length) {
+			size_t index = (node->offset + node->progress) >> kPageShift;
+			// Pages that were never loaded cannot be dirty.
+			auto pit = pages.find(index);
+			if(pit && (pit->loadState == kStateWantWriteback
+					|| pit->loadState == kStateWriteback
+					|| pit->loadState == kStateAnotherWriteback))
+				return false;
+			node->progress += kPageSize;
+		}
+		return true;
+	};
+
 	for(auto it = _monitorQueue.begin(); it != _monitorQueue.end(); ) {
 		auto it_copy = it;
 		auto node = *it++;
-		assert(node->type == ManageRequest::initialize);
-		if(progressNode(node)) {
+		bool done;
+		if(node->type == ManageRequest::initialize) {
+			done = progressNode(node);
+		}else{
+			assert(node->type == ManageRequest::writeback);
+			done = progressWriteback(node);
+		}
+		if(done) {
 			_monitorQueue.erase(it_copy);
 			node->setup(Error::success);
 			pending.push_back(node);
@@ -1277,6 +1307,65 @@ FrontalMemory::fetchRange(uintptr_t offset, FetchFlags flags, smarter::shared_pt
 	co_return PhysicalRange{physical + misalign, kPageSize - misalign, CachingMode::null};
 }
 
+Error FrontalMemory::loadahead(uintptr_t offset, size_t size) {
+	assert(!(offset % kPageSize));
+	assert(!(size % kPageSize));
+
+	ManageList pendingManagement;
+	{
+		auto irq_lock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_managed->mutex);
+
+		// Queue all missing pages at once such that they are fused into
+		// as few management requests as possible.
+		// Pages beyond the end of the space are silently ignored.
+		for(size_t pg = 0; pg < size; pg += kPageSize) {
+			auto index = (offset + pg) >> kPageShift;
+			if(index >= _managed->numPages)
+				break;
+			auto [pit, wasInserted] = _managed->pages.find_or_insert(index, _managed.get(), index);
+			assert(pit);
+			if(pit->loadState == ManagedSpace::kStateMissing) {
+				pit->loadState = ManagedSpace::kStateWantInitialization;
+				_managed->_initializationList.push_back(&pit->cachePage);
+			}
+		}
+
+		_managed->_progressManagement(pendingManagement);
+	}
+
+	while(!pendingManagement.empty()) {
+		auto node = pendingManagement.pop_front();
+		node->complete();
+	}
+
+	return Error::success;
+}
+
+coroutine<frg::expected<Error>> FrontalMemory::waitForWriteback(uintptr_t offset, size_t size) {
+	assert(!(offset % kPageSize));
+	assert(!(size % kPageSize));
+
+	MonitorNode node;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_managed->mutex);
+
+		// Pages beyond the end of the space are silently ignored.
+		auto limit = _managed->numPages << kPageShift;
+		if(offset >= limit)
+			co_return {};
+		size = frg::min(size, limit - offset);
+	}
+
+	node.setup(ManageRequest::writeback, offset, size);
+	_managed->submitMonitor(&node);
+	co_await node.event.wait();
+	if(node.error() != Error::success)
+		co_return node.error();
+	co_return {};
+}
+
 void FrontalMemory::markDirty(uintptr_t offset, size_t size) {
 	assert(!(offset % kPageSize));
 	assert(!(size % kPageSize));
@@ -319,6 +319,16 @@ public:
 	// Marks a range of pages as dirty.
 	virtual void markDirty(uintptr_t offset, size_t size) = 0;
 
+	// Hints that a range of memory will be accessed soon.
+	// Starts to make the range available but does not wait for it.
+	virtual Error loadahead(uintptr_t offset, size_t size);
+
+	// Completes once every page in the range was observed to be neither dirty nor under
+	// writeback at some point after the call, i.e., once the writes that happened before
+	// the call are written back. Pages are checked in order and progress is monotonic:
+	// pages that are dirtied again after they were observed clean do not delay completion.
+	virtual coroutine<frg::expected<Error>> waitForWriteback(uintptr_t offset, size_t size);
+
 	virtual void submitManage(ManageNode *handle);
 
 	// Called (e.g. by user space) to update a range after loading or writeback.
@@ -979,6 +989,8 @@ public:
 			fetchRange(uintptr_t offset, FetchFlags flags,
 			smarter::shared_ptr<WorkQueue> wq) override;
 	void markDirty(uintptr_t offset, size_t size) override;
+	Error loadahead(uintptr_t offset, size_t size) override;
+	coroutine<frg::expected<Error>> waitForWriteback(uintptr_t offset, size_t size) override;
 
 	coroutine<frg::expected<Error, PhysicalAddr>> takeGlobalFutex(uintptr_t offset,
 			smarter::shared_ptr<WorkQueue> wq) override;
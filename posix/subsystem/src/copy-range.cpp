@@ -0,0 +1,220 @@
+#include <algorithm>
+#include <print>
+
+#include <helix/ipc.hpp>
+#include <helix/memory.hpp>
+
+#include "copy-range.hpp"
+#include "fs.hpp"
+
+namespace copy_range {
+
+namespace {
+
+bool logCopies = false;
+
+constexpr size_t pageSize = 0x1000;
+
+// Size of the intermediate buffer for files that are not backed by a page cache.
+constexpr size_t bufferSize = 0x10000;
+
+async::result<frg::expected<Error, size_t>>
+writeChunk(Process *process, File *out, std::optional<int64_t> &outOffset,
+		const void *data, size_t length) {
+	if(!outOffset)
+		co_return co_await out->writeAll(process, data, length);
+
+	auto result = co_await out->pwrite(process, *outOffset, data, length);
+	if(!result)
+		co_return result.error();
+	*outOffset += result.value();
+	co_return result.value();
+}
+
+async::result<frg::expected<Error, size_t>>
+copyFromPageCache(Process *process, File *in, int64_t offset,
+		File *out, std::optional<int64_t> &outOffset, size_t length) {
+	auto stats = co_await in->associatedLink()->getTarget()->getStats();
+	if(!stats)
+		co_return stats.error();
+	auto fileSize = stats.value().fileSize;
+	if(static_cast<uint64_t>(offset) >= fileSize)
+		co_return size_t{0};
+	length = std::min(length, static_cast<size_t>(fileSize - offset));
+
+	auto memory = co_await in->accessMemory();
+
+	// Let the server of out read the page cache directly (e.g., the fs server
+	// writes it to its own page cache and netserver enqueues it to a socket).
+	auto direct = co_await out->copyFromMemory(memory, offset, outOffset, length);
+	if(direct) {
+		if(outOffset)
+			*outOffset += direct.value();
+		if(logCopies)
+			std::println("posix: Server copied {} bytes from page cache", direct.value());
+		co_return direct.value();
+	}
+	if(direct.error() != Error::illegalOperationTarget)
+		co_return direct.error();
+
+	size_t progress = 0;
+	while(progress < length) {
+		size_t chunk = std::min(windowSize - ((offset + progress) & (pageSize - 1)),
+				length - progress);
+
+		auto window = co_await lockWindow(memory, offset + progress, chunk, kHelMapProtRead);
+		if(!window) {
+			if(progress)
+				break;
+			co_return window.error();
+		}
+		auto data = window.value().data();
+
+		auto result = co_await writeChunk(process, out, outOffset, data, chunk);
+		if(!result) {
+			if(progress)
+				break;
+			co_return result.error();
+		}
+		progress += result.value();
+		if(result.value() < chunk)
+			break;
+	}
+
+	if(logCopies)
+		std::println("posix: Copied {} bytes from page cache", progress);
+	co_return progress;
+}
+
+async::result<frg::expected<Error, size_t>>
+copyThroughBuffer(Process *process, File *in, std::optional<int64_t> inOffset,
+		File *out, std::optional<int64_t> &outOffset, size_t length) {
+	std::vector<std::byte> buffer(std::min(length, bufferSize));
+
+	size_t progress = 0;
+	while(progress < length) {
+		size_t chunk = std::min(buffer.size(), length - progress);
+
+		std::expected<size_t, Error> readResult;
+		if(inOffset)
+			readResult = co_await in->pread(process, *inOffset + progress, buffer.data(), chunk);
+		else
+			readResult = co_await in->readSome(process, buffer.data(), chunk, {});
+		if(!readResult) {
+			if(readResult.error() == Error::eof || progress)
+				break;
+			co_return readResult.error();
+		}
+		if(!readResult.value())
+			break;
+
+		auto writeResult = co_await writeChunk(process, out, outOffset,
+				buffer.data(), readResult.value());
+		if(!writeResult) {
+			if(progress)
+				break;
+			co_return writeResult.error();
+		}
+		progress += writeResult.value();
+
+		// Do not block on sources that only return partial data.
+		if(writeResult.value() < readResult.value() || readResult.value() < chunk)
+			break;
+	}
+	co_return progress;
+}
+
+bool isRegular(File *file) {
+	auto link = file->associatedLink();
+	return link && link->getTarget()->getType() == VfsType::regular;
+}
+
+} // anonymous namespace
+
+async::result<frg::expected<Error, PageCacheWindow>>
+lockWindow(helix::BorrowedDescriptor memory, int64_t offset, size_t length,
+		uint32_t protection) {
+	size_t windowOffset = offset & ~(pageSize - 1);
+	size_t windowLength = ((offset + length + pageSize - 1) & ~(pageSize - 1)) - windowOffset;
+	assert(windowLength <= windowSize);
+
+	// Lock the pages before touching them. Otherwise, we would take page faults
+	// (that need to be resolved by the fs server) while accessing the mapping.
+	helix::LockMemoryView lockMemory;
+	auto &&submit = helix::submitLockMemoryView(memory, &lockMemory,
+			windowOffset, windowLength, helix::Dispatcher::global());
+	co_await submit.async_wait();
+	if(lockMemory.error())
+		co_return Error::ioError;
+
+	PageCacheWindow window;
+	window.lock = lockMemory.descriptor();
+	window.mapping = helix::Mapping{memory, static_cast<ptrdiff_t>(windowOffset),
+			windowLength, protection};
+	window.misalign = offset - windowOffset;
+	co_return std::move(window);
+}
+
+async::result<frg::expected<Error, size_t>>
+sendfile(Process *process, SharedFilePtr in, std::optional<int64_t> inOffset,
+		SharedFilePtr out, std::optional<int64_t> outOffset, size_t length) {
+	if(!length)
+		co_return size_t{0};
+
+	if(!in->isPageCacheBacked())
+		co_return co_await copyThroughBuffer(process, in.get(), inOffset,
+				out.get(), outOffset, length);
+
+	int64_t offset;
+	if(inOffset) {
+		offset = *inOffset;
+	}else{
+		auto position = co_await in->seek(0, VfsSeek::relative);
+		if(!position)
+			co_return position.error();
+		offset = position.value();
+	}
+
+	auto result = co_await copyFromPageCache(process, in.get(), offset,
+			out.get(), outOffset, length);
+	if(result && result.value() && !inOffset) {
+		auto position = co_await in->seek(offset + result.value(), VfsSeek::absolute);
+		if(!position)
+			co_return position.error();
+	}
+	co_return result;
+}
+
+async::result<frg::expected<Error, size_t>>
+copyFileRange(Process *process, SharedFilePtr in, std::optional<int64_t> inOffset,
+		SharedFilePtr out, std::optional<int64_t> outOffset, size_t length) {
+	if(!isRegular(in.get()) || !isRegular(out.get()))
+		co_return Error::illegalArguments;
+
+	// Linux rejects overlapping copies within the same file.
+	if(in->associatedLink()->getTarget() == out->associatedLink()->getTarget()) {
+		auto inPosition = inOffset;
+		if(!inPosition) {
+			auto position = co_await in->seek(0, VfsSeek::relative);
+			if(!position)
+				co_return position.error();
+			inPosition = position.value();
+		}
+		auto outPosition = outOffset;
+		if(!outPosition) {
+			auto position = co_await out->seek(0, VfsSeek::relative);
+			if(!position)
+				co_return position.error();
+			outPosition = position.value();
+		}
+
+		if(*inPosition < *outPosition + static_cast<int64_t>(length)
+				&& *outPosition < *inPosition + static_cast<int64_t>(length))
+			co_return Error::illegalArguments;
+	}
+
+	co_return co_await sendfile(process, std::move(in), inOffset,
+			std::move(out), outOffset, length);
+}
+
+} // namespace copy_range
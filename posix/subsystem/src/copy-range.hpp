@@ -0,0 +1,54 @@
+#pragma once
+
+#include <optional>
+
+#include <helix/memory.hpp>
+
+#include "file.hpp"
+
+namespace copy_range {
+
+// Maximal amount of page cache that is locked and mapped at a time.
+constexpr size_t windowSize = 0x100000;
+
+// A locked and mapped range of a file's page cache. The pages cannot be evicted
+// while the window exists, so accessing the mapping never takes page faults
+// (that would need to be resolved by the fs server).
+struct PageCacheWindow {
+	// Points to the file offset that was passed to lockWindow().
+	std::byte *data() {
+		return reinterpret_cast<std::byte *>(mapping.get()) + misalign;
+	}
+
+	helix::UniqueDescriptor lock;
+	helix::Mapping mapping;
+	size_t misalign = 0;
+};
+
+// Locks and maps [offset, offset + length) of memory, as returned by
+// File::accessMemory(). The pages that the range touches may not span more
+// than windowSize bytes.
+// Fails if the range is not backed by the file (e.g., because the file was
+// truncated concurrently).
+async::result<frg::expected<Error, PageCacheWindow>>
+lockWindow(helix::BorrowedDescriptor memory, int64_t offset, size_t length,
+		uint32_t protection);
+
+// Copies up to length bytes from in to out without passing them through the
+// caller's address space. If an offset is given, the corresponding file position
+// is left untouched; otherwise, the file position is used and advanced.
+// If in is backed by a page cache (see File::isPageCacheBacked()), the page cache
+// is handed to the server of out (see File::copyFromMemory()), which reads it
+// directly. Otherwise, or if that server does not support it, out receives the data
+// from a mapping of the page cache in posix.
+// Callers check that in is open for reading and out for writing.
+async::result<frg::expected<Error, size_t>>
+sendfile(Process *process, SharedFilePtr in, std::optional<int64_t> inOffset,
+		SharedFilePtr out, std::optional<int64_t> outOffset, size_t length);
+
+// Like sendfile() but requires both files to be regular files.
+async::result<frg::expected<Error, size_t>>
+copyFileRange(Process *process, SharedFilePtr in, std::optional<int64_t> inOffset,
+		SharedFilePtr out, std::optional<int64_t> outOffset, size_t length);
+
+} // namespace copy_range
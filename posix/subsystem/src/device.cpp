@@ -366,12 +366,14 @@ FutureMaybe<std::shared_ptr<FsLink>> mountExternalDevice(helix::BorrowedLane lan
 	HEL_CHECK(offer.error());
 	HEL_CHECK(send_req.error());
 	HEL_CHECK(recv_resp.error());
-	HEL_CHECK(pull_node.error());
 
 	managarm::fs::SvrResponse resp;
 	resp.ParseFromArray(recv_resp.data(), recv_resp.length());
 	recv_resp.reset();
-	assert(resp.error() == managarm::fs::Errors::SUCCESS);
+	// The server does not send a node if the file system cannot be mounted.
+	if(resp.error() != managarm::fs::Errors::SUCCESS)
+		co_return nullptr;
+	HEL_CHECK(pull_node.error());
 	co_return extern_fs::createRoot(lane.dup(), pull_node.descriptor(), device);
 }
 
@@ -93,6 +93,7 @@ openExternalDevice(helix::BorrowedLane lane,
 		std::shared_ptr<MountView> mount, std::shared_ptr<FsLink> link,
 		SemanticFlags semantic_flags);
 
+// Returns nullptr if the server fails to mount the file system.
 FutureMaybe<std::shared_ptr<FsLink>> mountExternalDevice(helix::BorrowedLane lane, std::shared_ptr<UnixDevice> device);
 
 async::result<void> serveServerLane(helix::UniqueDescriptor lane);
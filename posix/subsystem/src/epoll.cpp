@@ -48,12 +48,17 @@ private:
 		smarter::shared_ptr<Item> item;
 	};
 
-	struct Item {
+	struct Item final : ReadinessObserver {
 		Item(smarter::shared_ptr<OpenFile> epoll, Process *process,
 				smarter::shared_ptr<File> file, int mask, uint64_t cookie)
 		: epoll{epoll}, state{stateAlive}, process{process},
 				file{std::move(file)}, eventMask{mask}, cookie{cookie} { }
 
+		~Item() override {
+			// Detach before the file (and thus the source) can go away.
+			detach();
+		}
+
 		smarter::shared_ptr<OpenFile> epoll;
 		State state;
 
@@ -77,8 +82,42 @@ private:
 		smarter::borrowed_ptr<Item> self;
 
 		frg::default_list_hook<Item> hook_;
+
+		// Items of files that have a ReadinessSource are notified of edges directly;
+		// they never have an outstanding pollWait() operation.
+		bool readinessChanged(uint64_t, int) override {
+			if(!(state & stateAlive))
+				return false;
+			if(logEpoll)
+				std::println("posix.epoll \e[1;34m{}\e[0m: Item \e[1;34m{}\e[0m becomes pending",
+					epoll->structName(), file->structName());
+			bool woken = epoll->_numWaiters;
+			epoll->_makePending(this);
+			return woken;
+		}
 	};
 
+	void _makePending(Item *item) {
+		if(item->state & statePending)
+			return;
+		item->state |= statePending;
+
+		item->self.lock().ctr()->increment();
+		_pendingQueue.push_back(item);
+		_raiseStatus();
+	}
+
+	void _raiseStatus() {
+		_currentSeq++;
+		_statusBell.raise();
+		_readiness.raise(_currentSeq, EPOLLIN);
+	}
+
+	static void _observe(Item *item, ReadinessSource *source) {
+		source->attach(item, (item->eventMask & epollEvents) | EPOLLERR | EPOLLHUP,
+				item->eventMask & EPOLLEXCLUSIVE);
+	}
+
 	static void _awaitPoll(Item *item) {
 	reRunImmediately:
 		// First, destruct the operation so that we can re-use it later.
@@ -118,15 +157,10 @@ private:
 			// Note that we stop watching once an item becomes pending.
 			// We do this as we have to pollStatus() again anyway before we report the item.
 			item->state &= ~statePolling;
-			if(!(item->state & statePending)) {
-				item->state |= statePending;
-
-				item->self.lock().ctr()->increment();
-				self->_pendingQueue.push_back(item);
-				self->_currentSeq++;
-				self->_statusBell.raise();
-			}
+			self->_makePending(item);
 		}else{
+			// Files without a ReadinessSource (see File::readinessSource()) re-arm
+			// their pollWait() here; for external files, this is an IPC round-trip.
 			// Here, we assume that the lambda does not execute on the current stack.
 			// TODO: Use some callback queueing mechanism to ensure this.
 			if(logEpoll)
@@ -169,14 +203,14 @@ public:
 				process, std::move(file), mask, cookie);
 		item->self = item;
 
-		item->state |= statePending | stateActive;
+		if(auto source = item->file->readinessSource(); source)
+			_observe(item.get(), source);
+
+		item->state |= stateActive;
 
 		_fileMap.insert({{item->file.get(), fd}, item});
 
-		item.ctr()->increment();
-		_pendingQueue.push_back(item.get());
-		_currentSeq++;
-		_statusBell.raise();
+		_makePending(item.get());
 		return Error::success;
 	}
 
@@ -198,14 +232,17 @@ public:
 		item->cookie = cookie;
 		item->cancelPoll.cancel();
 
+		// Re-attach to update the mask that the source filters edges with.
+		if(item->isObserving()) {
+			item->detach();
+			if(auto source = item->file->readinessSource(); source)
+				_observe(item.get(), source);
+		}
+
 		// Mark the item as pending.
 		if(!(item->state & statePending)) {
-			item->state |= statePending | stateActive;
-
-			item.ctr()->increment();
-			_pendingQueue.push_back(item.get());
-			_currentSeq++;
-			_statusBell.raise();
+			item->state |= stateActive;
+			_makePending(item.get());
 		}
 		return Error::success;
 	}
@@ -222,6 +259,7 @@ public:
 		auto item = it->second;
 
 		item->cancelPoll.cancel();
+		item->detach();
 
 		_fileMap.erase(it);
 		item->state &= ~stateAlive;
@@ -265,7 +303,10 @@ public:
 				if(logEpoll)
 					std::println("posix.epoll \e[1;34m{}\e[0m: Checking item \e[1;34m{}\e[0m",
 						structName(), item->file->structName());
-				auto result_or_error = co_await item->file->pollStatus(item->process);
+				// Observed items can be checked without going through a coroutine (or IPC).
+				auto result_or_error = item->isObserving()
+						? item->file->readinessStatus()
+						: co_await item->file->pollStatus(item->process);
 
 				// Discard closed items.
 				if(!result_or_error) {
@@ -273,6 +314,7 @@ public:
 					if(logEpoll)
 						std::println("posix.epoll \e[1;34m{}\e[0m: Discarding closed item \e[1;34m{}\e[0m",
 							structName(), item->file->structName());
+					item->detach();
 					item->state &= ~statePending;
 					continue;
 				}
@@ -285,9 +327,13 @@ public:
 				// Return pending items to the caller.
 				auto status = std::get<1>(result) & (itemEvents | EPOLLERR | EPOLLHUP);
 				if(status) {
-					if(item->eventMask & (EPOLLWAKEUP | EPOLLEXCLUSIVE))
+					// EPOLLEXCLUSIVE is implemented by the ReadinessSource of observed items.
+					auto unhandled = item->eventMask & EPOLLWAKEUP;
+					if(!item->isObserving())
+						unhandled |= item->eventMask & EPOLLEXCLUSIVE;
+					if(unhandled)
 						std::println("posix.epoll \e[1;34m{}\e[0m: unhandled epoll flag {:#x}",
-							structName(), item->eventMask & (EPOLLWAKEUP | EPOLLEXCLUSIVE));
+							structName(), unhandled);
 
 					assert(k < max_events);
 					memset(events + k, 0, sizeof(struct epoll_event));
@@ -301,7 +347,8 @@ public:
 
 				if(!status || (item->eventMask & EPOLLET)) {
 					item->state &= ~statePending;
-					if(!(item->state & statePolling)) {
+					// Observed items are re-queued by the next edge.
+					if(!item->isObserving() && !(item->state & statePolling)) {
 						item->state |= statePolling;
 
 						// Once an item is not pending anymore, we continue watching it.
@@ -331,7 +378,9 @@ public:
 			// Block and re-check if there are pending events.
 			if(cancellation.is_cancellation_requested())
 				break;
+			_numWaiters++;
 			co_await _statusBell.async_wait(cancellation);
+			_numWaiters--;
 		}
 
 		// Before returning, we have to reinsert the level-triggered events that we report.
@@ -339,8 +388,7 @@ public:
 			_pendingQueue.splice(_pendingQueue.end(), repoll_queue);
 			// We have to increment the sequence again as concurrent waiters
 			// might have seen an empty _pendingQueue.
-			_currentSeq++;
-			_statusBell.raise();
+			_raiseStatus();
 		}
 
 		if(logEpoll)
@@ -362,6 +410,7 @@ public:
 
 			it = _fileMap.erase(it);
 			item->state &= ~stateAlive;
+			item->detach();
 
 			if(item->state & statePolling)
 				item->cancelPoll.cancel();
@@ -399,6 +448,14 @@ public:
 		co_return PollStatusResult{_currentSeq, _pendingQueue.empty() ? 0 : EPOLLIN};
 	}
 
+	ReadinessSource *readinessSource() override {
+		return &_readiness;
+	}
+
+	frg::expected<Error, PollStatusResult> readinessStatus() override {
+		return PollStatusResult{_currentSeq, _pendingQueue.empty() ? 0 : EPOLLIN};
+	}
+
 	helix::BorrowedDescriptor getPassthroughLane() override {
 		return _passthrough;
 	}
@@ -439,6 +496,9 @@ private:
 	> _pendingQueue;
 	async::recurring_event _statusBell;
 	uint64_t _currentSeq;
+	ReadinessSource _readiness;
+	// Number of waitForEvents() calls that are blocked on _statusBell.
+	int _numWaiters = 0;
 };
 
 } // anonymous namespace
@@ -50,6 +50,7 @@ struct OpenFile : File {
 				}
 				_writeableSeq = ++_currentSeq;
 				_doorbell.raise();
+				_readiness.raise(_currentSeq, EPOLLOUT);
 				co_return size_t{8};
 			}
 
@@ -84,6 +85,7 @@ struct OpenFile : File {
 
 		_readableSeq = ++_currentSeq;
 		_doorbell.raise();
+		_readiness.raise(_currentSeq, EPOLLIN);
 		co_return length;
 	}
 
@@ -108,13 +110,21 @@ struct OpenFile : File {
 
 	async::result<frg::expected<Error, PollStatusResult>>
 	pollStatus(Process *) override {
+		co_return readinessStatus();
+	}
+
+	ReadinessSource *readinessSource() override {
+		return &_readiness;
+	}
+
+	frg::expected<Error, PollStatusResult> readinessStatus() override {
 		int events = 0;
 		if (_counter > 0)
 			events |= EPOLLIN;
 		if (_counter < 0xFFFFFFFFFFFFFFFF)
 			events |= EPOLLOUT;
 
-		co_return PollStatusResult(_currentSeq, events);
+		return PollStatusResult(_currentSeq, events);
 	}
 
 	async::result<void> setFileFlags(int flags) override {
@@ -145,6 +155,7 @@ private:
 	helix::UniqueLane _passthrough;
 	async::recurring_event _doorbell;
 	async::cancellation_event cancelServe_;
+	ReadinessSource _readiness;
 
 	uint64_t _currentSeq;
 	uint64_t _readableSeq;
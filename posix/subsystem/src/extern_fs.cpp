@@ -28,6 +28,7 @@ struct Superblock final : FsSuperblock {
 	async::result<frg::expected<Error, std::shared_ptr<FsLink>>>
 			rename(FsLink *source, FsNode *directory, std::string name) override;
 	async::result<frg::expected<Error, FsFileStats>> getFsstats() override;
+	async::result<frg::expected<Error>> sync() override;
 
 	std::string getFsType() override {
 		return "ext2";
@@ -236,14 +237,26 @@ private:
 		co_return std::move(memory);
 	}
 
+	async::result<frg::expected<Error, size_t>>
+	copyFromMemory(helix::BorrowedDescriptor memory, uint64_t inOffset,
+			std::optional<int64_t> outOffset, size_t length) override {
+		auto result = co_await _file.copyFromMemory(memory, inOffset,
+				outOffset.value_or(-1), length);
+		if(!result)
+			co_return result.error() | toPosixError;
+		co_return result.value();
+	}
+
 	helix::BorrowedDescriptor getPassthroughLane() override {
 		return _file.getLane();
 	}
 
 public:
 	OpenFile(helix::UniqueLane control, helix::UniqueLane lane,
-			std::shared_ptr<MountView> mount, std::shared_ptr<FsLink> link, bool append)
-	: File{FileKind::unknown, StructName::get("externfs.file"), std::move(mount), std::move(link), 0, append},
+			std::shared_ptr<MountView> mount, std::shared_ptr<FsLink> link,
+			DefaultOps defaultOps, bool append)
+	: File{FileKind::unknown, StructName::get("externfs.file"), std::move(mount), std::move(link),
+			defaultOps, append},
 			_control{std::move(control)}, _file{std::move(lane)} { }
 
 	~OpenFile() override {
@@ -279,6 +292,37 @@ public:
 		co_return {};
 	}
 
+	async::result<frg::expected<Error>> sync() override {
+		// Stores through shared mappings only dirty the page cache once the
+		// kernel is notified of them.
+		auto node = associatedLink()->getTarget().get();
+		co_await Process::synchronizeFileMappings([&] (FsNode *other) {
+			return other == node;
+		});
+
+		managarm::fs::CntRequest req;
+		req.set_req_type(managarm::fs::CntReqType::PT_FSYNC);
+
+		auto ser = req.SerializeAsString();
+		auto [offer, send_req, recv_resp]
+				= co_await helix_ng::exchangeMsgs(getPassthroughLane(),
+			helix_ng::offer(
+				helix_ng::sendBuffer(ser.data(), ser.size()),
+				helix_ng::recvInline()
+			)
+		);
+		HEL_CHECK(offer.error());
+		HEL_CHECK(send_req.error());
+		HEL_CHECK(recv_resp.error());
+
+		managarm::fs::SvrResponse resp;
+		resp.ParseFromArray(recv_resp.data(), recv_resp.length());
+		recv_resp.reset();
+		if(resp.error() != managarm::fs::Errors::SUCCESS)
+			co_return resp.error() | toPosixError;
+		co_return {};
+	}
+
 private:
 	helix::UniqueLane _control;
 	protocols::fs::File _file;
@@ -333,8 +377,10 @@ private:
 		recv_resp.reset();
 		assert(resp.error() == managarm::fs::Errors::SUCCESS);
 
+		// Regular files are backed by the fs server's page cache.
 		auto file = smarter::make_shared<OpenFile>(pull_ctrl.descriptor(),
-				pull_passthrough.descriptor(), std::move(mount), std::move(link), append);
+				pull_passthrough.descriptor(), std::move(mount), std::move(link),
+				File::defaultPageCache, append);
 		file->setupWeakFile(file);
 		co_return File::constructHandle(std::move(file));
 	}
@@ -872,7 +918,7 @@ private:
 		assert(resp.error() == managarm::fs::Errors::SUCCESS);
 
 		auto file = smarter::make_shared<OpenFile>(pull_ctrl.descriptor(),
-				pull_passthrough.descriptor(), std::move(mount), std::move(link), append);
+				pull_passthrough.descriptor(), std::move(mount), std::move(link), 0, append);
 		file->setupWeakFile(file);
 		co_return File::constructHandle(std::move(file));
 	}
@@ -1033,6 +1079,33 @@ std::shared_ptr<FsLink> Superblock::internalizePeripheralLink(Node *parent, std:
 	return link;
 }
 
+async::result<frg::expected<Error>> Superblock::sync() {
+	co_await Process::synchronizeFileMappings([&] (FsNode *node) {
+		return node->superblock() == this;
+	});
+
+	managarm::fs::CntRequest req;
+	req.set_req_type(managarm::fs::CntReqType::SB_SYNC);
+
+	auto [offer, send_req, recv_resp] = co_await helix_ng::exchangeMsgs(
+		_lane,
+		helix_ng::offer(
+			helix_ng::sendBragiHeadOnly(req, frg::stl_allocator{}),
+			helix_ng::recvInline()
+		)
+	);
+	HEL_CHECK(offer.error());
+	HEL_CHECK(send_req.error());
+	HEL_CHECK(recv_resp.error());
+
+	managarm::fs::SvrResponse resp;
+	resp.ParseFromArray(recv_resp.data(), recv_resp.length());
+	recv_resp.reset();
+	if(resp.error() != managarm::fs::Errors::SUCCESS)
+		co_return resp.error() | toPosixError;
+	co_return {};
+}
+
 async::result<frg::expected<Error, FsFileStats>> Superblock::getFsstats() {
 	std::cout << "posix: unimplemented getFsstats for extern_fs Superblock!" << std::endl;
 	co_return Error::illegalOperationTarget;
@@ -1050,7 +1123,7 @@ std::shared_ptr<FsLink> createRoot(helix::UniqueLane sb_lane, helix::UniqueLane
 smarter::shared_ptr<File, FileHandle>
 createFile(helix::UniqueLane lane, std::shared_ptr<MountView> mount, std::shared_ptr<FsLink> link) {
 	auto file = smarter::make_shared<OpenFile>(helix::UniqueLane{},
-			std::move(lane), std::move(mount), std::move(link), false);
+			std::move(lane), std::move(mount), std::move(link), 0, false);
 	file->setupWeakFile(file);
 	return File::constructHandle(std::move(file));
 }
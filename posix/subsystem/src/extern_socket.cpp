@@ -1,14 +1,53 @@
+#include <unordered_map>
+
+#include <bragi/helpers-std.hpp>
+#include <helix/memory.hpp>
+#include <protocols/fs/defs.hpp>
+
 #include "extern_socket.hpp"
 
 #include "fs.bragi.hpp"
 #include "protocols/fs/client.hpp"
 
 namespace {
+
+struct Socket;
+
+// Readiness table of netserver, see extern_socket::openReadiness().
+helix::Mapping readinessMapping;
+uint64_t numReadinessSlots = 0;
+std::unordered_map<uint64_t, Socket *> socketsBySlot;
+
 struct Socket : File {
 	Socket(helix::UniqueLane sockLane)
 	: File{FileKind::unknown,  StructName::get("extern-socket")},
 		_file{std::move(sockLane)} { }
 
+	~Socket() override {
+		if(_slot)
+			socketsBySlot.erase(*_slot);
+	}
+
+	// Lets netserver publish the socket's status to the readiness table.
+	// If that fails, the socket is still polled through pollWait().
+	async::result<void> watchReadiness() {
+		if(!numReadinessSlots)
+			co_return;
+		auto slotOrError = co_await _file.watchReadiness();
+		if(!slotOrError)
+			co_return;
+		auto slot = slotOrError.value();
+		assert(slot < numReadinessSlots);
+		auto [_, inserted] = socketsBySlot.insert({slot, this});
+		assert(inserted);
+		_slot = slot;
+	}
+
+	void raiseReadiness(int edges) {
+		auto result = readinessStatus();
+		_readiness.raise(std::get<0>(result.value()), edges);
+	}
+
 	async::result<frg::expected<Error, PollWaitResult>>
 	pollWait(Process *, uint64_t sequence, int mask,
 			async::cancellation_token cancellation) override {
@@ -19,20 +58,119 @@ struct Socket : File {
 
 	async::result<frg::expected<Error, PollStatusResult>>
 	pollStatus(Process *) override {
+		if(_slot)
+			co_return readinessStatus();
 		auto resultOrError = co_await _file.pollStatus();
 		assert(resultOrError);
 		co_return resultOrError.value();
 	}
 
+	ReadinessSource *readinessSource() override {
+		if(!_slot)
+			return nullptr;
+		return &_readiness;
+	}
+
+	frg::expected<Error, PollStatusResult> readinessStatus() override {
+		assert(_slot);
+		auto page = reinterpret_cast<protocols::fs::StatusPage *>(readinessMapping.get()) + *_slot;
+
+		while(true) {
+			// Start the seqlock read. netserver only holds the seqlock for a few stores;
+			// if it is preempted in between, let it run.
+			auto seqlock = __atomic_load_n(&page->seqlock, __ATOMIC_ACQUIRE);
+			if(seqlock & 1) {
+				HEL_CHECK(helYield());
+				continue;
+			}
+
+			// Perform the actual loads.
+			auto sequence = __atomic_load_n(&page->sequence, __ATOMIC_RELAXED);
+			auto status = __atomic_load_n(&page->status, __ATOMIC_RELAXED);
+
+			// Finish the seqlock read.
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if(__atomic_load_n(&page->seqlock, __ATOMIC_RELAXED) != seqlock)
+				continue;
+			return PollStatusResult{sequence, status};
+		}
+	}
+
+	async::result<frg::expected<Error, AcceptResult>> accept(Process *) override {
+		auto laneOrError = co_await _file.accept();
+		if(!laneOrError)
+			co_return laneOrError.error() | toPosixError;
+
+		auto file = smarter::make_shared<Socket>(std::move(laneOrError.value()));
+		file->setupWeakFile(file);
+		co_await file->watchReadiness();
+		co_return File::constructHandle(file);
+	}
+
+	async::result<frg::expected<Error, size_t>>
+	copyFromMemory(helix::BorrowedDescriptor memory, uint64_t inOffset,
+			std::optional<int64_t> outOffset, size_t length) override {
+		auto result = co_await _file.copyFromMemory(memory, inOffset,
+				outOffset.value_or(-1), length);
+		if(!result)
+			co_return result.error() | toPosixError;
+		co_return result.value();
+	}
+
 	helix::BorrowedDescriptor getPassthroughLane() override {
 		return _file.getLane();
 	}
 
 private:
 	protocols::fs::File _file;
+	// Slot in the readiness table, if netserver publishes our status there.
+	std::optional<uint64_t> _slot;
+	ReadinessSource _readiness;
 };
+
+async::detached serveReadiness(helix::UniqueLane lane) {
+	while(true) {
+		managarm::fs::ReadinessWaitRequest req;
+
+		auto [offer, send_req, recv_resp] = co_await helix_ng::exchangeMsgs(
+			lane,
+			helix_ng::offer(
+				helix_ng::want_lane,
+				helix_ng::sendBragiHeadOnly(req, frg::stl_allocator{}),
+				helix_ng::recvInline()
+			)
+		);
+		HEL_CHECK(offer.error());
+		HEL_CHECK(send_req.error());
+		HEL_CHECK(recv_resp.error());
+		auto conversation = offer.descriptor();
+
+		auto preamble = bragi::read_preamble(recv_resp);
+		assert(!preamble.error());
+		std::vector<uint8_t> tail(preamble.tail_size());
+		auto [recv_tail] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::recvBuffer(tail.data(), tail.size())
+		);
+		HEL_CHECK(recv_tail.error());
+
+		auto resp = *bragi::parse_head_tail<managarm::fs::ReadinessWaitReply>(recv_resp, tail);
+		recv_resp.reset();
+		assert(resp.error() == managarm::fs::Errors::SUCCESS);
+		assert(resp.slots().size() == resp.edges().size());
+
+		// Slots of sockets that were closed in the meantime are not in the map anymore.
+		for(size_t i = 0; i < resp.slots().size(); i++) {
+			auto it = socketsBySlot.find(resp.slots()[i]);
+			if(it == socketsBySlot.end())
+				continue;
+			it->second->raiseReadiness(resp.edges()[i]);
+		}
+	}
 }
 
+} // anonymous namespace
+
 namespace extern_socket {
 
 async::result<smarter::shared_ptr<File, FileHandle>> createSocket(helix::BorrowedLane lane,
@@ -66,7 +204,47 @@ async::result<smarter::shared_ptr<File, FileHandle>> createSocket(helix::Borrowe
 
 	auto file = smarter::make_shared<Socket>(recv_lane.descriptor());
 	file->setupWeakFile(file);
+	co_await file->watchReadiness();
 	co_return File::constructHandle(file);
 }
 
+async::result<void> openReadiness(helix::BorrowedLane lane) {
+	managarm::fs::OpenReadinessRequest req;
+
+	auto [offer, send_req, recv_resp] = co_await helix_ng::exchangeMsgs(
+		lane,
+		helix_ng::offer(
+			helix_ng::want_lane,
+			helix_ng::sendBragiHeadOnly(req, frg::stl_allocator{}),
+			helix_ng::recvInline()
+		)
+	);
+	HEL_CHECK(offer.error());
+	HEL_CHECK(send_req.error());
+	if(recv_resp.error() == kHelErrDismissed) {
+		std::cout << "posix: netserver does not support readiness streams;"
+				" epoll falls back to pollWait() for sockets" << std::endl;
+		co_return;
+	}
+	HEL_CHECK(recv_resp.error());
+	auto conversation = offer.descriptor();
+
+	auto resp = *bragi::parse_head_only<managarm::fs::OpenReadinessReply>(recv_resp);
+	recv_resp.reset();
+	assert(resp.error() == managarm::fs::Errors::SUCCESS);
+
+	auto [pull_lane, pull_memory] = co_await helix_ng::exchangeMsgs(
+		conversation,
+		helix_ng::pullDescriptor(),
+		helix_ng::pullDescriptor()
+	);
+	HEL_CHECK(pull_lane.error());
+	HEL_CHECK(pull_memory.error());
+
+	readinessMapping = helix::Mapping{pull_memory.descriptor(), 0,
+			resp.num_slots() * sizeof(protocols::fs::StatusPage), kHelMapProtRead};
+	numReadinessSlots = resp.num_slots();
+	serveReadiness(pull_lane.descriptor());
+}
+
 } // namespace extern_socket
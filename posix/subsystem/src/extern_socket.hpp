@@ -3,4 +3,8 @@
 namespace extern_socket {
 async::result<smarter::shared_ptr<File, FileHandle>> createSocket(helix::BorrowedLane lane,
 		int domain, int type, int proto, int flags);
+
+// Opens netserver's readiness stream. Sockets that are created afterwards
+// have a ReadinessSource that is fed from the stream.
+async::result<void> openReadiness(helix::BorrowedLane lane);
 }
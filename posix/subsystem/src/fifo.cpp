@@ -1,17 +1,20 @@
 
 #include <async/cancellation.hpp>
+#include <limits.h>
+#include <signal.h>
 #include <string.h>
 #include <sys/epoll.h>
 #include <iostream>
-#include <deque>
 #include <map>
-#include <numeric>
 #include <print>
 
 #include <async/recurring-event.hpp>
 #include <bragi/helpers-std.hpp>
 #include <helix/ipc.hpp>
+#include "copy-range.hpp"
 #include "fifo.hpp"
+#include "fs.hpp"
+#include "process.hpp"
 #include "fs.bragi.hpp"
 #include "protocols/fs/common.hpp"
 
@@ -23,16 +26,37 @@ namespace {
 
 constexpr bool logFifos = false;
 
-struct Packet {
-	// The actual octet data that the packet consists of.
-	std::vector<char> buffer;
+// Pipes are backed by a ring of page-sized buffers. Buffers hold shared references
+// to their pages such that splice() and tee() can move data between pipes without copying it.
+constexpr size_t pipePageSize = 0x1000;
+constexpr size_t defaultPipePages = 16;
+constexpr size_t maxPipeSize = 0x100000;
 
+struct PipePage {
+	char data[pipePageSize];
+};
+
+struct PipeBuffer {
+	std::shared_ptr<PipePage> page;
 	size_t offset = 0;
+	size_t length = 0;
+
+	char *data() {
+		return page->data + offset;
+	}
+
+	// Only buffers that own their page exclusively may be appended to;
+	// pages that are shared with other pipes (via tee()) are immutable.
+	size_t tailroom() const {
+		if(page.use_count() != 1)
+			return 0;
+		return pipePageSize - offset - length;
+	}
 };
 
 struct Channel {
 	Channel()
-	: writerCount{0}, readerCount{0} { }
+	: writerCount{0}, readerCount{0}, ring_(defaultPipePages) { }
 
 	// Status management for poll().
 	async::recurring_event statusBell;
@@ -41,14 +65,159 @@ struct Channel {
 	uint64_t noWriterSeq = 0;
 	uint64_t noReaderSeq = 0;
 	uint64_t inSeq = 0;
+	uint64_t outSeq = 1;
 	int writerCount;
 	int readerCount;
 
 	async::recurring_event readerPresent;
 	async::recurring_event writerPresent;
 
-	// The actual queue of this pipe.
-	std::deque<Packet> packetQueue;
+	// Edges for the read and write sides are published separately,
+	// such that epoll only sees edges that are relevant for each end.
+	ReadinessSource readReadiness;
+	ReadinessSource writeReadiness;
+
+	size_t capacity() {
+		return ring_.size() * pipePageSize;
+	}
+
+	size_t numBuffers() {
+		return used_;
+	}
+
+	size_t freeBuffers() {
+		return ring_.size() - used_ - reserved_;
+	}
+
+	// Claims free slots for buffers that are filled asynchronously, such that
+	// the buffers can be pushed without waiting once their data is available.
+	void reserveBuffers(size_t n) {
+		assert(freeBuffers() >= n);
+		reserved_ += n;
+	}
+
+	void unreserveBuffers(size_t n) {
+		assert(reserved_ >= n);
+		reserved_ -= n;
+	}
+
+	// Number of bytes that are currently buffered.
+	size_t bytesQueued() {
+		return bytes_;
+	}
+
+	// Number of bytes that can be enqueued without blocking.
+	size_t spaceForEnqueue() {
+		size_t space = freeBuffers() * pipePageSize;
+		if(used_)
+			space += back().tailroom();
+		return space;
+	}
+
+	PipeBuffer &at(size_t i) {
+		assert(i < used_);
+		return ring_[(head_ + i) % ring_.size()];
+	}
+
+	PipeBuffer &front() {
+		return at(0);
+	}
+
+	PipeBuffer &back() {
+		return at(used_ - 1);
+	}
+
+	void pushBuffer(PipeBuffer buffer) {
+		assert(used_ + reserved_ < ring_.size());
+		assert(buffer.length);
+		bytes_ += buffer.length;
+		ring_[(head_ + used_++) % ring_.size()] = std::move(buffer);
+	}
+
+	// Removes chunk bytes from the front of the ring.
+	void consume(size_t chunk) {
+		auto &buffer = front();
+		assert(chunk <= buffer.length);
+		buffer.offset += chunk;
+		buffer.length -= chunk;
+		bytes_ -= chunk;
+		if(!buffer.length) {
+			buffer.page = nullptr;
+			head_ = (head_ + 1) % ring_.size();
+			used_--;
+		}
+	}
+
+	// Copies data into the ring, merging it into the last buffer if possible.
+	size_t copyIn(const void *data, size_t length) {
+		auto p = reinterpret_cast<const char *>(data);
+		size_t progress = 0;
+		if(used_) {
+			auto &tail = back();
+			size_t chunk = std::min(tail.tailroom(), length);
+			memcpy(tail.data() + tail.length, p, chunk);
+			tail.length += chunk;
+			bytes_ += chunk;
+			progress += chunk;
+		}
+		while(progress < length && freeBuffers()) {
+			size_t chunk = std::min(pipePageSize, length - progress);
+			PipeBuffer buffer{std::make_shared<PipePage>(), 0, chunk};
+			memcpy(buffer.data(), p + progress, chunk);
+			pushBuffer(std::move(buffer));
+			progress += chunk;
+		}
+		return progress;
+	}
+
+	// Copies data out of the ring, spanning multiple buffers if necessary.
+	size_t copyOut(void *data, size_t length) {
+		auto p = reinterpret_cast<char *>(data);
+		size_t progress = 0;
+		while(progress < length && used_) {
+			auto &buffer = front();
+			size_t chunk = std::min(buffer.length, length - progress);
+			memcpy(p + progress, buffer.data(), chunk);
+			consume(chunk);
+			progress += chunk;
+		}
+		return progress;
+	}
+
+	// Resizes the ring to the given number of pages.
+	// Fails if the currently buffered data does not fit into the new ring.
+	bool resize(size_t pages) {
+		assert(pages);
+		if(used_ + reserved_ > pages)
+			return false;
+		std::vector<PipeBuffer> ring(pages);
+		for(size_t i = 0; i < used_; i++)
+			ring[i] = std::move(at(i));
+		ring_ = std::move(ring);
+		head_ = 0;
+		return true;
+	}
+
+	void raiseIn() {
+		inSeq = ++currentSeq;
+		statusBell.raise();
+		readReadiness.raise(currentSeq, EPOLLIN);
+	}
+
+	void raiseOut() {
+		outSeq = ++currentSeq;
+		statusBell.raise();
+		if(freeBuffers())
+			writeReadiness.raise(currentSeq, EPOLLOUT);
+	}
+
+private:
+	std::vector<PipeBuffer> ring_;
+	size_t head_ = 0;
+	size_t used_ = 0;
+	// Slots that are claimed by reserveBuffers().
+	size_t reserved_ = 0;
+	size_t bytes_ = 0;
 };
 
 struct OpenFile : File {
@@ -64,8 +233,26 @@ public:
 
 	OpenFile(std::shared_ptr<MountView> mount, std::shared_ptr<FsLink> link,
 		bool isReader, bool isWriter, bool nonBlock = false)
-	: File{FileKind::unknown,  StructName::get("fifo"), mount, link, File::defaultPipeLikeSeek},
-		isReader_{isReader}, isWriter_{isWriter}, nonBlock_{nonBlock} { }
+	: File{FileKind::fifo,  StructName::get("fifo"), mount, link, File::defaultPipeLikeSeek},
+		isReader_{isReader}, isWriter_{isWriter}, nonBlock_{nonBlock} {
+		setAccessMode(isReader, isWriter);
+	}
+
+	Channel *channel() {
+		return _channel.get();
+	}
+
+	bool isReader() {
+		return isReader_;
+	}
+
+	bool isWriter() {
+		return isWriter_;
+	}
+
+	bool isNonBlocking() {
+		return nonBlock_;
+	}
 
 	void connectChannel(std::shared_ptr<Channel> channel) {
 		assert(!_channel);
@@ -81,12 +268,14 @@ public:
 			if (_channel->readerCount-- == 1) {
 				_channel->noReaderSeq = ++_channel->currentSeq;
 				_channel->statusBell.raise();
+				_channel->writeReadiness.raise(_channel->currentSeq, EPOLLERR);
 			}
 		}
 		if (isWriter_) {
 			if(_channel->writerCount-- == 1) {
 				_channel->noWriterSeq = ++_channel->currentSeq;
 				_channel->statusBell.raise();
+				_channel->readReadiness.raise(_channel->currentSeq, EPOLLHUP);
 			}
 		}
 		_channel = nullptr;
@@ -101,7 +290,7 @@ public:
 		if(!maxLength)
 			co_return size_t{0};
 
-		while(_channel->packetQueue.empty() && _channel->writerCount) {
+		while(!_channel->bytesQueued() && _channel->writerCount) {
 			if(nonBlock_) {
 				if(logFifos)
 					std::cout << "posix: FIFO pipe would block" << std::endl;
@@ -115,36 +304,48 @@ public:
 			}
 		}
 
-		if(_channel->packetQueue.empty()) {
+		if(!_channel->bytesQueued()) {
 			assert(!_channel->writerCount);
 			co_return size_t{0};
 		}
 
-		// TODO: Truncate packets (for SOCK_DGRAM) here.
-		auto packet = &_channel->packetQueue.front();
-		size_t chunk = std::min(packet->buffer.size() - packet->offset, maxLength);
+		auto chunk = _channel->copyOut(data, maxLength);
 		assert(chunk); // Otherwise we return above since !maxLength.
-		memcpy(data, packet->buffer.data() + packet->offset, chunk);
-		packet->offset += chunk;
-		if(packet->offset == packet->buffer.size())
-			_channel->packetQueue.pop_front();
+		_channel->raiseOut();
 		co_return chunk;
 	}
 
 	async::result<frg::expected<Error, size_t>>
-	writeAll(Process *, const void *data, size_t maxLength) override {
+	writeAll(Process *process, const void *data, size_t maxLength) override {
 		if (!isWriter_)
 			co_return Error::insufficientPermissions;
 
-		Packet packet;
-		packet.buffer.resize(maxLength);
-		memcpy(packet.buffer.data(), data, maxLength);
-		packet.offset = 0;
+		auto p = reinterpret_cast<const char *>(data);
+		size_t progress = 0;
+		while(progress < maxLength) {
+			if(!_channel->readerCount) {
+				if(process)
+					process->threadGroup()->signalContext()->issueSignal(SIGPIPE, {});
+				co_return Error::brokenPipe;
+			}
 
-		_channel->packetQueue.push_back(std::move(packet));
-		_channel->inSeq = ++_channel->currentSeq;
-		_channel->statusBell.raise();
-		co_return maxLength;
+			// Writes of up to PIPE_BUF bytes must not be interleaved with other writes.
+			auto space = _channel->spaceForEnqueue();
+			if(!space || (maxLength <= PIPE_BUF && space < maxLength)) {
+				if(nonBlock_) {
+					if(progress)
+						break;
+					co_return Error::wouldBlock;
+				}
+				co_await _channel->statusBell.async_wait();
+				continue;
+			}
+
+			progress += _channel->copyIn(p + progress, maxLength - progress);
+			_channel->raiseIn();
+		}
+
+		co_return progress;
 	}
 
 
@@ -173,7 +374,8 @@ public:
 				edges |= EPOLLIN;
 		}
 		if (isWriter_) {
-			edges |= EPOLLOUT;
+			if(_channel->outSeq > pastSeq && _channel->freeBuffers())
+				edges |= EPOLLOUT;
 			if(_channel->noReaderSeq > pastSeq)
 				edges |= EPOLLERR;
 		}
@@ -183,20 +385,35 @@ public:
 
 	async::result<frg::expected<Error, PollStatusResult>>
 	pollStatus(Process *) override {
+		co_return readinessStatus();
+	}
+
+	// Only files that are either a reader or a writer can use the per-side sources.
+	ReadinessSource *readinessSource() override {
+		if(!_channel || isReader_ == isWriter_)
+			return nullptr;
+		return isReader_ ? &_channel->readReadiness : &_channel->writeReadiness;
+	}
+
+	frg::expected<Error, PollStatusResult> readinessStatus() override {
+		if(!_channel)
+			return Error::fileClosed;
+
 		int events = 0;
 		if (isReader_) {
 			if(!_channel->writerCount)
 				events |= EPOLLHUP;
-			if(!_channel->packetQueue.empty())
+			if(_channel->bytesQueued())
 				events |= EPOLLIN;
 		}
 		if (isWriter_) {
-			events |= EPOLLOUT;
+			if(_channel->freeBuffers())
+				events |= EPOLLOUT;
 			if(!_channel->readerCount)
 				events |= EPOLLERR;
 		}
 
-		co_return PollStatusResult(_channel->currentSeq, events);
+		return PollStatusResult(_channel->currentSeq, events);
 	}
 
 	helix::BorrowedDescriptor getPassthroughLane() override {
@@ -245,11 +462,7 @@ public:
 				case FIONREAD: {
 					size_t count = 0;
 					if (isReader_)
-						count = std::accumulate(_channel->packetQueue.cbegin(), _channel->packetQueue.cend(), 0,
-							[](size_t sum, const Packet &p) {
-								return sum + (p.buffer.size() - p.offset);
-							}
-						);
+						count = _channel->bytesQueued();
 
 					resp.set_fionread_count(count);
 					resp.set_error(managarm::fs::Errors::SUCCESS);
@@ -293,6 +506,269 @@ private:
 	bool nonBlock_;
 };
 
+// Waits until the pipe contains data. Returns false if the pipe is empty and has no writers.
+async::result<frg::expected<Error, bool>> waitForData(Channel *channel, bool nonBlock) {
+	while(!channel->bytesQueued()) {
+		if(!channel->writerCount)
+			co_return false;
+		if(nonBlock)
+			co_return Error::wouldBlock;
+		co_await channel->statusBell.async_wait();
+	}
+	co_return true;
+}
+
+// Waits until the pipe has at least one free buffer.
+async::result<frg::expected<Error>> waitForSpace(Process *process, Channel *channel, bool nonBlock) {
+	while(true) {
+		if(!channel->readerCount) {
+			if(process)
+				process->threadGroup()->signalContext()->issueSignal(SIGPIPE, {});
+			co_return Error::brokenPipe;
+		}
+		if(channel->freeBuffers())
+			co_return {};
+		if(nonBlock)
+			co_return Error::wouldBlock;
+		co_await channel->statusBell.async_wait();
+	}
+}
+
+// Moves (or, for tee(), shares) buffers from one pipe to another without copying.
+async::result<frg::expected<Error, size_t>>
+transferBuffers(Process *process, Channel *in, Channel *out, size_t length,
+		bool nonBlock, bool consume) {
+	if(in == out)
+		co_return Error::illegalArguments;
+
+	auto dataResult = co_await waitForData(in, nonBlock);
+	if(!dataResult)
+		co_return dataResult.error();
+	if(!dataResult.value())
+		co_return size_t{0};
+
+	auto spaceResult = co_await waitForSpace(process, out, nonBlock);
+	if(!spaceResult)
+		co_return spaceResult.error();
+
+	// Both pipes might have changed while we were waiting.
+	size_t progress = 0;
+	size_t index = 0;
+	while(progress < length && out->freeBuffers()) {
+		if(index == in->numBuffers())
+			break;
+		auto &buffer = in->at(index);
+		size_t chunk = std::min(buffer.length, length - progress);
+		out->pushBuffer(PipeBuffer{buffer.page, buffer.offset, chunk});
+		if(consume) {
+			in->consume(chunk);
+		}else{
+			index++;
+		}
+		progress += chunk;
+	}
+
+	if(progress) {
+		if(consume)
+			in->raiseOut();
+		out->raiseIn();
+	}
+	co_return progress;
+}
+
+// Copies buffered data into a locked window of out's page cache. Only used for writes
+// that do not extend the file; those need to go through the fs server.
+async::result<frg::expected<Error, size_t>>
+drainToPageCache(Channel *in, File *out, int64_t offset, size_t length) {
+	auto memory = co_await out->accessMemory();
+	auto window = co_await copy_range::lockWindow(memory, offset, length,
+			kHelMapProtRead | kHelMapProtWrite);
+	if(!window)
+		co_return window.error();
+
+	// Other readers might have consumed data while we were locking the window.
+	size_t progress = 0;
+	while(progress < length && in->numBuffers()) {
+		auto &buffer = in->front();
+		size_t chunk = std::min(buffer.length, length - progress);
+		memcpy(window.value().data() + progress, buffer.data(), chunk);
+		in->consume(chunk);
+		progress += chunk;
+	}
+	co_return progress;
+}
+
+// Writes buffered data to an arbitrary file. Data is only consumed once it was written.
+async::result<frg::expected<Error, size_t>>
+drainToFile(Process *process, Channel *in, File *out, std::optional<int64_t> offset,
+		size_t length, bool nonBlock) {
+	auto dataResult = co_await waitForData(in, nonBlock);
+	if(!dataResult)
+		co_return dataResult.error();
+	if(!dataResult.value())
+		co_return size_t{0};
+
+	// Overwrites at explicit offsets go straight into the page cache.
+	if(offset && out->isPageCacheBacked()) {
+		auto stats = co_await out->associatedLink()->getTarget()->getStats();
+		if(!stats)
+			co_return stats.error();
+		auto fileSize = stats.value().fileSize;
+		if(static_cast<uint64_t>(*offset) < fileSize) {
+			size_t chunk = std::min({length, in->bytesQueued(),
+					static_cast<size_t>(fileSize - *offset),
+					copy_range::windowSize - (*offset & (pipePageSize - 1))});
+			auto result = co_await drainToPageCache(in, out, *offset, chunk);
+			if(result && result.value())
+				in->raiseOut();
+			co_return result;
+		}
+	}
+
+	size_t progress = 0;
+	while(progress < length && in->numBuffers()) {
+		// Keep a reference to the page such that it outlives concurrent reads.
+		PipeBuffer buffer = in->front();
+		size_t chunk = std::min(buffer.length, length - progress);
+
+		auto result = offset
+			? co_await out->pwrite(process, *offset + progress, buffer.data(), chunk)
+			: co_await out->writeAll(process, buffer.data(), chunk);
+		if(!result) {
+			if(progress)
+				break;
+			co_return result.error();
+		}
+
+		auto written = result.value();
+		if(!in->numBuffers() || in->front().page != buffer.page
+				|| in->front().offset != buffer.offset)
+			break;
+		in->consume(written);
+		progress += written;
+		if(written < chunk)
+			break;
+	}
+
+	if(progress)
+		in->raiseOut();
+	co_return progress;
+}
+
+// Copies file data from a locked window of in's page cache into fresh pipe pages.
+// If no offset is given, the file position is used and advanced.
+async::result<frg::expected<Error, size_t>>
+fillFromPageCache(Process *process, File *in, std::optional<int64_t> offset, Channel *out,
+		size_t length, bool nonBlock) {
+	int64_t position;
+	if(offset) {
+		position = *offset;
+	}else{
+		auto seekResult = co_await in->seek(0, VfsSeek::relative);
+		if(!seekResult)
+			co_return seekResult.error();
+		position = seekResult.value();
+	}
+
+	auto stats = co_await in->associatedLink()->getTarget()->getStats();
+	if(!stats)
+		co_return stats.error();
+	auto fileSize = stats.value().fileSize;
+	if(static_cast<uint64_t>(position) >= fileSize)
+		co_return size_t{0};
+
+	auto spaceResult = co_await waitForSpace(process, out, nonBlock);
+	if(!spaceResult)
+		co_return spaceResult.error();
+
+	// Hold the slots while locking the window such that other writers cannot
+	// fill the pipe in the meantime.
+	length = std::min({length, static_cast<size_t>(fileSize - position),
+			out->freeBuffers() * pipePageSize,
+			copy_range::windowSize - (position & (pipePageSize - 1))});
+	size_t slots = (length + pipePageSize - 1) / pipePageSize;
+	out->reserveBuffers(slots);
+	auto memory = co_await in->accessMemory();
+	auto window = co_await copy_range::lockWindow(memory, position, length, kHelMapProtRead);
+	out->unreserveBuffers(slots);
+	if(!window)
+		co_return window.error();
+
+	// Nothing was consumed from the file yet.
+	if(!out->readerCount) {
+		if(process)
+			process->threadGroup()->signalContext()->issueSignal(SIGPIPE, {});
+		co_return Error::brokenPipe;
+	}
+
+	size_t progress = 0;
+	while(progress < length) {
+		size_t chunk = std::min(pipePageSize, length - progress);
+		PipeBuffer buffer{std::make_shared<PipePage>(), 0, chunk};
+		memcpy(buffer.data(), window.value().data() + progress, chunk);
+		out->pushBuffer(std::move(buffer));
+		progress += chunk;
+	}
+	out->raiseIn();
+
+	if(!offset) {
+		auto seekResult = co_await in->seek(position + progress, VfsSeek::absolute);
+		if(!seekResult)
+			co_return seekResult.error();
+	}
+	co_return progress;
+}
+
+// Reads data from an arbitrary file into fresh pipe pages.
+async::result<frg::expected<Error, size_t>>
+fillFromFile(Process *process, File *in, std::optional<int64_t> offset, Channel *out,
+		size_t length, bool nonBlock) {
+	if(in->isPageCacheBacked())
+		co_return co_await fillFromPageCache(process, in, offset, out, length, nonBlock);
+
+	auto spaceResult = co_await waitForSpace(process, out, nonBlock);
+	if(!spaceResult)
+		co_return spaceResult.error();
+
+	size_t progress = 0;
+	while(progress < length && out->freeBuffers() && out->readerCount) {
+		size_t chunk = std::min(pipePageSize, length - progress);
+		PipeBuffer buffer{std::make_shared<PipePage>(), 0, 0};
+
+		// Other writers may fill the pipe while we are reading. Holding a slot
+		// ensures that we never have to wait (even for non-blocking pipes) once
+		// data was consumed from the file.
+		out->reserveBuffers(1);
+		auto result = offset
+			? co_await in->pread(process, *offset + progress, buffer.data(), chunk)
+			: co_await in->readSome(process, buffer.data(), chunk, {});
+		out->unreserveBuffers(1);
+		if(!result) {
+			if(progress)
+				break;
+			co_return result.error();
+		}
+		if(!result.value())
+			break;
+		buffer.length = result.value();
+
+		// The data was consumed from the file, so it is counted even if the
+		// readers disappeared in the meantime.
+		out->pushBuffer(std::move(buffer));
+		out->raiseIn();
+		progress += result.value();
+		if(result.value() < chunk)
+			break;
+	}
+
+	if(!progress && !out->readerCount) {
+		if(process)
+			process->threadGroup()->signalContext()->issueSignal(SIGPIPE, {});
+		co_return Error::brokenPipe;
+	}
+	co_return progress;
+}
+
 } // anonymous namespace
 
 // This maps FsNodes to Channels for named pipes (FIFOs)
@@ -375,5 +851,152 @@ std::array<smarter::shared_ptr<File, FileHandle>, 2> createPair(bool nonBlock) {
 			File::constructHandle(std::move(w_file))};
 }
 
-} // namespace fifo
+bool isPipe(File *file) {
+	return file->kind() == FileKind::fifo;
+}
+
+size_t getPipeSize(File *file) {
+	assert(isPipe(file));
+	return static_cast<OpenFile *>(file)->channel()->capacity();
+}
+
+frg::expected<Error, size_t> setPipeSize(File *file, size_t size) {
+	assert(isPipe(file));
+	if(size > maxPipeSize)
+		return Error::illegalArguments;
+
+	// Like Linux, round up to a power-of-two number of pages.
+	size_t pages = 1;
+	while(pages * pipePageSize < size)
+		pages <<= 1;
+
+	auto channel = static_cast<OpenFile *>(file)->channel();
+	if(!channel->resize(pages))
+		return Error::resourceInUse;
+	channel->raiseOut();
+	return channel->capacity();
+}
+
+async::result<frg::expected<Error, size_t>>
+splice(Process *process, SharedFilePtr in, std::optional<int64_t> inOffset,
+		SharedFilePtr out, std::optional<int64_t> outOffset, size_t length, bool nonBlock) {
+	auto inPipe = isPipe(in.get()) ? static_cast<OpenFile *>(in.get()) : nullptr;
+	auto outPipe = isPipe(out.get()) ? static_cast<OpenFile *>(out.get()) : nullptr;
+
+	if(!inPipe && !outPipe)
+		co_return Error::illegalArguments;
+	if((inPipe && inOffset) || (outPipe && outOffset))
+		co_return Error::seekOnPipe;
+	if((inPipe && !inPipe->isReader()) || (outPipe && !outPipe->isWriter()))
+		co_return Error::insufficientPermissions;
+	if(!length)
+		co_return size_t{0};
+
+	if(inPipe && outPipe)
+		co_return co_await transferBuffers(process, inPipe->channel(), outPipe->channel(),
+				length, nonBlock || inPipe->isNonBlocking(), true);
+	if(inPipe)
+		co_return co_await drainToFile(process, inPipe->channel(), out.get(), outOffset,
+				length, nonBlock || inPipe->isNonBlocking());
+	co_return co_await fillFromFile(process, in.get(), inOffset, outPipe->channel(),
+			length, nonBlock || outPipe->isNonBlocking());
+}
 
+async::result<frg::expected<Error, size_t>>
+tee(Process *process, SharedFilePtr in, SharedFilePtr out, size_t length, bool nonBlock) {
+	if(!isPipe(in.get()) || !isPipe(out.get()))
+		co_return Error::illegalArguments;
+	auto inPipe = static_cast<OpenFile *>(in.get());
+	auto outPipe = static_cast<OpenFile *>(out.get());
+	if(!inPipe->isReader() || !outPipe->isWriter())
+		co_return Error::insufficientPermissions;
+	if(!length)
+		co_return size_t{0};
+
+	co_return co_await transferBuffers(process, inPipe->channel(), outPipe->channel(),
+			length, nonBlock || inPipe->isNonBlocking(), false);
+}
+
+async::result<frg::expected<Error, size_t>>
+vmsplice(Process *process, SharedFilePtr file, std::vector<iovec> iovs, bool nonBlock) {
+	if(!isPipe(file.get()))
+		co_return Error::illegalArguments;
+	auto pipe = static_cast<OpenFile *>(file.get());
+	auto channel = pipe->channel();
+	nonBlock = nonBlock || pipe->isNonBlocking();
+
+	size_t progress = 0;
+	if(pipe->isWriter()) {
+		// Copy directly from the caller's address space into the pipe pages.
+		for(auto &iov : iovs) {
+			auto base = reinterpret_cast<uintptr_t>(iov.iov_base);
+			size_t done = 0;
+			while(done < iov.iov_len) {
+				auto spaceResult = co_await waitForSpace(process, channel, nonBlock || progress);
+				if(!spaceResult) {
+					if(progress)
+						co_return progress;
+					co_return spaceResult.error();
+				}
+
+				size_t chunk = std::min(pipePageSize, iov.iov_len - done);
+				PipeBuffer buffer{std::make_shared<PipePage>(), 0, chunk};
+				auto loadMemory = co_await helix_ng::readMemory(process->vmContext()->getSpace(),
+						base + done, chunk, buffer.data());
+				if(loadMemory.error()) {
+					if(progress)
+						co_return progress;
+					co_return Error::illegalArguments;
+				}
+
+				if(!channel->freeBuffers() || !channel->readerCount)
+					co_return progress;
+				channel->pushBuffer(std::move(buffer));
+				channel->raiseIn();
+				done += chunk;
+				progress += chunk;
+			}
+		}
+	}else{
+		// Copy pipe pages directly into the caller's address space.
+		assert(pipe->isReader());
+		auto dataResult = co_await waitForData(channel, nonBlock);
+		if(!dataResult)
+			co_return dataResult.error();
+
+		size_t index = 0;
+		size_t done = 0;
+		while(index < iovs.size() && channel->numBuffers()) {
+			auto &iov = iovs[index];
+			if(done == iov.iov_len) {
+				index++;
+				done = 0;
+				continue;
+			}
+
+			PipeBuffer buffer = channel->front();
+			size_t chunk = std::min(buffer.length, iov.iov_len - done);
+			auto storeMemory = co_await helix_ng::writeMemory(process->vmContext()->getSpace(),
+					reinterpret_cast<uintptr_t>(iov.iov_base) + done, chunk, buffer.data());
+			if(storeMemory.error()) {
+				if(progress)
+					break;
+				co_return Error::illegalArguments;
+			}
+
+			// Another reader might have consumed the data while we were copying.
+			if(!channel->numBuffers() || channel->front().page != buffer.page
+					|| channel->front().offset != buffer.offset)
+				break;
+			channel->consume(chunk);
+			done += chunk;
+			progress += chunk;
+		}
+		if(progress)
+			channel->raiseOut();
+	}
+
+	co_return progress;
+}
+
+} // namespace fifo
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <optional>
+#include <sys/uio.h>
+
 #include "file.hpp"
 #include "fs.hpp"
 
@@ -12,5 +15,28 @@ openNamedChannel(std::shared_ptr<MountView> mount, std::shared_ptr<FsLink> link,
 
 std::array<smarter::shared_ptr<File, FileHandle>, 2> createPair(bool nonBlock);
 
+bool isPipe(File *file);
+
+// Returns the capacity of the pipe in bytes (F_GETPIPE_SZ).
+size_t getPipeSize(File *file);
+
+// Changes the capacity of the pipe (F_SETPIPE_SZ).
+// Fails with Error::resourceInUse if the buffered data does not fit into the new capacity.
+frg::expected<Error, size_t> setPipeSize(File *file, size_t size);
+
+// Moves data between a pipe and another file without copying it through the caller.
+// At least one of the files must be a pipe; offsets may only be given for non-pipes.
+async::result<frg::expected<Error, size_t>>
+splice(Process *process, SharedFilePtr in, std::optional<int64_t> inOffset,
+		SharedFilePtr out, std::optional<int64_t> outOffset, size_t length, bool nonBlock);
+
+// Duplicates data from one pipe into another without consuming it.
+async::result<frg::expected<Error, size_t>>
+tee(Process *process, SharedFilePtr in, SharedFilePtr out, size_t length, bool nonBlock);
+
+// Copies data between the caller's address space and a pipe.
+async::result<frg::expected<Error, size_t>>
+vmsplice(Process *process, SharedFilePtr pipe, std::vector<iovec> iovs, bool nonBlock);
+
 } // namespace fifo
 
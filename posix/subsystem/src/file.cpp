@@ -1,4 +1,5 @@
 
+#include <algorithm>
 #include <string.h>
 #include <fcntl.h>
 
@@ -13,6 +14,91 @@ constexpr bool logDestruction = false;
 
 } // anonymous namespace
 
+// --------------------------------------------------------
+// ReadinessSource / ReadinessObserver implementation.
+// --------------------------------------------------------
+
+ReadinessObserver::~ReadinessObserver() {
+	detach();
+}
+
+void ReadinessObserver::detach() {
+	if(!source_)
+		return;
+	source_->detach_(this);
+	source_ = nullptr;
+}
+
+ReadinessSource::~ReadinessSource() {
+	assert(!raising_);
+	for(auto observer : observers_) {
+		if(observer)
+			observer->source_ = nullptr;
+	}
+}
+
+void ReadinessSource::attach(ReadinessObserver *observer, int mask, bool exclusive) {
+	assert(!observer->source_);
+	observer->source_ = this;
+	observer->mask_ = mask;
+	observer->exclusive_ = exclusive;
+	observers_.push_back(observer);
+}
+
+void ReadinessSource::detach_(ReadinessObserver *observer) {
+	auto it = std::find(observers_.begin(), observers_.end(), observer);
+	assert(it != observers_.end());
+	if(raising_) {
+		*it = nullptr;
+		needsCompaction_ = true;
+	}else{
+		observers_.erase(it);
+	}
+}
+
+void ReadinessSource::compact_() {
+	std::erase(observers_, nullptr);
+	needsCompaction_ = false;
+}
+
+void ReadinessSource::raise(uint64_t sequence, int edges) {
+	if(observers_.empty())
+		return;
+
+	// Observers may attach or detach while we iterate, hence the index-based loop.
+	raising_++;
+	ReadinessObserver *exclusive = nullptr;
+	for(size_t i = 0; i < observers_.size(); i++) {
+		auto observer = observers_[i];
+		if(!observer || !(edges & observer->mask_))
+			continue;
+		if(observer->exclusive_) {
+			if(exclusive)
+				continue;
+			if(observer->readinessChanged(sequence, edges))
+				exclusive = observer;
+			continue;
+		}
+		observer->readinessChanged(sequence, edges);
+	}
+	raising_--;
+
+	if(raising_)
+		return;
+	if(needsCompaction_)
+		compact_();
+
+	// Move the exclusive observer that woke up a waiter to the back of the list
+	// such that the next edge is delivered to a different observer.
+	if(exclusive) {
+		auto it = std::find(observers_.begin(), observers_.end(), exclusive);
+		if(it != observers_.end()) {
+			observers_.erase(it);
+			observers_.push_back(exclusive);
+		}
+	}
+}
+
 // --------------------------------------------------------
 // File implementation.
 // --------------------------------------------------------
@@ -80,6 +166,12 @@ async::result<frg::expected<protocols::fs::Error, size_t>> File::ptWrite(void *o
 			co_return protocols::fs::Error::notConnected;
 		case Error::illegalOperationTarget:
 			co_return protocols::fs::Error::illegalOperationTarget;
+		case Error::wouldBlock:
+			co_return protocols::fs::Error::wouldBlock;
+		case Error::brokenPipe:
+			co_return protocols::fs::Error::brokenPipe;
+		case Error::insufficientPermissions:
+			co_return protocols::fs::Error::insufficientPermissions;
 		default:
 			assert(!"Unexpected error from writeAll()");
 			__builtin_unreachable();
@@ -253,6 +345,10 @@ bool File::isTerminal() {
 	return _defaultOps & defaultIsTerminal;
 }
 
+bool File::isPageCacheBacked() {
+	return _defaultOps & defaultPageCache;
+}
+
 async::result<frg::expected<Error>> File::readExactly(Process *process,
 		void *data, size_t length) {
 	size_t offset = 0;
@@ -309,6 +405,11 @@ async::result<frg::expected<Error, size_t>> File::pwrite(Process *, int64_t, con
 	co_return Error::seekOnPipe;
 }
 
+async::result<frg::expected<Error, size_t>> File::copyFromMemory(helix::BorrowedDescriptor,
+		uint64_t, std::optional<int64_t>, size_t) {
+	co_return Error::illegalOperationTarget;
+}
+
 async::result<ReadEntriesResult> File::readEntries() {
 	std::cout << "posix \e[1;34m" << structName()
 			<< "\e[0m: Object does not implement readEntries()" << std::endl;
@@ -345,6 +446,16 @@ async::result<frg::expected<protocols::fs::Error>> File::allocate(int64_t, size_
 	co_return protocols::fs::Error::illegalOperationTarget;
 }
 
+async::result<frg::expected<Error>> File::sync() {
+	// Like Linux, reject fsync() on pipes, sockets and similar objects.
+	if(!_link || (_defaultOps & defaultPipeLikeSeek))
+		co_return Error::illegalArguments;
+	auto type = _link->getTarget()->getType();
+	if(type == VfsType::fifo || type == VfsType::socket)
+		co_return Error::illegalArguments;
+	co_return {};
+}
+
 async::result<frg::expected<Error, off_t>> File::seek(off_t, VfsSeek) {
 	if(_defaultOps & defaultPipeLikeSeek) {
 		co_return Error::seekOnPipe;
@@ -389,6 +500,16 @@ async::result<frg::expected<Error, PollStatusResult>> File::pollStatus(Process *
 	co_return PollStatusResult{std::get<0>(result), std::get<2>(result)};
 }
 
+ReadinessSource *File::readinessSource() {
+	return nullptr;
+}
+
+frg::expected<Error, PollStatusResult> File::readinessStatus() {
+	std::cout << "posix \e[1;34m" << structName()
+			<< "\e[0m: Object does not implement readinessStatus()" << std::endl;
+	return Error::illegalOperationTarget;
+}
+
 async::result<frg::expected<Error, AcceptResult>> File::accept(Process *) {
 	std::cout << "posix \e[1;34m" << structName()
 			<< "\e[0m: Object does not implement accept()" << std::endl;
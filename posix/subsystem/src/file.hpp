@@ -86,6 +86,9 @@ enum class Error {
 	noSuchProcess,
 
 	noFileDescriptorsAvailable,
+
+	// Corresponds to EBUSY
+	resourceInUse,
 };
 
 inline protocols::fs::Error operator|(Error e, protocols::fs::ToFsProtoError) {
@@ -155,9 +158,10 @@ inline managarm::posix::Errors operator|(Error e, ToPosixProtoError) {
 		case Error::interrupted: return managarm::posix::Errors::INTERRUPTED;
 		case Error::noSuchProcess: return managarm::posix::Errors::NO_SUCH_RESOURCE;
 		case Error::noFileDescriptorsAvailable: return managarm::posix::Errors::NO_FILE_DESCRIPTORS_AVAILABLE;
+		case Error::resourceInUse: return managarm::posix::Errors::RESOURCE_IN_USE;
+		case Error::seekOnPipe: return managarm::posix::Errors::SEEK_ON_PIPE;
 		case Error::fileClosed:
 		case Error::badExecutable:
-		case Error::seekOnPipe:
 		case Error::notConnected:
 		case Error::noSpaceLeft:
 		case Error::notSocket:
@@ -253,6 +257,72 @@ using PollResult = std::tuple<uint64_t, int, int>;
 using PollWaitResult = std::tuple<uint64_t, int>;
 using PollStatusResult = std::tuple<uint64_t, int>;
 
+struct ReadinessSource;
+
+// Receives readiness edges from a ReadinessSource without having to re-issue
+// pollWait() after each edge. Used by epoll to watch large numbers of files.
+struct ReadinessObserver {
+	friend struct ReadinessSource;
+
+	ReadinessObserver() = default;
+
+	ReadinessObserver(const ReadinessObserver &) = delete;
+
+	ReadinessObserver &operator= (const ReadinessObserver &) = delete;
+
+	bool isObserving() {
+		return source_;
+	}
+
+	// Stops observing the source (if any). Safe to call from within readinessChanged().
+	void detach();
+
+	// Called synchronously whenever one of the observed events receives an edge.
+	// Must not block; implementations are expected to merely queue some work.
+	// Returns true if the edge woke up a waiter; for exclusive observers,
+	// the edge is passed on to the next exclusive observer otherwise.
+	virtual bool readinessChanged(uint64_t sequence, int edges) = 0;
+
+protected:
+	virtual ~ReadinessObserver();
+
+private:
+	ReadinessSource *source_ = nullptr;
+	int mask_ = 0;
+	bool exclusive_ = false;
+};
+
+// Publishes readiness edges of a file to all observers.
+// The poll sequence itself is still owned by the file; raise() only forwards it.
+struct ReadinessSource {
+	friend struct ReadinessObserver;
+
+	ReadinessSource() = default;
+
+	ReadinessSource(const ReadinessSource &) = delete;
+
+	~ReadinessSource();
+
+	ReadinessSource &operator= (const ReadinessSource &) = delete;
+
+	// Exclusive observers follow EPOLLEXCLUSIVE semantics: edges are delivered
+	// to exclusive observers (in round-robin order) until one of them wakes up
+	// a waiter, while all non-exclusive observers are notified.
+	void attach(ReadinessObserver *observer, int mask, bool exclusive);
+
+	void raise(uint64_t sequence, int edges);
+
+private:
+	void detach_(ReadinessObserver *observer);
+	void compact_();
+
+	std::vector<ReadinessObserver *> observers_;
+	// Number of active raise() calls. While non-zero, detached observers
+	// are only nulled out so that raise() can safely continue iterating.
+	int raising_ = 0;
+	bool needsCompaction_ = false;
+};
+
 using AcceptResult = smarter::shared_ptr<File, FileHandle>;
 
 struct DisposeFileHandle { };
@@ -262,6 +332,8 @@ enum class FileKind {
 	pidfd,
 	timerfd,
 	inotify,
+	fifo,
+	ioUring,
 };
 
 struct File : private smarter::crtp_counter<File, DisposeFileHandle> {
@@ -273,6 +345,8 @@ public:
 	using DefaultOps = uint32_t;
 	static inline constexpr DefaultOps defaultIsTerminal = 1 << 1;
 	static inline constexpr DefaultOps defaultPipeLikeSeek = 1 << 2;
+	// The file contents (up to the file size) can be read from accessMemory().
+	static inline constexpr DefaultOps defaultPageCache = 1 << 3;
 
 	// ------------------------------------------------------------------------
 	// File protocol adapters.
@@ -409,6 +483,21 @@ public:
 
 	virtual ~File();
 
+	// Records whether the file description was opened for reading and/or writing.
+	// Files that never call this (e.g., sockets) allow both.
+	void setAccessMode(bool readable, bool writable) {
+		_readable = readable;
+		_writable = writable;
+	}
+
+	bool isReadable() {
+		return _readable;
+	}
+
+	bool isWritable() {
+		return _writable;
+	}
+
 // TODO: Make this protected:
 	void setupWeakFile(smarter::weak_ptr<File> ptr) {
 		_weakPtr = std::move(ptr);
@@ -458,6 +547,8 @@ public:
 
 	bool isTerminal();
 
+	bool isPageCacheBacked();
+
 	async::result<frg::expected<Error>> readExactly(Process *process, void *data, size_t length);
 
 	virtual async::result<frg::expected<Error, off_t>>
@@ -479,6 +570,14 @@ public:
 	virtual async::result<frg::expected<Error, size_t>>
 	pwrite(Process *process, int64_t offset, const void *data, size_t length);
 
+	// Writes length bytes at inOffset of memory (usually the accessMemory() of another file)
+	// to the file, at outOffset or at the current position. Servers implement this to
+	// copy data without passing it through posix. Returns illegalOperationTarget
+	// if the file does not support it; callers then fall back to writeAll() or pwrite().
+	virtual async::result<frg::expected<Error, size_t>>
+	copyFromMemory(helix::BorrowedDescriptor memory, uint64_t inOffset,
+			std::optional<int64_t> outOffset, size_t length);
+
 	virtual FutureMaybe<ReadEntriesResult> readEntries();
 
 	virtual async::result<protocols::fs::RecvResult>
@@ -496,6 +595,10 @@ public:
 
 	virtual async::result<frg::expected<protocols::fs::Error>> allocate(int64_t offset, size_t size);
 
+	// Implements fsync() and fdatasync(): writes back the file and waits until it is durable.
+	// By default, this succeeds for files that are not backed by a device.
+	virtual async::result<frg::expected<Error>> sync();
+
 	// poll() uses a sequence number mechansim for synchronization.
 	// Before returning, it waits until current-sequence > in-sequence.
 	// Returns (current-sequence, edges since in-sequence, current events).
@@ -514,6 +617,18 @@ public:
 	// Returns (current-sequence, active events).
 	virtual async::result<frg::expected<Error, PollStatusResult>> pollStatus(Process *);
 
+	// Files that can determine their events synchronously return a ReadinessSource here.
+	// Observers of the source are notified of all edges that pollWait() would report.
+	// Files that are served by other processes only have a source if the server publishes
+	// their status to shared memory and reports their edges in batches (as netserver does
+	// for its sockets, see extern_socket::openReadiness()). For all other files,
+	// epoll keeps one pollWait() operation (and thus one IPC round-trip per readiness change)
+	// outstanding.
+	virtual ReadinessSource *readinessSource();
+
+	// Synchronous version of pollStatus(). Only called if readinessSource() is non-null.
+	virtual frg::expected<Error, PollStatusResult> readinessStatus();
+
 	virtual async::result<frg::expected<Error, AcceptResult>> accept(Process *process);
 
 	virtual async::result<protocols::fs::Error> bind(Process *process,
@@ -563,6 +678,8 @@ private:
 
 	bool _isOpen;
 	bool _append;
+	bool _readable = true;
+	bool _writable = true;
 };
 
 struct DummyFile final : File {
@@ -76,6 +76,11 @@ public:
 	virtual async::result<frg::expected<Error, FsFileStats>> getFsstats() = 0;
 	virtual std::string getFsType() = 0;
 	virtual dev_t deviceNumber() = 0;
+
+	// Implements syncfs(). File systems that are not backed by a device have nothing to do.
+	virtual async::result<frg::expected<Error>> sync() {
+		co_return {};
+	}
 };
 
 FsSuperblock *getAnonymousSuperblock();
@@ -0,0 +1,1129 @@
+#include <atomic>
+#include <deque>
+#include <fcntl.h>
+#include <map>
+#include <limits.h>
+#include <memory>
+#include <poll.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <print>
+
+#include <async/algorithm.hpp>
+#include <async/recurring-event.hpp>
+#include <helix/memory.hpp>
+#include <helix/timer.hpp>
+
+#include "copy-range.hpp"
+#include "fs.hpp"
+#include "io-uring.hpp"
+#include "process.hpp"
+#include "vfs.hpp"
+
+namespace {
+
+bool logUring = false;
+
+constexpr unsigned int maxEntries = 4096;
+constexpr size_t pageSize = 0x1000;
+
+// Upper bound for the amount of data that a single SQE transfers at once.
+constexpr size_t maxTransfer = 0x100000;
+
+// Upper bound for the bounce buffers of all SQEs that are in flight on a ring.
+// SQEs that would exceed it wait until other SQEs complete.
+constexpr size_t maxInflightBytes = 16 * maxTransfer;
+
+constexpr unsigned int supportedSetupFlags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP;
+
+constexpr unsigned int supportedFeatures = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP
+		| IORING_FEAT_SUBMIT_STABLE | IORING_FEAT_RW_CUR_POS;
+
+size_t alignUp(size_t value, size_t alignment) {
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+// CQEs carry negated errno values, hence we need to translate our errors.
+int toErrno(Error e) {
+	switch(e) {
+		case Error::success: return 0;
+		case Error::notDirectory: return ENOTDIR;
+		case Error::noSuchFile: return ENOENT;
+		case Error::eof: return 0;
+		case Error::fileClosed: return EBADF;
+		case Error::badExecutable: return ENOEXEC;
+		case Error::illegalOperationTarget: return EINVAL;
+		case Error::seekOnPipe: return ESPIPE;
+		case Error::wouldBlock: return EAGAIN;
+		case Error::brokenPipe: return EPIPE;
+		case Error::illegalArguments: return EINVAL;
+		case Error::insufficientPermissions: return EPERM;
+		case Error::accessDenied: return EACCES;
+		case Error::notConnected: return ENOTCONN;
+		case Error::alreadyExists: return EEXIST;
+		case Error::notTerminal: return ENOTTY;
+		case Error::noBackingDevice: return ENXIO;
+		case Error::noSpaceLeft: return ENOSPC;
+		case Error::isDirectory: return EISDIR;
+		case Error::noMemory: return ENOMEM;
+		case Error::directoryNotEmpty: return ENOTEMPTY;
+		case Error::ioError: return EIO;
+		case Error::noChildProcesses: return ECHILD;
+		case Error::alreadyConnected: return EISCONN;
+		case Error::unsupportedSocketType: return ESOCKTNOSUPPORT;
+		case Error::notSocket: return ENOTSOCK;
+		case Error::interrupted: return EINTR;
+		case Error::noSuchProcess: return ESRCH;
+		case Error::noFileDescriptorsAvailable: return EMFILE;
+		case Error::resourceInUse: return EBUSY;
+	}
+	return EIO;
+}
+
+int toErrno(protocols::fs::Error e) {
+	switch(e) {
+		case protocols::fs::Error::none: return 0;
+		case protocols::fs::Error::afNotSupported: return EAFNOSUPPORT;
+		case protocols::fs::Error::destAddrRequired: return EDESTADDRREQ;
+		case protocols::fs::Error::netUnreachable: return ENETUNREACH;
+		case protocols::fs::Error::messageSize: return EMSGSIZE;
+		case protocols::fs::Error::hostUnreachable: return EHOSTUNREACH;
+		case protocols::fs::Error::addressInUse: return EADDRINUSE;
+		case protocols::fs::Error::addressNotAvailable: return EADDRNOTAVAIL;
+		case protocols::fs::Error::invalidProtocolOption: return ENOPROTOOPT;
+		case protocols::fs::Error::connectionRefused: return ECONNREFUSED;
+		case protocols::fs::Error::timedOut: return ETIMEDOUT;
+		case protocols::fs::Error::internalError: return EIO;
+		case protocols::fs::Error::nameTooLong: return ENAMETOOLONG;
+		default:
+			return toErrno(e | toPosixError);
+	}
+}
+
+struct PendingCompletion {
+	uint64_t userData;
+	int32_t res;
+	uint32_t flags;
+};
+
+struct OpenFile final : File {
+	OpenFile(unsigned int sqEntries, unsigned int cqEntries)
+	: File{FileKind::ioUring, StructName::get("io_uring")},
+			_sqEntries{sqEntries}, _cqEntries{cqEntries} {
+		// SQ ring header, followed by the SQ index array.
+		_sqOff.head = 0;
+		_sqOff.tail = 4;
+		_sqOff.ring_mask = 8;
+		_sqOff.ring_entries = 12;
+		_sqOff.flags = 16;
+		_sqOff.dropped = 20;
+		_sqOff.array = 64;
+
+		// CQ ring header, followed by the CQEs.
+		uint32_t cqBase = alignUp(_sqOff.array + sizeof(uint32_t) * _sqEntries, 64);
+		_cqOff.head = cqBase;
+		_cqOff.tail = cqBase + 4;
+		_cqOff.ring_mask = cqBase + 8;
+		_cqOff.ring_entries = cqBase + 12;
+		_cqOff.overflow = cqBase + 16;
+		_cqOff.flags = cqBase + 20;
+		_cqOff.cqes = cqBase + 64;
+
+		// The rings and the SQEs live in separate memory objects. Userspace maps the
+		// SQEs at the fixed offset IORING_OFF_SQES, see io_uring::accessRegion().
+		_layout.mmapSize = alignUp(_cqOff.cqes + sizeof(struct io_uring_cqe) * _cqEntries,
+				pageSize);
+		_layout.sqesOffset = IORING_OFF_SQES;
+		_sqesSize = alignUp(sizeof(struct io_uring_sqe) * _sqEntries, pageSize);
+
+		HelHandle handle;
+		HEL_CHECK(helAllocateMemory(_layout.mmapSize, 0, nullptr, &handle));
+		_ringMemory = helix::UniqueDescriptor{handle};
+		_ringMapping = helix::Mapping{_ringMemory, 0, _layout.mmapSize};
+
+		HEL_CHECK(helAllocateMemory(_sqesSize, 0, nullptr, &handle));
+		_sqesMemory = helix::UniqueDescriptor{handle};
+		_sqesMapping = helix::Mapping{_sqesMemory, 0, _sqesSize};
+
+		_word(_sqOff.ring_mask) = _sqEntries - 1;
+		_word(_sqOff.ring_entries) = _sqEntries;
+		_word(_cqOff.ring_mask) = _cqEntries - 1;
+		_word(_cqOff.ring_entries) = _cqEntries;
+	}
+
+	static void serve(smarter::shared_ptr<OpenFile> file) {
+		helix::UniqueLane lane;
+		std::tie(lane, file->_passthrough) = helix::createStream();
+		async::detach(protocols::fs::servePassthrough(std::move(lane),
+				smarter::shared_ptr<File>{file}, &File::fileOperations, file->_cancelServe));
+	}
+
+	void fillParams(struct io_uring_params *params) {
+		params->sq_entries = _sqEntries;
+		params->cq_entries = _cqEntries;
+		params->features = supportedFeatures;
+		params->sq_off = _sqOff;
+		params->cq_off = _cqOff;
+	}
+
+	Layout layout() {
+		return _layout;
+	}
+
+	frg::expected<Error, helix::UniqueDescriptor> accessRegion(uint64_t offset, size_t size) {
+		// With IORING_FEAT_SINGLE_MMAP, the CQ ring is part of the SQ ring mapping.
+		if(offset == IORING_OFF_SQ_RING || offset == IORING_OFF_CQ_RING) {
+			if(size > _layout.mmapSize)
+				return Error::illegalArguments;
+			return _ringMemory.dup();
+		}else if(offset == IORING_OFF_SQES) {
+			if(size > _sqesSize)
+				return Error::illegalArguments;
+			return _sqesMemory.dup();
+		}
+		return Error::illegalArguments;
+	}
+
+	// --------------------------------------------------------------------
+	// Submission.
+	// --------------------------------------------------------------------
+
+	unsigned int submit(std::shared_ptr<Process> process, unsigned int toSubmit) {
+		auto head = _sqHead;
+		auto tail = _atomic(_sqOff.tail).load(std::memory_order_acquire);
+
+		// Transfers from and to the page cache are grouped by file. Each group is
+		// performed by a single coroutine, without bounce buffers and without requests
+		// to the fs server (except for the file size), see _runPageCacheBatch().
+		std::map<int, std::pair<SharedFilePtr, std::vector<struct io_uring_sqe>>> batches;
+
+		unsigned int submitted = 0;
+		while(submitted < toSubmit && head != tail) {
+			auto index = _array()[head & (_sqEntries - 1)];
+			head++;
+
+			if(index >= _sqEntries) {
+				_atomic(_sqOff.dropped).fetch_add(1, std::memory_order_relaxed);
+				continue;
+			}
+
+			// Copy the SQE such that userspace can re-use the slot immediately.
+			struct io_uring_sqe sqe;
+			memcpy(&sqe, _sqes() + index, sizeof(struct io_uring_sqe));
+			submitted++;
+
+			if(auto file = _pageCacheTransferTarget(process.get(), sqe); file) {
+				auto &batch = batches[sqe.fd];
+				batch.first = std::move(file);
+				batch.second.push_back(sqe);
+				continue;
+			}
+			async::detach(_runOperation(process, sqe));
+		}
+
+		for(auto &[fd, batch] : batches)
+			async::detach(_runPageCacheBatch(process, std::move(batch.first),
+					std::move(batch.second)));
+
+		_sqHead = head;
+		_atomic(_sqOff.head).store(head, std::memory_order_release);
+		if(submitted)
+			_raiseStatus(EPOLLOUT);
+		return submitted;
+	}
+
+	async::result<frg::expected<Error>>
+	waitForCompletions(unsigned int minComplete, async::cancellation_token ct) {
+		while(true) {
+			_flushOverflow();
+			if(_completionsReady() >= minComplete)
+				co_return {};
+			if(ct.is_cancellation_requested())
+				co_return Error::interrupted;
+			co_await _completionBell.async_wait(ct);
+		}
+	}
+
+	// --------------------------------------------------------------------
+	// File implementation.
+	// --------------------------------------------------------------------
+
+	void handleClose() override {
+		_cancelOperations.cancel();
+		_cancelServe.cancel();
+	}
+
+	FutureMaybe<helix::UniqueDescriptor> accessMemory() override {
+		co_return _ringMemory.dup();
+	}
+
+	async::result<frg::expected<Error, PollWaitResult>>
+	pollWait(Process *, uint64_t pastSeq, int mask,
+			async::cancellation_token cancellation) override {
+		(void)mask; // TODO: utilize mask.
+		assert(pastSeq <= _currentSeq);
+		while(pastSeq == _currentSeq && !cancellation.is_cancellation_requested())
+			co_await _statusBell.async_wait(cancellation);
+
+		int edges = 0;
+		if(_inSeq > pastSeq)
+			edges |= EPOLLIN;
+		if(_outSeq > pastSeq)
+			edges |= EPOLLOUT;
+		co_return PollWaitResult{_currentSeq, edges};
+	}
+
+	async::result<frg::expected<Error, PollStatusResult>>
+	pollStatus(Process *) override {
+		co_return readinessStatus();
+	}
+
+	ReadinessSource *readinessSource() override {
+		return &_readiness;
+	}
+
+	frg::expected<Error, PollStatusResult> readinessStatus() override {
+		int events = 0;
+		if(_completionsReady())
+			events |= EPOLLIN;
+		if(_atomic(_sqOff.tail).load(std::memory_order_acquire) - _sqHead < _sqEntries)
+			events |= EPOLLOUT;
+		return PollStatusResult{_currentSeq, events};
+	}
+
+	helix::BorrowedDescriptor getPassthroughLane() override {
+		return _passthrough;
+	}
+
+private:
+	// --------------------------------------------------------------------
+	// Ring access.
+	// --------------------------------------------------------------------
+
+	uint32_t &_word(uint32_t offset) {
+		return *reinterpret_cast<uint32_t *>(
+				reinterpret_cast<std::byte *>(_ringMapping.get()) + offset);
+	}
+
+	std::atomic_ref<uint32_t> _atomic(uint32_t offset) {
+		return std::atomic_ref<uint32_t>{_word(offset)};
+	}
+
+	uint32_t *_array() {
+		return &_word(_sqOff.array);
+	}
+
+	struct io_uring_sqe *_sqes() {
+		return reinterpret_cast<struct io_uring_sqe *>(_sqesMapping.get());
+	}
+
+	struct io_uring_cqe *_cqes() {
+		return reinterpret_cast<struct io_uring_cqe *>(&_word(_cqOff.cqes));
+	}
+
+	uint32_t _completionsReady() {
+		return _cqTail - _atomic(_cqOff.head).load(std::memory_order_acquire);
+	}
+
+	bool _pushCompletion(const PendingCompletion &completion) {
+		if(_completionsReady() == _cqEntries)
+			return false;
+
+		auto cqe = _cqes() + (_cqTail & (_cqEntries - 1));
+		cqe->user_data = completion.userData;
+		cqe->res = completion.res;
+		cqe->flags = completion.flags;
+		_cqTail++;
+		_atomic(_cqOff.tail).store(_cqTail, std::memory_order_release);
+		return true;
+	}
+
+	// Completions that do not fit into the CQ are kept until userspace
+	// consumes some CQEs (IORING_FEAT_NODROP).
+	void _flushOverflow() {
+		bool progress = false;
+		while(!_overflow.empty() && _pushCompletion(_overflow.front())) {
+			_overflow.pop_front();
+			progress = true;
+		}
+		if(_overflow.empty())
+			_atomic(_sqOff.flags).fetch_and(~IORING_SQ_CQ_OVERFLOW, std::memory_order_relaxed);
+		if(progress)
+			_raiseStatus(EPOLLIN);
+	}
+
+	void _complete(uint64_t userData, int32_t res, uint32_t flags = 0) {
+		if(logUring)
+			std::println("posix.io_uring: Completing {:#x} with {}", userData, res);
+
+		PendingCompletion completion{userData, res, flags};
+		if(!_overflow.empty() || !_pushCompletion(completion)) {
+			_overflow.push_back(completion);
+			_atomic(_sqOff.flags).fetch_or(IORING_SQ_CQ_OVERFLOW, std::memory_order_relaxed);
+			_atomic(_cqOff.overflow).fetch_add(1, std::memory_order_relaxed);
+		}
+
+		_numCompletions++;
+		_completionBell.raise();
+		_raiseStatus(EPOLLIN);
+	}
+
+	void _raiseStatus(int edges) {
+		++_currentSeq;
+		if(edges & EPOLLIN)
+			_inSeq = _currentSeq;
+		if(edges & EPOLLOUT)
+			_outSeq = _currentSeq;
+		_statusBell.raise();
+		_readiness.raise(_currentSeq, edges);
+	}
+
+	// --------------------------------------------------------------------
+	// Operations.
+	// --------------------------------------------------------------------
+
+	async::result<void> _runOperation(std::shared_ptr<Process> process, struct io_uring_sqe sqe) {
+		// Keep the ring alive until the operation completes.
+		auto self = smarter::static_pointer_cast<OpenFile>(weakFile().lock());
+
+		int32_t res;
+		if(sqe.flags & ~IOSQE_ASYNC) {
+			// Linked, drained and fixed-file SQEs are not supported yet.
+			res = -EINVAL;
+		}else{
+			res = co_await _perform(process.get(), sqe);
+		}
+		_complete(sqe.user_data, res);
+	}
+
+	// Returns the file if sqe reads from or writes to the page cache at an explicit offset.
+	SharedFilePtr _pageCacheTransferTarget(Process *process, const struct io_uring_sqe &sqe) {
+		if(sqe.opcode != IORING_OP_READ && sqe.opcode != IORING_OP_READV
+				&& sqe.opcode != IORING_OP_WRITE && sqe.opcode != IORING_OP_WRITEV)
+			return {};
+		if(sqe.flags & ~IOSQE_ASYNC)
+			return {};
+		if(sqe.off == static_cast<uint64_t>(-1))
+			return {};
+		auto file = process->fileContext()->getFile(sqe.fd);
+		if(!file || !file->isPageCacheBacked())
+			return {};
+		return file;
+	}
+
+	async::result<void> _runPageCacheBatch(std::shared_ptr<Process> process,
+			SharedFilePtr file, std::vector<struct io_uring_sqe> sqes) {
+		// Keep the ring alive until the operations complete.
+		auto self = smarter::static_pointer_cast<OpenFile>(weakFile().lock());
+
+		auto memory = co_await file->accessMemory();
+		auto stats = co_await file->associatedLink()->getTarget()->getStats();
+
+		for(auto &sqe : sqes) {
+			if(!stats) {
+				_complete(sqe.user_data, -toErrno(stats.error()));
+				continue;
+			}
+			auto fileSize = stats.value().fileSize;
+
+			bool isWrite = sqe.opcode == IORING_OP_WRITE || sqe.opcode == IORING_OP_WRITEV;
+			if(isWrite ? !file->isWritable() : !file->isReadable()) {
+				_complete(sqe.user_data, -EBADF);
+				continue;
+			}
+
+			auto iovsOrError = co_await _fetchIovecs(process.get(), sqe);
+			if(!iovsOrError) {
+				_complete(sqe.user_data, iovsOrError.error());
+				continue;
+			}
+			auto iovs = std::move(iovsOrError.value());
+
+			size_t total = 0;
+			for(auto &iov : iovs)
+				total += iov.iov_len;
+			total = std::min(total, maxTransfer);
+
+			// Writes that extend the file need the fs server to allocate blocks
+			// and update the file size.
+			if(isWrite && sqe.off + total > fileSize) {
+				_complete(sqe.user_data, co_await _perform(process.get(), sqe));
+				continue;
+			}
+			if(sqe.off >= fileSize) {
+				_complete(sqe.user_data, 0);
+				continue;
+			}
+			total = std::min(total, static_cast<size_t>(fileSize - sqe.off));
+
+			_complete(sqe.user_data, co_await _transferPageCache(process.get(),
+					memory, sqe.off, iovs, total, isWrite));
+		}
+	}
+
+	// Copies between the user's buffers and locked windows of the page cache.
+	// Returns the number of bytes transferred or a negated errno value.
+	async::result<int32_t> _transferPageCache(Process *process, helix::BorrowedDescriptor memory,
+			uint64_t offset, const std::vector<struct iovec> &iovs, size_t length, bool isWrite) {
+		size_t progress = 0;
+		size_t iovIndex = 0;
+		size_t iovProgress = 0;
+		while(progress < length) {
+			size_t chunk = std::min(copy_range::windowSize - ((offset + progress) & (pageSize - 1)),
+					length - progress);
+			auto window = co_await copy_range::lockWindow(memory, offset + progress, chunk,
+					isWrite ? (kHelMapProtRead | kHelMapProtWrite) : kHelMapProtRead);
+			if(!window) {
+				// The file was truncated concurrently.
+				if(progress)
+					break;
+				co_return -toErrno(window.error());
+			}
+
+			size_t windowProgress = 0;
+			while(windowProgress < chunk) {
+				auto &iov = iovs[iovIndex];
+				auto piece = std::min(iov.iov_len - iovProgress, chunk - windowProgress);
+				auto address = reinterpret_cast<uintptr_t>(iov.iov_base) + iovProgress;
+				auto data = window.value().data() + windowProgress;
+
+				HelError error;
+				if(isWrite) {
+					auto load = co_await helix_ng::readMemory(process->vmContext()->getSpace(),
+							address, piece, data);
+					error = load.error();
+				}else{
+					auto store = co_await helix_ng::writeMemory(process->vmContext()->getSpace(),
+							address, piece, data);
+					error = store.error();
+				}
+				if(error) {
+					progress += windowProgress;
+					co_return progress ? static_cast<int32_t>(progress) : -EFAULT;
+				}
+
+				windowProgress += piece;
+				iovProgress += piece;
+				if(iovProgress == iov.iov_len) {
+					iovIndex++;
+					iovProgress = 0;
+				}
+			}
+			progress += chunk;
+		}
+		co_return progress;
+	}
+
+	async::result<int32_t> _perform(Process *process, const struct io_uring_sqe &sqe) {
+		if(logUring)
+			std::println("posix.io_uring: Performing opcode {} on fd {}", sqe.opcode, sqe.fd);
+
+		switch(sqe.opcode) {
+			case IORING_OP_NOP:
+				co_return 0;
+			case IORING_OP_READ:
+			case IORING_OP_READV:
+			case IORING_OP_RECV:
+				co_return co_await _performRead(process, sqe);
+			case IORING_OP_WRITE:
+			case IORING_OP_WRITEV:
+			case IORING_OP_SEND:
+				co_return co_await _performWrite(process, sqe);
+			case IORING_OP_ACCEPT:
+				co_return co_await _performAccept(process, sqe);
+			case IORING_OP_OPENAT:
+				co_return co_await _performOpenAt(process, sqe);
+			case IORING_OP_CLOSE: {
+				auto error = process->fileContext()->closeFile(sqe.fd);
+				if(error == Error::noSuchFile)
+					co_return -EBADF;
+				co_return -toErrno(error);
+			}
+			case IORING_OP_FSYNC: {
+				auto file = process->fileContext()->getFile(sqe.fd);
+				if(!file)
+					co_return -EBADF;
+				auto result = co_await file->sync();
+				if(!result)
+					co_return -toErrno(result.error());
+				co_return 0;
+			}
+			case IORING_OP_TIMEOUT:
+				co_return co_await _performTimeout(process, sqe);
+			case IORING_OP_POLL_ADD:
+				co_return co_await _performPoll(process, sqe);
+			default:
+				std::println("posix.io_uring: Unsupported opcode {}", sqe.opcode);
+				co_return -EINVAL;
+		}
+	}
+
+	// Reads the iovec array of a READV/WRITEV SQE (or synthesizes a single
+	// iovec for the other opcodes).
+	async::result<std::expected<std::vector<struct iovec>, int32_t>>
+	_fetchIovecs(Process *process, const struct io_uring_sqe &sqe) {
+		std::vector<struct iovec> iovs;
+		if(sqe.opcode == IORING_OP_READV || sqe.opcode == IORING_OP_WRITEV) {
+			if(sqe.len > IOV_MAX)
+				co_return std::unexpected{-EINVAL};
+			iovs.resize(sqe.len);
+			auto load = co_await helix_ng::readMemory(process->vmContext()->getSpace(),
+					sqe.addr, sizeof(struct iovec) * sqe.len, iovs.data());
+			if(load.error())
+				co_return std::unexpected{-EFAULT};
+		}else{
+			iovs.push_back({reinterpret_cast<void *>(sqe.addr), sqe.len});
+		}
+		co_return std::move(iovs);
+	}
+
+	// Bounce buffer of an SQE. Its size counts against the ring's in-flight
+	// budget until it is destructed. The memory is not initialized.
+	struct TransferBuffer {
+		TransferBuffer(OpenFile *ring, size_t size)
+		: _ring{ring}, _size{size}, _data{std::make_unique_for_overwrite<char[]>(size)} {
+			_ring->_inflightBytes += _size;
+		}
+
+		TransferBuffer(const TransferBuffer &) = delete;
+		TransferBuffer &operator= (const TransferBuffer &) = delete;
+
+		~TransferBuffer() {
+			_ring->_inflightBytes -= _size;
+			_ring->_transferBell.raise();
+		}
+
+		char *data() { return _data.get(); }
+		size_t size() { return _size; }
+
+	private:
+		OpenFile *_ring;
+		size_t _size;
+		std::unique_ptr<char[]> _data;
+	};
+
+	// Waits until a TransferBuffer of the given size fits into the in-flight budget.
+	// Returns false if the ring is closed in the meantime.
+	async::result<bool> _waitForTransferBudget(size_t size) {
+		while(_inflightBytes + size > maxInflightBytes) {
+			if(_cancelOperations.is_cancellation_requested())
+				co_return false;
+			co_await _transferBell.async_wait(_cancelOperations);
+		}
+		co_return !_cancelOperations.is_cancellation_requested();
+	}
+
+	// Waits until the file reports one of the events in mask (or an error or hangup).
+	// Returns the reported events or a negated errno value.
+	async::result<int32_t> _waitForEvents(Process *process, File *file, int mask) {
+		mask |= EPOLLERR | EPOLLHUP;
+
+		auto statusOrError = co_await file->pollStatus(process);
+		if(!statusOrError)
+			co_return -toErrno(statusOrError.error());
+		auto sequence = std::get<0>(statusOrError.value());
+		auto status = std::get<1>(statusOrError.value()) & mask;
+
+		while(!status) {
+			auto waitOrError = co_await file->pollWait(process, sequence, mask, _cancelOperations);
+			if(!waitOrError)
+				co_return -toErrno(waitOrError.error());
+			if(_cancelOperations.is_cancellation_requested())
+				co_return -ECANCELED;
+
+			statusOrError = co_await file->pollStatus(process);
+			if(!statusOrError)
+				co_return -toErrno(statusOrError.error());
+			sequence = std::get<0>(statusOrError.value());
+			status = std::get<1>(statusOrError.value()) & mask;
+		}
+		co_return status;
+	}
+
+	// Operations that can block indefinitely (RECV, SEND, ACCEPT and writes to
+	// files that are not backed by the page cache) first wait for readiness,
+	// such that closing the ring cancels them. RECV and SEND are then performed
+	// with MSG_DONTWAIT and re-armed if another reader or writer was faster.
+
+	async::result<int32_t> _performRead(Process *process, const struct io_uring_sqe &sqe) {
+		auto file = process->fileContext()->getFile(sqe.fd);
+		if(!file)
+			co_return -EBADF;
+
+		auto iovsOrError = co_await _fetchIovecs(process, sqe);
+		if(!iovsOrError)
+			co_return iovsOrError.error();
+		auto iovs = std::move(iovsOrError.value());
+
+		size_t total = 0;
+		for(auto &iov : iovs)
+			total += iov.iov_len;
+		auto size = std::min(total, maxTransfer);
+
+		bool isRecv = sqe.opcode == IORING_OP_RECV;
+		bool mayWait = isRecv && !(sqe.msg_flags & MSG_DONTWAIT);
+
+		while(true) {
+			if(mayWait) {
+				auto events = co_await _waitForEvents(process, file.get(), EPOLLIN);
+				if(events < 0)
+					co_return events;
+			}
+
+			if(!(co_await _waitForTransferBudget(size)))
+				co_return -ECANCELED;
+			TransferBuffer buffer{this, size};
+
+			size_t length;
+			if(isRecv) {
+				auto result = co_await file->recvMsg(process, sqe.msg_flags | MSG_DONTWAIT,
+						buffer.data(), buffer.size(), nullptr, 0, 0);
+				if(auto error = std::get_if<protocols::fs::Error>(&result); error) {
+					if(*error == protocols::fs::Error::wouldBlock && mayWait)
+						continue;
+					co_return -toErrno(*error);
+				}
+				length = std::get<protocols::fs::RecvData>(result).dataLength;
+			}else if(sqe.off == static_cast<uint64_t>(-1)) {
+				auto result = co_await file->readSome(process, buffer.data(), buffer.size(),
+						_cancelOperations);
+				if(_cancelOperations.is_cancellation_requested())
+					co_return -ECANCELED;
+				if(!result)
+					co_return result.error() == Error::eof ? 0 : -toErrno(result.error());
+				length = result.value();
+			}else{
+				auto result = co_await file->pread(process, sqe.off, buffer.data(), buffer.size());
+				if(!result)
+					co_return result.error() == Error::eof ? 0 : -toErrno(result.error());
+				length = result.value();
+			}
+
+			// Scatter the data into the user's buffers.
+			size_t progress = 0;
+			for(auto &iov : iovs) {
+				if(progress == length)
+					break;
+				auto chunk = std::min(iov.iov_len, length - progress);
+				auto store = co_await helix_ng::writeMemory(process->vmContext()->getSpace(),
+						reinterpret_cast<uintptr_t>(iov.iov_base), chunk, buffer.data() + progress);
+				if(store.error())
+					co_return -EFAULT;
+				progress += chunk;
+			}
+			co_return length;
+		}
+	}
+
+	async::result<int32_t> _performWrite(Process *process, const struct io_uring_sqe &sqe) {
+		auto file = process->fileContext()->getFile(sqe.fd);
+		if(!file)
+			co_return -EBADF;
+
+		auto iovsOrError = co_await _fetchIovecs(process, sqe);
+		if(!iovsOrError)
+			co_return iovsOrError.error();
+		auto iovs = std::move(iovsOrError.value());
+
+		size_t total = 0;
+		for(auto &iov : iovs)
+			total += iov.iov_len;
+		auto size = std::min(total, maxTransfer);
+
+		bool isSend = sqe.opcode == IORING_OP_SEND;
+		bool mayWait;
+		if(isSend)
+			mayWait = !(sqe.msg_flags & MSG_DONTWAIT);
+		else
+			mayWait = sqe.off == static_cast<uint64_t>(-1) && !file->isPageCacheBacked();
+
+		while(true) {
+			if(mayWait) {
+				auto events = co_await _waitForEvents(process, file.get(), EPOLLOUT);
+				if(events < 0)
+					co_return events;
+			}
+
+			if(!(co_await _waitForTransferBudget(size)))
+				co_return -ECANCELED;
+			TransferBuffer buffer{this, size};
+
+			// Gather the user's buffers.
+			size_t progress = 0;
+			for(auto &iov : iovs) {
+				if(progress == size)
+					break;
+				auto chunk = std::min(iov.iov_len, size - progress);
+				auto load = co_await helix_ng::readMemory(process->vmContext()->getSpace(),
+						reinterpret_cast<uintptr_t>(iov.iov_base), chunk, buffer.data() + progress);
+				if(load.error())
+					co_return -EFAULT;
+				progress += chunk;
+			}
+
+			if(isSend) {
+				struct ucred creds;
+				memset(&creds, 0, sizeof(struct ucred));
+				auto result = co_await file->sendMsg(process, sqe.msg_flags | MSG_DONTWAIT,
+						buffer.data(), buffer.size(), nullptr, 0, {}, creds);
+				if(!result) {
+					if(result.error() == protocols::fs::Error::wouldBlock && mayWait)
+						continue;
+					co_return -toErrno(result.error());
+				}
+				co_return result.value();
+			}else if(sqe.off == static_cast<uint64_t>(-1)) {
+				auto result = co_await file->writeAll(process, buffer.data(), buffer.size());
+				if(!result)
+					co_return -toErrno(result.error());
+				co_return result.value();
+			}else{
+				auto result = co_await file->pwrite(process, sqe.off, buffer.data(), buffer.size());
+				if(!result)
+					co_return -toErrno(result.error());
+				co_return result.value();
+			}
+		}
+	}
+
+	async::result<int32_t> _performAccept(Process *process, const struct io_uring_sqe &sqe) {
+		auto file = process->fileContext()->getFile(sqe.fd);
+		if(!file)
+			co_return -EBADF;
+		if(sqe.accept_flags & ~(SOCK_NONBLOCK | SOCK_CLOEXEC))
+			co_return -EINVAL;
+
+		auto events = co_await _waitForEvents(process, file.get(), EPOLLIN);
+		if(events < 0)
+			co_return events;
+
+		auto acceptResult = co_await file->accept(process);
+		if(!acceptResult)
+			co_return -toErrno(acceptResult.error());
+		auto newFile = acceptResult.value();
+
+		if(sqe.accept_flags & SOCK_NONBLOCK)
+			co_await newFile->setFileFlags(O_NONBLOCK);
+
+		if(sqe.addr) {
+			socklen_t addrLength;
+			auto load = co_await helix_ng::readMemory(process->vmContext()->getSpace(),
+					sqe.addr2, sizeof(socklen_t), &addrLength);
+			if(load.error())
+				co_return -EFAULT;
+
+			std::vector<char> addr(std::min(addrLength, socklen_t{sizeof(struct sockaddr_storage)}));
+			auto peerResult = co_await newFile->peername(addr.data(), addr.size());
+			if(peerResult) {
+				addrLength = peerResult.value();
+				auto store = co_await helix_ng::writeMemory(process->vmContext()->getSpace(),
+						sqe.addr, std::min(addr.size(), size_t{addrLength}), addr.data());
+				if(store.error())
+					co_return -EFAULT;
+				store = co_await helix_ng::writeMemory(process->vmContext()->getSpace(),
+						sqe.addr2, sizeof(socklen_t), &addrLength);
+				if(store.error())
+					co_return -EFAULT;
+			}
+		}
+
+		auto fd = process->fileContext()->attachFile(std::move(newFile),
+				sqe.accept_flags & SOCK_CLOEXEC);
+		if(!fd)
+			co_return -toErrno(fd.error());
+		co_return fd.value();
+	}
+
+	// Reads a NUL-terminated path from the user's address space.
+	async::result<std::expected<std::string, int32_t>>
+	_fetchPath(Process *process, uintptr_t address) {
+		std::string path;
+		while(path.size() <= PATH_MAX) {
+			// Never read across a page boundary, as the next page might not be mapped.
+			char chunk[256];
+			auto length = std::min(sizeof(chunk), pageSize - (address & (pageSize - 1)));
+			auto load = co_await helix_ng::readMemory(process->vmContext()->getSpace(),
+					address, length, chunk);
+			if(load.error())
+				co_return std::unexpected{-EFAULT};
+
+			auto end = static_cast<char *>(memchr(chunk, 0, length));
+			if(end) {
+				path.append(chunk, end);
+				co_return std::move(path);
+			}
+			path.append(chunk, length);
+			address += length;
+		}
+		co_return std::unexpected{-ENAMETOOLONG};
+	}
+
+	async::result<int32_t> _performOpenAt(Process *process, const struct io_uring_sqe &sqe) {
+		auto flags = sqe.open_flags;
+		if(flags & ~(O_ACCMODE | O_CREAT | O_EXCL | O_NONBLOCK | O_CLOEXEC | O_TRUNC
+				| O_NOCTTY | O_APPEND | O_NOFOLLOW | O_DIRECTORY))
+			co_return -EINVAL;
+
+		auto pathOrError = co_await _fetchPath(process, sqe.addr);
+		if(!pathOrError)
+			co_return pathOrError.error();
+
+		SemanticFlags semanticFlags = 0;
+		if(flags & O_NONBLOCK)
+			semanticFlags |= semanticNonBlock;
+		if((flags & O_ACCMODE) == O_RDONLY)
+			semanticFlags |= semanticRead;
+		else if((flags & O_ACCMODE) == O_WRONLY)
+			semanticFlags |= semanticWrite;
+		else if((flags & O_ACCMODE) == O_RDWR)
+			semanticFlags |= semanticRead | semanticWrite;
+		if(flags & O_APPEND)
+			semanticFlags |= semanticAppend;
+
+		ViewPath relativeTo;
+		if(sqe.fd == AT_FDCWD) {
+			relativeTo = process->fsContext()->getWorkingDirectory();
+		}else{
+			auto dir = process->fileContext()->getFile(sqe.fd);
+			if(!dir)
+				co_return -EBADF;
+			relativeTo = {dir->associatedMount(), dir->associatedLink()};
+		}
+
+		PathResolver resolver;
+		resolver.setup(process->fsContext()->getRoot(),
+				relativeTo, std::move(pathOrError.value()), process);
+
+		smarter::shared_ptr<File, FileHandle> file;
+		if(flags & O_CREAT) {
+			auto resolveResult = co_await resolver.resolve(resolvePrefix | resolveNoTrailingSlash);
+			if(!resolveResult)
+				co_return -toErrno(resolveResult.error());
+			if(!resolver.hasComponent())
+				co_return (flags & O_ACCMODE) != O_RDONLY ? -EISDIR : -EEXIST;
+
+			auto directory = resolver.currentLink()->getTarget();
+			auto linkResult = co_await directory->getLinkOrCreate(process, resolver.nextComponent(),
+					sqe.len & ~process->fsContext()->getUmask(), flags & O_EXCL);
+			if(!linkResult)
+				co_return -toErrno(linkResult.error());
+			auto link = linkResult.value();
+			auto node = link->getTarget();
+
+			auto fileResult = co_await node->open(resolver.currentView(), std::move(link),
+					semanticFlags);
+			if(!fileResult)
+				co_return -toErrno(fileResult.error());
+			file = fileResult.value();
+		}else{
+			ResolveFlags resolveFlags = 0;
+			if(flags & O_NOFOLLOW)
+				resolveFlags |= resolveDontFollow;
+
+			auto resolveResult = co_await resolver.resolve(resolveFlags);
+			if(!resolveResult)
+				co_return -toErrno(resolveResult.error());
+
+			auto target = resolver.currentLink()->getTarget();
+			if((flags & O_DIRECTORY) && target->getType() != VfsType::directory)
+				co_return -ENOTDIR;
+			if(target->getType() == VfsType::symlink)
+				co_return -ELOOP;
+
+			auto fileResult = co_await target->open(resolver.currentView(),
+					resolver.currentLink(), semanticFlags);
+			if(!fileResult)
+				co_return -toErrno(fileResult.error());
+			file = fileResult.value();
+		}
+		if(!file)
+			co_return -ENOENT;
+		file->setAccessMode(semanticFlags & semanticRead, semanticFlags & semanticWrite);
+
+		if(flags & O_TRUNC) {
+			auto result = co_await file->truncate(0);
+			if(!result && result.error() != protocols::fs::Error::illegalOperationTarget)
+				co_return -toErrno(result.error());
+		}
+
+		auto fd = process->fileContext()->attachFile(std::move(file), flags & O_CLOEXEC);
+		if(!fd)
+			co_return -toErrno(fd.error());
+		co_return fd.value();
+	}
+
+	async::result<int32_t> _performTimeout(Process *process, const struct io_uring_sqe &sqe) {
+		if(sqe.len != 1 || (sqe.timeout_flags & ~IORING_TIMEOUT_ABS))
+			co_return -EINVAL;
+
+		struct __kernel_timespec ts;
+		auto load = co_await helix_ng::readMemory(process->vmContext()->getSpace(),
+				sqe.addr, sizeof(ts), &ts);
+		if(load.error())
+			co_return -EFAULT;
+
+		int64_t ns = ts.tv_sec * 1'000'000'000 + ts.tv_nsec;
+		if(sqe.timeout_flags & IORING_TIMEOUT_ABS) {
+			uint64_t now;
+			HEL_CHECK(helGetClock(&now));
+			ns -= now;
+		}
+
+		// A non-zero count completes the timeout early once that many other
+		// completions have been posted.
+		auto target = _numCompletions + sqe.off;
+		bool expired = false;
+		co_await async::race_and_cancel(
+			async::lambda([&](async::cancellation_token c) -> async::result<void> {
+				if(ns > 0)
+					co_await helix::sleepFor(ns, c);
+				if(!c.is_cancellation_requested())
+					expired = true;
+			}),
+			async::lambda([&](async::cancellation_token c) -> async::result<void> {
+				if(!sqe.off) {
+					co_await async::suspend_indefinitely(c);
+					co_return;
+				}
+				while(_numCompletions < target && !c.is_cancellation_requested())
+					co_await _completionBell.async_wait(c);
+			}),
+			async::lambda([&](async::cancellation_token c) -> async::result<void> {
+				co_await async::suspend_indefinitely(c, _cancelOperations);
+			})
+		);
+
+		if(expired)
+			co_return -ETIME;
+		if(_numCompletions >= target && sqe.off)
+			co_return 0;
+		co_return -ECANCELED;
+	}
+
+	async::result<int32_t> _performPoll(Process *process, const struct io_uring_sqe &sqe) {
+		auto file = process->fileContext()->getFile(sqe.fd);
+		if(!file)
+			co_return -EBADF;
+
+		// POLL* and EPOLL* constants coincide for the events that we support.
+		int mask = sqe.poll32_events & (POLLIN | POLLOUT | POLLPRI | POLLRDHUP);
+		co_return co_await _waitForEvents(process, file.get(), mask);
+	}
+
+	helix::UniqueLane _passthrough;
+	async::cancellation_event _cancelServe;
+	async::cancellation_event _cancelOperations;
+
+	unsigned int _sqEntries;
+	unsigned int _cqEntries;
+	struct io_sqring_offsets _sqOff{};
+	struct io_cqring_offsets _cqOff{};
+	Layout _layout;
+	size_t _sqesSize;
+
+	helix::UniqueDescriptor _ringMemory;
+	helix::Mapping _ringMapping;
+	helix::UniqueDescriptor _sqesMemory;
+	helix::Mapping _sqesMapping;
+
+	// Private copies of the indices that we own. Userspace may only read them.
+	uint32_t _sqHead = 0;
+	uint32_t _cqTail = 0;
+
+	std::deque<PendingCompletion> _overflow;
+	uint64_t _numCompletions = 0;
+	async::recurring_event _completionBell;
+
+	size_t _inflightBytes = 0;
+	async::recurring_event _transferBell;
+
+	async::recurring_event _statusBell;
+	ReadinessSource _readiness;
+	uint64_t _currentSeq = 1;
+	uint64_t _inSeq = 0;
+	uint64_t _outSeq = 1;
+};
+
+unsigned int roundUpToPowerOfTwo(unsigned int n) {
+	unsigned int result = 1;
+	while(result < n)
+		result <<= 1;
+	return result;
+}
+
+} // anonymous namespace
+
+namespace io_uring {
+
+frg::expected<Error, std::pair<smarter::shared_ptr<File, FileHandle>, Layout>>
+createFile(struct io_uring_params *params) {
+	if(params->flags & ~supportedSetupFlags)
+		return Error::illegalArguments;
+
+	auto sqEntries = params->sq_entries;
+	if(!sqEntries)
+		return Error::illegalArguments;
+	if(sqEntries > maxEntries) {
+		if(!(params->flags & IORING_SETUP_CLAMP))
+			return Error::illegalArguments;
+		sqEntries = maxEntries;
+	}
+	sqEntries = roundUpToPowerOfTwo(sqEntries);
+
+	// Like Linux, default to a CQ that is twice as large as the SQ.
+	auto cqEntries = 2 * sqEntries;
+	if(params->flags & IORING_SETUP_CQSIZE) {
+		if(!params->cq_entries)
+			return Error::illegalArguments;
+		cqEntries = params->cq_entries;
+		if(cqEntries > 2 * maxEntries) {
+			if(!(params->flags & IORING_SETUP_CLAMP))
+				return Error::illegalArguments;
+			cqEntries = 2 * maxEntries;
+		}
+		cqEntries = roundUpToPowerOfTwo(cqEntries);
+		if(cqEntries < sqEntries)
+			return Error::illegalArguments;
+	}
+
+	auto file = smarter::make_shared<OpenFile>(sqEntries, cqEntries);
+	file->setupWeakFile(file);
+	OpenFile::serve(file);
+	file->fillParams(params);
+	auto layout = file->layout();
+	return std::make_pair(File::constructHandle(std::move(file)), layout);
+}
+
+bool isRing(File *file) {
+	return file->kind() == FileKind::ioUring;
+}
+
+frg::expected<Error, helix::UniqueDescriptor>
+accessRegion(File *file, uint64_t offset, size_t size) {
+	assert(isRing(file));
+	return static_cast<OpenFile *>(file)->accessRegion(offset, size);
+}
+
+async::result<frg::expected<Error, unsigned int>>
+enter(File *file, std::shared_ptr<Process> process, unsigned int toSubmit,
+		unsigned int minComplete, unsigned int flags, async::cancellation_token ct) {
+	assert(isRing(file));
+	auto ring = static_cast<OpenFile *>(file);
+
+	if(flags & ~IORING_ENTER_GETEVENTS)
+		co_return Error::illegalArguments;
+
+	auto submitted = ring->submit(std::move(process), toSubmit);
+
+	if(flags & IORING_ENTER_GETEVENTS) {
+		auto result = co_await ring->waitForCompletions(minComplete, ct);
+		// Like Linux, only report the interruption if nothing was submitted.
+		if(!result && !submitted)
+			co_return result.error();
+	}
+	co_return submitted;
+}
+
+} // namespace io_uring
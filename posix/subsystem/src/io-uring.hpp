@@ -0,0 +1,38 @@
+#pragma once
+
+#include <memory>
+
+#include <async/cancellation.hpp>
+#include <linux/io_uring.h>
+
+#include "file.hpp"
+
+namespace io_uring {
+
+// Size of the SQ and CQ rings (which share one mapping, see IORING_FEAT_SINGLE_MMAP)
+// and the mmap() offset of the SQE array.
+struct Layout {
+	size_t mmapSize;
+	size_t sqesOffset;
+};
+
+// Validates params and fills in the entry counts, features and ring offsets.
+frg::expected<Error, std::pair<smarter::shared_ptr<File, FileHandle>, Layout>>
+createFile(struct io_uring_params *params);
+
+bool isRing(File *file);
+
+// The rings and the SQEs are backed by separate memory objects.
+// mmap() selects one of them by offset (IORING_OFF_SQ_RING, IORING_OFF_CQ_RING
+// or IORING_OFF_SQES); the returned memory is mapped from its start.
+frg::expected<Error, helix::UniqueDescriptor>
+accessRegion(File *file, uint64_t offset, size_t size);
+
+// Consumes up to toSubmit SQEs on behalf of process. If IORING_ENTER_GETEVENTS
+// is set, waits until at least minComplete CQEs are available.
+// Returns the number of SQEs that were consumed.
+async::result<frg::expected<Error, unsigned int>>
+enter(File *file, std::shared_ptr<Process> process, unsigned int toSubmit,
+		unsigned int minComplete, unsigned int flags, async::cancellation_token ct);
+
+} // namespace io_uring
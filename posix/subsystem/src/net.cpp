@@ -1,4 +1,5 @@
 #include "net.hpp"
+#include "extern_socket.hpp"
 
 #include <async/oneshot-event.hpp>
 #include <protocols/mbus/client.hpp>
@@ -22,6 +23,7 @@ async::result<void> enumerateNetserver() {
 	std::cout << "POSIX: found netserver" << std::endl;
 	auto entity = co_await mbus_ng::Instance::global().getEntity(events[0].id);
 	netserverLane = (co_await entity.getRemoteLane()).unwrap();
+	co_await extern_socket::openReadiness(netserverLane);
 	foundNetserver.raise();
 
 	managarm::fs::InitializePosixLane req;
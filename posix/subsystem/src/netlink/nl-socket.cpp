@@ -1,4 +1,3 @@
-#include <core/bpf.hpp>
 #include <linux/netlink.h>
 #include <string.h>
 #include <sys/epoll.h>
@@ -62,8 +61,7 @@ void OpenFile::handleClose() {
 
 void OpenFile::deliver(core::netlink::Packet packet) {
 	if(filter_) {
-		Bpf bpf{filter_.value()};
-		size_t accept_bytes = bpf.run(arch::dma_buffer_view{nullptr, packet.buffer.data(), packet.buffer.size()});
+		size_t accept_bytes = filter_->run(arch::dma_buffer_view{nullptr, packet.buffer.data(), packet.buffer.size()});
 
 		if(!accept_bytes)
 			return;
@@ -331,13 +329,11 @@ async::result<size_t> OpenFile::sockname(void *addr_ptr, size_t max_addr_length)
 async::result<frg::expected<protocols::fs::Error>> OpenFile::setSocketOption(int layer, int number,
 		std::vector<char> optbuf) {
 	if(layer == SOL_SOCKET && number == SO_ATTACH_FILTER) {
-		assert(optbuf.size() % sizeof(struct sock_filter) == 0);
-
-		Bpf bpf{optbuf};
-		if(!bpf.validate())
+		auto bpf = Bpf::compile(optbuf);
+		if(!bpf)
 			co_return protocols::fs::Error::illegalArguments;
 
-		filter_ = optbuf;
+		filter_ = std::move(bpf);
 	} else if(layer == SOL_NETLINK && number == NETLINK_ADD_MEMBERSHIP) {
 		auto val = *reinterpret_cast<int *>(optbuf.data());
 		std::cout << "posix: Join netlink group "
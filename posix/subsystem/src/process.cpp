@@ -1,6 +1,7 @@
 
 #include <signal.h>
 #include <string.h>
+#include <algorithm>
 #include <print>
 
 #include "common.hpp"
@@ -199,7 +200,8 @@ async::result<void *> VmContext::remapFile(void *oldPointer,
 
 	assert(!it->second.copyOnWrite);
 
-	auto memory = co_await it->second.file->accessMemory();
+	// Map the same memory again; files (e.g., io_uring rings) can be backed by multiple objects.
+	auto &memory = it->second.fileView;
 
 	// Perform the actual mapping.
 	// POSIX specifies that non-page-size mappings are rounded up and filled with zeros.
@@ -275,6 +277,30 @@ void VmContext::unmapFile(void *pointer, size_t size) {
 	}
 }
 
+async::result<void> VmContext::synchronizeFiles(std::function<bool(FsNode *)> filter) {
+	// Collect the ranges first since the area tree can change while we wait.
+	std::vector<std::pair<uintptr_t, size_t>> ranges;
+	for(auto &[address, area] : _areaTree) {
+		if(area.copyOnWrite || !(area.nativeFlags & kHelMapProtWrite))
+			continue;
+		if(!area.file || !area.file->isPageCacheBacked())
+			continue;
+		auto link = area.file->associatedLink();
+		if(!link || !filter(link->getTarget().get()))
+			continue;
+		ranges.emplace_back(address, area.areaSize);
+	}
+
+	for(auto [address, size] : ranges) {
+		auto sync = co_await helix_ng::synchronizeSpace(_space,
+				reinterpret_cast<void *>(address), size);
+		// The area may have been unmapped in the meantime.
+		if(sync.error() == kHelErrFault)
+			continue;
+		HEL_CHECK(sync.error());
+	}
+}
+
 // ----------------------------------------------------------------------------
 // FsContext.
 // ----------------------------------------------------------------------------
@@ -943,6 +969,21 @@ std::shared_ptr<Process> Process::findProcess(ProcessId pid) {
 	return it->second->getProcess();
 }
 
+async::result<void> Process::synchronizeFileMappings(std::function<bool(FsNode *)> filter) {
+	// Threads share their VmContext; only synchronize each context once.
+	std::vector<std::shared_ptr<VmContext>> contexts;
+	for(auto &[pid, hull] : globalPidMap) {
+		auto process = hull->getProcess();
+		if(!process || !process->vmContext())
+			continue;
+		if(std::ranges::find(contexts, process->vmContext()) == contexts.end())
+			contexts.push_back(process->vmContext());
+	}
+
+	for(auto &context : contexts)
+		co_await context->synchronizeFiles(filter);
+}
+
 Process::Process(ThreadGroup *threadGroup, std::shared_ptr<PidHull> tidHull)
 : hull_{std::move(tidHull)}, tgPointer_{threadGroup} {
 
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <functional>
 #include <map>
 #include <memory>
 #include <unordered_map>
@@ -51,6 +52,10 @@ struct VmContext {
 
 	void unmapFile(void *pointer, size_t size);
 
+	// Notifies the kernel of pages that were dirtied through shared writable mappings
+	// of files for which filter returns true, such that their writeback can be awaited.
+	async::result<void> synchronizeFiles(std::function<bool(FsNode *)> filter);
+
 private:
 	struct Area {
 		bool copyOnWrite;
@@ -434,6 +439,10 @@ struct Process : std::enable_shared_from_this<Process> {
 
 	static std::shared_ptr<Process> findProcess(ProcessId pid);
 
+	// Calls VmContext::synchronizeFiles() for the address spaces of all processes.
+	// Used by fsync() since stores through mappings are not visible to file systems.
+	static async::result<void> synchronizeFileMappings(std::function<bool(FsNode *)> filter);
+
 	static async::result<std::shared_ptr<ThreadGroup>> init(std::string path);
 
 	static std::shared_ptr<Process> fork(std::shared_ptr<Process> parent);
@@ -8,20 +8,24 @@
 #include <sys/socket.h>
 #include <sys/sysmacros.h>
 #include <sys/timerfd.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <sys/pidfd.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <print>
 
 #include <helix/timer.hpp>
 
 #include "net.hpp"
 #include "netlink/nl-socket.hpp"
+#include "copy-range.hpp"
 #include "epoll.hpp"
 #include "extern_socket.hpp"
 #include "fifo.hpp"
 #include "inotify.hpp"
+#include "io-uring.hpp"
 #include "memfd.hpp"
 #include "ostrace.hpp"
 #include "pts.hpp"
@@ -637,11 +641,23 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			}else{
 				auto file = self->fileContext()->getFile(req->fd());
 				assert(file && "Illegal FD for VM_MAP");
-				auto memory = co_await file->accessMemory();
+				helix::UniqueDescriptor memory;
+				intptr_t offset = req->rel_offset();
+				if(io_uring::isRing(file.get())) {
+					auto regionResult = io_uring::accessRegion(file.get(), offset, req->size());
+					if(!regionResult) {
+						co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+						continue;
+					}
+					memory = std::move(regionResult.value());
+					offset = 0;
+				}else{
+					memory = co_await file->accessMemory();
+				}
 				assert(memory);
 				result = co_await self->vmContext()->mapFile(hint,
 						std::move(memory), std::move(file),
-						req->rel_offset(), req->size(), copyOnWrite, nativeFlags);
+						offset, req->size(), copyOnWrite, nativeFlags);
 			}
 
 			if(!result) {
@@ -793,6 +809,10 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				assert(source.second->getTarget()->getType() == VfsType::blockDevice);
 				auto device = blockRegistry.get(source.second->getTarget()->readDevice());
 				auto link = co_await device->mount();
+				if(!link) {
+					co_await sendErrorResponse(managarm::posix::Errors::INTERNAL_ERROR);
+					continue;
+				}
 				co_await target.first->mount(target.second, std::move(link), source);
 			}
 
@@ -2125,6 +2145,9 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				continue;
 			}
 
+			if(semantic_flags & (semanticRead | semanticWrite))
+				file->setAccessMode(semantic_flags & semanticRead, semantic_flags & semanticWrite);
+
 			if(file->isTerminal() &&
 				!(req->flags() & managarm::posix::OpenFlags::OF_NOCTTY) &&
 				self->pgPointer()->getSession()->getSessionId() == (pid_t)self->pid() &&
@@ -2849,7 +2872,8 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 					co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
 					continue;
 				}
-			} else if (req->domain() == AF_INET || req->domain() == AF_PACKET) {
+			} else if (req->domain() == AF_INET || req->domain() == AF_INET6
+					|| req->domain() == AF_PACKET) {
 				file = co_await extern_socket::createSocket(
 					co_await net::getNetLane(),
 					req->domain(),
@@ -4473,6 +4497,392 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
 			);
 
+			HEL_CHECK(send_resp.error());
+			logBragiReply(resp);
+		}else if(preamble.id() == bragi::message_id<managarm::posix::SpliceRequest>) {
+			auto req = bragi::parse_head_only<managarm::posix::SpliceRequest>(recv_head);
+			if (!req) {
+				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+				break;
+			}
+
+			logRequest(logRequests, "SPLICE", "fd_in={} fd_out={} length={}",
+				req->fd_in(), req->fd_out(), req->length());
+
+			auto in = self->fileContext()->getFile(req->fd_in());
+			auto out = self->fileContext()->getFile(req->fd_out());
+			if (!in || !out) {
+				co_await sendErrorResponse.operator()<managarm::posix::SpliceResponse>(
+					managarm::posix::Errors::NO_SUCH_FD
+				);
+				continue;
+			}
+
+			std::optional<int64_t> inOffset;
+			std::optional<int64_t> outOffset;
+			if(req->has_off_in())
+				inOffset = req->off_in();
+			if(req->has_off_out())
+				outOffset = req->off_out();
+
+			auto result = co_await fifo::splice(self.get(), std::move(in), inOffset,
+					std::move(out), outOffset, req->length(), req->flags() & SPLICE_F_NONBLOCK);
+
+			managarm::posix::SpliceResponse resp;
+			if (result) {
+				resp.set_error(managarm::posix::Errors::SUCCESS);
+				resp.set_size(result.value());
+			} else {
+				resp.set_error(result.error() | toPosixProtoError);
+			}
+
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+			);
+			HEL_CHECK(send_resp.error());
+			logBragiReply(resp);
+		}else if(preamble.id() == bragi::message_id<managarm::posix::TeeRequest>) {
+			auto req = bragi::parse_head_only<managarm::posix::TeeRequest>(recv_head);
+			if (!req) {
+				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+				break;
+			}
+
+			logRequest(logRequests, "TEE", "fd_in={} fd_out={} length={}",
+				req->fd_in(), req->fd_out(), req->length());
+
+			auto in = self->fileContext()->getFile(req->fd_in());
+			auto out = self->fileContext()->getFile(req->fd_out());
+			if (!in || !out) {
+				co_await sendErrorResponse.operator()<managarm::posix::TeeResponse>(
+					managarm::posix::Errors::NO_SUCH_FD
+				);
+				continue;
+			}
+
+			auto result = co_await fifo::tee(self.get(), std::move(in), std::move(out),
+					req->length(), req->flags() & SPLICE_F_NONBLOCK);
+
+			managarm::posix::TeeResponse resp;
+			if (result) {
+				resp.set_error(managarm::posix::Errors::SUCCESS);
+				resp.set_size(result.value());
+			} else {
+				resp.set_error(result.error() | toPosixProtoError);
+			}
+
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+			);
+			HEL_CHECK(send_resp.error());
+			logBragiReply(resp);
+		}else if(preamble.id() == bragi::message_id<managarm::posix::VmspliceRequest>) {
+			std::vector<uint8_t> tail(preamble.tail_size());
+			auto [recv_tail] = co_await helix_ng::exchangeMsgs(
+					conversation,
+					helix_ng::recvBuffer(tail.data(), tail.size())
+				);
+			HEL_CHECK(recv_tail.error());
+
+			logBragiRequest(tail);
+			auto req = bragi::parse_head_tail<managarm::posix::VmspliceRequest>(recv_head, tail);
+			if (!req) {
+				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+				break;
+			}
+
+			logRequest(logRequests, "VMSPLICE", "fd={} nr_segs={}", req->fd(), req->iov_bases().size());
+
+			auto file = self->fileContext()->getFile(req->fd());
+			if (!file) {
+				co_await sendErrorResponse.operator()<managarm::posix::VmspliceResponse>(
+					managarm::posix::Errors::NO_SUCH_FD
+				);
+				continue;
+			}else if(req->iov_bases().size() != req->iov_lengths().size()) {
+				co_await sendErrorResponse.operator()<managarm::posix::VmspliceResponse>(
+					managarm::posix::Errors::ILLEGAL_ARGUMENTS
+				);
+				continue;
+			}
+
+			std::vector<iovec> iovs;
+			for(size_t i = 0; i < req->iov_bases().size(); i++)
+				iovs.push_back({reinterpret_cast<void *>(req->iov_bases()[i]), req->iov_lengths()[i]});
+
+			auto result = co_await fifo::vmsplice(self.get(), std::move(file), std::move(iovs),
+					req->flags() & SPLICE_F_NONBLOCK);
+
+			managarm::posix::VmspliceResponse resp;
+			if (result) {
+				resp.set_error(managarm::posix::Errors::SUCCESS);
+				resp.set_size(result.value());
+			} else {
+				resp.set_error(result.error() | toPosixProtoError);
+			}
+
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+			);
+			HEL_CHECK(send_resp.error());
+			logBragiReply(resp);
+		}else if(preamble.id() == bragi::message_id<managarm::posix::PipeSizeRequest>) {
+			auto req = bragi::parse_head_only<managarm::posix::PipeSizeRequest>(recv_head);
+			if (!req) {
+				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+				break;
+			}
+
+			logRequest(logRequests, "PIPE_SIZE", "fd={} set={} size={}", req->fd(), req->set(), req->size());
+
+			auto file = self->fileContext()->getFile(req->fd());
+			if (!file) {
+				co_await sendErrorResponse.operator()<managarm::posix::PipeSizeResponse>(
+					managarm::posix::Errors::NO_SUCH_FD
+				);
+				continue;
+			} else if(!fifo::isPipe(file.get()) || (req->set() && req->size() < 0)) {
+				co_await sendErrorResponse.operator()<managarm::posix::PipeSizeResponse>(
+					managarm::posix::Errors::ILLEGAL_ARGUMENTS
+				);
+				continue;
+			}
+
+			managarm::posix::PipeSizeResponse resp;
+			if(req->set()) {
+				auto result = fifo::setPipeSize(file.get(), req->size());
+				if (result) {
+					resp.set_error(managarm::posix::Errors::SUCCESS);
+					resp.set_size(result.value());
+				} else {
+					resp.set_error(result.error() | toPosixProtoError);
+				}
+			}else{
+				resp.set_error(managarm::posix::Errors::SUCCESS);
+				resp.set_size(fifo::getPipeSize(file.get()));
+			}
+
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+			);
+			HEL_CHECK(send_resp.error());
+			logBragiReply(resp);
+		}else if(preamble.id() == bragi::message_id<managarm::posix::IoUringSetupRequest>) {
+			auto req = bragi::parse_head_only<managarm::posix::IoUringSetupRequest>(recv_head);
+			if (!req) {
+				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+				break;
+			}
+
+			logRequest(logRequests, "IO_URING_SETUP", "sq_entries={} cq_entries={} flags={:#x}",
+					req->sq_entries(), req->cq_entries(), req->flags());
+
+			struct io_uring_params params{};
+			params.sq_entries = req->sq_entries();
+			params.cq_entries = req->cq_entries();
+			params.flags = req->flags();
+
+			auto result = io_uring::createFile(&params);
+			if (!result) {
+				co_await sendErrorResponse.operator()<managarm::posix::IoUringSetupResponse>(
+					result.error() | toPosixProtoError
+				);
+				continue;
+			}
+			auto [file, layout] = std::move(result.value());
+
+			auto fd = self->fileContext()->attachFile(std::move(file), req->cloexec());
+			if (!fd) {
+				co_await sendErrorResponse.operator()<managarm::posix::IoUringSetupResponse>(
+					fd.error() | toPosixProtoError
+				);
+				continue;
+			}
+
+			managarm::posix::IoUringSetupResponse resp;
+			resp.set_error(managarm::posix::Errors::SUCCESS);
+			resp.set_fd(fd.value());
+			resp.set_sq_entries(params.sq_entries);
+			resp.set_cq_entries(params.cq_entries);
+			resp.set_features(params.features);
+			resp.set_mmap_size(layout.mmapSize);
+			resp.set_sqes_offset(layout.sqesOffset);
+			resp.set_sq_head(params.sq_off.head);
+			resp.set_sq_tail(params.sq_off.tail);
+			resp.set_sq_ring_mask(params.sq_off.ring_mask);
+			resp.set_sq_ring_entries(params.sq_off.ring_entries);
+			resp.set_sq_flags(params.sq_off.flags);
+			resp.set_sq_dropped(params.sq_off.dropped);
+			resp.set_sq_array(params.sq_off.array);
+			resp.set_cq_head(params.cq_off.head);
+			resp.set_cq_tail(params.cq_off.tail);
+			resp.set_cq_ring_mask(params.cq_off.ring_mask);
+			resp.set_cq_ring_entries(params.cq_off.ring_entries);
+			resp.set_cq_overflow(params.cq_off.overflow);
+			resp.set_cq_cqes(params.cq_off.cqes);
+			resp.set_cq_flags(params.cq_off.flags);
+
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+			);
+			HEL_CHECK(send_resp.error());
+			logBragiReply(resp);
+		}else if(preamble.id() == bragi::message_id<managarm::posix::IoUringEnterRequest>) {
+			auto req = bragi::parse_head_only<managarm::posix::IoUringEnterRequest>(recv_head);
+			if (!req) {
+				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+				break;
+			}
+
+			logRequest(logRequests, "IO_URING_ENTER", "fd={} to_submit={} min_complete={} flags={:#x}",
+					req->fd(), req->to_submit(), req->min_complete(), req->flags());
+
+			auto file = self->fileContext()->getFile(req->fd());
+			if (!file) {
+				co_await sendErrorResponse.operator()<managarm::posix::IoUringEnterResponse>(
+					managarm::posix::Errors::NO_SUCH_FD
+				);
+				continue;
+			} else if(!io_uring::isRing(file.get())) {
+				co_await sendErrorResponse.operator()<managarm::posix::IoUringEnterResponse>(
+					managarm::posix::Errors::ILLEGAL_ARGUMENTS
+				);
+				continue;
+			}
+
+			frg::expected<Error, unsigned int> result = Error::ioError;
+			{
+				auto cancelEvent = self->cancelEventRegistry().event(self->credentials(), req->cancellation_id());
+				if (!cancelEvent) {
+					std::println("posix: possibly duplicate cancellation ID registered");
+					co_await sendErrorResponse.operator()<managarm::posix::IoUringEnterResponse>(
+						managarm::posix::Errors::INTERNAL_ERROR
+					);
+					continue;
+				}
+
+				result = co_await io_uring::enter(file.get(), self, req->to_submit(),
+						req->min_complete(), req->flags(), cancelEvent);
+			}
+
+			managarm::posix::IoUringEnterResponse resp;
+			if (result) {
+				resp.set_error(managarm::posix::Errors::SUCCESS);
+				resp.set_submitted(result.value());
+			} else {
+				resp.set_error(result.error() | toPosixProtoError);
+			}
+
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+			);
+			HEL_CHECK(send_resp.error());
+			logBragiReply(resp);
+		}else if(preamble.id() == bragi::message_id<managarm::posix::CopyFileRangeRequest>) {
+			auto req = bragi::parse_head_only<managarm::posix::CopyFileRangeRequest>(recv_head);
+			if (!req) {
+				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+				break;
+			}
+
+			logRequest(logRequests, "COPY_FILE_RANGE", "fd_in={} fd_out={} length={}",
+				req->fd_in(), req->fd_out(), req->length());
+
+			auto in = self->fileContext()->getFile(req->fd_in());
+			auto out = self->fileContext()->getFile(req->fd_out());
+			if (!in || !out) {
+				co_await sendErrorResponse.operator()<managarm::posix::CopyFileRangeResponse>(
+					managarm::posix::Errors::NO_SUCH_FD
+				);
+				continue;
+			}
+			if (!in->isReadable() || !out->isWritable()) {
+				co_await sendErrorResponse.operator()<managarm::posix::CopyFileRangeResponse>(
+					managarm::posix::Errors::BAD_FD
+				);
+				continue;
+			}
+
+			std::optional<int64_t> inOffset;
+			std::optional<int64_t> outOffset;
+			if(req->has_off_in())
+				inOffset = req->off_in();
+			if(req->has_off_out())
+				outOffset = req->off_out();
+
+			frg::expected<Error, size_t> result = Error::ioError;
+			if(req->regular_only()) {
+				result = co_await copy_range::copyFileRange(self.get(), std::move(in), inOffset,
+						std::move(out), outOffset, req->length());
+			}else{
+				result = co_await copy_range::sendfile(self.get(), std::move(in), inOffset,
+						std::move(out), outOffset, req->length());
+			}
+
+			managarm::posix::CopyFileRangeResponse resp;
+			if (result) {
+				resp.set_error(managarm::posix::Errors::SUCCESS);
+				resp.set_size(result.value());
+			} else {
+				resp.set_error(result.error() | toPosixProtoError);
+			}
+
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+			);
+			HEL_CHECK(send_resp.error());
+			logBragiReply(resp);
+		}else if(preamble.id() == bragi::message_id<managarm::posix::FsyncRequest>) {
+			auto req = bragi::parse_head_only<managarm::posix::FsyncRequest>(recv_head);
+			if (!req) {
+				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+				break;
+			}
+
+			logRequest(logRequests, "FSYNC", "fd={} data_only={} whole_fs={}",
+				req->fd(), req->data_only(), req->whole_fs());
+
+			auto file = self->fileContext()->getFile(req->fd());
+			if (!file) {
+				co_await sendErrorResponse.operator()<managarm::posix::FsyncResponse>(
+					managarm::posix::Errors::NO_SUCH_FD
+				);
+				continue;
+			}
+
+			// fdatasync() is implemented by fsync() since file systems
+			// write back all metadata of the file anyway.
+			Error error = Error::success;
+			if(req->whole_fs()) {
+				if(auto link = file->associatedLink()) {
+					auto result = co_await link->getTarget()->superblock()->sync();
+					if(!result)
+						error = result.error();
+				}
+			}else{
+				auto result = co_await file->sync();
+				if(!result)
+					error = result.error();
+			}
+
+			managarm::posix::FsyncResponse resp;
+			if (error == Error::success) {
+				resp.set_error(managarm::posix::Errors::SUCCESS);
+			} else {
+				resp.set_error(error | toPosixProtoError);
+			}
+
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+			);
 			HEL_CHECK(send_resp.error());
 			logBragiReply(resp);
 		}else{
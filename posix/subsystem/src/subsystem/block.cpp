@@ -1,10 +1,12 @@
 
 #include <string.h>
+#include <format>
 #include <iostream>
 #include <string_view>
 #include <linux/fs.h>
 
 #include <core/id-allocator.hpp>
+#include <protocols/fs/defs.hpp>
 #include <protocols/mbus/client.hpp>
 
 #include "../device.hpp"
@@ -52,6 +54,33 @@ struct Device final : UnixDevice, drvcore::BlockDevice, std::enable_shared_from_
 		return mountExternalDevice(_lane, shared_from_this());
 	}
 
+	// Retrieves the counters of /sys/block/<dev>/stat from the driver.
+	async::result<std::vector<uint64_t>> ioStats() {
+		managarm::fs::GenericIoctlRequest req;
+		req.set_command(protocols::fs::ioctlBlockStats);
+
+		auto ser = req.SerializeAsString();
+		auto [offer, send_req, recv_resp, recv_stats] = co_await helix_ng::exchangeMsgs(_lane,
+			helix_ng::offer(
+				helix_ng::sendBuffer(ser.data(), ser.size()),
+				helix_ng::recvInline(),
+				helix_ng::recvInline()
+			)
+		);
+		HEL_CHECK(offer.error());
+		HEL_CHECK(send_req.error());
+		HEL_CHECK(recv_resp.error());
+		HEL_CHECK(recv_stats.error());
+
+		managarm::fs::GenericIoctlReply resp;
+		resp.ParseFromArray(recv_resp.data(), recv_resp.length());
+		assert(resp.error() == managarm::fs::Errors::SUCCESS);
+
+		std::vector<uint64_t> stats(recv_stats.length() / sizeof(uint64_t));
+		memcpy(stats.data(), recv_stats.data(), stats.size() * sizeof(uint64_t));
+		co_return stats;
+	}
+
 	void composeUevent(drvcore::UeventProperties &ue) override {
 		std::pair<int, int> dev = getId();
 		ue.set("SUBSYSTEM", "block");
@@ -82,6 +111,13 @@ struct SizeAttribute : sysfs::Attribute {
 	async::result<frg::expected<Error, std::string>> show(sysfs::Object *object) override;
 };
 
+struct StatAttribute : sysfs::Attribute {
+	StatAttribute(std::string name)
+	: sysfs::Attribute{std::move(name), false} { }
+
+	async::result<frg::expected<Error, std::string>> show(sysfs::Object *object) override;
+};
+
 struct ManagarmRootAttribute : sysfs::Attribute {
 	ManagarmRootAttribute(std::string name)
 	: sysfs::Attribute{std::move(name), false} { }
@@ -92,6 +128,7 @@ struct ManagarmRootAttribute : sysfs::Attribute {
 ReadOnlyAttribute roAttr{"ro"};
 DevAttribute<Device> devAttr{"dev"};
 SizeAttribute sizeAttr{"size"};
+StatAttribute statAttr{"stat"};
 ManagarmRootAttribute managarmRootAttr{"managarm-root"};
 
 async::result<frg::expected<Error, std::string>> ReadOnlyAttribute::show(sysfs::Object *object) {
@@ -106,6 +143,18 @@ async::result<frg::expected<Error, std::string>> SizeAttribute::show(sysfs::Obje
 	co_return std::to_string(device->size() / 512) + "\n";
 }
 
+async::result<frg::expected<Error, std::string>> StatAttribute::show(sysfs::Object *object) {
+	auto device = static_cast<Device *>(object);
+	auto stats = co_await device->ioStats();
+
+	std::string str;
+	for(auto value : stats)
+		str += std::format("{:8} ", value);
+	if(!str.empty())
+		str.back() = '\n';
+	co_return str;
+}
+
 async::result<frg::expected<Error, std::string>> ManagarmRootAttribute::show(sysfs::Object *) {
 	co_return "1\n";
 }
@@ -182,6 +231,7 @@ async::detached observePartitions() {
 			device->realizeAttribute(&roAttr);
 			device->realizeAttribute(&devAttr);
 			device->realizeAttribute(&sizeAttr);
+			device->realizeAttribute(&statAttr);
 			if (std::get<mbus_ng::StringItem>(properties.at("unix.is-managarm-root")).value == "1")
 				device->realizeAttribute(&managarmRootAttr);
 		}
@@ -263,6 +313,7 @@ async::detached run() {
 			device->assignId({8, minorAllocator.allocate()});
 			blockRegistry.install(device);
 			drvcore::installDevice(device);
+			device->realizeAttribute(&statAttr);
 		}
 	}
 }
@@ -433,7 +433,8 @@ public:
 	}
 
 	MemoryFile(std::shared_ptr<MountView> mount, std::shared_ptr<FsLink> link, SemanticFlags flags)
-	: File{FileKind::unknown,  StructName::get("tmpfs.regular"), std::move(mount), std::move(link)},
+	: File{FileKind::unknown,  StructName::get("tmpfs.regular"), std::move(mount), std::move(link),
+			File::defaultPageCache},
 	flags_{flags}, _offset{0} { }
 
 	void handleClose() override;
@@ -1,4 +1,5 @@
 
+#include <algorithm>
 #include <async/cancellation.hpp>
 #include <cstddef>
 #include <cstring>
@@ -28,6 +29,15 @@ namespace {
 constexpr int shutdownRead = 1;
 constexpr int shutdownWrite = 2;
 
+// Default and limits of SO_SNDBUF and SO_RCVBUF, matching Linux.
+constexpr size_t defaultSocketBuffer = 212992;
+constexpr size_t minSocketBuffer = 4608;
+constexpr size_t maxSocketBuffer = 4 * 1024 * 1024;
+
+// Initial size of the receive ring of stream sockets. The ring grows up to
+// the socket's receive buffer size.
+constexpr size_t initialRingSize = 4096;
+
 }
 
 namespace un_socket {
@@ -48,6 +58,63 @@ std::array<int, 3> supportedSocketTypes = {
 	SOCK_SEQPACKET,
 };
 
+// Ring of bytes that holds the unread data of a stream socket.
+// Writers are bounded by SO_SNDBUF/SO_RCVBUF, hence the ring never outgrows the
+// receive buffer size (unless that is lowered while data is queued).
+struct ByteRing {
+	size_t size() const {
+		return size_;
+	}
+
+	// Appends data, growing the ring if necessary.
+	void push(const void *data, size_t length) {
+		if(!length)
+			return;
+		if(size_ + length > storage_.size())
+			grow_(size_ + length);
+		auto p = reinterpret_cast<const char *>(data);
+		size_t tail = (head_ + size_) % storage_.size();
+		size_t chunk = std::min(length, storage_.size() - tail);
+		memcpy(storage_.data() + tail, p, chunk);
+		memcpy(storage_.data(), p + chunk, length - chunk);
+		size_ += length;
+	}
+
+	// Copies data that starts at the given offset from the front, without consuming it.
+	void copyOut(void *data, size_t offset, size_t length) const {
+		assert(offset + length <= size_);
+		if(!length)
+			return;
+		auto p = reinterpret_cast<char *>(data);
+		size_t start = (head_ + offset) % storage_.size();
+		size_t chunk = std::min(length, storage_.size() - start);
+		memcpy(p, storage_.data() + start, chunk);
+		memcpy(p + chunk, storage_.data(), length - chunk);
+	}
+
+	void consume(size_t length) {
+		assert(length <= size_);
+		size_ -= length;
+		head_ = size_ ? (head_ + length) % storage_.size() : 0;
+	}
+
+private:
+	void grow_(size_t required) {
+		size_t capacity = std::max(storage_.size(), initialRingSize);
+		while(capacity < required)
+			capacity *= 2;
+		std::vector<char> storage(capacity);
+		if(size_)
+			copyOut(storage.data(), 0, size_);
+		storage_ = std::move(storage);
+		head_ = 0;
+	}
+
+	std::vector<char> storage_;
+	size_t head_ = 0;
+	size_t size_ = 0;
+};
+
 struct Packet {
 	// Sender process information.
 	int senderPid;
@@ -57,7 +124,11 @@ struct Packet {
 	struct timeval recvTimestamp;
 
 	// The actual octet data that the packet consists of.
+	// Stream sockets keep their data in a ByteRing instead; for them, packets only
+	// delimit data with different credentials or ancillary data.
 	std::vector<char> buffer;
+	// Number of bytes in the ring that belong to this packet (stream sockets only).
+	size_t length = 0;
 
 	std::vector<smarter::shared_ptr<File, FileHandle>> files;
 
@@ -106,6 +177,8 @@ public:
 		b->_currentState = State::connected;
 		a->_statusBell.raise();
 		b->_statusBell.raise();
+		a->_readiness.raise(a->_currentSeq, EPOLLOUT);
+		b->_readiness.raise(b->_currentSeq, EPOLLOUT);
 	}
 
 	static void serve(smarter::shared_ptr<OpenFile> file) {
@@ -128,6 +201,169 @@ public:
 			_ownerPid = process->pid();
 	}
 
+	// Stream sockets block writers once the remote has this many bytes queued.
+	size_t sendLimit() {
+		assert(_remote);
+		return std::min(sendBufferSize_, _remote->recvBufferSize_);
+	}
+
+	bool writable() {
+		if(socktype_ != SOCK_STREAM || _currentState != State::connected)
+			return true;
+		return _remote->_recvBytes < sendLimit();
+	}
+
+	// Waits until the remote can accept more stream data.
+	// Returns the number of bytes that can be queued.
+	async::result<frg::expected<Error, size_t>> waitForSendSpace(bool nonBlock) {
+		if(_currentState == State::connected && !writable()) {
+			if(nonBlock)
+				co_return Error::wouldBlock;
+
+			co_await async::race_and_cancel(
+				[&](async::cancellation_token c) { return raceSendTimeout(c); },
+				[&](async::cancellation_token c) -> async::result<void> {
+					while (_currentState == State::connected && !writable()
+							&& !(shutdownFlags_ & shutdownWrite)
+							&& !c.is_cancellation_requested())
+						co_await _statusBell.async_wait(c);
+				}
+			);
+
+			if(_currentState == State::connected && !writable()
+					&& !(shutdownFlags_ & shutdownWrite))
+				co_return Error::wouldBlock; // timed out
+		}
+
+		// The peer may have shut down its read side while we were waiting.
+		if(_currentState != State::connected || (shutdownFlags_ & shutdownWrite))
+			co_return Error::brokenPipe;
+		co_return sendLimit() - _remote->_recvBytes;
+	}
+
+	// Appends stream data to our receive ring. The data is coalesced into the last
+	// packet unless that would merge ancillary data or credentials of different senders.
+	void enqueueStream(const void *data, size_t length, const struct ucred &creds,
+			std::vector<smarter::shared_ptr<File, FileHandle>> files) {
+		_recvRing.push(data, length);
+		_recvBytes += length;
+
+		if(!_recvQueue.empty() && files.empty()) {
+			auto &tail = _recvQueue.back();
+			if(tail.files.empty() && tail.senderPid == creds.pid && tail.senderUid == creds.uid
+					&& tail.senderGid == creds.gid) {
+				tail.length += length;
+				return;
+			}
+		}
+
+		Packet packet;
+		packet.senderPid = creds.pid;
+		packet.senderUid = creds.uid;
+		packet.senderGid = creds.gid;
+		packet.length = length;
+		packet.files = std::move(files);
+		packet.offset = 0;
+		auto now = clk::getRealtime();
+		TIMESPEC_TO_TIMEVAL(&packet.recvTimestamp, &now);
+		_recvQueue.push_back(std::move(packet));
+	}
+
+	void enqueuePacket(Packet packet) {
+		_recvBytes += packet.buffer.size() - packet.offset;
+		_recvQueue.push_back(std::move(packet));
+	}
+
+	void raiseIn() {
+		_inSeq = ++_currentSeq;
+		_statusBell.raise();
+		_readiness.raise(_currentSeq, EPOLLIN);
+	}
+
+	void applyShutdown(int flags) {
+		shutdownFlags_ |= flags;
+
+		// Readers see EOF once the queue is drained; writers fail with EPIPE.
+		int edges = 0;
+		++_currentSeq;
+		if(shutdownFlags_ & shutdownRead) {
+			_inSeq = _currentSeq;
+			edges |= EPOLLIN | EPOLLRDHUP;
+		}
+		if(shutdownFlags_ == (shutdownRead | shutdownWrite))
+			edges |= EPOLLHUP;
+		if(shutdownFlags_ & shutdownWrite)
+			edges |= EPOLLOUT;
+		_statusBell.raise();
+		_readiness.raise(_currentSeq, edges);
+	}
+
+	static struct ucred senderCreds(Process *process) {
+		return {
+			.pid = process->pid(),
+			.uid = static_cast<uid_t>(process->threadGroup()->uid()),
+			.gid = static_cast<gid_t>(process->threadGroup()->gid()),
+		};
+	}
+
+	// Notifies writers that the socket might have become writable.
+	void raiseOut() {
+		++_currentSeq;
+		_statusBell.raise();
+		if(writable())
+			_readiness.raise(_currentSeq, EPOLLOUT);
+	}
+
+	// Copies stream data out of the receive ring, spanning multiple packets.
+	// Like Linux, this stops in front of packets that carry file descriptors
+	// or (if SO_PASSCRED is set) credentials of a different sender.
+	size_t dequeueStream(void *data, size_t maxLength, bool peek) {
+		assert(!_recvQueue.empty());
+		auto p = reinterpret_cast<char *>(data);
+		auto pid = _recvQueue.front().senderPid;
+		auto uid = _recvQueue.front().senderUid;
+		auto gid = _recvQueue.front().senderGid;
+
+		size_t progress = 0;
+		size_t index = 0;
+		while(progress < maxLength && index < _recvQueue.size()) {
+			auto &packet = _recvQueue[index];
+			if(progress) {
+				if(!packet.files.empty())
+					break;
+				if(_passCreds && (packet.senderPid != pid || packet.senderUid != uid
+						|| packet.senderGid != gid))
+					break;
+			}
+
+			auto chunk = std::min(packet.length - packet.offset, maxLength - progress);
+			// When peeking, the ring still contains the data of all previous packets.
+			_recvRing.copyOut(p + progress, peek ? progress : 0, chunk);
+			progress += chunk;
+			if(peek) {
+				index++;
+				continue;
+			}
+
+			_recvRing.consume(chunk);
+			packet.offset += chunk;
+			_recvBytes -= chunk;
+			if(packet.offset == packet.length)
+				_recvQueue.pop_front();
+		}
+
+		// Wake up writers that are blocked on the queue.
+		if(!peek && progress && _remote)
+			_remote->raiseOut();
+		return progress;
+	}
+
+	void dequeuePacket() {
+		auto &packet = _recvQueue.front();
+		_recvBytes -= packet.buffer.size() - packet.offset;
+		_recvQueue.pop_front();
+	}
+
 	void handleClose() override {
 		if(logSockets)
 			std::cout << "posix: Closing socket \e[1;34m" << structName() << "\e[0m" << std::endl;
@@ -144,12 +380,15 @@ public:
 			if(socktype_ == SOCK_STREAM) {
 				rf->_hupSeq = ++rf->_currentSeq;
 				rf->_statusBell.raise();
+				rf->_readiness.raise(rf->_currentSeq, EPOLLHUP | EPOLLIN);
 			}
 			rf->_remote = nullptr;
 			_remote = nullptr;
 		}
 		_currentState = State::closed;
 		_statusBell.raise();
+		// Let observers notice that the file is gone.
+		_readiness.raise(_currentSeq, EPOLLHUP);
 		_cancelServe.cancel();
 	}
 
@@ -165,15 +404,15 @@ public:
 		bool queueWaitCancelled = false;
 
 		if(_recvQueue.empty()) {
+			if(shutdownFlags_ & shutdownRead)
+				co_return size_t{0};
+
 			if(nonBlock_) {
 				if(logSockets)
 					std::cout << "posix: UNIX socket would block" << std::endl;
 				co_return std::unexpected{Error::wouldBlock};
 			}
 
-			if(shutdownFlags_ & shutdownRead)
-				co_return size_t{0};
-
 			if(ct.is_cancellation_requested())
 				co_return std::unexpected{Error::interrupted};
 
@@ -182,7 +421,7 @@ public:
 					return raceReceiveTimeout(c);
 				}),
 				async::lambda([&](async::cancellation_token c) -> async::result<void> {
-					while (_recvQueue.empty()) {
+					while (_recvQueue.empty() && !(shutdownFlags_ & shutdownRead)) {
 						if (!co_await _statusBell.async_wait(c)) {
 							queueWaitCancelled = true;
 							co_return;
@@ -197,23 +436,20 @@ public:
 
 		if(_recvQueue.empty() && queueWaitCancelled)
 			co_return std::unexpected{Error::interrupted};
+		else if(_recvQueue.empty() && (shutdownFlags_ & shutdownRead))
+			co_return size_t{0};
 		else if(_recvQueue.empty())
 			co_return std::unexpected{Error::wouldBlock}; // timed out
 
-		auto packet = &_recvQueue.front();
 		if(socktype_ == SOCK_STREAM) {
-			auto chunk = std::min(packet->buffer.size() - packet->offset, max_length);
-			memcpy(data, packet->buffer.data() + packet->offset, chunk);
-			packet->offset += chunk;
-			if(packet->offset == packet->buffer.size())
-				_recvQueue.pop_front();
-			co_return chunk;
+			co_return dequeueStream(data, max_length, false);
 		} else {
+			auto packet = &_recvQueue.front();
 			assert(!packet->offset);
 			auto size = packet->buffer.size();
 			assert(max_length >= size);
 			memcpy(data, packet->buffer.data(), size);
-			_recvQueue.pop_front();
+			dequeuePacket();
 			co_return size;
 		}
 	}
@@ -232,17 +468,40 @@ public:
 		if(logSockets)
 			std::cout << "posix: Write to socket \e[1;34m" << structName() << "\e[0m" << std::endl;
 
+		if(socktype_ == SOCK_STREAM) {
+			auto p = reinterpret_cast<const char *>(data);
+			size_t progress = 0;
+			while(progress < length) {
+				auto space = co_await waitForSendSpace(nonBlock_);
+				if(!space) {
+					if(progress)
+						break;
+					if(space.error() == Error::brokenPipe)
+						process->threadGroup()->signalContext()->issueSignal(SIGPIPE, {});
+					co_return space.error();
+				}
+
+				auto chunk = std::min(space.value(), length - progress);
+				_remote->enqueueStream(p + progress, chunk, senderCreds(process), {});
+				_remote->raiseIn();
+				progress += chunk;
+			}
+			co_return progress;
+		}
+
+		auto creds = senderCreds(process);
 		Packet packet;
-		packet.senderPid = process->pid();
+		packet.senderPid = creds.pid;
+		packet.senderUid = creds.uid;
+		packet.senderGid = creds.gid;
 		packet.buffer.resize(length);
 		memcpy(packet.buffer.data(), data, length);
 		packet.offset = 0;
 		auto now = clk::getRealtime();
 		TIMESPEC_TO_TIMEVAL(&packet.recvTimestamp, &now);
 
-		_remote->_recvQueue.push_back(std::move(packet));
-		_remote->_inSeq = ++_remote->_currentSeq;
-		_remote->_statusBell.raise();
+		_remote->enqueuePacket(std::move(packet));
+		_remote->raiseIn();
 		co_return length;
 	}
 
@@ -262,23 +521,26 @@ public:
 		if(logSockets)
 			std::cout << "posix: Recv from socket \e[1;34m" << structName() << "\e[0m" << std::endl;
 
+		if(_recvQueue.empty() && shutdownFlags_ & shutdownRead)
+			co_return protocols::fs::RecvData{{}, 0, 0, 0};
+
 		if(_recvQueue.empty() && ((flags & MSG_DONTWAIT) || nonBlock_)) {
 			if(logSockets)
 				std::cout << "posix: UNIX socket would block" << std::endl;
 			co_return protocols::fs::Error::wouldBlock;
 		}
 
-		if(_recvQueue.empty() && shutdownFlags_ & shutdownRead)
-			co_return protocols::fs::RecvData{{}, 0, 0, 0};
-
 		co_await async::race_and_cancel(
 			[&](async::cancellation_token c) { return raceReceiveTimeout(c); },
 			[&](async::cancellation_token c) -> async::result<void> {
-				while (_recvQueue.empty() && !c.is_cancellation_requested())
+				while (_recvQueue.empty() && !(shutdownFlags_ & shutdownRead)
+						&& !c.is_cancellation_requested())
 					co_await _statusBell.async_wait(c);
 			}
 		);
 
+		if(_recvQueue.empty() && shutdownFlags_ & shutdownRead)
+			co_return protocols::fs::RecvData{{}, 0, 0, 0};
 		if(_recvQueue.empty())
 			co_return protocols::fs::Error::wouldBlock;
 
@@ -332,21 +594,17 @@ public:
 
 		// datagram packets are always read from their beginning, so offsets are illegal
 		assert(!packet->offset || socktype_ == SOCK_STREAM);
-		auto data_length = packet->buffer.size() - packet->offset;
-		auto chunk = std::min(packet->buffer.size() - packet->offset, max_length);
-		memcpy(data, packet->buffer.data() + packet->offset, chunk);
-
+		size_t data_length;
 		if(socktype_ == SOCK_STREAM) {
-			returned_length = chunk;
-			if(!(flags & MSG_PEEK)) {
-				packet->offset += chunk;
-				if(packet->offset == packet->buffer.size())
-					_recvQueue.pop_front();
-			}
+			returned_length = dequeueStream(data, max_length, flags & MSG_PEEK);
+			data_length = returned_length;
 		} else {
+			data_length = packet->buffer.size();
+			auto chunk = std::min(data_length, max_length);
+			memcpy(data, packet->buffer.data(), chunk);
 			returned_length = (flags & MSG_TRUNC) ? data_length : chunk;
 			if(!(flags & MSG_PEEK))
-				_recvQueue.pop_front();
+				dequeuePacket();
 		}
 
 		if(data_length != returned_length)
@@ -426,11 +684,36 @@ public:
 		if(logSockets)
 			std::cout << "posix: Send to socket \e[1;34m" << structName() << "\e[0m" << std::endl;
 
-		protocols::fs::utils::handleSoPasscred(remote->_passCreds, ucreds, process->pid(), process->threadGroup()->uid(), process->threadGroup()->gid());
-
-		// We ignore MSG_DONTWAIT here as we never block anyway.
+		// Like Linux, record the sender's credentials even if the receiver does not
+		// ask for them (yet). This also lets data from writeAll() and sendMsg() coalesce.
+		if(!ucreds.pid && !ucreds.uid && !ucreds.gid)
+			ucreds = senderCreds(process);
 
 		// TODO: Add permission checking for ucred related items
+		if(socktype_ == SOCK_STREAM) {
+			auto p = reinterpret_cast<const char *>(data);
+			size_t progress = 0;
+			while(progress < max_length) {
+				auto space = co_await waitForSendSpace((flags & MSG_DONTWAIT) || nonBlock_);
+				if(!space) {
+					if(progress)
+						break;
+					if(space.error() == Error::brokenPipe && !(flags & MSG_NOSIGNAL))
+						process->threadGroup()->signalContext()->issueSignal(SIGPIPE, {});
+					co_return space.error() | protocols::fs::toFsProtoError;
+				}
+
+				// File descriptors are attached to the first byte of the message.
+				auto chunk = std::min(space.value(), max_length - progress);
+				_remote->enqueueStream(p + progress, chunk, ucreds,
+						progress ? std::vector<smarter::shared_ptr<File, FileHandle>>{} : std::move(files));
+				_remote->raiseIn();
+				progress += chunk;
+			}
+			co_return progress;
+		}
+
+		// Datagrams are never subject to backpressure, so we ignore MSG_DONTWAIT here.
 		Packet packet;
 		packet.senderPid = ucreds.pid;
 		packet.senderUid = ucreds.uid;
@@ -442,9 +725,8 @@ public:
 		auto now = clk::getRealtime();
 		TIMESPEC_TO_TIMEVAL(&packet.recvTimestamp, &now);
 
-		remote->_recvQueue.push_back(std::move(packet));
-		remote->_inSeq = ++remote->_currentSeq;
-		remote->_statusBell.raise();
+		remote->enqueuePacket(std::move(packet));
+		remote->raiseIn();
 
 		co_return max_length;
 	}
@@ -500,8 +782,10 @@ public:
 		if(_currentState == State::closed)
 			co_return Error::fileClosed;
 
-		// For now making sockets always writable is sufficient.
-		int edges = EPOLLOUT;
+		// Only stream sockets apply backpressure; other sockets are always writable.
+		int edges = 0;
+		if(writable())
+			edges |= EPOLLOUT;
 		if(socktype_ == SOCK_STREAM || socktype_ == SOCK_SEQPACKET) {
 			if(_hupSeq > past_seq)
 				edges |= EPOLLHUP | EPOLLIN;
@@ -510,7 +794,9 @@ public:
 			edges |= EPOLLIN;
 
 		if(shutdownFlags_ & shutdownRead)
-			edges |= EPOLLRDHUP;
+			edges |= EPOLLIN | EPOLLRDHUP;
+		if(shutdownFlags_ == (shutdownRead | shutdownWrite))
+			edges |= EPOLLHUP;
 
 //		std::cout << "posix: pollWait(" << past_seq << ") on \e[1;34m" << structName() << "\e[0m"
 //				<< " returns (" << _currentSeq
@@ -521,7 +807,20 @@ public:
 
 	async::result<frg::expected<Error, PollStatusResult>>
 	pollStatus(Process *) override {
-		int events = EPOLLOUT;
+		co_return readinessStatus();
+	}
+
+	ReadinessSource *readinessSource() override {
+		return &_readiness;
+	}
+
+	frg::expected<Error, PollStatusResult> readinessStatus() override {
+		if(_currentState == State::closed)
+			return Error::fileClosed;
+
+		int events = 0;
+		if(writable())
+			events |= EPOLLOUT;
 		if(socktype_ == SOCK_STREAM || socktype_ == SOCK_SEQPACKET) {
 			if(_currentState == State::remoteShutDown)
 				events |= EPOLLHUP | EPOLLIN;
@@ -529,9 +828,11 @@ public:
 		if(!_acceptQueue.empty() || !_recvQueue.empty())
 			events |= EPOLLIN;
 		if(shutdownFlags_ & shutdownRead)
-			events |= EPOLLRDHUP;
+			events |= EPOLLIN | EPOLLRDHUP;
+		if(shutdownFlags_ == (shutdownRead | shutdownWrite))
+			events |= EPOLLHUP;
 
-		co_return PollStatusResult{_currentSeq, events};
+		return PollStatusResult{_currentSeq, events};
 	}
 
 	async::result<protocols::fs::Error>
@@ -632,8 +933,7 @@ public:
 				co_return protocols::fs::Error::connectionRefused;
 			auto server = abstractSocketsBindMap.at(path);
 			server->_acceptQueue.push_back(this);
-			server->_inSeq = ++server->_currentSeq;
-			server->_statusBell.raise();
+			server->raiseIn();
 
 			co_await async::race_and_cancel(
 				[&](async::cancellation_token c) { return raceSendTimeout(c); },
@@ -667,8 +967,7 @@ public:
 			auto server = globalBindMap.at(node);
 			if(socktype_ == SOCK_STREAM) {
 				server->_acceptQueue.push_back(this);
-				server->_inSeq = ++server->_currentSeq;
-				server->_statusBell.raise();
+				server->raiseIn();
 
 				co_await async::race_and_cancel(
 					[&](async::cancellation_token c) { return raceSendTimeout(c); },
@@ -701,18 +1000,28 @@ public:
 		if(_currentState != State::connected)
 			co_return protocols::fs::Error::notConnected;
 
-		if(how == SHUT_RD) {
-			shutdownFlags_ |= shutdownRead;
-		} else if(how == SHUT_WR) {
-			shutdownFlags_ |= shutdownWrite;
-		} else if(how == SHUT_RDWR) {
-			shutdownFlags_ |= shutdownRead | shutdownWrite;
-		} else {
+		if(how != SHUT_RD && how != SHUT_WR && how != SHUT_RDWR) {
 			std::println("posix: unexpected how={} for un-socket shutdown", how);
 			co_return protocols::fs::Error::illegalArguments;
 		}
 
-		_statusBell.raise();
+		int flags = 0;
+		if(how == SHUT_RD || how == SHUT_RDWR)
+			flags |= shutdownRead;
+		if(how == SHUT_WR || how == SHUT_RDWR)
+			flags |= shutdownWrite;
+		applyShutdown(flags);
+
+		// Like Linux, the peer cannot receive what we no longer send and vice versa.
+		// This wakes up peers that are blocked in read() or poll().
+		if(socktype_ != SOCK_DGRAM && _remote) {
+			int peerFlags = 0;
+			if(flags & shutdownWrite)
+				peerFlags |= shutdownRead;
+			if(flags & shutdownRead)
+				peerFlags |= shutdownWrite;
+			_remote->applyShutdown(peerFlags);
+		}
 
 		co_return protocols::fs::Error::none;
 	}
@@ -769,6 +1078,12 @@ public:
 		} else if(layer == SOL_SOCKET && number == SO_TYPE) {
 			int type = socktype_;
 			memcpy(optbuf.data(), &type, std::min(optbuf.size(), sizeof(type)));
+		} else if(layer == SOL_SOCKET && number == SO_SNDBUF) {
+			int size = sendBufferSize_;
+			memcpy(optbuf.data(), &size, std::min(optbuf.size(), sizeof(size)));
+		} else if(layer == SOL_SOCKET && number == SO_RCVBUF) {
+			int size = recvBufferSize_;
+			memcpy(optbuf.data(), &size, std::min(optbuf.size(), sizeof(size)));
 		} else if(layer == SOL_SOCKET && number == SO_ACCEPTCONN) {
 			int listen = listen_;
 			memcpy(optbuf.data(), &listen, std::min(optbuf.size(), sizeof(listen)));
@@ -810,6 +1125,23 @@ public:
 			int val = *reinterpret_cast<int *>(optbuf.data());
 
 			timestamp_ = (val != 0);
+		} else if(layer == SOL_SOCKET && (number == SO_SNDBUF || number == SO_RCVBUF)) {
+			if(optbuf.size() < sizeof(int))
+				co_return protocols::fs::Error::illegalArguments;
+
+			// Like Linux, double the value to account for bookkeeping overhead.
+			int val = *reinterpret_cast<int *>(optbuf.data());
+			auto size = std::clamp(static_cast<size_t>(std::max(val, 0)) * 2,
+					minSocketBuffer, maxSocketBuffer);
+			// Growing the buffers might unblock writers.
+			if(number == SO_SNDBUF) {
+				sendBufferSize_ = size;
+				raiseOut();
+			} else {
+				recvBufferSize_ = size;
+				if(_currentState == State::connected && _remote)
+					_remote->raiseOut();
+			}
 		} else if(layer == SOL_SOCKET && number == SO_RCVTIMEO) {
 			if(optbuf.size() < sizeof(timeval))
 				co_return protocols::fs::Error::illegalArguments;
@@ -851,6 +1183,8 @@ public:
 						resp.set_error(managarm::fs::Errors::NOT_CONNECTED);
 					} else if(_recvQueue.empty()) {
 						resp.set_fionread_count(0);
+					} else if(socktype_ == SOCK_STREAM) {
+						resp.set_fionread_count(_recvBytes);
 					} else {
 						auto packet = &_recvQueue.front();
 						resp.set_fionread_count(packet->buffer.size() - packet->offset);
@@ -931,6 +1265,7 @@ private:
 
 	// Status management for poll().
 	async::recurring_event _statusBell;
+	ReadinessSource _readiness;
 	uint64_t _currentSeq;
 	uint64_t _hupSeq = 0;
 	uint64_t _inSeq;
@@ -940,6 +1275,10 @@ private:
 
 	// The actual receive queue of the socket.
 	std::deque<Packet> _recvQueue;
+	// Data of stream sockets; see Packet.
+	ByteRing _recvRing;
+	// Number of unread bytes in _recvQueue.
+	size_t _recvBytes = 0;
 
 	int _ownerPid;
 
@@ -967,6 +1306,9 @@ private:
 	std::optional<timeval> sendTimeout_;
 
 	int shutdownFlags_ = 0;
+
+	size_t sendBufferSize_ = defaultSocketBuffer;
+	size_t recvBufferSize_ = defaultSocketBuffer;
 };
 
 std::expected<smarter::shared_ptr<File, FileHandle>, Error>
@@ -33,6 +33,7 @@ std::ostream& operator<<(std::ostream& os, const Error& err) {
 		case Error::interrupted: err_string = "interrupted"; break;
 		case Error::noSuchProcess: err_string = "noSuchProcess"; break;
 		case Error::noFileDescriptorsAvailable: err_string = "noFileDescriptorsAvailable"; break;
+		case Error::resourceInUse: err_string = "resourceInUse"; break;
 	}
 
 	return os << err_string;
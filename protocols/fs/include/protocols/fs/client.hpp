@@ -35,13 +35,24 @@ struct File {
 	async::result<frg::expected<Error, PollStatusResult>>
 	pollStatus();
 
+	// Returns the slot of the server's readiness table that the file publishes its status to.
+	async::result<frg::expected<Error, uint64_t>> watchReadiness();
+
 	async::result<helix::UniqueDescriptor> accessMemory();
 
+	// Asks the server to copy length bytes at inOffset of memory into the file.
+	// outOffset is -1 to write at the file's current position.
+	async::result<frg::expected<Error, size_t>> copyFromMemory(helix::BorrowedDescriptor memory,
+			uint64_t inOffset, int64_t outOffset, size_t length);
+
 	static async::result<frg::expected<Error, File>> createSocket(helix::BorrowedLane lane,
 		int domain, int type, int proto, int flags);
 
 	async::result<Error> connect(const struct sockaddr *addr_ptr, socklen_t addr_length);
 
+	// Returns the passthrough lane of the accepted connection.
+	async::result<frg::expected<Error, helix::UniqueLane>> accept();
+
 	async::result<frg::expected<Error, size_t>>
 	sendto(const void *buf, size_t len, int flags, const struct sockaddr *addr_ptr, socklen_t addr_length);
 
@@ -4,6 +4,11 @@
 
 namespace protocols::fs {
 
+// managarm-specific ioctl() that retrieves the I/O statistics of a block device.
+// The reply is followed by a buffer of uint64_t counters in the order of
+// Linux' /sys/block/<dev>/stat.
+inline constexpr uint64_t ioctlBlockStats = 0x4D420001;
+
 struct StatusPage {
 	uint64_t seqlock;
 	uint64_t sequence;
@@ -107,6 +107,10 @@ struct FileOperations {
 		fallocate = f;
 		return *this;
 	}
+	constexpr FileOperations &withFsync(async::result<frg::expected<protocols::fs::Error>> (*f)(void *object)) {
+		fsync = f;
+		return *this;
+	}
 	constexpr FileOperations &withIoctl(async::result<void> (*f)(void *object,
 			uint32_t id, helix_ng::RecvInlineResult msg, helix::UniqueLane conversation)) {
 		ioctl = f;
@@ -158,6 +162,8 @@ struct FileOperations {
 	async::result<helix::BorrowedDescriptor>(*accessMemory)(void *object) = nullptr;
 	async::result<frg::expected<protocols::fs::Error>> (*truncate)(void *object, size_t size) = nullptr;
 	async::result<frg::expected<protocols::fs::Error>> (*fallocate)(void *object, int64_t offset, size_t size) = nullptr;
+	// Makes the file's data and metadata durable.
+	async::result<frg::expected<protocols::fs::Error>> (*fsync)(void *object) = nullptr;
 	async::result<void> (*ioctl)(void *object, uint32_t id, helix_ng::RecvInlineResult req,
 			helix::UniqueLane conversation) = nullptr;
 	async::result<protocols::fs::Error> (*flock)(void *object, int flags) = nullptr;
@@ -166,9 +172,20 @@ struct FileOperations {
 			async::cancellation_token cancellation) = nullptr;
 	async::result<frg::expected<Error, PollStatusResult>>
 	(*pollStatus)(void *object) = nullptr;
+	// Assigns a slot of the server's readiness table (see OpenReadinessRequest) to the file.
+	// The server publishes the file's poll status to the slot and reports its edges
+	// through the readiness stream.
+	async::result<frg::expected<Error, uint64_t>> (*watchReadiness)(void *object) = nullptr;
+	// Copies length bytes at inOffset of the given memory object into the file.
+	// outOffset is -1 to use (and advance) the file's current position.
+	async::result<frg::expected<Error, size_t>>
+	(*copyFromMemory)(void *object, helix::BorrowedDescriptor memory,
+			uint64_t inOffset, int64_t outOffset, size_t length) = nullptr;
 	async::result<Error> (*bind)(void *object, helix_ng::CredentialsView credentials,
 			const void *addr_ptr, size_t addr_length) = nullptr;
 	async::result<Error> (*listen)(void *object) = nullptr;
+	// Returns a lane that serves the accepted connection.
+	async::result<frg::expected<Error, helix::UniqueLane>> (*accept)(void *object) = nullptr;
 	async::result<Error> (*connect)(void *object, helix_ng::CredentialsView credentials,
 			const void *addr_ptr, size_t addr_length) = nullptr;
 	async::result<size_t> (*sockname)(void *object, void *addr_ptr, size_t max_addr_length) = nullptr;
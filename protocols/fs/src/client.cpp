@@ -261,6 +261,58 @@ async::result<frg::expected<Error, PollStatusResult>> File::pollStatus() {
 	co_return PollStatusResult(resp.sequence(), resp.status());
 }
 
+async::result<frg::expected<Error, uint64_t>> File::watchReadiness() {
+	managarm::fs::WatchReadinessRequest req;
+
+	auto [offer, send_req, recv_resp] = co_await helix_ng::exchangeMsgs(
+		_lane,
+		helix_ng::offer(
+			helix_ng::sendBragiHeadOnly(req, frg::stl_allocator{}),
+			helix_ng::recvInline()
+		)
+	);
+
+	HEL_CHECK(offer.error());
+	HEL_CHECK(send_req.error());
+	HEL_CHECK(recv_resp.error());
+
+	auto resp = *bragi::parse_head_only<managarm::fs::WatchReadinessReply>(recv_resp);
+	recv_resp.reset();
+
+	if(resp.error() != managarm::fs::Errors::SUCCESS)
+		co_return static_cast<Error>(resp.error());
+	co_return resp.slot();
+}
+
+async::result<frg::expected<Error, size_t>> File::copyFromMemory(helix::BorrowedDescriptor memory,
+		uint64_t inOffset, int64_t outOffset, size_t length) {
+	managarm::fs::CopyFromMemoryRequest req;
+	req.set_in_offset(inOffset);
+	req.set_out_offset(outOffset);
+	req.set_size(length);
+
+	auto [offer, send_req, push_memory, recv_resp] = co_await helix_ng::exchangeMsgs(
+		_lane,
+		helix_ng::offer(
+			helix_ng::sendBragiHeadOnly(req, frg::stl_allocator{}),
+			helix_ng::pushDescriptor(memory),
+			helix_ng::recvInline()
+		)
+	);
+
+	HEL_CHECK(offer.error());
+	HEL_CHECK(send_req.error());
+	HEL_CHECK(push_memory.error());
+	HEL_CHECK(recv_resp.error());
+
+	auto resp = *bragi::parse_head_only<managarm::fs::CopyFromMemoryReply>(recv_resp);
+	recv_resp.reset();
+
+	if(resp.error() != managarm::fs::Errors::SUCCESS)
+		co_return static_cast<Error>(resp.error());
+	co_return resp.size();
+}
+
 async::result<helix::UniqueDescriptor> File::accessMemory() {
 	managarm::fs::CntRequest req;
 	req.set_req_type(managarm::fs::CntReqType::MMAP);
@@ -347,6 +399,40 @@ async::result<Error> File::connect(const struct sockaddr *addr_ptr, socklen_t ad
 	co_return static_cast<Error>(resp.error());
 }
 
+async::result<frg::expected<Error, helix::UniqueLane>> File::accept() {
+	managarm::fs::CntRequest req;
+	req.set_req_type(managarm::fs::CntReqType::PT_ACCEPT);
+
+	auto [offer, send_req, recv_resp] = co_await helix_ng::exchangeMsgs(
+	    _lane,
+	    helix_ng::offer(
+	        helix_ng::want_lane,
+	        helix_ng::sendBragiHeadOnly(req, frg::stl_allocator{}),
+	        helix_ng::recvInline()
+	    )
+	);
+
+	HEL_CHECK(offer.error());
+	HEL_CHECK(send_req.error());
+	HEL_CHECK(recv_resp.error());
+
+	managarm::fs::SvrResponse resp;
+	resp.ParseFromArray(recv_resp.data(), recv_resp.length());
+	recv_resp.reset();
+
+	if(resp.error() != managarm::fs::Errors::SUCCESS)
+		co_return static_cast<Error>(resp.error());
+
+	auto conversation = offer.descriptor();
+	auto [pull_lane] = co_await helix_ng::exchangeMsgs(
+	    conversation,
+	    helix_ng::pullDescriptor()
+	);
+	HEL_CHECK(pull_lane.error());
+
+	co_return pull_lane.descriptor();
+}
+
 async::result<frg::expected<Error, size_t>>
 File::sendto(const void *buf, size_t len, int flags, const struct sockaddr *addr_ptr, socklen_t addr_length) {
 	managarm::fs::SendMsgRequest req;
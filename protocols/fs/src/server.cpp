@@ -3,6 +3,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <iostream>
+#include <memory>
 #include <print>
 #include <vector>
 
@@ -196,8 +197,8 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			co_return;
 		}
 
-		std::string data;
-		data.resize(req.size());
+		// Only the bytes produced by the read are sent back, no need to zero the buffer.
+		auto data = std::make_unique_for_overwrite<char[]>(req.size());
 		ReadResult res = std::unexpected{Error::internalError};
 
 		{
@@ -220,7 +221,7 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			res = co_await file_ops->read(
 				file.get(),
 				extract_creds.credentials(),
-				data.data(),
+				data.get(),
 				req.size(),
 				cancelEvent
 			);
@@ -239,7 +240,7 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		auto [send_resp, send_data] = co_await helix_ng::exchangeMsgs(
 			conversation,
 			helix_ng::sendBuffer(ser.data(), ser.size()),
-			helix_ng::sendBuffer(data.data(), size)
+			helix_ng::sendBuffer(data.get(), size)
 		);
 		HEL_CHECK(send_resp.error());
 		HEL_CHECK(send_data.error());
@@ -265,10 +266,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			co_return;
 		}
 
-		std::string data;
-		data.resize(req.size());
+		auto data = std::make_unique_for_overwrite<char[]>(req.size());
 		auto res = co_await file_ops->pread(file.get(), req.offset(), extract_creds.credentials(),
-				data.data(), req.size());
+				data.get(), req.size());
 
 		managarm::fs::SvrResponse resp;
 		if (!res.has_value()) {
@@ -288,7 +288,7 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			auto [send_resp, send_data] = co_await helix_ng::exchangeMsgs(
 				conversation,
 				helix_ng::sendBuffer(ser.data(), ser.size()),
-				helix_ng::sendBuffer(data.data(), res.value())
+				helix_ng::sendBuffer(data.get(), res.value())
 			);
 			HEL_CHECK(send_resp.error());
 			HEL_CHECK(send_data.error());
@@ -479,6 +479,36 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
 		}
 
+		auto ser = resp.SerializeAsString();
+		auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBuffer(ser.data(), ser.size())
+		);
+		HEL_CHECK(send_resp.error());
+		logBragiSerializedReply(ser);
+	}else if(req.req_type() == managarm::fs::CntReqType::PT_FSYNC) {
+		if(!file_ops->fsync) {
+			managarm::fs::SvrResponse resp;
+			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
+
+			auto ser = resp.SerializeAsString();
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBuffer(ser.data(), ser.size())
+			);
+			HEL_CHECK(send_resp.error());
+			logBragiSerializedReply(ser);
+			co_return;
+		}
+		auto result = co_await file_ops->fsync(file.get());
+
+		managarm::fs::SvrResponse resp;
+		if(result) {
+			resp.set_error(managarm::fs::Errors::SUCCESS);
+		}else{
+			resp.set_error(result.error() | toFsError);
+		}
+
 		auto ser = resp.SerializeAsString();
 		auto [send_resp] = co_await helix_ng::exchangeMsgs(
 			conversation,
@@ -838,10 +868,10 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			co_return;
 		}
 
-		co_await file_ops->listen(file.get());
+		auto error = co_await file_ops->listen(file.get());
 
 		managarm::fs::SvrResponse resp;
-		resp.set_error(managarm::fs::Errors::SUCCESS);
+		resp.set_error(error | toFsError);
 
 		auto ser = resp.SerializeAsString();
 		auto [send_resp] = co_await helix_ng::exchangeMsgs(
@@ -850,6 +880,48 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		);
 		HEL_CHECK(send_resp.error());
 		logBragiSerializedReply(ser);
+	}else if(req.req_type() == managarm::fs::CntReqType::PT_ACCEPT) {
+		if(!file_ops->accept) {
+			managarm::fs::SvrResponse resp;
+			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
+
+			auto ser = resp.SerializeAsString();
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBuffer(ser.data(), ser.size())
+			);
+			HEL_CHECK(send_resp.error());
+			logBragiSerializedReply(ser);
+			co_return;
+		}
+
+		auto laneOrError = co_await file_ops->accept(file.get());
+
+		managarm::fs::SvrResponse resp;
+		if(!laneOrError) {
+			resp.set_error(laneOrError.error() | toFsError);
+
+			auto ser = resp.SerializeAsString();
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBuffer(ser.data(), ser.size())
+			);
+			HEL_CHECK(send_resp.error());
+			logBragiSerializedReply(ser);
+			co_return;
+		}
+		resp.set_error(managarm::fs::Errors::SUCCESS);
+
+		// The client only pulls the descriptor after it has seen a successful response.
+		auto ser = resp.SerializeAsString();
+		auto [send_resp, push_lane] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBuffer(ser.data(), ser.size()),
+			helix_ng::pushDescriptor(laneOrError.value())
+		);
+		HEL_CHECK(send_resp.error());
+		HEL_CHECK(push_lane.error());
+		logBragiSerializedReply(ser);
 	} else if (req.req_type() == managarm::fs::CntReqType::PT_ADD_SEALS) {
 		managarm::fs::SvrResponse resp;
 		resp.set_error(managarm::fs::Errors::SUCCESS);
@@ -1294,6 +1366,65 @@ async::detached handleMessages(smarter::shared_ptr<void> file,
 		auto ret = co_await file_ops->shutdown(file.get(), how);
 		resp.set_error(ret | toFsError);
 
+		auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+		);
+		HEL_CHECK(send_resp.error());
+		logBragiReply(resp);
+	} else if(preamble.id() == managarm::fs::WatchReadinessRequest::message_id) {
+		recv_req.reset();
+
+		managarm::fs::WatchReadinessReply resp;
+
+		if(!file_ops->watchReadiness) {
+			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
+		}else{
+			auto slotOrError = co_await file_ops->watchReadiness(file.get());
+			if(slotOrError) {
+				resp.set_error(managarm::fs::Errors::SUCCESS);
+				resp.set_slot(slotOrError.value());
+			}else{
+				resp.set_error(slotOrError.error() | toFsError);
+			}
+		}
+
+		auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+		);
+		HEL_CHECK(send_resp.error());
+		logBragiReply(resp);
+	} else if(preamble.id() == managarm::fs::CopyFromMemoryRequest::message_id) {
+		auto req = bragi::parse_head_only<managarm::fs::CopyFromMemoryRequest>(recv_req);
+		recv_req.reset();
+		if(!req) {
+			std::cout << "protocols/fs: Rejecting request due to decoding failure" << std::endl;
+			co_return;
+		}
+
+		auto [pull_memory] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::pullDescriptor()
+		);
+		HEL_CHECK(pull_memory.error());
+
+		managarm::fs::CopyFromMemoryReply resp;
+
+		if(!file_ops->copyFromMemory) {
+			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
+		}else{
+			auto memory = pull_memory.descriptor();
+			auto sizeOrError = co_await file_ops->copyFromMemory(file.get(), memory,
+					req->in_offset(), req->out_offset(), req->size());
+			if(sizeOrError) {
+				resp.set_error(managarm::fs::Errors::SUCCESS);
+				resp.set_size(sizeOrError.value());
+			}else{
+				resp.set_error(sizeOrError.error() | toFsError);
+			}
+		}
+
 		auto [send_resp] = co_await helix_ng::exchangeMsgs(
 			conversation,
 			helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
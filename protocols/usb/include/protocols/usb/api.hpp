@@ -16,7 +16,9 @@ enum class UsbError {
 	babble,
 	timeout,
 	unsupported,
-	other
+	other,
+	// The transfer was aborted by Endpoint::cancelStream().
+	cancelled
 };
 
 enum class DeviceSpeed {
@@ -55,12 +57,14 @@ struct InterruptTransfer {
 struct BulkTransfer {
 	BulkTransfer(XferFlags flags, arch::dma_buffer_view buffer)
 	: flags{flags}, buffer{buffer},
-			allowShortPackets{false}, lazyNotification{false} { }
+			allowShortPackets{false}, lazyNotification{false}, streamId{0} { }
 
 	XferFlags flags;
 	arch::dma_buffer_view buffer;
 	bool allowShortPackets;
 	bool lazyNotification;
+	// Zero if the transfer does not use bulk streams (see Endpoint::allocateStreams()).
+	uint32_t streamId;
 };
 
 enum class PipeType {
@@ -79,6 +83,16 @@ public:
 	virtual async::result<frg::expected<UsbError, size_t>> transfer(ControlTransfer info) = 0;
 	virtual async::result<frg::expected<UsbError, size_t>> transfer(InterruptTransfer info) = 0;
 	virtual async::result<frg::expected<UsbError, size_t>> transfer(BulkTransfer info) = 0;
+
+	virtual async::result<frg::expected<UsbError, size_t>> allocateStreams(size_t numStreams) {
+		(void)numStreams;
+		co_return UsbError::unsupported;
+	}
+
+	virtual async::result<frg::expected<UsbError>> cancelStream(uint32_t streamId) {
+		(void)streamId;
+		co_return UsbError::unsupported;
+	}
 };
 
 
@@ -89,6 +103,16 @@ struct Endpoint {
 	async::result<frg::expected<UsbError, size_t>> transfer(InterruptTransfer info) const;
 	async::result<frg::expected<UsbError, size_t>> transfer(BulkTransfer info) const;
 
+	// Enables bulk streams (USB 3) on this endpoint. Afterwards, transfers can be
+	// issued on stream IDs 1 to n concurrently, where n is the return value.
+	// n might be smaller than numStreams if the device or the controller supports
+	// less streams. Fails with UsbError::unsupported if streams are not supported.
+	async::result<frg::expected<UsbError, size_t>> allocateStreams(size_t numStreams) const;
+
+	// Aborts the transfer that is pending on the given stream (if any); it completes
+	// with UsbError::cancelled. Transfers on other streams are not affected.
+	async::result<frg::expected<UsbError>> cancelStream(uint32_t streamId) const;
+
 private:
 	std::shared_ptr<EndpointData> _state;
 };
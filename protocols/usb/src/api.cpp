@@ -116,4 +116,12 @@ async::result<frg::expected<UsbError, size_t>> Endpoint::transfer(BulkTransfer i
 	return _state->transfer(info);
 }
 
+async::result<frg::expected<UsbError, size_t>> Endpoint::allocateStreams(size_t numStreams) const {
+	return _state->allocateStreams(numStreams);
+}
+
+async::result<frg::expected<UsbError>> Endpoint::cancelStream(uint32_t streamId) const {
+	return _state->cancelStream(streamId);
+}
+
 } // namespace protocols::usb
@@ -1,6 +1,7 @@
 
 #include <memory>
 #include <iostream>
+#include <type_traits>
 
 #include <string.h>
 
@@ -61,6 +62,8 @@ struct EndpointState final : EndpointData {
 	async::result<frg::expected<UsbError, size_t>> transfer(ControlTransfer info) override;
 	async::result<frg::expected<UsbError, size_t>> transfer(InterruptTransfer info) override;
 	async::result<frg::expected<UsbError, size_t>> transfer(BulkTransfer info) override;
+	async::result<frg::expected<UsbError, size_t>> allocateStreams(size_t numStreams) override;
+	async::result<frg::expected<UsbError>> cancelStream(uint32_t streamId) override;
 
 private:
 	helix::UniqueLane _lane;
@@ -85,6 +88,7 @@ frg::expected<UsbError> transformProtocolError(managarm::usb::Errors error) {
 		case TIMEOUT: return timeout;
 		case UNSUPPORTED: return unsupported;
 		case OTHER: return other;
+		case CANCELLED: return cancelled;
 		case ILLEGAL_REQUEST: assert(!"Illegal request in USB client"); break;
 		default: assert(!"Invalid error code in protocolErrorIntoApiError");
 	}
@@ -323,6 +327,8 @@ doTransferOfType(auto &lane, managarm::usb::XferType type, XferInfo info) {
 	req.set_allow_short_packets(info.allowShortPackets);
 	req.set_lazy_notification(info.lazyNotification);
 	req.set_length(info.buffer.size());
+	if constexpr (std::is_same_v<XferInfo, BulkTransfer>)
+		req.set_stream_id(info.streamId);
 
 	if(info.flags == kXferToDevice) {
 		auto [offer, sendReq, sendData, recvResp] =
@@ -383,6 +389,54 @@ async::result<frg::expected<UsbError, size_t>> EndpointState::transfer(BulkTrans
 	co_return co_await doTransferOfType(_lane, managarm::usb::XferType::BULK, info);
 }
 
+async::result<frg::expected<UsbError, size_t>> EndpointState::allocateStreams(size_t numStreams) {
+	managarm::usb::AllocateStreamsRequest req;
+	req.set_num_streams(numStreams);
+
+	auto [offer, sendReq, recvResp] = co_await helix_ng::exchangeMsgs(
+		_lane,
+		helix_ng::offer(
+			helix_ng::sendBragiHeadOnly(req, frg::stl_allocator{}),
+			helix_ng::recvInline()
+		)
+	);
+
+	HEL_CHECK(offer.error());
+	HEL_CHECK(sendReq.error());
+	HEL_CHECK(recvResp.error());
+
+	auto resp = bragi::parse_head_only<managarm::usb::SvrResponse>(recvResp);
+	recvResp.reset();
+
+	FRG_CO_TRY(transformProtocolError(resp->error()));
+
+	co_return resp->size();
+}
+
+async::result<frg::expected<UsbError>> EndpointState::cancelStream(uint32_t streamId) {
+	managarm::usb::CancelStreamRequest req;
+	req.set_stream_id(streamId);
+
+	auto [offer, sendReq, recvResp] = co_await helix_ng::exchangeMsgs(
+		_lane,
+		helix_ng::offer(
+			helix_ng::sendBragiHeadOnly(req, frg::stl_allocator{}),
+			helix_ng::recvInline()
+		)
+	);
+
+	HEL_CHECK(offer.error());
+	HEL_CHECK(sendReq.error());
+	HEL_CHECK(recvResp.error());
+
+	auto resp = bragi::parse_head_only<managarm::usb::SvrResponse>(recvResp);
+	recvResp.reset();
+
+	FRG_CO_TRY(transformProtocolError(resp->error()));
+
+	co_return frg::success;
+}
+
 } // anonymous namespace
 
 Device connect(helix::UniqueLane lane) {
@@ -1,6 +1,7 @@
 
 #include <string.h>
 #include <iostream>
+#include <type_traits>
 #include <bragi/helpers-std.hpp>
 
 #include "protocols/usb/server.hpp"
@@ -22,6 +23,7 @@ async::result<void> respondWithError(helix::UniqueDescriptor &conversation, UsbE
 		case timeout: protoErr = TIMEOUT; break;
 		case unsupported: protoErr = UNSUPPORTED; break;
 		case other: protoErr = OTHER; break;
+		case cancelled: protoErr = CANCELLED; break;
 		default: assert(!"Invalid error in respondWithError");
 	}
 
@@ -47,10 +49,80 @@ auto handleXferReq(auto req, auto &endpoint, auto &&...xferArgs) {
 
 	xfer.allowShortPackets = req->allow_short_packets();
 	xfer.lazyNotification = req->lazy_notification();
+	if constexpr (std::is_same_v<XferType, BulkTransfer>)
+		xfer.streamId = req->stream_id();
 
 	return endpoint.transfer(xfer);
 };
 
+async::result<void> handleTransfer(Endpoint endpoint, helix::UniqueDescriptor conversation,
+		managarm::usb::TransferRequest req) {
+	// TODO(qookie): Use proper pool:
+	//		 something like ep.device.bufferPool()
+	arch::dma_buffer buffer{nullptr, static_cast<size_t>(req.length())};
+
+	if (req.dir() == managarm::usb::XferDirection::TO_DEVICE) {
+		auto [recvBuffer] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::recvBuffer(buffer.data(), buffer.size())
+		);
+
+		HEL_CHECK(recvBuffer.error());
+	}
+
+	frg::expected<UsbError, uint64_t> outcome;
+
+	switch (req.type()) {
+		using enum managarm::usb::XferType;
+		case INTERRUPT:
+			outcome = co_await handleXferReq<InterruptTransfer>(&req, endpoint, buffer);
+			break;
+		case BULK:
+			outcome = co_await handleXferReq<BulkTransfer>(&req, endpoint, buffer);
+			break;
+			// TODO(qookie): Support control EPs
+			//case CONTROL:
+			//	outcome = co_await handleXferReq<ControlTransfer>(&req, endpoint, buffer);
+			//	break;
+		default:
+			std::cout << "Unexpected endpoint type\n";
+			co_await respondWithError(conversation, UsbError::unsupported);
+			co_return;
+	}
+
+	if (!outcome) {
+		co_await respondWithError(conversation, outcome.error());
+		co_return;
+	}
+
+	auto length = outcome.value();
+
+	managarm::usb::SvrResponse resp;
+	resp.set_error(managarm::usb::Errors::SUCCESS);
+
+	if (req.dir() == managarm::usb::XferDirection::TO_HOST) {
+		auto [sendResp, sendData] =
+			co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{}),
+				helix_ng::sendBuffer(buffer.data(), length)
+			);
+
+		HEL_CHECK(sendResp.error());
+		HEL_CHECK(sendData.error());
+	} else {
+		resp.set_size(length);
+
+		auto [sendResp] =
+			co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+			);
+
+		HEL_CHECK(sendResp.error());
+	}
+}
+
 } // namespace anonymous
 
 async::detached serveEndpoint(Endpoint endpoint, helix::UniqueLane lane) {
@@ -81,67 +153,65 @@ async::detached serveEndpoint(Endpoint endpoint, helix::UniqueLane lane) {
 				co_return;
 			}
 
-			// TODO(qookie): Use proper pool:
-			//		 something like ep.device.bufferPool()
-			arch::dma_buffer buffer{nullptr, static_cast<size_t>(req->length())};
-
-			if (req->dir() == managarm::usb::XferDirection::TO_DEVICE) {
-				auto [recvBuffer] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::recvBuffer(buffer.data(), buffer.size())
-				);
-
-				HEL_CHECK(recvBuffer.error());
+			if (req->stream_id()) {
+				// Transfers on different streams complete in any order;
+				// do not wait for this transfer before accepting the next one.
+				[] (Endpoint endpoint, helix::UniqueDescriptor conversation,
+						managarm::usb::TransferRequest req) -> async::detached {
+					co_await handleTransfer(std::move(endpoint), std::move(conversation),
+							std::move(req));
+				}(endpoint, std::move(conversation), std::move(*req));
+				continue;
 			}
 
-			frg::expected<UsbError, uint64_t> outcome;
-
-			switch (req->type()) {
-				using enum managarm::usb::XferType;
-				case INTERRUPT:
-					outcome = co_await handleXferReq<InterruptTransfer>(req, endpoint, buffer);
-					break;
-				case BULK:
-					outcome = co_await handleXferReq<BulkTransfer>(req, endpoint, buffer);
-					break;
-					// TODO(qookie): Support control EPs
-					//case CONTROL:
-					//	outcome = co_await handleXferReq<ControlTransfer>(req, endpoint, buffer);
-					//	break;
-				default:
-					std::cout << "Unexpected endpoint type\n";
-					co_return;
+			co_await handleTransfer(endpoint, std::move(conversation), std::move(*req));
+		} else if (preamble.id() == bragi::message_id<managarm::usb::AllocateStreamsRequest>) {
+			auto req = bragi::parse_head_only<managarm::usb::AllocateStreamsRequest>(recvReq);
+			recvReq.reset();
+			if (!req) {
+				co_return;
 			}
 
+			auto outcome = co_await endpoint.allocateStreams(req->num_streams());
+
 			if (!outcome) {
 				co_await respondWithError(conversation, outcome.error());
 				continue;
 			}
 
-			auto length = outcome.value();
-
 			managarm::usb::SvrResponse resp;
 			resp.set_error(managarm::usb::Errors::SUCCESS);
+			resp.set_size(outcome.value());
 
-			if (req->dir() == managarm::usb::XferDirection::TO_HOST) {
-				auto [sendResp, sendData] =
-					co_await helix_ng::exchangeMsgs(
-						conversation,
-						helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{}),
-						helix_ng::sendBuffer(buffer.data(), length)
-					);
+			auto [sendResp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+			);
 
-				HEL_CHECK(sendResp.error());
-				HEL_CHECK(sendData.error());
-			} else {
-				auto [sendResp] =
-					co_await helix_ng::exchangeMsgs(
-						conversation,
-						helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
-					);
+			HEL_CHECK(sendResp.error());
+		} else if (preamble.id() == bragi::message_id<managarm::usb::CancelStreamRequest>) {
+			auto req = bragi::parse_head_only<managarm::usb::CancelStreamRequest>(recvReq);
+			recvReq.reset();
+			if (!req) {
+				co_return;
+			}
 
-				HEL_CHECK(sendResp.error());
+			auto outcome = co_await endpoint.cancelStream(req->stream_id());
+
+			if (!outcome) {
+				co_await respondWithError(conversation, outcome.error());
+				continue;
 			}
+
+			managarm::usb::SvrResponse resp;
+			resp.set_error(managarm::usb::Errors::SUCCESS);
+
+			auto [sendResp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+			);
+
+			HEL_CHECK(sendResp.error());
 		}else{
 			recvReq.reset();
 			managarm::usb::SvrResponse resp;
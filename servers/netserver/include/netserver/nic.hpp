@@ -12,6 +12,8 @@
 #include <ostream>
 #include <protocols/mbus/client.hpp>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace nic {
 struct MacAddress {
@@ -48,10 +50,71 @@ private:
 enum EtherType : uint16_t {
 	ETHER_TYPE_IP4 = 0x0800,
 	ETHER_TYPE_ARP = 0x0806,
+	ETHER_TYPE_IP6 = 0x86DD,
+};
+
+// Work that a NIC can take over from the network stack.
+struct Offloads {
+	// The NIC computes TCP/UDP checksums of outgoing frames, see TxOffload.
+	bool txChecksum = false;
+	// The NIC verifies TCP/UDP checksums of incoming frames, see RxInfo.
+	bool rxChecksum = false;
+	// Largest TCP/IPv4 packet that the NIC splits into MTU-sized segments.
+	// Zero if the NIC does not support TCP segmentation offload. Implies txChecksum.
+	size_t maxTsoSize = 0;
+	// Largest frame that receive() returns, if the NIC coalesces segments.
+	size_t maxReceiveSize = 0;
+};
+
+// Describes the offloads that apply to a single outgoing frame.
+struct TxOffload {
+	// The NIC sums up the frame starting at checksumStart and stores the checksum
+	// at checksumStart + checksumOffset. That field must contain the (uncomplemented)
+	// sum of the pseudo header.
+	bool needsChecksum = false;
+	uint16_t checksumStart = 0;
+	uint16_t checksumOffset = 0;
+	// If non-zero, the frame is a TCP/IPv4 packet that the NIC splits into segments
+	// of segmentSize payload bytes. headerSize covers all headers, including TCP.
+	uint16_t segmentSize = 0;
+	uint16_t headerSize = 0;
+};
+
+struct RxInfo {
+	size_t length;
+	// The TCP/UDP checksum was verified by the NIC (or the frame was never
+	// checksummed since it did not leave the host).
+	bool checksumValid = false;
+};
+
+// Keeps the memory of a received frame alive. Once the last reference is dropped,
+// the NIC may reuse the memory for another frame.
+using FrameOwner = std::shared_ptr<void>;
+
+struct RxFrame {
+	FrameOwner owner;
+	arch::dma_buffer_view data;
+	RxInfo info;
+};
+
+// Recycles equally-sized receive buffers instead of allocating a new one per frame.
+struct RxBufferPool : std::enable_shared_from_this<RxBufferPool> {
+	RxBufferPool(arch::dma_pool *dmaPool, size_t bufferSize)
+	: dmaPool_{dmaPool}, bufferSize_{bufferSize} {}
+
+	size_t bufferSize() {
+		return bufferSize_;
+	}
+
+	// Returns a buffer that goes back to the pool once the owner is dropped.
+	std::pair<FrameOwner, arch::dma_buffer_view> allocate();
+
+private:
+	arch::dma_pool *dmaPool_;
+	size_t bufferSize_;
+	std::vector<arch::dma_buffer> free_;
 };
 
-// TODO(arsen): Expose interface for csum offloading, constructing frames, and
-// other features of NICs
 struct Link {
 	struct AllocatedBuffer {
 		arch::dma_buffer frame;
@@ -64,6 +127,19 @@ struct Link {
 	virtual async::result<size_t> receive(arch::dma_buffer_view) = 0;
 	//! Sends an entire ethernet frame
 	virtual async::result<void> send(const arch::dma_buffer_view) = 0;
+	//! Like receive() but also returns what the NIC checked
+	virtual async::result<RxInfo> receiveWithInfo(arch::dma_buffer_view frame);
+	//! Like send() but lets the NIC finish the frame, see offloads()
+	virtual async::result<void> sendWithOffload(const arch::dma_buffer_view frame, TxOffload offload);
+	//! Sends a frame from allocateFrame(). Links may keep the buffer instead of copying it.
+	//! The default implementation calls send() or sendWithOffload().
+	virtual async::result<void> transmit(arch::dma_buffer frame, TxOffload offload = {});
+	//! Appends between one and maxFrames received frames to frames.
+	//! The default implementation receives a single frame into a recycled buffer.
+	virtual async::result<void> receiveBatch(std::vector<RxFrame> &frames, size_t maxFrames);
+	const Offloads &offloads() {
+		return offloads_;
+	}
 	arch::dma_pool *dmaPool();
 	AllocatedBuffer allocateFrame(size_t payloadSize);
 	AllocatedBuffer allocateFrame(MacAddress to, EtherType type,
@@ -82,6 +158,10 @@ struct Link {
 		return raw_ip_;
 	}
 
+	bool loopback() {
+		return loopback_;
+	}
+
 	mbus_ng::Properties mbusNetworkProperties() {
 		return {
 			{"net.ifname", mbus_ng::StringItem{name()}},
@@ -107,6 +187,12 @@ protected:
 	bool l1_up_ = false;
 
 	bool raw_ip_ = false;
+	bool loopback_ = false;
+
+	Offloads offloads_;
+
+private:
+	std::shared_ptr<RxBufferPool> rxPool_;
 };
 
 async::detached runDevice(std::shared_ptr<Link> dev);
@@ -7,6 +7,7 @@
 #include <iomanip>
 #include <memory>
 #include "ip4.hpp"
+#include "transport.hpp"
 
 struct ArpHeader {
 	uint16_t hrd;
@@ -132,15 +133,38 @@ void Neighbours::feedArp(nic::MacAddress, arch::dma_buffer_view view, std::weak_
 	async::detach(sendArp(2, targetProto, senderHw, senderProto));
 }
 
-Neighbours::Entry &Neighbours::getEntry(uint32_t ip) {
+namespace {
+
+uint64_t now() {
 	uint64_t time;
 	HEL_CHECK(helGetClock(&time));
+	return time;
+}
+
+} // anonymous namespace
+
+void Neighbours::collectGarbage_(uint64_t time) {
+	std::erase_if(table_, [&] (auto &kv) {
+		auto &entry = kv.second;
+		// Entries in other states have coroutines that refer to them.
+		if (entry.state != State::reachable && entry.state != State::stale
+				&& entry.state != State::failed)
+			return false;
+		return !entry.pending && entry.mtime_ns + gcTimeMs * 1'000'000 <= time;
+	});
+}
+
+Neighbours::Entry &Neighbours::getEntry(uint32_t ip) {
+	auto time = now();
 	if (auto f = table_.find(ip); f != table_.end()) {
-		if (time + staleTimeMs * 1'000'000 <= f->second.mtime_ns) {
+		if (f->second.state == State::reachable
+				&& f->second.mtime_ns + staleTimeMs * 1'000'000 <= time) {
 			f->second.state = State::stale;
 		}
 		return f->second;
 	}
+	if (table_.size() >= gcThreshold)
+		collectGarbage_(time);
 	auto &entry = table_.emplace(std::piecewise_construct,
 		std::make_tuple(ip), std::make_tuple()).first->second;
 	entry.mtime_ns = time;
@@ -149,6 +173,10 @@ Neighbours::Entry &Neighbours::getEntry(uint32_t ip) {
 
 void Neighbours::updateTable(uint32_t ip, nic::MacAddress mac, std::weak_ptr<nic::Link> link) {
 	auto &entry = getEntry(ip);
+	// Cached targets still refer to the old MAC.
+	if (entry.usable() && entry.mac != mac)
+		inet::invalidateDsts();
+	entry.mtime_ns = now();
 	entry.mac = mac;
 	entry.state = State::reachable;
 	entry.link = std::move(link);
@@ -162,7 +190,7 @@ std::map<uint32_t, Neighbours::Entry> &Neighbours::getTable() {
 
 namespace {
 async::detached entryProber(uint32_t ip, Neighbours::Entry &e, uint32_t sender) {
-	e.state = Neighbours::State::probe;
+	e.state = Neighbours::State::incomplete;
 	for (int i = 0; i < 3; i++) {
 		co_await sendArp(1, sender, {}, ip);
 		std::cout << "netserver: sent arp req" << std::endl;
@@ -172,11 +200,45 @@ async::detached entryProber(uint32_t ip, Neighbours::Entry &e, uint32_t sender)
 		co_await e.change.async_wait(ev);
 		co_await timer.retire();
 
+		if (e.state != Neighbours::State::incomplete) {
+			co_return;
+		}
+	}
+	e.state = Neighbours::State::failed;
+	e.change.raise();
+}
+
+// Confirms that a stale entry is still valid. Other than entryProber(), the
+// requests are sent directly to the known MAC.
+async::detached entryRefresher(uint32_t ip, Neighbours::Entry &e, uint32_t sender) {
+	e.state = Neighbours::State::delay;
+	{
+		async::cancellation_event ev;
+		helix::TimeoutCancellation timer { Neighbours::delayTimeMs * 1'000'000, ev };
+		co_await e.change.async_wait(ev);
+		co_await timer.retire();
+	}
+	if (e.state != Neighbours::State::delay) {
+		co_return;
+	}
+
+	e.state = Neighbours::State::probe;
+	for (int i = 0; i < 3; i++) {
+		co_await sendArp(1, sender, e.mac, ip);
+
+		async::cancellation_event ev;
+		helix::TimeoutCancellation timer { 1'000'000'000, ev };
+		co_await e.change.async_wait(ev);
+		co_await timer.retire();
+
 		if (e.state != Neighbours::State::probe) {
 			co_return;
 		}
 	}
+	std::cout << "netserver: Neighbour " << std::hex << std::setw(8) << ip << std::dec
+		<< " stopped responding" << std::endl;
 	e.state = Neighbours::State::failed;
+	inet::invalidateDsts();
 	e.change.raise();
 }
 } // namespace
@@ -184,13 +246,24 @@ async::detached entryProber(uint32_t ip, Neighbours::Entry &e, uint32_t sender)
 async::result<std::optional<nic::MacAddress>> Neighbours::tryResolve(uint32_t ip,
 		uint32_t sender) {
 	auto &entry = getEntry(ip);
-	if (entry.state == State::reachable) {
+	if (entry.state == State::stale) {
+		entryRefresher(ip, entry, sender);
+	}
+	if (entry.usable()) {
 		co_return entry.mac;
 	}
-	if (entry.state != State::probe) {
+
+	if (entry.state != State::incomplete) {
 		entryProber(ip, entry, sender);
 	}
-	co_await entry.change.async_wait();
+	// Drop packets instead of queuing an unbounded number of them.
+	if (entry.pending >= maxPending) {
+		co_return std::nullopt;
+	}
+	entry.pending++;
+	while (entry.state == State::incomplete)
+		co_await entry.change.async_wait();
+	entry.pending--;
 	if (entry.state != State::reachable) {
 		co_return std::nullopt;
 	}
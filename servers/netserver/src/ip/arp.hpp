@@ -6,21 +6,47 @@
 #include <map>
 #include <optional>
 
+// Neighbour cache for IPv4. Entries follow the neighbour unreachability detection
+// of RFC 4861 (section 7.3.2), like on Linux: confirmed entries become stale after
+// some time, and stale entries are probed again once they are used.
 struct Neighbours {
+	// Confirmed entries become stale after this time.
 	static constexpr uint64_t staleTimeMs = 30'000;
+	// Stale entries that are used again are only probed if they are not confirmed within this time.
+	static constexpr uint64_t delayTimeMs = 5'000;
+	// Unused entries are removed this long after their last confirmation,
+	// but only once the table holds more than gcThreshold entries.
+	static constexpr uint64_t gcTimeMs = 60'000;
+	static constexpr size_t gcThreshold = 128;
+	// Number of senders that may wait for an entry to be resolved.
+	static constexpr unsigned int maxPending = 64;
+
 	enum class State {
 		none,
-		probe,
-		failed,
+		// Resolving, the MAC is not known yet.
+		incomplete,
 		reachable,
-		stale
+		stale,
+		// Used while stale, the MAC is still used until the probes fail.
+		delay,
+		probe,
+		failed
 	};
 	struct Entry {
+		// Time of the last confirmation.
 		uint64_t mtime_ns;
 		nic::MacAddress mac;
 		async::recurring_event change;
 		State state = State::none;
 		std::weak_ptr<nic::Link> link;
+		// Senders that wait until the entry is resolved.
+		unsigned int pending = 0;
+
+		// Whether the MAC can be used without resolving it first.
+		bool usable() const {
+			return state == State::reachable || state == State::stale
+				|| state == State::delay || state == State::probe;
+		}
 	};
 	async::result<std::optional<nic::MacAddress>> tryResolve(uint32_t addr,
 		uint32_t sender);
@@ -29,6 +55,7 @@ struct Neighbours {
 	std::map<uint32_t, Neighbours::Entry> &getTable();
 private:
 	Entry &getEntry(uint32_t addr);
+	void collectGarbage_(uint64_t now);
 	std::map<uint32_t, Entry> table_;
 };
 
@@ -1,32 +1,376 @@
 #include "checksum.hpp"
 
-#include <arch/bit.hpp>
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstring>
+#include <format>
+#include <iostream>
+#include <random>
+#include <vector>
 
-void Checksum::update(uint16_t word)  {
-	state_ += word;
-	while (state_ >> 16 != 0) {
-		state_ = (state_ >> 16) + (state_ & 0xffff);
+#ifdef __x86_64__
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+// The kernels below sum the data as native endian 16-bit words and return
+// an unfolded 64-bit partial sum. Since the one's complement sum does not
+// depend on byte order (RFC 1071, section 2), we only need to swap the
+// folded result on little endian machines.
+// If Copy is true, the kernels also copy the data to dest.
+using Kernel = uint64_t (*)(void *dest, const void *src, size_t size);
+
+inline uint64_t addWithCarry(uint64_t a, uint64_t b) {
+	uint64_t sum;
+	if (__builtin_add_overflow(a, b, &sum))
+		sum++;
+	return sum;
+}
+
+inline uint16_t fold(uint64_t sum) {
+	sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+	sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	return sum;
+}
+
+template<typename T, bool Copy>
+inline T load(unsigned char *&dest, const unsigned char *&src) {
+	T value;
+	memcpy(&value, src, sizeof(T));
+	if constexpr (Copy) {
+		memcpy(dest, &value, sizeof(T));
+		dest += sizeof(T);
 	}
+	src += sizeof(T);
+	return value;
 }
 
-void Checksum::update(const void *data, size_t size) {
-	using namespace arch;
-	auto iter = static_cast<const unsigned char*>(data);
-	if (size % 2 != 0) {
-		size--;
-		update(iter[size] << 8);
+template<bool Copy>
+uint64_t sumScalar(void *dest, const void *src, size_t size) {
+	auto d = static_cast<unsigned char *>(dest);
+	auto s = static_cast<const unsigned char *>(src);
+
+	// Use two accumulators to shorten the dependency chain of the carries.
+	uint64_t sum0 = 0;
+	uint64_t sum1 = 0;
+	for (; size >= 32; size -= 32) {
+		sum0 = addWithCarry(sum0, load<uint64_t, Copy>(d, s));
+		sum1 = addWithCarry(sum1, load<uint64_t, Copy>(d, s));
+		sum0 = addWithCarry(sum0, load<uint64_t, Copy>(d, s));
+		sum1 = addWithCarry(sum1, load<uint64_t, Copy>(d, s));
+	}
+	uint64_t sum = addWithCarry(sum0, sum1);
+	for (; size >= 8; size -= 8)
+		sum = addWithCarry(sum, load<uint64_t, Copy>(d, s));
+	if (size & 4)
+		sum = addWithCarry(sum, load<uint32_t, Copy>(d, s));
+	if (size & 2)
+		sum = addWithCarry(sum, load<uint16_t, Copy>(d, s));
+	if (size & 1) {
+		// The trailing byte is padded with a zero byte.
+		uint16_t word = 0;
+		memcpy(&word, s, 1);
+		if constexpr (Copy)
+			*d = *s;
+		sum = addWithCarry(sum, word);
 	}
-	auto end = iter + size;
-	for (; iter < end; iter += 2) {
-		update(iter[0] << 8 | iter[1]);
+	return sum;
+}
+
+// The vector kernels zero-extend the 16-bit words into 32-bit lanes.
+// Each iteration adds at most 2 * 0xFFFF to a lane (and the final sum of
+// two accumulators doubles that), so the lanes are spilled to the 64-bit
+// sum every 2^14 iterations.
+constexpr size_t maxVectorIterations = size_t{1} << 14;
+
+#ifdef __x86_64__
+
+template<bool Copy>
+[[gnu::target("avx2")]] uint64_t sumAvx2(void *dest, const void *src, size_t size) {
+	auto d = static_cast<unsigned char *>(dest);
+	auto s = static_cast<const unsigned char *>(src);
+	const __m256i zero = _mm256_setzero_si256();
+
+	uint64_t sum = 0;
+	while (size >= 32) {
+		size_t n = std::min(size / 32, maxVectorIterations);
+		__m256i accLow = zero;
+		__m256i accHigh = zero;
+		for (size_t i = 0; i < n; i++) {
+			auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s));
+			if constexpr (Copy) {
+				_mm256_storeu_si256(reinterpret_cast<__m256i *>(d), v);
+				d += 32;
+			}
+			accLow = _mm256_add_epi32(accLow, _mm256_unpacklo_epi16(v, zero));
+			accHigh = _mm256_add_epi32(accHigh, _mm256_unpackhi_epi16(v, zero));
+			s += 32;
+		}
+		size -= n * 32;
+
+		uint32_t lanes[8];
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes), _mm256_add_epi32(accLow, accHigh));
+		for (auto lane : lanes)
+			sum += lane;
 	}
+	return addWithCarry(sum, sumScalar<Copy>(d, s, size));
+}
+
+#elif defined(__aarch64__)
+
+template<bool Copy>
+uint64_t sumNeon(void *dest, const void *src, size_t size) {
+	auto d = static_cast<unsigned char *>(dest);
+	auto s = static_cast<const unsigned char *>(src);
+
+	uint64_t sum = 0;
+	while (size >= 16) {
+		size_t n = std::min(size / 16, maxVectorIterations);
+		uint32x4_t acc = vdupq_n_u32(0);
+		for (size_t i = 0; i < n; i++) {
+			auto v = vld1q_u8(s);
+			if constexpr (Copy) {
+				vst1q_u8(d, v);
+				d += 16;
+			}
+			acc = vpadalq_u16(acc, vreinterpretq_u16_u8(v));
+			s += 16;
+		}
+		size -= n * 16;
+		sum += vaddlvq_u32(acc);
+	}
+	return addWithCarry(sum, sumScalar<Copy>(d, s, size));
+}
+
+#endif
+
+struct KernelInfo {
+	const char *name;
+	Kernel sum;
+	Kernel copyAndSum;
+	bool (*supported)();
+	// Smaller buffers are summed by the scalar kernel.
+	size_t minSize = 0;
+};
+
+constexpr KernelInfo scalarKernel{"scalar", sumScalar<false>, sumScalar<true>, [] { return true; }};
+
+// Ordered by preference, the last supported kernel is used.
+// On x86_64, 64-bit adds make the scalar kernel about twice as fast as SSE2,
+// hence there is no SSE2 kernel. AVX2 only overtakes the scalar kernel
+// at about 512 to 768 bytes.
+constexpr KernelInfo kernels[] = {
+	scalarKernel,
+#ifdef __x86_64__
+	{"avx2", sumAvx2<false>, sumAvx2<true>, [] {
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") != 0;
+	}, 1024},
+#elif defined(__aarch64__)
+	{"neon", sumNeon<false>, sumNeon<true>, [] { return true; }},
+#endif
+};
+
+const KernelInfo &bestKernel() {
+	static const KernelInfo &best = [] () -> const KernelInfo & {
+		for (size_t i = std::size(kernels); i > 1; i--) {
+			if (kernels[i - 1].supported())
+				return kernels[i - 1];
+		}
+		return kernels[0];
+	}();
+	return best;
+}
+
+const KernelInfo &kernelFor(size_t size) {
+	auto &best = bestKernel();
+	if (size < best.minSize)
+		return scalarKernel;
+	return best;
+}
+
+// Converts the result of a kernel to a 16-bit sum in network byte order.
+uint16_t toNetworkSum(uint64_t partial) {
+	auto sum = fold(partial);
+	if constexpr (std::endian::native == std::endian::little)
+		sum = __builtin_bswap16(sum);
+	return sum;
+}
+
+} // anonymous namespace
+
+void Checksum::update(uint16_t word)  {
+	state_ += word;
+}
+
+void Checksum::update(const void *data, size_t size) {
+	accumulate_(kernelFor(size).sum(nullptr, data, size), size);
 }
 
 void Checksum::update(arch::dma_buffer_view view) {
 	update(view.data(), view.size());
 }
 
+void Checksum::copyAndUpdate(void *dest, const void *src, size_t size) {
+	accumulate_(kernelFor(size).copyAndSum(dest, src, size), size);
+}
+
+void Checksum::accumulate_(uint64_t partial, size_t size) {
+	auto sum = toNetworkSum(partial);
+	// A block that starts at an odd offset contributes its bytes swapped.
+	if (odd_)
+		sum = __builtin_bswap16(sum);
+	// Cannot overflow unless we sum more than 2^48 blocks.
+	state_ += sum;
+	odd_ ^= size & 1;
+}
+
 uint16_t Checksum::finalize() {
-	auto state_ = this->state_;
-	return ~state_;
+	return ~fold(state_);
+}
+
+uint16_t Checksum::sum() {
+	return fold(state_);
+}
+
+uint16_t adjustChecksum(uint16_t checksum, uint16_t oldValue, uint16_t newValue) {
+	// HC' = ~(~HC + ~m + m')
+	uint32_t sum = uint16_t(~checksum);
+	sum += uint16_t(~oldValue);
+	sum += newValue;
+	return ~fold(sum);
+}
+
+uint16_t adjustChecksum32(uint16_t checksum, uint32_t oldValue, uint32_t newValue) {
+	checksum = adjustChecksum(checksum, oldValue >> 16, newValue >> 16);
+	return adjustChecksum(checksum, oldValue & 0xFFFF, newValue & 0xFFFF);
+}
+
+namespace {
+
+// The original word-at-a-time implementation.
+uint16_t referenceChecksum(const unsigned char *data, size_t size) {
+	uint32_t state = 0;
+	for (size_t i = 0; i + 1 < size; i += 2)
+		state += data[i] << 8 | data[i + 1];
+	if (size % 2 != 0)
+		state += data[size - 1] << 8;
+	while (state >> 16 != 0)
+		state = (state >> 16) + (state & 0xffff);
+	return ~state;
+}
+
+} // anonymous namespace
+
+void benchmarkChecksum() {
+	constexpr size_t maxSize = 64 * 1024;
+	// Leave room for misaligning the buffers.
+	std::vector<unsigned char> source(maxSize + 64);
+	std::vector<unsigned char> dest(maxSize + 64);
+	std::mt19937 prng{42};
+	for (auto &byte : source)
+		byte = prng();
+
+	// Verify all kernels, including odd sizes and misaligned buffers.
+	bool okay = true;
+	for (auto &kernel : kernels) {
+		if (!kernel.supported())
+			continue;
+		for (size_t size = 0; size <= maxSize && okay; size = size < 256 ? size + 1 : size * 2 - 1) {
+			auto misalign = prng() % 64;
+			auto data = source.data() + misalign;
+			uint16_t expected = referenceChecksum(data, size);
+
+			auto sum = ~toNetworkSum(kernel.sum(nullptr, data, size));
+			std::fill(dest.begin(), dest.end(), 0);
+			auto copySum = ~toNetworkSum(kernel.copyAndSum(dest.data() + 3, data, size));
+			if (uint16_t(sum) != expected || uint16_t(copySum) != expected
+					|| memcmp(dest.data() + 3, data, size)) {
+				std::cout << std::format("netserver: checksum kernel {} is broken for {} bytes",
+						kernel.name, size) << std::endl;
+				okay = false;
+			}
+		}
+	}
+
+	// Split the data into blocks of arbitrary size. Blocks are large enough
+	// to mix the vector kernels with the scalar kernel for small blocks.
+	for (size_t i = 0; i < 1000 && okay; i++) {
+		size_t size = prng() % 4096;
+		Checksum csum;
+		size_t progress = 0;
+		while (progress < size) {
+			size_t chunk = std::min<size_t>(prng() % 2 ? prng() % 100 : prng() % 2048, size - progress);
+			if (prng() % 2)
+				csum.update(source.data() + progress, chunk);
+			else
+				csum.copyAndUpdate(dest.data() + progress, source.data() + progress, chunk);
+			progress += chunk;
+		}
+		if (csum.finalize() != referenceChecksum(source.data(), size)) {
+			std::cout << "netserver: Checksum of split data is broken" << std::endl;
+			okay = false;
+		}
+	}
+
+	// RFC 1624 updates.
+	for (size_t i = 0; i < 1000 && okay; i++) {
+		auto data = source.data();
+		size_t offset = (prng() % 32) * 2;
+		uint16_t oldValue = data[offset] << 8 | data[offset + 1];
+		uint16_t newValue = prng();
+		auto adjusted = adjustChecksum(referenceChecksum(data, 64), oldValue, newValue);
+
+		unsigned char modified[64];
+		memcpy(modified, data, 64);
+		modified[offset] = newValue >> 8;
+		modified[offset + 1] = newValue;
+		auto expected = referenceChecksum(modified, 64);
+		// 0x0000 and 0xFFFF are equivalent in one's complement arithmetic.
+		if (adjusted != expected && (adjusted | expected) != 0xFFFF) {
+			std::cout << "netserver: Incremental checksum update is broken" << std::endl;
+			okay = false;
+		}
+	}
+
+	if (!okay)
+		return;
+
+	auto measure = [&] (auto fn, size_t size) {
+		using clock = std::chrono::steady_clock;
+		size_t iterations = std::max<size_t>(1, (64 << 20) / size);
+		auto start = clock::now();
+		for (size_t i = 0; i < iterations; i++)
+			fn(size);
+		std::chrono::duration<double> elapsed = clock::now() - start;
+		return (iterations * size) / elapsed.count() / (1 << 20);
+	};
+
+	for (size_t size = 64; size <= maxSize; size *= 4) {
+		volatile uint16_t sink;
+		auto reference = measure([&] (size_t n) {
+			sink = referenceChecksum(source.data(), n);
+		}, size);
+		std::cout << std::format("netserver: Checksum of {} bytes: reference {:.0f} MiB/s",
+				size, reference);
+		for (auto &kernel : kernels) {
+			if (!kernel.supported())
+				continue;
+			auto sum = measure([&] (size_t n) {
+				sink = fold(kernel.sum(nullptr, source.data(), n));
+			}, size);
+			auto copy = measure([&] (size_t n) {
+				sink = fold(kernel.copyAndSum(dest.data(), source.data(), n));
+			}, size);
+			std::cout << std::format(", {} {:.0f} MiB/s ({:.0f} MiB/s with copy)",
+					kernel.name, sum, copy);
+		}
+		std::cout << std::endl;
+	}
 }
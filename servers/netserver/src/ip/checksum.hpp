@@ -4,13 +4,31 @@
 
 #include <arch/dma_structs.hpp>
 
-// 16-bit one's compliment sum checksum, as described in RFC791, amongst others
+// 16-bit one's compliment sum checksum, as described in RFC791, amongst others.
+// Data passed to consecutive update() calls is treated as one byte stream,
+// i.e., blocks do not need to start at an even offset.
 struct Checksum {
 	void update(uint16_t word);
 	void update(const void *mem, size_t size);
 	void update(arch::dma_buffer_view area);
+	// Copies the data to dest and adds it to the checksum in a single pass.
+	void copyAndUpdate(void *dest, const void *src, size_t size);
 	uint16_t finalize();
+	// Returns the sum without complementing it, e.g., to seed checksum offloading.
+	uint16_t sum();
 
 private:
-	uint32_t state_ = 0;
+	void accumulate_(uint64_t partial, size_t size);
+
+	uint64_t state_ = 0;
+	bool odd_ = false;
 };
+
+// Updates a checksum after a 16-bit (or 32-bit) field of the covered data
+// was rewritten, without summing the data again (RFC 1624, eqn. 3).
+uint16_t adjustChecksum(uint16_t checksum, uint16_t oldValue, uint16_t newValue);
+uint16_t adjustChecksum32(uint16_t checksum, uint32_t oldValue, uint32_t newValue);
+
+// Verifies all checksum kernels that the CPU supports against a simple
+// reference implementation and prints their throughput.
+void benchmarkChecksum();
@@ -0,0 +1,79 @@
+#include "icmp6.hpp"
+
+#include "checksum.hpp"
+#include "ip6.hpp"
+#include "ndp.hpp"
+
+#include <arch/bit.hpp>
+#include <async/basic.hpp>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+async::result<void> sendEchoReply(smarter::shared_ptr<const InetPacket> request) {
+	auto target = co_await ip6().targetByRemote(request->source, request->link.lock());
+	if(!target)
+		co_return;
+
+	// Answer from the address that the request was sent to, unless it was multicast.
+	if(!request->destination.isMulticast())
+		target->source = request->destination;
+
+	// The identifier, sequence number and data are echoed as-is.
+	auto body = request->payload.subview(4);
+	co_await sendIcmp6(std::move(*target), icmp6::echoReply, 0, body.data(), body.size());
+}
+
+} // anonymous namespace
+
+void Icmp6::feedDatagram(smarter::shared_ptr<const InetPacket> packet) {
+	auto payload = packet->payload;
+	if(payload.size() < 4)
+		return;
+
+	// Unlike for UDP, the checksum is mandatory and NICs do not verify it.
+	Checksum csum;
+	sumPseudoHeader(csum, packet->source, packet->destination, IpProto::icmp6, payload.size());
+	csum.update(payload);
+	auto sum = csum.finalize();
+	if(sum != 0 && sum != 0xFFFF) {
+		std::cout << "netserver: wrong ICMPv6 checksum" << std::endl;
+		return;
+	}
+
+	auto type = reinterpret_cast<const uint8_t *>(payload.data())[0];
+	switch(type) {
+	case icmp6::echoRequest:
+		async::detach(sendEchoReply(std::move(packet)));
+		break;
+	case icmp6::routerAdvertisement:
+		neigh6().feedRouterAdvertisement(*packet);
+		break;
+	case icmp6::neighbourSolicitation:
+		neigh6().feedSolicitation(*packet);
+		break;
+	case icmp6::neighbourAdvertisement:
+		neigh6().feedAdvertisement(*packet);
+		break;
+	default:
+		break;
+	}
+}
+
+async::result<protocols::fs::Error> sendIcmp6(Ip6TargetInfo target, uint8_t type, uint8_t code,
+		const void *body, size_t size) {
+	std::vector<char> buf(4 + size);
+	buf[0] = type;
+	buf[1] = code;
+	std::memcpy(buf.data() + 4, body, size);
+
+	Checksum csum;
+	sumPseudoHeader(csum, target.source, target.remote, IpProto::icmp6, buf.size());
+	csum.update(buf.data(), buf.size());
+	auto sum = arch::to_endian<arch::big_endian, uint16_t>(csum.finalize());
+	std::memcpy(buf.data() + 2, &sum, sizeof(sum));
+
+	co_return co_await ip6().sendFrame(std::move(target), buf.data(), buf.size(), IpProto::icmp6);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <async/result.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <protocols/fs/common.hpp>
+#include <smarter.hpp>
+
+struct InetPacket;
+struct Ip6TargetInfo;
+
+namespace icmp6 {
+
+constexpr uint8_t echoRequest = 128;
+constexpr uint8_t echoReply = 129;
+constexpr uint8_t routerSolicitation = 133;
+constexpr uint8_t routerAdvertisement = 134;
+constexpr uint8_t neighbourSolicitation = 135;
+constexpr uint8_t neighbourAdvertisement = 136;
+
+} // namespace icmp6
+
+struct Icmp6 {
+	void feedDatagram(smarter::shared_ptr<const InetPacket> packet);
+};
+
+// Sends an ICMPv6 message. body is the part that follows the type, code and checksum.
+async::result<protocols::fs::Error> sendIcmp6(Ip6TargetInfo target, uint8_t type, uint8_t code,
+		const void *body, size_t size);
@@ -0,0 +1,123 @@
+#include "inet.hpp"
+#include "checksum.hpp"
+
+#include <algorithm>
+#include <arch/bit.hpp>
+#include <arpa/inet.h>
+#include <cstring>
+#include <sys/socket.h>
+
+namespace {
+
+constexpr uint8_t ip4MappedPrefix[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF};
+
+} // anonymous namespace
+
+InetAddress InetAddress::fromIp4(uint32_t address) {
+	InetAddress result;
+	std::memcpy(result.bytes.data(), ip4MappedPrefix, sizeof(ip4MappedPrefix));
+	auto be = arch::to_endian<arch::big_endian, uint32_t>(address);
+	std::memcpy(result.bytes.data() + 12, &be, sizeof(be));
+	return result;
+}
+
+InetAddress InetAddress::fromIp6(const in6_addr &address) {
+	InetAddress result;
+	std::memcpy(result.bytes.data(), &address, sizeof(address));
+	return result;
+}
+
+InetAddress InetAddress::any(int family) {
+	if(family == AF_INET)
+		return fromIp4(INADDR_ANY);
+	return {};
+}
+
+bool InetAddress::isIp4() const {
+	return !std::memcmp(bytes.data(), ip4MappedPrefix, sizeof(ip4MappedPrefix));
+}
+
+uint32_t InetAddress::ip4() const {
+	uint32_t be;
+	std::memcpy(&be, bytes.data() + 12, sizeof(be));
+	return arch::from_endian<arch::big_endian, uint32_t>(be);
+}
+
+in6_addr InetAddress::ip6() const {
+	in6_addr result;
+	std::memcpy(&result, bytes.data(), sizeof(result));
+	return result;
+}
+
+std::string InetAddress::toString() const {
+	char buffer[INET6_ADDRSTRLEN];
+	if(isIp4()) {
+		inet_ntop(AF_INET, bytes.data() + 12, buffer, sizeof(buffer));
+	}else{
+		inet_ntop(AF_INET6, bytes.data(), buffer, sizeof(buffer));
+	}
+	return buffer;
+}
+
+void sumPseudoHeader(Checksum &csum, const InetAddress &source, const InetAddress &destination,
+		IpProto proto, size_t length) {
+	// Since the pseudo header consists of 16-bit words, the order of the words does not matter.
+	if(source.isIp4()) {
+		csum.update(source.bytes.data() + 12, 4);
+		csum.update(destination.bytes.data() + 12, 4);
+		csum.update(static_cast<uint16_t>(length));
+	}else{
+		csum.update(source.bytes.data(), 16);
+		csum.update(destination.bytes.data(), 16);
+		csum.update(static_cast<uint16_t>(length >> 16));
+		csum.update(static_cast<uint16_t>(length));
+	}
+	csum.update(static_cast<uint16_t>(proto));
+}
+
+protocols::fs::Error parseSockaddr(const void *ptr, size_t length, int family,
+		InetAddress &address, uint16_t &port) {
+	if(family == AF_INET) {
+		sockaddr_in sa;
+		if(length < sizeof(sa))
+			return protocols::fs::Error::illegalArguments;
+		std::memcpy(&sa, ptr, sizeof(sa));
+		if(sa.sin_family != AF_INET)
+			return protocols::fs::Error::afNotSupported;
+
+		address = InetAddress::fromIp4(arch::from_endian<arch::big_endian, uint32_t>(sa.sin_addr.s_addr));
+		port = arch::from_endian<arch::big_endian, uint16_t>(sa.sin_port);
+		return protocols::fs::Error::none;
+	}
+
+	sockaddr_in6 sa;
+	if(length < sizeof(sa))
+		return protocols::fs::Error::illegalArguments;
+	std::memcpy(&sa, ptr, sizeof(sa));
+	if(sa.sin6_family != AF_INET6)
+		return protocols::fs::Error::afNotSupported;
+
+	address = InetAddress::fromIp6(sa.sin6_addr);
+	if(address.isIp4())
+		return protocols::fs::Error::addressNotAvailable;
+	port = arch::from_endian<arch::big_endian, uint16_t>(sa.sin6_port);
+	return protocols::fs::Error::none;
+}
+
+size_t emitSockaddr(void *ptr, size_t length, int family, const InetAddress &address, uint16_t port) {
+	if(family == AF_INET) {
+		sockaddr_in sa{};
+		sa.sin_family = AF_INET;
+		sa.sin_port = arch::to_endian<arch::big_endian, uint16_t>(port);
+		sa.sin_addr.s_addr = arch::to_endian<arch::big_endian, uint32_t>(address.ip4());
+		std::memcpy(ptr, &sa, std::min(sizeof(sa), length));
+		return sizeof(sa);
+	}
+
+	sockaddr_in6 sa{};
+	sa.sin6_family = AF_INET6;
+	sa.sin6_port = arch::to_endian<arch::big_endian, uint16_t>(port);
+	sa.sin6_addr = address.ip6();
+	std::memcpy(ptr, &sa, std::min(sizeof(sa), length));
+	return sizeof(sa);
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <arch/dma_structs.hpp>
+#include <array>
+#include <compare>
+#include <cstdint>
+#include <memory>
+#include <netinet/in.h>
+#include <netserver/nic.hpp>
+#include <protocols/fs/common.hpp>
+#include <string>
+
+struct Checksum;
+
+enum class IpProto : uint16_t {
+	icmp = 1,
+	tcp = 6,
+	udp = 17,
+	icmp6 = 58,
+};
+
+// An IPv4 or IPv6 address. IPv4 addresses are stored as IPv4-mapped IPv6 addresses
+// (RFC 4291, section 2.5.5.2), such that TCP and UDP handle both families alike.
+struct InetAddress {
+	// Takes the address in native byte order, like Ip4Packet::Header.
+	static InetAddress fromIp4(uint32_t address);
+	static InetAddress fromIp6(const in6_addr &address);
+	// The wildcard address of a family, i.e., 0.0.0.0 or ::.
+	static InetAddress any(int family);
+
+	bool isIp4() const;
+	int family() const {
+		return isIp4() ? AF_INET : AF_INET6;
+	}
+
+	// Only valid for IPv4 addresses. Returns the address in native byte order.
+	uint32_t ip4() const;
+	in6_addr ip6() const;
+
+	bool isAny() const {
+		return *this == any(family());
+	}
+	bool isBroadcast() const {
+		return *this == fromIp4(INADDR_BROADCAST);
+	}
+	// The remaining predicates only apply to IPv6.
+	bool isMulticast() const {
+		return bytes[0] == 0xFF;
+	}
+	bool isLinkLocal() const {
+		return bytes[0] == 0xFE && (bytes[1] & 0xC0) == 0x80;
+	}
+
+	std::string toString() const;
+
+	friend auto operator<=>(const InetAddress &, const InetAddress &) = default;
+
+	std::array<uint8_t, 16> bytes = {};
+};
+
+static_assert(sizeof(InetAddress) == 16);
+
+// What TCP, UDP and ICMPv6 need to know about a received IP packet.
+struct InetPacket {
+	InetAddress source;
+	InetAddress destination;
+	// The transport header and its payload.
+	arch::dma_buffer_view payload;
+	uint8_t protocol = 0;
+	// TTL for IPv4, hop limit for IPv6.
+	uint8_t hopLimit = 0;
+	// The NIC already verified the TCP/UDP checksum.
+	bool checksumValid = false;
+	std::weak_ptr<nic::Link> link;
+	// Keeps the payload alive.
+	nic::FrameOwner owner;
+};
+
+// Adds the pseudo header of TCP, UDP and ICMPv6 checksums (RFC 9293, section 3.1
+// and RFC 8200, section 8.1) to a checksum.
+void sumPseudoHeader(Checksum &csum, const InetAddress &source, const InetAddress &destination,
+		IpProto proto, size_t length);
+
+// Parses a sockaddr_in (for AF_INET sockets) or a sockaddr_in6 (for AF_INET6 sockets).
+// IPv6 sockets behave as if IPV6_V6ONLY was set, i.e., they reject IPv4-mapped addresses.
+protocols::fs::Error parseSockaddr(const void *ptr, size_t length, int family,
+		InetAddress &address, uint16_t &port);
+// Writes (a prefix of) the sockaddr of the given family and returns its full size.
+size_t emitSockaddr(void *ptr, size_t length, int family, const InetAddress &address, uint16_t port);
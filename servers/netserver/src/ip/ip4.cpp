@@ -2,15 +2,23 @@
 
 #include "arp.hpp"
 #include "checksum.hpp"
+#include "loopback.hpp"
+#include "tcp4.hpp"
+#include "transport.hpp"
+#include "udp4.hpp"
 #include <async/recurring-event.hpp>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <algorithm>
+#include <cassert>
+#include <chrono>
 #include <cstring>
+#include <format>
 #include <iostream>
 #include <iomanip>
 #include <protocols/fs/server.hpp>
 #include <queue>
+#include <random>
 
 using namespace protocols::fs;
 
@@ -26,29 +34,9 @@ Ip4 &ip4() {
 	return inst;
 }
 
-bool Ip4Router::addRoute(Route r) {
-	return routes.emplace(std::move(r)).second;
-}
-
-std::optional<Route> Ip4Router::resolveRoute(uint32_t ip, std::shared_ptr<nic::Link> link) {
-	for (auto i = routes.begin(); i != routes.end(); i++) {
-		const auto &r = *i;
-		if (r.network.sameNet(ip)) {
-			if(link && r.link.lock()->index() != link->index())
-				continue;
-
-			if (r.link.expired()) {
-				i = routes.erase(i);
-				continue;
-			}
-			return { r };
-		}
-	}
-	return {};
-}
-
-bool operator<(const CidrAddress &lhs, const CidrAddress &) {
-	return std::tie(lhs.prefix, lhs.ip) < std::tie(lhs.prefix, lhs.ip);
+bool operator<(const CidrAddress &lhs, const CidrAddress &rhs) {
+	// Longer prefixes sort first.
+	return std::tie(rhs.prefix, lhs.ip) < std::tie(lhs.prefix, rhs.ip);
 }
 
 auto operator<=>(const Route &lhs, const Route &rhs) {
@@ -71,8 +59,64 @@ bool operator==(const Route &lhs, const Route &rhs) {
 	return operator<=>(lhs, rhs) == 0;
 }
 
-bool Ip4Packet::parse(arch::dma_buffer owner, arch::dma_buffer_view frame) {
-	buffer_ = std::move(owner);
+namespace {
+
+std::array<uint8_t, 4> routeKey(uint32_t ip) {
+	auto be = arch::to_endian<arch::big_endian, uint32_t>(ip);
+	std::array<uint8_t, 4> key;
+	std::memcpy(key.data(), &be, sizeof(be));
+	return key;
+}
+
+} // anonymous namespace
+
+bool Ip4Router::addRoute(Route r) {
+	r.network.ip &= r.network.mask();
+	auto &candidates = routes.insert(routeKey(r.network.ip), r.network.prefix);
+	if (std::ranges::find(candidates, r) != candidates.end())
+		return false;
+	auto it = std::ranges::upper_bound(candidates, r, [] (const Route &lhs, const Route &rhs) {
+		return (lhs <=> rhs) < 0;
+	});
+	candidates.insert(it, std::move(r));
+	inet::invalidateDsts();
+	return true;
+}
+
+std::optional<Route> Ip4Router::resolveRoute(uint32_t ip, std::shared_ptr<nic::Link> link) {
+	std::optional<Route> result;
+	routes.lookup(routeKey(ip), [&] (std::vector<Route> &candidates) {
+		for (auto i = candidates.begin(); i != candidates.end();) {
+			auto routeLink = i->link.lock();
+			if (!routeLink) {
+				i = candidates.erase(i);
+				continue;
+			}
+			if (link && routeLink->index() != link->index()) {
+				i++;
+				continue;
+			}
+			result = *i;
+			return true;
+		}
+		return false;
+	});
+	return result;
+}
+
+std::vector<Route> Ip4Router::getRoutes() {
+	std::vector<Route> result;
+	routes.forEach([&] (auto &, unsigned int, std::vector<Route> &candidates) {
+		for (auto &r : candidates) {
+			if (!r.link.expired())
+				result.push_back(r);
+		}
+	});
+	return result;
+}
+
+bool Ip4Packet::parse(nic::FrameOwner owner, arch::dma_buffer_view frame) {
+	owner_ = std::move(owner);
 	data = frame;
 	if (data.size() < sizeof(header)) {
 		return false;
@@ -100,6 +144,19 @@ bool Ip4Packet::parse(arch::dma_buffer owner, arch::dma_buffer_view frame) {
 	return true;
 }
 
+InetPacket Ip4Packet::inet() const {
+	return InetPacket{
+		.source = InetAddress::fromIp4(header.source),
+		.destination = InetAddress::fromIp4(header.destination),
+		.payload = payload(),
+		.protocol = header.protocol,
+		.hopLimit = header.ttl,
+		.checksumValid = checksumValid,
+		.link = link,
+		.owner = owner_,
+	};
+}
+
 namespace {
 auto checkAddress(const void *addr_ptr, size_t addr_len, uint32_t &ip) {
 	struct sockaddr_in addr;
@@ -234,6 +291,14 @@ async::result<frg::expected<protocols::fs::Error, size_t>> Ip4Socket::sendmsg(vo
 
 async::result<std::optional<Ip4TargetInfo>>
 Ip4::targetByRemote(uint32_t remote, std::shared_ptr<nic::Link> link) {
+	// Packets to our own addresses never leave the host.
+	if (hasIp(remote)) {
+		if (auto lo = nic::loopback::get()) {
+			Ip4Router::Route route{{remote, 32}, lo};
+			co_return Ip4TargetInfo { remote, remote, std::move(route), std::move(lo) };
+		}
+	}
+
 	auto oroute = ip4Router().resolveRoute(remote, link);
 	if (!oroute) {
 		std::cout << "netserver: net unreachable" << std::endl;
@@ -262,6 +327,14 @@ Ip4::targetByRemote(uint32_t remote, std::shared_ptr<nic::Link> link) {
 	co_return Ip4TargetInfo { remote, source, *oroute, std::move(target) };
 }
 
+async::result<std::optional<nic::MacAddress>> Ip4::resolveNextHop(const Ip4TargetInfo &ti) {
+	auto macTarget = ti.route.gateway;
+	if (macTarget == 0) {
+		macTarget = ti.remote;
+	}
+	co_return co_await neigh4().tryResolve(macTarget, ti.source);
+}
+
 bool Ip4::hasIp(uint32_t addr) {
 	return std::any_of(ips.cbegin(), ips.cend(),
 		[addr] (auto &x) {
@@ -270,7 +343,7 @@ bool Ip4::hasIp(uint32_t addr) {
 }
 
 async::result<protocols::fs::Error> Ip4::sendFrame(Ip4TargetInfo ti,
-		void *data, size_t len, uint16_t proto) {
+		const void *data, size_t len, uint16_t proto, nic::TxOffload offload) {
 	using arch::convert_endian;
 	using arch::endian;
 
@@ -278,14 +351,22 @@ async::result<protocols::fs::Error> Ip4::sendFrame(Ip4TargetInfo ti,
 	// calculate header size
 	size_t header_size = sizeof(Ip4Packet::Header);
 	size_t packet_size = len + header_size;
+	auto &target = ti.link;
+
+	// With TSO, only the segments that the NIC produces need to fit into the MTU.
+	size_t segment_size = packet_size;
+	if (offload.segmentSize) {
+		assert(packet_size <= target->offloads().maxTsoSize);
+		segment_size = std::min(packet_size, header_size + offload.headerSize + offload.segmentSize);
+	}
+
 	// TODO(arsen): options
-	if (ti.route.mtu != 0 && ti.route.mtu < packet_size) {
+	if (ti.route.mtu != 0 && ti.route.mtu < segment_size) {
 		std::cout << "netserver: cant fragment 1" << std::endl;
 		co_return protocols::fs::Error::messageSize;
 	}
 
-	auto &target = ti.link;
-	if (target->mtu < packet_size) {
+	if (target->mtu < segment_size) {
 		std::cout << "netserver: cant fragment 2" << std::endl;
 		co_return protocols::fs::Error::messageSize;
 	}
@@ -314,12 +395,9 @@ async::result<protocols::fs::Error> Ip4::sendFrame(Ip4TargetInfo ti,
 	nic::Link::AllocatedBuffer fb;
 
 	if(!target->rawIp()) {
-		auto macTarget = ti.route.gateway;
-		if (macTarget == 0) {
-			macTarget = ti.remote;
-		}
-
-		auto mac = co_await neigh4().tryResolve(macTarget, ti.source);
+		auto mac = ti.nextHopMac;
+		if (!mac)
+			mac = co_await resolveNextHop(ti);
 		if (!mac) {
 			co_return protocols::fs::Error::hostUnreachable;
 		}
@@ -332,14 +410,24 @@ async::result<protocols::fs::Error> Ip4::sendFrame(Ip4TargetInfo ti,
 	std::memcpy(fb.payload.data(), &hdr, sizeof(hdr));
 	std::memcpy(fb.payload.subview(header_size).byte_data(), data, len);
 
-	co_await target->send(std::move(fb.frame));
+	if (offload.needsChecksum || offload.segmentSize) {
+		// Make the offsets relative to the start of the frame.
+		auto prefix = static_cast<char *>(fb.payload.data())
+				- static_cast<char *>(fb.frame.data()) + header_size;
+		offload.checksumStart += prefix;
+		if (offload.segmentSize)
+			offload.headerSize += prefix;
+	}
+	co_await target->transmit(std::move(fb.frame), offload);
 	co_return protocols::fs::Error::none;
 }
 
 void Ip4::feedPacket(nic::MacAddress, nic::MacAddress,
-		arch::dma_buffer owner, arch::dma_buffer_view frame, std::weak_ptr<nic::Link> link) {
+		nic::FrameOwner owner, arch::dma_buffer_view frame, std::weak_ptr<nic::Link> link,
+		bool checksumValid) {
 	Ip4Packet hdr{};
 	hdr.link = link;
+	hdr.checksumValid = checksumValid;
 
 	if (!hdr.parse(std::move(owner), frame)) {
 		std::cout << "netserver: runt, or otherwise invalid, ip4 frame received"
@@ -348,21 +436,26 @@ void Ip4::feedPacket(nic::MacAddress, nic::MacAddress,
 	}
 	auto proto = hdr.header.protocol;
 
+	// TCP and UDP do not need the IP header, hence they get a smaller packet.
+	switch (static_cast<IpProto>(proto)) {
+	case IpProto::udp:
+		udp().feedDatagram(smarter::make_shared<const InetPacket>(hdr.inet()));
+		break;
+	case IpProto::tcp:
+		tcp().feedDatagram(smarter::make_shared<const InetPacket>(hdr.inet()));
+		break;
+	default:
+		break;
+	}
+
 	auto begin = sockets.lower_bound(proto);
-	if (begin == sockets.end()
-			&& proto != static_cast<uint16_t>(IpProto::udp)
-			&& proto != static_cast<uint16_t>(IpProto::tcp)) {
+	bool hasSockets = begin != sockets.end() && begin->first == proto;
+	if (!hasSockets && proto != static_cast<uint16_t>(IpProto::icmp))
 		return;
-	}
 
 	auto hdrs = smarter::make_shared<const Ip4Packet>(std::move(hdr));
-
-	switch (static_cast<IpProto>(proto)) {
-	case IpProto::icmp: icmp.feedDatagram(hdrs, link); break;
-	case IpProto::udp: udp.feedDatagram(hdrs, link); break;
-	case IpProto::tcp: tcp.feedDatagram(hdrs); break;
-	default: break;
-	}
+	if (proto == static_cast<uint16_t>(IpProto::icmp))
+		icmp.feedDatagram(hdrs, link);
 
 	for (; begin != sockets.end() && begin->first == proto; begin++) {
 		begin->second->pqueue.emplace(hdrs);
@@ -372,6 +465,7 @@ void Ip4::feedPacket(nic::MacAddress, nic::MacAddress,
 
 void Ip4::setLink(CidrAddress addr, std::weak_ptr<nic::Link> l) {
 	ips.emplace(addr, std::move(l));
+	inet::invalidateDsts();
 }
 
 std::shared_ptr<nic::Link> Ip4::getLink(uint32_t addr) {
@@ -405,6 +499,7 @@ std::optional<CidrAddress> Ip4::getCidrByIndex(int index) {
 }
 
 bool Ip4::deleteLink(CidrAddress addr) {
+	inet::invalidateDsts();
 	return ips.erase(addr) > 0;
 }
 
@@ -446,14 +541,122 @@ managarm::fs::Errors Ip4::serveSocket(helix::UniqueLane lane, int type, int prot
 			icmp.serveSocket(std::move(lane));
 			break;
 		default:
-			udp.serveSocket(std::move(lane));
+			udp().serveSocket(AF_INET, std::move(lane));
 			break;
 		}
 		return managarm::fs::Errors::SUCCESS;
 	case SOCK_STREAM:
-		tcp.serveSocket(flags, std::move(lane));
+		tcp().serveSocket(AF_INET, flags, std::move(lane));
 		return managarm::fs::Errors::SUCCESS;
 	default:
 		return managarm::fs::Errors::ILLEGAL_ARGUMENT;
 	}
 }
+
+void benchmarkRoutes() {
+	constexpr size_t numRoutes = 100'000;
+	std::mt19937 prng{42};
+
+	// Like in the global routing table, most prefixes are /24.
+	auto randomPrefix = [&] () -> uint8_t {
+		auto r = prng() % 100;
+		if (r < 60)
+			return 24;
+		if (r < 75)
+			return 22 + prng() % 2;
+		if (r < 90)
+			return 16 + prng() % 6;
+		if (r < 95)
+			return 8 + prng() % 8;
+		return 25 + prng() % 8;
+	};
+
+	// Values are indices into networks, starting at one. The default route is always present.
+	std::vector<CidrAddress> networks{{0, 0}};
+	LpmTrie<4, size_t, 16> trie;
+	LpmTrie<4, size_t> plainTrie;
+	trie.insert(routeKey(0), 0) = 1;
+	plainTrie.insert(routeKey(0), 0) = 1;
+	while (networks.size() < numRoutes) {
+		CidrAddress network{static_cast<uint32_t>(prng()), randomPrefix()};
+		network.ip &= network.mask();
+		auto &value = trie.insert(routeKey(network.ip), network.prefix);
+		if (value)
+			continue;
+		networks.push_back(network);
+		value = networks.size();
+		plainTrie.insert(routeKey(network.ip), network.prefix) = value;
+	}
+
+	// Half of the addresses fall into random routes, the others are random.
+	std::vector<uint32_t> addresses(1 << 16);
+	for (size_t i = 0; i < addresses.size(); i++) {
+		if (i % 2) {
+			auto &network = networks[prng() % networks.size()];
+			addresses[i] = network.ip | (prng() & ~network.mask());
+		} else {
+			addresses[i] = prng();
+		}
+	}
+
+	std::vector<bool> erased(networks.size());
+	auto reference = [&] (uint32_t address) {
+		size_t best = 0;
+		for (size_t i = 0; i < networks.size(); i++) {
+			if (erased[i] || !networks[i].sameNet(address))
+				continue;
+			if (!best || networks[i].prefix > networks[best - 1].prefix)
+				best = i + 1;
+		}
+		return best;
+	};
+	auto resolve = [] (auto &t, uint32_t address) {
+		size_t result = 0;
+		t.lookup(routeKey(address), [&] (size_t &value) {
+			result = value;
+			return true;
+		});
+		return result;
+	};
+
+	// Check the lookups, also after removing routes, which updates the links between nodes.
+	auto verify = [&] () {
+		for (size_t i = 0; i < 1000; i++) {
+			auto address = addresses[i];
+			auto expected = reference(address);
+			if (resolve(trie, address) != expected || resolve(plainTrie, address) != expected) {
+				std::cout << std::format("netserver: Route lookup of {:08x} is broken", address)
+						<< std::endl;
+				return false;
+			}
+		}
+		return true;
+	};
+
+	auto measure = [&] (auto &t) {
+		using clock = std::chrono::steady_clock;
+		constexpr size_t iterations = 10'000'000;
+		volatile size_t sink;
+		auto start = clock::now();
+		for (size_t i = 0; i < iterations; i++)
+			sink = resolve(t, addresses[i % addresses.size()]);
+		std::chrono::duration<double> elapsed = clock::now() - start;
+		return iterations / elapsed.count() / 1e6;
+	};
+	if (!verify())
+		return;
+	auto withFront = measure(trie);
+	auto withoutFront = measure(plainTrie);
+
+	for (size_t i = 1; i < networks.size(); i += 2) {
+		trie.erase(routeKey(networks[i].ip), networks[i].prefix);
+		plainTrie.erase(routeKey(networks[i].ip), networks[i].prefix);
+		erased[i] = true;
+	}
+	if (!verify())
+		return;
+
+	std::cout << std::format("netserver: Route lookup with {} routes: {:.1f} M/s"
+			" ({:.1f} M/s without front table)",
+			numRoutes, withFront, withoutFront) << std::endl;
+}
@@ -7,24 +7,18 @@
 #include <smarter.hpp>
 #include <netserver/nic.hpp>
 #include <protocols/fs/common.hpp>
-#include <set>
 #include <cstdint>
 #include <memory>
 #include <optional>
+#include <vector>
 
 #include "icmp.hpp"
-#include "udp4.hpp"
-#include "tcp4.hpp"
+#include "inet.hpp"
+#include "lpm-trie.hpp"
 
 #include <netserver/nic.hpp>
 #include "fs.bragi.hpp"
 
-enum class IpProto : uint16_t {
-	icmp = 1,
-	tcp = 6,
-	udp = 17,
-};
-
 struct CidrAddress {
 	uint32_t ip;
 	uint8_t prefix;
@@ -66,15 +60,16 @@ struct Ip4Router {
 	bool addRoute(Route r);
 	std::optional<Route> resolveRoute(uint32_t ip, std::shared_ptr<nic::Link> link = {});
 
-	inline const std::set<Route> &getRoutes() const {
-		return routes;
-	}
+	std::vector<Route> getRoutes();
 private:
-	std::set<Route> routes;
+	// Keyed by the network in network byte order. Routes to the same
+	// network are kept sorted, such that the preferred route comes first.
+	// Lookups start at a table of the first 16 bits (512 KiB on 64-bit).
+	LpmTrie<4, std::vector<Route>, 16> routes;
 };
 
 class Ip4Packet {
-	arch::dma_buffer buffer_;
+	nic::FrameOwner owner_;
 public:
 	struct Header {
 		uint8_t ihl;
@@ -108,6 +103,8 @@ public:
 	static_assert(sizeof(header) == 20, "bad header size");
 	arch::dma_buffer_view data;
 	std::weak_ptr<nic::Link> link;
+	// The NIC already verified the TCP/UDP checksum.
+	bool checksumValid = false;
 
 	inline arch::dma_buffer_view payload() const {
 		return data.subview(header.ihl * 4);
@@ -117,8 +114,15 @@ public:
 		return data.subview(0, header.ihl * 4);
 	}
 
+	inline const nic::FrameOwner &owner() const {
+		return owner_;
+	}
+
+	// Drops the IP header, which TCP and UDP do not need.
+	InetPacket inet() const;
+
 	// assumes frame is a valid view into owner
-	bool parse(arch::dma_buffer owner, arch::dma_buffer_view frame);
+	bool parse(nic::FrameOwner owner, arch::dma_buffer_view frame);
 };
 
 struct Ip4TargetInfo {
@@ -126,6 +130,8 @@ struct Ip4TargetInfo {
 	uint32_t source;
 	Ip4Router::Route route;
 	std::shared_ptr<nic::Link> link;
+	// MAC of the gateway (or the remote) if it is already known, e.g., from a DstCache.
+	std::optional<nic::MacAddress> nextHopMac = std::nullopt;
 };
 
 struct Ip4Socket;
@@ -133,7 +139,8 @@ struct Ip4 {
 	managarm::fs::Errors serveSocket(helix::UniqueLane lane, int type, int proto, int flags);
 	// frame is a view into the owner buffer, stripping away eth bits
 	void feedPacket(nic::MacAddress dest, nic::MacAddress src,
-		arch::dma_buffer owner, arch::dma_buffer_view frame, std::weak_ptr<nic::Link> link);
+		nic::FrameOwner owner, arch::dma_buffer_view frame, std::weak_ptr<nic::Link> link,
+		bool checksumValid = false);
 
 	bool hasIp(uint32_t ip);
 	std::shared_ptr<nic::Link> getLink(uint32_t ip);
@@ -143,17 +150,22 @@ struct Ip4 {
 	std::optional<uint32_t> findLinkIp(uint32_t ipOnNet, nic::Link *link);
 
 	async::result<std::optional<Ip4TargetInfo>> targetByRemote(uint32_t, std::shared_ptr<nic::Link> link = {});
+	// Resolves the MAC of the gateway (or the remote) via ARP.
+	async::result<std::optional<nic::MacAddress>> resolveNextHop(const Ip4TargetInfo &ti);
+	// Offsets in the offload descriptor are relative to the IP payload.
 	async::result<protocols::fs::Error> sendFrame(Ip4TargetInfo,
-		void*, size_t,
-		uint16_t);
+		const void*, size_t,
+		uint16_t, nic::TxOffload offload = {});
 private:
 	std::multimap<int, smarter::shared_ptr<Ip4Socket>> sockets;
 	std::map<CidrAddress, std::weak_ptr<nic::Link>> ips;
 
-	Udp4 udp;
 	Icmp icmp;
-	Tcp4 tcp;
 };
 
 Ip4 &ip4();
 Ip4Router &ip4Router();
+
+// Verifies the route lookup against a linear scan and prints its throughput
+// for a table of 100k routes.
+void benchmarkRoutes();
@@ -0,0 +1,429 @@
+#include "ip6.hpp"
+
+#include "loopback.hpp"
+#include "ndp.hpp"
+#include "tcp4.hpp"
+#include "transport.hpp"
+#include "udp4.hpp"
+#include <algorithm>
+#include <arch/bit.hpp>
+#include <arch/variable.hpp>
+#include <cassert>
+#include <cstring>
+#include <hel.h>
+#include <hel-syscalls.h>
+#include <iostream>
+#include <linux/rtnetlink.h>
+#include <sys/socket.h>
+
+using Route = Ip6Router::Route;
+
+namespace {
+
+struct Ip6Header {
+	// Version, traffic class and flow label.
+	arch::scalar_storage<uint32_t, arch::big_endian> versionClassFlow;
+	arch::scalar_storage<uint16_t, arch::big_endian> payloadLength;
+	uint8_t nextHeader;
+	uint8_t hopLimit;
+	uint8_t source[16];
+	uint8_t destination[16];
+};
+static_assert(sizeof(Ip6Header) == 40);
+
+// Extension headers (RFC 8200, section 4).
+constexpr uint8_t hopByHopHeader = 0;
+constexpr uint8_t routingHeader = 43;
+constexpr uint8_t fragmentHeader = 44;
+constexpr uint8_t destinationOptionsHeader = 60;
+
+// Multicast addresses whose scope is a single link.
+bool hasLinkScope(const InetAddress &address) {
+	return address.isLinkLocal() || (address.isMulticast() && (address.bytes[1] & 0xF) == 2);
+}
+
+// Ethernet address that IPv6 multicast packets are sent to (RFC 2464, section 7).
+nic::MacAddress multicastMac(const InetAddress &address) {
+	return nic::MacAddress{{0x33, 0x33, address.bytes[12], address.bytes[13],
+			address.bytes[14], address.bytes[15]}};
+}
+
+} // anonymous namespace
+
+Ip6Router &ip6Router() {
+	static Ip6Router inst;
+	return inst;
+}
+
+Ip6 &ip6() {
+	static Ip6 inst;
+	return inst;
+}
+
+InetAddress linkLocalMulticast(uint8_t group) {
+	InetAddress result;
+	result.bytes[0] = 0xFF;
+	result.bytes[1] = 0x02;
+	result.bytes[15] = group;
+	return result;
+}
+
+InetAddress solicitedNodeAddress(const InetAddress &address) {
+	// ff02::1:ff00:0/104, followed by the low 24 bits of the address.
+	auto result = linkLocalMulticast(0);
+	result.bytes[11] = 0x01;
+	result.bytes[12] = 0xFF;
+	std::copy(address.bytes.begin() + 13, address.bytes.end(), result.bytes.begin() + 13);
+	return result;
+}
+
+InetAddress eui64Address(const InetAddress &prefix, nic::MacAddress mac) {
+	auto result = prefix;
+	result.bytes[8] = mac[0] ^ 0x02;
+	result.bytes[9] = mac[1];
+	result.bytes[10] = mac[2];
+	result.bytes[11] = 0xFF;
+	result.bytes[12] = 0xFE;
+	result.bytes[13] = mac[3];
+	result.bytes[14] = mac[4];
+	result.bytes[15] = mac[5];
+	return result;
+}
+
+bool CidrAddress6::sameNet(const InetAddress &other) const {
+	return maskPrefix(other.bytes, prefix) == maskPrefix(ip.bytes, prefix);
+}
+
+bool operator<(const CidrAddress6 &lhs, const CidrAddress6 &rhs) {
+	// Longer prefixes sort first.
+	return std::tie(rhs.prefix, lhs.ip) < std::tie(lhs.prefix, rhs.ip);
+}
+
+void Ip6Router::addRoute(Route r) {
+	r.network.ip.bytes = maskPrefix(r.network.ip.bytes, r.network.prefix);
+	auto &candidates = routes_.insert(r.network.ip.bytes, r.network.prefix);
+
+	auto link = r.link.lock();
+	std::erase_if(candidates, [&] (const Route &other) {
+		return other.gateway == r.gateway && other.link.lock() == link;
+	});
+	auto it = std::ranges::upper_bound(candidates, r.metric, {}, &Route::metric);
+	candidates.insert(it, std::move(r));
+	inet::invalidateDsts();
+}
+
+bool Ip6Router::removeRoute(const CidrAddress6 &network, const InetAddress &gateway, nic::Link *link) {
+	auto candidates = routes_.find(network.ip.bytes, network.prefix);
+	if(!candidates)
+		return false;
+
+	auto n = std::erase_if(*candidates, [&] (const Route &r) {
+		return r.gateway == gateway && r.link.lock().get() == link;
+	});
+	if(candidates->empty())
+		routes_.erase(network.ip.bytes, network.prefix);
+	inet::invalidateDsts();
+	return n;
+}
+
+std::optional<Route> Ip6Router::resolveRoute(const InetAddress &ip, std::shared_ptr<nic::Link> link) {
+	std::optional<Route> result;
+	uint64_t time = 0;
+	routes_.lookup(ip.bytes, [&] (std::vector<Route> &candidates) {
+		for(auto &r : candidates) {
+			auto routeLink = r.link.lock();
+			if(!routeLink)
+				continue;
+			if(link && routeLink->index() != link->index())
+				continue;
+			if(r.expiry) {
+				if(!time)
+					HEL_CHECK(helGetClock(&time));
+				if(r.expiry <= time)
+					continue;
+			}
+			result = r;
+			return true;
+		}
+		return false;
+	});
+	return result;
+}
+
+std::vector<Route> Ip6Router::getRoutes() {
+	std::vector<Route> result;
+	routes_.forEach([&] (auto &, unsigned int, std::vector<Route> &candidates) {
+		for(auto &r : candidates) {
+			if(!r.link.expired())
+				result.push_back(r);
+		}
+	});
+	return result;
+}
+
+async::result<std::optional<Ip6TargetInfo>>
+Ip6::targetByRemote(const InetAddress &remote, std::shared_ptr<nic::Link> link) {
+	// Like for IPv4, packets to our own addresses go through the loopback link.
+	if (hasIp(remote)) {
+		if (auto lo = nic::loopback::get())
+			co_return Ip6TargetInfo{remote, remote, {{remote, 128}, lo}, std::move(lo)};
+	}
+
+	auto route = ip6Router().resolveRoute(remote, link);
+	if (!route) {
+		std::cout << "netserver: net unreachable" << std::endl;
+		co_return std::nullopt;
+	}
+
+	auto target = route->link.lock();
+	if (!target)
+		co_return std::nullopt;
+
+	auto source = route->source;
+	if (source.isAny())
+		source = findLinkIp(remote, target.get()).value_or(InetAddress{});
+	if (source.isAny()) {
+		std::cout << "netserver: could not find a source address for "
+			<< remote.toString() << std::endl;
+		co_return std::nullopt;
+	}
+
+	co_return Ip6TargetInfo{remote, source, *route, std::move(target)};
+}
+
+bool Ip6::hasIp(const InetAddress &addr) {
+	return std::any_of(addresses_.cbegin(), addresses_.cend(),
+		[&] (auto &x) {
+			return x.first.ip == addr;
+		});
+}
+
+std::shared_ptr<nic::Link> Ip6::getLink(const InetAddress &addr) {
+	auto iter = std::find_if(addresses_.begin(), addresses_.end(),
+		[&] (const auto &e) { return e.first.ip == addr; });
+	if (iter == addresses_.end())
+		return {};
+	auto ptr = iter->second.lock();
+	if (!ptr) {
+		addresses_.erase(iter);
+		return {};
+	}
+	return ptr;
+}
+
+void Ip6::addAddress(CidrAddress6 addr, std::weak_ptr<nic::Link> link) {
+	addresses_.emplace(addr, std::move(link));
+	inet::invalidateDsts();
+}
+
+bool Ip6::deleteAddress(CidrAddress6 addr) {
+	inet::invalidateDsts();
+	return addresses_.erase(addr) > 0;
+}
+
+std::vector<CidrAddress6> Ip6::getAddressesByIndex(int index) {
+	std::vector<CidrAddress6> result;
+	for (auto &[addr, link] : addresses_) {
+		auto ptr = link.lock();
+		if (ptr && ptr->index() == index)
+			result.push_back(addr);
+	}
+	return result;
+}
+
+std::optional<InetAddress> Ip6::findLinkIp(const InetAddress &destination, nic::Link *link) {
+	// Prefer addresses of the same scope as the destination (RFC 6724, section 5, rule 2).
+	std::optional<InetAddress> result;
+	for (auto &[addr, weak] : addresses_) {
+		if (weak.lock().get() != link)
+			continue;
+		if (hasLinkScope(addr.ip) == hasLinkScope(destination))
+			return addr.ip;
+		if (!result)
+			result = addr.ip;
+	}
+	return result;
+}
+
+bool Ip6::acceptsDestination_(const InetAddress &destination, nic::Link *link) {
+	if (destination == linkLocalMulticast(1))
+		return true;
+	for (auto &[addr, weak] : addresses_) {
+		if (addr.ip == destination)
+			return true;
+		if (destination == solicitedNodeAddress(addr.ip) && weak.lock().get() == link)
+			return true;
+	}
+	return false;
+}
+
+async::result<std::optional<nic::MacAddress>> Ip6::resolveNextHop(const Ip6TargetInfo &ti) {
+	if (ti.remote.isMulticast())
+		co_return multicastMac(ti.remote);
+	auto nextHop = ti.route.gateway.isAny() ? ti.remote : ti.route.gateway;
+	co_return co_await neigh6().tryResolve(nextHop, ti.source, ti.link);
+}
+
+async::result<protocols::fs::Error> Ip6::sendFrame(Ip6TargetInfo ti,
+		const void *data, size_t len, IpProto proto, nic::TxOffload offload) {
+	// NICs only segment TCP/IPv4, see nic::Offloads.
+	assert(!offload.segmentSize);
+
+	// TODO: fragmentation
+	size_t packetSize = sizeof(Ip6Header) + len;
+	auto &target = ti.link;
+	if ((ti.route.mtu != 0 && ti.route.mtu < packetSize) || target->mtu < packetSize) {
+		std::cout << "netserver: cant fragment ip6 packet" << std::endl;
+		co_return protocols::fs::Error::messageSize;
+	}
+
+	Ip6Header header{
+		.versionClassFlow = uint32_t{6} << 28,
+		.payloadLength = static_cast<uint16_t>(len),
+		.nextHeader = static_cast<uint8_t>(proto),
+		.hopLimit = ti.hopLimit,
+		.source = {},
+		.destination = {},
+	};
+	std::memcpy(header.source, ti.source.bytes.data(), sizeof(header.source));
+	std::memcpy(header.destination, ti.remote.bytes.data(), sizeof(header.destination));
+
+	nic::Link::AllocatedBuffer fb;
+
+	if (!target->rawIp()) {
+		auto mac = ti.nextHopMac;
+		if (!mac)
+			mac = co_await resolveNextHop(ti);
+		if (!mac)
+			co_return protocols::fs::Error::hostUnreachable;
+
+		fb = target->allocateFrame(*mac, nic::ETHER_TYPE_IP6, packetSize);
+	} else {
+		fb = target->allocateFrame(packetSize);
+	}
+
+	std::memcpy(fb.payload.data(), &header, sizeof(header));
+	std::memcpy(fb.payload.subview(sizeof(header)).byte_data(), data, len);
+
+	if (offload.needsChecksum) {
+		// Make the offsets relative to the start of the frame.
+		auto prefix = static_cast<char *>(fb.payload.data())
+				- static_cast<char *>(fb.frame.data()) + sizeof(header);
+		offload.checksumStart += prefix;
+	}
+	co_await target->transmit(std::move(fb.frame), offload);
+	co_return protocols::fs::Error::none;
+}
+
+void Ip6::feedPacket(nic::MacAddress, nic::MacAddress,
+		nic::FrameOwner owner, arch::dma_buffer_view frame, std::weak_ptr<nic::Link> link,
+		bool checksumValid) {
+	Ip6Header header;
+	if (frame.size() < sizeof(header))
+		return;
+	std::memcpy(&header, frame.data(), sizeof(header));
+	if ((header.versionClassFlow.load() >> 28) != 6)
+		return;
+
+	size_t length = header.payloadLength.load();
+	if (frame.size() < sizeof(header) + length) {
+		std::cout << "netserver: runt ip6 packet received" << std::endl;
+		return;
+	}
+	auto payload = frame.subview(sizeof(header), length);
+
+	InetAddress destination;
+	std::memcpy(destination.bytes.data(), header.destination, sizeof(header.destination));
+	if (!acceptsDestination_(destination, link.lock().get()))
+		return;
+
+	// Skip extension headers; we do not implement any of their options.
+	auto nextHeader = header.nextHeader;
+	while (nextHeader == hopByHopHeader || nextHeader == routingHeader
+			|| nextHeader == destinationOptionsHeader) {
+		if (payload.size() < 8)
+			return;
+		auto bytes = reinterpret_cast<const uint8_t *>(payload.data());
+		size_t extensionSize = (bytes[1] + 1) * 8;
+		if (payload.size() < extensionSize)
+			return;
+		// Routing headers with segments left would require us to forward the packet.
+		if (nextHeader == routingHeader && bytes[3])
+			return;
+		nextHeader = bytes[0];
+		payload = payload.subview(extensionSize);
+	}
+	// TODO: Reassemble fragments.
+	if (nextHeader == fragmentHeader)
+		return;
+
+	InetPacket packet{
+		.source = {},
+		.destination = destination,
+		.payload = payload,
+		.protocol = nextHeader,
+		.hopLimit = header.hopLimit,
+		.checksumValid = checksumValid,
+		.link = std::move(link),
+		.owner = std::move(owner),
+	};
+	std::memcpy(packet.source.bytes.data(), header.source, sizeof(header.source));
+	// IPv4-mapped addresses must not appear on the wire (RFC 4291, section 2.5.5.2).
+	if (packet.source.isIp4() || packet.source.isMulticast())
+		return;
+
+	auto shared = smarter::make_shared<const InetPacket>(std::move(packet));
+	switch (static_cast<IpProto>(nextHeader)) {
+	case IpProto::icmp6: icmp.feedDatagram(std::move(shared)); break;
+	case IpProto::udp: udp().feedDatagram(std::move(shared)); break;
+	case IpProto::tcp: tcp().feedDatagram(std::move(shared)); break;
+	default: break;
+	}
+}
+
+void Ip6::configureLink(std::shared_ptr<nic::Link> link) {
+	// Without a MAC, there is no interface identifier to derive addresses from.
+	if (link->rawIp())
+		return;
+
+	InetAddress linkLocal;
+	linkLocal.bytes[0] = 0xFE;
+	linkLocal.bytes[1] = 0x80;
+	auto address = eui64Address(linkLocal, link->deviceMac());
+	if (hasIp(address))
+		return;
+
+	// TODO: Perform duplicate address detection.
+	addAddress({address, 64}, link);
+
+	Route onLink{{linkLocal, 64}, link};
+	onLink.metric = 256;
+	onLink.protocol = RTPROT_KERNEL;
+	ip6Router().addRoute(std::move(onLink));
+
+	InetAddress multicast;
+	multicast.bytes[0] = 0xFF;
+	Route multicastRoute{{multicast, 8}, link};
+	multicastRoute.metric = 256;
+	multicastRoute.protocol = RTPROT_KERNEL;
+	multicastRoute.type = RTN_MULTICAST;
+	ip6Router().addRoute(std::move(multicastRoute));
+
+	async::detach(neigh6().solicitRouters(std::move(link)));
+}
+
+managarm::fs::Errors Ip6::serveSocket(helix::UniqueLane lane, int type, int proto, int flags) {
+	switch (type) {
+	case SOCK_DGRAM:
+		// TODO: ICMPv6 sockets.
+		if (proto == IPPROTO_ICMPV6)
+			return managarm::fs::Errors::ILLEGAL_ARGUMENT;
+		udp().serveSocket(AF_INET6, std::move(lane));
+		return managarm::fs::Errors::SUCCESS;
+	case SOCK_STREAM:
+		tcp().serveSocket(AF_INET6, flags, std::move(lane));
+		return managarm::fs::Errors::SUCCESS;
+	default:
+		return managarm::fs::Errors::ILLEGAL_ARGUMENT;
+	}
+}
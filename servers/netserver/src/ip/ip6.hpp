@@ -0,0 +1,117 @@
+#pragma once
+
+#include <arch/dma_structs.hpp>
+#include <async/result.hpp>
+#include <helix/ipc.hpp>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <netserver/nic.hpp>
+#include <optional>
+#include <protocols/fs/common.hpp>
+#include <vector>
+
+#include "icmp6.hpp"
+#include "inet.hpp"
+#include "lpm-trie.hpp"
+
+#include "fs.bragi.hpp"
+
+struct CidrAddress6 {
+	InetAddress ip;
+	uint8_t prefix;
+
+	bool sameNet(const InetAddress &other) const;
+
+	friend bool operator<(const CidrAddress6 &, const CidrAddress6 &);
+	friend bool operator==(const CidrAddress6 &, const CidrAddress6 &) = default;
+};
+
+struct Ip6Router {
+	struct Route {
+		inline Route(CidrAddress6 net, std::weak_ptr<nic::Link> link)
+			: network(net), link(link) {}
+
+		CidrAddress6 network;
+		std::weak_ptr<nic::Link> link;
+		unsigned int mtu = 0;
+		// Unspecified (::) for routes to directly attached networks.
+		InetAddress gateway;
+		unsigned int metric = 0;
+		InetAddress source;
+		uint8_t protocol = 0;
+		uint8_t type = 0;
+		// Routes from router advertisements expire at this point (in nanoseconds since boot).
+		// Zero if the route does not expire.
+		uint64_t expiry = 0;
+	};
+
+	// Replaces the route with the same network, gateway and link, if any.
+	void addRoute(Route r);
+	bool removeRoute(const CidrAddress6 &network, const InetAddress &gateway, nic::Link *link);
+	std::optional<Route> resolveRoute(const InetAddress &ip, std::shared_ptr<nic::Link> link = {});
+
+	std::vector<Route> getRoutes();
+
+private:
+	// Routes to the same network are ordered by their metric.
+	LpmTrie<16, std::vector<Route>> routes_;
+};
+
+struct Ip6TargetInfo {
+	InetAddress remote;
+	InetAddress source;
+	Ip6Router::Route route;
+	std::shared_ptr<nic::Link> link;
+	// Neighbour discovery messages must be sent with a hop limit of 255.
+	uint8_t hopLimit = 64;
+	// MAC of the gateway (or the remote) if it is already known, e.g., from a DstCache.
+	std::optional<nic::MacAddress> nextHopMac = std::nullopt;
+};
+
+struct Ip6 {
+	managarm::fs::Errors serveSocket(helix::UniqueLane lane, int type, int proto, int flags);
+	// frame is a view into the owner buffer, stripping away eth bits
+	void feedPacket(nic::MacAddress dest, nic::MacAddress src,
+		nic::FrameOwner owner, arch::dma_buffer_view frame, std::weak_ptr<nic::Link> link,
+		bool checksumValid = false);
+
+	// Assigns a link-local address to the link and solicits routers, which then
+	// trigger stateless address autoconfiguration (RFC 4862).
+	void configureLink(std::shared_ptr<nic::Link> link);
+
+	bool hasIp(const InetAddress &ip);
+	std::shared_ptr<nic::Link> getLink(const InetAddress &ip);
+	void addAddress(CidrAddress6 addr, std::weak_ptr<nic::Link> link);
+	bool deleteAddress(CidrAddress6 addr);
+	std::vector<CidrAddress6> getAddressesByIndex(int index);
+	// Picks a source address on the link, preferring link-local addresses for
+	// link-local destinations and global addresses otherwise.
+	std::optional<InetAddress> findLinkIp(const InetAddress &destination, nic::Link *link);
+
+	async::result<std::optional<Ip6TargetInfo>> targetByRemote(const InetAddress &remote,
+		std::shared_ptr<nic::Link> link = {});
+	// Resolves the MAC of the gateway (or the remote) via neighbour discovery.
+	async::result<std::optional<nic::MacAddress>> resolveNextHop(const Ip6TargetInfo &ti);
+	// Offsets in the offload descriptor are relative to the IP payload.
+	async::result<protocols::fs::Error> sendFrame(Ip6TargetInfo,
+		const void *, size_t,
+		IpProto, nic::TxOffload offload = {});
+
+private:
+	bool acceptsDestination_(const InetAddress &destination, nic::Link *link);
+
+	std::map<CidrAddress6, std::weak_ptr<nic::Link>> addresses_;
+
+	Icmp6 icmp;
+};
+
+// Link-local multicast group, e.g., ff02::1 for all nodes and ff02::2 for all routers.
+InetAddress linkLocalMulticast(uint8_t group);
+// Solicited-node multicast address of an address (RFC 4291, section 2.7.1).
+InetAddress solicitedNodeAddress(const InetAddress &address);
+// Interface identifier that is derived from the MAC (RFC 4291, appendix A).
+InetAddress eui64Address(const InetAddress &prefix, nic::MacAddress mac);
+
+Ip6 &ip6();
+Ip6Router &ip6Router();
@@ -0,0 +1,274 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+// Clears the bits of an address (in network byte order) that follow the prefix.
+template<size_t Bytes>
+std::array<uint8_t, Bytes> maskPrefix(std::array<uint8_t, Bytes> address, unsigned int prefix) {
+	for(size_t i = 0; i < Bytes; i++) {
+		if(prefix >= (i + 1) * 8)
+			continue;
+		address[i] &= prefix > i * 8 ? uint8_t(0xFF << (8 - (prefix - i * 8))) : 0;
+	}
+	return address;
+}
+
+// Maps prefixes of Bytes-sized addresses (in network byte order) to values and finds
+// the prefixes that contain an address, longest first. This is a path-compressed
+// binary trie: each node stores the bits that it skips, such that lookups visit at
+// most one node per distinct prefix length on the path.
+//
+// If FrontBits is non-zero, lookups start at a table that is indexed by the first
+// FrontBits bits of the address, similar to the first level of DIR-24-8. Each node
+// also links to the closest node above it that holds a value, such that lookups
+// find all matching prefixes without walking the trie from its root.
+template<size_t Bytes, typename T, unsigned int FrontBits = 0>
+struct LpmTrie {
+	using Key = std::array<uint8_t, Bytes>;
+	static constexpr unsigned int maxPrefix = Bytes * 8;
+	static_assert(FrontBits % 8 == 0 && FrontBits <= 24 && FrontBits <= maxPrefix);
+
+	// Returns the value of the prefix, inserting a default-constructed value if necessary.
+	T &insert(const Key &address, unsigned int prefix) {
+		auto key = mask(address, prefix);
+		auto slot = &root_;
+		// Closest node with a value above the slot.
+		Node *covering = nullptr;
+		while(true) {
+			auto node = slot->get();
+			if(!node) {
+				*slot = std::make_unique<Node>(key, prefix, covering);
+				size_++;
+				nodeChanged_(prefix);
+				return (*slot)->value.emplace();
+			}
+
+			auto common = commonPrefix(node->key, key, std::min(node->prefix, prefix));
+			if(common == node->prefix) {
+				if(node->prefix == prefix) {
+					if(!node->value) {
+						node->value.emplace();
+						size_++;
+						setCovering_(node, node);
+					}
+					return *node->value;
+				}
+				if(node->value)
+					covering = node;
+				slot = &node->children[bit(key, node->prefix)];
+				continue;
+			}
+
+			auto fresh = std::make_unique<Node>(key, prefix, covering);
+			auto &value = fresh->value.emplace();
+			size_++;
+			if(common == prefix) {
+				// The new prefix contains the existing node.
+				fresh->children[bit(node->key, prefix)] = std::move(*slot);
+				setCovering_(fresh.get(), fresh.get());
+				*slot = std::move(fresh);
+			}else{
+				// Both diverge after the common bits; join them below a new inner node.
+				auto inner = std::make_unique<Node>(mask(key, common), common, covering);
+				inner->children[bit(node->key, common)] = std::move(*slot);
+				inner->children[bit(key, common)] = std::move(fresh);
+				*slot = std::move(inner);
+				nodeChanged_(common);
+			}
+			nodeChanged_(prefix);
+			return value;
+		}
+	}
+
+	T *find(const Key &address, unsigned int prefix) {
+		auto key = mask(address, prefix);
+		auto node = root_.get();
+		while(node && node->prefix <= prefix) {
+			if(commonPrefix(node->key, key, node->prefix) != node->prefix)
+				return nullptr;
+			if(node->prefix == prefix)
+				return node->value ? &*node->value : nullptr;
+			node = node->children[bit(key, node->prefix)].get();
+		}
+		return nullptr;
+	}
+
+	bool erase(const Key &address, unsigned int prefix) {
+		auto key = mask(address, prefix);
+		std::unique_ptr<Node> *parent = nullptr;
+		auto slot = &root_;
+		while(auto node = slot->get()) {
+			if(node->prefix > prefix || commonPrefix(node->key, key, node->prefix) != node->prefix)
+				return false;
+			if(node->prefix != prefix) {
+				parent = slot;
+				slot = &node->children[bit(key, node->prefix)];
+				continue;
+			}
+
+			if(!node->value)
+				return false;
+			node->value.reset();
+			size_--;
+			setCovering_(node, node->covering);
+			compact_(*slot);
+			if(parent)
+				compact_(*parent);
+			return true;
+		}
+		return false;
+	}
+
+	// Calls fn on the values of all prefixes that contain the address, longest prefix
+	// first, until fn returns true. Returns whether fn returned true.
+	template<typename F>
+	bool lookup(const Key &address, F fn) {
+		auto start = frontNode_(address);
+		auto node = start ? start : root_.get();
+		Node *match = nullptr;
+		while(node && commonPrefix(node->key, address, node->prefix) == node->prefix) {
+			if(node->value)
+				match = node;
+			if(node->prefix == maxPrefix)
+				break;
+			node = node->children[bit(address, node->prefix)].get();
+		}
+		// The front table skips the nodes above start.
+		if(!match && start)
+			match = start->covering;
+
+		for(; match; match = match->covering) {
+			if(fn(*match->value))
+				return true;
+		}
+		return false;
+	}
+
+	// Calls fn(key, prefix, value) for all prefixes. Each prefix is visited before
+	// the longer prefixes that it contains.
+	template<typename F>
+	void forEach(F fn) {
+		forEach_(root_.get(), fn);
+	}
+
+	size_t size() const {
+		return size_;
+	}
+
+private:
+	static Key mask(const Key &key, unsigned int prefix) {
+		return maskPrefix(key, prefix);
+	}
+
+	struct Node {
+		Node(const Key &key, unsigned int prefix, Node *covering)
+		: key{key}, prefix{prefix}, covering{covering} {}
+
+		// Bits of the key past the prefix are zero.
+		Key key;
+		unsigned int prefix;
+		std::optional<T> value;
+		std::unique_ptr<Node> children[2];
+		// Closest ancestor that has a value, i.e., the next shorter matching prefix.
+		Node *covering;
+	};
+
+	static bool bit(const Key &key, unsigned int i) {
+		return (key[i / 8] >> (7 - i % 8)) & 1;
+	}
+
+	// Number of leading bits (but at most limit) that a and b have in common.
+	static unsigned int commonPrefix(const Key &a, const Key &b, unsigned int limit) {
+		unsigned int n = 0;
+		for(size_t i = 0; i < Bytes && n < limit; i++) {
+			uint8_t diff = a[i] ^ b[i];
+			if(diff) {
+				n += std::countl_zero(diff);
+				break;
+			}
+			n += 8;
+		}
+		return std::min(n, limit);
+	}
+
+	// Removes a node without value if it does not join two subtries.
+	void compact_(std::unique_ptr<Node> &slot) {
+		auto node = slot.get();
+		if(node->value || (node->children[0] && node->children[1]))
+			return;
+		nodeChanged_(node->prefix);
+		auto child = std::move(node->children[0] ? node->children[0] : node->children[1]);
+		slot = std::move(child);
+	}
+
+	// Updates the covering links below a node, down to (and including) the nodes that have a value.
+	static void setCovering_(Node *node, Node *covering) {
+		for(auto &child : node->children) {
+			if(!child)
+				continue;
+			child->covering = covering;
+			if(!child->value)
+				setCovering_(child.get(), covering);
+		}
+	}
+
+	static size_t frontIndex(const Key &key) {
+		size_t index = 0;
+		for(size_t i = 0; i < FrontBits / 8; i++)
+			index = (index << 8) | key[i];
+		return index;
+	}
+
+	// The front table is rebuilt on the next lookup after nodes within its reach change.
+	void nodeChanged_(unsigned int prefix) {
+		if(prefix <= FrontBits)
+			frontDirty_ = true;
+	}
+
+	// Returns the longest node that covers the first FrontBits bits of the address,
+	// or null if the lookup has to start at the root.
+	Node *frontNode_(const Key &address) {
+		if constexpr (!FrontBits) {
+			return nullptr;
+		}else{
+			if(frontDirty_) {
+				front_.assign(size_t{1} << FrontBits, nullptr);
+				fillFront_(root_.get());
+				frontDirty_ = false;
+			}
+			return front_[frontIndex(address)];
+		}
+	}
+
+	// Nodes are visited before the nodes below them, which override their part of the table.
+	void fillFront_(Node *node) {
+		if(!node || node->prefix > FrontBits)
+			return;
+		std::fill_n(front_.begin() + frontIndex(node->key),
+				size_t{1} << (FrontBits - node->prefix), node);
+		fillFront_(node->children[0].get());
+		fillFront_(node->children[1].get());
+	}
+
+	template<typename F>
+	void forEach_(Node *node, F &fn) {
+		if(!node)
+			return;
+		if(node->value)
+			fn(node->key, node->prefix, *node->value);
+		forEach_(node->children[0].get(), fn);
+		forEach_(node->children[1].get(), fn);
+	}
+
+	std::unique_ptr<Node> root_;
+	size_t size_ = 0;
+	std::vector<Node *> front_;
+	bool frontDirty_ = true;
+};
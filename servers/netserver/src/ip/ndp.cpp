@@ -0,0 +1,459 @@
+#include "ndp.hpp"
+
+#include "icmp6.hpp"
+#include "ip6.hpp"
+#include "transport.hpp"
+
+#include <arch/bit.hpp>
+#include <arch/variable.hpp>
+#include <async/basic.hpp>
+#include <helix/ipc.hpp>
+#include <helix/timer.hpp>
+#include <cstring>
+#include <iostream>
+#include <linux/rtnetlink.h>
+#include <vector>
+
+namespace {
+
+constexpr uint8_t sourceLinkLayerOption = 1;
+constexpr uint8_t targetLinkLayerOption = 2;
+constexpr uint8_t prefixInformationOption = 3;
+constexpr uint8_t mtuOption = 5;
+
+constexpr uint32_t solicitedFlag = 0x4000'0000;
+constexpr uint32_t overrideFlag = 0x2000'0000;
+
+constexpr uint32_t infiniteLifetime = 0xFFFF'FFFF;
+
+// Like Linux, prefer routes to attached networks over default routes.
+constexpr unsigned int prefixRouteMetric = 256;
+constexpr unsigned int defaultRouteMetric = 1024;
+
+// Neighbour solicitations and advertisements, following the ICMPv6 header.
+struct NeighbourMessage {
+	// Reserved in solicitations.
+	arch::scalar_storage<uint32_t, arch::big_endian> flags;
+	uint8_t target[16];
+};
+static_assert(sizeof(NeighbourMessage) == 20);
+
+struct RouterAdvertisement {
+	uint8_t hopLimit;
+	uint8_t flags;
+	arch::scalar_storage<uint16_t, arch::big_endian> lifetime;
+	arch::scalar_storage<uint32_t, arch::big_endian> reachableTime;
+	arch::scalar_storage<uint32_t, arch::big_endian> retransTimer;
+};
+static_assert(sizeof(RouterAdvertisement) == 12);
+
+struct LinkLayerOption {
+	uint8_t type;
+	// Length of the option in units of 8 bytes, like for all options.
+	uint8_t length;
+	uint8_t address[6];
+};
+static_assert(sizeof(LinkLayerOption) == 8);
+
+struct PrefixInformation {
+	static constexpr uint8_t onLinkFlag = 0x80;
+	static constexpr uint8_t autonomousFlag = 0x40;
+
+	uint8_t type;
+	uint8_t length;
+	uint8_t prefixLength;
+	uint8_t flags;
+	arch::scalar_storage<uint32_t, arch::big_endian> validLifetime;
+	arch::scalar_storage<uint32_t, arch::big_endian> preferredLifetime;
+	uint32_t reserved;
+	uint8_t prefix[16];
+};
+static_assert(sizeof(PrefixInformation) == 32);
+
+struct MtuOption {
+	uint8_t type;
+	uint8_t length;
+	uint16_t reserved;
+	arch::scalar_storage<uint32_t, arch::big_endian> mtu;
+};
+static_assert(sizeof(MtuOption) == 8);
+
+uint64_t now() {
+	uint64_t time;
+	HEL_CHECK(helGetClock(&time));
+	return time;
+}
+
+LinkLayerOption makeLinkLayerOption(uint8_t type, nic::MacAddress mac) {
+	LinkLayerOption option{.type = type, .length = 1, .address = {}};
+	std::memcpy(option.address, mac.data(), sizeof(option.address));
+	return option;
+}
+
+// Routers do not forward neighbour discovery messages, hence they always arrive
+// with the initial hop limit (RFC 4861, section 6.1).
+bool isValidMessage(const InetPacket &packet, size_t bodySize) {
+	auto bytes = reinterpret_cast<const uint8_t *>(packet.payload.data());
+	return packet.hopLimit == 255 && packet.payload.size() >= 4 + bodySize && !bytes[1];
+}
+
+// Calls fn(option, length) for each option. Returns false if the options are malformed.
+template<typename F>
+bool forEachOption(arch::dma_buffer_view options, F fn) {
+	auto p = reinterpret_cast<const uint8_t *>(options.data());
+	size_t n = options.size();
+	while(n >= 2) {
+		size_t length = p[1] * 8;
+		if(!length || length > n)
+			return false;
+		fn(p, length);
+		p += length;
+		n -= length;
+	}
+	return true;
+}
+
+bool findLinkLayerOption(arch::dma_buffer_view options, uint8_t type, std::optional<nic::MacAddress> &mac) {
+	return forEachOption(options, [&] (const uint8_t *option, size_t length) {
+		if(option[0] != type || length != sizeof(LinkLayerOption))
+			return;
+		std::array<uint8_t, 6> address;
+		std::memcpy(address.data(), option + 2, address.size());
+		mac = nic::MacAddress{address};
+	});
+}
+
+// Solicitations go to the solicited-node multicast address, unless the MAC of the target is known.
+async::result<void> sendSolicitation(InetAddress target, InetAddress sender, std::shared_ptr<nic::Link> link,
+		std::optional<nic::MacAddress> mac = std::nullopt) {
+	struct {
+		NeighbourMessage message;
+		LinkLayerOption option;
+	} body{};
+	std::memcpy(body.message.target, target.bytes.data(), sizeof(body.message.target));
+	body.option = makeLinkLayerOption(sourceLinkLayerOption, link->deviceMac());
+
+	auto remote = mac ? target : solicitedNodeAddress(target);
+	Ip6TargetInfo ti{remote, sender, {{remote, 128}, link}, link, 255, mac};
+	co_await sendIcmp6(std::move(ti), icmp6::neighbourSolicitation, 0, &body, sizeof(body));
+}
+
+async::result<void> sendAdvertisement(InetAddress target, InetAddress remote, bool solicited,
+		std::shared_ptr<nic::Link> link) {
+	struct {
+		NeighbourMessage message;
+		LinkLayerOption option;
+	} body{};
+	body.message.flags = (solicited ? solicitedFlag : 0) | overrideFlag;
+	std::memcpy(body.message.target, target.bytes.data(), sizeof(body.message.target));
+	body.option = makeLinkLayerOption(targetLinkLayerOption, link->deviceMac());
+
+	Ip6TargetInfo ti{remote, target, {{remote, 128}, link}, link, 255};
+	co_await sendIcmp6(std::move(ti), icmp6::neighbourAdvertisement, 0, &body, sizeof(body));
+}
+
+async::detached entryProber(InetAddress ip, Neighbours6::Entry &e, InetAddress sender,
+		std::shared_ptr<nic::Link> link) {
+	e.state = Neighbours6::State::incomplete;
+	for (int i = 0; i < 3; i++) {
+		co_await sendSolicitation(ip, sender, link);
+
+		async::cancellation_event ev;
+		helix::TimeoutCancellation timer { 1'000'000'000, ev };
+		co_await e.change.async_wait(ev);
+		co_await timer.retire();
+
+		if (e.state != Neighbours6::State::incomplete) {
+			co_return;
+		}
+	}
+	e.state = Neighbours6::State::failed;
+	e.change.raise();
+}
+
+// Like the ARP counterpart, probes a stale entry with unicast solicitations (RFC 4861, section 7.3.3).
+async::detached entryRefresher(InetAddress ip, Neighbours6::Entry &e, InetAddress sender,
+		std::shared_ptr<nic::Link> link) {
+	e.state = Neighbours6::State::delay;
+	{
+		async::cancellation_event ev;
+		helix::TimeoutCancellation timer { Neighbours::delayTimeMs * 1'000'000, ev };
+		co_await e.change.async_wait(ev);
+		co_await timer.retire();
+	}
+	if (e.state != Neighbours6::State::delay) {
+		co_return;
+	}
+
+	e.state = Neighbours6::State::probe;
+	for (int i = 0; i < 3; i++) {
+		co_await sendSolicitation(ip, sender, link, e.mac);
+
+		async::cancellation_event ev;
+		helix::TimeoutCancellation timer { 1'000'000'000, ev };
+		co_await e.change.async_wait(ev);
+		co_await timer.retire();
+
+		if (e.state != Neighbours6::State::probe) {
+			co_return;
+		}
+	}
+	e.state = Neighbours6::State::failed;
+	inet::invalidateDsts();
+	e.change.raise();
+}
+
+} // anonymous namespace
+
+void Neighbours6::collectGarbage_(uint64_t time) {
+	std::erase_if(table_, [&] (auto &kv) {
+		auto &entry = kv.second;
+		// Entries in other states have coroutines that refer to them.
+		if (entry.state != State::reachable && entry.state != State::stale
+				&& entry.state != State::failed)
+			return false;
+		return !entry.pending && entry.mtime_ns + Neighbours::gcTimeMs * 1'000'000 <= time;
+	});
+}
+
+Neighbours6::Entry &Neighbours6::getEntry(const InetAddress &ip) {
+	auto time = now();
+	if (auto f = table_.find(ip); f != table_.end()) {
+		// Reachability confirmations expire (RFC 4861, section 7.3.3).
+		if (f->second.state == State::reachable
+				&& f->second.mtime_ns + Neighbours::staleTimeMs * 1'000'000 <= time) {
+			f->second.state = State::stale;
+		}
+		return f->second;
+	}
+	if (table_.size() >= Neighbours::gcThreshold)
+		collectGarbage_(time);
+	auto &entry = table_.emplace(std::piecewise_construct,
+		std::make_tuple(ip), std::make_tuple()).first->second;
+	entry.mtime_ns = time;
+	return entry;
+}
+
+void Neighbours6::updateTable(const InetAddress &ip, nic::MacAddress mac, std::weak_ptr<nic::Link> link) {
+	auto &entry = getEntry(ip);
+	if (entry.usable() && entry.mac != mac)
+		inet::invalidateDsts();
+	entry.mtime_ns = now();
+	entry.mac = mac;
+	entry.state = State::reachable;
+	entry.link = std::move(link);
+
+	entry.change.raise();
+}
+
+std::map<InetAddress, Neighbours6::Entry> &Neighbours6::getTable() {
+	return table_;
+}
+
+async::result<std::optional<nic::MacAddress>> Neighbours6::tryResolve(InetAddress ip,
+		InetAddress sender, std::shared_ptr<nic::Link> link) {
+	auto &entry = getEntry(ip);
+	if (entry.state == State::stale) {
+		entryRefresher(ip, entry, sender, link);
+	}
+	if (entry.usable()) {
+		co_return entry.mac;
+	}
+
+	if (entry.state != State::incomplete) {
+		entryProber(ip, entry, sender, std::move(link));
+	}
+	if (entry.pending >= Neighbours::maxPending) {
+		co_return std::nullopt;
+	}
+	entry.pending++;
+	while (entry.state == State::incomplete)
+		co_await entry.change.async_wait();
+	entry.pending--;
+	if (entry.state != State::reachable) {
+		co_return std::nullopt;
+	}
+	co_return entry.mac;
+}
+
+void Neighbours6::feedSolicitation(const InetPacket &packet) {
+	if(!isValidMessage(packet, sizeof(NeighbourMessage)))
+		return;
+	auto link = packet.link.lock();
+	if(!link)
+		return;
+
+	NeighbourMessage message;
+	std::memcpy(&message, packet.payload.subview(4).data(), sizeof(message));
+	InetAddress target;
+	std::memcpy(target.bytes.data(), message.target, sizeof(message.target));
+	if(target.isMulticast())
+		return;
+
+	std::optional<nic::MacAddress> mac;
+	if(!findLinkLayerOption(packet.payload.subview(4 + sizeof(message)), sourceLinkLayerOption, mac))
+		return;
+
+	if(ip6().getLink(target) != link)
+		return;
+
+	// Solicitations from the unspecified address belong to duplicate address detection
+	// of another host. The answer goes to all nodes since the host has no address yet.
+	if(packet.source.isAny()) {
+		if(mac)
+			return;
+		async::detach(sendAdvertisement(target, linkLocalMulticast(1), false, std::move(link)));
+		return;
+	}
+
+	if(mac)
+		updateTable(packet.source, *mac, link);
+	async::detach(sendAdvertisement(target, packet.source, true, std::move(link)));
+}
+
+void Neighbours6::feedAdvertisement(const InetPacket &packet) {
+	if(!isValidMessage(packet, sizeof(NeighbourMessage)))
+		return;
+
+	NeighbourMessage message;
+	std::memcpy(&message, packet.payload.subview(4).data(), sizeof(message));
+	InetAddress target;
+	std::memcpy(target.bytes.data(), message.target, sizeof(message.target));
+	if(target.isMulticast())
+		return;
+
+	// Unsolicited advertisements only update existing entries.
+	if(!table_.contains(target))
+		return;
+
+	std::optional<nic::MacAddress> mac;
+	if(!findLinkLayerOption(packet.payload.subview(4 + sizeof(message)), targetLinkLayerOption, mac))
+		return;
+	if(mac)
+		updateTable(target, *mac, packet.link);
+}
+
+void Neighbours6::feedRouterAdvertisement(const InetPacket &packet) {
+	if(!isValidMessage(packet, sizeof(RouterAdvertisement)) || !packet.source.isLinkLocal())
+		return;
+	auto link = packet.link.lock();
+	if(!link)
+		return;
+
+	RouterAdvertisement advertisement;
+	std::memcpy(&advertisement, packet.payload.subview(4).data(), sizeof(advertisement));
+
+	std::optional<nic::MacAddress> routerMac;
+	unsigned int mtu = 0;
+	std::vector<PrefixInformation> prefixes;
+	auto options = packet.payload.subview(4 + sizeof(advertisement));
+	bool valid = forEachOption(options, [&] (const uint8_t *option, size_t length) {
+		if(option[0] == sourceLinkLayerOption && length == sizeof(LinkLayerOption)) {
+			std::array<uint8_t, 6> address;
+			std::memcpy(address.data(), option + 2, address.size());
+			routerMac = nic::MacAddress{address};
+		}else if(option[0] == prefixInformationOption && length == sizeof(PrefixInformation)) {
+			PrefixInformation info;
+			std::memcpy(&info, option, sizeof(info));
+			prefixes.push_back(info);
+		}else if(option[0] == mtuOption && length == sizeof(MtuOption)) {
+			MtuOption info;
+			std::memcpy(&info, option, sizeof(info));
+			mtu = info.mtu.load();
+		}
+	});
+	if(!valid)
+		return;
+
+	if(routerMac)
+		updateTable(packet.source, *routerMac, link);
+
+	auto time = now();
+	auto expiry = [&] (uint32_t lifetime) -> uint64_t {
+		if(lifetime == infiniteLifetime)
+			return 0;
+		return time + uint64_t{lifetime} * 1'000'000'000;
+	};
+
+	for(auto &info : prefixes) {
+		InetAddress prefix;
+		std::memcpy(prefix.bytes.data(), info.prefix, sizeof(info.prefix));
+		auto prefixLength = info.prefixLength;
+		if(prefixLength > 128 || prefix.isLinkLocal())
+			continue;
+		prefix.bytes = maskPrefix(prefix.bytes, prefixLength);
+		auto validLifetime = info.validLifetime.load();
+
+		if(info.flags & PrefixInformation::onLinkFlag) {
+			if(validLifetime) {
+				Ip6Router::Route route{{prefix, prefixLength}, link};
+				route.metric = prefixRouteMetric;
+				route.protocol = RTPROT_RA;
+				route.mtu = mtu;
+				route.expiry = expiry(validLifetime);
+				ip6Router().addRoute(std::move(route));
+			}else{
+				ip6Router().removeRoute({prefix, prefixLength}, {}, link.get());
+			}
+		}
+
+		// Interface identifiers are derived from 48-bit MACs, which only works for /64 prefixes.
+		// TODO: Perform duplicate address detection and honor the address lifetimes.
+		if((info.flags & PrefixInformation::autonomousFlag) && prefixLength == 64 && validLifetime) {
+			auto address = eui64Address(prefix, link->deviceMac());
+			if(!ip6().hasIp(address)) {
+				std::cout << "netserver: Configured " << address.toString() << "/64 on "
+						<< link->name() << std::endl;
+				ip6().addAddress({address, 64}, link);
+			}
+		}
+	}
+
+	if(auto lifetime = advertisement.lifetime.load(); lifetime) {
+		Ip6Router::Route route{{InetAddress{}, 0}, link};
+		route.gateway = packet.source;
+		route.metric = defaultRouteMetric;
+		route.protocol = RTPROT_RA;
+		route.mtu = mtu;
+		route.expiry = time + uint64_t{lifetime} * 1'000'000'000;
+		ip6Router().addRoute(std::move(route));
+	}else{
+		ip6Router().removeRoute({InetAddress{}, 0}, packet.source, link.get());
+	}
+
+	advertisedLinks_.insert(link->index());
+	advertised_.raise();
+}
+
+async::result<void> Neighbours6::solicitRouters(std::shared_ptr<nic::Link> link) {
+	auto allRouters = linkLocalMulticast(2);
+
+	// At most three solicitations, four seconds apart (RFC 4861, section 10).
+	for(int i = 0; i < 3; i++) {
+		if(advertisedLinks_.contains(link->index()))
+			co_return;
+
+		struct {
+			uint32_t reserved;
+			LinkLayerOption option;
+		} body{};
+		body.option = makeLinkLayerOption(sourceLinkLayerOption, link->deviceMac());
+
+		// Without an address, the option must be omitted.
+		auto source = ip6().findLinkIp(allRouters, link.get()).value_or(InetAddress{});
+		size_t size = source.isAny() ? sizeof(body.reserved) : sizeof(body);
+
+		Ip6TargetInfo ti{allRouters, source, {{allRouters, 128}, link}, link, 255};
+		co_await sendIcmp6(std::move(ti), icmp6::routerSolicitation, 0, &body, size);
+
+		async::cancellation_event ev;
+		helix::TimeoutCancellation timer { 4'000'000'000, ev };
+		co_await advertised_.async_wait(ev);
+		co_await timer.retire();
+	}
+}
+
+Neighbours6 &neigh6() {
+	static Neighbours6 neigh;
+	return neigh;
+}
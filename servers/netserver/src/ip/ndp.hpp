@@ -0,0 +1,40 @@
+#pragma once
+
+#include <async/recurring-event.hpp>
+#include <async/result.hpp>
+#include <map>
+#include <memory>
+#include <netserver/nic.hpp>
+#include <optional>
+#include <set>
+
+#include "arp.hpp"
+#include "inet.hpp"
+
+// Neighbour discovery (RFC 4861), i.e., the IPv6 counterpart of ARP.
+// Also processes router advertisements, which drive SLAAC (RFC 4862).
+struct Neighbours6 {
+	using State = Neighbours::State;
+	using Entry = Neighbours::Entry;
+
+	async::result<std::optional<nic::MacAddress>> tryResolve(InetAddress addr,
+		InetAddress sender, std::shared_ptr<nic::Link> link);
+	void updateTable(const InetAddress &addr, nic::MacAddress hardware, std::weak_ptr<nic::Link> link);
+	std::map<InetAddress, Entry> &getTable();
+
+	void feedSolicitation(const InetPacket &packet);
+	void feedAdvertisement(const InetPacket &packet);
+	void feedRouterAdvertisement(const InetPacket &packet);
+	// Sends router solicitations until a router on the link answers.
+	async::result<void> solicitRouters(std::shared_ptr<nic::Link> link);
+private:
+	Entry &getEntry(const InetAddress &addr);
+	void collectGarbage_(uint64_t now);
+	std::map<InetAddress, Entry> table_;
+
+	// Indices of links that received a router advertisement.
+	std::set<int> advertisedLinks_;
+	async::recurring_event advertised_;
+};
+
+Neighbours6 &neigh6();
@@ -0,0 +1,127 @@
+#include <algorithm>
+#include <cmath>
+
+#include "tcp-congestion.hpp"
+
+namespace {
+
+// Slow start with appropriate byte counting (RFC 3465, L = 2 * SMSS).
+uint32_t slowStartIncrease(uint32_t ackedBytes, uint32_t mss) {
+	return std::min(ackedBytes, 2 * mss);
+}
+
+// Slow start and congestion avoidance as in RFC 5681.
+struct NewReno final : TcpCongestionControl {
+	using TcpCongestionControl::TcpCongestionControl;
+
+	std::string_view name() const override {
+		return "reno";
+	}
+
+	void onAck(uint32_t ackedBytes, uint64_t, uint64_t) override {
+		if(cwnd < ssthresh) {
+			cwnd += slowStartIncrease(ackedBytes, mss);
+			return;
+		}
+
+		// Grow by one segment per window.
+		bytesAcked_ += ackedBytes;
+		if(bytesAcked_ >= cwnd) {
+			bytesAcked_ -= cwnd;
+			cwnd += mss;
+		}
+	}
+
+	void onCongestionEvent(uint32_t flightSize, uint64_t) override {
+		ssthresh = std::max(flightSize / 2, 2 * mss);
+		bytesAcked_ = 0;
+	}
+
+private:
+	uint32_t bytesAcked_ = 0;
+};
+
+// CUBIC as in RFC 9438. Windows are computed in segments, times in seconds.
+struct Cubic final : TcpCongestionControl {
+	static constexpr double c = 0.4;
+	static constexpr double beta = 0.7;
+	// Additive increase of the Reno-friendly estimate (RFC 9438, section 4.3).
+	static constexpr double alpha = 3 * (1 - beta) / (1 + beta);
+
+	using TcpCongestionControl::TcpCongestionControl;
+
+	std::string_view name() const override {
+		return "cubic";
+	}
+
+	void onAck(uint32_t ackedBytes, uint64_t now, uint64_t srtt) override {
+		if(cwnd < ssthresh) {
+			cwnd += slowStartIncrease(ackedBytes, mss);
+			return;
+		}
+
+		double segments = static_cast<double>(cwnd) / mss;
+		if(!epochStart_) {
+			epochStart_ = now;
+			if(segments < wMax_) {
+				k_ = std::cbrt((wMax_ - segments) / c);
+				origin_ = wMax_;
+			}else{
+				k_ = 0;
+				origin_ = segments;
+			}
+			wEst_ = segments;
+		}
+
+		// Target the window that W_cubic() reaches one RTT from now.
+		double t = static_cast<double>(now + srtt - epochStart_) / 1e9;
+		double target = origin_ + c * std::pow(t - k_, 3);
+
+		// Never grow slower than Reno would.
+		wEst_ += alpha * (static_cast<double>(ackedBytes) / mss) / segments;
+		target = std::max(target, wEst_);
+
+		// Grow by at most half the window per RTT.
+		target = std::clamp(target, segments, 1.5 * segments);
+
+		increase_ += (target - segments) / segments * ackedBytes;
+		if(increase_ >= 1) {
+			auto n = static_cast<uint32_t>(increase_);
+			cwnd += n;
+			increase_ -= n;
+		}
+	}
+
+	void onCongestionEvent(uint32_t, uint64_t) override {
+		double segments = static_cast<double>(cwnd) / mss;
+
+		// Fast convergence: release bandwidth to new flows.
+		if(segments < wMax_)
+			wMax_ = segments * (1 + beta) / 2;
+		else
+			wMax_ = segments;
+
+		ssthresh = std::max(static_cast<uint32_t>(cwnd * beta), 2 * mss);
+		epochStart_ = 0;
+		increase_ = 0;
+	}
+
+private:
+	uint64_t epochStart_ = 0;
+	double wMax_ = 0;
+	double k_ = 0;
+	double origin_ = 0;
+	double wEst_ = 0;
+	// Fractional cwnd increase in bytes.
+	double increase_ = 0;
+};
+
+} // anonymous namespace
+
+std::unique_ptr<TcpCongestionControl> makeTcpCongestionControl(std::string_view name, uint32_t mss) {
+	if(name == "reno")
+		return std::make_unique<NewReno>(mss);
+	if(name == "cubic")
+		return std::make_unique<Cubic>(mss);
+	return nullptr;
+}
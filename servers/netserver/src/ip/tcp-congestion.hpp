@@ -0,0 +1,42 @@
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+#include <string_view>
+
+// Congestion control algorithm of a TCP connection.
+// Algorithms only grow the window outside of loss recovery and pick ssthresh on
+// congestion events. Fast retransmit and fast recovery (RFC 6582) are done by
+// the socket itself, which adjusts cwnd directly during recovery.
+struct TcpCongestionControl {
+	// Initial window as in RFC 6928.
+	TcpCongestionControl(uint32_t mss)
+	: mss{mss}, cwnd{10 * mss}, ssthresh{UINT32_MAX} { }
+
+	virtual ~TcpCongestionControl() = default;
+
+	virtual std::string_view name() const = 0;
+
+	// Called for ACKs that advance snd.una outside of loss recovery.
+	// Times are in nanoseconds.
+	virtual void onAck(uint32_t ackedBytes, uint64_t now, uint64_t srtt) = 0;
+
+	// Called on fast retransmit. Updates ssthresh.
+	virtual void onCongestionEvent(uint32_t flightSize, uint64_t now) = 0;
+
+	// Called when the retransmission timer expires (RFC 5681, section 3.1).
+	void onTimeout(uint32_t flightSize, uint64_t now) {
+		onCongestionEvent(flightSize, now);
+		cwnd = mss;
+	}
+
+	uint32_t mss;
+	uint32_t cwnd;
+	uint32_t ssthresh;
+};
+
+// Names match the ones accepted by Linux' TCP_CONGESTION socket option.
+// Returns nullptr for unknown algorithms.
+std::unique_ptr<TcpCongestionControl> makeTcpCongestionControl(std::string_view name, uint32_t mss);
+
+constexpr std::string_view defaultTcpCongestionControl = "cubic";
@@ -3,10 +3,16 @@
 #include <async/result.hpp>
 #include <arch/bit.hpp>
 #include <arch/variable.hpp>
+#include <algorithm>
+#include <core/clock.hpp>
 #include <protocols/fs/server.hpp>
+#include <bit>
+#include <cstddef>
 #include <cstring>
+#include <deque>
 #include <format>
 #include <iomanip>
+#include <optional>
 #include <random>
 #include <fcntl.h>
 #include <sys/epoll.h>
@@ -14,12 +20,16 @@
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netinet/ip.h>
+#include <netinet/tcp.h>
 
 #include <bragi/helpers-std.hpp>
 
 #include "checksum.hpp"
-#include "ip4.hpp"
+#include "readiness.hpp"
 #include "tcp4.hpp"
+#include "transport.hpp"
+#include "tcp-congestion.hpp"
+#include "timer-wheel.hpp"
 
 namespace {
 
@@ -35,16 +45,6 @@ struct stl_allocator {
 	}
 };
 
-struct PseudoHeader {
-	arch::scalar_storage<uint32_t, arch::big_endian> src;
-	arch::scalar_storage<uint32_t, arch::big_endian> dst;
-	uint8_t zero = 0;
-	uint8_t proto = static_cast<uint8_t>(IpProto::tcp);
-	arch::scalar_storage<uint16_t, arch::big_endian> len;
-};
-
-static_assert(sizeof(PseudoHeader) == 12);
-
 struct RingBuffer {
 	RingBuffer(int shift)
 	: storage_{reinterpret_cast<char *>(operator new (1 << shift))}, shift_{shift} { }
@@ -65,14 +65,28 @@ struct RingBuffer {
 		return enqPtr_ - deqPtr_;
 	}
 
-	void enqueue(void *data, size_t size) {
-		assert(size <= spaceForEnqueue());
+	size_t size() {
+		return size_t{1} << shift_;
+	}
+
+	void enqueue(const void *data, size_t size) {
+		enqueueAhead(0, data, size);
+		enqueueAdvance(size);
+	}
+
+	// Stores data behind the end of the ring without making it available.
+	void enqueueAhead(size_t offset, const void *data, size_t size) {
+		assert(offset + size <= spaceForEnqueue());
 		size_t ringSize = size_t{1} << shift_;
-		auto wrappedPtr = enqPtr_ & (ringSize - 1);
-		auto p = reinterpret_cast<char *>(data);
+		auto wrappedPtr = (enqPtr_ + offset) & (ringSize - 1);
+		auto p = reinterpret_cast<const char *>(data);
 		size_t bytesUntilEnd = std::min(size, ringSize - wrappedPtr);
 		memcpy(storage_ + wrappedPtr, p, bytesUntilEnd);
 		memcpy(storage_, p + bytesUntilEnd, size - bytesUntilEnd);
+	}
+
+	void enqueueAdvance(size_t size) {
+		assert(size <= spaceForEnqueue());
 		enqPtr_ += size;
 	}
 
@@ -91,10 +105,44 @@ struct RingBuffer {
 		memcpy(p + bytesUntilEnd, storage_, size - bytesUntilEnd);
 	}
 
+	// Like dequeueLookahead(), but also adds the data to a checksum.
+	void checksumLookahead(size_t offset, void *data, size_t size, Checksum &csum) {
+		assert(offset + size <= availableToDequeue());
+		size_t ringSize = size_t{1} << shift_;
+		auto wrappedPtr = (deqPtr_ + offset) & (ringSize - 1);
+		auto p = reinterpret_cast<char *>(data);
+		size_t bytesUntilEnd = std::min(size, ringSize - wrappedPtr);
+		csum.copyAndUpdate(p, storage_ + wrappedPtr, bytesUntilEnd);
+		csum.copyAndUpdate(p + bytesUntilEnd, storage_, size - bytesUntilEnd);
+	}
+
 	void dequeueAdvance(size_t size) {
 		deqPtr_ += size;
 	}
 
+	// Enlarges the ring. Data that was stored by enqueueAhead() is preserved.
+	void grow(int shift) {
+		assert(shift >= shift_);
+		size_t oldSize = size_t{1} << shift_;
+		size_t newSize = size_t{1} << shift;
+		auto storage = reinterpret_cast<char *>(operator new (newSize));
+
+		auto ptr = deqPtr_;
+		size_t progress = 0;
+		while(progress < oldSize) {
+			size_t chunk = std::min({oldSize - progress,
+					oldSize - (ptr & (oldSize - 1)),
+					newSize - (ptr & (newSize - 1))});
+			memcpy(storage + (ptr & (newSize - 1)), storage_ + (ptr & (oldSize - 1)), chunk);
+			ptr += chunk;
+			progress += chunk;
+		}
+
+		operator delete(storage_);
+		storage_ = storage;
+		shift_ = shift;
+	}
+
 private:
 	char *storage_;
 	int shift_;
@@ -105,12 +153,182 @@ private:
 // TODO: Use a CSPRNG, see also UDP.
 static std::mt19937 globalPrng;
 
+// Like Linux' tcp_syn_retries, connect() fails after this many SYN retransmissions,
+// i.e., after about two minutes.
+constexpr unsigned int maxSynRetries = 6;
+// Half-open connections are dropped after this many SYN-ACK retransmissions.
+constexpr unsigned int maxSynAckRetries = 5;
+
+// MSS that we announce and upper bound for the MSS that we send.
+// TODO: Perform path MTU discovery.
+constexpr uint32_t mss = 1280;
+// MSS that is assumed if the remote does not announce one (RFC 9293, section 3.7.1).
+constexpr uint32_t defaultMss = 536;
+
+// Ring buffers start at 16 KiB and are tuned up to 4 MiB.
+constexpr int initialRingShift = 14;
+constexpr int maxRingShift = 22;
+// Window scale that we announce, such that the largest ring fits into the window.
+constexpr int windowShift = maxRingShift - 15;
+static_assert((size_t{0xFFFF} << windowShift) >= (size_t{1} << maxRingShift));
+
+// Bounds the work of inserting into out-of-order queues and SACK scoreboards.
+constexpr size_t maxSnRanges = 32;
+
+// Retransmission timeout bounds (RFC 6298). All times are in nanoseconds.
+constexpr uint64_t initialRto = 1'000'000'000;
+constexpr uint64_t minRto = 200'000'000;
+constexpr uint64_t maxRto = 60'000'000'000;
+// RTO after the handshake if the SYN had to be retransmitted (RFC 6298, section 5.7).
+constexpr uint64_t synRetransmitRto = 3'000'000'000;
+
+// Like Linux, delay ACKs by at most 40ms, but acknowledge every second full segment.
+constexpr uint64_t delayedAckTimeout = 40'000'000;
+
+// Connections stay in TIME-WAIT for 2 * MSL. Like Linux, we assume an MSL of 30 seconds.
+constexpr uint64_t timeWaitTimeout = 60'000'000'000;
+// Like Linux' tcp_fin_timeout, closed sockets give up on the remote side after this time.
+constexpr uint64_t finTimeout = 60'000'000'000;
+
+// Comparison of sequence numbers modulo 2^32.
+bool seqBefore(uint32_t a, uint32_t b) {
+	return static_cast<int32_t>(a - b) < 0;
+}
+
+bool seqAfter(uint32_t a, uint32_t b) {
+	return static_cast<int32_t>(a - b) > 0;
+}
+
+uint64_t mix64(uint64_t x) {
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccd;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53;
+	x ^= x >> 33;
+	return x;
+}
+
+uint64_t randomKey() {
+	return (uint64_t{globalPrng()} << 32) | globalPrng();
+}
+
+// Keys are random such that remote hosts cannot predict hash collisions or SYN cookies.
+const uint64_t tupleHashKey = randomKey();
+const uint64_t synCookieKey = randomKey();
+
+// Returns the two 64-bit halves of an address.
+std::pair<uint64_t, uint64_t> addressWords(const InetAddress &address) {
+	uint64_t words[2];
+	std::memcpy(words, address.bytes.data(), sizeof(words));
+	return {words[0], words[1]};
+}
+
+uint64_t hashFourTuple(const TcpFourTuple &tuple, uint64_t key) {
+	uint64_t h;
+	if (tuple.local.ipAddress.isIp4()) {
+		h = mix64(key ^ ((uint64_t{tuple.local.ipAddress.ip4()} << 32) | tuple.remote.ipAddress.ip4()));
+	} else {
+		auto [localHigh, localLow] = addressWords(tuple.local.ipAddress);
+		auto [remoteHigh, remoteLow] = addressWords(tuple.remote.ipAddress);
+		h = mix64(key ^ localHigh);
+		h = mix64(h ^ localLow);
+		h = mix64(h ^ remoteHigh);
+		h = mix64(h ^ remoteLow);
+	}
+	return mix64(h ^ ((uint64_t{tuple.local.port} << 16) | tuple.remote.port));
+}
+
+// SYN cookies store a coarse timestamp (in units of 64 seconds) in the top bits of
+// the ISN, followed by an index into cookieMssTable and a keyed hash of the connection.
+// Other options cannot be encoded; connections that are established via cookies do
+// not use window scaling, SACK or timestamps.
+constexpr int cookieTimeShift = 27;
+constexpr int cookieMssShift = 25;
+
+constexpr uint32_t cookieMssTable[] = {defaultMss, 1220, 1440, 1460};
+
+uint32_t synCookieTime() {
+	return (clk::getTimeSinceBoot().tv_sec / 64) & 0x1F;
+}
+
+uint32_t makeSynCookie(const TcpFourTuple &tuple, uint32_t remoteIsn, uint32_t time, uint32_t mssIndex) {
+	auto h = mix64(hashFourTuple(tuple, synCookieKey) ^ ((uint64_t{remoteIsn} << 7) | (time << 2) | mssIndex));
+	return (time << cookieTimeShift) | (mssIndex << cookieMssShift)
+			| (h & ((uint32_t{1} << cookieMssShift) - 1));
+}
+
+// Returns the MSS encoded in the cookie.
+std::optional<uint32_t> checkSynCookie(const TcpFourTuple &tuple, uint32_t remoteIsn, uint32_t cookie) {
+	uint32_t time = cookie >> cookieTimeShift;
+	uint32_t mssIndex = (cookie >> cookieMssShift) & 3;
+	// Accept cookies from the current and the previous period.
+	if(((synCookieTime() - time) & 0x1F) > 1)
+		return std::nullopt;
+	if(makeSynCookie(tuple, remoteIsn, time, mssIndex) != cookie)
+		return std::nullopt;
+	return cookieMssTable[mssIndex];
+}
+
+// Timestamp clock with a resolution of 1ms (RFC 7323, section 5.4).
+uint32_t timestampClock() {
+	return TimerWheel::now() / 1'000'000;
+}
+
+// Range [begin, end) of sequence numbers.
+struct SnRange {
+	uint32_t begin;
+	uint32_t end;
+};
+
+// Inserts into a sorted list of disjoint ranges, merging adjacent and overlapping ones.
+// Returns false if the list is full.
+bool insertSnRange(std::vector<SnRange> &ranges, SnRange range) {
+	auto it = ranges.begin();
+	while(it != ranges.end() && seqBefore(it->end, range.begin))
+		it++;
+
+	// Absorb all ranges that touch the new one.
+	auto last = it;
+	while(last != ranges.end() && !seqAfter(last->begin, range.end)) {
+		if(seqBefore(last->begin, range.begin))
+			range.begin = last->begin;
+		if(seqAfter(last->end, range.end))
+			range.end = last->end;
+		last++;
+	}
+
+	if(it == last && ranges.size() >= maxSnRanges)
+		return false;
+	it = ranges.erase(it, last);
+	ranges.insert(it, range);
+	return true;
+}
+
+// Drops all ranges (or parts of them) before sn.
+void trimSnRanges(std::vector<SnRange> &ranges, uint32_t sn) {
+	auto it = ranges.begin();
+	while(it != ranges.end() && !seqAfter(it->end, sn))
+		it++;
+	ranges.erase(ranges.begin(), it);
+	if(!ranges.empty() && seqBefore(ranges.front().begin, sn))
+		ranges.front().begin = sn;
+}
+
 } // namespace
 
+size_t TcpFourTupleHash::operator()(const TcpFourTuple &tuple) const {
+	return hashFourTuple(tuple, tupleHashKey);
+}
+
 struct TcpHeader {
 	static constexpr arch::field<uint16_t, bool> finFlag{0, 1};
 	static constexpr arch::field<uint16_t, bool> synFlag{1, 1};
+	static constexpr arch::field<uint16_t, bool> rstFlag{2, 1};
+	static constexpr arch::field<uint16_t, bool> pshFlag{3, 1};
 	static constexpr arch::field<uint16_t, bool> ackFlag{4, 1};
+	static constexpr arch::field<uint16_t, bool> urgFlag{5, 1};
+	static constexpr arch::field<uint16_t, bool> eceFlag{6, 1};
+	static constexpr arch::field<uint16_t, bool> cwrFlag{7, 1};
 	static constexpr arch::field<uint16_t, unsigned int> headerWords{12, 4};
 
 	arch::scalar_storage<uint16_t, arch::big_endian> srcPort;
@@ -125,14 +343,239 @@ struct TcpHeader {
 
 static_assert(sizeof(TcpHeader) == 20);
 
+struct TcpTimestamp {
+	uint32_t value;
+	uint32_t echo;
+};
+
+// Options of a segment. Only the options below are emitted; unknown ones are ignored.
+struct TcpOptions {
+	static constexpr uint8_t kindEnd = 0;
+	static constexpr uint8_t kindNop = 1;
+	static constexpr uint8_t kindMss = 2;
+	static constexpr uint8_t kindWindowScale = 3;
+	static constexpr uint8_t kindSackPermitted = 4;
+	static constexpr uint8_t kindSack = 5;
+	static constexpr uint8_t kindTimestamp = 8;
+
+	// Options take at most 40 bytes, which leaves space for 4 SACK blocks
+	// (or 3 blocks if timestamps are used).
+	static constexpr size_t maxSize = 40;
+	static constexpr size_t maxSackBlocks = 4;
+
+	// Returns false if the options are malformed.
+	bool parse(arch::dma_buffer_view view) {
+		auto p = reinterpret_cast<const uint8_t *>(view.data());
+		size_t n = view.size();
+		size_t i = 0;
+		while(i < n) {
+			auto kind = p[i];
+			if(kind == kindEnd)
+				break;
+			if(kind == kindNop) {
+				i++;
+				continue;
+			}
+
+			if(i + 2 > n)
+				return false;
+			size_t length = p[i + 1];
+			if(length < 2 || i + length > n)
+				return false;
+
+			auto load32 = [&] (size_t offset) {
+				uint32_t v;
+				memcpy(&v, p + i + offset, 4);
+				return arch::from_endian<arch::big_endian, uint32_t>(v);
+			};
+
+			if(kind == kindMss && length == 4) {
+				mss = (p[i + 2] << 8) | p[i + 3];
+			}else if(kind == kindWindowScale && length == 3) {
+				// Shifts larger than 14 are treated as 14 (RFC 7323, section 2.3).
+				windowScale = std::min(p[i + 2], uint8_t{14});
+			}else if(kind == kindSackPermitted && length == 2) {
+				sackPermitted = true;
+			}else if(kind == kindSack && length >= 10 && !((length - 2) % 8)) {
+				numSackBlocks = std::min((length - 2) / 8, maxSackBlocks);
+				for(size_t k = 0; k < numSackBlocks; k++)
+					sackBlocks[k] = {load32(2 + k * 8), load32(6 + k * 8)};
+			}else if(kind == kindTimestamp && length == 10) {
+				timestamp = TcpTimestamp{load32(2), load32(6)};
+			}
+			i += length;
+		}
+		return true;
+	}
+
+	size_t size() const {
+		size_t n = 0;
+		if(mss)
+			n += 4;
+		if(sackPermitted || timestamp)
+			n += timestamp ? 12 : 4;
+		if(windowScale)
+			n += 4;
+		if(numSackBlocks)
+			n += 4 + 8 * numSackBlocks;
+		assert(n <= maxSize);
+		return n;
+	}
+
+	// Writes size() bytes. The layout matches what Linux emits.
+	void emit(char *buffer) const {
+		auto p = reinterpret_cast<uint8_t *>(buffer);
+		auto store32 = [&] (uint32_t v) {
+			v = arch::to_endian<arch::big_endian, uint32_t>(v);
+			memcpy(p, &v, 4);
+			p += 4;
+		};
+
+		if(mss) {
+			*p++ = kindMss;
+			*p++ = 4;
+			*p++ = *mss >> 8;
+			*p++ = *mss & 0xFF;
+		}
+		if(sackPermitted && timestamp) {
+			*p++ = kindSackPermitted;
+			*p++ = 2;
+		}else if(sackPermitted) {
+			*p++ = kindNop;
+			*p++ = kindNop;
+			*p++ = kindSackPermitted;
+			*p++ = 2;
+		}else if(timestamp) {
+			*p++ = kindNop;
+			*p++ = kindNop;
+		}
+		if(timestamp) {
+			*p++ = kindTimestamp;
+			*p++ = 10;
+			store32(timestamp->value);
+			store32(timestamp->echo);
+		}
+		if(windowScale) {
+			*p++ = kindNop;
+			*p++ = kindWindowScale;
+			*p++ = 3;
+			*p++ = *windowScale;
+		}
+		if(numSackBlocks) {
+			*p++ = kindNop;
+			*p++ = kindNop;
+			*p++ = kindSack;
+			*p++ = 2 + 8 * numSackBlocks;
+			for(size_t k = 0; k < numSackBlocks; k++) {
+				store32(sackBlocks[k].begin);
+				store32(sackBlocks[k].end);
+			}
+		}
+	}
+
+	std::optional<uint16_t> mss;
+	std::optional<uint8_t> windowScale;
+	bool sackPermitted = false;
+	std::optional<TcpTimestamp> timestamp;
+	SnRange sackBlocks[maxSackBlocks];
+	size_t numSackBlocks = 0;
+};
+
 struct TcpPacket {
-	arch::dma_buffer_view payload() {
+	// Upper bound on the payload of coalesced segments; Linux' GRO uses the same limit.
+	static constexpr size_t maxCoalescedSize = 0xFFFF;
+
+	// Payload of this segment, without the payloads of coalesced segments.
+	arch::dma_buffer_view payload() const {
+		auto words = header.flags.load() & TcpHeader::headerWords;
+		return packet->payload.subview(words * 4);
+	}
+
+	// Size of the payload, including the payloads of coalesced segments.
+	size_t payloadSize() const {
+		size_t size = payload().size();
+		for (auto &segment : coalesced)
+			size += segment.payload.size();
+		return size;
+	}
+
+	// Calls fn(data, size) for each contiguous piece of the payload bytes
+	// in [offset, offset + length), including coalesced segments.
+	template<typename F>
+	void forEachPayloadChunk(size_t offset, size_t length, F fn) const {
+		auto visit = [&] (arch::dma_buffer_view view) {
+			if (offset >= view.size()) {
+				offset -= view.size();
+				return;
+			}
+			size_t chunk = std::min(view.size() - offset, length);
+			fn(reinterpret_cast<const char *>(view.data()) + offset, chunk);
+			offset = 0;
+			length -= chunk;
+		};
+
+		visit(payload());
+		for (auto &segment : coalesced) {
+			if (!length)
+				break;
+			visit(segment.payload);
+		}
+	}
+
+	// Segments that only carry data and an ACK can be coalesced. PSH ends a burst.
+	bool canCoalesce() const {
+		auto flags = header.flags.load();
+		return (flags & TcpHeader::ackFlag) && !(flags & TcpHeader::pshFlag)
+				&& !(flags & TcpHeader::finFlag) && !(flags & TcpHeader::synFlag)
+				&& !(flags & TcpHeader::rstFlag) && !(flags & TcpHeader::urgFlag)
+				&& !(flags & TcpHeader::eceFlag) && !(flags & TcpHeader::cwrFlag)
+				&& payload().size();
+	}
+
+	// Appends the payload of the next in-order segment of the same connection,
+	// similar to Linux' GRO. Like GRO, this requires identical ACK numbers and options,
+	// such that the connection handles the result like a single large segment.
+	bool tryCoalesce(TcpPacket &next) {
+		auto nextFlags = next.header.flags.load();
+		if (!canCoalesce() || !(nextFlags & TcpHeader::ackFlag)
+				|| (nextFlags & TcpHeader::finFlag) || (nextFlags & TcpHeader::synFlag)
+				|| (nextFlags & TcpHeader::rstFlag) || (nextFlags & TcpHeader::urgFlag)
+				|| (nextFlags & TcpHeader::eceFlag) || (nextFlags & TcpHeader::cwrFlag))
+			return false;
+
+		auto size = payloadSize();
+		auto nextPayload = next.payload();
+		if (!nextPayload.size() || size + nextPayload.size() > maxCoalescedSize)
+			return false;
+
+		if (next.packet->source != packet->source || next.packet->destination != packet->destination
+				|| next.header.srcPort.load() != header.srcPort.load()
+				|| next.header.destPort.load() != header.destPort.load()
+				|| next.packet->link.owner_before(packet->link)
+				|| packet->link.owner_before(next.packet->link))
+			return false;
+
+		if (next.header.seqNumber.load() != header.seqNumber.load() + size
+				|| next.header.ackNumber.load() != header.ackNumber.load())
+			return false;
+
 		auto words = header.flags.load() & TcpHeader::headerWords;
-		return packet->payload().subview(words * 4);
+		if ((nextFlags & TcpHeader::headerWords) != words
+				|| std::memcmp(packet->payload.subview(sizeof(TcpHeader)).data(),
+					next.packet->payload.subview(sizeof(TcpHeader)).data(),
+					words * 4 - sizeof(TcpHeader)))
+			return false;
+
+		// The window of the latest segment is the most accurate one.
+		header.window.store(next.header.window.load());
+		if (nextFlags & TcpHeader::pshFlag)
+			header.flags.store(header.flags.load() | TcpHeader::pshFlag(true));
+		coalesced.push_back({nextPayload, std::move(next.packet)});
+		return true;
 	}
 
-	bool parse(smarter::shared_ptr<const Ip4Packet> packet) {
-		auto ipPayload = packet->payload();
+	bool parse(smarter::shared_ptr<const InetPacket> packet) {
+		auto ipPayload = packet->payload;
 		if (ipPayload.size() < sizeof(TcpHeader))
 			return false;
 
@@ -142,19 +585,16 @@ struct TcpPacket {
 			return false;
 		if (ipPayload.size() < words * 4)
 			return false;
+		if (!options.parse(ipPayload.subview(sizeof(TcpHeader), words * 4 - sizeof(TcpHeader))))
+			return false;
 
-		if (header.checksum.load()) {
-			PseudoHeader pseudo {
-				.src = packet->header.source,
-				.dst = packet->header.destination,
-				.proto = packet->header.protocol,
-				.len = ipPayload.size()
-			};
+		if (header.checksum.load() && !packet->checksumValid) {
 			Checksum csum;
-			csum.update(&pseudo, sizeof(pseudo));
+			sumPseudoHeader(csum, packet->source, packet->destination,
+					IpProto::tcp, ipPayload.size());
 			csum.update(ipPayload);
 			auto result = csum.finalize();
-			if (result && ~result)
+			if (result != 0 && result != 0xFFFF)
 				return false;
 		}
 
@@ -162,38 +602,110 @@ struct TcpPacket {
 		return true;
 	}
 
+	struct Segment {
+		arch::dma_buffer_view payload;
+		// Keeps the payload alive.
+		smarter::shared_ptr<const InetPacket> packet;
+	};
+
 	TcpHeader header;
-	smarter::shared_ptr<const Ip4Packet> packet;
+	TcpOptions options;
+	smarter::shared_ptr<const InetPacket> packet;
+	// Segments that were coalesced into this one (see Tcp4::deliver_()).
+	// Their payloads directly follow the payload of this segment.
+	std::vector<Segment> coalesced;
 };
 
 namespace {
 
-protocols::fs::Error checkAddress(const void *addrPtr, size_t addrLength, TcpEndpoint &e) {
-	struct sockaddr_in sa;
-	if (addrLength < sizeof(sa))
-		return protocols::fs::Error::illegalArguments;
+// Sends a segment without payload, e.g., a SYN-ACK.
+async::result<protocols::fs::Error> sendControlSegment(uint16_t localPort, TcpEndpoint remoteEp,
+		uint32_t seqNumber, uint32_t ackNumber, arch::bit_value<uint16_t> flags, uint16_t window,
+		TcpOptions options, std::shared_ptr<nic::Link> boundInterface) {
+	auto targetInfo = co_await inet::targetByRemote(remoteEp.ipAddress, boundInterface);
+	if (!targetInfo)
+		co_return protocols::fs::Error::netUnreachable;
+
+	std::vector<char> buf;
+	buf.resize(sizeof(TcpHeader) + options.size());
+
+	auto header = new (buf.data()) TcpHeader {
+		.srcPort = localPort,
+		.destPort = remoteEp.port,
+		.seqNumber = seqNumber,
+		.ackNumber = ackNumber,
+		.flags = {},
+		.window = window,
+		.checksum = 0,
+		.urgentPointer = 0,
+	};
+	header->flags.store(TcpHeader::headerWords(buf.size() / 4) | flags);
+	options.emit(buf.data() + sizeof(TcpHeader));
+
+	Checksum csum;
+	sumPseudoHeader(csum, targetInfo->source, remoteEp.ipAddress, IpProto::tcp, buf.size());
+	csum.update(buf.data(), buf.size());
+	header->checksum = csum.finalize();
+
+	co_return co_await inet::sendFrame(std::move(*targetInfo),
+		buf.data(), buf.size(), IpProto::tcp);
+}
 
-	std::memcpy(&sa, addrPtr, sizeof(sa));
-	if (sa.sin_family != AF_INET)
-		return protocols::fs::Error::afNotSupported;
+// Answers a segment that does not belong to any connection (RFC 9293, section 3.10.7.1).
+void sendReset(const TcpPacket &packet, const TcpFourTuple &tuple) {
+	auto flags = packet.header.flags.load();
+	if (flags & TcpHeader::rstFlag)
+		return;
+	if (tuple.local.ipAddress.isBroadcast() || tuple.local.ipAddress.isMulticast())
+		return;
 
-	e.port = arch::from_endian<arch::big_endian, uint16_t>(sa.sin_port);
-	e.ipAddress = arch::from_endian<arch::big_endian, uint32_t>(sa.sin_addr.s_addr);
-	return protocols::fs::Error::none;
+	if (flags & TcpHeader::ackFlag) {
+		async::detach(sendControlSegment(tuple.local.port, tuple.remote,
+				packet.header.ackNumber.load(), 0,
+				TcpHeader::rstFlag(true), 0, {}, {}));
+	} else {
+		// SYN and FIN count as one byte.
+		uint32_t length = packet.payloadSize();
+		if (flags & TcpHeader::synFlag)
+			length++;
+		if (flags & TcpHeader::finFlag)
+			length++;
+		async::detach(sendControlSegment(tuple.local.port, tuple.remote,
+				0, packet.header.seqNumber.load() + length,
+				TcpHeader::rstFlag(true) | TcpHeader::ackFlag(true), 0, {}, {}));
+	}
 }
 
 } // anonymous namespace
 
 struct Tcp4Socket {
-	Tcp4Socket(Tcp4 *parent, bool nonBlock)
-	: parent_(parent), nonBlock_{nonBlock}, recvRing_{14}, sendRing_{14} {}
+	Tcp4Socket(Tcp4 *parent, int family, bool nonBlock)
+	: parent_(parent), family_{family}, nonBlock_{nonBlock}, recvRing_{initialRingShift}, sendRing_{initialRingShift},
+		congestion_{makeTcpCongestionControl(defaultTcpCongestionControl, mss)},
+		rtoTimer_{[this] { onRtoExpired_(); }},
+		delayedAckTimer_{[this] {
+			ackNow_ = true;
+			flushEvent_.raise();
+		}},
+		closeTimer_{[this] {
+			auto self = holder_.lock();
+			destroy_();
+		}},
+		retryTimer_{[this] { flushEvent_.raise(); }} {
+		localEp_.ipAddress = InetAddress::any(family);
+		remoteEp_.ipAddress = InetAddress::any(family);
+	}
 
 	~Tcp4Socket() {
-		parent_->unbind(localEp_);
+		timerWheel().disarm(&rtoTimer_);
+		timerWheel().disarm(&delayedAckTimer_);
+		timerWheel().disarm(&closeTimer_);
+		timerWheel().disarm(&retryTimer_);
+		parent_->unbind(localEp_, this);
 	}
 
-	static auto makeSocket(Tcp4 *parent, bool nonBlock) {
-		auto s = smarter::make_shared<Tcp4Socket>(parent, nonBlock);
+	static auto makeSocket(Tcp4 *parent, int family, bool nonBlock) {
+		auto s = smarter::make_shared<Tcp4Socket>(parent, family, nonBlock);
 		s->holder_ = s;
 		async::detach(s->flushOutPackets_());
 		return s;
@@ -211,16 +723,17 @@ struct Tcp4Socket {
 
 		// Validate the endpoint.
 		TcpEndpoint bindEp;
-		if (auto e = checkAddress(addrPtr, addrLength, bindEp); e != protocols::fs::Error::none)
+		if (auto e = parseSockaddr(addrPtr, addrLength, self->family_, bindEp.ipAddress, bindEp.port);
+				e != protocols::fs::Error::none)
 			co_return e;
 
-		if (bindEp.ipAddress == INADDR_BROADCAST) {
+		if (bindEp.ipAddress.isBroadcast() || bindEp.ipAddress.isMulticast()) {
 			std::cout << "netserver: TCP cannot broadcast" << std::endl;
 			co_return protocols::fs::Error::accessDenied;
 		}
 
-		if (bindEp.ipAddress != INADDR_ANY && !ip4().hasIp(bindEp.ipAddress)) {
-			std::cout << "netserver: IP address " << std::setw(8) << std::hex << bindEp.ipAddress << std::dec << " is not available" << std::endl;
+		if (!bindEp.ipAddress.isAny() && !inet::isLocalAddress(bindEp.ipAddress)) {
+			std::cout << "netserver: IP address " << bindEp.ipAddress.toString() << " is not available" << std::endl;
 			co_return protocols::fs::Error::addressNotAvailable;
 		}
 
@@ -239,27 +752,17 @@ struct Tcp4Socket {
 
 	static async::result<size_t> sockname(void *object, void *addr_ptr, size_t max_addr_length) {
 		auto self = static_cast<Tcp4Socket *>(object);
-		sockaddr_in sa{};
-		sa.sin_family = AF_INET;
-		sa.sin_port = htons(self->localEp_.port);
-		sa.sin_addr.s_addr = htonl(self->localEp_.ipAddress);
-		memcpy(addr_ptr, &sa, std::min(sizeof(sockaddr_in), max_addr_length));
-
-		co_return sizeof(sockaddr_in);
+		co_return emitSockaddr(addr_ptr, max_addr_length, self->family_,
+				self->localEp_.ipAddress, self->localEp_.port);
 	}
 
 	static async::result<frg::expected<protocols::fs::Error, size_t>> peername(void *object, void *addr_ptr, size_t max_addr_length) {
 		auto self = static_cast<Tcp4Socket *>(object);
-		if(self->connectState_ != ConnectState::connected) {
+		if(!self->synchronized_()) {
 			co_return protocols::fs::Error::notConnected;
 		}
-		sockaddr_in sa{};
-		sa.sin_family = AF_INET;
-		sa.sin_port = htons(self->remoteEp_.port);
-		sa.sin_addr.s_addr = htonl(self->remoteEp_.ipAddress);
-		memcpy(addr_ptr, &sa, std::min(sizeof(sockaddr_in), max_addr_length));
-
-		co_return sizeof(sockaddr_in);
+		co_return emitSockaddr(addr_ptr, max_addr_length, self->family_,
+				self->remoteEp_.ipAddress, self->remoteEp_.port);
 	}
 
 	static async::result<void> ioctl(void *object, uint32_t id, helix_ng::RecvInlineResult msg, helix::UniqueLane conversation) {
@@ -275,7 +778,7 @@ struct Tcp4Socket {
 				case FIONREAD: {
 					resp.set_error(managarm::fs::Errors::SUCCESS);
 
-					if(self->connectState_ != ConnectState::connected) {
+					if(!self->synchronized_()) {
 						resp.set_error(managarm::fs::Errors::NOT_CONNECTED);
 					}else {
 						resp.set_fionread_count(self->recvRing_.availableToDequeue());
@@ -317,10 +820,11 @@ struct Tcp4Socket {
 
 		// Validate the endpoint.
 		TcpEndpoint connectEp;
-		if (auto e = checkAddress(addrPtr, addrLength, connectEp); e != protocols::fs::Error::none)
+		if (auto e = parseSockaddr(addrPtr, addrLength, self->family_, connectEp.ipAddress, connectEp.port);
+				e != protocols::fs::Error::none)
 			co_return e;
 
-		if (connectEp.ipAddress == INADDR_BROADCAST) {
+		if (connectEp.ipAddress.isBroadcast() || connectEp.ipAddress.isMulticast()) {
 			std::cout << "netserver: TCP cannot broadcast" << std::endl;
 			co_return protocols::fs::Error::accessDenied;
 		}
@@ -331,9 +835,22 @@ struct Tcp4Socket {
 			co_return protocols::fs::Error::addressNotAvailable;
 		}
 
+		// Incoming packets are matched against the source address that we use.
+		auto targetInfo = co_await inet::targetByRemote(connectEp.ipAddress, self->boundInterface_);
+		if (!targetInfo) {
+			std::cout << "netserver: Destination unreachable" << std::endl;
+			co_return protocols::fs::Error::netUnreachable;
+		}
+
 		// Connect to the remote.
+		auto randomSn = globalPrng();
+		self->localSettledSn_ = randomSn;
+		self->localFlushedSn_ = randomSn;
+		self->localMaxSn_ = randomSn;
+		self->recoverSn_ = randomSn;
 		self->connectState_ = ConnectState::sendSyn;
 		self->remoteEp_ = connectEp;
+		self->parent_->registerConnection_(self->holder_.lock(), targetInfo->source);
 		self->flushEvent_.raise();
 
 		while(true) {
@@ -341,9 +858,53 @@ struct Tcp4Socket {
 				break;
 			co_await self->settleEvent_.async_wait();
 		}
+		if(self->connectState_ == ConnectState::closed)
+			co_return self->connectError_;
+		co_return protocols::fs::Error::none;
+	}
+
+	static async::result<protocols::fs::Error> listen(void *object) {
+		auto self = static_cast<Tcp4Socket *>(object);
+
+		if (self->connectState_ != ConnectState::none)
+			co_return protocols::fs::Error::illegalArguments;
+
+		// Like Linux, bind to an ephemeral port if necessary.
+		if (!self->localEp_.port && !self->bindAvailable()) {
+			std::cout << "netserver: No source port" << std::endl;
+			co_return protocols::fs::Error::addressInUse;
+		}
+
+		// TODO: PT_LISTEN does not carry the backlog, so we always use the maximum.
+		self->listening_ = true;
 		co_return protocols::fs::Error::none;
 	}
 
+	static async::result<frg::expected<protocols::fs::Error, helix::UniqueLane>> accept(void *object) {
+		auto self = static_cast<Tcp4Socket *>(object);
+
+		if (!self->listening_)
+			co_return protocols::fs::Error::illegalArguments;
+
+		while (self->acceptQueue_.empty()) {
+			if (!self->listening_)
+				co_return protocols::fs::Error::illegalArguments;
+			if (self->nonBlock_)
+				co_return protocols::fs::Error::wouldBlock;
+			co_await self->acceptEvent_.async_wait();
+		}
+
+		auto socket = std::move(self->acceptQueue_.front());
+		self->acceptQueue_.pop_front();
+		socket->listener_ = smarter::shared_ptr<Tcp4Socket>{};
+		self->publishReadiness_(0);
+
+		auto [localLane, remoteLane] = helix::createStream();
+		async::detach(protocols::fs::servePassthrough(std::move(localLane), socket, &ops),
+				[socket] { socket->close_(); });
+		co_return std::move(remoteLane);
+	}
+
 	static async::result<protocols::fs::ReadResult> read(void *object, helix_ng::CredentialsView creds,
 			void *data, size_t size, async::cancellation_token) {
 		auto result = co_await recvMsg(object, creds, 0, data, size, nullptr, 0, {});
@@ -377,6 +938,9 @@ struct Tcp4Socket {
 			if(!available) {
 				if(progress)
 					break;
+				// Return EOF once the remote sent a FIN or the connection was reset.
+				if(self->remoteClosed_ || self->connectState_ == ConnectState::closed)
+					break;
 				if(self->nonBlock_ || flags & MSG_DONTWAIT)
 					co_return protocols::fs::Error::wouldBlock;
 				co_await self->inEvent_.async_wait();
@@ -388,16 +952,17 @@ struct Tcp4Socket {
 			if(flags & MSG_PEEK)
 				break;
 			self->recvRing_.dequeueAdvance(chunk);
+			self->tuneReceiveBuffer_(chunk);
 			self->flushEvent_.raise();
 		}
 
-		struct sockaddr_in sa;
-		memset(&sa, 0, sizeof(struct sockaddr_in));
-		sa.sin_port = arch::to_endian<arch::big_endian, uint16_t>(self->remoteEp_.port);
-		sa.sin_addr.s_addr = arch::to_endian<arch::big_endian, uint32_t>(self->remoteEp_.ipAddress);
-		memcpy(addrPtr, &sa, std::min(sizeof(struct sockaddr_in), addrLength));
+		if(!(flags & MSG_PEEK))
+			self->publishReadiness_(0);
 
-		co_return protocols::fs::RecvData{{}, progress, sizeof(struct sockaddr_in), 0};
+		auto addrSize = emitSockaddr(addrPtr, addrLength, self->family_,
+				self->remoteEp_.ipAddress, self->remoteEp_.port);
+
+		co_return protocols::fs::RecvData{{}, progress, addrSize, 0};
 	}
 
 	static async::result<frg::expected<protocols::fs::Error, size_t>> sendMsg(void *object,
@@ -412,24 +977,54 @@ struct Tcp4Socket {
 		(void) fds;
 
 		auto self = static_cast<Tcp4Socket *>(object);
-		auto p = reinterpret_cast<char *>(data);
+		co_return co_await self->sendData_(reinterpret_cast<const char *>(data), size);
+	}
+
+	// Implements sendfile() and splice() from a file: the data is enqueued directly
+	// from the file's page cache instead of being copied through posix.
+	static async::result<frg::expected<protocols::fs::Error, size_t>>
+	copyFromMemory(void *object, helix::BorrowedDescriptor memory,
+			uint64_t inOffset, int64_t outOffset, size_t size) {
+		// Bounds the amount of memory that is locked at a time.
+		constexpr size_t windowSize = 0x100000;
+
+		auto self = static_cast<Tcp4Socket *>(object);
+		if(outOffset >= 0)
+			co_return protocols::fs::Error::seekOnPipe;
 
 		size_t progress = 0;
 		while(progress < size) {
-			size_t space = self->sendRing_.spaceForEnqueue();
-			if(!space) {
-				if(self->nonBlock_) {
-					if(progress)
-						break;
-					co_return protocols::fs::Error::wouldBlock;
-				}
-				co_await self->settleEvent_.async_wait();
-				continue;
+			auto chunkOffset = inOffset + progress;
+			auto chunkSize = std::min(size - progress,
+					windowSize - (chunkOffset & (windowSize - 1)));
+
+			auto mapOffset = chunkOffset & ~size_t(0xFFF);
+			auto mapSize = (((chunkOffset & size_t(0xFFF)) + chunkSize + 0xFFF) & ~size_t(0xFFF));
+
+			helix::LockMemoryView lockMemory;
+			auto &&submit = helix::submitLockMemoryView(memory,
+					&lockMemory, mapOffset, mapSize, helix::Dispatcher::global());
+			co_await submit.async_wait();
+			if(lockMemory.error()) {
+				if(progress)
+					break;
+				co_return protocols::fs::Error::illegalArguments;
 			}
-			size_t chunk = std::min(space, size - progress);
-			self->sendRing_.enqueue(p + progress, chunk);
-			self->flushEvent_.raise();
-			progress += chunk;
+
+			helix::Mapping fileMap{memory,
+					static_cast<ptrdiff_t>(mapOffset), mapSize,
+					kHelMapProtRead | kHelMapDontRequireBacking};
+			auto result = co_await self->sendData_(
+					reinterpret_cast<const char *>(fileMap.get()) + (chunkOffset - mapOffset),
+					chunkSize);
+			if(!result) {
+				if(progress)
+					break;
+				co_return result.error();
+			}
+			progress += result.value();
+			if(result.value() < chunkSize)
+				break;
 		}
 
 		co_return progress;
@@ -463,16 +1058,19 @@ struct Tcp4Socket {
 	static async::result<frg::expected<protocols::fs::Error, protocols::fs::PollStatusResult>>
 	pollStatus(void *object) {
 		auto self = static_cast<Tcp4Socket *>(object);
+		co_return protocols::fs::PollStatusResult{self->currentSeq_, self->pollStatus_()};
+	}
 
-		int active = 0;
-		if(self->recvRing_.availableToDequeue())
-			active |= EPOLLIN;
-		if(self->sendRing_.spaceForEnqueue())
-			active |= EPOLLOUT;
-		if(self->remoteClosed_)
-			active |= EPOLLHUP;
+	static async::result<frg::expected<protocols::fs::Error, uint64_t>>
+	watchReadiness(void *object) {
+		auto self = static_cast<Tcp4Socket *>(object);
 
-		co_return protocols::fs::PollStatusResult{self->currentSeq_, active};
+		if(!self->readinessSlot_) {
+			if(auto e = self->readinessSlot_.acquire(); !e)
+				co_return e.error();
+			self->publishReadiness_(0);
+		}
+		co_return self->readinessSlot_.index();
 	}
 
 	static async::result<void> setFileFlags(void *object, int flags) {
@@ -500,6 +1098,38 @@ struct Tcp4Socket {
 		int layer, int number, std::vector<char> optbuf) {
 		auto self = static_cast<Tcp4Socket *>(object);
 
+		if(layer == SOL_SOCKET && number == SO_REUSEPORT) {
+			if(optbuf.size() < sizeof(int))
+				co_return protocols::fs::Error::illegalArguments;
+			int value;
+			memcpy(&value, optbuf.data(), sizeof(int));
+			self->reusePort_ = value;
+			co_return {};
+		}
+
+		if(layer == IPPROTO_TCP && number == TCP_NODELAY) {
+			if(optbuf.size() < sizeof(int))
+				co_return protocols::fs::Error::illegalArguments;
+			int value;
+			memcpy(&value, optbuf.data(), sizeof(int));
+			self->nodelay_ = value;
+			// Data held back by Nagle's algorithm can be sent now.
+			self->flushEvent_.raise();
+			co_return {};
+		}
+
+		if(layer == IPPROTO_TCP && number == TCP_CONGESTION) {
+			std::string_view name{optbuf.data(), strnlen(optbuf.data(), optbuf.size())};
+			auto congestion = makeTcpCongestionControl(name, self->sendMss_);
+			if(!congestion)
+				co_return protocols::fs::Error::fileNotFound;
+			// The new algorithm continues from the current window.
+			congestion->cwnd = self->congestion_->cwnd;
+			congestion->ssthresh = self->congestion_->ssthresh;
+			self->congestion_ = std::move(congestion);
+			co_return {};
+		}
+
 		if(layer == SOL_SOCKET && number == SO_BINDTODEVICE) {
 			std::string ifname{optbuf.data()};
 
@@ -522,13 +1152,31 @@ struct Tcp4Socket {
 		co_return protocols::fs::Error::invalidProtocolOption;
 	}
 
+	static async::result<protocols::fs::Error> shutdown(void *object, int how) {
+		auto self = static_cast<Tcp4Socket *>(object);
+
+		if(how != SHUT_RD && how != SHUT_WR && how != SHUT_RDWR)
+			co_return protocols::fs::Error::illegalArguments;
+		if(!self->synchronized_())
+			co_return protocols::fs::Error::notConnected;
+
+		// Like Linux, SHUT_RD does not affect the connection.
+		if(how != SHUT_RD)
+			self->shutdownSend_();
+		co_return protocols::fs::Error::none;
+	}
+
 	constexpr static protocols::fs::FileOperations ops {
 		.read = &read,
 		.write = &write,
 		.ioctl = &ioctl,
 		.pollWait = &pollWait,
 		.pollStatus = &pollStatus,
+		.watchReadiness = &watchReadiness,
+		.copyFromMemory = &copyFromMemory,
 		.bind = &bind,
+		.listen = &listen,
+		.accept = &accept,
 		.connect = &connect,
 		.sockname = &sockname,
 		.getFileFlags = &getFileFlags,
@@ -537,9 +1185,14 @@ struct Tcp4Socket {
 		.sendMsg = &sendMsg,
 		.peername = &peername,
 		.setSocketOption = &setSocketOption,
+		.shutdown = &shutdown,
 	};
 
-	bool bindAvailable(uint32_t ipAddress = INADDR_ANY) {
+	bool bindAvailable() {
+		return bindAvailable(InetAddress::any(family_));
+	}
+
+	bool bindAvailable(InetAddress ipAddress) {
 		static std::uniform_int_distribution<uint16_t> dist {
 			32768, 60999
 		};
@@ -557,26 +1210,142 @@ struct Tcp4Socket {
 private:
 	async::result<void> flushOutPackets_();
 
+	// Events that pollStatus() reports.
+	int pollStatus_() {
+		int active = 0;
+		bool hangup = remoteClosed_ || connectState_ == ConnectState::closed;
+		if(recvRing_.availableToDequeue() || !acceptQueue_.empty() || hangup)
+			active |= EPOLLIN;
+		if(sendRing_.spaceForEnqueue())
+			active |= EPOLLOUT;
+		if(hangup)
+			active |= EPOLLHUP;
+		return active;
+	}
+
+	// Publishes the current status and the given edges to the readiness table
+	// (if posix watches this socket). Must be called whenever the status changes.
+	void publishReadiness_(int edges) {
+		if(readinessSlot_)
+			readinessSlot_.publish(currentSeq_, pollStatus_(), edges);
+	}
+	// Waits for the next tick of the timer wheel before the flush is retried.
+	async::result<void> waitForRetry_();
+
 	void handleInPacket_(TcpPacket packet);
+	void handleListenPacket_(TcpPacket packet, const TcpFourTuple &tuple);
+	void handleAck_(const TcpPacket &packet);
+	void handleData_(const TcpPacket &packet);
+	// Handles a RST as in RFC 9293, section 3.10.7.4, and RFC 5961, section 3.2.
+	void handleReset_(const TcpPacket &packet);
+
+	// Options that we send on SYN and SYN-ACK segments.
+	TcpOptions synOptions_();
+	// Applies the options of the remote SYN or SYN-ACK.
+	void negotiateOptions_(const TcpOptions &remote);
+	// Timestamp and SACK options of segments after the handshake.
+	TcpOptions segmentOptions_();
+	// Next range that is retransmitted during loss recovery.
+	std::optional<SnRange> nextHole_();
+
+	// Dynamic right-sizing of the receive buffer: the buffer is large enough to hold
+	// the data that the application consumes per RTT, similar to Linux.
+	void tuneReceiveBuffer_(size_t copied);
+	// Grows the send buffer up to twice the amount of data that can be in flight.
+	bool growSendBuffer_();
+
+	// Called when the ACK for our SYN arrives.
+	void settleSyn_();
+	void sampleRtt_(uint64_t rtt);
+	void onRtoExpired_();
+
+	// Called once the file is closed.
+	void close_();
+	// Enqueues data into sendRing_, waiting for space unless the socket is non-blocking.
+	async::result<frg::expected<protocols::fs::Error, size_t>> sendData_(const char *p, size_t size);
+
+	// Queues a FIN behind the data in sendRing_.
+	void shutdownSend_();
+	// Aborts the connection with a RST.
+	void reset_();
+	// Called when the ACK for our FIN arrives.
+	void finAcked_();
+	void enterTimeWait_();
+	// Removes the socket from all tables and wakes up all waiters.
+	// Callers must hold a reference since this may drop the last one that Tcp4 holds.
+	void destroy_();
+
+	// States in which the handshake is complete and the connection is not closed yet.
+	bool synchronized_() {
+		return connectState_ >= ConnectState::connected && connectState_ != ConnectState::closed;
+	}
+
+	// States in which our FIN is queued but not acknowledged yet.
+	bool finQueued_() {
+		return connectState_ == ConnectState::finWait1
+				|| connectState_ == ConnectState::closing
+				|| connectState_ == ConnectState::lastAck;
+	}
+
+	// Set once no more data can be sent, i.e., after shutdown(SHUT_WR) or a reset.
+	bool sendShutdown_() {
+		return connectState_ >= ConnectState::finWait1;
+	}
+
+	bool acceptQueueFull_() {
+		return acceptQueue_.size() >= backlog_;
+	}
+
+	// Called on listeners once the handshake of a connection completes.
+	void enqueueAccepted_(smarter::shared_ptr<Tcp4Socket> socket) {
+		acceptQueue_.push_back(std::move(socket));
+		inSeq_ = ++currentSeq_;
+		acceptEvent_.raise();
+		pollEvent_.raise();
+		publishReadiness_(EPOLLIN);
+	}
 
 private:
 	friend struct Tcp4;
 
+	// The order matters, see synchronized_() and sendShutdown_().
 	enum class ConnectState {
 		none,
 		sendSyn, // Client-side only.
 		sendSynAck, // Server-side only.
 		connected,
+		// The remote sent a FIN, we did not.
+		closeWait,
+		// We sent a FIN, the remote did not acknowledge it yet.
+		finWait1,
+		// The remote acknowledged our FIN but did not send its own FIN yet.
+		finWait2,
+		// Both sides sent a FIN at the same time, ours is not acknowledged yet.
+		closing,
+		// Both sides closed; waits for old duplicates to expire.
+		timeWait,
+		// We sent a FIN after the remote's FIN, it is not acknowledged yet.
+		lastAck,
+		// The socket is removed from all tables.
+		closed,
 	};
 
 	Tcp4 *parent_;
+	// AF_INET or AF_INET6.
+	int family_;
 	bool nonBlock_;
 	TcpEndpoint remoteEp_;
 	TcpEndpoint localEp_;
 	smarter::weak_ptr<Tcp4Socket> holder_;
+	// Route and next hop of remoteEp_.
+	inet::DstCache dst_;
 
 	ConnectState connectState_ = ConnectState::none;
 	bool remoteClosed_ = false;
+	// Set once the file is closed.
+	bool userClosed_ = false;
+	// Returned by connect() if the connection could not be established.
+	protocols::fs::Error connectError_ = protocols::fs::Error::connectionRefused;
 
 	// Out-SN corresponding to the front of sendRing_.
 	uint32_t localSettledSn_ = 0;
@@ -584,12 +1353,38 @@ private:
 	uint32_t localFlushedSn_ = 0;
 	// Out-SN of the end of the remote window (>= localSettledSn_).
 	uint32_t localWindowSn_ = 0;
+	// Highest Out-SN that was ever flushed (>= localFlushedSn_).
+	// After a retransmission timeout, localFlushedSn_ is reset to localSettledSn_.
+	uint32_t localMaxSn_ = 0;
 	// In-SN that we already acknowledged.
 	uint32_t remoteAckedSn_ = 0;
 	// In-SN that we already received (>= remoteAckedSn_).
 	uint32_t remoteKnownSn_ = 0;
 	// Size of received window that we announced to the remote side.
 	uint32_t announcedWindow_ = 0;
+	// Set if an ACK must be sent without delay, e.g., for out-of-order segments.
+	bool ackNow_ = false;
+	// Disables Nagle's algorithm.
+	bool nodelay_ = false;
+
+	// Options negotiated during the handshake.
+	uint32_t sendMss_ = mss;
+	// Shift of windows that we receive and send, respectively (RFC 7323).
+	int sendWindowShift_ = 0;
+	int receiveWindowShift_ = 0;
+	bool sackEnabled_ = false;
+	bool timestampsEnabled_ = false;
+	// Most recent timestamp value of the remote that we echo.
+	uint32_t timestampRecent_ = 0;
+
+	// Out-of-order data that is stored behind the end of recvRing_.
+	std::vector<SnRange> outOfOrder_;
+	// In-SN of the most recent out-of-order segment. Its range is the first SACK block.
+	uint32_t recentOutOfOrderSn_ = 0;
+
+	// Receive buffer tuning. Consumed bytes are counted per RTT.
+	size_t receiveCopied_ = 0;
+	uint64_t receiveTuneStart_ = 0;
 
 	RingBuffer recvRing_;
 	RingBuffer sendRing_;
@@ -598,6 +1393,37 @@ private:
 	async::recurring_event flushEvent_;
 	async::recurring_event settleEvent_;
 
+	// RTT estimation and retransmission timeout as in RFC 6298.
+	// Only one segment is timed at a time; retransmitted segments are not timed (Karn's algorithm).
+	uint64_t srtt_ = 0;
+	uint64_t rttvar_ = 0;
+	uint64_t rto_ = initialRto;
+	bool rttTiming_ = false;
+	uint32_t rttSn_ = 0;
+	uint64_t rttStart_ = 0;
+	// Set by the retransmission timer, handled by flushOutPackets_().
+	bool retransmitDue_ = false;
+
+	// Fast retransmit and fast recovery as in RFC 6582 (NewReno).
+	unsigned int dupAcks_ = 0;
+	bool inRecovery_ = false;
+	// Out-SN that ends loss recovery once it is acknowledged.
+	uint32_t recoverSn_ = 0;
+	// Out-SN ranges that the remote selectively acknowledged (RFC 2018).
+	std::vector<SnRange> sacked_;
+	// End of the data that was retransmitted during the current recovery.
+	uint32_t highRetransmitSn_ = 0;
+	// Set to resend the next hole, see nextHole_().
+	bool fastRetransmit_ = false;
+	std::unique_ptr<TcpCongestionControl> congestion_;
+
+	// Doubles as the persist timer while the remote window is closed.
+	TimerWheel::Timer rtoTimer_;
+	TimerWheel::Timer delayedAckTimer_;
+	// Ends TIME-WAIT and limits the time that closed sockets spend on closing.
+	TimerWheel::Timer closeTimer_;
+	TimerWheel::Timer retryTimer_;
+
 	// The following sequence numbers are *not* TCP sequence numbers,
 	// they implement the poll() function.
 	uint64_t currentSeq_ = 1;
@@ -605,158 +1431,796 @@ private:
 	uint64_t outSeq_ = 0;
 	uint64_t hupSeq_ = 1;
 	async::recurring_event pollEvent_;
+	// Released once the file is closed.
+	ReadinessTable::Slot readinessSlot_;
 
 	std::shared_ptr<nic::Link> boundInterface_ = {};
+
+	// State of listening sockets.
+	bool listening_ = false;
+	bool reusePort_ = false;
+	size_t backlog_ = SOMAXCONN;
+	// Number of connections in ConnectState::sendSynAck.
+	size_t synQueueLength_ = 0;
+	std::deque<smarter::shared_ptr<Tcp4Socket>> acceptQueue_;
+	async::recurring_event acceptEvent_;
+
+	// Listener of passively opened connections until they are accepted.
+	smarter::shared_ptr<Tcp4Socket> listener_;
+	// Retransmissions of our SYN or SYN-ACK.
+	unsigned int synRetries_ = 0;
 };
 
 async::result<void> Tcp4Socket::flushOutPackets_() {
+	// Keep the socket alive until it is destroyed.
+	auto self = holder_.lock();
+
 	while(true) {
+		if(connectState_ == ConnectState::closed)
+			co_return;
+
 		if(connectState_ == ConnectState::none) {
 			co_await flushEvent_.async_wait();
 			continue;
 		}
 
 		if(connectState_ == ConnectState::sendSyn) {
-			if(localSettledSn_ != localFlushedSn_) {
+			if(localSettledSn_ != localFlushedSn_ && !retransmitDue_) {
 				co_await flushEvent_.async_wait();
 				continue;
 			}
 
-			// Obtain a new random sequence number.
-			auto randomSn = globalPrng();
-			localSettledSn_ = randomSn;
-			localFlushedSn_ = randomSn;
+			if(retransmitDue_) {
+				retransmitDue_ = false;
+				synRetries_++;
+			}
+
+			if(synRetries_ > maxSynRetries) {
+				if(debugTcp)
+					std::cout << "netserver: TCP connection timed out" << std::endl;
+				connectError_ = protocols::fs::Error::timedOut;
+				destroy_();
+				co_return;
+			}
+
+			// SYNs that cannot be sent also count against maxSynRetries.
+			if(!rtoTimer_.armed())
+				timerWheel().arm(&rtoTimer_, TimerWheel::now() + rto_);
 
 			// Construct and transmit the initial SYN packet.
-			auto targetInfo = co_await ip4().targetByRemote(remoteEp_.ipAddress, boundInterface_);
+			auto targetInfo = co_await dst_.get(remoteEp_.ipAddress, boundInterface_);
 			if (!targetInfo) {
-				// TODO: Return an error to users.
 				std::cout << "netserver: Destination unreachable" << std::endl;
-				co_return;
+				localFlushedSn_ = localSettledSn_;
+				co_await waitForRetry_();
+				continue;
 			}
 
+			auto options = synOptions_();
+
 			std::vector<char> buf;
-			buf.resize(sizeof(TcpHeader));
+			buf.resize(sizeof(TcpHeader) + options.size());
 
 			auto header = new (buf.data()) TcpHeader {
 				.srcPort = localEp_.port,
 				.destPort = remoteEp_.port,
-				.seqNumber = localFlushedSn_,
+				.seqNumber = localSettledSn_,
 				.ackNumber = 0,
 				.flags = {},
-				.window = 0,
+				.window = std::min(recvRing_.spaceForEnqueue(), size_t{0xFFFF}),
 				.checksum = 0,
 				.urgentPointer = 0,
 			};
-			header->flags.store(TcpHeader::headerWords(sizeof(TcpHeader) / 4)
+			header->flags.store(TcpHeader::headerWords(buf.size() / 4)
 					| TcpHeader::synFlag(true));
+			options.emit(buf.data() + sizeof(TcpHeader));
 
 			// Fill in the checksum.
-			PseudoHeader pseudo {
-				.src = targetInfo->source,
-				.dst = remoteEp_.ipAddress,
-				.len = buf.size()
-			};
 			Checksum csum;
-			csum.update(&pseudo, sizeof(PseudoHeader));
+			sumPseudoHeader(csum, targetInfo->source, remoteEp_.ipAddress, IpProto::tcp, buf.size());
 			csum.update(buf.data(), buf.size());
 			header->checksum = csum.finalize();
 
-			++localFlushedSn_;
+			// The first SYN is timed; the timer is cancelled if the SYN is retransmitted.
+			if(!synRetries_) {
+				rttTiming_ = true;
+				rttSn_ = localSettledSn_ + 1;
+				rttStart_ = TimerWheel::now();
+			}
+			localFlushedSn_ = localSettledSn_ + 1;
+			localMaxSn_ = localFlushedSn_;
 
 			if(debugTcp)
 				std::cout << "netserver: Sending TCP SYN" << std::endl;
-			auto error = co_await ip4().sendFrame(std::move(*targetInfo),
-				buf.data(), buf.size(), static_cast<uint16_t>(IpProto::tcp));
+			auto error = co_await inet::sendFrame(std::move(*targetInfo),
+				buf.data(), buf.size(), IpProto::tcp);
 			if (error != protocols::fs::Error::none) {
-				// TODO: Return an error to users.
 				std::cout << "netserver: Could not send TCP packet" << std::endl;
+				localFlushedSn_ = localSettledSn_;
+				co_await waitForRetry_();
+			}
+		}else if(connectState_ == ConnectState::sendSynAck) {
+			if(localSettledSn_ != localFlushedSn_ && !retransmitDue_) {
+				co_await flushEvent_.async_wait();
+				continue;
+			}
+
+			if(retransmitDue_) {
+				retransmitDue_ = false;
+				synRetries_++;
+			}
+
+			if(synRetries_ > maxSynAckRetries) {
+				if(debugTcp)
+					std::cout << "netserver: Dropping half-open TCP connection" << std::endl;
+				destroy_();
 				co_return;
 			}
+
+			if(!synRetries_) {
+				rttTiming_ = true;
+				rttSn_ = localSettledSn_ + 1;
+				rttStart_ = TimerWheel::now();
+			}
+			localFlushedSn_ = localSettledSn_ + 1;
+			localMaxSn_ = localFlushedSn_;
+			if(!rtoTimer_.armed())
+				timerWheel().arm(&rtoTimer_, TimerWheel::now() + rto_);
+
+			if(debugTcp)
+				std::cout << "netserver: Sending TCP SYN-ACK" << std::endl;
+			auto error = co_await sendControlSegment(localEp_.port, remoteEp_,
+					localSettledSn_, remoteKnownSn_,
+					TcpHeader::synFlag(true) | TcpHeader::ackFlag(true),
+					std::min(recvRing_.spaceForEnqueue(), size_t{0xFFFF}), synOptions_(), boundInterface_);
+			if (error != protocols::fs::Error::none) {
+				std::cout << "netserver: Could not send TCP SYN-ACK" << std::endl;
+				localFlushedSn_ = localSettledSn_;
+				co_await waitForRetry_();
+			}
 		}else{
-			auto targetInfo = co_await ip4().targetByRemote(remoteEp_.ipAddress);
+			auto targetInfo = co_await dst_.get(remoteEp_.ipAddress, boundInterface_);
 			if (!targetInfo) {
-				// TODO: Return an error to users.
 				std::cout << "netserver: Destination unreachable" << std::endl;
-				co_return;
+				co_await waitForRetry_();
+				continue;
 			}
 
-			assert(connectState_ == ConnectState::connected);
-			size_t flushPointer = localFlushedSn_ - localSettledSn_;
-			size_t windowPointer = localWindowSn_ - localSettledSn_;
+			assert(synchronized_());
+
+			// On timeouts, go back to the first unacknowledged byte.
+			// If nothing is outstanding, this sends a window probe instead.
+			bool probe = false;
+			if(retransmitDue_) {
+				retransmitDue_ = false;
+				localFlushedSn_ = localSettledSn_;
+				probe = true;
+			}
 
+			// Our FIN takes up one sequence number behind the data in sendRing_.
 			size_t bytesAvailable = sendRing_.availableToDequeue();
+			bool finQueued = finQueued_();
+			bool finFlushed = finQueued && localFlushedSn_ - localSettledSn_ > bytesAvailable;
+			size_t flushPointer = localFlushedSn_ - localSettledSn_ - finFlushed;
+			size_t windowPointer = localWindowSn_ - localSettledSn_;
 			assert(bytesAvailable >= flushPointer);
 
-			// Check whether we need to send a packet.
-			// TODO: Add retransmission here.
-			bool wantData = (bytesAvailable > flushPointer && windowPointer > flushPointer);
-			bool wantAck = (remoteAckedSn_ != remoteKnownSn_);
-			bool wantWindowUpdate = (announcedWindow_ < recvRing_.spaceForEnqueue());
-
-			if(!wantData && !wantAck && !wantWindowUpdate) {
-				co_await flushEvent_.async_wait();
-				continue;
+			// Data is limited by both the remote window and the congestion window.
+			size_t sendLimit = std::min(windowPointer, size_t{congestion_->cwnd});
+			if(probe)
+				sendLimit = std::max(sendLimit, size_t{1});
+
+			// Options count against the MSS (RFC 9293, section 3.7.1).
+			auto options = segmentOptions_();
+			size_t segmentChunk = sendMss_ - options.size();
+
+			// With TSO, we pass multiple segments worth of data to the NIC at once.
+			// NICs only segment TCP over IPv4.
+			auto &offloads = targetInfo->link->offloads();
+			size_t maxChunk = segmentChunk;
+			if(offloads.maxTsoSize && targetInfo->remote.isIp4()) {
+				size_t headerSize = targetInfo->ipHeaderSize() + sizeof(TcpHeader) + options.size();
+				maxChunk = std::max(segmentChunk,
+						(offloads.maxTsoSize - headerSize) / segmentChunk * segmentChunk);
+			}
+
+			// Determine the segment that we send (if any).
+			size_t offset = flushPointer;
+			size_t chunk = 0;
+			bool fin = false;
+			bool retransmit = false;
+			if(fastRetransmit_) {
+				fastRetransmit_ = false;
+				if(auto hole = nextHole_(); hole) {
+					offset = hole->begin - localSettledSn_;
+					chunk = std::min({size_t{hole->end - hole->begin}, bytesAvailable - offset, segmentChunk});
+					// The hole might extend to our FIN.
+					fin = finQueued && offset + chunk == bytesAvailable
+							&& seqAfter(hole->end, localSettledSn_ + bytesAvailable);
+					highRetransmitSn_ = hole->begin + chunk + fin;
+					retransmit = true;
+				}
+			}
+			if(!retransmit && bytesAvailable > flushPointer && sendLimit > flushPointer) {
+				chunk = std::min({
+					bytesAvailable - flushPointer,
+					sendLimit - flushPointer,
+					maxChunk
+				});
+
+				// Nagle's algorithm: do not send small segments while data is in flight.
+				// The last segment in front of our FIN is not held back.
+				if(chunk < segmentChunk && flushPointer && !nodelay_
+						&& !(finQueued && flushPointer + chunk == bytesAvailable))
+					chunk = 0;
+			}
+			// Send our FIN once all data is flushed, if possible on the last data segment.
+			if(!retransmit && finQueued && !finFlushed && flushPointer + chunk == bytesAvailable)
+				fin = true;
+
+			// Check whether we need to send a packet.
+			// The window that we announce is a multiple of the window scale.
+			size_t receiveSpace = std::min(recvRing_.spaceForEnqueue() >> receiveWindowShift_,
+					size_t{0xFFFF}) << receiveWindowShift_;
+			bool wantAck = ackNow_ || remoteKnownSn_ - remoteAckedSn_ >= 2 * mss;
+			// Avoid the silly window syndrome (RFC 1122, section 4.2.3.3).
+			bool wantWindowUpdate = announcedWindow_ < receiveSpace
+					&& (!announcedWindow_ || receiveSpace - announcedWindow_ >= mss);
+
+			// Keep the retransmission timer running while data is outstanding.
+			// While the remote window is closed, it triggers window probes.
+			bool windowClosed = bytesAvailable > flushPointer && windowPointer <= flushPointer;
+			if((localMaxSn_ != localSettledSn_ || windowClosed) && !rtoTimer_.armed())
+				timerWheel().arm(&rtoTimer_, TimerWheel::now() + rto_);
+
+			if(!chunk && !fin && !wantAck && !wantWindowUpdate) {
+				co_await flushEvent_.async_wait();
+				continue;
 			}
 
 			// Construct and transmit the TCP packet.
-			auto chunk = std::min({
-				bytesAvailable - flushPointer,
-				windowPointer - flushPointer,
-				size_t{1280} // TODO: Perform path MTU discovery.
-			});
+			uint32_t seqNumber = localSettledSn_ + offset;
 
 			std::vector<char> buf;
-			buf.resize(sizeof(TcpHeader) + chunk);
+			buf.resize(sizeof(TcpHeader) + options.size() + chunk);
 
 			auto header = new (buf.data()) TcpHeader {
 				.srcPort = localEp_.port,
 				.destPort = remoteEp_.port,
-				.seqNumber = localFlushedSn_,
+				.seqNumber = seqNumber,
 				.ackNumber = remoteKnownSn_,
 				.flags = {},
-				.window = std::min(recvRing_.spaceForEnqueue(), size_t{0xFFFF}),
+				.window = receiveSpace >> receiveWindowShift_,
 				.checksum = 0,
 				.urgentPointer = 0,
 			};
-			header->flags.store(TcpHeader::headerWords(sizeof(TcpHeader) / 4)
-					| TcpHeader::ackFlag(true));
-
-			sendRing_.dequeueLookahead(flushPointer, buf.data() + sizeof(TcpHeader), chunk);
+			header->flags.store(TcpHeader::headerWords((sizeof(TcpHeader) + options.size()) / 4)
+					| TcpHeader::ackFlag(true) | TcpHeader::finFlag(fin));
+			options.emit(buf.data() + sizeof(TcpHeader));
 
-			// Fill in the checksum.
-			PseudoHeader pseudo {
-				.src = targetInfo->source,
-				.dst = remoteEp_.ipAddress,
-				.len = buf.size()
-			};
 			Checksum csum;
-			csum.update(&pseudo, sizeof(PseudoHeader));
-			csum.update(buf.data(), buf.size());
-			header->checksum = csum.finalize();
+			sumPseudoHeader(csum, targetInfo->source, remoteEp_.ipAddress, IpProto::tcp, buf.size());
+
+			nic::TxOffload offload;
+			if(chunk > segmentChunk) {
+				offload.segmentSize = segmentChunk;
+				offload.headerSize = sizeof(TcpHeader) + options.size();
+			}
+			if(offloads.txChecksum) {
+				// The NIC only needs the sum of the pseudo header.
+				sendRing_.dequeueLookahead(offset, buf.data() + sizeof(TcpHeader) + options.size(), chunk);
+				header->checksum = csum.sum();
+				offload.needsChecksum = true;
+				offload.checksumOffset = offsetof(TcpHeader, checksum);
+			}else{
+				// Checksum the payload while copying it out of the ring.
+				csum.update(buf.data(), sizeof(TcpHeader) + options.size());
+				sendRing_.checksumLookahead(offset, buf.data() + sizeof(TcpHeader) + options.size(),
+						chunk, csum);
+				header->checksum = csum.finalize();
+			}
+
+			size_t length = chunk + fin;
+			if(length && offset == flushPointer) {
+				localFlushedSn_ = seqNumber + length;
+				if(seqAfter(localFlushedSn_, localMaxSn_)) {
+					// Time this segment unless it (partially) retransmits data.
+					if(!rttTiming_ && !seqBefore(seqNumber, localMaxSn_)) {
+						rttTiming_ = true;
+						rttSn_ = localFlushedSn_;
+						rttStart_ = TimerWheel::now();
+					}
+					localMaxSn_ = localFlushedSn_;
+				}
+			}
+			if(length && !rtoTimer_.armed())
+				timerWheel().arm(&rtoTimer_, TimerWheel::now() + rto_);
 
-			localFlushedSn_ += chunk;
 			remoteAckedSn_ = remoteKnownSn_;
-			announcedWindow_ = recvRing_.spaceForEnqueue();
+			announcedWindow_ = receiveSpace;
+			ackNow_ = false;
+			timerWheel().disarm(&delayedAckTimer_);
 
 			if(debugTcp)
-				std::cout << "netserver: Sending TCP data (" << chunk << " bytes)" << std::endl;
-			auto error = co_await ip4().sendFrame(std::move(*targetInfo),
-				buf.data(), buf.size(),
-				static_cast<uint16_t>(IpProto::tcp));
+				std::cout << "netserver: Sending TCP data (" << chunk << " bytes"
+						<< (fin ? ", FIN" : "") << ")" << std::endl;
+			auto error = co_await inet::sendFrame(std::move(*targetInfo),
+				buf.data(), buf.size(), IpProto::tcp, offload);
 			if (error != protocols::fs::Error::none) {
-				// TODO: Return an error to users.
 				std::cout << "netserver: Could not send TCP packet" << std::endl;
-				co_return;
+				// The segment did not leave, so it is flushed again.
+				if(length && !seqBefore(seqNumber, localSettledSn_)
+						&& seqBefore(seqNumber, localFlushedSn_)) {
+					localFlushedSn_ = seqNumber;
+					rttTiming_ = false;
+				}
+				ackNow_ = true;
+				co_await waitForRetry_();
 			}
 		}
 	}
 }
 
+async::result<void> Tcp4Socket::waitForRetry_() {
+	timerWheel().arm(&retryTimer_, TimerWheel::now() + TimerWheel::tickNs);
+	co_await flushEvent_.async_wait();
+}
+
+void Tcp4Socket::settleSyn_() {
+	++localSettledSn_;
+	localFlushedSn_ = localSettledSn_;
+	localMaxSn_ = localSettledSn_;
+	recoverSn_ = localSettledSn_;
+	timerWheel().disarm(&rtoTimer_);
+	congestion_ = makeTcpCongestionControl(congestion_->name(), sendMss_);
+
+	if(rttTiming_) {
+		rttTiming_ = false;
+		sampleRtt_(TimerWheel::now() - rttStart_);
+	}else{
+		rto_ = synRetransmitRto;
+	}
+}
+
+void Tcp4Socket::sampleRtt_(uint64_t rtt) {
+	if(!srtt_) {
+		srtt_ = rtt;
+		rttvar_ = rtt / 2;
+	}else{
+		uint64_t delta = srtt_ > rtt ? srtt_ - rtt : rtt - srtt_;
+		rttvar_ = (3 * rttvar_ + delta) / 4;
+		srtt_ = (7 * srtt_ + rtt) / 8;
+	}
+	// The clock granularity G is one tick of the timer wheel.
+	rto_ = std::clamp(srtt_ + std::max(TimerWheel::tickNs, 4 * rttvar_), minRto, maxRto);
+}
+
+void Tcp4Socket::onRtoExpired_() {
+	if(synchronized_() && localMaxSn_ != localSettledSn_) {
+		if(debugTcp)
+			std::cout << "netserver: TCP retransmission timeout" << std::endl;
+		// Lost segments are no longer in flight after the go-back-N rewind.
+		congestion_->onTimeout(localFlushedSn_ - localSettledSn_, TimerWheel::now());
+		inRecovery_ = false;
+		dupAcks_ = 0;
+		// Prevent fast retransmits triggered by duplicate ACKs for the retransmitted data.
+		recoverSn_ = localMaxSn_;
+		// The remote may have discarded SACKed data (RFC 2018, section 8).
+		sacked_.clear();
+	}
+
+	// Back off exponentially (RFC 6298, section 5.5).
+	rto_ = std::min(2 * rto_, maxRto);
+	rttTiming_ = false;
+	fastRetransmit_ = false;
+	retransmitDue_ = true;
+	flushEvent_.raise();
+}
+
+TcpOptions Tcp4Socket::synOptions_() {
+	TcpOptions options;
+	options.mss = mss;
+	if(connectState_ == ConnectState::sendSyn) {
+		options.windowScale = windowShift;
+		options.sackPermitted = true;
+		options.timestamp = TcpTimestamp{timestampClock(), 0};
+	}else{
+		// Only answer with the options that the remote offered.
+		if(receiveWindowShift_)
+			options.windowScale = receiveWindowShift_;
+		options.sackPermitted = sackEnabled_;
+		if(timestampsEnabled_)
+			options.timestamp = TcpTimestamp{timestampClock(), timestampRecent_};
+	}
+	return options;
+}
+
+void Tcp4Socket::negotiateOptions_(const TcpOptions &remote) {
+	sendMss_ = std::min(uint32_t{remote.mss.value_or(defaultMss)}, mss);
+	if(remote.windowScale) {
+		sendWindowShift_ = *remote.windowScale;
+		receiveWindowShift_ = windowShift;
+	}
+	sackEnabled_ = remote.sackPermitted;
+	if(remote.timestamp) {
+		timestampsEnabled_ = true;
+		timestampRecent_ = remote.timestamp->value;
+	}
+}
+
+TcpOptions Tcp4Socket::segmentOptions_() {
+	TcpOptions options;
+	if(timestampsEnabled_)
+		options.timestamp = TcpTimestamp{timestampClock(), timestampRecent_};
+
+	if(sackEnabled_ && !outOfOrder_.empty()) {
+		size_t maxBlocks = timestampsEnabled_ ? 3 : TcpOptions::maxSackBlocks;
+
+		// The first block contains the most recent segment (RFC 2018, section 4).
+		auto recent = std::ranges::find_if(outOfOrder_, [&] (const SnRange &range) {
+			return !seqBefore(recentOutOfOrderSn_, range.begin)
+					&& seqBefore(recentOutOfOrderSn_, range.end);
+		});
+		if(recent != outOfOrder_.end())
+			options.sackBlocks[options.numSackBlocks++] = *recent;
+		for(auto it = outOfOrder_.begin(); it != outOfOrder_.end(); it++) {
+			if(options.numSackBlocks == maxBlocks)
+				break;
+			if(it != recent)
+				options.sackBlocks[options.numSackBlocks++] = *it;
+		}
+	}
+	return options;
+}
+
+std::optional<SnRange> Tcp4Socket::nextHole_() {
+	if(localMaxSn_ == localSettledSn_)
+		return std::nullopt;
+
+	// Without SACK information, only the first segment is known to be lost.
+	if(!sackEnabled_ || sacked_.empty())
+		return SnRange{localSettledSn_, localMaxSn_};
+
+	// Holes below the highest SACKed range are considered lost (RFC 6675, section 4).
+	uint32_t sn = seqAfter(highRetransmitSn_, localSettledSn_) ? highRetransmitSn_ : localSettledSn_;
+	for(auto &range : sacked_) {
+		if(!seqAfter(range.end, sn))
+			continue;
+		if(seqAfter(range.begin, sn))
+			return SnRange{sn, range.begin};
+		sn = range.end;
+	}
+	return std::nullopt;
+}
+
+void Tcp4Socket::tuneReceiveBuffer_(size_t copied) {
+	auto now = TimerWheel::now();
+	receiveCopied_ += copied;
+	if(now - receiveTuneStart_ < (srtt_ ? srtt_ : initialRto))
+		return;
+
+	size_t wanted = 2 * receiveCopied_;
+	if(wanted > recvRing_.size() && recvRing_.size() < (size_t{1} << maxRingShift)) {
+		int shift = std::min(static_cast<int>(std::bit_width(wanted - 1)), maxRingShift);
+		if(debugTcp)
+			std::cout << "netserver: Growing TCP receive buffer to " << (size_t{1} << shift)
+					<< " bytes" << std::endl;
+		recvRing_.grow(shift);
+	}
+	receiveCopied_ = 0;
+	receiveTuneStart_ = now;
+}
+
+async::result<frg::expected<protocols::fs::Error, size_t>>
+Tcp4Socket::sendData_(const char *p, size_t size) {
+	size_t progress = 0;
+	while(progress < size) {
+		if(sendShutdown_()) {
+			if(progress)
+				break;
+			co_return protocols::fs::Error::brokenPipe;
+		}
+
+		size_t space = sendRing_.spaceForEnqueue();
+		if(!space && growSendBuffer_())
+			continue;
+		if(!space) {
+			if(nonBlock_) {
+				if(progress)
+					break;
+				co_return protocols::fs::Error::wouldBlock;
+			}
+			co_await settleEvent_.async_wait();
+			continue;
+		}
+		size_t chunk = std::min(space, size - progress);
+		sendRing_.enqueue(p + progress, chunk);
+		flushEvent_.raise();
+		progress += chunk;
+	}
+
+	publishReadiness_(0);
+	co_return progress;
+}
+
+bool Tcp4Socket::growSendBuffer_() {
+	size_t inFlight = std::min(size_t{congestion_->cwnd}, size_t{localWindowSn_ - localSettledSn_});
+	if(sendRing_.size() >= 2 * inFlight || sendRing_.size() >= (size_t{1} << maxRingShift))
+		return false;
+
+	int shift = std::min(static_cast<int>(std::bit_width(2 * inFlight - 1)), maxRingShift);
+	sendRing_.grow(shift);
+	return true;
+}
+
+void Tcp4Socket::handleAck_(const TcpPacket &packet) {
+	auto ackNumber = packet.header.ackNumber.load();
+	uint32_t window = packet.header.window.load() << sendWindowShift_;
+	auto now = TimerWheel::now();
+
+	// Old duplicates are ignored.
+	if(seqBefore(ackNumber, localSettledSn_))
+		return;
+
+	size_t validWindow = localMaxSn_ - localSettledSn_;
+	size_t ackPointer = ackNumber - localSettledSn_;
+	if(ackPointer > validWindow) {
+		std::cout << "netserver: Rejecting ack-number outside of valid window"
+				<< std::endl;
+		return;
+	}
+
+	// Update the scoreboard. Blocks outside of the outstanding data
+	// (such as D-SACK blocks) are ignored.
+	bool newSack = false;
+	if(sackEnabled_) {
+		for(size_t i = 0; i < packet.options.numSackBlocks; i++) {
+			auto block = packet.options.sackBlocks[i];
+			if(!seqBefore(block.begin, block.end) || !seqAfter(block.begin, ackNumber)
+					|| seqAfter(block.end, localMaxSn_))
+				continue;
+			if(insertSnRange(sacked_, block))
+				newSack = true;
+		}
+	}
+
+	if(!ackPointer) {
+		bool windowChanged = localWindowSn_ != localSettledSn_ + window;
+		localWindowSn_ = localSettledSn_ + window;
+		if(windowChanged)
+			flushEvent_.raise();
+
+		// Duplicate ACKs as defined by RFC 5681, section 2.
+		auto flags = packet.header.flags.load();
+		if(packet.payloadSize() || (flags & TcpHeader::synFlag) || (flags & TcpHeader::finFlag)
+				|| windowChanged || localMaxSn_ == localSettledSn_)
+			return;
+
+		if(inRecovery_) {
+			// Each duplicate ACK signals that a segment has left the network.
+			// With SACK, this allows us to fill the next hole instead of sending new data.
+			if(newSack && nextHole_())
+				fastRetransmit_ = true;
+			else
+				congestion_->cwnd += sendMss_;
+			flushEvent_.raise();
+		}else if(++dupAcks_ == 3 && seqAfter(ackNumber, recoverSn_)) {
+			if(debugTcp)
+				std::cout << "netserver: TCP fast retransmit" << std::endl;
+			congestion_->onCongestionEvent(localMaxSn_ - localSettledSn_, now);
+			congestion_->cwnd = congestion_->ssthresh + 3 * sendMss_;
+			inRecovery_ = true;
+			recoverSn_ = localMaxSn_;
+			highRetransmitSn_ = localSettledSn_;
+			// The timed segment might be retransmitted.
+			rttTiming_ = false;
+			fastRetransmit_ = true;
+			flushEvent_.raise();
+		}
+		return;
+	}
+
+	// With timestamps, every ACK yields an RTT sample, even for retransmitted data (RFC 7323, section 4).
+	if(timestampsEnabled_ && packet.options.timestamp && packet.options.timestamp->echo) {
+		rttTiming_ = false;
+		// Round up to the clock resolution.
+		uint64_t rtt = timestampClock() - packet.options.timestamp->echo;
+		sampleRtt_(std::max(rtt, uint64_t{1}) * 1'000'000);
+	}else if(rttTiming_ && !seqBefore(ackNumber, rttSn_)) {
+		rttTiming_ = false;
+		sampleRtt_(now - rttStart_);
+	}
+
+	localSettledSn_ += ackPointer;
+	localWindowSn_ = localSettledSn_ + window;
+	// The ACK covers our FIN if it extends beyond the data.
+	bool finAcked = ackPointer > sendRing_.availableToDequeue();
+	sendRing_.dequeueAdvance(ackPointer - finAcked);
+	trimSnRanges(sacked_, localSettledSn_);
+	// After a go-back-N rewind, the ACK can cover data that we did not flush again.
+	if(seqBefore(localFlushedSn_, localSettledSn_))
+		localFlushedSn_ = localSettledSn_;
+
+	if(inRecovery_) {
+		if(!seqBefore(ackNumber, recoverSn_)) {
+			// Full acknowledgement: deflate the window.
+			congestion_->cwnd = congestion_->ssthresh;
+			inRecovery_ = false;
+			dupAcks_ = 0;
+		}else{
+			// Partial acknowledgement: the next segment was lost as well.
+			congestion_->cwnd -= std::min(congestion_->cwnd, static_cast<uint32_t>(ackPointer));
+			if(ackPointer >= sendMss_)
+				congestion_->cwnd += sendMss_;
+			congestion_->cwnd = std::max(congestion_->cwnd, sendMss_);
+			fastRetransmit_ = true;
+		}
+	}else{
+		congestion_->onAck(ackPointer, now, srtt_);
+		dupAcks_ = 0;
+	}
+
+	// Restart the retransmission timer (RFC 6298, section 5.3).
+	if(localMaxSn_ == localSettledSn_)
+		timerWheel().disarm(&rtoTimer_);
+	else
+		timerWheel().arm(&rtoTimer_, now + rto_);
+
+	outSeq_ = ++currentSeq_;
+	flushEvent_.raise();
+	settleEvent_.raise();
+	pollEvent_.raise();
+	publishReadiness_(EPOLLOUT);
+
+	if(finAcked)
+		finAcked_();
+}
+
+void Tcp4Socket::handleData_(const TcpPacket &packet) {
+	auto flags = packet.header.flags.load();
+	auto payloadSize = packet.payloadSize();
+	auto seqNumber = packet.header.seqNumber.load();
+
+	bool hasContent = payloadSize || (flags & TcpHeader::synFlag) || (flags & TcpHeader::finFlag);
+
+	// Trim data that we already received, e.g., if the remote retransmits
+	// with different segment boundaries.
+	size_t overlap = 0;
+	if(seqBefore(seqNumber, remoteKnownSn_)) {
+		overlap = std::min(size_t{remoteKnownSn_ - seqNumber}, payloadSize);
+		payloadSize -= overlap;
+		seqNumber += overlap;
+	}
+
+	// Out-of-order and duplicate segments are acknowledged immediately,
+	// which lets the remote detect losses via duplicate ACKs.
+	if(hasContent && (overlap || seqNumber != remoteKnownSn_)) {
+		ackNow_ = true;
+		flushEvent_.raise();
+	}
+
+	if(seqNumber != remoteKnownSn_) {
+		// Queue data that fits into the receive buffer. A FIN is only
+		// processed once it arrives in order.
+		if(!seqAfter(seqNumber, remoteKnownSn_) || !payloadSize)
+			return;
+		size_t offset = seqNumber - remoteKnownSn_;
+		size_t space = recvRing_.spaceForEnqueue();
+		if(offset >= space)
+			return;
+		size_t chunk = std::min(payloadSize, space - offset);
+		if(!insertSnRange(outOfOrder_, {seqNumber, static_cast<uint32_t>(seqNumber + chunk)}))
+			return;
+		packet.forEachPayloadChunk(overlap, chunk, [&] (const char *data, size_t size) {
+			recvRing_.enqueueAhead(offset, data, size);
+			offset += size;
+		});
+		recentOutOfOrderSn_ = seqNumber;
+		return;
+	}
+
+	int edges = 0;
+
+	size_t accepted = std::min(payloadSize, recvRing_.spaceForEnqueue());
+	size_t chunk = accepted;
+	if(chunk) {
+		packet.forEachPayloadChunk(overlap, chunk, [&] (const char *data, size_t size) {
+			recvRing_.enqueue(data, size);
+		});
+		remoteKnownSn_ += chunk;
+
+		// The segment might fill a hole in front of queued out-of-order data.
+		if(!outOfOrder_.empty()) {
+			ackNow_ = true;
+			trimSnRanges(outOfOrder_, remoteKnownSn_);
+			if(!outOfOrder_.empty() && outOfOrder_.front().begin == remoteKnownSn_) {
+				size_t contiguous = outOfOrder_.front().end - remoteKnownSn_;
+				recvRing_.enqueueAdvance(contiguous);
+				remoteKnownSn_ += contiguous;
+				chunk += contiguous;
+				outOfOrder_.erase(outOfOrder_.begin());
+			}
+		}
+
+		if(announcedWindow_ < chunk) {
+			announcedWindow_ = 0;
+		}else{
+			announcedWindow_ -= chunk;
+		}
+
+		inSeq_ = ++currentSeq_;
+		edges |= EPOLLIN;
+	}
+
+	if((flags & TcpHeader::finFlag) && accepted == payloadSize) {
+		++remoteKnownSn_; // FIN counts as one byte.
+		remoteClosed_ = true;
+		ackNow_ = true;
+
+		if(connectState_ == ConnectState::connected)
+			connectState_ = ConnectState::closeWait;
+		else if(connectState_ == ConnectState::finWait1)
+			connectState_ = ConnectState::closing;
+		else if(connectState_ == ConnectState::finWait2)
+			enterTimeWait_();
+
+		// Readers see EOF.
+		inSeq_ = hupSeq_ = ++currentSeq_;
+		edges |= EPOLLIN | EPOLLHUP;
+	}
+
+	// Segments that do not fit into the window (e.g., window probes)
+	// are answered immediately such that the remote learns our window.
+	if(accepted < payloadSize)
+		ackNow_ = true;
+	else if(chunk && !delayedAckTimer_.armed())
+		timerWheel().arm(&delayedAckTimer_, TimerWheel::now() + delayedAckTimeout);
+
+	if(edges) {
+		inEvent_.raise();
+		pollEvent_.raise();
+		publishReadiness_(edges);
+	}
+	flushEvent_.raise();
+}
+
 void Tcp4Socket::handleInPacket_(TcpPacket packet) {
 	if(boundInterface_ && boundInterface_->index() != packet.packet->link.lock()->index())
 		return;
 
+	if(packet.header.flags.load() & TcpHeader::rstFlag) {
+		handleReset_(packet);
+		return;
+	}
+
+	if(connectState_ == ConnectState::sendSynAck) {
+		if(packet.header.flags.load() & TcpHeader::synFlag) {
+			// Our SYN-ACK is retransmitted by flushOutPackets_().
+			return;
+		}
+
+		if(!(packet.header.flags.load() & TcpHeader::ackFlag)
+				|| packet.header.ackNumber.load() != localSettledSn_ + 1) {
+			std::cout << "netserver: Rejecting packet with bad ack-number [sendSynAck]"
+					<< std::endl;
+			return;
+		}
+
+		// Like Linux, ignore the ACK if the accept queue is full; the remote will
+		// retry once it receives another SYN-ACK.
+		if(listener_->acceptQueueFull_())
+			return;
+
+		settleSyn_();
+		localWindowSn_ = localSettledSn_ + (packet.header.window.load() << sendWindowShift_);
+		connectState_ = ConnectState::connected;
+		listener_->synQueueLength_--;
+		listener_->enqueueAccepted_(holder_.lock());
+		flushEvent_.raise();
+		settleEvent_.raise();
+		// The ACK may already carry data, which is handled below.
+	}
+
 	if(connectState_ == ConnectState::sendSyn) {
 		if(localSettledSn_ == localFlushedSn_) {
 			std::cout << "netserver: Rejecting packet before SYN is sent [sendSyn]"
@@ -780,93 +2244,422 @@ void Tcp4Socket::handleInPacket_(TcpPacket packet) {
 			return;
 		}
 
-		++localSettledSn_;
+		negotiateOptions_(packet.options);
+		settleSyn_();
+		// The window of SYN segments is never scaled.
 		localWindowSn_ = localSettledSn_ + packet.header.window.load();
 		remoteAckedSn_ = packet.header.seqNumber.load();
 		remoteKnownSn_ = packet.header.seqNumber.load() + 1; // SYN counts as one byte.
+		ackNow_ = true;
 		connectState_ = ConnectState::connected;
 		flushEvent_.raise();
 		settleEvent_.raise();
-	}else if(connectState_ == ConnectState::connected) {
-		if(packet.header.seqNumber.load() == remoteKnownSn_) {
-			bool gotUpdate = false;
-
-			auto payload = packet.payload();
-			size_t chunk = std::min(payload.size(), recvRing_.spaceForEnqueue());
-			if(chunk) {
-				recvRing_.enqueue(payload.data(), chunk);
-				remoteKnownSn_ += chunk;
-				if(announcedWindow_ < chunk) {
-					announcedWindow_ = 0;
-				}else{
-					announcedWindow_ -= chunk;
-				}
+	}else if(synchronized_()) {
+		if(timestampsEnabled_ && packet.options.timestamp) {
+			auto timestamp = *packet.options.timestamp;
 
-				inSeq_ = ++currentSeq_;
-				gotUpdate = true;
+			// PAWS: reject old duplicates (RFC 7323, section 5.3).
+			if(seqBefore(timestamp.value, timestampRecent_)) {
+				ackNow_ = true;
+				flushEvent_.raise();
+				return;
 			}
 
-			if(packet.header.flags.load() & TcpHeader::finFlag) {
-				++remoteKnownSn_; // FIN counts as one byte.
-				remoteClosed_ = true;
+			// Only remember timestamps of segments that we acknowledge next (RFC 7323, section 4.3).
+			if(!seqAfter(packet.header.seqNumber.load(), remoteAckedSn_))
+				timestampRecent_ = timestamp.value;
+		}
+
+		handleData_(packet);
 
-				hupSeq_ = ++currentSeq_;
-				gotUpdate = true;
-			}
+		if(packet.header.flags.load() & TcpHeader::ackFlag)
+			handleAck_(packet);
+	}
+}
 
-			if(gotUpdate) {
-				inEvent_.raise();
-				flushEvent_.raise();
-				pollEvent_.raise();
-			}
+void Tcp4Socket::handleReset_(const TcpPacket &packet) {
+	auto seqNumber = packet.header.seqNumber.load();
+
+	if(connectState_ == ConnectState::sendSyn) {
+		// The RST must acknowledge our SYN.
+		if(!(packet.header.flags.load() & TcpHeader::ackFlag)
+				|| packet.header.ackNumber.load() != localSettledSn_ + 1)
+			return;
+		if(debugTcp)
+			std::cout << "netserver: TCP connection refused" << std::endl;
+		connectError_ = protocols::fs::Error::connectionRefused;
+		destroy_();
+	}else if(connectState_ == ConnectState::timeWait) {
+		// Do not cut TIME-WAIT short (RFC 1337).
+		return;
+	}else if(connectState_ == ConnectState::sendSynAck || synchronized_()) {
+		// Only a RST at the expected sequence number resets the connection.
+		// Other RSTs in the window are answered with a challenge ACK.
+		if(seqNumber == remoteKnownSn_) {
+			if(debugTcp)
+				std::cout << "netserver: TCP connection reset by peer" << std::endl;
+			destroy_();
+		}else if(synchronized_() && !seqBefore(seqNumber, remoteKnownSn_)
+				&& seqBefore(seqNumber, remoteKnownSn_ + announcedWindow_)) {
+			ackNow_ = true;
+			flushEvent_.raise();
 		}
+	}
+}
 
-		if(packet.header.flags.load() & TcpHeader::ackFlag) {
-			size_t validWindow = localFlushedSn_ - localSettledSn_;
-			size_t ackPointer = packet.header.ackNumber.load() - localSettledSn_;
-			if(ackPointer <= validWindow) {
-				localSettledSn_ += ackPointer;
-				localWindowSn_ = localSettledSn_ + packet.header.window.load();
-				sendRing_.dequeueAdvance(ackPointer);
-				outSeq_ = ++currentSeq_;
-				settleEvent_.raise();
-				pollEvent_.raise();
-			}else{
-				std::cout << "netserver: Rejecting ack-number outside of valid window"
-						<< std::endl;
-			}
+void Tcp4Socket::close_() {
+	userClosed_ = true;
+	readinessSlot_.release();
+
+	if(listening_) {
+		// Connections that were not accepted yet are reset, like on Linux.
+		auto queued = std::move(acceptQueue_);
+		for(auto &child : queued)
+			child->reset_();
+
+		std::vector<smarter::shared_ptr<Tcp4Socket>> halfOpen;
+		for(auto &[tuple, socket] : parent_->connections) {
+			if(socket->listener_.get() == this)
+				halfOpen.push_back(socket);
+		}
+		for(auto &child : halfOpen)
+			child->reset_();
+
+		destroy_();
+		return;
+	}
+
+	if(!synchronized_()) {
+		destroy_();
+		return;
+	}
+
+	if(connectState_ == ConnectState::connected || connectState_ == ConnectState::closeWait) {
+		// Reset the connection if unread data would be lost (RFC 2525, section 2.17).
+		if(recvRing_.availableToDequeue()) {
+			reset_();
+			return;
+		}
+		shutdownSend_();
+	}
+
+	// Nobody waits for orphaned connections, so they do not linger forever.
+	if(connectState_ != ConnectState::timeWait)
+		timerWheel().arm(&closeTimer_, TimerWheel::now() + finTimeout);
+}
+
+void Tcp4Socket::shutdownSend_() {
+	if(connectState_ == ConnectState::connected) {
+		connectState_ = ConnectState::finWait1;
+	}else if(connectState_ == ConnectState::closeWait) {
+		connectState_ = ConnectState::lastAck;
+	}else{
+		return;
+	}
+
+	// Wake up writers, they fail from now on.
+	settleEvent_.raise();
+	flushEvent_.raise();
+}
+
+void Tcp4Socket::reset_() {
+	if(connectState_ == ConnectState::sendSynAck || synchronized_())
+		async::detach(sendControlSegment(localEp_.port, remoteEp_,
+				localMaxSn_, remoteKnownSn_,
+				TcpHeader::rstFlag(true) | TcpHeader::ackFlag(true),
+				0, {}, boundInterface_));
+	destroy_();
+}
+
+void Tcp4Socket::finAcked_() {
+	if(connectState_ == ConnectState::finWait1) {
+		connectState_ = ConnectState::finWait2;
+	}else if(connectState_ == ConnectState::closing) {
+		enterTimeWait_();
+	}else{
+		assert(connectState_ == ConnectState::lastAck);
+		destroy_();
+	}
+}
+
+void Tcp4Socket::enterTimeWait_() {
+	connectState_ = ConnectState::timeWait;
+	timerWheel().disarm(&rtoTimer_);
+	timerWheel().arm(&closeTimer_, TimerWheel::now() + timeWaitTimeout);
+}
+
+void Tcp4Socket::destroy_() {
+	if(connectState_ == ConnectState::closed)
+		return;
+
+	if(debugTcp)
+		std::cout << "netserver: Destroying TCP socket" << std::endl;
+
+	bool registered = connectState_ != ConnectState::none;
+	if(connectState_ == ConnectState::sendSynAck)
+		listener_->synQueueLength_--;
+	listener_ = smarter::shared_ptr<Tcp4Socket>{};
+	connectState_ = ConnectState::closed;
+	listening_ = false;
+
+	timerWheel().disarm(&rtoTimer_);
+	timerWheel().disarm(&delayedAckTimer_);
+	timerWheel().disarm(&closeTimer_);
+	timerWheel().disarm(&retryTimer_);
+	if(registered)
+		parent_->unregisterConnection_(TcpFourTuple{localEp_, remoteEp_});
+	parent_->unbind(localEp_, this);
+
+	hupSeq_ = ++currentSeq_;
+	inEvent_.raise();
+	settleEvent_.raise();
+	acceptEvent_.raise();
+	pollEvent_.raise();
+	publishReadiness_(EPOLLHUP);
+	// Lets flushOutPackets_() return.
+	flushEvent_.raise();
+}
+
+void Tcp4Socket::handleListenPacket_(TcpPacket packet, const TcpFourTuple &tuple) {
+	if(boundInterface_ && boundInterface_->index() != packet.packet->link.lock()->index())
+		return;
+
+	auto flags = packet.header.flags.load();
+	if(flags & TcpHeader::rstFlag)
+		return;
+	if((flags & TcpHeader::synFlag) && !(flags & TcpHeader::ackFlag)) {
+		auto remoteIsn = packet.header.seqNumber.load();
+
+		// Like Linux, drop SYNs while the accept queue is full.
+		if(acceptQueueFull_())
+			return;
+
+		// If the SYN queue overflows, answer with a SYN cookie instead of
+		// allocating a socket. The state is reconstructed from the final ACK.
+		if(synQueueLength_ >= backlog_) {
+			if(debugTcp)
+				std::cout << "netserver: SYN queue overflow, sending SYN cookie" << std::endl;
+			// Encode the largest MSS from the table that does not exceed the remote MSS.
+			auto remoteMss = packet.options.mss.value_or(defaultMss);
+			uint32_t mssIndex = 0;
+			while(mssIndex + 1 < std::size(cookieMssTable) && cookieMssTable[mssIndex + 1] <= remoteMss)
+				mssIndex++;
+
+			TcpOptions options;
+			options.mss = mss;
+			async::detach(sendControlSegment(tuple.local.port, tuple.remote,
+					makeSynCookie(tuple, remoteIsn, synCookieTime(), mssIndex), remoteIsn + 1,
+					TcpHeader::synFlag(true) | TcpHeader::ackFlag(true),
+					0xFFFF, options, boundInterface_));
+			return;
+		}
+
+		auto child = makeSocket(parent_, family_, false);
+		child->localEp_ = tuple.local;
+		child->remoteEp_ = tuple.remote;
+		child->boundInterface_ = boundInterface_;
+		child->listener_ = holder_.lock();
+
+		auto randomSn = globalPrng();
+		child->localSettledSn_ = randomSn;
+		child->localFlushedSn_ = randomSn;
+		child->localMaxSn_ = randomSn;
+		child->recoverSn_ = randomSn;
+		// SYN counts as one byte. It is acknowledged by the SYN-ACK.
+		child->remoteAckedSn_ = remoteIsn + 1;
+		child->remoteKnownSn_ = remoteIsn + 1;
+		child->negotiateOptions_(packet.options);
+		child->connectState_ = ConnectState::sendSynAck;
+
+		synQueueLength_++;
+		parent_->connections.emplace(tuple, child);
+		child->flushEvent_.raise();
+	}else if((flags & TcpHeader::ackFlag) && !(flags & TcpHeader::synFlag)) {
+		// This might complete a handshake that we answered with a SYN cookie.
+		auto seqNumber = packet.header.seqNumber.load();
+		auto cookie = packet.header.ackNumber.load() - 1;
+		auto cookieMss = checkSynCookie(tuple, seqNumber - 1, cookie);
+		if(!cookieMss) {
+			sendReset(packet, tuple);
+			return;
 		}
+		if(acceptQueueFull_())
+			return;
+
+		if(debugTcp)
+			std::cout << "netserver: Accepted TCP connection via SYN cookie" << std::endl;
+		auto child = makeSocket(parent_, family_, false);
+		child->localEp_ = tuple.local;
+		child->remoteEp_ = tuple.remote;
+		child->boundInterface_ = boundInterface_;
+		child->localSettledSn_ = cookie + 1;
+		child->localFlushedSn_ = cookie + 1;
+		child->localMaxSn_ = cookie + 1;
+		child->recoverSn_ = cookie + 1;
+		child->localWindowSn_ = cookie + 1 + packet.header.window.load();
+		child->sendMss_ = std::min(*cookieMss, mss);
+		child->congestion_ = makeTcpCongestionControl(child->congestion_->name(), child->sendMss_);
+		child->remoteAckedSn_ = seqNumber;
+		child->remoteKnownSn_ = seqNumber;
+		child->connectState_ = ConnectState::connected;
+
+		parent_->connections.emplace(tuple, child);
+		enqueueAccepted_(child);
+		// The ACK may already carry data.
+		child->handleInPacket_(std::move(packet));
+	}
+}
+
+Tcp4 &tcp() {
+	static Tcp4 inst;
+	return inst;
+}
+
+void Tcp4::feedDatagram(smarter::shared_ptr<const InetPacket> packet) {
+	if (lossPerMille_ && std::uniform_int_distribution<unsigned int>{0, 999}(globalPrng) < lossPerMille_)
+		return;
+
+	if (delay_) {
+		delayed_.push_back({TimerWheel::now() + delay_, std::move(packet)});
+		if (!delayTimer_.armed())
+			timerWheel().arm(&delayTimer_, delayed_.front().first);
+		return;
 	}
+
+	deliver_(std::move(packet));
 }
 
-void Tcp4::feedDatagram(smarter::shared_ptr<const Ip4Packet> packet) {
+void Tcp4::deliverDelayed_() {
+	auto now = TimerWheel::now();
+	while (!delayed_.empty() && delayed_.front().first <= now) {
+		auto packet = std::move(delayed_.front().second);
+		delayed_.pop_front();
+		deliver_(std::move(packet));
+	}
+	flushCoalesced();
+
+	if (!delayed_.empty())
+		timerWheel().arm(&delayTimer_, delayed_.front().first);
+}
+
+void Tcp4::flushCoalesced() {
+	if (!coalescing_)
+		return;
+	auto tcp = std::move(*coalescing_);
+	coalescing_ = nullptr;
+	dispatch_(std::move(tcp));
+}
+
+void Tcp4::deliver_(smarter::shared_ptr<const InetPacket> packet) {
 	TcpPacket tcp;
 	if (!tcp.parse(std::move(packet))) {
 		std::cout << "netserver: Received broken TCP packet" << std::endl;
 		return;
 	}
 
+	// Merge in-order segments of the same connection such that a burst is handled
+	// (and acknowledged) at once. A segment with PSH completes the merged segment.
+	if (coalescing_) {
+		if (coalescing_->tryCoalesce(tcp)) {
+			if (coalescing_->header.flags.load() & TcpHeader::pshFlag)
+				flushCoalesced();
+			return;
+		}
+		flushCoalesced();
+	}
+
+	if (tcp.canCoalesce()) {
+		coalescing_ = std::make_unique<TcpPacket>(std::move(tcp));
+		return;
+	}
+	dispatch_(std::move(tcp));
+}
+
+void Tcp4::dispatch_(TcpPacket tcp) {
 	if(debugTcp)
 		std::cout << "netserver: Received TCP packet at port " << tcp.header.destPort.load()
-				<< " (" << tcp.payload().size() << " bytes)" << std::endl;
+				<< " (" << tcp.payloadSize() << " bytes)" << std::endl;
 
-	auto it = binds.lower_bound({ 0, tcp.header.destPort.load() });
-	for (; it != binds.end() && it->first.port == tcp.header.destPort.load(); it++) {
-		auto existingEp = it->first;
-		if (existingEp.ipAddress == tcp.packet->header.destination
-				|| existingEp.ipAddress == INADDR_ANY) {
-			it->second->handleInPacket_(std::move(tcp));
-			break;
+	TcpFourTuple tuple{
+		.local = {tcp.packet->destination, tcp.header.destPort.load()},
+		.remote = {tcp.packet->source, tcp.header.srcPort.load()},
+	};
+
+	// Segments of the same connection usually arrive back to back (see nic::runDevice()).
+	// Handling a segment can destroy the connection, hence we hold a reference.
+	if (lastConnection_ && lastTuple_ == tuple) {
+		auto socket = lastConnection_->holder_.lock();
+		socket->handleInPacket_(std::move(tcp));
+		return;
+	}
+
+	if (auto it = connections.find(tuple); it != connections.end()) {
+		auto socket = it->second;
+		lastTuple_ = tuple;
+		lastConnection_ = socket.get();
+		socket->handleInPacket_(std::move(tcp));
+		return;
+	}
+
+	if (auto listener = findListener_(tuple); listener) {
+		listener->handleListenPacket_(std::move(tcp), tuple);
+		return;
+	}
+
+	sendReset(tcp, tuple);
+}
+
+void Tcp4::unregisterConnection_(const TcpFourTuple &tuple) {
+	if (lastConnection_ && lastTuple_ == tuple)
+		lastConnection_ = nullptr;
+	connections.erase(tuple);
+}
+
+Tcp4Socket *Tcp4::findListener_(const TcpFourTuple &tuple) {
+	// Listeners bound to the exact address take precedence over wildcard ones.
+	// Within a SO_REUSEPORT group, connections are distributed by their hash.
+	auto matches = [&] (const InetAddress &ipAddress) {
+		size_t n = 0;
+		auto it = binds.lower_bound({ ipAddress, tuple.local.port });
+		for (; it != binds.end() && it->first == TcpEndpoint{ ipAddress, tuple.local.port }; it++) {
+			if (it->second->listening_)
+				n++;
 		}
+		return n;
+	};
+
+	auto ipAddress = tuple.local.ipAddress;
+	size_t n = matches(ipAddress);
+	if (!n) {
+		ipAddress = InetAddress::any(ipAddress.family());
+		n = matches(ipAddress);
+	}
+	if (!n)
+		return nullptr;
+
+	size_t k = TcpFourTupleHash{}(tuple) % n;
+	auto it = binds.lower_bound({ ipAddress, tuple.local.port });
+	for (;; it++) {
+		if (!it->second->listening_)
+			continue;
+		if (!k--)
+			return it->second.get();
 	}
 }
 
 bool Tcp4::tryBind(smarter::shared_ptr<Tcp4Socket> socket, TcpEndpoint wantedEp) {
-	auto it = binds.lower_bound(wantedEp);
+	auto it = binds.lower_bound({ InetAddress{}, wantedEp.port });
 	for (; it != binds.end() && it->first.port == wantedEp.port; it++) {
 		auto existingEp = it->first;
-		if (existingEp.ipAddress == INADDR_ANY || wantedEp.ipAddress == INADDR_ANY
+		// IPv6 sockets behave as if IPV6_V6ONLY was set, i.e., families do not conflict.
+		if (existingEp.ipAddress.family() != wantedEp.ipAddress.family())
+			continue;
+		if (existingEp.ipAddress.isAny() || wantedEp.ipAddress.isAny()
 				|| existingEp.ipAddress == wantedEp.ipAddress) {
+			// SO_REUSEPORT allows sharing the exact same endpoint.
+			if (socket->reusePort_ && it->second->reusePort_
+					&& existingEp.ipAddress == wantedEp.ipAddress)
+				continue;
 			return false;
 		}
 	}
@@ -875,13 +2668,46 @@ bool Tcp4::tryBind(smarter::shared_ptr<Tcp4Socket> socket, TcpEndpoint wantedEp)
 	return true;
 }
 
-bool Tcp4::unbind(TcpEndpoint e) {
-	return binds.erase(e) != 0;
+bool Tcp4::unbind(TcpEndpoint e, Tcp4Socket *socket) {
+	auto [begin, end] = binds.equal_range(e);
+	for (auto it = begin; it != end; it++) {
+		if (it->second.get() == socket) {
+			binds.erase(it);
+			return true;
+		}
+	}
+	return false;
+}
+
+void Tcp4::registerConnection_(smarter::shared_ptr<Tcp4Socket> socket, const InetAddress &localAddress) {
+	// Sockets bound to the wildcard address obtain a concrete address here.
+	// They keep their bind to reserve the port.
+	if (socket->localEp_.ipAddress != localAddress) {
+		unbind(socket->localEp_, socket.get());
+		socket->localEp_.ipAddress = localAddress;
+		binds.emplace(socket->localEp_, socket);
+	}
+
+	TcpFourTuple tuple{socket->localEp_, socket->remoteEp_};
+	connections.emplace(tuple, std::move(socket));
+}
+
+void Tcp4::setLossRate(unsigned int perMille) {
+	if (perMille)
+		std::cout << "netserver: Dropping " << perMille << "/1000 of incoming TCP segments" << std::endl;
+	lossPerMille_ = std::min(perMille, 1000u);
+}
+
+void Tcp4::setDelay(unsigned int ms) {
+	if (ms)
+		std::cout << "netserver: Delaying incoming TCP segments by " << ms << "ms" << std::endl;
+	delay_ = uint64_t{ms} * 1'000'000;
 }
 
-void Tcp4::serveSocket(int flags, helix::UniqueLane lane) {
+void Tcp4::serveSocket(int family, int flags, helix::UniqueLane lane) {
 	using protocols::fs::servePassthrough;
-	auto sock = Tcp4Socket::makeSocket(this, flags & SOCK_NONBLOCK);
-	async::detach(servePassthrough(std::move(lane), std::move(sock),
-			&Tcp4Socket::ops));
+	auto sock = Tcp4Socket::makeSocket(this, family, flags & SOCK_NONBLOCK);
+	async::detach(servePassthrough(std::move(lane), sock,
+			&Tcp4Socket::ops),
+		[sock] { sock->close_(); });
 }
@@ -2,27 +2,85 @@
 
 #include <helix/ipc.hpp>
 #include <smarter.hpp>
+#include <deque>
 #include <map>
+#include <memory>
+#include <unordered_map>
 
-class Ip4Packet;
+#include "inet.hpp"
+#include "timer-wheel.hpp"
 
 struct TcpEndpoint {
 	friend bool operator<(const TcpEndpoint &l, const TcpEndpoint &r) {
 		return std::tie(l.port, l.ipAddress) < std::tie(r.port, r.ipAddress);
 	}
 
-	uint32_t ipAddress = 0;
+	friend bool operator==(const TcpEndpoint &l, const TcpEndpoint &r) = default;
+
+	InetAddress ipAddress;
 	uint16_t port = 0;
 };
 
+// Identifies a connection. Unlike binds, both endpoints are fully specified.
+struct TcpFourTuple {
+	friend bool operator==(const TcpFourTuple &l, const TcpFourTuple &r) = default;
+
+	TcpEndpoint local;
+	TcpEndpoint remote;
+};
+
+struct TcpFourTupleHash {
+	size_t operator()(const TcpFourTuple &tuple) const;
+};
+
 struct Tcp4Socket;
+struct TcpPacket;
 
 struct Tcp4 {
-	void feedDatagram(smarter::shared_ptr<const Ip4Packet>);
+	void feedDatagram(smarter::shared_ptr<const InetPacket>);
 	bool tryBind(smarter::shared_ptr<Tcp4Socket> socket, TcpEndpoint ipAddress);
-	bool unbind(TcpEndpoint remote);
-	void serveSocket(int flags, helix::UniqueLane lane);
+	bool unbind(TcpEndpoint local, Tcp4Socket *socket);
+	// Serves an AF_INET or AF_INET6 socket.
+	void serveSocket(int family, int flags, helix::UniqueLane lane);
+
+	// Drops or delays incoming segments, similar to netem.
+	// Only intended for testing loss recovery and links with a high bandwidth-delay product.
+	void setLossRate(unsigned int perMille);
+	void setDelay(unsigned int ms);
+
+	// Hands the segment that in-order segments are being merged into (if any) to its
+	// connection. Called once nic::runDevice() has fed a batch of frames to the stack.
+	void flushCoalesced();
 
 private:
-	std::map<TcpEndpoint, smarter::shared_ptr<Tcp4Socket>> binds;
+	friend struct Tcp4Socket;
+
+	void deliver_(smarter::shared_ptr<const InetPacket> packet);
+	void dispatch_(TcpPacket tcp);
+	void deliverDelayed_();
+
+	// Picks the listener for a packet that does not belong to a connection.
+	Tcp4Socket *findListener_(const TcpFourTuple &tuple);
+	// Makes packets of an actively opened connection reach the socket.
+	void registerConnection_(smarter::shared_ptr<Tcp4Socket> socket, const InetAddress &localAddress);
+	void unregisterConnection_(const TcpFourTuple &tuple);
+
+	// Bound sockets, including listeners. With SO_REUSEPORT, multiple
+	// listeners may share the same endpoint.
+	std::multimap<TcpEndpoint, smarter::shared_ptr<Tcp4Socket>> binds;
+	// Connections in any state past the initial SYN, keyed by the full 4-tuple.
+	std::unordered_map<TcpFourTuple, smarter::shared_ptr<Tcp4Socket>, TcpFourTupleHash> connections;
+	// Connection that received the last segment; avoids hashing for each segment of a burst.
+	TcpFourTuple lastTuple_;
+	Tcp4Socket *lastConnection_ = nullptr;
+	// Segment that subsequent in-order segments of its connection are merged into.
+	std::unique_ptr<TcpPacket> coalescing_;
+
+	unsigned int lossPerMille_ = 0;
+	uint64_t delay_ = 0;
+	// Delayed packets and their delivery time.
+	std::deque<std::pair<uint64_t, smarter::shared_ptr<const InetPacket>>> delayed_;
+	TimerWheel::Timer delayTimer_{[this] { deliverDelayed_(); }};
 };
+
+Tcp4 &tcp();
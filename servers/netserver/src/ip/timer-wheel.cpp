@@ -0,0 +1,85 @@
+#include <algorithm>
+
+#include <hel.h>
+#include <hel-syscalls.h>
+#include <helix/timer.hpp>
+
+#include "timer-wheel.hpp"
+
+TimerWheel &timerWheel() {
+	static TimerWheel inst;
+	return inst;
+}
+
+uint64_t TimerWheel::now() {
+	uint64_t ns;
+	HEL_CHECK(helGetClock(&ns));
+	return ns;
+}
+
+void TimerWheel::arm(Timer *timer, uint64_t deadline) {
+	if(timer->armed_)
+		disarm(timer);
+
+	// While no timer is armed, the wheel does not advance.
+	if(!numArmed_)
+		currentTick_ = now() / tickNs;
+
+	// Round up such that the timer does not fire early.
+	timer->tick_ = std::max((deadline + tickNs - 1) / tickNs, currentTick_ + 1);
+	timer->armed_ = true;
+	slots_[timer->tick_ % numSlots].push_back(timer);
+	numArmed_++;
+
+	if(!running_) {
+		running_ = true;
+		run_();
+	}
+	armEvent_.raise();
+}
+
+void TimerWheel::disarm(Timer *timer) {
+	if(!timer->armed_)
+		return;
+
+	auto &slot = slots_[timer->tick_ % numSlots];
+	slot.erase(slot.iterator_to(timer));
+	timer->armed_ = false;
+	numArmed_--;
+}
+
+async::detached TimerWheel::run_() {
+	while(true) {
+		if(!numArmed_) {
+			co_await armEvent_.async_wait();
+			continue;
+		}
+
+		co_await helix::sleepFor(tickNs);
+
+		auto target = now() / tickNs;
+		while(numArmed_ && currentTick_ < target) {
+			currentTick_++;
+			auto &slot = slots_[currentTick_ % numSlots];
+
+			// Callbacks may arm or disarm timers, hence we restart the scan after each one.
+			// Timers are never armed for the current tick, so this terminates.
+			while(true) {
+				Timer *due = nullptr;
+				for(auto it = slot.begin(); it != slot.end(); ++it) {
+					if((*it)->tick_ <= currentTick_) {
+						due = *it;
+						slot.erase(it);
+						break;
+					}
+				}
+				if(!due)
+					break;
+
+				due->armed_ = false;
+				numArmed_--;
+				due->callback_();
+			}
+		}
+	}
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <array>
+#include <functional>
+#include <stdint.h>
+
+#include <async/recurring-event.hpp>
+#include <async/result.hpp>
+#include <frg/list.hpp>
+
+// Hashed timer wheel. All timers are driven by a single coroutine, which stays
+// cheap with many connections, unlike one sleeping coroutine per timer.
+// Timers fire at tick granularity and never earlier than their deadline.
+struct TimerWheel {
+	struct Timer {
+		friend struct TimerWheel;
+
+		Timer(std::function<void()> callback)
+		: callback_{std::move(callback)} { }
+
+		Timer(const Timer &) = delete;
+
+		Timer &operator= (const Timer &) = delete;
+
+		bool armed() const {
+			return armed_;
+		}
+
+	private:
+		std::function<void()> callback_;
+		uint64_t tick_ = 0;
+		bool armed_ = false;
+		frg::default_list_hook<Timer> hook_;
+	};
+
+	static constexpr uint64_t tickNs = 10'000'000;
+	static constexpr size_t numSlots = 256;
+
+	// The deadline is in nanoseconds since boot, see now().
+	// Re-arming an armed timer moves its deadline.
+	void arm(Timer *timer, uint64_t deadline);
+	void disarm(Timer *timer);
+
+	static uint64_t now();
+
+private:
+	async::detached run_();
+
+	using TimerList = frg::intrusive_list<
+		Timer,
+		frg::locate_member<
+			Timer,
+			frg::default_list_hook<Timer>,
+			&Timer::hook_
+		>
+	>;
+
+	std::array<TimerList, numSlots> slots_;
+	size_t numArmed_ = 0;
+	// All slots up to (and including) this tick have been processed.
+	uint64_t currentTick_ = 0;
+	bool running_ = false;
+	async::recurring_event armEvent_;
+};
+
+TimerWheel &timerWheel();
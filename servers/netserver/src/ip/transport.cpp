@@ -0,0 +1,95 @@
+#include "transport.hpp"
+
+#include <hel.h>
+#include <hel-syscalls.h>
+
+namespace inet {
+
+namespace {
+
+uint64_t dstGeneration = 1;
+
+async::result<std::optional<nic::MacAddress>> resolveNextHop(const Target &target) {
+	if(auto ti = std::get_if<Ip4TargetInfo>(&target.info))
+		co_return co_await ip4().resolveNextHop(*ti);
+	co_return co_await ip6().resolveNextHop(std::get<Ip6TargetInfo>(target.info));
+}
+
+} // anonymous namespace
+
+size_t Target::ipHeaderSize() const {
+	if(std::holds_alternative<Ip4TargetInfo>(info))
+		return sizeof(Ip4Packet::Header);
+	return 40;
+}
+
+unsigned int Target::routeMtu() const {
+	return std::visit([] (auto &ti) { return ti.route.mtu; }, info);
+}
+
+bool isLocalAddress(const InetAddress &address) {
+	if(address.isIp4())
+		return ip4().hasIp(address.ip4());
+	return ip6().hasIp(address);
+}
+
+async::result<std::optional<Target>> targetByRemote(InetAddress remote,
+		std::shared_ptr<nic::Link> link) {
+	if(remote.isIp4()) {
+		auto ti = co_await ip4().targetByRemote(remote.ip4(), std::move(link));
+		if(!ti)
+			co_return std::nullopt;
+		co_return Target{remote, InetAddress::fromIp4(ti->source), ti->link, std::move(*ti)};
+	}
+
+	auto ti = co_await ip6().targetByRemote(remote, std::move(link));
+	if(!ti)
+		co_return std::nullopt;
+	co_return Target{remote, ti->source, ti->link, std::move(*ti)};
+}
+
+async::result<protocols::fs::Error> sendFrame(Target target,
+		const void *data, size_t size, IpProto proto, nic::TxOffload offload) {
+	if(auto ti = std::get_if<Ip4TargetInfo>(&target.info))
+		co_return co_await ip4().sendFrame(std::move(*ti), data, size,
+				static_cast<uint16_t>(proto), offload);
+	co_return co_await ip6().sendFrame(std::get<Ip6TargetInfo>(std::move(target.info)),
+			data, size, proto, offload);
+}
+
+void invalidateDsts() {
+	dstGeneration++;
+}
+
+async::result<std::optional<Target>> DstCache::get(const InetAddress &remote,
+		std::shared_ptr<nic::Link> link) {
+	uint64_t now;
+	HEL_CHECK(helGetClock(&now));
+	if(target_ && target_->remote == remote && boundLink_ == link.get()
+			&& generation_ == dstGeneration && now < expiry_)
+		co_return target_;
+
+	// Changes during the lookup invalidate its result.
+	auto generation = dstGeneration;
+	target_ = std::nullopt;
+	auto target = co_await targetByRemote(remote, link);
+	if(!target)
+		co_return std::nullopt;
+
+	// Targets are only cached once the next hop is known. Otherwise, sendFrame()
+	// resolves it and reports failures.
+	if(!target->link->rawIp()) {
+		auto mac = co_await resolveNextHop(*target);
+		if(!mac)
+			co_return target;
+		std::visit([&] (auto &ti) { ti.nextHopMac = mac; }, target->info);
+	}
+
+	target_ = target;
+	boundLink_ = link.get();
+	generation_ = generation;
+	expiry_ = now + lifetimeMs * 1'000'000;
+	co_return target;
+}
+
+} // namespace inet
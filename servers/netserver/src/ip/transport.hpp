@@ -0,0 +1,63 @@
+#pragma once
+
+#include <async/result.hpp>
+#include <memory>
+#include <netserver/nic.hpp>
+#include <optional>
+#include <protocols/fs/common.hpp>
+#include <variant>
+
+#include "inet.hpp"
+#include "ip4.hpp"
+#include "ip6.hpp"
+
+// Glue that lets TCP and UDP send packets without caring about the IP version.
+namespace inet {
+
+struct Target {
+	InetAddress remote;
+	InetAddress source;
+	std::shared_ptr<nic::Link> link;
+	std::variant<Ip4TargetInfo, Ip6TargetInfo> info;
+
+	size_t ipHeaderSize() const;
+	// MTU of the route, or zero if it is only limited by the link.
+	unsigned int routeMtu() const;
+};
+
+// Whether the address is assigned to one of our links.
+bool isLocalAddress(const InetAddress &address);
+
+async::result<std::optional<Target>> targetByRemote(InetAddress remote,
+	std::shared_ptr<nic::Link> link = {});
+// Offsets in the offload descriptor are relative to the IP payload.
+async::result<protocols::fs::Error> sendFrame(Target target,
+	const void *data, size_t size, IpProto proto, nic::TxOffload offload = {});
+
+// Drops all targets that DstCaches hold. Called whenever routes, addresses or
+// neighbours change.
+void invalidateDsts();
+
+// Remembers the target of a connected socket, including the link-layer address of
+// its next hop, such that established flows skip route and neighbour lookups.
+struct DstCache {
+	// Cached targets are looked up again after this time, which lets the neighbour
+	// cache notice if the next hop stopped responding.
+	static constexpr uint64_t lifetimeMs = 30'000;
+
+	async::result<std::optional<Target>> get(const InetAddress &remote,
+		std::shared_ptr<nic::Link> link = {});
+
+	void reset() {
+		target_ = std::nullopt;
+	}
+
+private:
+	std::optional<Target> target_;
+	// Link that the target was looked up for (may be null).
+	nic::Link *boundLink_ = nullptr;
+	uint64_t generation_ = 0;
+	uint64_t expiry_ = 0;
+};
+
+} // namespace inet
@@ -1,7 +1,8 @@
 #include "udp4.hpp"
 
-#include "ip4.hpp"
 #include "checksum.hpp"
+#include "readiness.hpp"
+#include "transport.hpp"
 
 #include <async/basic.hpp>
 #include <async/recurring-event.hpp>
@@ -9,6 +10,7 @@
 #include <async/queue.hpp>
 #include <arch/bit.hpp>
 #include <protocols/fs/server.hpp>
+#include <cstddef>
 #include <cstring>
 #include <iomanip>
 #include <random>
@@ -32,22 +34,6 @@ template<typename T>
 void maybeFlip(T &x) {
 	x = arch::convert_endian<arch::endian::big, arch::endian::native>(x);
 }
-
-struct PseudoHeader {
-	uint32_t src;
-	uint32_t dst;
-
-	uint8_t zero = 0;
-	uint8_t proto = static_cast<uint8_t>(IpProto::udp);
-	uint16_t len;
-
-	void ensureEndian() {
-		maybeFlip(src);
-		maybeFlip(dst);
-		maybeFlip(proto);
-		maybeFlip(len);
-	}
-};
 } // namespace
 
 struct Udp {
@@ -67,32 +53,30 @@ struct Udp {
 	static_assert(sizeof(header) == 8, "udp header size wrong");
 
 	arch::dma_buffer_view payload() const {
-		return packet->payload().subview(sizeof(header));
+		return packet->payload.subview(sizeof(header), header.len - sizeof(header));
 	}
 
-	bool parse(smarter::shared_ptr<const Ip4Packet> packet) {
+	bool parse(smarter::shared_ptr<const InetPacket> packet) {
 		Checksum chk;
-		auto payload = packet->payload();
+		auto payload = packet->payload;
 		if (payload.size() < sizeof(header)) {
 			return false;
 		}
 		std::memcpy(&header, payload.data(), sizeof(header));
 		header.ensureEndian();
-		if (payload.size() < header.len) {
+		if (header.len < sizeof(header) || payload.size() < header.len) {
+			return false;
+		}
+		// The checksum is optional for IPv4 only (RFC 8200, section 8.1).
+		if (header.chk == 0 && !packet->source.isIp4()) {
 			return false;
 		}
-		if (header.chk != 0) {
-			PseudoHeader phdr;
-			phdr.src = packet->header.source;
-			phdr.dst = packet->header.destination;
-			phdr.proto = packet->header.protocol;
-			phdr.len = payload.size();
-			phdr.ensureEndian();
-
-			chk.update(&phdr, sizeof(phdr));
-			chk.update(payload);
+		if (header.chk != 0 && !packet->checksumValid) {
+			sumPseudoHeader(chk, packet->source, packet->destination,
+					IpProto::udp, header.len);
+			chk.update(payload.subview(0, header.len));
 			auto fin = chk.finalize();
-			if (fin != 0 && ~fin != 0) {
+			if (fin != 0 && fin != 0xFFFF) {
 				return false;
 			}
 		}
@@ -100,56 +84,28 @@ struct Udp {
 		return true;
 	}
 
-	smarter::shared_ptr<const Ip4Packet> packet;
-
-	std::weak_ptr<nic::Link> link;
+	smarter::shared_ptr<const InetPacket> packet;
 };
 
-Endpoint &Endpoint::operator=(struct sockaddr_in sa) {
-	using arch::convert_endian;
-	using arch::endian;
-	port = convert_endian<endian::big, endian::native>(sa.sin_port);
-	addr = convert_endian<endian::big,
-	     endian::native>(sa.sin_addr.s_addr);
-	return *this;
-}
-
-void Endpoint::ensureEndian() {
-	maybeFlip(addr);
-	maybeFlip(port);
-}
-
 
 bool operator<(const Endpoint &l, const Endpoint &r) {
 	return std::tie(l.port, l.addr) < std::tie(r.port, r.addr);
 }
 
-namespace {
-auto checkAddress(const void *addr_ptr, size_t addr_len, Endpoint &e) {
-	struct sockaddr_in addr;
-	if (addr_len < sizeof(addr)) {
-		return protocols::fs::Error::illegalArguments;
-	}
-	std::memcpy(&addr, addr_ptr, sizeof(addr));
-	if (addr.sin_family != AF_INET) {
-		return protocols::fs::Error::afNotSupported;
-	}
-	e = addr;
-	return protocols::fs::Error::none;
-}
-} // namespace
-
 using namespace protocols::fs;
 
 struct Udp4Socket {
-	Udp4Socket(Udp4 *parent) : parent_(parent) {}
+	Udp4Socket(Udp4 *parent, int family) : parent_(parent), family_(family) {
+		local_.addr = InetAddress::any(family);
+		remote_.addr = InetAddress::any(family);
+	}
 
 	~Udp4Socket() {
 		parent_->unbind(local_);
 	}
 
-	static auto make_socket(Udp4 *parent) {
-		auto s = smarter::make_shared<Udp4Socket>(parent);
+	static auto make_socket(Udp4 *parent, int family) {
+		auto s = smarter::make_shared<Udp4Socket>(parent, family);
 		s->holder_ = s;
 		return s;
 	}
@@ -162,7 +118,7 @@ struct Udp4Socket {
 		auto self = static_cast<Udp4Socket *>(obj);
 		Endpoint remote;
 
-		if (auto e = checkAddress(addr_ptr, addr_size, remote);
+		if (auto e = parseSockaddr(addr_ptr, addr_size, self->family_, remote.addr, remote.port);
 			e != protocols::fs::Error::none) {
 			co_return e;
 		}
@@ -173,7 +129,7 @@ struct Udp4Socket {
 			co_return protocols::fs::Error::addressNotAvailable;
 		}
 
-		if (remote.addr == INADDR_BROADCAST) {
+		if (remote.addr.isBroadcast() || remote.addr.isMulticast()) {
 			std::cout << "netserver: broadcast" << std::endl;
 			co_return protocols::fs::Error::accessDenied;
 		}
@@ -184,13 +140,8 @@ struct Udp4Socket {
 
 	static async::result<size_t> sockname(void *object, void *addr_ptr, size_t max_addr_length) {
 		auto self = static_cast<Udp4Socket *>(object);
-		sockaddr_in sa{};
-		sa.sin_family = AF_INET;
-		sa.sin_port = htons(self->local_.port);
-		sa.sin_addr.s_addr = htonl(self->local_.addr);
-		memcpy(addr_ptr, &sa, std::min(sizeof(sockaddr_in), max_addr_length));
-
-		co_return sizeof(sockaddr_in);
+		co_return emitSockaddr(addr_ptr, max_addr_length, self->family_,
+				self->local_.addr, self->local_.port);
 	}
 
 	static async::result<protocols::fs::Error> bind(void* obj,
@@ -205,18 +156,18 @@ struct Udp4Socket {
 			co_return protocols::fs::Error::illegalArguments;
 		}
 
-		if (auto e = checkAddress(addr_ptr, addr_size, local);
+		if (auto e = parseSockaddr(addr_ptr, addr_size, self->family_, local.addr, local.port);
 			e != protocols::fs::Error::none) {
 			co_return e;
 		}
 
 		// TODO(arsen): check other broadcast addresses too
-		if (local.addr == INADDR_BROADCAST) {
+		if (local.addr.isBroadcast() || local.addr.isMulticast()) {
 			std::cout << "netserver: broadcast" << std::endl;
 			co_return protocols::fs::Error::accessDenied;
 		}
 
-		if (local.addr != INADDR_ANY && !ip4().hasIp(local.addr)) {
+		if (!local.addr.isAny() && !inet::isLocalAddress(local.addr)) {
 			std::cout << "netserver: not local ip" << std::endl;
 			co_return protocols::fs::Error::addressNotAvailable;
 		}
@@ -248,33 +199,29 @@ struct Udp4Socket {
 			co_return Error::wouldBlock;
 
 		auto element = co_await self->queue_.async_get();
+		self->publishReadiness_(0);
 		auto packet = element->payload();
 		auto copy_size = std::min(packet.size(), len);
 		std::memcpy(data, packet.data(), copy_size);
 
-		sockaddr_in addr {};
-		addr.sin_family = AF_INET;
-		addr.sin_port = convert_endian<endian::big>(element->header.src);
-		addr.sin_addr = {
-			convert_endian<endian::big>(element->packet->header.source)
-		};
-
 		std::memset(addr_buf, 0, addr_size);
-		std::memcpy(addr_buf, &addr, std::min(addr_size, sizeof(addr)));
+		auto addrLength = emitSockaddr(addr_buf, addr_size, self->family_,
+				element->packet->source, element->header.src);
 
 		protocols::fs::CtrlBuilder ctrl{max_ctrl_len};
 
-		if(self->ipPacketInfo_) {
+		auto link = element->packet->link.lock();
+		if(self->ipPacketInfo_ && self->family_ == AF_INET && link) {
 			auto truncated = ctrl.message(IPPROTO_IP, IP_PKTINFO, sizeof(struct in_pktinfo));
 			if(!truncated)
 				ctrl.write<struct in_pktinfo>({
-					.ipi_ifindex = element->link.lock()->index(),
-					.ipi_spec_dst = { .s_addr = convert_endian<endian::big>(element->packet->header.destination) },
-					.ipi_addr = { .s_addr = convert_endian<endian::big>(element->packet->header.source) },
+					.ipi_ifindex = link->index(),
+					.ipi_spec_dst = { .s_addr = convert_endian<endian::big>(element->packet->destination.ip4()) },
+					.ipi_addr = { .s_addr = convert_endian<endian::big>(element->packet->source.ip4()) },
 				});
 		}
 
-		co_return RecvData{ctrl.buffer(), copy_size, sizeof(addr), 0};
+		co_return RecvData{ctrl.buffer(), copy_size, addrLength, 0};
 	}
 
 	static async::result<frg::expected<protocols::fs::Error, size_t>> sendmsg(void *obj,
@@ -292,7 +239,7 @@ struct Udp4Socket {
 		Endpoint target;
 		auto source = self->local_;
 		if (addr_size != 0) {
-			if (auto e = checkAddress(addr_ptr, addr_size, target);
+			if (auto e = parseSockaddr(addr_ptr, addr_size, self->family_, target.addr, target.port);
 				e != protocols::fs::Error::none) {
 				std::cout << "netserver: trimmed sendmsg addr" << std::endl;
 				co_return e;
@@ -301,7 +248,7 @@ struct Udp4Socket {
 			target = self->remote_;
 		}
 
-		if (target.port == 0 || target.addr == 0) {
+		if (target.port == 0 || target.addr.isAny()) {
 			std::cout << "netserver: udp needs destination" << std::endl;
 			co_return protocols::fs::Error::destAddrRequired;
 		}
@@ -313,7 +260,7 @@ struct Udp4Socket {
 
 		source = self->local_;
 
-		if (target.addr == INADDR_BROADCAST) {
+		if (target.addr.isBroadcast() || target.addr.isMulticast()) {
 			std::cout << "netserver: broadcast" << std::endl;
 			co_return protocols::fs::Error::accessDenied;
 		}
@@ -326,49 +273,42 @@ struct Udp4Socket {
 			.len = static_cast<uint16_t>(len + sizeof(Udp::Header)),
 			.chk = 0,
 		};
-		header.ensureEndian();
 
-		// native endian target IP
-		auto targetIpNe = target.addr;
-		source.ensureEndian();
-		target.ensureEndian();
-
-		auto ti = co_await ip4().targetByRemote(targetIpNe);
+		// Connected sockets keep their target cached.
+		std::optional<inet::Target> ti;
+		if (addr_size != 0)
+			ti = co_await inet::targetByRemote(target.addr);
+		else
+			ti = co_await self->dst_.get(target.addr);
 		if (!ti) {
 			co_return protocols::fs::Error::netUnreachable;
 		}
 
 		Checksum chk;
-		PseudoHeader psh {
-			.src = convert_endian<endian::big>(ti->source),
-			.dst = target.addr,
-			.len = header.len
-		};
-		chk.update(&psh, sizeof(psh));
-		chk.update(&header, sizeof(header));
-		chk.update(data, len);
-		header.chk = convert_endian<endian::big>(chk.finalize());
-
-		std::cout << "netserver:" << std::endl << std::hex
-			<< std::setw(8) << psh.src << std::endl
-			<< std::setw(8) << psh.dst << std::endl
-			<< std::setw(8) << psh.len << std::endl
-
-			<< std::setw(8) << header.src << std::endl
-			<< std::setw(8) << header.dst << std::endl
-			<< std::setw(8) << header.len << std::endl
-			<< std::setw(8) << header.chk << std::endl << std::dec;
-
-		if (header.chk == 0) {
+		sumPseudoHeader(chk, ti->source, target.addr, IpProto::udp, header.len);
+		header.ensureEndian();
+
+		nic::TxOffload offload;
+		if (ti->link->offloads().txChecksum) {
+			// The NIC only needs the sum of the pseudo header.
+			std::memcpy(buf.data() + sizeof(header), data, len);
+			header.chk = convert_endian<endian::big>(chk.sum());
+			offload.needsChecksum = true;
+			offload.checksumOffset = offsetof(Udp::Header, chk);
+		} else {
+			chk.update(&header, sizeof(header));
+			chk.copyAndUpdate(buf.data() + sizeof(header), data, len);
+			header.chk = convert_endian<endian::big>(chk.finalize());
+		}
+
+		if (header.chk == 0 && !offload.needsChecksum) {
 			header.chk = ~header.chk;
 		}
 
 		std::memcpy(buf.data(), &header, sizeof(header));
-		std::memcpy(buf.data() + sizeof(header), data, len);
 
-		auto error = co_await ip4().sendFrame(std::move(*ti),
-			buf.data(), buf.size(),
-			static_cast<uint16_t>(IpProto::udp));
+		auto error = co_await inet::sendFrame(std::move(*ti),
+			buf.data(), buf.size(), IpProto::udp, offload);
 		if (error != protocols::fs::Error::none) {
 			co_return error;
 		}
@@ -395,11 +335,19 @@ struct Udp4Socket {
 	static async::result<frg::expected<protocols::fs::Error, protocols::fs::PollStatusResult>>
 	pollStatus(void *obj) {
 		auto self = static_cast<Udp4Socket *>(obj);
-		int events = EPOLLOUT;
-		if(!self->queue_.empty())
-			events |= EPOLLIN;
+		co_return protocols::fs::PollStatusResult(self->_currentSeq, self->pollStatus_());
+	}
+
+	static async::result<frg::expected<protocols::fs::Error, uint64_t>>
+	watchReadiness(void *obj) {
+		auto self = static_cast<Udp4Socket *>(obj);
 
-		co_return protocols::fs::PollStatusResult(self->_currentSeq, events);
+		if(!self->readinessSlot_) {
+			if(auto e = self->readinessSlot_.acquire(); !e)
+				co_return e.error();
+			self->publishReadiness_(0);
+		}
+		co_return self->readinessSlot_.index();
 	}
 
 	static async::result<frg::expected<Error>> setSocketOption(void *obj,
@@ -424,6 +372,7 @@ struct Udp4Socket {
 	constexpr static FileOperations ops {
 		.pollWait = &pollWait,
 		.pollStatus = &pollStatus,
+		.watchReadiness = &watchReadiness,
 		.bind = &bind,
 		.connect = &connect,
 		.sockname = &sockname,
@@ -432,7 +381,11 @@ struct Udp4Socket {
 		.setSocketOption = &setSocketOption,
 	};
 
-	bool bindAvailable(uint32_t addr = INADDR_ANY) {
+	bool bindAvailable() {
+		return bindAvailable(InetAddress::any(family_));
+	}
+
+	bool bindAvailable(InetAddress addr) {
 		static std::mt19937 rng;
 		static std::uniform_int_distribution<uint16_t> dist {
 			32768, 60999
@@ -460,47 +413,79 @@ struct Udp4Socket {
 private:
 	friend struct Udp4;
 
+	int pollStatus_() {
+		int events = EPOLLOUT;
+		if(!queue_.empty())
+			events |= EPOLLIN;
+		return events;
+	}
+
+	// See Tcp4Socket::publishReadiness_().
+	void publishReadiness_(int edges) {
+		if(readinessSlot_)
+			readinessSlot_.publish(_currentSeq, pollStatus_(), edges);
+	}
+
 	async::queue<Udp, stl_allocator> queue_;
 	Endpoint remote_;
 	Endpoint local_;
 	Udp4 *parent_;
+	int family_;
+	// Route and next hop of remote_.
+	inet::DstCache dst_;
 	smarter::weak_ptr<Udp4Socket> holder_;
 
 	async::recurring_event _statusBell;
 	uint64_t _currentSeq;
 	uint64_t _inSeq;
+	// Released once the file is closed.
+	ReadinessTable::Slot readinessSlot_;
 
 	bool ipPacketInfo_ = false;
 };
 
-void Udp4::feedDatagram(smarter::shared_ptr<const Ip4Packet> packet, std::weak_ptr<nic::Link> link) {
-	Udp udp{ .link = link };
+Udp4 &udp() {
+	static Udp4 inst;
+	return inst;
+}
+
+namespace {
+
+// Whether sockets bound to both endpoints receive the same datagrams. IPv6 sockets
+// behave as if IPV6_V6ONLY was set, so wildcards only cover their own family.
+bool overlaps(const InetAddress &a, const InetAddress &b) {
+	if (a.family() != b.family())
+		return false;
+	return a == b || a.isAny() || b.isAny();
+}
+
+} // namespace
+
+void Udp4::feedDatagram(smarter::shared_ptr<const InetPacket> packet) {
+	Udp udp;
 	if (!udp.parse(std::move(packet))) {
 		std::cout << "netserver: broken udp received" << std::endl;
 		return;
 	}
 
-	std::cout << "received udp datagram to port " << udp.header.dst << std::endl;
-
-	auto i = binds.lower_bound({ 0, udp.header.dst });
+	auto i = binds.lower_bound({ InetAddress{}, udp.header.dst });
 	for (; i != binds.end() && i->first.port == udp.header.dst; i++) {
 		auto ep = i->first;
-		if (ep.addr == udp.packet->header.destination
-			|| ep.addr == INADDR_ANY) {
+		if (ep.addr == udp.packet->destination
+			|| ep.addr == InetAddress::any(udp.packet->destination.family())) {
 			i->second->queue_.emplace(std::move(udp));
 			i->second->_inSeq = ++i->second->_currentSeq;
 			i->second->_statusBell.raise();
+			i->second->publishReadiness_(EPOLLIN);
 			break;
 		}
 	}
 }
 
 bool Udp4::tryBind(smarter::shared_ptr<Udp4Socket> socket, Endpoint addr) {
-	auto i = binds.lower_bound(addr);
+	auto i = binds.lower_bound({ InetAddress{}, addr.port });
 	for (; i != binds.end() && i->first.port == addr.port; i++) {
-		auto ep = i->first;
-		if (ep.addr == INADDR_ANY || addr.addr == INADDR_ANY
-			|| ep.addr == addr.addr) {
+		if (overlaps(i->first.addr, addr.addr)) {
 			return false;
 		}
 	}
@@ -513,9 +498,10 @@ bool Udp4::unbind(Endpoint e) {
 	return binds.erase(e) != 0;
 }
 
-void Udp4::serveSocket(helix::UniqueLane lane) {
+void Udp4::serveSocket(int family, helix::UniqueLane lane) {
 	using protocols::fs::servePassthrough;
-	auto sock = Udp4Socket::make_socket(this);
-	async::detach(servePassthrough(std::move(lane), std::move(sock),
-			&Udp4Socket::ops));
+	auto sock = Udp4Socket::make_socket(this, family);
+	async::detach(servePassthrough(std::move(lane), sock,
+			&Udp4Socket::ops),
+		[sock] { sock->readinessSlot_.release(); });
 }
@@ -5,24 +5,24 @@
 #include <map>
 #include <netserver/nic.hpp>
 
-class Ip4Packet;
+#include "inet.hpp"
 
 struct Endpoint {
-	uint32_t addr = 0;
+	InetAddress addr;
 	uint16_t port = 0;
-
-	Endpoint &operator=(struct sockaddr_in sa);
-	void ensureEndian();
 };
 
 bool operator<(const Endpoint &l, const Endpoint &r);
 
 struct Udp4Socket;
 struct Udp4 {
-	void feedDatagram(smarter::shared_ptr<const Ip4Packet>, std::weak_ptr<nic::Link> link);
+	void feedDatagram(smarter::shared_ptr<const InetPacket>);
 	bool tryBind(smarter::shared_ptr<Udp4Socket> socket, Endpoint addr);
 	bool unbind(Endpoint remote);
-	void serveSocket(helix::UniqueLane lane);
+	// Serves an AF_INET or AF_INET6 socket.
+	void serveSocket(int family, helix::UniqueLane lane);
 private:
 	std::map<Endpoint, smarter::shared_ptr<Udp4Socket>> binds;
 };
+
+Udp4 &udp();
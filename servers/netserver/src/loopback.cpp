@@ -0,0 +1,93 @@
+#include "loopback.hpp"
+
+#include <algorithm>
+#include <async/recurring-event.hpp>
+#include <cassert>
+#include <cstring>
+#include <deque>
+
+namespace nic::loopback {
+
+namespace {
+
+// Like Linux, leave room for the largest IPv4 packet.
+constexpr unsigned int loopbackMtu = 64 * 1024;
+// Frames that are not received yet. Further frames are dropped, like on a NIC
+// whose receive ring is full.
+constexpr size_t maxQueuedFrames = 1024;
+
+struct LoopbackLink final : nic::Link {
+	LoopbackLink()
+	: nic::Link{loopbackMtu, nullptr} {
+		raw_ip_ = true;
+		loopback_ = true;
+		l1_up_ = true;
+		// Frames never leave the host, hence checksums are not needed. Segmentation
+		// is not needed either: large TCP packets are received as they are.
+		offloads_.txChecksum = true;
+		offloads_.rxChecksum = true;
+		offloads_.maxTsoSize = 0xFFFF;
+		offloads_.maxReceiveSize = loopbackMtu;
+	}
+
+	async::result<size_t> receive(arch::dma_buffer_view buffer) override {
+		while(queue_.empty())
+			co_await arrived_.async_wait();
+		auto frame = std::move(queue_.front());
+		queue_.pop_front();
+
+		auto size = std::min(buffer.size(), frame.data.size());
+		std::memcpy(buffer.data(), frame.data.data(), size);
+		co_return size;
+	}
+
+	async::result<void> receiveBatch(std::vector<RxFrame> &frames, size_t maxFrames) override {
+		while(queue_.empty())
+			co_await arrived_.async_wait();
+		while(!queue_.empty() && frames.size() < maxFrames) {
+			frames.push_back(std::move(queue_.front()));
+			queue_.pop_front();
+		}
+	}
+
+	// Frames that are not from allocateFrame() need to be copied.
+	async::result<void> send(const arch::dma_buffer_view view) override {
+		arch::dma_buffer frame{nullptr, view.size()};
+		std::memcpy(frame.data(), view.data(), view.size());
+		co_await transmit(std::move(frame), {});
+	}
+
+	async::result<void> sendWithOffload(const arch::dma_buffer_view view, TxOffload) override {
+		co_await send(view);
+	}
+
+	async::result<void> transmit(arch::dma_buffer frame, TxOffload) override {
+		if(queue_.size() >= maxQueuedFrames)
+			co_return;
+
+		auto storage = std::make_shared<arch::dma_buffer>(std::move(frame));
+		arch::dma_buffer_view view = *storage;
+		queue_.push_back({std::move(storage), view, {.length = view.size(), .checksumValid = true}});
+		arrived_.raise();
+	}
+
+private:
+	std::deque<RxFrame> queue_;
+	async::recurring_event arrived_;
+};
+
+std::shared_ptr<nic::Link> loopbackLink;
+
+} // anonymous namespace
+
+std::shared_ptr<nic::Link> makeShared() {
+	assert(!loopbackLink);
+	loopbackLink = std::make_shared<LoopbackLink>();
+	return loopbackLink;
+}
+
+std::shared_ptr<nic::Link> get() {
+	return loopbackLink;
+}
+
+} // namespace nic::loopback
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <memory>
+#include <netserver/nic.hpp>
+
+// The lo link. Frames are handed to the receive path by reference, i.e., they are
+// never copied, and their TCP/UDP checksums are neither computed nor verified.
+namespace nic::loopback {
+
+// Creates the loopback link. It only exists once.
+std::shared_ptr<nic::Link> makeShared();
+// Returns the loopback link (or null if it was not created yet).
+std::shared_ptr<nic::Link> get();
+
+} // namespace nic::loopback
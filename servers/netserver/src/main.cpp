@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <assert.h>
 #include <format>
 #include <net/if.h>
@@ -23,9 +24,14 @@
 #include <sys/ioctl.h>
 #include "fs.bragi.hpp"
 
+#include "ip/checksum.hpp"
 #include "ip/ip4.hpp"
+#include "ip/ip6.hpp"
+#include "ip/tcp4.hpp"
+#include "loopback.hpp"
 #include "netlink/netlink.hpp"
 #include "raw.hpp"
+#include "readiness.hpp"
 
 #include <netserver/nic.hpp>
 #include <nic/virtio/virtio.hpp>
@@ -116,6 +122,24 @@ std::shared_ptr<nic::Link> nic::Link::byName(std::string name) {
 
 namespace {
 
+// The loopback link has no mbus entity; mbus IDs are never negative.
+constexpr int64_t loopbackEntityId = -1;
+
+void setupLoopback() {
+	auto lo = nic::loopback::makeShared();
+	baseDeviceMap.insert({loopbackEntityId, lo});
+	nic::runDevice(lo);
+
+	ip4().setLink({INADDR_LOOPBACK, 8}, lo);
+	ip4Router().addRoute({ {INADDR_LOOPBACK & 0xFF00'0000, 8}, lo });
+
+	auto address = InetAddress::fromIp6(in6addr_loopback);
+	ip6().addAddress({address, 128}, lo);
+	Ip6Router::Route route{ {address, 128}, lo };
+	route.metric = 256;
+	ip6Router().addRoute(std::move(route));
+}
+
 async::result<std::shared_ptr<nic::Link>> setupVirtioDevice(mbus_ng::Entity &base_entity, protocols::hw::Device hwDevice) {
 	virtio_core::DiscoverMode discover_mode = virtio_core::DiscoverMode::null;
 	auto properties = (co_await base_entity.getProperties()).unwrap();
@@ -425,14 +449,41 @@ async::result<protocols::svrctl::Error> bindDevice(int64_t base_id) {
 	frg::string_view station = "";
 	frg::string_view subnet = "";
 	frg::string_view gateway = "";
+	frg::string_view station6 = "";
+	frg::string_view gateway6 = "";
+	unsigned int tcpLoss = 0;
+	unsigned int tcpDelay = 0;
+	bool checksumBench = false;
+	bool routeBench = false;
 
 	frg::array args = {
 		frg::option{"netserver.ip", frg::as_string_view(station)},
 		frg::option{"netserver.subnet", frg::as_string_view(subnet)},
 		frg::option{"netserver.gateway", frg::as_string_view(gateway)},
+		frg::option{"netserver.ip6", frg::as_string_view(station6)},
+		frg::option{"netserver.gateway6", frg::as_string_view(gateway6)},
+		frg::option{"netserver.tcp-loss", frg::as_number(tcpLoss)},
+		frg::option{"netserver.tcp-delay", frg::as_number(tcpDelay)},
+		frg::option{"netserver.checksum-bench", frg::store_true(checksumBench)},
+		frg::option{"netserver.route-bench", frg::store_true(routeBench)},
 	};
 	frg::parse_arguments(cmdline.c_str(), args);
 
+	static bool checksumBenchDone = false;
+	if(checksumBench && !checksumBenchDone) {
+		benchmarkChecksum();
+		checksumBenchDone = true;
+	}
+
+	static bool routeBenchDone = false;
+	if(routeBench && !routeBenchDone) {
+		benchmarkRoutes();
+		routeBenchDone = true;
+	}
+
+	tcp().setLossRate(tcpLoss);
+	tcp().setDelay(tcpDelay);
+
 	auto convert_ip = [](frg::string_view &str, in_addr *addr) -> bool {
 		std::string strbuf{str.data(), str.size()};
 		return inet_pton(AF_INET, strbuf.c_str(), addr) == 1;
@@ -467,6 +518,39 @@ async::result<protocols::svrctl::Error> bindDevice(int64_t base_id) {
 		ip4Router().addRoute(std::move(default_route));
 	}
 
+	// IPv6 addresses are usually configured via SLAAC, but static
+	// configuration is useful on networks without a router.
+	ip6().configureLink(device);
+
+	if(station6.size()) {
+		std::string strbuf{station6.data(), station6.size()};
+		uint8_t prefix = 64;
+		if(auto slash = strbuf.find('/'); slash != std::string::npos) {
+			prefix = std::clamp(atoi(strbuf.c_str() + slash + 1), 0, 128);
+			strbuf.resize(slash);
+		}
+
+		in6_addr addr;
+		if(inet_pton(AF_INET6, strbuf.c_str(), &addr) == 1) {
+			auto address = InetAddress::fromIp6(addr);
+			ip6().addAddress({address, prefix}, device);
+			Ip6Router::Route route{ {address, prefix}, device };
+			route.metric = 256;
+			ip6Router().addRoute(std::move(route));
+		}
+	}
+
+	if(gateway6.size()) {
+		std::string strbuf{gateway6.data(), gateway6.size()};
+		in6_addr addr;
+		if(inet_pton(AF_INET6, strbuf.c_str(), &addr) == 1) {
+			Ip6Router::Route route{ {InetAddress{}, 0}, device };
+			route.gateway = InetAddress::fromIp6(addr);
+			route.metric = 1024;
+			ip6Router().addRoute(std::move(route));
+		}
+	}
+
 	co_return protocols::svrctl::Error::success;
 }
 
@@ -601,6 +685,13 @@ async::detached serve(helix::UniqueLane lane) {
 						co_await sendError(err);
 						continue;
 					}
+				} else if(req.domain() == AF_INET6) {
+					auto err = ip6().serveSocket(std::move(local_lane),
+							req.type(), req.protocol(), req.flags());
+					if(err != managarm::fs::Errors::SUCCESS) {
+						co_await sendError(err);
+						continue;
+					}
 				} else if(req.domain() == AF_NETLINK) {
 					auto nl_socket = smarter::make_shared<nl::NetlinkSocket>(req.flags(), req.protocol());
 					async::detach(servePassthrough(std::move(local_lane), nl_socket,
@@ -801,6 +892,25 @@ async::detached serve(helix::UniqueLane lane) {
 			);
 
 			posixLane = std::move(conversation);
+		} else if(preamble.id() == managarm::fs::OpenReadinessRequest::message_id) {
+			recv_req.reset();
+			auto [localLane, remoteLane] = helix::createStream();
+			async::detach(readinessTable().serveStream(std::move(localLane)));
+
+			managarm::fs::OpenReadinessReply resp;
+			resp.set_error(managarm::fs::Errors::SUCCESS);
+			resp.set_num_slots(ReadinessTable::numSlots);
+
+			auto [send_resp, push_lane, push_memory] =
+				co_await helix_ng::exchangeMsgs(conversation,
+					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{}),
+					helix_ng::pushDescriptor(remoteLane),
+					helix_ng::pushDescriptor(readinessTable().getMemory())
+				);
+			HEL_CHECK(send_resp.error());
+			HEL_CHECK(push_lane.error());
+			HEL_CHECK(push_memory.error());
+			logBragiReply(resp);
 		} else {
 			recv_req.reset();
 			std::cout << "netserver: received unknown message: "
@@ -847,6 +957,7 @@ int main() {
 
 	async::run(clk::enumerateTracker(), helix::currentDispatcher);
 	nl::initialize();
+	setupLoopback();
 
 //	HEL_CHECK(helSetPriority(kHelThisThread, 3));
 
@@ -9,7 +9,9 @@
 
 #include "core/netlink.hpp"
 #include "ip/ip4.hpp"
+#include "ip/ip6.hpp"
 #include "ip/arp.hpp"
+#include "ip/ndp.hpp"
 
 #include <deque>
 #include <vector>
@@ -72,6 +74,8 @@ private:
 
 	void getRoute(struct nlmsghdr *hdr);
 	void newRoute(struct nlmsghdr *hdr);
+	void newRoute6(struct nlmsghdr *hdr, const struct rtmsg *msg,
+		core::netlink::NetlinkAttrs<struct rtmsg> attrs);
 
 	void getLink(struct nlmsghdr *hdr);
 
@@ -84,7 +88,9 @@ private:
 	void sendLinkPacket(std::shared_ptr<nic::Link> nic, void *h, uint16_t flags);
 	void sendAddrPacket(const struct nlmsghdr *hdr, const struct ifaddrmsg *msg, std::shared_ptr<nic::Link>);
 	void sendRoutePacket(const struct nlmsghdr *hdr, Ip4Router::Route &route);
+	void sendRoute6Packet(const struct nlmsghdr *hdr, Ip6Router::Route &route);
 	void sendNeighPacket(const struct nlmsghdr *hdr, uint32_t addr, Neighbours::Entry &entry);
+	void sendNeigh6Packet(const struct nlmsghdr *hdr, const InetAddress &addr, Neighbours::Entry &entry);
 
 	int flags;
 
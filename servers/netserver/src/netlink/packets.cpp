@@ -16,10 +16,12 @@ namespace {
 uint16_t mapArpStateToNetlink(Neighbours::State state) {
 	switch(state) {
 		case Neighbours::State::none: return NUD_NONE;
-		case Neighbours::State::probe: return NUD_PROBE;
-		case Neighbours::State::failed: return NUD_FAILED;
+		case Neighbours::State::incomplete: return NUD_INCOMPLETE;
 		case Neighbours::State::reachable: return NUD_REACHABLE;
 		case Neighbours::State::stale: return NUD_STALE;
+		case Neighbours::State::delay: return NUD_DELAY;
+		case Neighbours::State::probe: return NUD_PROBE;
+		case Neighbours::State::failed: return NUD_FAILED;
 	}
 
 	__builtin_unreachable();
@@ -46,7 +48,7 @@ void NetlinkSocket::sendLinkPacket(std::shared_ptr<nic::Link> nic, void *h, uint
 
 	b.message<struct ifinfomsg>({
 		.ifi_family = AF_UNSPEC,
-		.ifi_type = ARPHRD_ETHER,
+		.ifi_type = static_cast<unsigned short>(nic->loopback() ? ARPHRD_LOOPBACK : ARPHRD_ETHER),
 		.ifi_index = nic->index(),
 		.ifi_flags = IFF_UP | IFF_RUNNING | nic->iff_flags(),
 	});
@@ -72,6 +74,28 @@ void NetlinkSocket::sendLinkPacket(std::shared_ptr<nic::Link> nic, void *h, uint
 }
 
 void NetlinkSocket::sendAddrPacket(const struct nlmsghdr *hdr, const struct ifaddrmsg *msg, std::shared_ptr<nic::Link> nic) {
+	if(msg->ifa_family == AF_UNSPEC || msg->ifa_family == AF_INET6) {
+		for(auto &addr : ip6().getAddressesByIndex(nic->index())) {
+			NetlinkBuilder b;
+			b.header(RTM_NEWADDR, NLM_F_MULTI | NLM_F_DUMP_FILTERED, hdr->nlmsg_seq, 0);
+			b.message<struct ifaddrmsg>({
+				.ifa_family = AF_INET6,
+				.ifa_prefixlen = addr.prefix,
+				.ifa_flags = msg->ifa_flags,
+				.ifa_scope = static_cast<unsigned char>(addr.ip.isLinkLocal() ? RT_SCOPE_LINK : RT_SCOPE_UNIVERSE),
+				.ifa_index = static_cast<uint32_t>(nic->index()),
+			});
+
+			b.rtattr(IFA_ADDRESS, addr.ip.ip6());
+			b.rtattr(IFA_LABEL, nic->name());
+
+			deliver(b.packet());
+		}
+	}
+
+	if(msg->ifa_family != AF_UNSPEC && msg->ifa_family != AF_INET)
+		return;
+
 	auto addr_check = ip4().getCidrByIndex(nic->index());
 
 	if(!addr_check)
@@ -126,6 +150,36 @@ void NetlinkSocket::sendRoutePacket(const struct nlmsghdr *hdr, Ip4Router::Route
 	deliver(b.packet());
 }
 
+void NetlinkSocket::sendRoute6Packet(const struct nlmsghdr *hdr, Ip6Router::Route &route) {
+	NetlinkBuilder b;
+
+	b.header(RTM_NEWROUTE, NLM_F_MULTI, hdr->nlmsg_seq, 0);
+	b.message<struct rtmsg>({
+		.rtm_family = AF_INET6,
+		.rtm_dst_len = route.network.prefix,
+		.rtm_src_len = 0,
+		.rtm_tos = 0,
+		.rtm_table = RT_TABLE_MAIN,
+		.rtm_protocol = route.protocol,
+		.rtm_scope = RT_SCOPE_UNIVERSE,
+		.rtm_type = static_cast<unsigned char>(route.type ? route.type : RTN_UNICAST),
+		.rtm_flags = 0,
+	});
+
+	b.rtattr(RTA_TABLE, RT_TABLE_MAIN);
+	if(route.network.prefix)
+		b.rtattr(RTA_DST, route.network.ip.ip6());
+	if(route.metric)
+		b.rtattr(RTA_PRIORITY, route.metric);
+	if(!route.gateway.isAny())
+		b.rtattr(RTA_GATEWAY, route.gateway.ip6());
+	if(!route.source.isAny())
+		b.rtattr(RTA_PREFSRC, route.source.ip6());
+	b.rtattr(RTA_OIF, (route.link.expired()) ? 0 : route.link.lock()->index());
+
+	deliver(b.packet());
+}
+
 void NetlinkSocket::sendNeighPacket(const struct nlmsghdr *hdr, uint32_t addr, Neighbours::Entry &entry) {
 	NetlinkBuilder b;
 	int index = 0;
@@ -151,4 +205,25 @@ void NetlinkSocket::sendNeighPacket(const struct nlmsghdr *hdr, uint32_t addr, N
 	deliver(b.packet());
 }
 
+void NetlinkSocket::sendNeigh6Packet(const struct nlmsghdr *hdr, const InetAddress &addr, Neighbours::Entry &entry) {
+	NetlinkBuilder b;
+	int index = 0;
+
+	if(auto nic = entry.link.lock())
+		index = nic->index();
+
+	b.header(RTM_NEWNEIGH, NLM_F_MULTI | NLM_F_DUMP_FILTERED, hdr->nlmsg_seq, 0);
+	b.message<struct ndmsg>({
+		.ndm_family = AF_INET6,
+		.ndm_ifindex = index,
+		.ndm_state = mapArpStateToNetlink(entry.state),
+		.ndm_type = RTN_UNICAST,
+	});
+
+	b.rtattr(NDA_DST, addr.ip6());
+	b.rtattr<uint8_t[6]>(NDA_LLADDR, entry.mac.data());
+
+	deliver(b.packet());
+}
+
 } // namespace nl
@@ -1,6 +1,7 @@
 #include "core/netlink.hpp"
 #include "netlink.hpp"
 #include "src/ip/arp.hpp"
+#include "src/ip/ndp.hpp"
 
 #include <arpa/inet.h>
 #include <linux/neighbour.h>
@@ -109,6 +110,11 @@ void NetlinkSocket::newRoute(struct nlmsghdr *hdr) {
 		return;
 	}
 
+	if(msg->rtm_family == AF_INET6) {
+		newRoute6(hdr, msg, *attrs);
+		return;
+	}
+
 	Ip4Router::Route route { { 0, 0 }, {} };
 	bool route_changed = false;
 
@@ -177,6 +183,64 @@ void NetlinkSocket::newRoute(struct nlmsghdr *hdr) {
 		sendAck(this, hdr);
 }
 
+void NetlinkSocket::newRoute6(struct nlmsghdr *hdr, const struct rtmsg *msg,
+		core::netlink::NetlinkAttrs<struct rtmsg> attrs) {
+	Ip6Router::Route route { { {}, msg->rtm_dst_len }, {} };
+	bool route_changed = false;
+
+	for(auto attr : attrs) {
+		switch(attr.type()) {
+			case RTA_DST:
+				if(auto opt = attr.data<in6_addr>())
+					route.network.ip = InetAddress::fromIp6(*opt);
+				route_changed = true;
+				break;
+			case RTA_GATEWAY:
+				if(auto opt = attr.data<in6_addr>())
+					route.gateway = InetAddress::fromIp6(*opt);
+				route_changed = true;
+				break;
+			case RTA_PREFSRC:
+				if(auto opt = attr.data<in6_addr>())
+					route.source = InetAddress::fromIp6(*opt);
+				route_changed = true;
+				break;
+			case RTA_OIF: {
+				if(auto nic = nic::Link::byIndex(attr.data<int>().value_or(0))) {
+					route.link = nic;
+					route_changed = true;
+				}
+				break;
+			}
+			case RTA_PRIORITY:
+				route.metric = attr.data<int>().value_or(0);
+				route_changed = true;
+				break;
+			default:
+				std::cout << "netlink: ignoring unknown attr " << attr.type() << std::endl;
+				if(attr.type() > RTA_MAX) {
+					sendError(this, hdr, EINVAL);
+					return;
+				}
+				break;
+		}
+	}
+
+	if(route.network.prefix > 128 || route.link.expired()) {
+		sendError(this, hdr, EINVAL);
+		return;
+	}
+
+	route.protocol = msg->rtm_protocol;
+	route.type = msg->rtm_type;
+
+	if(route_changed)
+		ip6Router().addRoute(std::move(route));
+
+	if(hdr->nlmsg_flags & NLM_F_ACK)
+		sendAck(this, hdr);
+}
+
 void NetlinkSocket::getRoute(struct nlmsghdr *hdr) {
 	assert((hdr->nlmsg_flags & (NLM_F_REQUEST | NLM_F_MATCH)) == (NLM_F_REQUEST | NLM_F_MATCH));
 
@@ -189,14 +253,15 @@ void NetlinkSocket::getRoute(struct nlmsghdr *hdr) {
 		return;
 	}
 
-	assert(payload->rtgen_family == AF_UNSPEC || payload->rtgen_family == AF_INET);
-
 	// Loop over all ipv4 and ipv6 routes, and return them.
-	// TODO: also return ipv6 routes.
-	auto ipv4_router = ip4Router();
+	if(payload->rtgen_family == AF_UNSPEC || payload->rtgen_family == AF_INET) {
+		for(auto route : ip4Router().getRoutes())
+			sendRoutePacket(hdr, route);
+	}
 
-	for(auto route : ipv4_router.getRoutes()) {
-		sendRoutePacket(hdr, route);
+	if(payload->rtgen_family == AF_UNSPEC || payload->rtgen_family == AF_INET6) {
+		for(auto route : ip6Router().getRoutes())
+			sendRoute6Packet(hdr, route);
 	}
 
 	if(hdr->nlmsg_flags & NLM_F_DUMP)
@@ -229,6 +294,39 @@ void NetlinkSocket::newAddr(struct nlmsghdr *hdr) {
 		return;
 	}
 
+	if(msg->ifa_family == AF_INET6) {
+		std::optional<InetAddress> addr6;
+		for(auto &attr : *attrs) {
+			if(attr.type() == IFA_ADDRESS || attr.type() == IFA_LOCAL) {
+				if(auto opt = attr.data<in6_addr>())
+					addr6 = InetAddress::fromIp6(*opt);
+			}
+		}
+
+		if(!addr6 || addr6->isIp4() || prefix > 128) {
+			sendError(this, hdr, EINVAL);
+			return;
+		}
+
+		ip6().addAddress({*addr6, prefix}, nic);
+		Ip6Router::Route route{ {*addr6, prefix}, nic };
+		route.metric = 256;
+		route.protocol = RTPROT_KERNEL;
+		ip6Router().addRoute(std::move(route));
+
+		if(hdr->nlmsg_flags & NLM_F_ACK)
+			sendAck(this, hdr);
+
+		core::netlink::NetlinkBuilder b;
+		b.group(RTNLGRP_IPV6_IFADDR);
+		b.header(RTM_NEWADDR, 0, _currentSeq, 0);
+		b.message<struct ifaddrmsg>(*msg);
+		b.nlattr(IFA_ADDRESS, addr6->ip6());
+
+		broadcast(b.packet());
+		return;
+	}
+
 	for(auto &attr : *attrs) {
 		switch(attr.type()) {
 			case IFA_ADDRESS: {
@@ -324,6 +422,27 @@ void NetlinkSocket::deleteAddr(struct nlmsghdr *hdr) {
 		return;
 	}
 
+	if(msg->ifa_family == AF_INET6) {
+		std::optional<InetAddress> addr6;
+		for(auto &attr : *attrs) {
+			if(attr.type() == IFA_ADDRESS || attr.type() == IFA_LOCAL) {
+				if(auto opt = attr.data<in6_addr>())
+					addr6 = InetAddress::fromIp6(*opt);
+			}
+		}
+
+		auto nic_by_addr = addr6 ? ip6().getLink(*addr6) : nullptr;
+		if(!nic_by_addr || nic_by_addr->index() != nic->index()
+				|| !ip6().deleteAddress({*addr6, msg->ifa_prefixlen})) {
+			sendError(this, hdr, EINVAL);
+			return;
+		}
+
+		if(hdr->nlmsg_flags & NLM_F_ACK)
+			sendAck(this, hdr);
+		return;
+	}
+
 	for(auto attr : *attrs) {
 		switch(attr.type()) {
 			case IFA_ADDRESS: {
@@ -372,6 +491,9 @@ void NetlinkSocket::getNeighbor(struct nlmsghdr *hdr) {
 		sendNeighPacket(hdr, it->first, it->second);
 	}
 
+	for(auto &[addr, entry] : neigh6().getTable())
+		sendNeigh6Packet(hdr, addr, entry);
+
 	if(hdr->nlmsg_flags & NLM_F_DUMP)
 		sendDone(this, hdr);
 
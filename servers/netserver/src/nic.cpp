@@ -11,6 +11,8 @@
 
 #include "ip/arp.hpp"
 #include "ip/ip4.hpp"
+#include "ip/ip6.hpp"
+#include "ip/tcp4.hpp"
 #include "raw.hpp"
 
 namespace {
@@ -19,9 +21,76 @@ id_allocator<int> _allocator;
 
 std::unordered_map<std::string, id_allocator<int>> prefixedNames_;
 
+// Upper bound on the number of frames that runDevice() processes at once.
+constexpr size_t maxRxBatch = 64;
+// Number of idle buffers that an RxBufferPool keeps around.
+constexpr size_t maxFreeRxBuffers = 64;
+
+// Identifies the flow that an IP frame belongs to; zero for other frames.
+uint32_t flowOf(arch::dma_buffer_view frame, bool rawIp) {
+	auto bytes = reinterpret_cast<const uint8_t *>(frame.data());
+	size_t offset = 0;
+	uint16_t ethertype = 0;
+	if(!rawIp) {
+		if(frame.size() < 14)
+			return 0;
+		ethertype = bytes[12] << 8 | bytes[13];
+		offset = 14;
+	}else if(frame.size()) {
+		ethertype = (bytes[0] >> 4) == 6 ? nic::ETHER_TYPE_IP6 : nic::ETHER_TYPE_IP4;
+	}
+
+	// FNV-1a over the protocol, the addresses and (unless this is a non-first fragment) the ports.
+	auto ip = bytes + offset;
+	uint32_t hash = 2166136261;
+	auto mix = [&] (const uint8_t *p, size_t n) {
+		for(size_t i = 0; i < n; i++)
+			hash = (hash ^ p[i]) * 16777619;
+	};
+	if(ethertype == nic::ETHER_TYPE_IP4) {
+		if(frame.size() < offset + 20)
+			return 0;
+		size_t ihl = (ip[0] & 0xF) * 4;
+		mix(ip + 9, 1);
+		mix(ip + 12, 8);
+		if(!(ip[6] & 0x1F) && !ip[7] && frame.size() >= offset + ihl + 4)
+			mix(ip + ihl, 4);
+	}else if(ethertype == nic::ETHER_TYPE_IP6) {
+		if(frame.size() < offset + 40)
+			return 0;
+		// Extension headers are not followed; their flows only hash by address.
+		mix(ip + 6, 1);
+		mix(ip + 8, 32);
+		if((ip[6] == 6 || ip[6] == 17) && frame.size() >= offset + 44)
+			mix(ip + 40, 4);
+	}else{
+		return 0;
+	}
+	return hash;
+}
+
 } /* namespace */
 
 namespace nic {
+std::pair<FrameOwner, arch::dma_buffer_view> RxBufferPool::allocate() {
+	arch::dma_buffer buffer;
+	if(!free_.empty()) {
+		buffer = std::move(free_.back());
+		free_.pop_back();
+	}else{
+		buffer = arch::dma_buffer{dmaPool_, bufferSize_};
+	}
+
+	auto storage = new arch::dma_buffer{std::move(buffer)};
+	arch::dma_buffer_view view = *storage;
+	FrameOwner owner{storage, [pool = weak_from_this()] (arch::dma_buffer *p) {
+		if(auto self = pool.lock(); self && self->free_.size() < maxFreeRxBuffers)
+			self->free_.push_back(std::move(*p));
+		delete p;
+	}};
+	return {std::move(owner), view};
+}
+
 uint8_t &MacAddress::operator[](size_t idx) {
 	return mac_[idx];
 }
@@ -48,6 +117,33 @@ MacAddress Link::deviceMac() {
 	return mac_;
 }
 
+async::result<RxInfo> Link::receiveWithInfo(arch::dma_buffer_view frame) {
+	co_return RxInfo{.length = co_await receive(frame)};
+}
+
+async::result<void> Link::sendWithOffload(const arch::dma_buffer_view frame, TxOffload offload) {
+	// Callers must check offloads() first.
+	assert(!offload.needsChecksum && !offload.segmentSize);
+	co_await send(frame);
+}
+
+async::result<void> Link::transmit(arch::dma_buffer frame, TxOffload offload) {
+	if(offload.needsChecksum || offload.segmentSize)
+		co_await sendWithOffload(frame, offload);
+	else
+		co_await send(frame);
+}
+
+async::result<void> Link::receiveBatch(std::vector<RxFrame> &frames, size_t) {
+	if(!rxPool_)
+		rxPool_ = std::make_shared<RxBufferPool>(dmaPool(),
+				std::max(size_t{1514}, offloads_.maxReceiveSize));
+
+	auto [owner, buffer] = rxPool_->allocate();
+	auto info = co_await receiveWithInfo(buffer);
+	frames.push_back({std::move(owner), buffer.subview(0, info.length), info});
+}
+
 arch::dma_pool *Link::dmaPool() {
 	return dmaPool_;
 }
@@ -81,6 +177,9 @@ void Link::configureName(std::string prefix) {
 }
 
 std::string Link::name() {
+	if(loopback_)
+		return "lo";
+
 	/* if our fallback option of naming using the MAC fails, and no prefix is set, use `ethX` */
 	if(namePrefix_.empty() && !mac_)
 		configureName("eth");
@@ -139,40 +238,70 @@ unsigned int Link::iff_flags() {
 		flags |= IFF_BROADCAST;
 	if(l1_up_)
 		flags |= IFF_LOWER_UP;
+	if(loopback_)
+		flags |= IFF_LOOPBACK;
 
 	return flags;
 }
 
 async::detached runDevice(std::shared_ptr<nic::Link> dev) {
 	using namespace arch;
+	std::vector<RxFrame> frames;
+	frames.reserve(maxRxBatch);
+
 	while(true) {
-		dma_buffer frameBuffer { dev->dmaPool(), 1514 };
-		auto len = co_await dev->receive(frameBuffer);
-
-		if(!dev->rawIp()) {
-			auto capsule = frameBuffer.subview(14, len - 14);
-			auto data = reinterpret_cast<uint8_t*>(frameBuffer.data());
-			uint16_t ethertype = data[12] << 8 | data[13];
-			nic::MacAddress dstsrc[2];
-			std::memcpy(dstsrc, data, sizeof(dstsrc));
-
-			raw().feedPacket(frameBuffer.subview(0, len));
-
-			switch (ethertype) {
-			case ETHER_TYPE_IP4:
-				ip4().feedPacket(dstsrc[0], dstsrc[1],
-					std::move(frameBuffer), capsule, dev);
-				break;
-			case ETHER_TYPE_ARP:
-				neigh4().feedArp(dstsrc[0], capsule, dev);
-				break;
-			default:
-				break;
+		co_await dev->receiveBatch(frames, maxRxBatch);
+
+		// Handle the frames of each flow back to back. TCP then merges the in-order
+		// segments of a connection (see Tcp4::deliver_()) and handles them at once.
+		if(frames.size() > 1)
+			std::ranges::stable_sort(frames, {}, [&] (const RxFrame &frame) {
+				return flowOf(frame.data, dev->rawIp());
+			});
+
+		for(auto &frame : frames) {
+			auto len = frame.data.size();
+
+			if(!dev->rawIp()) {
+				if(len < 14)
+					continue;
+
+				auto capsule = frame.data.subview(14, len - 14);
+				auto data = reinterpret_cast<uint8_t*>(frame.data.data());
+				uint16_t ethertype = data[12] << 8 | data[13];
+				nic::MacAddress dstsrc[2];
+				std::memcpy(dstsrc, data, sizeof(dstsrc));
+
+				raw().feedPacket(frame.owner, frame.data);
+
+				switch (ethertype) {
+				case ETHER_TYPE_IP4:
+					ip4().feedPacket(dstsrc[0], dstsrc[1],
+						std::move(frame.owner), capsule, dev, frame.info.checksumValid);
+					break;
+				case ETHER_TYPE_IP6:
+					ip6().feedPacket(dstsrc[0], dstsrc[1],
+						std::move(frame.owner), capsule, dev, frame.info.checksumValid);
+					break;
+				case ETHER_TYPE_ARP:
+					neigh4().feedArp(dstsrc[0], capsule, dev);
+					break;
+				default:
+					break;
+				}
+			} else if (len && (reinterpret_cast<uint8_t *>(frame.data.data())[0] >> 4) == 6) {
+				ip6().feedPacket({}, {}, std::move(frame.owner), frame.data, dev,
+						frame.info.checksumValid);
+			} else {
+				ip4().feedPacket({}, {}, std::move(frame.owner), frame.data, dev,
+						frame.info.checksumValid);
 			}
-		} else {
-			dma_buffer_view capsule = frameBuffer;
-			ip4().feedPacket({}, {}, std::move(frameBuffer), capsule, dev);
 		}
+
+		tcp().flushCoalesced();
+
+		// Drops our references, which lets the NIC reuse the buffers.
+		frames.clear();
 	}
 }
 } // namespace nic
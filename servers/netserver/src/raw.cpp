@@ -1,6 +1,5 @@
 #include <arpa/inet.h>
 #include <async/execution.hpp>
-#include <core/bpf.hpp>
 #include <linux/filter.h>
 #include <linux/if_ether.h>
 #include <linux/if_packet.h>
@@ -25,19 +24,18 @@ managarm::fs::Errors Raw::serveSocket(helix::UniqueLane lane, int type, int prot
 	return managarm::fs::Errors::SUCCESS;
 }
 
-void Raw::feedPacket(arch::dma_buffer_view frame) {
+void Raw::feedPacket(nic::FrameOwner owner, arch::dma_buffer_view frame) {
 	for(auto s = sockets_.begin(); s != sockets_.end(); s++) {
 		size_t accept_bytes = SIZE_MAX;
 
 		if((*s)->filter_) {
-			Bpf bpf{(*s)->filter_.value()};
-			accept_bytes = bpf.run(frame);
+			accept_bytes = (*s)->filter_->run(frame);
 
 			if(!accept_bytes)
 				continue;
 		}
 
-		RawSocket::PacketInfo info{frame.size(), frame.subview(0, std::min(frame.size(), accept_bytes))};
+		RawSocket::PacketInfo info{frame.size(), owner, frame.subview(0, std::min(frame.size(), accept_bytes))};
 
 		(*s)->queue_.emplace(info);
 		(*s)->_inSeq = ++(*s)->_currentSeq;
@@ -124,16 +122,14 @@ async::result<frg::expected<protocols::fs::Error>> RawSocket::setSocketOption(vo
 	auto self = static_cast<RawSocket *>(obj);
 
 	if(layer == SOL_SOCKET && number == SO_ATTACH_FILTER) {
-		assert(optbuf.size() % sizeof(struct sock_filter) == 0);
-
 		if(self->filterLocked_)
 			co_return protocols::fs::Error::insufficientPermissions;
 
-		Bpf bpf{optbuf};
-		if(!bpf.validate())
+		auto bpf = Bpf::compile(optbuf);
+		if(!bpf)
 			co_return protocols::fs::Error::illegalArguments;
 
-		self->filter_ = optbuf;
+		self->filter_ = std::move(bpf);
 	} else if(layer == SOL_SOCKET && number == SO_DETACH_FILTER) {
 		if(self->filterLocked_)
 			co_return protocols::fs::Error::insufficientPermissions;
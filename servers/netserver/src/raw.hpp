@@ -3,6 +3,7 @@
 #include <arch/dma_pool.hpp>
 #include <async/recurring-event.hpp>
 #include <async/queue.hpp>
+#include <core/bpf.hpp>
 #include <helix/ipc.hpp>
 #include <netserver/nic.hpp>
 #include <protocols/fs/server.hpp>
@@ -12,7 +13,7 @@ struct RawSocket;
 
 struct Raw {
 	managarm::fs::Errors serveSocket(helix::UniqueLane lane, int type, int proto, int flags);
-	void feedPacket(arch::dma_buffer_view frame);
+	void feedPacket(nic::FrameOwner owner, arch::dma_buffer_view frame);
 
 private:
 	friend RawSocket;
@@ -60,12 +61,14 @@ private:
 	int proto [[maybe_unused]];
 	bool filterLocked_ = false;
 	bool packetAuxData_ = false;
-	std::optional<std::vector<char>> filter_ = std::nullopt;
+	std::optional<Bpf> filter_ = std::nullopt;
 
 	std::shared_ptr<nic::Link> link = {};
 
 	struct PacketInfo {
 		size_t len;
+		// Keeps view alive until the packet is received.
+		nic::FrameOwner owner;
 		arch::dma_buffer_view view;
 	};
 
@@ -0,0 +1,134 @@
+#include <assert.h>
+#include <iostream>
+
+#include <bragi/helpers-std.hpp>
+#include <hel.h>
+#include <hel-syscalls.h>
+#include <helix/ipc.hpp>
+
+#include "fs.bragi.hpp"
+#include "readiness.hpp"
+
+ReadinessTable &readinessTable() {
+	static ReadinessTable inst;
+	return inst;
+}
+
+ReadinessTable::ReadinessTable()
+: pendingEdges_(numSlots, 0), queued_(numSlots, false) {
+	size_t size = (numSlots * sizeof(protocols::fs::StatusPage) + 0xFFF) & ~size_t{0xFFF};
+	HelHandle handle;
+	HEL_CHECK(helAllocateMemory(size, 0, nullptr, &handle));
+	memory_ = helix::UniqueDescriptor{handle};
+	mapping_ = helix::Mapping{memory_, 0, size};
+
+	// Hand out low slots first.
+	freeSlots_.reserve(numSlots);
+	for(size_t i = numSlots; i > 0; i--)
+		freeSlots_.push_back(i - 1);
+}
+
+async::result<void> ReadinessTable::serveStream(helix::UniqueLane lane) {
+	while(true) {
+		auto [accept, recv_req] = co_await helix_ng::exchangeMsgs(
+			lane,
+			helix_ng::accept(
+				helix_ng::recvInline())
+		);
+		if(accept.error() == kHelErrEndOfLane)
+			co_return;
+		HEL_CHECK(accept.error());
+		HEL_CHECK(recv_req.error());
+
+		auto conversation = accept.descriptor();
+		auto req = bragi::parse_head_only<managarm::fs::ReadinessWaitRequest>(recv_req);
+		recv_req.reset();
+		if(!req) {
+			std::cout << "netserver: Rejecting request due to decoding failure" << std::endl;
+			continue;
+		}
+
+		// Slots that were released after their edges were queued have no pending edges.
+		std::vector<uint64_t> slots;
+		std::vector<uint32_t> edges;
+		while(true) {
+			while(!pendingQueue_.empty() && slots.size() < maxBatch) {
+				auto index = pendingQueue_.front();
+				pendingQueue_.pop_front();
+				queued_[index] = false;
+				if(!pendingEdges_[index])
+					continue;
+				slots.push_back(index);
+				edges.push_back(pendingEdges_[index]);
+				pendingEdges_[index] = 0;
+			}
+
+			if(!slots.empty())
+				break;
+			co_await pendingEvent_.async_wait();
+		}
+
+		managarm::fs::ReadinessWaitReply resp;
+		resp.set_error(managarm::fs::Errors::SUCCESS);
+		resp.set_slots(std::move(slots));
+		resp.set_edges(std::move(edges));
+
+		auto [send_head, send_tail] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadTail(resp, frg::stl_allocator{})
+		);
+		HEL_CHECK(send_head.error());
+		HEL_CHECK(send_tail.error());
+	}
+}
+
+ReadinessTable::Slot::~Slot() {
+	release();
+}
+
+frg::expected<protocols::fs::Error> ReadinessTable::Slot::acquire() {
+	assert(index_ == invalidIndex);
+	auto &table = readinessTable();
+	if(table.freeSlots_.empty())
+		return protocols::fs::Error::noSpaceLeft;
+	index_ = table.freeSlots_.back();
+	table.freeSlots_.pop_back();
+	return {};
+}
+
+void ReadinessTable::Slot::release() {
+	if(index_ == invalidIndex)
+		return;
+	auto &table = readinessTable();
+	table.pendingEdges_[index_] = 0;
+	table.freeSlots_.push_back(index_);
+	index_ = invalidIndex;
+}
+
+void ReadinessTable::Slot::publish(uint64_t sequence, int status, int edges) {
+	assert(index_ != invalidIndex);
+	auto &table = readinessTable();
+	auto page = reinterpret_cast<protocols::fs::StatusPage *>(table.mapping_.get()) + index_;
+
+	// Start the seqlock write.
+	auto seqlock = __atomic_load_n(&page->seqlock, __ATOMIC_RELAXED);
+	assert(!(seqlock & 1));
+	__atomic_store_n(&page->seqlock, seqlock + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	// Perform the actual update.
+	__atomic_store_n(&page->sequence, sequence, __ATOMIC_RELAXED);
+	__atomic_store_n(&page->status, status, __ATOMIC_RELAXED);
+
+	// Complete the seqlock write.
+	__atomic_store_n(&page->seqlock, seqlock + 2, __ATOMIC_RELEASE);
+
+	if(!edges)
+		return;
+	table.pendingEdges_[index_] |= edges;
+	if(!table.queued_[index_]) {
+		table.queued_[index_] = true;
+		table.pendingQueue_.push_back(index_);
+		table.pendingEvent_.raise();
+	}
+}
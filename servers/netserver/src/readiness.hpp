@@ -0,0 +1,77 @@
+#pragma once
+
+#include <deque>
+#include <stdint.h>
+#include <vector>
+
+#include <async/recurring-event.hpp>
+#include <async/result.hpp>
+#include <frg/expected.hpp>
+#include <helix/ipc.hpp>
+#include <helix/memory.hpp>
+#include <protocols/fs/common.hpp>
+#include <protocols/fs/defs.hpp>
+
+// Reports the readiness of sockets to posix in batches, which allows epoll to watch
+// many sockets without keeping one pollWait() request outstanding per socket.
+// Each watched socket owns one slot of a table of StatusPage structs that is shared
+// with posix. Sockets publish their poll status to the slot; edges are queued until
+// posix picks them up through a ReadinessWaitRequest on the readiness stream.
+struct ReadinessTable {
+	static constexpr size_t numSlots = 65536;
+	// Maximal number of slots that are reported per ReadinessWaitReply.
+	static constexpr size_t maxBatch = 1024;
+
+	// A slot of the table. Sockets acquire a slot when posix starts to watch them.
+	struct Slot {
+		Slot() = default;
+
+		Slot(const Slot &) = delete;
+
+		~Slot();
+
+		Slot &operator= (const Slot &) = delete;
+
+		explicit operator bool () const {
+			return index_ != invalidIndex;
+		}
+
+		uint64_t index() const {
+			return index_;
+		}
+
+		frg::expected<protocols::fs::Error> acquire();
+		void release();
+
+		// Updates the status in the table and queues the edges (if any) for posix.
+		void publish(uint64_t sequence, int status, int edges);
+
+	private:
+		static constexpr uint64_t invalidIndex = ~uint64_t{0};
+
+		uint64_t index_ = invalidIndex;
+	};
+
+	ReadinessTable();
+
+	helix::BorrowedDescriptor getMemory() {
+		return memory_;
+	}
+
+	// Serves ReadinessWaitRequests until posix closes the stream.
+	async::result<void> serveStream(helix::UniqueLane lane);
+
+private:
+	helix::UniqueDescriptor memory_;
+	helix::Mapping mapping_;
+
+	std::vector<uint64_t> freeSlots_;
+	// Edges that were not reported yet, indexed by slot.
+	std::vector<int> pendingEdges_;
+	// Slots that (potentially) have pending edges; queued_ avoids duplicate entries.
+	std::deque<uint64_t> pendingQueue_;
+	std::vector<bool> queued_;
+	async::recurring_event pendingEvent_;
+};
+
+ReadinessTable &readinessTable();
@@ -0,0 +1,901 @@
+#include <arpa/inet.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct IterationsPerSecondBenchmark {
+	using clock = std::chrono::high_resolution_clock;
+
+	void launchRepetition() {
+		ref_ = clock::now();
+	}
+
+	bool isRepetitionDone() {
+		auto elapsed = duration_cast<std::chrono::nanoseconds>(
+					std::chrono::high_resolution_clock::now() - ref_);
+		return elapsed.count() > 1'000'000'000;
+	}
+
+	void announceIterations(uint64_t iters) {
+		std::cout << "    " << iters << " iterations per second" << std::endl;
+		results_.push_back(iters);
+	}
+
+	void finalizeStatistics() {
+		double avg = 0;
+		for(uint64_t n : results_)
+			avg += n;
+		avg /= results_.size();
+
+		double var = 0;
+		for(uint64_t n : results_)
+			var += (n - avg) * (n - avg);
+		var /= results_.size();
+
+		std::cout << "    avg: " << static_cast<uint64_t>(avg)
+				<< ", std: " << static_cast<uint64_t>(sqrt(var)) << std::endl;
+	}
+
+private:
+	std::vector<double> results_;
+	std::chrono::time_point<clock> ref_;
+};
+
+bool makeTcpPair(int family, int fds[2]);
+
+// Registers numIdle socket pairs that never become readable, plus one pair
+// that is used for ping-pong. Measures how many readiness changes epoll can
+// deliver per second. This should be independent of numIdle.
+// AF_UNIX sockets are served by posix itself, AF_INET sockets by netserver.
+void doEpollBenchmark(int family, int numIdle, uint32_t flags) {
+	std::cout << "epoll ping-pong over " << (family == AF_UNIX ? "AF_UNIX" : "TCP")
+			<< ", " << numIdle << " idle sockets"
+			<< ((flags & EPOLLET) ? ", edge-triggered" : "") << std::endl;
+
+	auto makePair = [&] (int fds[2]) -> bool {
+		if(family == AF_UNIX) {
+			if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds)) {
+				std::cout << "    socketpair() failed: " << strerror(errno) << std::endl;
+				return false;
+			}
+			return true;
+		}
+		if(!makeTcpPair(family, fds))
+			return false;
+		for(int i = 0; i < 2; ++i) {
+			int one = 1;
+			int e = setsockopt(fds[i], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			assert(!e);
+		}
+		return true;
+	};
+
+	int epfd = epoll_create1(0);
+	assert(epfd >= 0);
+
+	std::vector<int> idleFds;
+	for(int i = 0; i < numIdle; i++) {
+		int fds[2];
+		if(!makePair(fds)) {
+			std::cout << "    giving up after " << i << " pairs" << std::endl;
+			break;
+		}
+
+		epoll_event evt;
+		memset(&evt, 0, sizeof(epoll_event));
+		evt.events = EPOLLIN | flags;
+		evt.data.u64 = i;
+		int e = epoll_ctl(epfd, EPOLL_CTL_ADD, fds[0], &evt);
+		assert(!e);
+
+		idleFds.push_back(fds[0]);
+		idleFds.push_back(fds[1]);
+	}
+
+	int active[2];
+	if(!makePair(active)) {
+		for(int fd : idleFds)
+			close(fd);
+		close(epfd);
+		return;
+	}
+
+	epoll_event evt;
+	memset(&evt, 0, sizeof(epoll_event));
+	evt.events = EPOLLIN | flags;
+	evt.data.u64 = static_cast<uint64_t>(-1);
+	int e = epoll_ctl(epfd, EPOLL_CTL_ADD, active[0], &evt);
+	assert(!e);
+
+	IterationsPerSecondBenchmark bench;
+	for(int k = 0; k < 5; ++k) {
+		uint64_t n = 0;
+		bench.launchRepetition();
+		while(!bench.isRepetitionDone()) {
+			for(int i = 0; i < 100; ++i) {
+				char c = 'x';
+				auto written = write(active[1], &c, 1);
+				assert(written == 1);
+
+				epoll_event events[16];
+				int pending = epoll_wait(epfd, events, 16, -1);
+				assert(pending == 1);
+				assert(events[0].data.u64 == static_cast<uint64_t>(-1));
+
+				auto read_bytes = read(active[0], &c, 1);
+				assert(read_bytes == 1);
+				++n;
+			}
+		}
+		bench.announceIterations(n);
+	}
+	bench.finalizeStatistics();
+
+	close(active[0]);
+	close(active[1]);
+	for(int fd : idleFds)
+		close(fd);
+	close(epfd);
+}
+
+constexpr size_t ioBlockSize = 4096;
+constexpr size_t ioFileBlocks = 256;
+
+int makeBenchmarkFile() {
+	char path[] = "/tmp/posix-bench-XXXXXX";
+	int fd = mkstemp(path);
+	assert(fd >= 0);
+	unlink(path);
+
+	std::vector<char> block(ioBlockSize, 'x');
+	for(size_t i = 0; i < ioFileBlocks; i++) {
+		auto written = write(fd, block.data(), ioBlockSize);
+		assert(written == static_cast<ssize_t>(ioBlockSize));
+	}
+	return fd;
+}
+
+// Reads 4 KiB blocks from a file using one pread() per block.
+void doPreadBenchmark() {
+	std::cout << "pread(), 4 KiB blocks" << std::endl;
+
+	int fd = makeBenchmarkFile();
+	std::vector<char> buffer(ioBlockSize);
+
+	IterationsPerSecondBenchmark bench;
+	for(int k = 0; k < 5; ++k) {
+		uint64_t n = 0;
+		bench.launchRepetition();
+		while(!bench.isRepetitionDone()) {
+			for(int i = 0; i < 100; ++i) {
+				auto result = pread(fd, buffer.data(), ioBlockSize,
+						(n % ioFileBlocks) * ioBlockSize);
+				assert(result == static_cast<ssize_t>(ioBlockSize));
+				++n;
+			}
+		}
+		bench.announceIterations(n);
+	}
+	bench.finalizeStatistics();
+
+	close(fd);
+}
+
+// Reads 4 KiB blocks from a file using io_uring, submitting batchSize SQEs
+// per io_uring_enter() call. Compare against doPreadBenchmark().
+void doIoUringBenchmark(unsigned int batchSize) {
+	std::cout << "io_uring, 4 KiB blocks, batches of " << batchSize << std::endl;
+
+	int fd = makeBenchmarkFile();
+	std::vector<char> buffer(batchSize * ioBlockSize);
+
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	int ringFd = syscall(__NR_io_uring_setup, batchSize, &params);
+	if(ringFd < 0) {
+		std::cout << "    io_uring_setup() failed: " << strerror(errno) << std::endl;
+		close(fd);
+		return;
+	}
+	assert(params.features & IORING_FEAT_SINGLE_MMAP);
+
+	size_t ringSize = std::max(params.sq_off.array + params.sq_entries * sizeof(uint32_t),
+			params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe));
+	auto ring = static_cast<char *>(mmap(nullptr, ringSize, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING));
+	assert(ring != MAP_FAILED);
+	size_t sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	auto sqes = static_cast<struct io_uring_sqe *>(mmap(nullptr, sqesSize,
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES));
+	assert(sqes != MAP_FAILED);
+
+	auto sqMask = *reinterpret_cast<unsigned int *>(ring + params.sq_off.ring_mask);
+	auto sqTail = reinterpret_cast<unsigned int *>(ring + params.sq_off.tail);
+	auto sqArray = reinterpret_cast<unsigned int *>(ring + params.sq_off.array);
+	auto cqMask = *reinterpret_cast<unsigned int *>(ring + params.cq_off.ring_mask);
+	auto cqHead = reinterpret_cast<unsigned int *>(ring + params.cq_off.head);
+	auto cqTail = reinterpret_cast<unsigned int *>(ring + params.cq_off.tail);
+	auto cqes = reinterpret_cast<struct io_uring_cqe *>(ring + params.cq_off.cqes);
+
+	IterationsPerSecondBenchmark bench;
+	for(int k = 0; k < 5; ++k) {
+		uint64_t n = 0;
+		bench.launchRepetition();
+		while(!bench.isRepetitionDone()) {
+			auto tail = *sqTail;
+			for(unsigned int i = 0; i < batchSize; ++i) {
+				auto index = (tail + i) & sqMask;
+				auto sqe = &sqes[index];
+				memset(sqe, 0, sizeof(struct io_uring_sqe));
+				sqe->opcode = IORING_OP_READ;
+				sqe->fd = fd;
+				sqe->addr = reinterpret_cast<uintptr_t>(buffer.data() + i * ioBlockSize);
+				sqe->len = ioBlockSize;
+				sqe->off = ((n + i) % ioFileBlocks) * ioBlockSize;
+				sqArray[index] = index;
+			}
+			std::atomic_ref{*sqTail}.store(tail + batchSize, std::memory_order_release);
+
+			int submitted = syscall(__NR_io_uring_enter, ringFd, batchSize, batchSize,
+					IORING_ENTER_GETEVENTS, nullptr, 0);
+			assert(submitted == static_cast<int>(batchSize));
+
+			auto head = *cqHead;
+			assert(std::atomic_ref{*cqTail}.load(std::memory_order_acquire) - head
+					>= batchSize);
+			for(unsigned int i = 0; i < batchSize; ++i) {
+				auto res = cqes[(head + i) & cqMask].res;
+				assert(res == static_cast<int>(ioBlockSize));
+			}
+			std::atomic_ref{*cqHead}.store(head + batchSize, std::memory_order_release);
+			n += batchSize;
+		}
+		bench.announceIterations(n);
+	}
+	bench.finalizeStatistics();
+
+	munmap(sqes, sqesSize);
+	munmap(ring, ringSize);
+	close(ringFd);
+	close(fd);
+}
+
+// Copies a file to /dev/null in 64 KiB chunks, either through a user buffer
+// (read() + write()) or without one (sendfile()).
+void doFileCopyBenchmark(bool useSendfile) {
+	std::cout << (useSendfile ? "sendfile()" : "read() + write()")
+			<< ", 64 KiB chunks" << std::endl;
+
+	constexpr size_t chunkSize = 0x10000;
+	int fd = makeBenchmarkFile();
+	int nullFd = open("/dev/null", O_WRONLY);
+	assert(nullFd >= 0);
+	std::vector<char> buffer(chunkSize);
+	constexpr size_t fileSize = ioFileBlocks * ioBlockSize;
+
+	IterationsPerSecondBenchmark bench;
+	for(int k = 0; k < 5; ++k) {
+		uint64_t n = 0;
+		bench.launchRepetition();
+		while(!bench.isRepetitionDone()) {
+			for(int i = 0; i < 100; ++i) {
+				off_t offset = (n * chunkSize) % fileSize;
+				if(useSendfile) {
+					auto sent = sendfile(nullFd, fd, &offset, chunkSize);
+					assert(sent == static_cast<ssize_t>(chunkSize));
+				}else{
+					auto result = pread(fd, buffer.data(), chunkSize, offset);
+					assert(result == static_cast<ssize_t>(chunkSize));
+					auto written = write(nullFd, buffer.data(), chunkSize);
+					assert(written == static_cast<ssize_t>(chunkSize));
+				}
+				++n;
+			}
+		}
+		bench.announceIterations(n);
+	}
+	bench.finalizeStatistics();
+
+	close(nullFd);
+	close(fd);
+}
+
+// Sequential reads from a block device, reported in MiB per second.
+// Intended to be run against a (virtio-blk) disk in QEMU.
+void doBlockReadBenchmark(const char *path) {
+	std::cout << "Sequential read() from " << path << ", 1 MiB chunks" << std::endl;
+
+	int fd = open(path, O_RDONLY);
+	if(fd < 0) {
+		std::cout << "    skipped: " << strerror(errno) << std::endl;
+		return;
+	}
+
+	constexpr size_t chunkSize = 0x100000;
+	off_t deviceSize = lseek(fd, 0, SEEK_END);
+	if(deviceSize < static_cast<off_t>(chunkSize)) {
+		std::cout << "    skipped: device too small" << std::endl;
+		close(fd);
+		return;
+	}
+	std::vector<char> buffer(chunkSize);
+
+	IterationsPerSecondBenchmark bench;
+	off_t offset = 0;
+	for(int k = 0; k < 5; ++k) {
+		uint64_t n = 0;
+		bench.launchRepetition();
+		while(!bench.isRepetitionDone()) {
+			if(offset + static_cast<off_t>(chunkSize) > deviceSize)
+				offset = 0;
+			auto result = pread(fd, buffer.data(), chunkSize, offset);
+			assert(result == static_cast<ssize_t>(chunkSize));
+			offset += chunkSize;
+			++n;
+		}
+		bench.announceIterations(n);
+	}
+	bench.finalizeStatistics();
+
+	close(fd);
+}
+
+// Random 4 KiB reads from a block device, reported in IOPS.
+// Intended to be run against a (NVMe) disk in QEMU.
+void doBlockRandomReadBenchmark(const char *path) {
+	std::cout << "Random pread() from " << path << ", 4 KiB blocks" << std::endl;
+
+	int fd = open(path, O_RDONLY);
+	if(fd < 0) {
+		std::cout << "    skipped: " << strerror(errno) << std::endl;
+		return;
+	}
+
+	constexpr size_t blockSize = 0x1000;
+	off_t numBlocks = lseek(fd, 0, SEEK_END) / blockSize;
+	if(!numBlocks) {
+		std::cout << "    skipped: device too small" << std::endl;
+		close(fd);
+		return;
+	}
+	char buffer[blockSize];
+
+	// Use a fixed seed such that runs are comparable.
+	uint64_t state = 0x9E3779B97F4A7C15;
+	IterationsPerSecondBenchmark bench;
+	for(int k = 0; k < 5; ++k) {
+		uint64_t n = 0;
+		bench.launchRepetition();
+		while(!bench.isRepetitionDone()) {
+			state ^= state << 13;
+			state ^= state >> 7;
+			state ^= state << 17;
+			off_t offset = (state % numBlocks) * blockSize;
+			auto result = pread(fd, buffer, blockSize, offset);
+			assert(result == static_cast<ssize_t>(blockSize));
+			++n;
+		}
+		bench.announceIterations(n);
+	}
+	bench.finalizeStatistics();
+
+	close(fd);
+}
+
+// Creates numFiles files in a single directory (reported as the time it takes),
+// then measures random stat() calls on them in lookups per second.
+// Intended to be run on a disk-backed file system (e.g., ext2 as the root file system).
+void doDirectoryLookupBenchmark(const char *path, int numFiles) {
+	std::cout << "stat() in a directory of " << numFiles << " files in " << path << std::endl;
+
+	if(mkdir(path, 0755)) {
+		std::cout << "    skipped: " << strerror(errno) << std::endl;
+		return;
+	}
+
+	auto fileName = [&] (int i) {
+		return std::string{path} + "/file-" + std::to_string(i);
+	};
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for(int i = 0; i < numFiles; ++i) {
+		int fd = open(fileName(i).c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+		assert(fd >= 0);
+		close(fd);
+	}
+	auto elapsed = duration_cast<std::chrono::milliseconds>(
+			std::chrono::high_resolution_clock::now() - start);
+	std::cout << "    created files in " << elapsed.count() << " ms" << std::endl;
+
+	// Use a fixed seed such that runs are comparable.
+	uint64_t state = 0x9E3779B97F4A7C15;
+	IterationsPerSecondBenchmark bench;
+	for(int k = 0; k < 5; ++k) {
+		uint64_t n = 0;
+		bench.launchRepetition();
+		while(!bench.isRepetitionDone()) {
+			state ^= state << 13;
+			state ^= state >> 7;
+			state ^= state << 17;
+			struct stat st;
+			int e = stat(fileName(state % numFiles).c_str(), &st);
+			assert(!e);
+			++n;
+		}
+		bench.announceIterations(n);
+	}
+	bench.finalizeStatistics();
+
+	for(int i = 0; i < numFiles; ++i) {
+		int e = unlink(fileName(i).c_str());
+		assert(!e);
+	}
+	int e = rmdir(path);
+	assert(!e);
+}
+
+// Writes numWriters files of the given size concurrently (from separate processes)
+// in 64 KiB chunks, reported in MiB per second.
+void doConcurrentWriteBenchmark(const char *path, int numWriters, size_t fileSize) {
+	std::cout << numWriters << " concurrent writers of " << (fileSize >> 20)
+			<< " MiB each in " << path << ", 64 KiB chunks" << std::endl;
+
+	if(mkdir(path, 0755)) {
+		std::cout << "    skipped: " << strerror(errno) << std::endl;
+		return;
+	}
+
+	auto fileName = [&] (int i) {
+		return std::string{path} + "/file-" + std::to_string(i);
+	};
+
+	constexpr size_t chunkSize = 0x10000;
+	auto start = std::chrono::high_resolution_clock::now();
+	std::vector<pid_t> children;
+	for(int i = 0; i < numWriters; ++i) {
+		auto pid = fork();
+		assert(pid >= 0);
+		if(!pid) {
+			std::vector<char> buffer(chunkSize, 'a' + i);
+			int fd = open(fileName(i).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			assert(fd >= 0);
+			for(size_t progress = 0; progress < fileSize; progress += chunkSize) {
+				auto result = write(fd, buffer.data(), chunkSize);
+				assert(result == static_cast<ssize_t>(chunkSize));
+			}
+			int e = fsync(fd);
+			assert(!e);
+			close(fd);
+			_exit(0);
+		}
+		children.push_back(pid);
+	}
+	for(auto pid : children) {
+		int status;
+		auto result = waitpid(pid, &status, 0);
+		assert(result == pid);
+		assert(WIFEXITED(status) && !WEXITSTATUS(status));
+	}
+	auto elapsed = duration_cast<std::chrono::microseconds>(
+			std::chrono::high_resolution_clock::now() - start);
+
+	auto total = numWriters * fileSize;
+	std::cout << "    " << (total >> 20) << " MiB in " << elapsed.count() / 1000 << " ms, "
+			<< static_cast<uint64_t>(total / std::max<double>(elapsed.count(), 1) * 1'000'000 / (1 << 20))
+			<< " MiB per second" << std::endl;
+
+	for(int i = 0; i < numWriters; ++i) {
+		int e = unlink(fileName(i).c_str());
+		assert(!e);
+	}
+	int e = rmdir(path);
+	assert(!e);
+}
+
+// Creates, renames and unlinks files in a single directory, reported in
+// iterations per second. Each repetition ends with sync() such that metadata
+// does not pile up across repetitions.
+void doMetadataBenchmark(const char *path) {
+	std::cout << "create() + rename() + unlink() in " << path << std::endl;
+
+	if(mkdir(path, 0755)) {
+		std::cout << "    skipped: " << strerror(errno) << std::endl;
+		return;
+	}
+
+	auto fileName = [&] (const char *prefix, uint64_t i) {
+		return std::string{path} + "/" + prefix + std::to_string(i);
+	};
+
+	IterationsPerSecondBenchmark bench;
+	for(int k = 0; k < 5; ++k) {
+		uint64_t n = 0;
+		bench.launchRepetition();
+		while(!bench.isRepetitionDone()) {
+			for(int i = 0; i < 100; ++i) {
+				int fd = open(fileName("a-", n + i).c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+				assert(fd >= 0);
+				close(fd);
+				int e = rename(fileName("a-", n + i).c_str(), fileName("b-", n + i).c_str());
+				assert(!e);
+			}
+			for(int i = 0; i < 100; ++i) {
+				int e = unlink(fileName("b-", n + i).c_str());
+				assert(!e);
+			}
+			n += 100;
+		}
+		sync();
+		bench.announceIterations(n);
+	}
+	bench.finalizeStatistics();
+
+	int e = rmdir(path);
+	assert(!e);
+}
+
+// Reads a file once from start to end in 128 KiB chunks, similar to cat.
+// The file should not be in the page cache yet, i.e., this should be the
+// first access to the file after boot.
+void doColdFileReadBenchmark(const char *path) {
+	std::cout << "Cold sequential read() of " << path << ", 128 KiB chunks" << std::endl;
+
+	int fd = open(path, O_RDONLY);
+	if(fd < 0) {
+		std::cout << "    skipped: " << strerror(errno) << std::endl;
+		return;
+	}
+
+	constexpr size_t chunkSize = 0x20000;
+	std::vector<char> buffer(chunkSize);
+
+	uint64_t total = 0;
+	auto start = std::chrono::high_resolution_clock::now();
+	while(true) {
+		auto result = read(fd, buffer.data(), chunkSize);
+		assert(result >= 0);
+		if(!result)
+			break;
+		total += result;
+	}
+	auto elapsed = duration_cast<std::chrono::microseconds>(
+			std::chrono::high_resolution_clock::now() - start);
+
+	std::cout << "    " << (total >> 20) << " MiB in " << elapsed.count() / 1000 << " ms, "
+			<< static_cast<uint64_t>(total / std::max<double>(elapsed.count(), 1) * 1'000'000 / (1 << 20))
+			<< " MiB per second" << std::endl;
+
+	close(fd);
+}
+
+// The TCP benchmarks rely on netserver to deliver FINs, e.g., readers wait
+// for EOF. If a connection is never torn down, fail the run instead of hanging.
+void armTcpWatchdog() {
+	signal(SIGALRM, [] (int) {
+		const char message[] = "    timed out waiting for TCP teardown\n";
+		auto result = write(STDOUT_FILENO, message, sizeof(message) - 1);
+		(void)result;
+		_exit(1);
+	});
+	alarm(300);
+}
+
+// Connects two TCP sockets over the loopback link. Returns false if the
+// address family is not supported.
+bool makeTcpPair(int family, int fds[2]) {
+	int listener = socket(family, SOCK_STREAM, 0);
+	if(listener < 0) {
+		std::cout << "    skipped: " << strerror(errno) << std::endl;
+		return false;
+	}
+
+	sockaddr_storage address{};
+	socklen_t length;
+	if(family == AF_INET) {
+		auto sin = reinterpret_cast<sockaddr_in *>(&address);
+		sin->sin_family = AF_INET;
+		sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		length = sizeof(sockaddr_in);
+	}else{
+		auto sin6 = reinterpret_cast<sockaddr_in6 *>(&address);
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_addr = in6addr_loopback;
+		length = sizeof(sockaddr_in6);
+	}
+
+	int e = bind(listener, reinterpret_cast<sockaddr *>(&address), length);
+	assert(!e);
+	e = listen(listener, 16);
+	assert(!e);
+	e = getsockname(listener, reinterpret_cast<sockaddr *>(&address), &length);
+	assert(!e);
+
+	fds[0] = socket(family, SOCK_STREAM, 0);
+	assert(fds[0] >= 0);
+	e = connect(fds[0], reinterpret_cast<sockaddr *>(&address), length);
+	assert(!e);
+	fds[1] = accept(listener, nullptr, nullptr);
+	assert(fds[1] >= 0);
+
+	close(listener);
+	return true;
+}
+
+// Streams data from a child process to its parent over a TCP connection on
+// the loopback link, in 64 KiB chunks. Returns the elapsed time in microseconds,
+// or -1 if the address family is not supported.
+int64_t streamOverTcp(int family, size_t size) {
+	int fds[2];
+	if(!makeTcpPair(family, fds))
+		return -1;
+	armTcpWatchdog();
+
+	constexpr size_t chunkSize = 0x10000;
+	auto start = std::chrono::high_resolution_clock::now();
+	auto pid = fork();
+	assert(pid >= 0);
+	if(!pid) {
+		close(fds[1]);
+		std::vector<char> buffer(chunkSize, 'x');
+		for(size_t progress = 0; progress < size; ) {
+			auto result = write(fds[0], buffer.data(), std::min(chunkSize, size - progress));
+			assert(result > 0);
+			progress += result;
+		}
+		// Sends a FIN after the data, the reader stops at EOF.
+		int e = shutdown(fds[0], SHUT_WR);
+		assert(!e);
+		close(fds[0]);
+		_exit(0);
+	}
+	close(fds[0]);
+
+	std::vector<char> buffer(chunkSize);
+	uint64_t total = 0;
+	while(true) {
+		auto result = read(fds[1], buffer.data(), chunkSize);
+		assert(result >= 0);
+		if(!result)
+			break;
+		total += result;
+	}
+	auto elapsed = duration_cast<std::chrono::microseconds>(
+			std::chrono::high_resolution_clock::now() - start);
+	assert(total == size);
+
+	int status;
+	auto result = waitpid(pid, &status, 0);
+	assert(result == pid);
+	assert(WIFEXITED(status) && !WEXITSTATUS(status));
+
+	close(fds[1]);
+	alarm(0);
+	return elapsed.count();
+}
+
+uint64_t mibPerSecond(size_t size, int64_t microseconds) {
+	return static_cast<uint64_t>(size / std::max<double>(microseconds, 1) * 1'000'000 / (1 << 20));
+}
+
+void doTcpThroughputBenchmark(int family, size_t size) {
+	std::cout << "TCP over " << (family == AF_INET ? "127.0.0.1" : "::1")
+			<< ", " << (size >> 20) << " MiB in 64 KiB chunks" << std::endl;
+
+	auto elapsed = streamOverTcp(family, size);
+	if(elapsed < 0)
+		return;
+
+	std::cout << "    " << (size >> 20) << " MiB in " << elapsed / 1000 << " ms, "
+			<< mibPerSecond(size, elapsed) << " MiB per second" << std::endl;
+}
+
+// Returns the value of the netserver.tcp-loss option on the kernel command line.
+unsigned int tcpLossOption() {
+	int fd = open("/proc/cmdline", O_RDONLY);
+	if(fd < 0)
+		return 0;
+	char buffer[4096];
+	auto result = read(fd, buffer, sizeof(buffer) - 1);
+	close(fd);
+	if(result <= 0)
+		return 0;
+	buffer[result] = 0;
+
+	auto option = strstr(buffer, "netserver.tcp-loss=");
+	if(!option)
+		return 0;
+	return strtoul(option + strlen("netserver.tcp-loss="), nullptr, 10);
+}
+
+// Repeats the loopback stream while netserver drops incoming TCP segments, which
+// exercises retransmissions, SACK-based recovery and congestion control. The loss
+// rate is set at boot time via netserver.tcp-loss (in 1/1000); combine it with
+// netserver.tcp-delay to emulate a WAN link. Throughput varies with the segments
+// that are dropped, hence we report the spread over several runs.
+void doTcpLossBenchmark(size_t size) {
+	auto loss = tcpLossOption();
+	std::cout << "TCP over 127.0.0.1 with " << loss << "/1000 segment loss, "
+			<< (size >> 20) << " MiB in 64 KiB chunks" << std::endl;
+	if(!loss) {
+		std::cout << "    skipped: boot with netserver.tcp-loss=<per mille>" << std::endl;
+		return;
+	}
+
+	std::vector<double> results;
+	for(int k = 0; k < 5; ++k) {
+		auto elapsed = streamOverTcp(AF_INET, size);
+		if(elapsed < 0)
+			return;
+		std::cout << "    " << (size >> 20) << " MiB in " << elapsed / 1000 << " ms, "
+				<< mibPerSecond(size, elapsed) << " MiB per second" << std::endl;
+		results.push_back(mibPerSecond(size, elapsed));
+	}
+
+	double avg = 0;
+	for(double n : results)
+		avg += n;
+	avg /= results.size();
+
+	double var = 0;
+	for(double n : results)
+		var += (n - avg) * (n - avg);
+	var /= results.size();
+
+	std::cout << "    avg: " << static_cast<uint64_t>(avg) << " MiB per second"
+			<< ", std: " << static_cast<uint64_t>(sqrt(var)) << std::endl;
+}
+
+// Bounces a single byte between two threads of execution over a TCP connection
+// on the loopback link. Each iteration is one round trip.
+void doTcpPingPongBenchmark() {
+	std::cout << "TCP ping-pong over 127.0.0.1, 1 byte" << std::endl;
+
+	int fds[2];
+	if(!makeTcpPair(AF_INET, fds))
+		return;
+	for(int i = 0; i < 2; ++i) {
+		int one = 1;
+		int e = setsockopt(fds[i], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		assert(!e);
+	}
+	armTcpWatchdog();
+
+	auto pid = fork();
+	assert(pid >= 0);
+	if(!pid) {
+		close(fds[0]);
+		char c;
+		while(read(fds[1], &c, 1) == 1) {
+			auto result = write(fds[1], &c, 1);
+			assert(result == 1);
+		}
+		_exit(0);
+	}
+	close(fds[1]);
+
+	IterationsPerSecondBenchmark bench;
+	for(int k = 0; k < 5; ++k) {
+		uint64_t n = 0;
+		bench.launchRepetition();
+		while(!bench.isRepetitionDone()) {
+			for(int i = 0; i < 100; ++i) {
+				char c = 'x';
+				auto result = write(fds[0], &c, 1);
+				assert(result == 1);
+				result = read(fds[0], &c, 1);
+				assert(result == 1);
+				++n;
+			}
+		}
+		bench.announceIterations(n);
+	}
+	bench.finalizeStatistics();
+
+	// The echo loop exits once it reads the FIN.
+	int e = shutdown(fds[0], SHUT_WR);
+	assert(!e);
+	int status;
+	auto result = waitpid(pid, &status, 0);
+	assert(result == pid);
+	close(fds[0]);
+	alarm(0);
+}
+
+// Sets up and tears down TCP connections on the loopback link, including the
+// accept() on the listening side.
+void doTcpConnectBenchmark() {
+	std::cout << "TCP connect() + accept() + close() over 127.0.0.1" << std::endl;
+
+	IterationsPerSecondBenchmark bench;
+	for(int k = 0; k < 5; ++k) {
+		uint64_t n = 0;
+		bench.launchRepetition();
+		while(!bench.isRepetitionDone()) {
+			for(int i = 0; i < 10; ++i) {
+				int fds[2];
+				if(!makeTcpPair(AF_INET, fds))
+					return;
+				close(fds[0]);
+				close(fds[1]);
+				++n;
+			}
+		}
+		bench.announceIterations(n);
+	}
+	bench.finalizeStatistics();
+}
+
+} // anonymous namespace
+
+int main() {
+	// Make sure that we can open enough file descriptors.
+	struct rlimit limit;
+	int e = getrlimit(RLIMIT_NOFILE, &limit);
+	assert(!e);
+	limit.rlim_cur = limit.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &limit);
+	e = getrlimit(RLIMIT_NOFILE, &limit);
+	assert(!e);
+
+	// Each idle socket pair consumes two file descriptors.
+	int numIdle = 10'000;
+	if(limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < 2 * 10'000 + 16)
+		numIdle = (limit.rlim_cur - 16) / 2;
+
+	doEpollBenchmark(AF_UNIX, 0, 0);
+	doEpollBenchmark(AF_UNIX, numIdle, 0);
+	doEpollBenchmark(AF_UNIX, numIdle, EPOLLET);
+	// Setting up TCP connections is slower; 1000 idle connections suffice to show the scaling.
+	doEpollBenchmark(AF_INET, 0, 0);
+	doEpollBenchmark(AF_INET, std::min(numIdle, 1'000), 0);
+	doEpollBenchmark(AF_INET, std::min(numIdle, 1'000), EPOLLET);
+
+	doPreadBenchmark();
+	doIoUringBenchmark(1);
+	doIoUringBenchmark(32);
+
+	doFileCopyBenchmark(false);
+	doFileCopyBenchmark(true);
+
+	doBlockReadBenchmark("/dev/sda");
+	doBlockRandomReadBenchmark("/dev/nvme0n1");
+
+	doDirectoryLookupBenchmark("/posix-bench-dir", 100'000);
+
+	doColdFileReadBenchmark("/root/bigfile");
+
+	doConcurrentWriteBenchmark("/posix-bench-writers", 4, 64 << 20);
+
+	doMetadataBenchmark("/posix-bench-metadata");
+
+	doTcpThroughputBenchmark(AF_INET, 256 << 20);
+	doTcpThroughputBenchmark(AF_INET6, 256 << 20);
+	doTcpLossBenchmark(32 << 20);
+	doTcpPingPongBenchmark();
+	doTcpConnectBenchmark();
+}
@@ -0,0 +1,129 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#include "testsuite.hpp"
+
+// TODO: mlibc has no sysdeps for sendfile() and copy_file_range() on managarm yet.
+//       Enable these tests once it does.
+#if defined(__linux__)
+
+namespace {
+
+// Creates an unlinked temporary file that contains size bytes of a known pattern.
+int makeFile(size_t size) {
+	char path[] = "/tmp/copy-range-XXXXXX";
+	int fd = mkstemp(path);
+	assert(fd >= 0);
+	unlink(path);
+
+	std::vector<char> data(size);
+	for(size_t i = 0; i < size; i++)
+		data[i] = 'a' + (i % 26);
+	ssize_t written = write(fd, data.data(), size);
+	assert(written == static_cast<ssize_t>(size));
+	return fd;
+}
+
+} // anonymous namespace
+
+DEFINE_TEST(sendfile_to_socket, ([] {
+	// Make the file span multiple pages.
+	constexpr size_t size = 3 * 4096 + 100;
+	int fd = makeFile(size);
+
+	int sv[2];
+	int ret = socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+	assert(!ret);
+
+	// With an explicit offset, the file position is not changed.
+	off_t offset = 4000;
+	ssize_t sent = sendfile(sv[0], fd, &offset, 200);
+	assert(sent == 200);
+	assert(offset == 4200);
+	assert(lseek(fd, 0, SEEK_CUR) == static_cast<off_t>(size));
+
+	char buffer[200];
+	ssize_t received = recv(sv[1], buffer, sizeof(buffer), MSG_WAITALL);
+	assert(received == 200);
+	for(size_t i = 0; i < 200; i++)
+		assert(buffer[i] == 'a' + ((4000 + i) % 26));
+
+	// Without an offset, the file position is used and advanced.
+	off_t position = lseek(fd, size - 50, SEEK_SET);
+	assert(position == static_cast<off_t>(size - 50));
+	sent = sendfile(sv[0], fd, nullptr, 1000);
+	assert(sent == 50);
+	assert(lseek(fd, 0, SEEK_CUR) == static_cast<off_t>(size));
+	received = recv(sv[1], buffer, 50, MSG_WAITALL);
+	assert(received == 50);
+	for(size_t i = 0; i < 50; i++)
+		assert(buffer[i] == 'a' + ((size - 50 + i) % 26));
+
+	// At EOF, nothing is transferred.
+	sent = sendfile(sv[0], fd, nullptr, 1000);
+	assert(!sent);
+
+	// The input must be open for reading and the output for writing.
+	int fds[2];
+	ret = pipe(fds);
+	assert(!ret);
+	sent = sendfile(fds[0], fd, &offset, 10);
+	assert(sent == -1);
+	assert(errno == EBADF);
+	sent = sendfile(sv[0], fds[1], nullptr, 10);
+	assert(sent == -1);
+	assert(errno == EBADF);
+
+	close(fds[0]);
+	close(fds[1]);
+	close(sv[0]);
+	close(sv[1]);
+	close(fd);
+}))
+
+DEFINE_TEST(copy_file_range_regular, ([] {
+	constexpr size_t size = 2 * 4096;
+	int in = makeFile(size);
+	int out = makeFile(0);
+
+	off_t inOffset = 10;
+	off_t outOffset = 0;
+	ssize_t copied = copy_file_range(in, &inOffset, out, &outOffset, size, 0);
+	assert(copied == static_cast<ssize_t>(size - 10));
+	assert(inOffset == static_cast<off_t>(size));
+	assert(outOffset == static_cast<off_t>(size - 10));
+
+	std::vector<char> buffer(size);
+	ssize_t read_bytes = pread(out, buffer.data(), size, 0);
+	assert(read_bytes == static_cast<ssize_t>(size - 10));
+	for(size_t i = 0; i < size - 10; i++)
+		assert(buffer[i] == 'a' + ((10 + i) % 26));
+
+	// Overlapping ranges within the same file are rejected.
+	inOffset = 0;
+	outOffset = 100;
+	copied = copy_file_range(in, &inOffset, in, &outOffset, 200, 0);
+	assert(copied == -1);
+	assert(errno == EINVAL);
+
+	// Non-regular files are rejected.
+	int fds[2];
+	int ret = pipe(fds);
+	assert(!ret);
+	copied = copy_file_range(in, nullptr, fds[1], nullptr, 10, 0);
+	assert(copied == -1);
+	assert(errno == EINVAL);
+
+	close(fds[0]);
+	close(fds[1]);
+	close(in);
+	close(out);
+}))
+
+#endif
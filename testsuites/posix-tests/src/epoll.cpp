@@ -144,3 +144,90 @@ DEFINE_TEST(epoll_edge_triggered, ([] {
 	close(epfd);
 	close(fd);
 }));
+
+DEFINE_TEST(epoll_pipe_edge_triggered, ([] {
+	int fds[2];
+	int e = pipe(fds);
+	assert(!e);
+
+	int epfd = epoll_create1(0);
+	assert(epfd >= 0);
+
+	epoll_event evt;
+	memset(&evt, 0, sizeof(epoll_event));
+	evt.events = EPOLLIN | EPOLLET;
+	e = epoll_ctl(epfd, EPOLL_CTL_ADD, fds[0], &evt);
+	assert(!e);
+
+	int pending = epoll_wait(epfd, &evt, 1, 0);
+	assert(!pending);
+
+	// Every write is an edge, even if the pipe was readable before.
+	for(int i = 0; i < 3; i++) {
+		char c = 'x';
+		auto written = write(fds[1], &c, 1);
+		assert(written == 1);
+
+		memset(&evt, 0, sizeof(epoll_event));
+		pending = epoll_wait(epfd, &evt, 1, 0);
+		assert(pending == 1);
+		assert(evt.events & EPOLLIN);
+
+		pending = epoll_wait(epfd, &evt, 1, 0);
+		assert(!pending);
+	}
+
+	// Closing the write end is an edge as well.
+	close(fds[1]);
+	memset(&evt, 0, sizeof(epoll_event));
+	pending = epoll_wait(epfd, &evt, 1, 0);
+	assert(pending == 1);
+	assert(evt.events & EPOLLHUP);
+
+	close(epfd);
+	close(fds[0]);
+}));
+
+DEFINE_TEST(epoll_exclusive, ([] {
+	int e;
+	int pending;
+
+	int fd = eventfd(0, EFD_NONBLOCK);
+	assert(fd >= 0);
+
+	int epfds[2];
+	for(int i = 0; i < 2; i++) {
+		epfds[i] = epoll_create1(0);
+		assert(epfds[i] >= 0);
+
+		epoll_event evt;
+		memset(&evt, 0, sizeof(epoll_event));
+		evt.events = EPOLLIN | EPOLLEXCLUSIVE;
+		e = epoll_ctl(epfds[i], EPOLL_CTL_ADD, fd, &evt);
+		assert(!e);
+	}
+
+	// EPOLLEXCLUSIVE items cannot be modified.
+	epoll_event evt;
+	memset(&evt, 0, sizeof(epoll_event));
+	evt.events = EPOLLIN;
+	e = epoll_ctl(epfds[0], EPOLL_CTL_MOD, fd, &evt);
+	assert(e == -1);
+	assert(errno == EINVAL);
+
+	uint64_t n = 1;
+	auto written = write(fd, &n, sizeof(uint64_t));
+	assert(written == sizeof(uint64_t));
+
+	// Without blocked waiters, the edge is delivered to all instances.
+	for(int i = 0; i < 2; i++) {
+		memset(&evt, 0, sizeof(epoll_event));
+		pending = epoll_wait(epfds[i], &evt, 1, 0);
+		assert(pending == 1);
+		assert(evt.events & EPOLLIN);
+	}
+
+	close(epfds[0]);
+	close(epfds[1]);
+	close(fd);
+}));
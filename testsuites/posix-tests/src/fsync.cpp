@@ -0,0 +1,125 @@
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "testsuite.hpp"
+
+// The files live on the root file system (rather than on the tmpfs in /tmp)
+// such that syncing actually writes them back to the disk.
+
+DEFINE_TEST(fsync_regular, ([] {
+	char path[] = "/posix-testsuite-fsync-XXXXXX";
+	int fd = mkstemp(path);
+	assert(fd >= 0);
+	unlink(path);
+
+	const char data[] = "durable";
+	ssize_t written = write(fd, data, sizeof(data));
+	assert(written == sizeof(data));
+
+	int ret = fsync(fd);
+	assert(!ret);
+	ret = fdatasync(fd);
+	assert(!ret);
+	ret = syncfs(fd);
+	assert(!ret);
+
+	// Syncing does not change the contents or the file position.
+	assert(lseek(fd, 0, SEEK_CUR) == sizeof(data));
+	char buffer[sizeof(data)];
+	ssize_t read_bytes = pread(fd, buffer, sizeof(buffer), 0);
+	assert(read_bytes == sizeof(data));
+	assert(!memcmp(buffer, data, sizeof(data)));
+
+	close(fd);
+}))
+
+DEFINE_TEST(fsync_reopen, ([] {
+	char path[] = "/posix-testsuite-fsync-XXXXXX";
+	int fd = mkstemp(path);
+	assert(fd >= 0);
+
+	// Write more than a page such that the data spans multiple pages of the cache.
+	char data[3 * 4096];
+	for(size_t i = 0; i < sizeof(data); i++)
+		data[i] = static_cast<char>(i * 7);
+	ssize_t written = write(fd, data, sizeof(data));
+	assert(written == sizeof(data));
+
+	int ret = fsync(fd);
+	assert(!ret);
+	close(fd);
+
+	// The data is visible through a new open file description.
+	fd = open(path, O_RDONLY);
+	assert(fd >= 0);
+	char buffer[sizeof(data)];
+	ssize_t read_bytes = read(fd, buffer, sizeof(buffer));
+	assert(read_bytes == sizeof(data));
+	assert(!memcmp(buffer, data, sizeof(data)));
+
+	struct stat st;
+	ret = fstat(fd, &st);
+	assert(!ret);
+	assert(st.st_size == sizeof(data));
+
+	close(fd);
+	unlink(path);
+}))
+
+DEFINE_TEST(fsync_shared_mapping, ([] {
+	char path[] = "/posix-testsuite-fsync-XXXXXX";
+	int fd = mkstemp(path);
+	assert(fd >= 0);
+
+	const size_t size = 2 * 4096;
+	int ret = ftruncate(fd, size);
+	assert(!ret);
+
+	auto map = static_cast<char *>(mmap(nullptr, size, PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0));
+	assert(map != MAP_FAILED);
+
+	// Stores through the mapping are only known to the file system after fsync().
+	for(size_t i = 0; i < size; i++)
+		map[i] = static_cast<char>(i * 13);
+	ret = fsync(fd);
+	assert(!ret);
+
+	ret = munmap(map, size);
+	assert(!ret);
+	close(fd);
+
+	fd = open(path, O_RDONLY);
+	assert(fd >= 0);
+	char buffer[size];
+	ssize_t read_bytes = pread(fd, buffer, size, 0);
+	assert(read_bytes == static_cast<ssize_t>(size));
+	for(size_t i = 0; i < size; i++)
+		assert(buffer[i] == static_cast<char>(i * 13));
+
+	close(fd);
+	unlink(path);
+}))
+
+DEFINE_TEST(fsync_pipe, ([] {
+	int fds[2];
+	int ret = pipe(fds);
+	assert(!ret);
+
+	// Pipes cannot be synchronized.
+	ret = fsync(fds[0]);
+	assert(ret == -1);
+	assert(errno == EINVAL);
+
+	ret = fsync(-1);
+	assert(ret == -1);
+	assert(errno == EBADF);
+
+	close(fds[0]);
+	close(fds[1]);
+}))
@@ -0,0 +1,276 @@
+#include <algorithm>
+#include <assert.h>
+#include <atomic>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "testsuite.hpp"
+
+// TODO: mlibc has no sysdeps for io_uring_setup() and io_uring_enter() on managarm yet.
+//       Enable these tests once it does.
+#if defined(__linux__)
+
+namespace {
+
+struct Ring {
+	Ring(unsigned int entries) {
+		struct io_uring_params params;
+		memset(&params, 0, sizeof(params));
+		fd = syscall(__NR_io_uring_setup, entries, &params);
+		assert(fd >= 0);
+		assert(params.features & IORING_FEAT_SINGLE_MMAP);
+
+		sqEntries = params.sq_entries;
+		cqEntries = params.cq_entries;
+		assert(sqEntries == entries);
+		assert(cqEntries == 2 * entries);
+
+		ringSize = std::max(params.sq_off.array + params.sq_entries * sizeof(uint32_t),
+				params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe));
+		ring = static_cast<char *>(mmap(nullptr, ringSize, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING));
+		assert(ring != MAP_FAILED);
+		sqes = static_cast<struct io_uring_sqe *>(mmap(nullptr,
+				params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+		assert(sqes != MAP_FAILED);
+
+		sqTail = reinterpret_cast<unsigned int *>(ring + params.sq_off.tail);
+		sqArray = reinterpret_cast<unsigned int *>(ring + params.sq_off.array);
+		cqHead = reinterpret_cast<unsigned int *>(ring + params.cq_off.head);
+		cqTail = reinterpret_cast<unsigned int *>(ring + params.cq_off.tail);
+		cqes = reinterpret_cast<struct io_uring_cqe *>(ring + params.cq_off.cqes);
+	}
+
+	~Ring() {
+		munmap(sqes, sqEntries * sizeof(struct io_uring_sqe));
+		munmap(ring, ringSize);
+		close(fd);
+	}
+
+	struct io_uring_sqe *nextSqe() {
+		auto tail = *sqTail + pending;
+		auto sqe = &sqes[tail & (sqEntries - 1)];
+		memset(sqe, 0, sizeof(*sqe));
+		sqArray[tail & (sqEntries - 1)] = tail & (sqEntries - 1);
+		pending++;
+		return sqe;
+	}
+
+	// Submits all pending SQEs and waits for minComplete CQEs.
+	int submitAndWait(unsigned int minComplete) {
+		std::atomic_ref{*sqTail}.store(*sqTail + pending, std::memory_order_release);
+		auto n = pending;
+		pending = 0;
+		int ret = syscall(__NR_io_uring_enter, fd, n, minComplete,
+				minComplete ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+		assert(ret == static_cast<int>(n));
+		return ret;
+	}
+
+	unsigned int completionsReady() {
+		return std::atomic_ref{*cqTail}.load(std::memory_order_acquire) - *cqHead;
+	}
+
+	struct io_uring_cqe popCqe() {
+		assert(completionsReady());
+		auto cqe = cqes[*cqHead & (cqEntries - 1)];
+		std::atomic_ref{*cqHead}.store(*cqHead + 1, std::memory_order_release);
+		return cqe;
+	}
+
+	int fd;
+	unsigned int sqEntries;
+	unsigned int cqEntries;
+	size_t ringSize;
+	char *ring;
+	struct io_uring_sqe *sqes;
+	unsigned int *sqTail;
+	unsigned int *sqArray;
+	unsigned int *cqHead;
+	unsigned int *cqTail;
+	struct io_uring_cqe *cqes;
+	unsigned int pending = 0;
+};
+
+} // anonymous namespace
+
+DEFINE_TEST(io_uring_nop, ([] {
+	Ring ring{8};
+
+	for(int i = 0; i < 4; i++) {
+		auto sqe = ring.nextSqe();
+		sqe->opcode = IORING_OP_NOP;
+		sqe->user_data = 100 + i;
+	}
+	ring.submitAndWait(4);
+	assert(ring.completionsReady() == 4);
+
+	// NOPs may complete in any order.
+	uint64_t seen = 0;
+	for(int i = 0; i < 4; i++) {
+		auto cqe = ring.popCqe();
+		assert(cqe.res == 0);
+		assert(cqe.user_data >= 100 && cqe.user_data < 104);
+		seen |= 1 << (cqe.user_data - 100);
+	}
+	assert(seen == 0xF);
+}))
+
+DEFINE_TEST(io_uring_pipe_read_write, ([] {
+	Ring ring{8};
+
+	int fds[2];
+	int ret = pipe(fds);
+	assert(!ret);
+
+	// Submit the read first, such that it has to wait for the write.
+	char buffer[16]{};
+	auto sqe = ring.nextSqe();
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = fds[0];
+	sqe->addr = reinterpret_cast<uintptr_t>(buffer);
+	sqe->len = sizeof(buffer);
+	sqe->off = -1;
+	sqe->user_data = 1;
+	ring.submitAndWait(0);
+	assert(!ring.completionsReady());
+
+	const char *message = "hello";
+	sqe = ring.nextSqe();
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->fd = fds[1];
+	sqe->addr = reinterpret_cast<uintptr_t>(message);
+	sqe->len = 5;
+	sqe->off = -1;
+	sqe->user_data = 2;
+	ring.submitAndWait(2);
+
+	for(int i = 0; i < 2; i++) {
+		auto cqe = ring.popCqe();
+		assert(cqe.res == 5);
+		assert(cqe.user_data == 1 || cqe.user_data == 2);
+	}
+	assert(!memcmp(buffer, "hello", 5));
+
+	close(fds[0]);
+	close(fds[1]);
+}))
+
+DEFINE_TEST(io_uring_readv_file, ([] {
+	Ring ring{4};
+
+	char path[] = "/tmp/io-uring-XXXXXX";
+	int fd = mkstemp(path);
+	assert(fd >= 0);
+	unlink(path);
+	ssize_t written = write(fd, "0123456789", 10);
+	assert(written == 10);
+
+	char a[4]{}, b[4]{};
+	struct iovec iovs[2] = {{a, 3}, {b, 4}};
+	auto sqe = ring.nextSqe();
+	sqe->opcode = IORING_OP_READV;
+	sqe->fd = fd;
+	sqe->addr = reinterpret_cast<uintptr_t>(iovs);
+	sqe->len = 2;
+	sqe->off = 2;
+	ring.submitAndWait(1);
+
+	auto cqe = ring.popCqe();
+	assert(cqe.res == 7);
+	assert(!memcmp(a, "234", 3));
+	assert(!memcmp(b, "5678", 4));
+
+	// Errors are reported in the CQE.
+	sqe = ring.nextSqe();
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = 12345;
+	sqe->addr = reinterpret_cast<uintptr_t>(a);
+	sqe->len = 1;
+	ring.submitAndWait(1);
+	cqe = ring.popCqe();
+	assert(cqe.res == -EBADF);
+
+	// Overwrites within the file go straight to the page cache.
+	sqe = ring.nextSqe();
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->fd = fd;
+	sqe->addr = reinterpret_cast<uintptr_t>("ab");
+	sqe->len = 2;
+	sqe->off = 8;
+	ring.submitAndWait(1);
+	cqe = ring.popCqe();
+	assert(cqe.res == 2);
+
+	// Writes beyond the end of the file extend it.
+	sqe = ring.nextSqe();
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->fd = fd;
+	sqe->addr = reinterpret_cast<uintptr_t>("cd");
+	sqe->len = 2;
+	sqe->off = 10;
+	ring.submitAndWait(1);
+	cqe = ring.popCqe();
+	assert(cqe.res == 2);
+
+	char c[12]{};
+	assert(pread(fd, c, sizeof(c), 0) == 12);
+	assert(!memcmp(c, "01234567abcd", 12));
+
+	close(fd);
+}))
+
+DEFINE_TEST(io_uring_timeout_poll, ([] {
+	Ring ring{4};
+
+	int fds[2];
+	int ret = pipe(fds);
+	assert(!ret);
+
+	auto sqe = ring.nextSqe();
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fds[0];
+	sqe->poll32_events = POLLIN;
+	sqe->user_data = 1;
+
+	struct __kernel_timespec ts{.tv_sec = 0, .tv_nsec = 10'000'000};
+	sqe = ring.nextSqe();
+	sqe->opcode = IORING_OP_TIMEOUT;
+	sqe->addr = reinterpret_cast<uintptr_t>(&ts);
+	sqe->len = 1;
+	sqe->user_data = 2;
+	ring.submitAndWait(1);
+
+	// The timeout fires while the poll is still pending.
+	auto cqe = ring.popCqe();
+	assert(cqe.user_data == 2);
+	assert(cqe.res == -ETIME);
+	assert(!ring.completionsReady());
+
+	ssize_t written = write(fds[1], "x", 1);
+	assert(written == 1);
+	ring.submitAndWait(1);
+	cqe = ring.popCqe();
+	assert(cqe.user_data == 1);
+	assert(cqe.res & POLLIN);
+
+	// Close the pipe through the ring.
+	sqe = ring.nextSqe();
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->fd = fds[0];
+	ring.submitAndWait(1);
+	cqe = ring.popCqe();
+	assert(cqe.res == 0);
+	assert(fcntl(fds[0], F_GETFD) == -1 && errno == EBADF);
+
+	close(fds[1]);
+}))
+
+#endif
@@ -2,7 +2,9 @@
 #include <cstring>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <poll.h>
 
@@ -53,3 +55,152 @@ DEFINE_TEST(fifo_rw, ([] {
 	assert(close(fd) == 0);
 	assert(unlink("/tmp/posix-testsuite-fifo") == 0);
 }))
+
+// TODO: mlibc has no sysdeps for F_SETPIPE_SZ, splice(), tee() and vmsplice()
+//       on managarm yet. Enable these tests once it does.
+#if defined(__linux__)
+
+DEFINE_TEST(pipe_size, ([] {
+	int fds[2];
+	int e = pipe2(fds, O_NONBLOCK);
+	assert(!e);
+
+	assert(fcntl(fds[0], F_GETPIPE_SZ) == 65536);
+	assert(fcntl(fds[1], F_SETPIPE_SZ, 5000) == 8192);
+	assert(fcntl(fds[0], F_GETPIPE_SZ) == 8192);
+
+	// Fill the pipe until it applies backpressure.
+	char buf[4096];
+	memset(buf, 'x', sizeof(buf));
+	size_t total = 0;
+	while(true) {
+		ssize_t n = write(fds[1], buf, sizeof(buf));
+		if(n < 0) {
+			assert(errno == EAGAIN);
+			break;
+		}
+		total += n;
+	}
+	assert(total == 8192);
+
+	pollfd pfd;
+	memset(&pfd, 0, sizeof(pollfd));
+	pfd.fd = fds[1];
+	pfd.events = POLLOUT;
+	e = poll(&pfd, 1, 0);
+	assert(e == 0);
+
+	// The buffered data does not fit into a single page.
+	assert(fcntl(fds[1], F_SETPIPE_SZ, 4096) == -1);
+	assert(errno == EBUSY);
+
+	close(fds[0]);
+	close(fds[1]);
+}))
+
+DEFINE_TEST(pipe_buf_atomic, ([] {
+	int fds[2];
+	int e = pipe2(fds, O_NONBLOCK);
+	assert(!e);
+	assert(fcntl(fds[1], F_SETPIPE_SZ, 4096) == 4096);
+
+	char buf[PIPE_BUF];
+	memset(buf, 'x', sizeof(buf));
+	assert(write(fds[1], buf, 100) == 100);
+
+	// Writes of at most PIPE_BUF bytes are never split.
+	assert(write(fds[1], buf, PIPE_BUF) == -1);
+	assert(errno == EAGAIN);
+
+	assert(read(fds[0], buf, 100) == 100);
+	assert(write(fds[1], buf, PIPE_BUF) == PIPE_BUF);
+
+	close(fds[0]);
+	close(fds[1]);
+}))
+
+DEFINE_TEST(pipe_splice_tee, ([] {
+	int a[2], b[2];
+	assert(!pipe(a));
+	assert(!pipe(b));
+
+	assert(write(a[1], "hello world", 11) == 11);
+
+	// tee() duplicates the data without consuming it.
+	assert(tee(a[0], b[1], 5, 0) == 5);
+	char buf[16] = {};
+	assert(read(b[0], buf, sizeof(buf)) == 5);
+	assert(!memcmp(buf, "hello", 5));
+
+	// splice() moves the data.
+	assert(splice(a[0], nullptr, b[1], nullptr, 11, 0) == 11);
+	memset(buf, 0, sizeof(buf));
+	assert(read(b[0], buf, sizeof(buf)) == 11);
+	assert(!memcmp(buf, "hello world", 11));
+
+	// Empty pipes do not block with SPLICE_F_NONBLOCK.
+	assert(splice(a[0], nullptr, b[1], nullptr, 11, SPLICE_F_NONBLOCK) == -1);
+	assert(errno == EAGAIN);
+
+	close(a[0]);
+	close(a[1]);
+	close(b[0]);
+	close(b[1]);
+}))
+
+DEFINE_TEST(pipe_splice_file, ([] {
+	int fd = open("/tmp/posix-testsuite-splice", O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	assert(fd >= 0);
+
+	char data[10000];
+	for(size_t i = 0; i < sizeof(data); i++)
+		data[i] = i % 251;
+	assert(write(fd, data, sizeof(data)) == sizeof(data));
+
+	int fds[2];
+	assert(!pipe(fds));
+
+	// File to pipe, using an explicit offset.
+	loff_t off = 100;
+	assert(splice(fd, &off, fds[1], nullptr, 5000, 0) == 5000);
+	assert(off == 5100);
+
+	// Pipe back to the file at the end.
+	loff_t outOff = sizeof(data);
+	assert(splice(fds[0], nullptr, fd, &outOff, 5000, 0) == 5000);
+	assert(outOff == sizeof(data) + 5000);
+
+	char buf[5000];
+	assert(pread(fd, buf, sizeof(buf), sizeof(data)) == sizeof(buf));
+	assert(!memcmp(buf, data + 100, sizeof(buf)));
+
+	// Offsets are not allowed for pipes.
+	off = 0;
+	assert(splice(fds[0], &off, fd, nullptr, 1, 0) == -1);
+	assert(errno == ESPIPE);
+
+	close(fds[0]);
+	close(fds[1]);
+	close(fd);
+	assert(unlink("/tmp/posix-testsuite-splice") == 0);
+}))
+
+DEFINE_TEST(pipe_vmsplice, ([] {
+	int fds[2];
+	assert(!pipe(fds));
+
+	char first[] = "abc";
+	char second[] = "defgh";
+	iovec iov[2] = {{first, 3}, {second, 5}};
+	assert(vmsplice(fds[1], iov, 2, 0) == 8);
+
+	char buf[8];
+	iovec riov = {buf, sizeof(buf)};
+	assert(vmsplice(fds[0], &riov, 1, 0) == 8);
+	assert(!memcmp(buf, "abcdefgh", 8));
+
+	close(fds[0]);
+	close(fds[1]);
+}))
+
+#endif
@@ -5,6 +5,8 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
+#include <linux/filter.h>
+#include <linux/netlink.h>
 #include <netinet/in.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
@@ -12,8 +14,11 @@
 #include <sys/time.h>
 #include <sys/poll.h>
 #include <sys/un.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
+#include <vector>
+
 #include "testsuite.hpp"
 
 DEFINE_TEST(socket_accept_timeout, ([] {
@@ -134,6 +139,45 @@ DEFINE_TEST(socket_shutdown_rd, ([] {
 	close(fds[1]);
 }));
 
+DEFINE_TEST(socket_shutdown_stream_peer, ([] {
+	int fds[2];
+	int ret = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+	assert(!ret);
+
+	// A reader that is blocked when the peer shuts down its write side sees EOF.
+	pid_t child = fork();
+	assert(child >= 0);
+	if(!child) {
+		char c;
+		_exit(read(fds[1], &c, 1) == 0 ? 0 : 1);
+	}
+	usleep(100'000);
+	ret = shutdown(fds[0], SHUT_WR);
+	assert(!ret);
+
+	int status;
+	ret = waitpid(child, &status, 0);
+	assert(ret == child);
+	assert(WIFEXITED(status) && !WEXITSTATUS(status));
+
+	struct pollfd pfd;
+	pfd.fd = fds[1];
+	pfd.events = POLLIN | POLLOUT | POLLRDHUP | POLLHUP;
+	ret = poll(&pfd, 1, 0);
+	assert(ret == 1);
+	assert(pfd.revents == (POLLIN | POLLOUT | POLLRDHUP));
+
+	// The other direction still works.
+	ret = write(fds[1], "x", 1);
+	assert(ret == 1);
+	char c;
+	ret = read(fds[0], &c, 1);
+	assert(ret == 1);
+
+	close(fds[0]);
+	close(fds[1]);
+}));
+
 // From https://gist.github.com/netbsduser/b219af354dbe01083f7a1c57ac2c531a
 DEFINE_TEST(socket_msg_boundary, ([] {
 	int sock[2];
@@ -376,3 +420,217 @@ DEFINE_TEST(socket_connect_dgram, ([] {
 	close(server_fd);
 	unlink(server_addr.sun_path);
 }));
+
+DEFINE_TEST(socket_stream_coalesce, ([] {
+	int fds[2];
+	int ret = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+	assert(!ret);
+
+	for(int i = 0; i < 64; i++) {
+		char c = 'a' + (i % 26);
+		ret = write(fds[0], &c, 1);
+		assert(ret == 1);
+	}
+
+	int avail = 0;
+	ret = ioctl(fds[1], FIONREAD, &avail);
+	assert(!ret);
+	assert(avail == 64);
+
+	// Small writes must be readable in a single call.
+	char buf[128];
+	ret = read(fds[1], buf, sizeof(buf));
+	assert(ret == 64);
+	for(int i = 0; i < 64; i++)
+		assert(buf[i] == 'a' + (i % 26));
+
+	close(fds[0]);
+	close(fds[1]);
+}));
+
+DEFINE_TEST(socket_stream_coalesce_passcred, ([] {
+	int fds[2];
+	int ret = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+	assert(!ret);
+
+	int one = 1;
+	ret = setsockopt(fds[1], SOL_SOCKET, SO_PASSCRED, &one, sizeof(one));
+	assert(!ret);
+
+	// Data from write() and sendmsg() carries the same credentials.
+	ret = write(fds[0], "abc", 3);
+	assert(ret == 3);
+	struct iovec iov = {const_cast<char *>("def"), 3};
+	struct msghdr msg = {};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	ret = sendmsg(fds[0], &msg, 0);
+	assert(ret == 3);
+
+	char buf[16];
+	ret = read(fds[1], buf, sizeof(buf));
+	assert(ret == 6);
+	assert(!memcmp(buf, "abcdef", 6));
+
+	close(fds[0]);
+	close(fds[1]);
+}));
+
+DEFINE_TEST(socket_stream_backpressure, ([] {
+	int fds[2];
+	int ret = socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds);
+	assert(!ret);
+
+	int size = 16384;
+	ret = setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+	assert(!ret);
+	socklen_t len = sizeof(size);
+	ret = getsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, &len);
+	assert(!ret);
+	assert(size >= 16384);
+
+	// Fill the socket until the writer would block.
+	char buf[4096];
+	memset(buf, 'x', sizeof(buf));
+	size_t total = 0;
+	while(true) {
+		ret = write(fds[0], buf, sizeof(buf));
+		if(ret < 0) {
+			assert(errno == EAGAIN);
+			break;
+		}
+		total += ret;
+		assert(total < 16 * 1024 * 1024);
+	}
+	assert(total > 0);
+
+	struct pollfd pfd = {.fd = fds[0], .events = POLLOUT, .revents = 0};
+	ret = poll(&pfd, 1, 0);
+	assert(ret == 0);
+
+	// Draining the reader makes the writer writable again.
+	size_t drained = 0;
+	while(drained < total) {
+		ret = read(fds[1], buf, sizeof(buf));
+		assert(ret > 0);
+		drained += ret;
+	}
+
+	ret = poll(&pfd, 1, 0);
+	assert(ret == 1);
+	assert(pfd.revents & POLLOUT);
+
+	close(fds[0]);
+	close(fds[1]);
+}));
+
+// TODO: mlibc has no sysdeps for sendmmsg() and recvmmsg() on managarm yet.
+//       Enable this test once it does.
+#if defined(__linux__)
+
+DEFINE_TEST(socket_mmsg, ([] {
+	int fds[2];
+	int ret = socketpair(AF_UNIX, SOCK_DGRAM, 0, fds);
+	assert(!ret);
+
+	char out[3][8] = {"one", "two!", "three"};
+	struct iovec out_iovs[3];
+	struct mmsghdr out_msgs[3];
+	memset(out_msgs, 0, sizeof(out_msgs));
+	for(int i = 0; i < 3; i++) {
+		out_iovs[i].iov_base = out[i];
+		out_iovs[i].iov_len = strlen(out[i]);
+		out_msgs[i].msg_hdr.msg_iov = &out_iovs[i];
+		out_msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	ret = sendmmsg(fds[0], out_msgs, 3, 0);
+	assert(ret == 3);
+	for(int i = 0; i < 3; i++)
+		assert(out_msgs[i].msg_len == strlen(out[i]));
+
+	char in[4][8];
+	struct iovec in_iovs[4];
+	struct mmsghdr in_msgs[4];
+	memset(in_msgs, 0, sizeof(in_msgs));
+	for(int i = 0; i < 4; i++) {
+		in_iovs[i].iov_base = in[i];
+		in_iovs[i].iov_len = sizeof(in[i]);
+		in_msgs[i].msg_hdr.msg_iov = &in_iovs[i];
+		in_msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	// MSG_WAITFORONE only blocks for the first message.
+	ret = recvmmsg(fds[1], in_msgs, 4, MSG_WAITFORONE, nullptr);
+	assert(ret == 3);
+	for(int i = 0; i < 3; i++) {
+		assert(in_msgs[i].msg_len == strlen(out[i]));
+		assert(!memcmp(in[i], out[i], strlen(out[i])));
+	}
+
+	close(fds[0]);
+	close(fds[1]);
+}));
+
+#endif
+
+namespace {
+
+int attachFilter(int s, std::initializer_list<struct sock_filter> insns) {
+	std::vector<struct sock_filter> code{insns};
+	struct sock_fprog prog = {
+		.len = static_cast<unsigned short>(code.size()),
+		.filter = code.data(),
+	};
+	return setsockopt(s, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+}
+
+} // anonymous namespace
+
+DEFINE_TEST(socket_filter_verifier, ([] {
+	int s = socket(AF_NETLINK, SOCK_DGRAM, NETLINK_KOBJECT_UEVENT);
+	assert(s >= 0);
+
+	// Uses scratch memory, X-register jumps and the remaining ALU operations.
+	int ret = attachFilter(s, {
+		BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0),
+		BPF_STMT(BPF_ST, 0),
+		BPF_STMT(BPF_LDX | BPF_IMM, 8),
+		BPF_JUMP(BPF_JMP | BPF_JGE | BPF_X, 0, 0, 3),
+		BPF_STMT(BPF_ALU | BPF_MOD | BPF_X, 0),
+		BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 1),
+		BPF_JUMP(BPF_JMP | BPF_JGT | BPF_X, 1, 0, 0),
+		BPF_STMT(BPF_LD | BPF_MEM, 0),
+		BPF_STMT(BPF_RET | BPF_A, 0),
+	});
+	assert(!ret);
+
+	// Jump beyond the end of the program.
+	ret = attachFilter(s, {
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_X, 0, 1, 0),
+		BPF_STMT(BPF_RET | BPF_K, 0),
+	});
+	assert(ret == -1 && errno == EINVAL);
+
+	// Division by a zero constant.
+	ret = attachFilter(s, {
+		BPF_STMT(BPF_ALU | BPF_DIV | BPF_K, 0),
+		BPF_STMT(BPF_RET | BPF_A, 0),
+	});
+	assert(ret == -1 && errno == EINVAL);
+
+	// Scratch memory that is only written on one path.
+	ret = attachFilter(s, {
+		BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 1, 0, 1),
+		BPF_STMT(BPF_ST, 2),
+		BPF_STMT(BPF_LD | BPF_MEM, 2),
+		BPF_STMT(BPF_RET | BPF_A, 0),
+	});
+	assert(ret == -1 && errno == EINVAL);
+
+	// Program that does not end in a return.
+	ret = attachFilter(s, {
+		BPF_STMT(BPF_LD | BPF_IMM, 1),
+	});
+	assert(ret == -1 && errno == EINVAL);
+
+	close(s);
+}));